@@ -0,0 +1,116 @@
+/*
+ * AdmissionControl.h
+ *
+ *  Admission of the detection requests of the TCP services.
+ */
+
+#ifndef ADMISSIONCONTROL_H_
+#define ADMISSIONCONTROL_H_
+
+#include <QtCore/QMutex>
+#include <QtCore/QDateTime>
+
+// Bounds the number of detection requests waiting for a thread, and drops
+// or degrades the requests with a deadline (see TcpServer::kDeadline) when
+// the expected detection time does not fit in the time left. Expected times
+// are moving averages of the last detections. Thread-safe.
+class AdmissionControl
+{
+public:
+	enum Decision {kProcess, kDegrade, kDrop};
+
+	// maxQueue=0 means no bound. Without degraded mode (degradedMaxFeatures=0
+	// and degradedHomography=true), late requests are dropped.
+	AdmissionControl(int maxQueue = 0, int degradedMaxFeatures = 0, bool degradedHomography = true) :
+		maxQueue_(maxQueue),
+		degradedMaxFeatures_(degradedMaxFeatures),
+		degradedHomography_(degradedHomography),
+		waiting_(0),
+		accepted_(0),
+		rejected_(0),
+		dropped_(0),
+		degraded_(0),
+		expectedMs_(0),
+		expectedDegradedMs_(0)
+	{}
+
+	int maxQueue() const {return maxQueue_;}
+	int degradedMaxFeatures() const {return degradedMaxFeatures_;}
+	bool degradedHomography() const {return degradedHomography_;}
+	bool degradedMode() const {return degradedMaxFeatures_ > 0 || !degradedHomography_;}
+
+	// Called when a request is received, false if the queue is full
+	bool admit(bool bounded = true)
+	{
+		QMutexLocker locker(&mutex_);
+		if(bounded && maxQueue_ > 0 && waiting_ >= maxQueue_)
+		{
+			++rejected_;
+			return false;
+		}
+		++waiting_;
+		++accepted_;
+		return true;
+	}
+
+	// Called when a worker takes the request, deadline in ms since epoch (0 if none)
+	Decision start(qint64 deadline)
+	{
+		QMutexLocker locker(&mutex_);
+		--waiting_;
+		if(deadline <= 0)
+		{
+			return kProcess;
+		}
+		qint64 left = deadline - QDateTime::currentMSecsSinceEpoch();
+		if(left <= 0)
+		{
+			++dropped_;
+			return kDrop;
+		}
+		if(left >= expectedMs_)
+		{
+			return kProcess;
+		}
+		if(degradedMode() && left >= expectedDegradedMs_)
+		{
+			++degraded_;
+			return kDegrade;
+		}
+		++dropped_;
+		return kDrop;
+	}
+
+	// Called when the request is processed
+	void done(Decision decision, float ms)
+	{
+		QMutexLocker locker(&mutex_);
+		float & expected = decision==kDegrade?expectedDegradedMs_:expectedMs_;
+		expected = expected>0?0.9f*expected + 0.1f*ms:ms;
+	}
+
+	void stats(int & waiting, qint64 & accepted, qint64 & rejected, qint64 & dropped, qint64 & degraded) const
+	{
+		QMutexLocker locker(&mutex_);
+		waiting = waiting_;
+		accepted = accepted_;
+		rejected = rejected_;
+		dropped = dropped_;
+		degraded = degraded_;
+	}
+
+private:
+	int maxQueue_;
+	int degradedMaxFeatures_;
+	bool degradedHomography_;
+	mutable QMutex mutex_;
+	int waiting_; // admitted, not started yet
+	qint64 accepted_;
+	qint64 rejected_; // queue full
+	qint64 dropped_; // deadline missed
+	qint64 degraded_;
+	float expectedMs_; // full detection
+	float expectedDegradedMs_;
+};
+
+#endif /* ADMISSIONCONTROL_H_ */
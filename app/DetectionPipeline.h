@@ -0,0 +1,266 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DETECTIONPIPELINE_H_
+#define DETECTIONPIPELINE_H_
+
+#include <find_object/FindObject.h>
+#include <find_object/TcpServer.h>
+#include <find_object/Settings.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QObject>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QQueue>
+#include <QtCore/QByteArray>
+
+// Bounded queue between two stages of the pipeline. When it is full, the
+// oldest item is dropped (latency stays bounded under overload) or, if
+// dropOldest is false, the producer waits for a free slot.
+template<class T>
+class PipelineQueue
+{
+public:
+	PipelineQueue(int capacity, bool dropOldest) :
+		capacity_(capacity>0?capacity:1),
+		dropOldest_(dropOldest),
+		dropped_(0),
+		stopped_(false)
+	{}
+
+	// Return false if the queue is stopped
+	bool push(const T & item)
+	{
+		QMutexLocker locker(&mutex_);
+		while(!stopped_ && !dropOldest_ && queue_.size() >= capacity_)
+		{
+			notFull_.wait(&mutex_);
+		}
+		if(stopped_)
+		{
+			return false;
+		}
+		if(queue_.size() >= capacity_)
+		{
+			queue_.dequeue();
+			++dropped_;
+		}
+		queue_.enqueue(item);
+		notEmpty_.wakeOne();
+		return true;
+	}
+
+	// Wait for an item, return false if the queue is stopped
+	bool pop(T & item)
+	{
+		QMutexLocker locker(&mutex_);
+		while(!stopped_ && queue_.empty())
+		{
+			notEmpty_.wait(&mutex_);
+		}
+		if(stopped_)
+		{
+			return false;
+		}
+		item = queue_.dequeue();
+		notFull_.wakeOne();
+		return true;
+	}
+
+	void stop()
+	{
+		QMutexLocker locker(&mutex_);
+		stopped_ = true;
+		notEmpty_.wakeAll();
+		notFull_.wakeAll();
+	}
+
+	int dropped() const
+	{
+		QMutexLocker locker(&mutex_);
+		return dropped_;
+	}
+
+private:
+	mutable QMutex mutex_;
+	QWaitCondition notEmpty_;
+	QWaitCondition notFull_;
+	QQueue<T> queue_;
+	int capacity_;
+	bool dropOldest_;
+	int dropped_;
+	bool stopped_;
+};
+
+// Camera ---> [queue] ---> detection thread ---> [queue] ---> publishing thread
+//
+// Capture and decoding stay in the camera's thread, the detection and the
+// serialization of the results are done in their own thread, so that each
+// stage works on a different frame.
+class DetectionPipeline : public QObject
+{
+	Q_OBJECT;
+
+public:
+	DetectionPipeline(find_object::FindObject * findObject, int queueSize = 2, bool dropOldest = true, QObject * parent = 0) :
+		QObject(parent),
+		findObject_(findObject),
+		images_(queueSize, dropOldest),
+		results_(queueSize, dropOldest),
+		detectionThread_(this, &DetectionPipeline::detectionLoop),
+		publishingThread_(this, &DetectionPipeline::publishingLoop)
+	{
+		UASSERT(findObject != 0);
+		detectionThread_.start();
+		publishingThread_.start();
+	}
+
+	virtual ~DetectionPipeline()
+	{
+		stop();
+	}
+
+	void stop()
+	{
+		images_.stop();
+		results_.stop();
+		detectionThread_.wait();
+		publishingThread_.wait();
+		if(images_.dropped() || results_.dropped())
+		{
+			UINFO("Pipeline: %d frames dropped before detection, %d results dropped before publishing",
+					images_.dropped(), results_.dropped());
+		}
+	}
+
+public Q_SLOTS:
+	// Can be connected with Qt::DirectConnection from the camera's thread
+	void addImage(const cv::Mat & image)
+	{
+		images_.push(Frame(image, -1));
+	}
+	// Images of several streams (see find_object::Camera::streamId())
+	void addImage(const cv::Mat & image, int streamId)
+	{
+		images_.push(Frame(image, streamId));
+	}
+
+Q_SIGNALS:
+	// Emitted from the publishing thread
+	void objectsFound(const find_object::DetectionInfo &);
+	void dataPublished(const QByteArray &); // see find_object::TcpServer::serialize()
+
+private:
+	class StageThread : public QThread
+	{
+	public:
+		StageThread(DetectionPipeline * pipeline, void (DetectionPipeline::*loop)()) :
+			pipeline_(pipeline),
+			loop_(loop)
+		{}
+	protected:
+		virtual void run()
+		{
+			(pipeline_->*loop_)();
+		}
+	private:
+		DetectionPipeline * pipeline_;
+		void (DetectionPipeline::*loop_)();
+	};
+
+	struct Frame
+	{
+		Frame(const cv::Mat & image = cv::Mat(), int streamId = -1) : image(image), streamId(streamId) {}
+		cv::Mat image;
+		int streamId;
+	};
+
+	void detectionLoop()
+	{
+		Frame frame;
+		int lastStreamId = -1;
+		bool multiStreams = false;
+		while(images_.pop(frame))
+		{
+			// The objects are tracked in one stream only
+			if(!multiStreams && frame.streamId >= 0 && lastStreamId >= 0 && frame.streamId != lastStreamId)
+			{
+				UINFO("Pipeline: images of several streams, objects are not tracked between frames.");
+				multiStreams = true;
+			}
+			lastStreamId = frame.streamId;
+
+			find_object::DetectionInfo info;
+			if(multiStreams)
+			{
+				findObject_->detectUntracked(frame.image, info);
+			}
+			else
+			{
+				findObject_->detect(frame.image, info);
+			}
+			info.streamId_ = frame.streamId;
+			frame = Frame();
+			if(info.objDetected_.size() > 1)
+			{
+				UINFO("%d objects detected! (%d ms)", (int)info.objDetected_.size(), (int)info.timeStamps_.value(find_object::DetectionInfo::kTimeTotal));
+			}
+			else if(info.objDetected_.size() == 1)
+			{
+				UINFO("Object %d detected! (%d ms)", (int)info.objDetected_.begin().key(), (int)info.timeStamps_.value(find_object::DetectionInfo::kTimeTotal));
+			}
+			else if(!find_object::Settings::getGeneral_sendNoObjDetectedEvents())
+			{
+				continue;
+			}
+			if(!results_.push(info))
+			{
+				break;
+			}
+		}
+	}
+
+	void publishingLoop()
+	{
+		find_object::DetectionInfo info;
+		while(results_.pop(info))
+		{
+			Q_EMIT objectsFound(info);
+			Q_EMIT dataPublished(find_object::TcpServer::serialize(info, find_object::Settings::getGeneral_portResultFormat()));
+		}
+	}
+
+private:
+	find_object::FindObject * findObject_;
+	PipelineQueue<Frame> images_;
+	PipelineQueue<find_object::DetectionInfo> results_;
+	StageThread detectionThread_;
+	StageThread publishingThread_;
+};
+
+#endif /* DETECTIONPIPELINE_H_ */
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef JSONLINESWRITER_H_
+#define JSONLINESWRITER_H_
+
+#include <find_object/JsonWriter.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QThread>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QDateTime>
+
+// Appends a JSON line per frame detected (see JsonWriter::line()) to a
+// file. Lines are formatted by the detecting threads and written by a
+// background thread, they don't wait for the disk. Lines are dropped
+// (and counted) when more than maxPendingBytes are waiting.
+class JsonLinesWriter : public QThread
+{
+	Q_OBJECT;
+
+public:
+	JsonLinesWriter(const QString & path, int maxPendingBytes = 16*1024*1024, QObject * parent = 0) :
+		QThread(parent),
+		file_(path),
+		maxPendingBytes_(maxPendingBytes),
+		dropped_(0),
+		stopping_(false)
+	{
+		if(!file_.open(QIODevice::WriteOnly | QIODevice::Append))
+		{
+			UERROR("Unable to open \"%s\": %s", path.toStdString().c_str(), file_.errorString().toStdString().c_str());
+			return;
+		}
+		UINFO("JSON lines appended to \"%s\"", path.toStdString().c_str());
+		this->start();
+	}
+	virtual ~JsonLinesWriter()
+	{
+		{
+			QMutexLocker locker(&mutex_);
+			stopping_ = true;
+			pendingCondition_.wakeOne();
+		}
+		this->wait(); // the lines waiting are written
+		file_.close();
+	}
+
+	bool isOpen() const {return file_.isOpen();}
+
+public Q_SLOTS:
+	// Can be connected with Qt::DirectConnection from any thread
+	void addDetection(const find_object::DetectionInfo & info)
+	{
+		if(!file_.isOpen())
+		{
+			return;
+		}
+		QByteArray line = find_object::JsonWriter::line(info, QDateTime::currentMSecsSinceEpoch());
+		QMutexLocker locker(&mutex_);
+		if(pending_.size() + line.size() > maxPendingBytes_)
+		{
+			++dropped_;
+			return;
+		}
+		pending_ += line;
+		pendingCondition_.wakeOne();
+	}
+
+protected:
+	virtual void run()
+	{
+		QByteArray lines;
+		bool stopping = false;
+		while(!stopping)
+		{
+			int dropped;
+			{
+				QMutexLocker locker(&mutex_);
+				while(pending_.isEmpty() && !stopping_)
+				{
+					pendingCondition_.wait(&mutex_);
+				}
+				stopping = stopping_;
+				lines.swap(pending_);
+				dropped = dropped_;
+				dropped_ = 0;
+			}
+			if(dropped)
+			{
+				UWARN("%d JSON lines dropped (writing to \"%s\" is too slow)", dropped, file_.fileName().toStdString().c_str());
+			}
+			if(!lines.isEmpty())
+			{
+				// all the lines waiting in a single write
+				if(file_.write(lines) != lines.size())
+				{
+					UERROR("Error writing to \"%s\": %s", file_.fileName().toStdString().c_str(), file_.errorString().toStdString().c_str());
+				}
+				file_.flush();
+				lines.clear();
+			}
+		}
+	}
+
+private:
+	QFile file_;
+	int maxPendingBytes_;
+	QMutex mutex_;
+	QWaitCondition pendingCondition_;
+	QByteArray pending_;
+	int dropped_;
+	bool stopping_;
+};
+
+#endif /* JSONLINESWRITER_H_ */
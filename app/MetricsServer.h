@@ -0,0 +1,144 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef METRICSSERVER_H_
+#define METRICSSERVER_H_
+
+#include <find_object/DetectionMetrics.h>
+#include <find_object/FindObject.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtNetwork/QTcpServer>
+#include <QtNetwork/QTcpSocket>
+#include <QtCore/QAtomicInt>
+
+// Minimal HTTP server publishing the detection metrics
+// in Prometheus text format on "GET /metrics", and the costs
+// of the objects in CSV on "GET /objects" and the memory used by the
+// objects, the vocabulary and the index on "GET /memory" (see setFindObject()).
+// "GET /ready" answers 200 when ready to detect, 503 while warming up.
+class MetricsServer : public QTcpServer
+{
+	Q_OBJECT;
+
+public:
+	MetricsServer(quint16 port, QObject * parent = 0) :
+		QTcpServer(parent),
+		findObject_(0),
+		ready_(1)
+	{
+		if (!this->listen(QHostAddress::Any, port))
+		{
+			UERROR("Unable to start the metrics server: %s", this->errorString().toStdString().c_str());
+			return;
+		}
+		UINFO("Metrics published on http://localhost:%d/metrics", (int)this->serverPort());
+		connect(this, SIGNAL(newConnection()), this, SLOT(addClient()));
+	}
+
+	const find_object::DetectionMetrics & metrics() const {return metrics_;}
+	void setFindObject(const find_object::FindObject * findObject) {findObject_ = findObject;}
+
+public Q_SLOTS:
+	// Can be connected with Qt::DirectConnection from any thread
+	void addDetection(const find_object::DetectionInfo & info)
+	{
+		metrics_.add(info);
+	}
+	void setQueue(int depth, qint64 accepted, qint64 rejected, qint64 dropped, qint64 degraded)
+	{
+		metrics_.setQueue(depth, accepted, rejected, dropped, degraded);
+	}
+	void setReady(bool ready)
+	{
+		ready_.fetchAndStoreOrdered(ready?1:0);
+	}
+
+private Q_SLOTS:
+	void addClient()
+	{
+		while(this->hasPendingConnections())
+		{
+			QTcpSocket * client = this->nextPendingConnection();
+			connect(client, SIGNAL(readyRead()), this, SLOT(readRequest()));
+			connect(client, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+		}
+	}
+
+	void readRequest()
+	{
+		QTcpSocket * client = (QTcpSocket*)sender();
+		if(!client->canReadLine())
+		{
+			return;
+		}
+		// Request line: "GET /metrics HTTP/1.1", headers are ignored
+		QList<QByteArray> request = client->readLine().trimmed().split(' ');
+		client->readAll();
+
+		QByteArray status;
+		QByteArray body;
+		if(request.size() >= 2 && request[0] == "GET" && (request[1] == "/metrics" || request[1] == "/"))
+		{
+			status = "200 OK";
+			body = metrics_.toPrometheus().toUtf8();
+		}
+		else if(request.size() >= 2 && request[0] == "GET" && request[1] == "/ready")
+		{
+			bool ready = ready_.fetchAndAddAcquire(0) != 0;
+			status = ready?"200 OK":"503 Service Unavailable";
+			body = ready?"ready\n":"warming up\n";
+		}
+		else if(request.size() >= 2 && request[0] == "GET" && request[1] == "/memory" && findObject_)
+		{
+			status = "200 OK";
+			body = findObject_->memoryUsageReport().toUtf8();
+		}
+		else if(request.size() >= 2 && request[0] == "GET" && request[1] == "/objects" && findObject_)
+		{
+			status = "200 OK";
+			body = findObject_->objectCostsReport().toUtf8();
+		}
+		else
+		{
+			status = "404 Not Found";
+			body = findObject_?"Not found, metrics are on /metrics, /objects and /memory\n":"Not found, metrics are on /metrics\n";
+		}
+		QByteArray response = "HTTP/1.0 " + status + "\r\n"
+				"Content-Type: text/plain; version=0.0.4\r\n"
+				"Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+				"Connection: close\r\n\r\n" + body;
+		client->write(response);
+		client->disconnectFromHost();
+	}
+
+private:
+	find_object::DetectionMetrics metrics_;
+	const find_object::FindObject * findObject_;
+	QAtomicInt ready_;
+};
+
+#endif /* METRICSSERVER_H_ */
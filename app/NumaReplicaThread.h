@@ -0,0 +1,104 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NUMAREPLICATHREAD_H_
+#define NUMAREPLICATHREAD_H_
+
+#include <find_object/FindObject.h>
+#include <find_object/utilite/ULogger.h>
+#include "NumaTopology.h"
+#include <QtCore/QThread>
+#include <QtCore/QTime>
+
+// Copy of a FindObject (see FindObject::replicate()) created from a thread
+// pinned on a NUMA node: its objects, vocabulary and index are allocated on
+// the node, and the threads of its pool are pinned on the node too (the
+// affinity is inherited). The copy is warmed up (see FindObject::warmUp())
+// before the thread exits, then it belongs to the thread that created
+// this one.
+class NumaReplicaThread : public QThread
+{
+public:
+	NumaReplicaThread(const NumaTopology & numa, int node, const find_object::FindObject * source, bool keepImagesInRAM, int warmUpIterations) :
+		numa_(numa),
+		node_(node),
+		source_(source),
+		keepImagesInRAM_(keepImagesInRAM),
+		warmUpIterations_(warmUpIterations),
+		ownerThread_(QThread::currentThread()),
+		replica_(0)
+	{
+		UASSERT(source != 0);
+	}
+	virtual ~NumaReplicaThread()
+	{
+		delete replica_;
+	}
+
+	// The caller owns the copy, 0 if it failed
+	find_object::FindObject * takeReplica()
+	{
+		find_object::FindObject * replica = replica_;
+		replica_ = 0;
+		return replica;
+	}
+
+protected:
+	virtual void run()
+	{
+		QTime time;
+		time.start();
+		numa_.pinCurrentThread(node_);
+		find_object::FindObject * replica = new find_object::FindObject(keepImagesInRAM_);
+		replica->moveToThread(ownerThread_);
+		if(replica->replicate(*source_))
+		{
+			if(warmUpIterations_ > 0)
+			{
+				replica->warmUp(warmUpIterations_);
+			}
+			UINFO("Objects copied on NUMA node %d (%d objects, %d ms)", node_, replica->objects().size(), time.elapsed());
+			replica_ = replica;
+		}
+		else
+		{
+			UERROR("Failed to copy the objects on NUMA node %d", node_);
+			delete replica;
+		}
+	}
+
+private:
+	const NumaTopology & numa_;
+	int node_;
+	const find_object::FindObject * source_;
+	bool keepImagesInRAM_;
+	int warmUpIterations_;
+	QThread * ownerThread_;
+	find_object::FindObject * replica_;
+};
+
+#endif /* NUMAREPLICATHREAD_H_ */
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef NUMATOPOLOGY_H_
+#define NUMATOPOLOGY_H_
+
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+#include <algorithm>
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+// NUMA nodes having CPUs and their CPUs, read from /sys/devices/system/node
+// on Linux (a single node elsewhere or without the information). A thread
+// pinned on the CPUs of a node gets its memory allocated on this node
+// (first touch), see TcpServerPool with a FindObject per node.
+class NumaTopology
+{
+public:
+	NumaTopology()
+	{
+#ifdef __linux__
+		QDir dir("/sys/devices/system/node");
+		QStringList nodes = dir.entryList(QStringList("node*"), QDir::Dirs);
+		QVector<int> ids;
+		for(int i=0; i<nodes.size(); ++i)
+		{
+			bool ok = false;
+			int id = nodes[i].mid(4).toInt(&ok);
+			if(ok)
+			{
+				ids.push_back(id);
+			}
+		}
+		std::sort(ids.begin(), ids.end());
+		for(int i=0; i<ids.size(); ++i)
+		{
+			QFile file(dir.filePath(QString("node%1/cpulist").arg(ids[i])));
+			if(file.open(QIODevice::ReadOnly))
+			{
+				QVector<int> cpus = parseCpuList(QString(file.readAll()).trimmed());
+				if(cpus.size())
+				{
+					cpus_.push_back(cpus);
+				}
+			}
+		}
+#endif
+		if(cpus_.isEmpty())
+		{
+			cpus_.push_back(QVector<int>());
+		}
+	}
+
+	int nodes() const {return cpus_.size();}
+	// Empty if unknown
+	const QVector<int> & cpus(int node) const {return cpus_[node];}
+
+	// Restricts the calling thread to the CPUs of the node
+	bool pinCurrentThread(int node) const
+	{
+		UASSERT(node >= 0 && node < nodes());
+#ifdef __linux__
+		if(cpus_[node].size())
+		{
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			for(int i=0; i<cpus_[node].size(); ++i)
+			{
+				CPU_SET(cpus_[node][i], &set);
+			}
+			if(sched_setaffinity(0, sizeof(set), &set) == 0)
+			{
+				return true;
+			}
+			UWARN("Failed to pin thread on the CPUs of NUMA node %d", node);
+		}
+#endif
+		return false;
+	}
+
+private:
+	// "0-7,16-23"
+	static QVector<int> parseCpuList(const QString & list)
+	{
+		QVector<int> cpus;
+		QStringList ranges = list.split(',', QString::SkipEmptyParts);
+		for(int i=0; i<ranges.size(); ++i)
+		{
+			QStringList bounds = ranges[i].split('-');
+			int first = bounds.first().toInt();
+			int last = bounds.last().toInt();
+			for(int cpu=first; cpu<=last; ++cpu)
+			{
+				cpus.push_back(cpu);
+			}
+		}
+		return cpus;
+	}
+
+private:
+	QVector<QVector<int> > cpus_;
+};
+
+#endif /* NUMATOPOLOGY_H_ */
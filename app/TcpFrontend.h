@@ -0,0 +1,294 @@
+/*
+ * TcpFrontend.h
+ *
+ *  Single port TCP service: the connections are handled on one I/O
+ *  thread and the requests are processed by a shared pool of
+ *  detection threads through a bounded queue.
+ */
+
+#ifndef TCPFRONTEND_H_
+#define TCPFRONTEND_H_
+
+#include <find_object/FindObject.h>
+#include <find_object/TcpServer.h>
+#include <find_object/utilite/ULogger.h>
+#include "AdmissionControl.h"
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QRunnable>
+#include <QtCore/QTime>
+
+class TcpFrontend;
+
+struct FrontendRequest
+{
+	enum Type {kDetect, kDetectFeatures, kAddObject, kRemoveObject};
+
+	FrontendRequest(Type t, qint64 ticket = -1) :
+		type(t),
+		id(0),
+		ticket(ticket),
+		deadline(0)
+	{}
+
+	Type type;
+	cv::Mat image;
+	std::vector<cv::KeyPoint> keypoints;
+	cv::Mat descriptors;
+	cv::Size imageSize;
+	int id;
+	QString filePath;
+	qint64 ticket; // request with ID, -1 if the result is published to all clients
+	qint64 deadline; // ms since epoch, 0 if none
+};
+
+class FrontendTask : public QRunnable
+{
+public:
+	FrontendTask(TcpFrontend * frontend, const FrontendRequest & request) :
+		frontend_(frontend),
+		request_(request)
+	{}
+	virtual void run();
+
+private:
+	TcpFrontend * frontend_;
+	FrontendRequest request_;
+};
+
+// Contrary to TcpServerPool (a server per thread, each on its own port),
+// all clients connect to the same port and any idle detection thread takes
+// the next request. When "queueSize" detections are already waiting, new
+// detections are rejected: requests with ID are answered with a failed
+// status, the others are dropped. Add/Remove requests are never rejected,
+// they are applied one at a time in the order received, by a thread of
+// their own outside the admission control.
+// Requests with a deadline are dropped or degraded by AdmissionControl.
+// The frames of the clients are detected untracked (see FindObject::detectUntracked()).
+class TcpFrontend : public QObject
+{
+	Q_OBJECT;
+
+public:
+	TcpFrontend(find_object::FindObject * sharedFindObject, int threads, int port, int queueSize, int degradedMaxFeatures = 0, bool degradedHomography = true) :
+		sharedFindObject_(sharedFindObject),
+		admission_(queueSize, degradedMaxFeatures, degradedHomography)
+	{
+		UASSERT(sharedFindObject != 0);
+		UASSERT(threads>=1);
+		UASSERT(queueSize>=1);
+
+		qRegisterMetaType<cv::Mat>("cv::Mat");
+		qRegisterMetaType<qint64>("qint64");
+
+		detectionPool_.setMaxThreadCount(threads);
+		updatePool_.setMaxThreadCount(1);
+
+		server_ = new find_object::TcpServer(port);
+		server_->setGrayscaleDecoding(true); // no GUI
+		objectsFoundFields_ = server_->usedFields(); // the metrics don't use them
+		UINFO("TcpServer set on port: %d (IP=%s), %d detection threads, queue of %d requests",
+				server_->getPort(),
+				server_->getHostAddress().toString().toStdString().c_str(),
+				threads,
+				queueSize);
+
+		ioThread_ = new QThread(this);
+		server_->moveToThread(ioThread_);
+		connect(ioThread_, SIGNAL(finished()), server_, SLOT(deleteLater()));
+
+		// Requests are queued directly from the I/O thread
+		QObject::connect(server_, SIGNAL(detectObject(const cv::Mat &)), this, SLOT(detect(const cv::Mat &)), Qt::DirectConnection);
+		QObject::connect(server_, SIGNAL(detectObject(const cv::Mat &, qint64, qint64)), this, SLOT(detect(const cv::Mat &, qint64, qint64)), Qt::DirectConnection);
+		QObject::connect(server_, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)), this, SLOT(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)), Qt::DirectConnection);
+		QObject::connect(server_, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)), this, SLOT(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)), Qt::DirectConnection);
+		QObject::connect(server_, SIGNAL(addObject(const cv::Mat &, int, const QString &)), this, SLOT(addObject(const cv::Mat &, int, const QString &)), Qt::DirectConnection);
+		QObject::connect(server_, SIGNAL(removeObject(int)), this, SLOT(removeObject(int)), Qt::DirectConnection);
+
+		// Results are sent back on the I/O thread
+		QObject::connect(this, SIGNAL(detectionPublished(find_object::DetectionInfo)), server_, SLOT(publishDetectionInfo(find_object::DetectionInfo)));
+		QObject::connect(this, SIGNAL(requestDone(find_object::DetectionInfo, qint64, bool)), server_, SLOT(publishResult(find_object::DetectionInfo, qint64, bool)));
+		QObject::connect(this, SIGNAL(requestRejected(qint64)), server_, SLOT(rejectRequest(qint64)));
+		QObject::connect(this, SIGNAL(publishData(const QByteArray &)), server_, SLOT(publishData(const QByteArray &)));
+
+		ioThread_->start();
+	}
+
+	virtual ~TcpFrontend()
+	{
+		// no new requests, then wait for those queued
+		ioThread_->quit();
+		ioThread_->wait();
+		detectionPool_.waitForDone();
+		updatePool_.waitForDone();
+	}
+
+	const AdmissionControl & admission() const {return admission_;}
+
+	// Called from the detection pool, or the update pool for Add/Remove requests
+	void process(const FrontendRequest & request)
+	{
+		if(request.type == FrontendRequest::kAddObject)
+		{
+			UINFO("Thread %p adding object %d (%s)...", (void *)QThread::currentThread(), request.id, request.filePath.toStdString().c_str());
+			sharedFindObject_->addObjectAndUpdate(request.image, request.id, request.filePath);
+			return;
+		}
+		if(request.type == FrontendRequest::kRemoveObject)
+		{
+			UINFO("Thread %p removing object %d...", (void *)QThread::currentThread(), request.id);
+			sharedFindObject_->removeObjectAndUpdate(request.id);
+			return;
+		}
+
+		AdmissionControl::Decision decision = admission_.start(request.deadline);
+		emitQueueChanged();
+
+		if(decision == AdmissionControl::kDrop)
+		{
+			// only requests with ID have a deadline
+			UDEBUG("Request %lld dropped, its deadline cannot be met", request.ticket);
+			Q_EMIT requestRejected(request.ticket);
+			return;
+		}
+
+		QTime time;
+		time.start();
+		find_object::DetectionInfo info;
+		bool degraded = decision == AdmissionControl::kDegrade;
+		if(request.type == FrontendRequest::kDetect)
+		{
+			UDEBUG("Thread %p detecting%s...", (void *)QThread::currentThread(), degraded?" (degraded)":"");
+			if(degraded)
+			{
+				sharedFindObject_->detectDegraded(request.image, info, admission_.degradedMaxFeatures(), admission_.degradedHomography());
+			}
+			else
+			{
+				sharedFindObject_->detectUntracked(request.image, info);
+			}
+		}
+		else
+		{
+			UDEBUG("Thread %p detecting (%d features)%s...", (void *)QThread::currentThread(), (int)request.keypoints.size(), degraded?" (degraded)":"");
+			if(degraded)
+			{
+				sharedFindObject_->detectDegraded(request.keypoints, request.descriptors, request.imageSize, info, admission_.degradedHomography());
+			}
+			else
+			{
+				sharedFindObject_->detectUntracked(request.keypoints, request.descriptors, request.imageSize, info);
+			}
+		}
+		admission_.done(decision, time.elapsed());
+		info.release(find_object::DetectionInfo::kAllFields & ~objectsFoundFields_);
+		if(request.ticket >= 0)
+		{
+			Q_EMIT requestDone(info, request.ticket, degraded);
+		}
+		else
+		{
+			Q_EMIT detectionPublished(info);
+		}
+		Q_EMIT objectsFound(info);
+	}
+
+public Q_SLOTS:
+	// Answer of the readiness service (TcpServer::kReadiness), thread-safe
+	void setReady(bool ready)
+	{
+		server_->setReady(ready);
+	}
+
+private Q_SLOTS:
+	void detect(const cv::Mat & image)
+	{
+		FrontendRequest request(FrontendRequest::kDetect);
+		request.image = image;
+		enqueue(request);
+	}
+	void detect(const cv::Mat & image, qint64 ticket, qint64 deadline)
+	{
+		FrontendRequest request(FrontendRequest::kDetect, ticket);
+		request.image = image;
+		request.deadline = deadline;
+		enqueue(request);
+	}
+	void detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize)
+	{
+		detectFeatures(keypoints, descriptors, imageSize, -1, 0);
+	}
+	void detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline)
+	{
+		FrontendRequest request(FrontendRequest::kDetectFeatures, ticket);
+		request.deadline = deadline;
+		request.keypoints = keypoints;
+		request.descriptors = descriptors;
+		request.imageSize = imageSize;
+		enqueue(request);
+	}
+	void addObject(const cv::Mat & image, int id, const QString & filePath)
+	{
+		FrontendRequest request(FrontendRequest::kAddObject);
+		request.image = image;
+		request.id = id;
+		request.filePath = filePath;
+		updatePool_.start(new FrontendTask(this, request));
+	}
+	void removeObject(int id)
+	{
+		FrontendRequest request(FrontendRequest::kRemoveObject);
+		request.id = id;
+		updatePool_.start(new FrontendTask(this, request));
+	}
+
+Q_SIGNALS:
+	void objectsFound(const find_object::DetectionInfo &); // emitted from the detection threads
+	void publishData(const QByteArray &); // sent to all clients, see TcpServer::serialize()
+	void queueChanged(int, qint64, qint64, qint64, qint64); // depth, accepted, rejected, dropped, degraded
+	void detectionPublished(const find_object::DetectionInfo &);
+	void requestDone(const find_object::DetectionInfo &, qint64, bool); // info, ticket, degraded
+	void requestRejected(qint64);
+
+private:
+	void enqueue(const FrontendRequest & request)
+	{
+		if(admission_.admit())
+		{
+			detectionPool_.start(new FrontendTask(this, request));
+		}
+		else
+		{
+			UDEBUG("Detection queue full (%d requests), request rejected", admission_.maxQueue());
+			if(request.ticket >= 0)
+			{
+				Q_EMIT requestRejected(request.ticket);
+			}
+		}
+		emitQueueChanged();
+	}
+
+	void emitQueueChanged()
+	{
+		int depth;
+		qint64 accepted, rejected, dropped, degraded;
+		admission_.stats(depth, accepted, rejected, dropped, degraded);
+		Q_EMIT queueChanged(depth, accepted, rejected, dropped, degraded);
+	}
+
+private:
+	find_object::FindObject * sharedFindObject_; //shared findobject
+	find_object::TcpServer * server_;
+	QThread * ioThread_;
+	QThreadPool detectionPool_;
+	QThreadPool updatePool_; // Add/Remove requests, in order
+	AdmissionControl admission_;
+	int objectsFoundFields_; // heavy fields of DetectionInfo sent to the clients
+};
+
+inline void FrontendTask::run()
+{
+	frontend_->process(request_);
+}
+
+#endif /* TCPFRONTEND_H_ */
@@ -11,8 +11,47 @@
 #include <find_object/FindObject.h>
 #include <find_object/TcpServer.h>
 #include <find_object/utilite/ULogger.h>
+#include "AdmissionControl.h"
+#include "NumaTopology.h"
 #include <QtCore/QThread>
 #include <QtCore/QSemaphore>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadPool>
+#include <QtCore/QRunnable>
+#include <QtCore/QTime>
+
+class FindObjectWorker;
+
+// Detection of a request with ID, outstanding requests of
+// a connection are processed concurrently in the request pool
+class RequestTask : public QRunnable
+{
+public:
+	RequestTask(FindObjectWorker * worker, const cv::Mat & image, qint64 ticket, qint64 deadline) :
+		worker_(worker),
+		image_(image),
+		ticket_(ticket),
+		deadline_(deadline)
+	{}
+	RequestTask(FindObjectWorker * worker, const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline) :
+		worker_(worker),
+		keypoints_(keypoints),
+		descriptors_(descriptors),
+		imageSize_(imageSize),
+		ticket_(ticket),
+		deadline_(deadline)
+	{}
+	virtual void run();
+
+private:
+	FindObjectWorker * worker_;
+	cv::Mat image_;
+	std::vector<cv::KeyPoint> keypoints_;
+	cv::Mat descriptors_;
+	cv::Size imageSize_;
+	qint64 ticket_;
+	qint64 deadline_;
+};
 
 class FindObjectWorker : public QObject
 {
@@ -23,15 +62,96 @@ public:
 			find_object::FindObject * sharedFindObject,
 			QSemaphore * sharedSemaphore,
 			int maxSemaphoreResources,
+			QThreadPool * requestPool,
+			AdmissionControl * admission,
 			QObject * parent = 0) :
 		QObject(parent),
 		sharedFindObject_(sharedFindObject),
 		sharedSemaphore_(sharedSemaphore),
-		maxSemaphoreResources_(maxSemaphoreResources)
+		maxSemaphoreResources_(maxSemaphoreResources),
+		requestPool_(requestPool),
+		admission_(admission),
+		objectsFoundFields_(find_object::DetectionInfo::kAllFields),
+		numa_(0),
+		numaNode_(0),
+		nodesUpdateMutex_(0)
 	{
 		UASSERT(sharedFindObject != 0);
 		UASSERT(sharedSemaphore != 0);
 		UASSERT(maxSemaphoreResources > 0);
+		UASSERT(requestPool != 0);
+		UASSERT(admission != 0);
+	}
+
+	// Heavy fields (DetectionInfo::Field flags) kept in the detections emitted
+	void setObjectsFoundFields(int fields) {objectsFoundFields_ = fields;}
+
+	// The thread of the worker and the request threads are pinned on the
+	// CPUs of the node (see pin()), sharedFindObject is the copy of the
+	// node. Objects added or removed are updated in the copies of all
+	// nodes, in the same order by all workers (same IDs generated).
+	void setNumaNode(const NumaTopology * numa, int node, const QVector<find_object::FindObject*> & nodeFindObjects, QMutex * nodesUpdateMutex)
+	{
+		UASSERT(numa != 0 && nodesUpdateMutex != 0);
+		numa_ = numa;
+		numaNode_ = node;
+		nodeFindObjects_ = nodeFindObjects;
+		nodesUpdateMutex_ = nodesUpdateMutex;
+	}
+	void pinRequestThread()
+	{
+		if(numa_)
+		{
+			// a system call per request, the pool threads are not ours
+			numa_->pinCurrentThread(numaNode_);
+		}
+	}
+
+	// Called from the request pool
+	void detectRequest(const cv::Mat & image, const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline)
+	{
+		sharedSemaphore_->acquire(1);
+		AdmissionControl::Decision decision = admission_->start(deadline);
+		Q_EMIT queueChanged();
+		if(decision == AdmissionControl::kDrop)
+		{
+			UDEBUG("Request %lld dropped, its deadline cannot be met", ticket);
+			Q_EMIT requestRejected(ticket);
+			sharedSemaphore_->release(1);
+			return;
+		}
+		QTime time;
+		time.start();
+		find_object::DetectionInfo info;
+		bool degraded = decision == AdmissionControl::kDegrade;
+		if(!image.empty())
+		{
+			UDEBUG("Thread %p detecting request %lld%s...", (void *)QThread::currentThread(), ticket, degraded?" (degraded)":"");
+			if(degraded)
+			{
+				sharedFindObject_->detectDegraded(image, info, admission_->degradedMaxFeatures(), admission_->degradedHomography());
+			}
+			else
+			{
+				sharedFindObject_->detectUntracked(image, info);
+			}
+		}
+		else
+		{
+			UDEBUG("Thread %p detecting request %lld (%d features)%s...", (void *)QThread::currentThread(), ticket, (int)keypoints.size(), degraded?" (degraded)":"");
+			if(degraded)
+			{
+				sharedFindObject_->detectDegraded(keypoints, descriptors, imageSize, info, admission_->degradedHomography());
+			}
+			else
+			{
+				sharedFindObject_->detectUntracked(keypoints, descriptors, imageSize, info);
+			}
+		}
+		admission_->done(decision, time.elapsed());
+		info.release(find_object::DetectionInfo::kAllFields & ~objectsFoundFields_);
+		Q_EMIT requestDone(info, ticket, degraded);
+		sharedSemaphore_->release(1);
 	}
 
 public Q_SLOTS:
@@ -40,59 +160,177 @@ public Q_SLOTS:
 		sharedSemaphore_->acquire(1);
 		UINFO("Thread %p detecting...", (void *)this->thread());
 		find_object::DetectionInfo info;
-		sharedFindObject_->detect(image, info);
+		sharedFindObject_->detectUntracked(image, info);
+		info.release(find_object::DetectionInfo::kAllFields & ~objectsFoundFields_);
 		Q_EMIT objectsFound(info);
 		sharedSemaphore_->release(1);
 	}
 
+	void detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize)
+	{
+		sharedSemaphore_->acquire(1);
+		UINFO("Thread %p detecting (%d features)...", (void *)this->thread(), (int)keypoints.size());
+		find_object::DetectionInfo info;
+		sharedFindObject_->detectUntracked(keypoints, descriptors, imageSize, info);
+		info.release(find_object::DetectionInfo::kAllFields & ~objectsFoundFields_);
+		Q_EMIT objectsFound(info);
+		sharedSemaphore_->release(1);
+	}
+
+	// Rejected when the queue of the requests with ID is full (see AdmissionControl)
+	void detectWithId(const cv::Mat & image, qint64 ticket, qint64 deadline)
+	{
+		if(admit(ticket))
+		{
+			requestPool_->start(new RequestTask(this, image, ticket, deadline));
+		}
+	}
+
+	void detectFeaturesWithId(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline)
+	{
+		if(admit(ticket))
+		{
+			requestPool_->start(new RequestTask(this, keypoints, descriptors, imageSize, ticket, deadline));
+		}
+	}
+
 	void addObjectAndUpdate(const cv::Mat & image, int id, const QString & filePath)
 	{
-		//block everyone!
-		sharedSemaphore_->acquire(maxSemaphoreResources_);
+		// Detections on the other threads are only blocked while
+		// the updated objects and vocabulary are swapped in
+		sharedSemaphore_->acquire(1);
 		UINFO("Thread %p adding object %d (%s)...", (void *)this->thread(), id, filePath.toStdString().c_str());
-		sharedFindObject_->addObjectAndUpdate(image, id, filePath);
-		sharedSemaphore_->release(maxSemaphoreResources_);
+		if(nodeFindObjects_.isEmpty())
+		{
+			sharedFindObject_->addObjectAndUpdate(image, id, filePath);
+		}
+		else
+		{
+			QMutexLocker locker(nodesUpdateMutex_);
+			for(int i=0; i<nodeFindObjects_.size(); ++i)
+			{
+				nodeFindObjects_[i]->addObjectAndUpdate(image, id, filePath);
+			}
+		}
+		sharedSemaphore_->release(1);
 	}
 	void removeObjectAndUpdate(int id)
 	{
-		//block everyone!
-		sharedSemaphore_->acquire(maxSemaphoreResources_);
+		sharedSemaphore_->acquire(1);
 		UINFO("Thread %p removing object %d...", (void *)this->thread(), id);
-		sharedFindObject_->removeObjectAndUpdate(id);
-		sharedSemaphore_->release(maxSemaphoreResources_);
+		if(nodeFindObjects_.isEmpty())
+		{
+			sharedFindObject_->removeObjectAndUpdate(id);
+		}
+		else
+		{
+			QMutexLocker locker(nodesUpdateMutex_);
+			for(int i=0; i<nodeFindObjects_.size(); ++i)
+			{
+				nodeFindObjects_[i]->removeObjectAndUpdate(id);
+			}
+		}
+		sharedSemaphore_->release(1);
+	}
+
+	// Connected to QThread::started() (direct connection, called by the thread)
+	void pin()
+	{
+		if(numa_ && numa_->pinCurrentThread(numaNode_))
+		{
+			UINFO("Thread %p pinned on NUMA node %d", (void *)QThread::currentThread(), numaNode_);
+		}
 	}
 
 Q_SIGNALS:
 	void objectsFound(const find_object::DetectionInfo &);
+	void requestDone(const find_object::DetectionInfo &, qint64, bool); // info, ticket, degraded, emitted from the request pool
+	void requestRejected(qint64);
+	void queueChanged();
+
+private:
+	bool admit(qint64 ticket)
+	{
+		bool admitted = admission_->admit();
+		if(!admitted)
+		{
+			UDEBUG("Request queue full (%d requests), request %lld rejected", admission_->maxQueue(), ticket);
+			Q_EMIT requestRejected(ticket);
+		}
+		Q_EMIT queueChanged();
+		return admitted;
+	}
 
 private:
 	find_object::FindObject * sharedFindObject_; //shared findobject
 	QSemaphore * sharedSemaphore_;
 	int maxSemaphoreResources_;
+	QThreadPool * requestPool_;
+	AdmissionControl * admission_;
+	int objectsFoundFields_;
+	const NumaTopology * numa_;
+	int numaNode_;
+	QVector<find_object::FindObject*> nodeFindObjects_;
+	QMutex * nodesUpdateMutex_;
 };
 
+inline void RequestTask::run()
+{
+	worker_->pinRequestThread();
+	worker_->detectRequest(image_, keypoints_, descriptors_, imageSize_, ticket_, deadline_);
+}
+
 class TcpServerPool : public QObject
 {
 	Q_OBJECT;
 public:
-	TcpServerPool(find_object::FindObject * sharedFindObject, int threads, int port) :
-		sharedSemaphore_(threads)
+	// queueSize, degradedMaxFeatures and degradedHomography: see AdmissionControl.
+	// nodeFindObjects: a copy of sharedFindObject per NUMA node of numa (see
+	// FindObject::replicate(), sharedFindObject can be one of them), the threads
+	// are spread on the nodes and detect on the copy of their node. Empty to
+	// detect on sharedFindObject with threads not pinned.
+	// The frames of the clients are independent: they are not tracked
+	// (General/roiTracking and Homography/opticalFlowTracking).
+	TcpServerPool(find_object::FindObject * sharedFindObject, int threads, int port, int queueSize = 0, int degradedMaxFeatures = 0, bool degradedHomography = true,
+			const QVector<find_object::FindObject*> & nodeFindObjects = QVector<find_object::FindObject*>()) :
+		sharedSemaphore_(threads),
+		admission_(queueSize, degradedMaxFeatures, degradedHomography)
 	{
 		UASSERT(sharedFindObject != 0);
 		UASSERT(threads>=1);
+		UASSERT(nodeFindObjects.isEmpty() || nodeFindObjects.size() == numa_.nodes());
 
 		qRegisterMetaType<cv::Mat>("cv::Mat");
+		qRegisterMetaType<qint64>("qint64");
 
+		// a pool of request threads per node
+		int nodes = nodeFindObjects.isEmpty()?1:nodeFindObjects.size();
+		requestPools_.resize(nodes);
+		for(int n=0; n<nodes; ++n)
+		{
+			requestPools_[n] = new QThreadPool(this);
+			requestPools_[n]->setMaxThreadCount((threads+nodes-1-n)/nodes); // threads of the node
+		}
 		threadPool_.resize(threads);
 		for(int i=0; i<threads; ++i)
 		{
 			find_object::TcpServer * tcpServer =  new find_object::TcpServer(port!=0?port++:0);
+			tcpServer->setGrayscaleDecoding(true); // no GUI
+			servers_.push_back(tcpServer);
 			UINFO("TcpServer set on port: %d (IP=%s)",
 					tcpServer->getPort(),
 					tcpServer->getHostAddress().toString().toStdString().c_str());
 
 			threadPool_[i] = new QThread(this);
-			FindObjectWorker * worker = new FindObjectWorker(sharedFindObject, &sharedSemaphore_, threads);
+			int node = i % nodes;
+			FindObjectWorker * worker = new FindObjectWorker(nodeFindObjects.isEmpty()?sharedFindObject:nodeFindObjects[node],
+					&sharedSemaphore_, threads, requestPools_[node], &admission_);
+			worker->setObjectsFoundFields(tcpServer->usedFields()); // the metrics don't use them
+			if(!nodeFindObjects.isEmpty())
+			{
+				worker->setNumaNode(&numa_, node, nodeFindObjects, &nodesUpdateMutex_);
+				connect(threadPool_[i], SIGNAL(started()), worker, SLOT(pin()), Qt::DirectConnection);
+			}
 
 			tcpServer->moveToThread(threadPool_[i]);
 			 worker->moveToThread(threadPool_[i]);
@@ -101,15 +339,28 @@ public:
 
 			// connect stuff:
 			QObject::connect(worker, SIGNAL(objectsFound(find_object::DetectionInfo)), tcpServer, SLOT(publishDetectionInfo(find_object::DetectionInfo)));
+			QObject::connect(worker, SIGNAL(objectsFound(find_object::DetectionInfo)), this, SIGNAL(objectsFound(find_object::DetectionInfo)), Qt::DirectConnection);
 			QObject::connect(tcpServer, SIGNAL(detectObject(const cv::Mat &)), worker, SLOT(detect(const cv::Mat &)));
+			QObject::connect(tcpServer, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)), worker, SLOT(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)));
+			QObject::connect(tcpServer, SIGNAL(detectObject(const cv::Mat &, qint64, qint64)), worker, SLOT(detectWithId(const cv::Mat &, qint64, qint64)));
+			QObject::connect(tcpServer, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)), worker, SLOT(detectFeaturesWithId(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)));
+			QObject::connect(worker, SIGNAL(requestDone(find_object::DetectionInfo, qint64, bool)), tcpServer, SLOT(publishResult(find_object::DetectionInfo, qint64, bool)));
+			QObject::connect(worker, SIGNAL(requestDone(find_object::DetectionInfo, qint64, bool)), this, SIGNAL(objectsFound(find_object::DetectionInfo)), Qt::DirectConnection);
+			QObject::connect(worker, SIGNAL(requestRejected(qint64)), tcpServer, SLOT(rejectRequest(qint64)));
+			QObject::connect(worker, SIGNAL(queueChanged()), this, SLOT(emitQueueChanged()), Qt::DirectConnection);
 			QObject::connect(tcpServer, SIGNAL(addObject(const cv::Mat &, int, const QString &)), worker, SLOT(addObjectAndUpdate(const cv::Mat &, int, const QString &)));
 			QObject::connect(tcpServer, SIGNAL(removeObject(int)), worker, SLOT(removeObjectAndUpdate(int)));
+			QObject::connect(this, SIGNAL(publishData(const QByteArray &)), tcpServer, SLOT(publishData(const QByteArray &)));
 			threadPool_[i]->start();
 		}
 	}
 
 	virtual ~TcpServerPool()
 	{
+		for(int n=0; n<requestPools_.size(); ++n)
+		{
+			requestPools_[n]->waitForDone(); // the workers are deleted with their thread
+		}
 		for(int i=0; i<threadPool_.size(); ++i)
 		{
 			threadPool_[i]->quit();
@@ -117,9 +368,38 @@ public:
 		}
 	}
 
+public Q_SLOTS:
+	// Answer of the readiness service of all servers (TcpServer::kReadiness), thread-safe
+	void setReady(bool ready)
+	{
+		for(int i=0; i<servers_.size(); ++i)
+		{
+			servers_[i]->setReady(ready);
+		}
+	}
+
+Q_SIGNALS:
+	void objectsFound(const find_object::DetectionInfo &); // emitted from the worker threads
+	void publishData(const QByteArray &); // sent by all servers, see TcpServer::serialize()
+	void queueChanged(int, qint64, qint64, qint64, qint64); // depth, accepted, rejected, dropped, degraded (requests with ID)
+
+private Q_SLOTS:
+	void emitQueueChanged()
+	{
+		int depth;
+		qint64 accepted, rejected, dropped, degraded;
+		admission_.stats(depth, accepted, rejected, dropped, degraded);
+		Q_EMIT queueChanged(depth, accepted, rejected, dropped, degraded);
+	}
+
 private:
 	QVector<QThread*> threadPool_;
+	QVector<find_object::TcpServer*> servers_; // deleted with their thread
 	QSemaphore sharedSemaphore_;
+	QVector<QThreadPool*> requestPools_;
+	AdmissionControl admission_;
+	NumaTopology numa_;
+	QMutex nodesUpdateMutex_;
 };
 
 
@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef WARMUPTHREAD_H_
+#define WARMUPTHREAD_H_
+
+#include <find_object/FindObject.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QThread>
+
+// Warms up the detector in background (see FindObject::warmUp()) while
+// the event loop is already running, then emits ready(true). The TCP
+// servers answer "not ready" to the readiness service until then.
+class WarmUpThread : public QThread
+{
+	Q_OBJECT;
+
+public:
+	WarmUpThread(find_object::FindObject * findObject, int iterations, QObject * parent = 0) :
+		QThread(parent),
+		findObject_(findObject),
+		iterations_(iterations)
+	{
+		UASSERT(findObject != 0);
+	}
+
+Q_SIGNALS:
+	void ready(bool);
+
+protected:
+	virtual void run()
+	{
+		findObject_->warmUp(iterations_);
+		Q_EMIT ready(true);
+	}
+
+private:
+	find_object::FindObject * findObject_;
+	int iterations_;
+};
+
+#endif /* WARMUPTHREAD_H_ */
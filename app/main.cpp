@@ -36,8 +36,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "find_object/Camera.h"
 #include "find_object/TcpServer.h"
 #include "find_object/JsonWriter.h"
+#include "find_object/Trace.h"
 #include "find_object/utilite/ULogger.h"
 #include "TcpServerPool.h"
+#include "TcpFrontend.h"
+#include "MetricsServer.h"
+#include "JsonLinesWriter.h"
+#include "DetectionPipeline.h"
+#include "WarmUpThread.h"
+#include "NumaTopology.h"
+#include "NumaReplicaThread.h"
 
 bool running = true;
 
@@ -116,16 +124,53 @@ void showUsage()
 			"  --tcp_threads #        Number of TCP threads (default 1, only in --console mode). \"--General/port\" parameter should not be 0.\n"
 			"                           Port numbers start from \"General/port\" value. \"Detect\" TCP service can be\n"
 			"                           executed at the same time by multiple threads. \"Add/Remove\" TCP services\n"
-			"                           cannot be called by multiple threads, so calling these services on a port\n "
-			"                          will block all other threads on the other ports.\n"
+			"                           are processed one at a time, detections on the other ports continue\n"
+			"                           with the current objects until the updated ones are swapped in.\n"
+			"  --tcp_single_port      Single port TCP service (\"General/port\"): all clients connect to the same\n"
+			"                           port, requests are processed by a pool of --tcp_threads threads (only in\n"
+			"                           --console mode).\n"
+			"  --tcp_numa             With --tcp_threads on a multi-socket machine: the objects are copied on each\n"
+			"                           NUMA node and the threads of each node detect on the local copy (more\n"
+			"                           memory, objects added or removed are updated in all copies). Not used with\n"
+			"                           --tcp_single_port.\n"
+			"  --tcp_queue #          Detection requests waiting for a thread before new ones are rejected (default\n"
+			"                           4 x --tcp_threads with --tcp_single_port, otherwise only requests with ID are\n"
+			"                           queued and not bounded by default). Queue depth and rejections are published\n"
+			"                           with --metrics_port.\n"
+			"  --tcp_degraded_features #  Requests with a deadline that cannot be met are processed with at most #\n"
+			"                           features instead of being dropped.\n"
+			"  --tcp_degraded_no_homography  Same, without computing the homographies (objects are only matched).\n"
+			"  --metrics_port #       Publish detection metrics (stage latency percentiles, counters\n"
+			"                           of frames, detections and rejections) in Prometheus text format\n"
+			"                           on http://host:port/metrics (only in --console mode). The costs of the\n"
+			"                           objects (matches, homography time, rejections, detection rate) are\n"
+			"                           on http://host:port/objects, the memory used by the objects, the\n"
+			"                           vocabulary and the index on http://host:port/memory.\n"
+			"  --pipeline_queue #     Frames waiting between the camera, detection and publishing stages\n"
+			"                           (default 2, only in --console mode with the TCP camera). When a stage\n"
+			"                           is late, the oldest frame waiting is dropped.\n"
+			"  --pipeline_no_drop     Wait instead of dropping frames when a stage is late.\n"
+			"  --warmup #             Detections run on the objects' images at startup to load the index in\n"
+			"                           memory (default 3, 0 to disable, only in --console mode). Until done,\n"
+			"                           the TCP \"Readiness\" service answers 0 and http://host:port/ready 503.\n"
 			"  --debug                Show debug log.\n"
 			"  --log-time             Show log with time.\n"
+			"  --log-async            Write the log from a background thread (the threads logging\n"
+			"                           don't wait for the console or the file).\n"
 			"  --params               Show all parameters.\n"
 			"  --defaults             Use default parameters (--config is ignored).\n"
 			"  --My/Parameter \"value\" Set find-Object's parameter (look --params for parameters' name).\n"
 			"                           It will override the one in --config. Example to set 4 threads:\n"
 			"                           $ find_object --General/threads 4\n"
+			"  --trace \"path\"         Save the trace spans of the detections to this file on exit\n"
+			"                           (Chrome trace format, built with WITH_TRACE).\n"
 			"  --json \"path\"          Path to an output JSON file (only in --console mode with --scene).\n"
+			"  --json_lines \"path\"    Append a compact JSON line per frame detected (time, stream, objects)\n"
+			"                           to this file, written from a background thread (only in --console\n"
+			"                           mode without --scene).\n"
+			"  --object_costs \"path\"  Write the costs of the objects (matches, homography time, rejections,\n"
+			"                           detection rate) as CSV to this file on exit, the most expensive first\n"
+			"                           (only in --console mode).\n"
 			"  --help                 Show usage.\n"
 			, find_object::Settings::iniDefaultPath().toStdString().c_str());
 	exit(-1);
@@ -150,9 +195,21 @@ int main(int argc, char* argv[])
 	QString configPath = "";
 	QString vocabularyPath = "";
 	QString jsonPath;
+	QString jsonLinesPath;
+	QString objectCostsPath;
+	QString tracePath;
 	find_object::ParametersMap customParameters;
 	bool imagesSaved = true;
 	int tcpThreads = 1;
+	int tcpQueue = 0;
+	bool tcpSinglePort = false;
+	bool tcpNuma = false;
+	int tcpDegradedFeatures = 0;
+	bool tcpDegradedHomography = true;
+	int metricsPort = -1;
+	int pipelineQueue = 2;
+	bool pipelineDrop = true;
+	int warmUpIterations = 3;
 
 	for(int i=1; i<argc; ++i)
 	{
@@ -335,11 +392,39 @@ int main(int argc, char* argv[])
 			ULogger::setPrintTime(true);
 			continue;
 		}
+		if(strcmp(argv[i], "-log-async") == 0 ||
+		   strcmp(argv[i], "--log-async") == 0)
+		{
+			ULogger::setAsync(true);
+			continue;
+		}
 		if(strcmp(argv[i], "-help") == 0 ||
 		   strcmp(argv[i], "--help") == 0)
 		{
 			showUsage();
 		}
+		if(strcmp(argv[i], "-trace") == 0 ||
+		   strcmp(argv[i], "--trace") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				tracePath = argv[i];
+				if(tracePath.contains('~'))
+				{
+					tracePath.replace('~', QDir::homePath());
+				}
+				if(!find_object::Trace::isCompiled())
+				{
+					UWARN("--trace: Find-Object is not built with WITH_TRACE, the trace will be empty.");
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
 		if(strcmp(argv[i], "-json") == 0 ||
 		   strcmp(argv[i], "--json") == 0)
 		{
@@ -358,6 +443,42 @@ int main(int argc, char* argv[])
 			}
 			continue;
 		}
+		if(strcmp(argv[i], "-json_lines") == 0 ||
+		   strcmp(argv[i], "--json_lines") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				jsonLinesPath = argv[i];
+				if(jsonLinesPath.contains('~'))
+				{
+					jsonLinesPath.replace('~', QDir::homePath());
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-object_costs") == 0 ||
+		   strcmp(argv[i], "--object_costs") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				objectCostsPath = argv[i];
+				if(objectCostsPath.contains('~'))
+				{
+					objectCostsPath.replace('~', QDir::homePath());
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
 		if(strcmp(argv[i], "-tcp_threads") == 0 ||
 		   strcmp(argv[i], "--tcp_threads") == 0)
 		{
@@ -377,6 +498,125 @@ int main(int argc, char* argv[])
 			}
 			continue;
 		}
+		if(strcmp(argv[i], "-tcp_queue") == 0 ||
+		   strcmp(argv[i], "--tcp_queue") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				tcpQueue = atoi(argv[i]);
+				if(tcpQueue < 1)
+				{
+					printf("tcp_queue should be >= 1!\n");
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-tcp_single_port") == 0 ||
+		   strcmp(argv[i], "--tcp_single_port") == 0)
+		{
+			tcpSinglePort = true;
+			continue;
+		}
+		if(strcmp(argv[i], "-tcp_numa") == 0 ||
+		   strcmp(argv[i], "--tcp_numa") == 0)
+		{
+			tcpNuma = true;
+			continue;
+		}
+		if(strcmp(argv[i], "-tcp_degraded_features") == 0 ||
+		   strcmp(argv[i], "--tcp_degraded_features") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				tcpDegradedFeatures = atoi(argv[i]);
+				if(tcpDegradedFeatures < 1)
+				{
+					printf("tcp_degraded_features should be >= 1!\n");
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-tcp_degraded_no_homography") == 0 ||
+		   strcmp(argv[i], "--tcp_degraded_no_homography") == 0)
+		{
+			tcpDegradedHomography = false;
+			continue;
+		}
+		if(strcmp(argv[i], "-metrics_port") == 0 ||
+		   strcmp(argv[i], "--metrics_port") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				metricsPort = atoi(argv[i]);
+				if(metricsPort < 0 || metricsPort > 65535)
+				{
+					printf("metrics_port should be between 0 and 65535!\n");
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-pipeline_queue") == 0 ||
+		   strcmp(argv[i], "--pipeline_queue") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				pipelineQueue = atoi(argv[i]);
+				if(pipelineQueue < 1)
+				{
+					printf("pipeline_queue should be >= 1!\n");
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-pipeline_no_drop") == 0 ||
+		   strcmp(argv[i], "--pipeline_no_drop") == 0)
+		{
+			pipelineDrop = false;
+			continue;
+		}
+		if(strcmp(argv[i], "-warmup") == 0 ||
+		   strcmp(argv[i], "--warmup") == 0)
+		{
+			++i;
+			if(i < argc)
+			{
+				warmUpIterations = atoi(argv[i]);
+				if(warmUpIterations < 0)
+				{
+					printf("warmup should be >= 0!\n");
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
 		if(strcmp(argv[i], "--params") == 0)
 		{
 			find_object::ParametersMap parameters = find_object::Settings::getDefaultParameters();
@@ -471,6 +711,9 @@ int main(int argc, char* argv[])
 	if(!guiMode)
 	{
 		UINFO("   JSON path: \"%s\"", jsonPath.toStdString().c_str());
+		UINFO("   JSON lines path: \"%s\"", jsonLinesPath.toStdString().c_str());
+		UINFO("   Object costs path: \"%s\"", objectCostsPath.toStdString().c_str());
+		UINFO("   Warm-up iterations: %d", warmUpIterations);
 	}
 	UINFO("   Settings path: \"%s\"", configPath.toStdString().c_str());
 	UINFO("   Vocabulary path: \"%s\"", vocabularyPath.toStdString().c_str());
@@ -513,6 +756,26 @@ int main(int argc, char* argv[])
 	}
 
 
+	// Objects loaded by a thread pinned on the first NUMA node, copied on the others (see --tcp_numa)
+	NumaTopology numa;
+	bool numaUsed = false;
+	if(tcpNuma && !guiMode)
+	{
+		if(tcpSinglePort)
+		{
+			UWARN("--tcp_numa is not used with --tcp_single_port.");
+		}
+		else if(numa.nodes() < 2)
+		{
+			UWARN("Single NUMA node, --tcp_numa is ignored.");
+		}
+		else
+		{
+			numaUsed = numa.pinCurrentThread(0);
+			UINFO("%d NUMA nodes, objects are copied on each node", numa.nodes());
+		}
+	}
+
 	// Create FindObject
 	find_object::FindObject * findObject = new find_object::FindObject(guiMode || imagesSaved);
 
@@ -527,6 +790,13 @@ int main(int argc, char* argv[])
 		else
 		{
 			objectsLoaded = findObject->objects().size();
+
+			// the application (camera, TCP port...) uses the parameters of the session
+			const find_object::ParametersMap sessionParameters = findObject->parameters();
+			for(find_object::ParametersMap::const_iterator iter=sessionParameters.begin(); iter!=sessionParameters.end(); ++iter)
+			{
+				find_object::Settings::setParameter(iter.key(), iter.value());
+			}
 		}
 	}
 	else if(!vocabularyPath.isEmpty() && !findObject->loadVocabulary(vocabularyPath))
@@ -566,10 +836,14 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	// process-wide, from the parameters of the application (or of its session)
+	find_object::FindObject::setImageCacheSize(find_object::Settings::getGeneral_imageCacheSize());
+
 	cv::Mat scene;
 	if(!scenePath.isEmpty())
 	{
-		scene = cv::imread(scenePath.toStdString());
+		// color is only used by the GUI
+		scene = cv::imread(scenePath.toStdString(), guiMode?cv::IMREAD_COLOR:cv::IMREAD_GRAYSCALE);
 		if(scene.empty())
 		{
 			UERROR("Failed to load scene \"%s\"", scenePath.toStdString().c_str());
@@ -627,18 +901,106 @@ int main(int argc, char* argv[])
 		}
 		else
 		{
-			TcpServerPool tcpServerPool(findObject, tcpThreads, find_object::Settings::getGeneral_port());
+			// Copies of the objects on the other NUMA nodes, allocated by threads pinned on them
+			QVector<find_object::FindObject*> nodeFindObjects;
+			if(numaUsed)
+			{
+				nodeFindObjects.push_back(findObject);
+				QVector<NumaReplicaThread*> replicaThreads;
+				for(int node=1; node<numa.nodes(); ++node)
+				{
+					replicaThreads.push_back(new NumaReplicaThread(numa, node, findObject, imagesSaved, warmUpIterations));
+					replicaThreads.back()->start();
+				}
+				for(int i=0; i<replicaThreads.size(); ++i)
+				{
+					replicaThreads[i]->wait();
+					find_object::FindObject * replica = replicaThreads[i]->takeReplica();
+					if(replica)
+					{
+						nodeFindObjects.push_back(replica);
+					}
+					delete replicaThreads[i];
+				}
+				if(nodeFindObjects.size() != numa.nodes())
+				{
+					UWARN("Objects not copied on all NUMA nodes, --tcp_numa is ignored.");
+					for(int i=1; i<nodeFindObjects.size(); ++i)
+					{
+						delete nodeFindObjects[i];
+					}
+					nodeFindObjects.clear();
+				}
+			}
+
+			// A server per thread on consecutive ports, or all threads behind one port
+			QObject * tcpService;
+			if(tcpSinglePort)
+			{
+				tcpService = new TcpFrontend(findObject, tcpThreads, find_object::Settings::getGeneral_port(),
+						tcpQueue>0?tcpQueue:4*tcpThreads, tcpDegradedFeatures, tcpDegradedHomography);
+			}
+			else
+			{
+				tcpService = new TcpServerPool(findObject, tcpThreads, find_object::Settings::getGeneral_port(),
+						tcpQueue, tcpDegradedFeatures, tcpDegradedHomography, nodeFindObjects);
+			}
+
+			MetricsServer * metricsServer = 0;
+			if(metricsPort >= 0)
+			{
+				metricsServer = new MetricsServer(metricsPort);
+				metricsServer->setFindObject(findObject);
+				// Metrics are aggregated in the detection threads
+				QObject::connect(tcpService, SIGNAL(objectsFound(find_object::DetectionInfo)), metricsServer, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+				QObject::connect(tcpService, SIGNAL(queueChanged(int, qint64, qint64, qint64, qint64)), metricsServer, SLOT(setQueue(int, qint64, qint64, qint64, qint64)), Qt::DirectConnection);
+				QObject::connect(findObject, SIGNAL(objectsFound(find_object::DetectionInfo)), metricsServer, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+			}
+
+			JsonLinesWriter * jsonLinesWriter = 0;
+			if(!jsonLinesPath.isEmpty())
+			{
+				jsonLinesWriter = new JsonLinesWriter(jsonLinesPath);
+				// Lines are formatted in the detection threads
+				QObject::connect(tcpService, SIGNAL(objectsFound(find_object::DetectionInfo)), jsonLinesWriter, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+				QObject::connect(findObject, SIGNAL(objectsFound(find_object::DetectionInfo)), jsonLinesWriter, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+			}
+
+			// Clients can connect while warming up, readiness is reported when done
+			WarmUpThread * warmUpThread = 0;
+			if(warmUpIterations > 0)
+			{
+				warmUpThread = new WarmUpThread(findObject, warmUpIterations);
+				QMetaObject::invokeMethod(tcpService, "setReady", Qt::DirectConnection, Q_ARG(bool, false));
+				QObject::connect(warmUpThread, SIGNAL(ready(bool)), tcpService, SLOT(setReady(bool)), Qt::DirectConnection);
+				if(metricsServer)
+				{
+					metricsServer->setReady(false);
+					QObject::connect(warmUpThread, SIGNAL(ready(bool)), metricsServer, SLOT(setReady(bool)), Qt::DirectConnection);
+				}
+			}
 
 			setupQuitSignal();
 
 			//If TCP camera is used
 			find_object::Camera * camera = 0;
+			DetectionPipeline * pipeline = 0;
 			if(find_object::Settings::getCamera_6useTcpCamera())
 			{
 				camera = new find_object::Camera();
+				pipeline = new DetectionPipeline(findObject, pipelineQueue, pipelineDrop);
 
-				// [Camera] ---Image---> [FindObject]
-				QObject::connect(camera, SIGNAL(imageReceived(const cv::Mat &)), findObject, SLOT(detect(const cv::Mat &)));
+				// [Camera] ---Image---> [Detection] ---Info---> [Publishing] ---> [TcpServers]
+				QObject::connect(camera, SIGNAL(imageReceived(const cv::Mat &, int)), pipeline, SLOT(addImage(const cv::Mat &, int)), Qt::DirectConnection);
+				QObject::connect(pipeline, SIGNAL(dataPublished(const QByteArray &)), tcpService, SIGNAL(publishData(const QByteArray &)), Qt::DirectConnection);
+				if(metricsServer)
+				{
+					QObject::connect(pipeline, SIGNAL(objectsFound(find_object::DetectionInfo)), metricsServer, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+				}
+				if(jsonLinesWriter)
+				{
+					QObject::connect(pipeline, SIGNAL(objectsFound(find_object::DetectionInfo)), jsonLinesWriter, SLOT(addDetection(find_object::DetectionInfo)), Qt::DirectConnection);
+				}
 				QObject::connect(camera, SIGNAL(finished()), &app, SLOT(quit()));
 
 				if(!camera->start())
@@ -651,6 +1013,10 @@ int main(int argc, char* argv[])
 			// start processing!
 			if(running)
 			{
+				if(warmUpThread)
+				{
+					warmUpThread->start();
+				}
 				app.exec();
 
 				if(!sessionPath.isEmpty())
@@ -672,14 +1038,46 @@ int main(int argc, char* argv[])
 			}
 
 			// cleanup
+			if(warmUpThread)
+			{
+				warmUpThread->wait();
+				delete warmUpThread;
+			}
 			if(camera)
 			{
 				camera->stop();
 				delete camera;
 			}
+			delete pipeline;
+			delete tcpService;
+			for(int i=1; i<nodeFindObjects.size(); ++i)
+			{
+				delete nodeFindObjects[i]; // the first is findObject
+			}
+			delete metricsServer;
+			delete jsonLinesWriter; // after the detections, the lines waiting are written
+		}
+
+		if(!objectCostsPath.isEmpty())
+		{
+			QFile file(objectCostsPath);
+			if(file.open(QIODevice::WriteOnly | QIODevice::Text))
+			{
+				file.write(findObject->objectCostsReport().toUtf8());
+				UINFO("Object costs written to \"%s\"", objectCostsPath.toStdString().c_str());
+			}
+			else
+			{
+				UERROR("Cannot open \"%s\"", objectCostsPath.toStdString().c_str());
+			}
 		}
 
 		delete findObject;
 	}
+
+	if(!tracePath.isEmpty())
+	{
+		find_object::Trace::save(tracePath);
+	}
 	return 0;
 }
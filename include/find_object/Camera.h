@@ -38,6 +38,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 namespace find_object {
 
 class CameraTcpServer;
+class SharedMemoryRing;
+class ImagePrefetcher;
 
 class FINDOBJECT_EXP Camera : public QObject {
 	Q_OBJECT
@@ -45,6 +47,11 @@ public:
 	Camera(QObject * parent = 0);
 	virtual ~Camera();
 
+	// Images decoded as set by Camera/decodeGrayscale: 0=as is,
+	// 1=grayscale, 2, 4 or 8=grayscale at a reduced resolution
+	static cv::Mat readImage(const std::string & path, int decodeGrayscale);
+	static cv::Mat decodeImage(const std::vector<unsigned char> & buffer, int decodeGrayscale);
+
 	virtual bool start();
 	virtual void stop();
 	virtual bool isRunning() {return cameraTimer_.isActive();}
@@ -54,9 +61,12 @@ public:
 	int getCurrentFrameIndex();
 	int getPort();
 	void moveToFrame(int frame);
+	// Stream of the last image (a connection with the TCP camera), -1 for the other sources
+	int streamId() const {return streamId_;}
 
 Q_SIGNALS:
 	void imageReceived(const cv::Mat & image);
+	void imageReceived(const cv::Mat & image, int streamId); // emitted after imageReceived(image)
 	void finished();
 
 public Q_SLOTS:
@@ -67,12 +77,21 @@ protected:
 	void startTimer();
 	void stopTimer();
 
+private:
+	void startPrefetcher();
+	cv::Mat * recycledFrame();
+
 private:
 	cv::VideoCapture capture_;
 	QTimer cameraTimer_;
 	QList<std::string> images_;
 	unsigned int currentImageIndex_;
 	CameraTcpServer * cameraTcpServer_;
+	ImagePrefetcher * prefetcher_; // see Camera/prefetch
+	SharedMemoryRing * sharedMemory_; // see Camera/sharedMemoryKey
+	QList<cv::Mat> sharedMemoryFrames_; // copies of the frames emitted, reused when no longer held
+	int videoFrames_; // frame count of the video file being prefetched
+	int streamId_;
 };
 
 } // namespace find_object
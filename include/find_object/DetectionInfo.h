@@ -28,14 +28,214 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define DETECTIONINFO_H_
 
 #include <QtCore/QMultiMap>
+#include <QtCore/QList>
 #include <QtGui/QTransform>
 #include <QtCore/QSize>
 #include <QtCore/QString>
+#include <QtCore/QSharedData>
 #include <opencv2/features2d/features2d.hpp>
 #include <vector>
 
 namespace find_object {
 
+// std::vector implicitly shared (copy-on-write): copies share the same
+// elements until one of them is modified with data(), push_back() or
+// clear(). Converts to a const std::vector.
+template<typename T>
+class SharedVector
+{
+public:
+	SharedVector() : d_(new Data) {}
+	SharedVector(const std::vector<T> & values) : d_(new Data(values)) {}
+	SharedVector & operator=(const std::vector<T> & values)
+	{
+		d_ = new Data(values);
+		return *this;
+	}
+
+	operator const std::vector<T> &() const {return d_->values;}
+	const std::vector<T> & vector() const {return d_->values;}
+	// Detached from the copies
+	std::vector<T> & data() {return d_->values;}
+
+	size_t size() const {return d_->values.size();}
+	bool empty() const {return d_->values.empty();}
+	const T & operator[](size_t i) const {return d_->values[i];}
+	void push_back(const T & value) {d_->values.push_back(value);}
+	void clear() {d_ = new Data;}
+
+private:
+	struct Data : public QSharedData
+	{
+		Data() {}
+		Data(const std::vector<T> & v) : values(v) {}
+		std::vector<T> values;
+	};
+	QSharedDataPointer<Data> d_;
+};
+
+// Matches <object descriptor index, scene descriptor index> of several
+// objects, stored in contiguous arrays instead of one map node per match.
+// Matches are grouped by object (a group per object, or per detection of
+// an object), groups are kept in the order they are added. The QMap views
+// (group(), value(), toMap(), toMultiMap()) are built on each call, they
+// are only for the GUI and for compatibility. The arrays are implicitly
+// shared: copies are cheap until one of them is modified.
+class DetectionMatches
+{
+public:
+	DetectionMatches() : d_(new Data) {}
+
+	void clear()
+	{
+		d_ = new Data;
+	}
+	void reserve(int groups, int matches)
+	{
+		Data * d = d_.data();
+		d->ids.reserve(groups);
+		d->offsets.reserve(groups+1);
+		d->objectIndexes.reserve(matches);
+		d->sceneIndexes.reserve(matches);
+	}
+
+	// Start a new group, following append() calls add matches to it.
+	void addGroup(int objectId)
+	{
+		d_->ids.push_back(objectId);
+		d_->offsets.push_back(d_->offsets.back());
+	}
+	void addGroup(int objectId, const std::vector<int> & objectIndexes, const std::vector<int> & sceneIndexes)
+	{
+		addGroup(objectId);
+		d_->objectIndexes.insert(d_->objectIndexes.end(), objectIndexes.begin(), objectIndexes.end());
+		d_->sceneIndexes.insert(d_->sceneIndexes.end(), sceneIndexes.begin(), sceneIndexes.end());
+		d_->offsets.back() = (int)d_->objectIndexes.size();
+	}
+	void append(int objectIndex, int sceneIndex)
+	{
+		d_->objectIndexes.push_back(objectIndex);
+		d_->sceneIndexes.push_back(sceneIndex);
+		++d_->offsets.back();
+	}
+	// Replace the matches of the groups already added: match i goes to
+	// group groupIndexes[i]. The order of the matches is kept in each group.
+	void assign(const std::vector<int> & groupIndexes, const std::vector<int> & objectIndexes, const std::vector<int> & sceneIndexes)
+	{
+		Data * d = d_.data();
+		std::vector<int> sizes(d->ids.size(), 0);
+		for(unsigned int i=0; i<groupIndexes.size(); ++i)
+		{
+			++sizes[groupIndexes[i]];
+		}
+		std::vector<int> next(d->ids.size());
+		for(unsigned int g=0; g<d->ids.size(); ++g)
+		{
+			next[g] = d->offsets[g];
+			d->offsets[g+1] = d->offsets[g] + sizes[g];
+		}
+		d->objectIndexes.resize(groupIndexes.size());
+		d->sceneIndexes.resize(groupIndexes.size());
+		for(unsigned int i=0; i<groupIndexes.size(); ++i)
+		{
+			int & j = next[groupIndexes[i]];
+			d->objectIndexes[j] = objectIndexes[i];
+			d->sceneIndexes[j] = sceneIndexes[i];
+			++j;
+		}
+	}
+
+	int groups() const {return (int)d_->ids.size();}
+	int totalMatches() const {return (int)d_->objectIndexes.size();}
+	bool empty() const {return d_->ids.empty();}
+	int id(int group) const {return d_->ids[group];}
+	int groupSize(int group) const {return d_->offsets[group+1] - d_->offsets[group];}
+	// Matches of a group are at [groupBegin(group), groupBegin(group+1))
+	int groupBegin(int group) const {return d_->offsets[group];}
+	int objectIndex(int i) const {return d_->objectIndexes[i];}
+	int sceneIndex(int i) const {return d_->sceneIndexes[i];}
+	std::vector<int> objectIndexes(int group) const {return std::vector<int>(d_->objectIndexes.begin()+d_->offsets[group], d_->objectIndexes.begin()+d_->offsets[group+1]);}
+	std::vector<int> sceneIndexes(int group) const {return std::vector<int>(d_->sceneIndexes.begin()+d_->offsets[group], d_->sceneIndexes.begin()+d_->offsets[group+1]);}
+	// Index of the last group added for this object, -1 if none
+	int find(int objectId) const
+	{
+		for(int g=(int)d_->ids.size()-1; g>=0; --g)
+		{
+			if(d_->ids[g] == objectId)
+			{
+				return g;
+			}
+		}
+		return -1;
+	}
+	bool contains(int objectId) const {return find(objectId) >= 0;}
+
+	QMultiMap<int, int> group(int group) const
+	{
+		QMultiMap<int, int> matches;
+		for(int i=d_->offsets[group]; i<d_->offsets[group+1]; ++i)
+		{
+			matches.insert(d_->objectIndexes[i], d_->sceneIndexes[i]);
+		}
+		return matches;
+	}
+	// Like QMultiMap::value(): the last group added for this object
+	QMultiMap<int, int> value(int objectId) const
+	{
+		int g = find(objectId);
+		return g>=0?group(g):QMultiMap<int, int>();
+	}
+	// Like QMultiMap::values(): the most recent group first
+	QList<QMultiMap<int, int> > values(int objectId) const
+	{
+		QList<QMultiMap<int, int> > list;
+		for(int g=(int)d_->ids.size()-1; g>=0; --g)
+		{
+			if(d_->ids[g] == objectId)
+			{
+				list.push_back(group(g));
+			}
+		}
+		return list;
+	}
+	// Groups of the same object are merged
+	QMap<int, QMultiMap<int, int> > toMap() const
+	{
+		QMap<int, QMultiMap<int, int> > map;
+		for(unsigned int g=0; g<d_->ids.size(); ++g)
+		{
+			QMultiMap<int, int> & matches = map[d_->ids[g]];
+			for(int i=d_->offsets[g]; i<d_->offsets[g+1]; ++i)
+			{
+				matches.insert(d_->objectIndexes[i], d_->sceneIndexes[i]);
+			}
+		}
+		return map;
+	}
+	// One value per group, in the same order as a QMultiMap filled
+	// with the groups in the order they were added
+	QMultiMap<int, QMultiMap<int, int> > toMultiMap() const
+	{
+		QMultiMap<int, QMultiMap<int, int> > map;
+		for(unsigned int g=0; g<d_->ids.size(); ++g)
+		{
+			map.insert(d_->ids[g], group(g));
+		}
+		return map;
+	}
+
+private:
+	struct Data : public QSharedData
+	{
+		Data() : offsets(1, 0) {}
+		std::vector<int> ids; // object ID of each group
+		std::vector<int> offsets; // groups()+1 offsets in the index arrays
+		std::vector<int> objectIndexes;
+		std::vector<int> sceneIndexes;
+	};
+	QSharedDataPointer<Data> d_;
+};
+
 class DetectionInfo
 {
 public:
@@ -47,7 +247,8 @@ public:
 		kTimeIndexing,
 		kTimeMatching,
 		kTimeHomography,
-		kTimeTotal
+		kTimeTotal,
+		kTimeGeometryCheck // part of kTimeHomography, after kTimeTotal to keep the values of the others
 	};
 	enum RejectedCode{
 		kRejectedUndef,
@@ -57,15 +258,63 @@ public:
 		kRejectedAllInliers,
 		kRejectedNotValid,
 		kRejectedCornersOutside,
-		kRejectedByAngle
+		kRejectedByAngle,
+		kRejectedLowScore,
+		kRejectedInconsistent, // see Homography/preCheck
+		kRejectedCascade // not found by the first stage, see General/cascade
+	};
+	// Heavy fields, see release()
+	enum Field{
+		kSceneKeypoints = 1,
+		kSceneDescriptors = 2,
+		kSceneWords = 4,
+		kMatches = 8, // matches_
+		kDetectedMatches = 16, // objDetectedInliers_ and objDetectedOutliers_
+		kRejectedMatches = 32, // rejectedInliers_ and rejectedOutliers_
+		kAllFields = 63
 	};
 
 public:
 	DetectionInfo() :
 		minMatchedDistance_(-1),
-		maxMatchedDistance_(-1)
+		maxMatchedDistance_(-1),
+		streamId_(-1),
+		reused_(false)
 	{}
 
+	// Clear fields (Field flags) not used by the receivers of a copy. Copies
+	// are cheap (the fields are implicitly shared), but the fields of a copy
+	// waiting in a queued connection are kept in memory until it is delivered.
+	void release(int fields)
+	{
+		if(fields & kSceneKeypoints)
+		{
+			sceneKeypoints_.clear();
+		}
+		if(fields & kSceneDescriptors)
+		{
+			sceneDescriptors_ = cv::Mat();
+		}
+		if(fields & kSceneWords)
+		{
+			sceneWords_.clear();
+		}
+		if(fields & kMatches)
+		{
+			matches_.clear();
+		}
+		if(fields & kDetectedMatches)
+		{
+			objDetectedInliers_.clear();
+			objDetectedOutliers_.clear();
+		}
+		if(fields & kRejectedMatches)
+		{
+			rejectedInliers_.clear();
+			rejectedOutliers_.clear();
+		}
+	}
+
 public:
 	// Those maps have the same size
 	QMultiMap<int, QTransform> objDetected_;
@@ -73,22 +322,25 @@ public:
 	QMultiMap<int, QString > objDetectedFilePaths_; // Object ID <filename> match the number of detected objects
 	QMultiMap<int, int> objDetectedInliersCount_; // ObjectID <count> match the number of detected objects
 	QMultiMap<int, int> objDetectedOutliersCount_; // ObjectID <count> match the number of detected objects
-	QMultiMap<int, QMultiMap<int, int> > objDetectedInliers_; // ObjectID Map< ObjectDescriptorIndex, SceneDescriptorIndex >, match the number of detected objects
-	QMultiMap<int, QMultiMap<int, int> > objDetectedOutliers_; // ObjectID Map< ObjectDescriptorIndex, SceneDescriptorIndex >, match the number of detected objects
+	DetectionMatches objDetectedInliers_; // A group per detected object <ObjectDescriptorIndex, SceneDescriptorIndex>, in the same order as objDetected_ with toMultiMap()
+	DetectionMatches objDetectedOutliers_; // A group per detected object <ObjectDescriptorIndex, SceneDescriptorIndex>, in the same order as objDetected_ with toMultiMap()
 
 	QMap<TimeStamp, float> timeStamps_;
-	std::vector<cv::KeyPoint> sceneKeypoints_;
-	cv::Mat sceneDescriptors_;
+	SharedVector<cv::KeyPoint> sceneKeypoints_;
+	cv::Mat sceneDescriptors_; // empty if they stayed on the GPU, see General/gpuPipeline
 	QMultiMap<int, int> sceneWords_;
-	QMap<int, QMultiMap<int, int> > matches_; // ObjectID Map< ObjectDescriptorIndex, SceneDescriptorIndex >, match the number of objects
+	DetectionMatches matches_; // A group per object (sorted by ID) <ObjectDescriptorIndex, SceneDescriptorIndex>, match the number of objects
 
 	// Those maps have the same size
-	QMultiMap<int, QMultiMap<int, int> > rejectedInliers_; // ObjectID Map< ObjectDescriptorIndex, SceneDescriptorIndex >
-	QMultiMap<int, QMultiMap<int, int> > rejectedOutliers_; // ObjectID Map< ObjectDescriptorIndex, SceneDescriptorIndex >
+	DetectionMatches rejectedInliers_; // A group per rejected object <ObjectDescriptorIndex, SceneDescriptorIndex>
+	DetectionMatches rejectedOutliers_; // A group per rejected object <ObjectDescriptorIndex, SceneDescriptorIndex>
 	QMultiMap<int, RejectedCode> rejectedCodes_; // ObjectID rejected code
 
 	float minMatchedDistance_;
 	float maxMatchedDistance_;
+
+	int streamId_; // stream of the scene (see Camera::streamId()), -1 if none
+	bool reused_; // detection of a previous frame, the scene did not change (see General/frameChangeThreshold)
 };
 
 inline QDataStream & operator<<(QDataStream &out, const DetectionInfo & info)
@@ -159,6 +411,153 @@ inline QDataStream & operator>>(QDataStream &in, DetectionInfo & info)
 	return in;
 }
 
+// Compact result format (version 1), written after a quint32 size by
+// TcpServer with "General/portResultFormat" > 0. Only what a client
+// needs to locate the objects is sent, in single precision:
+//   version flags (quint16) detections (quint32)
+//   kCompactStreamId (set when DetectionInfo::streamId_ >= 0): stream ID (qint32)
+//   per detection: id width height (qint32) homography m11..m33 (float) inliers outliers (qint32)
+//   kCompactKeypoints: count (quint32), per scene keypoint: x y size angle response (float) octave (qint32)
+//   kCompactMatches: groups (quint32), per detection: id count (qint32), count x <object index, scene index> (qint32)
+enum CompactResultFlags {
+	kCompactKeypoints = 1,
+	kCompactMatches = 2,
+	kCompactStreamId = 4
+};
+static const quint16 kCompactResultVersion = 1;
+
+inline void writeCompactDetectionInfo(QDataStream & out, const DetectionInfo & info, quint16 flags = 0)
+{
+	out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+	flags &= ~kCompactStreamId;
+	if(info.streamId_ >= 0)
+	{
+		flags |= kCompactStreamId;
+	}
+	out << kCompactResultVersion << flags << quint32(info.objDetected_.size());
+	if(flags & kCompactStreamId)
+	{
+		out << qint32(info.streamId_);
+	}
+
+	QMultiMap<int, int>::const_iterator iterInliers = info.objDetectedInliersCount_.constBegin();
+	QMultiMap<int, int>::const_iterator iterOutliers = info.objDetectedOutliersCount_.constBegin();
+	QMultiMap<int, QSize>::const_iterator iterSizes = info.objDetectedSizes_.constBegin();
+	for(QMultiMap<int, QTransform>::const_iterator iter=info.objDetected_.constBegin();
+		iter!=info.objDetected_.constEnd();
+		++iter, ++iterInliers, ++iterOutliers, ++iterSizes)
+	{
+		const QTransform & h = iter.value();
+		out << qint32(iter.key()) << qint32(iterSizes.value().width()) << qint32(iterSizes.value().height());
+		out << h.m11() << h.m12() << h.m13() << h.m21() << h.m22() << h.m23() << h.m31() << h.m32() << h.m33();
+		out << qint32(iterInliers.value()) << qint32(iterOutliers.value());
+	}
+
+	if(flags & kCompactKeypoints)
+	{
+		out << quint32(info.sceneKeypoints_.size());
+		for(unsigned int i=0; i<info.sceneKeypoints_.size(); ++i)
+		{
+			const cv::KeyPoint & kpt = info.sceneKeypoints_[i];
+			out << kpt.pt.x << kpt.pt.y << kpt.size << kpt.angle << kpt.response << qint32(kpt.octave);
+		}
+	}
+	if(flags & kCompactMatches)
+	{
+		const DetectionMatches & inliers = info.objDetectedInliers_;
+		out << quint32(inliers.groups());
+		for(int g=0; g<inliers.groups(); ++g)
+		{
+			out << qint32(inliers.id(g)) << qint32(inliers.groupSize(g));
+			for(int i=inliers.groupBegin(g); i<inliers.groupBegin(g)+inliers.groupSize(g); ++i)
+			{
+				out << qint32(inliers.objectIndex(i)) << qint32(inliers.sceneIndex(i));
+			}
+		}
+	}
+}
+
+// Returns false if the version is not supported or the data is truncated
+inline bool readCompactDetectionInfo(QDataStream & in, DetectionInfo & info)
+{
+	info = DetectionInfo();
+	in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+	quint16 version, flags;
+	quint32 n;
+	in >> version >> flags >> n;
+	if(in.status() != QDataStream::Ok || version != kCompactResultVersion)
+	{
+		return false;
+	}
+	if(flags & kCompactStreamId)
+	{
+		qint32 streamId;
+		in >> streamId;
+		info.streamId_ = streamId;
+	}
+	for(quint32 i=0; i<n && in.status() == QDataStream::Ok; ++i)
+	{
+		qint32 id, width, height, inliers, outliers;
+		float m[9];
+		in >> id >> width >> height;
+		for(int j=0; j<9; ++j)
+		{
+			in >> m[j];
+		}
+		in >> inliers >> outliers;
+		info.objDetected_.insert(id, QTransform(m[0], m[1], m[2], m[3], m[4], m[5], m[6], m[7], m[8]));
+		info.objDetectedSizes_.insert(id, QSize(width, height));
+		info.objDetectedFilePaths_.insert(id, QString());
+		info.objDetectedInliersCount_.insert(id, inliers);
+		info.objDetectedOutliersCount_.insert(id, outliers);
+	}
+	if(flags & kCompactKeypoints)
+	{
+		in >> n;
+		std::vector<cv::KeyPoint> & keypoints = info.sceneKeypoints_.data();
+		// 5 floats and an integer per keypoint, the count is not trusted
+		// before allocating them
+		const qint64 keypointSize = 6*4;
+		if(in.status() == QDataStream::Ok && in.device() && qint64(n) > in.device()->bytesAvailable()/keypointSize)
+		{
+			in.setStatus(QDataStream::ReadCorruptData);
+		}
+		if(in.status() == QDataStream::Ok)
+		{
+			keypoints.resize(n);
+		}
+		for(quint32 i=0; i<n && in.status() == QDataStream::Ok; ++i)
+		{
+			cv::KeyPoint & kpt = keypoints[i];
+			qint32 octave;
+			in >> kpt.pt.x >> kpt.pt.y >> kpt.size >> kpt.angle >> kpt.response >> octave;
+			kpt.octave = octave;
+		}
+	}
+	if(flags & kCompactMatches)
+	{
+		in >> n;
+		for(quint32 g=0; g<n && in.status() == QDataStream::Ok; ++g)
+		{
+			qint32 id, count;
+			in >> id >> count;
+			info.objDetectedInliers_.addGroup(id);
+			for(qint32 i=0; i<count && in.status() == QDataStream::Ok; ++i)
+			{
+				qint32 objectIndex, sceneIndex;
+				in >> objectIndex >> sceneIndex;
+				info.objDetectedInliers_.append(objectIndex, sceneIndex);
+			}
+		}
+	}
+	if(in.status() != QDataStream::Ok)
+	{
+		info = DetectionInfo();
+		return false;
+	}
+	return true;
+}
+
 } // namespace find_object
 
 #endif /* DETECTIONINFO_H_ */
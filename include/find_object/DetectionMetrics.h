@@ -0,0 +1,102 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DETECTIONMETRICS_H_
+#define DETECTIONMETRICS_H_
+
+#include "find_object/FindObjectExp.h" // DLL export/import defines
+
+#include "find_object/DetectionInfo.h"
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <vector>
+
+namespace find_object {
+
+// Log-linear histogram of latencies in ms (16 buckets per power of 2,
+// relative error < 7%) in the spirit of HDR histograms.
+class FINDOBJECT_EXP LatencyHistogram
+{
+public:
+	LatencyHistogram();
+
+	void add(float ms);
+	void merge(const LatencyHistogram & histogram);
+	qint64 count() const {return count_;}
+	double sum() const {return sum_;}
+	float max() const {return max_;}
+	float percentile(float p) const; // p in [0,1]
+
+private:
+	static int bucketIndex(float ms);
+	static float bucketUpperBound(int index);
+
+private:
+	std::vector<qint64> buckets_;
+	qint64 count_;
+	double sum_;
+	float max_;
+};
+
+// Aggregates the time stamps and rejection codes of the detections. Thread-safe.
+class FINDOBJECT_EXP DetectionMetrics
+{
+public:
+	DetectionMetrics();
+
+	void add(const DetectionInfo & info);
+	// Requests waiting in a detection queue, accepted, rejected because the queue
+	// was full, dropped or degraded to meet their deadline (published only when set)
+	void setQueue(int depth, qint64 accepted, qint64 rejected, qint64 dropped = 0, qint64 degraded = 0);
+	void reset();
+
+	LatencyHistogram histogram(DetectionInfo::TimeStamp stamp) const;
+	qint64 frames() const;
+
+	QString toPrometheus() const; // Prometheus text exposition format
+
+	static QString timeStampName(DetectionInfo::TimeStamp stamp);
+	static QString rejectedCodeName(DetectionInfo::RejectedCode code);
+
+private:
+	mutable QMutex mutex_;
+	QMap<int, LatencyHistogram> histograms_; // <TimeStamp, histogram>
+	QMap<int, qint64> rejections_; // <RejectedCode, count>
+	qint64 frames_;
+	qint64 framesWithDetections_;
+	qint64 objectsDetected_;
+	int queueDepth_; // -1 if no queue
+	qint64 queueAccepted_;
+	qint64 queueRejected_;
+	qint64 queueDropped_;
+	qint64 queueDegraded_;
+};
+
+} // namespace find_object
+
+#endif /* DETECTIONMETRICS_H_ */
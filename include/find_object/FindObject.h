@@ -39,16 +39,83 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QtCore/QMultiMap>
 #include <QtCore/QPair>
 #include <QtCore/QVector>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
 #include <QtGui/QTransform>
 #include <QtCore/QRect>
 #include <opencv2/opencv.hpp>
 #include <vector>
 
+class QFile;
+
 namespace find_object {
 
 class ObjSignature;
 class Vocabulary;
 class Feature2D;
+class ThreadPool;
+
+// Cost of an object in the detections since FindObject::resetObjectCosts()
+struct ObjectCost
+{
+	ObjectCost() :
+		features(0),
+		words(0),
+		matched(0),
+		matches(0),
+		homographies(0),
+		homographyTime(0.0),
+		detected(0),
+		inliers(0)
+	{}
+	int features; // of the object
+	int words; // distinct words of the vocabulary
+	qint64 matched; // scenes where the object has matches
+	qint64 matches; // summed over the scenes
+	qint64 homographies; // computed (RANSAC), more than one per scene with General/multiDetection
+	double homographyTime; // ms, summed over the homographies
+	qint64 detected; // scenes where the object is detected
+	qint64 inliers; // summed over the detections
+	QMap<int, qint64> rejections; // <DetectionInfo::RejectedCode, count>
+};
+
+// Bytes used by the objects and the vocabulary, see FindObject::memoryUsage().
+// Data mapped from a session file (General/sessionMemoryMapped) is counted.
+struct MemoryUsage
+{
+	MemoryUsage() :
+		objectImages(0),
+		objectKeypoints(0),
+		objectDescriptors(0),
+		objectWords(0),
+		objectsDescriptors(0),
+		imageCache(0),
+		vocabularyWords(0),
+		wordToObjects(0),
+		postings(0),
+		index(0),
+		cascade(0)
+	{}
+	qint64 total() const
+	{
+		return objectImages + objectKeypoints + objectDescriptors + objectWords + objectsDescriptors +
+				imageCache + vocabularyWords + wordToObjects + postings + index + cascade;
+	}
+	qint64 objectImages; // decoded, encoded and optical flow pyramids
+	qint64 objectKeypoints;
+	qint64 objectDescriptors; // not shared with objectsDescriptors
+	qint64 objectWords; // <word, descriptor> of the objects
+	qint64 objectsDescriptors; // descriptors of all objects, for the direct search
+	qint64 imageCache; // decoded images shared by all instances, see General/imageCacheSize
+	qint64 vocabularyWords; // descriptors or codes
+	qint64 wordToObjects;
+	qint64 postings; // inverted index
+	qint64 index; // nearest neighbor index (estimated) or vocabulary tree
+	qint64 cascade; // total of the first stage, see General/cascade
+};
 
 class FINDOBJECT_EXP FindObject : public QObject
 {
@@ -65,9 +132,27 @@ public:
 	FindObject(bool keepImagesInRAM_ = true, QObject * parent = 0);
 	virtual ~FindObject();
 
+	// Parameters of this instance, copied from Settings (the defaults) on creation
+	// and from the session on loadSession(). They can be changed while detecting:
+	// a new immutable set is swapped in, detections in progress keep the set taken
+	// at their start. As with Settings, call updateDetectorExtractor(), updateObjects()
+	// or updateVocabulary() to apply changed features or vocabulary parameters.
+	ParametersMap parameters() const;
+	void setParameters(const ParametersMap & parameters); // only the given parameters are changed
+	void setParameter(const QString & key, const QVariant & value);
+	// The decoded object images are cached for the whole process (all instances),
+	// its size (General/imageCacheSize, MB) is set by the application, not by the
+	// parameters of an instance.
+	static void setImageCacheSize(int megabytes);
+
 	bool loadSession(const QString & path, const ParametersMap & customParameters = ParametersMap());
 	bool saveSession(const QString & path);
 	bool isSessionModified() const {return sessionModified_;}
+	// Copy of the parameters, vocabulary (with its index) and objects of other
+	// through a temporary session. The memory of the copy is allocated by the
+	// calling thread, e.g. a copy per NUMA node loaded by a thread pinned on
+	// the node. The copy doesn't journal its updates (General/sessionJournal).
+	bool replicate(const FindObject & other);
 
 	bool saveVocabulary(const QString & filePath) const;
 	bool loadVocabulary(const QString & filePath);
@@ -80,6 +165,27 @@ public:
 	void removeAllObjects();
 
 	bool detect(const cv::Mat & image, find_object::DetectionInfo & info) const;
+	// Detection with the features of a scene extracted by the caller, with the same detector and
+	// descriptor types as the objects. There is no image: the scene is not tracked and
+	// Homography/opticalFlow is not used. imageSize is used to check the homographies.
+	bool detect(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, find_object::DetectionInfo & info) const;
+	// Detection on independent images (e.g., archived images, General/roiTracking and
+	// Homography/opticalFlowTracking are not used). Features of all images are extracted
+	// in parallel, the scene descriptors are searched at once in the vocabulary (inverted
+	// search), then the matching and the homographies of the images are done in parallel.
+	// All images are in memory at the same time: split large sets in batches of a few
+	// times the number of threads. Returns the number of images processed successfully.
+	int detectBatch(const std::vector<cv::Mat> & images, std::vector<find_object::DetectionInfo> & infos) const;
+	// Cheaper detection to meet a deadline: at most maxFeatures features are kept in the
+	// scene (0 means "Feature2D/3MaxFeatures", not used with features given by the caller) and,
+	// without homography, the objects are only matched (DetectionInfo::matches_). The
+	// scene is not tracked (General/roiTracking and Homography/opticalFlowTracking).
+	bool detectDegraded(const cv::Mat & image, find_object::DetectionInfo & info, int maxFeatures, bool homographyComputed) const;
+	bool detectDegraded(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, find_object::DetectionInfo & info, bool homographyComputed) const;
+	// Detection of an image not following the previous one (e.g., images of several
+	// streams): the scene is not tracked (General/roiTracking and Homography/opticalFlowTracking)
+	bool detectUntracked(const cv::Mat & image, find_object::DetectionInfo & info) const {return detectDegraded(image, info, 0, true);}
+	bool detectUntracked(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, find_object::DetectionInfo & info) const {return detectDegraded(keypoints, descriptors, imageSize, info, true);}
 
 	void updateDetectorExtractor();
 	void updateObjects(const QList<int> & ids = QList<int>());
@@ -88,6 +194,31 @@ public:
 	const QMap<int, ObjSignature*> & objects() const {return objects_;}
 	const Vocabulary * vocabulary() const {return vocabulary_;}
 
+	// Runs detections on object images (or a synthetic texture without images)
+	// and touches the descriptors and words, so that the first detections are
+	// not slowed by lazy initializations, page faults and cold caches. The costs
+	// of the objects are reset after.
+	void warmUp(int iterations = 3);
+
+	// Memory used by the objects, the vocabulary and the index, logged after
+	// each update of the vocabulary. Objects are refused above General/memoryBudget.
+	MemoryUsage memoryUsage() const;
+	// One "component,bytes" line per field of memoryUsage() then the total
+	QString memoryUsageReport() const;
+
+	// Costs of the objects loaded (also those never matched) and the number of
+	// scenes searched since the last reset, to find the objects burning time in
+	// the homographies without being detected
+	QMap<int, ObjectCost> objectCosts(qint64 * scenes = 0) const;
+	void resetObjectCosts();
+	// CSV of objectCosts(), the most expensive objects first
+	QString objectCostsReport() const;
+
+	// Heavy fields (DetectionInfo::Field flags) kept in the info emitted by
+	// objectsFound(), the others are released before (all by default)
+	void setObjectsFoundFields(int fields) {objectsFoundFields_ = fields;}
+	int objectsFoundFields() const {return objectsFoundFields_;}
+
 public Q_SLOTS:
 	void addObjectAndUpdate(const cv::Mat & image, int id=0, const QString & filePath = QString());
 	void removeObjectAndUpdate(int id);
@@ -97,17 +228,94 @@ Q_SIGNALS:
 	void objectsFound(const find_object::DetectionInfo &);
 
 private:
+	friend class DetectBatchTask;
+	friend class CompactJournalTask;
+	// Features of a scene extracted (and searched) beforehand, see detectBatch()
+	struct SceneFeatures
+	{
+		std::vector<cv::KeyPoint> keypoints;
+		cv::Mat descriptors;
+		cv::Size imageSize;
+		QMap<DetectionInfo::TimeStamp, float> timeStamps;
+		cv::Mat results; // of the vocabulary search, empty if not searched
+		cv::Mat dists;
+	};
+
+private:
+	QSharedPointer<const ParametersSnapshot> parametersSnapshot() const;
+	bool detect(const cv::Mat & image, DetectionInfo & info, const ParametersSnapshot & params, const SceneFeatures * features) const;
+	bool loadMappedSession(const QString & path, const ParametersMap & customParameters);
+	bool saveMappedSession(const QString & path);
+	bool writeSession(const QString & path) const;
+	void replayJournal(const QString & sessionPath);
+	void resetJournal(const QString & sessionPath);
+	void appendJournal(int type, const QByteArray & payload);
+	void compactJournal();
 	void clearVocabulary();
+	void updateCascade();
+	void extractFeatures(const QList<ObjSignature*> & objectsList);
+	void buildVocabulary(const QList<ObjSignature*> & objectsList, bool clear, ObjSignature * addedObject = 0, int removedObjectId = 0);
+	cv::Mat trackingMask(const cv::Size & imageSize, const ParametersSnapshot & params) const;
+	void updateTracks(const DetectionInfo & info, bool fullFrame, const ParametersSnapshot & params) const;
+	bool trackWithOpticalFlow(const cv::Mat & image, std::vector<cv::Mat> & pyramid, DetectionInfo & info, const ParametersSnapshot & params) const;
+	void updateFlowTracks(const cv::Mat & image, std::vector<cv::Mat> & pyramid, const DetectionInfo & info, const ParametersSnapshot & params) const;
+	cv::Mat frameThumbnail(const cv::Mat & image) const;
+	void addObjectCosts(const DetectionInfo & info, const QMap<int, ObjectCost> & homographyCosts) const;
+	bool memoryBudgetExceeded() const;
+
+private:
+	// Object detected in the previous frames, see General/roiTracking
+	struct Track
+	{
+		int objectId;
+		QRectF box; // in the scene
+		QPointF velocity; // pixels per frame
+	};
+	// Inliers of an object detected, tracked with optical flow (see Homography/opticalFlowTracking)
+	struct FlowTrack
+	{
+		int objectId;
+		std::vector<int> objectIndexes; // keypoints of the object
+		std::vector<cv::Point2f> objectPoints;
+		std::vector<cv::Point2f> scenePoints; // in the previous frame
+	};
 
 private:
+	ParametersMap parameters_;
+	QSharedPointer<const ParametersSnapshot> parametersSnapshot_; // replaced, never modified
+	mutable QMutex parametersMutex_;
 	QMap<int, ObjSignature*> objects_;
 	Vocabulary * vocabulary_;
+	ThreadPool * threadPool_; // shared by extraction, matching and homography tasks
+	FindObject * cascade_; // first stage with its own features and vocabulary of the objects, see General/cascade
 	QMap<int, cv::Mat> objectsDescriptors_;
 	QMap<int, int> dataRange_; // <last id of object's descriptor, id>
-	Feature2D * detector_;
+	Feature2D * detector_; // an instance per thread, see ThreadFeature2D
 	Feature2D * extractor_;
 	bool sessionModified_;
 	bool keepImagesInRAM_;
+	mutable QReadWriteLock objectsLock_; // held by detections, objects and vocabulary are swapped under the write lock
+	QMutex updateMutex_; // one update of the objects or vocabulary at a time
+	QList<QFile*> mappedSessions_; // descriptors of the objects loaded from them are not copied
+	QString sessionPath_; // last session loaded or saved, its journal is "<sessionPath_>.journal" (see General/sessionJournal)
+	QThreadPool compactionPool_; // a single thread merging the journal in the session
+	bool compactionQueued_;
+	mutable QMutex tracksMutex_;
+	mutable QList<Track> tracks_;
+	mutable QList<FlowTrack> flowTracks_;
+	mutable std::vector<cv::Mat> flowPyramid_; // of the previous frame
+	mutable int framesSinceFullFrame_;
+	// Last frame detected, see General/frameChangeThreshold. Cleared when
+	// the vocabulary is swapped in (under the write lock of objectsLock_).
+	mutable QMutex lastFrameMutex_;
+	mutable cv::Mat lastFrameThumbnail_;
+	mutable DetectionInfo lastFrameInfo_;
+	mutable bool lastFrameSuccess_;
+	mutable int framesReused_;
+	mutable QMutex objectCostsMutex_;
+	mutable QMap<int, ObjectCost> objectCosts_;
+	mutable qint64 objectCostsScenes_;
+	int objectsFoundFields_;
 };
 
 } // namespace find_object
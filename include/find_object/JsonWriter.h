@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "find_object/FindObjectExp.h" // DLL export/import defines
 
 #include "find_object/DetectionInfo.h"
+#include <QtCore/QByteArray>
 
 namespace find_object {
 
@@ -38,6 +39,10 @@ class FINDOBJECT_EXP JsonWriter
 {
 public:
 	static void write(const DetectionInfo & info, const QString & path);
+	// Compact JSON line (ending with '\n') of a frame detected at time
+	// (ms since epoch): stream, objects with their size, homography,
+	// inliers and outliers. The matches and file paths are not written.
+	static QByteArray line(const DetectionInfo & info, qint64 time);
 };
 
 } // namespace find_object
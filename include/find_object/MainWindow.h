@@ -48,6 +48,7 @@ class PdfPlotCurve;
 
 class Ui_mainWindow;
 class QLabel;
+class QThread;
 
 namespace find_object {
 
@@ -60,6 +61,7 @@ class KeypointDetector;
 class DescriptorExtractor;
 class Vocabulary;
 class FindObject;
+class DetectionWorker;
 
 class FINDOBJECT_EXP MainWindow : public QMainWindow
 {
@@ -79,11 +81,13 @@ public Q_SLOTS:
 	void startProcessing();
 	void stopProcessing();
 	void pauseProcessing();
+	// The image is detected on the detection thread, see showDetection()
 	void update(const cv::Mat & image);
 
 private Q_SLOTS:
 	void loadSession();
 	void saveSession();
+	void saveTrace();
 	void loadSettings();
 	void saveSettings();
 	void loadObjects();
@@ -111,6 +115,10 @@ private Q_SLOTS:
 	void notifyParametersChanged(const QStringList & param);
 	void moveCameraFrame(int frame);
 	void rectHovered(int objId);
+	void detectionDone(const cv::Mat & image, const find_object::DetectionInfo & info, bool detected);
+	void showPendingDetection();
+	void updateObjectCosts();
+	void resetObjectCosts();
 
 Q_SIGNALS:
 	void objectsFound(const find_object::DetectionInfo &);
@@ -126,6 +134,7 @@ private:
 	void updateObjectSize(find_object::ObjWidget * obj);
 	void updateVocabulary(const QList<int> & ids = QList<int>());
 	void updateObjects(const QList<int> & ids);
+	void showDetection(const cv::Mat & image, DetectionInfo & info, bool detected);
 
 private:
 	Ui_mainWindow * ui_;
@@ -143,6 +152,16 @@ private:
 	QMap<QString, QVariant> lastObjectsUpdateParameters_; // ParametersMap
 	TcpServer * tcpServer_;
 	cv::Mat sceneImage_;
+	QThread * detectionThread_;
+	DetectionWorker * detectionWorker_;
+	// Latest detection not shown yet, older ones are dropped (see General/guiRefreshRate)
+	cv::Mat pendingImage_;
+	DetectionInfo pendingInfo_;
+	bool pendingDetected_;
+	bool detectionPending_;
+	QTimer refreshTimer_;
+	QTime lastRefreshTime_;
+	QTime objectCostsTime_; // last refresh of the objects costs
 };
 
 } // namespace find_object
@@ -45,6 +45,7 @@ class QLabel;
 namespace find_object {
 
 class KeypointItem;
+class KeypointsItem;
 class ImageKptsView;
 
 class FINDOBJECT_EXP ObjWidget : public QWidget
@@ -68,6 +69,9 @@ public:
 	void setGraphicsViewMode(bool on);
 	void setAutoScale(bool autoScale);
 	void setSizedFeatures(bool on);
+	// In graphics view mode, all keypoints are painted by a single item
+	// instead of an item per keypoint (these can be selected and hovered)
+	void setBatchedFeatures(bool on);
 	void setMirrorView(bool on);
 	void setAlpha(int alpha);
 	void setDeletable(bool deletable);
@@ -85,6 +89,7 @@ public:
 	bool isImageShown() const;
 	bool isFeaturesShown() const;
 	bool isSizedFeatures() const;
+	bool isBatchedFeatures() const;
 	bool isMirrorView() const;
 	//QGraphicsScene * scene() const;
 	std::vector<cv::KeyPoint> selectedKeypoints() const;
@@ -107,7 +112,11 @@ Q_SIGNALS:
 
 private:
 	void setupGraphicsView();
-	void drawKeypoints(QPainter * painter = 0);
+	void drawKeypoints(QPainter * painter);
+	void createKeypointItems();
+	void updateKptRects();
+	void setKptChanged(int index);
+	void updateItemsColor();
 	void setupUi();
 	void updateItemsShown();
 	void computeScaleOffsets(float & scale, float & offsetX, float & offsetY);
@@ -119,8 +128,13 @@ private:
 	QPixmap pixmap_;
 	QRect rect_;
 	QList<KeypointItem*> keypointItems_;
+	KeypointsItem * keypointsItem_; // batched features, 0 if not in the scene
 	QGraphicsView * graphicsView_;
 	QVector<QColor> kptColors_;
+	QVector<QRectF> kptRects_;
+	// Keypoints colored since the last resetKptsColor()
+	QVector<int> changedKpts_;
+	QVector<bool> kptChanged_;
 	QList<QGraphicsRectItem*> rectItems_;
 	bool graphicsViewInitialized_;
 	int alpha_;
@@ -138,6 +152,7 @@ private:
 	QAction * graphicsViewMode_;
 	QAction * autoScale_;
 	QAction * sizedFeatures_;
+	QAction * batchedFeatures_;
 	QAction * setAlpha_;
 	QAction * setColor_;
 
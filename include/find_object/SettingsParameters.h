@@ -0,0 +1,275 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+// List of the parameters, included by Settings.h with PARAMETER() and
+// PARAMETER_COND() defined to generate the Settings accessors and the
+// fields of ParametersSnapshot. No include guard on purpose.
+//
+// PARAMETER(PREFIX, NAME, TYPE, DEFAULT_VALUE, DESCRIPTION)
+// PARAMETER_COND(PREFIX, NAME, TYPE, COND, DEFAULT_VALUE1, DEFAULT_VALUE2, DESCRIPTION)
+
+	PARAMETER(Camera, 1deviceId, int, 0, "Device ID (default 0).");
+	PARAMETER(Camera, 2imageWidth, int, 0, "Image width (0 means default width from camera).");
+	PARAMETER(Camera, 3imageHeight, int, 0, "Image height (0 means default height from camera).");
+	PARAMETER(Camera, 4imageRate, double, 10.0, "Image rate in Hz (0 Hz means as fast as possible)."); // Hz
+	PARAMETER(Camera, 5mediaPath, QString, "", "Video file or directory of images. If set, the camera is not used. See General->videoFormats and General->imageFormats for available formats.");
+	PARAMETER(Camera, 6useTcpCamera, bool, false, "Use TCP/IP input camera.");
+	PARAMETER(Camera, 8port, int, 0, "The images server's port when useTcpCamera is checked. Many image sources can be connected at the same time (a stream per connection), their images are taken in turn (round-robin) at \"Camera/4imageRate\".");
+	PARAMETER(Camera, 9queueSize, int, 1, "Maximum images buffered from TCP, per stream. If 0, all images are buffered.");
+	PARAMETER(Camera, sharedMemoryKey, QString, "", "Key of a shared memory ring of raw frames written by a producer on the same host (see find_object::SharedMemoryRing, or \"tcpImagesServer --shm\"). If set, the frames are read without encoding or TCP transfer (a single copy in a recycled buffer, the slot is released right away) and the other inputs are not used.");
+	PARAMETER(Camera, prefetch, int, 0, "Images of the directory or frames of the video file decoded ahead on background threads (0 means decoded when taken). A frame not ready yet is taken on the next tick of the camera instead of blocking it.");
+	PARAMETER(Camera, decodeGrayscale, int, 0, "Decode images of the directory, video frames and images of the TCP camera in grayscale, when only grayscale is needed (the detection converts the images to grayscale anyway): 0=color, 1=grayscale, 2, 4 or 8=grayscale at 1/2, 1/4 or 1/8 of the resolution (reduced while decoding JPEG images with OpenCV >= 3.2).");
+
+	//List format : [Index:item0;item1;item3;...]
+
+	PARAMETER_COND(Feature2D, 1Detector, QString, FINDOBJECT_NONFREE, "7:Dense;Fast;GFTT;MSER;ORB;SIFT;Star;SURF;BRISK;AGAST;KAZE;AKAZE" , "4:Dense;Fast;GFTT;MSER;ORB;SIFT;Star;SURF;BRISK;AGAST;KAZE;AKAZE", "Keypoint detector.");
+	PARAMETER_COND(Feature2D, 2Descriptor, QString, FINDOBJECT_NONFREE, "3:Brief;ORB;SIFT;SURF;BRISK;FREAK;KAZE;AKAZE;LUCID;LATCH;DAISY", "1:Brief;ORB;SIFT;SURF;BRISK;FREAK;KAZE;AKAZE;LUCID;LATCH;DAISY", "Keypoint descriptor.");
+	PARAMETER(Feature2D, 3MaxFeatures, int, 0, "Maximum features per image. If the number of features extracted is over this threshold, only X features with the highest response are kept. 0 means all features are kept. With ASIFT (\"Feature2D/4Affine\"), it is shared between the affine views according to their area and descriptors are extracted only for the features kept in each view.");
+	PARAMETER(Feature2D, 3MaxFeaturesGrid, int, 0, "With \"Feature2D/3MaxFeatures\", the features are kept over a grid of X x X cells covering the features, each cell keeping its strongest features. The budget of the cells with few features is shared by the others. Features spread over the image give fewer outliers to RANSAC than features clustered on textured areas. 0 or 1 means the strongest features of the whole image are kept.");
+	PARAMETER(Feature2D, 4Affine, bool, false, "(ASIFT) Extract features on multiple affine transformations of the image.");
+	PARAMETER(Feature2D, 5AffineCount, int, 6, "(ASIFT) Higher the value, more affine transformations will be done.");
+	PARAMETER(Feature2D, 6SubPix, bool, false, "Refines the corner locations. With SIFT/SURF, features are already subpixel, so no need to activate this.");
+	PARAMETER(Feature2D, 7SubPixWinSize, int, 3, "Half of the side length of the search window. For example, if winSize=Size(5,5) , then a 5*2+1 x 5*2+1 = 11 x 11 search window is used.");
+	PARAMETER(Feature2D, 8SubPixIterations, int, 30, "The process of corner position refinement stops after X iterations.");
+	PARAMETER(Feature2D, 9SubPixEps, float, 0.02f, "The process of corner position refinement stops when the corner position moves by less than epsilon on some iteration.");
+	PARAMETER(Feature2D, tiles, int, 1, "Split the image in X by X tiles from which features are extracted in parallel on the thread pool (see \"General/threads\"), for high resolution images. Each tile keeps only the keypoints in its own area and \"Feature2D/3MaxFeatures\" is shared between the tiles, which spreads the features over the image. 1 means the whole image is processed at once. Not used with ASIFT.");
+	PARAMETER(Feature2D, tilesOverlap, int, 32, "Pixels added around each tile (see \"Feature2D/tiles\"), so that the keypoints near the borders of its area are detected and described with their full neighborhood. Should be larger than the descriptor's patch radius.");
+
+	PARAMETER(Feature2D, Brief_bytes, int, 32, "Bytes is a length of descriptor in bytes. It can be equal 16, 32 or 64 bytes.");
+
+#if CV_MAJOR_VERSION < 3
+	PARAMETER(Feature2D, Dense_initFeatureScale, float, 1.f, "");
+	PARAMETER(Feature2D, Dense_featureScaleLevels, int, 1, "");
+	PARAMETER(Feature2D, Dense_featureScaleMul, float, 0.1f, "");
+	PARAMETER(Feature2D, Dense_initXyStep, int, 6, "");
+	PARAMETER(Feature2D, Dense_initImgBound, int, 0, "");
+	PARAMETER(Feature2D, Dense_varyXyStepWithScale, bool, true, "");
+	PARAMETER(Feature2D, Dense_varyImgBoundWithScale, bool, false, "");
+#endif
+
+	PARAMETER(Feature2D, Fast_threshold, int, 10, "Threshold on difference between intensity of the central pixel and pixels of a circle around this pixel.");
+	PARAMETER(Feature2D, Fast_nonmaxSuppression, bool, true, "If true, non-maximum suppression is applied to detected corners (keypoints).");
+	PARAMETER(Feature2D, Fast_gpu, bool, false, "GPU-FAST: Use GPU version of FAST. This option is enabled only if OpenCV is built with CUDA and GPUs are detected.");
+	PARAMETER(Feature2D, Fast_keypointsRatio, double, 0.05, "Used with FAST GPU (OpenCV 2).");
+	PARAMETER(Feature2D, Fast_maxNpoints, int, 5000, "Used with FAST GPU (OpenCV 3).");
+
+	PARAMETER(Feature2D, AGAST_threshold, int, 10, "Threshold on difference between intensity of the central pixel and pixels of a circle around this pixel.");
+	PARAMETER(Feature2D, AGAST_nonmaxSuppression, bool, true, "If true, non-maximum suppression is applied to detected corners (keypoints).");
+
+	PARAMETER(Feature2D, KAZE_extended, bool, false, "Set to enable extraction of extended (128-byte) descriptor.");
+	PARAMETER(Feature2D, KAZE_upright, bool, false, "Set to enable use of upright descriptors (non rotation-invariant).");
+	PARAMETER(Feature2D, KAZE_threshold, float, 0.001f, "Detector response threshold to accept point");
+	PARAMETER(Feature2D, KAZE_nOctaves, int, 4, "Maximum octave evolution of the image.");
+	PARAMETER(Feature2D, KAZE_nOctaveLayers, int, 4, "Default number of sublevels per scale level.");
+
+	PARAMETER(Feature2D, AKAZE_descriptorSize, int, 0, "Size of the descriptor in bits. 0 -> Full size.");
+	PARAMETER(Feature2D, AKAZE_descriptorChannels, int, 3, "Number of channels in the descriptor (1, 2, 3).");
+	PARAMETER(Feature2D, AKAZE_threshold, float, 0.001f, "Detector response threshold to accept point.");
+	PARAMETER(Feature2D, AKAZE_nOctaves, int, 4, "Maximum octave evolution of the image.");
+	PARAMETER(Feature2D, AKAZE_nOctaveLayers, int, 4, "Default number of sublevels per scale level.");
+
+	PARAMETER(Feature2D, GFTT_maxCorners, int, 1000, "Maximum number of corners to return. If there are more corners than are found, the strongest of them is returned.");
+	PARAMETER(Feature2D, GFTT_qualityLevel, double, 0.01, "Parameter characterizing the minimal accepted quality of image corners. The parameter value is multiplied by the best corner quality measure, which is the minimal eigenvalue (see cornerMinEigenVal ) or the Harris function response (see cornerHarris ). The corners with the quality measure less than the product are rejected. For example, if the best corner has the quality measure = 1500, and the qualityLevel=0.01 , then all the corners with the quality measure less than 15 are rejected.");
+	PARAMETER(Feature2D, GFTT_minDistance, double, 1, "Minimum possible Euclidean distance between the returned corners.");
+	PARAMETER(Feature2D, GFTT_blockSize, int, 3, "Size of an average block for computing a derivative covariation matrix over each pixel neighborhood. See cornerEigenValsAndVecs.");
+	PARAMETER(Feature2D, GFTT_useHarrisDetector, bool, false, "Parameter indicating whether to use a Harris detector (see cornerHarris) or cornerMinEigenVal.");
+	PARAMETER(Feature2D, GFTT_k, double, 0.04, "Free parameter of the Harris detector.");
+
+	PARAMETER(Feature2D, ORB_nFeatures, int, 500, "The maximum number of features to retain.");
+	PARAMETER(Feature2D, ORB_scaleFactor, float,  1.2f, "Pyramid decimation ratio, greater than 1. scaleFactor==2 means the classical pyramid, where each next level has 4x less pixels than the previous, but such a big scale factor will degrade feature matching scores dramatically. On the other hand, too close to 1 scale factor will mean that to cover certain scale range you will need more pyramid levels and so the speed will suffer.");
+	PARAMETER(Feature2D, ORB_nLevels, int, 8, "The number of pyramid levels. The smallest level will have linear size equal to input_image_linear_size/pow(scaleFactor, nlevels).");
+	PARAMETER(Feature2D, ORB_edgeThreshold, int, 31, "This is size of the border where the features are not detected. It should roughly match the patchSize parameter.");
+	PARAMETER(Feature2D, ORB_firstLevel, int, 0, "It should be 0 in the current implementation.");
+	PARAMETER(Feature2D, ORB_WTA_K, int, 2, "The number of points that produce each element of the oriented BRIEF descriptor. The default value 2 means the BRIEF where we take a random point pair and compare their brightnesses, so we get 0/1 response. Other possible values are 3 and 4. For example, 3 means that we take 3 random points (of course, those point coordinates are random, but they are generated from the pre-defined seed, so each element of BRIEF descriptor is computed deterministically from the pixel rectangle), find point of maximum brightness and output index of the winner (0, 1 or 2). Such output will occupy 2 bits, and therefore it will need a special variant of Hamming distance, denoted as NORM_HAMMING2 (2 bits per bin). When WTA_K=4, we take 4 random points to compute each bin (that will also occupy 2 bits with possible values 0, 1, 2 or 3).");
+	PARAMETER(Feature2D, ORB_scoreType, int, 0, "The default HARRIS_SCORE=0 means that Harris algorithm is used to rank features (the score is written to KeyPoint::score and is used to retain best nfeatures features); FAST_SCORE=1 is alternative value of the parameter that produces slightly less stable keypoints, but it is a little faster to compute.");
+	PARAMETER(Feature2D, ORB_patchSize, int, 31, "size of the patch used by the oriented BRIEF descriptor. Of course, on smaller pyramid layers the perceived image area covered by a feature will be larger.");
+	PARAMETER(Feature2D, ORB_gpu, bool, false, "GPU-ORB: Use GPU version of ORB. This option is enabled only if OpenCV is built with CUDA and GPUs are detected.");
+	PARAMETER(Feature2D, ORB_blurForDescriptor, bool, false, "GPU-ORB: blurForDescriptor parameter (OpenCV 3).");
+
+	PARAMETER(Feature2D, MSER_delta, int, 5, "");
+	PARAMETER(Feature2D, MSER_minArea, int, 60, "");
+	PARAMETER(Feature2D, MSER_maxArea, int, 14400, "");
+	PARAMETER(Feature2D, MSER_maxVariation, double, 0.25, "");
+	PARAMETER(Feature2D, MSER_minDiversity, double, 0.2, "");
+	PARAMETER(Feature2D, MSER_maxEvolution, int, 200, "");
+	PARAMETER(Feature2D, MSER_areaThreshold, double, 1.01, "");
+	PARAMETER(Feature2D, MSER_minMargin, double, 0.003, "");
+	PARAMETER(Feature2D, MSER_edgeBlurSize, int, 5, "");
+
+	PARAMETER(Feature2D, SIFT_nfeatures, int, 0, "The number of best features to retain. The features are ranked by their scores (measured in SIFT algorithm as the local contrast).");
+	PARAMETER(Feature2D, SIFT_nOctaveLayers, int, 3, "The number of layers in each octave. 3 is the value used in D. Lowe paper. The number of octaves is computed automatically from the image resolution.");
+	PARAMETER(Feature2D, SIFT_contrastThreshold, double, 0.04, "The contrast threshold used to filter out weak features in semi-uniform (low-contrast) regions. The larger the threshold, the less features are produced by the detector.");
+	PARAMETER(Feature2D, SIFT_edgeThreshold, double, 10, "The threshold used to filter out edge-like features. Note that the its meaning is different from the contrastThreshold, i.e. the larger the edgeThreshold, the less features are filtered out (more features are retained).");
+	PARAMETER(Feature2D, SIFT_sigma, double, 1.6, "The sigma of the Gaussian applied to the input image at the octave #0. If your image is captured with a weak camera with soft lenses, you might want to reduce the number.");
+	PARAMETER(Feature2D, SIFT_rootSIFT, bool, false, "RootSIFT descriptors.");
+
+	PARAMETER(Feature2D, SURF_hessianThreshold, double, 600.0, "Threshold for hessian keypoint detector used in SURF.");
+	PARAMETER(Feature2D, SURF_nOctaves, int, 4, "Number of pyramid octaves the keypoint detector will use.");
+	PARAMETER(Feature2D, SURF_nOctaveLayers, int, 2, "Number of octave layers within each octave.");
+	PARAMETER(Feature2D, SURF_extended, bool, true, "Extended descriptor flag (true - use extended 128-element descriptors; false - use 64-element descriptors).");
+	PARAMETER(Feature2D, SURF_upright, bool, false, "Up-right or rotated features flag (true - do not compute orientation of features; false - compute orientation).");
+	PARAMETER(Feature2D, SURF_gpu, bool, false, "GPU-SURF: Use GPU version of SURF. This option is enabled only if OpenCV is built with CUDA and GPUs are detected.");
+	PARAMETER(Feature2D, SURF_keypointsRatio, float, 0.01f, "Used with SURF GPU.");
+
+	PARAMETER(Feature2D, Star_maxSize, int, 45, "");
+	PARAMETER(Feature2D, Star_responseThreshold, int, 30, "");
+	PARAMETER(Feature2D, Star_lineThresholdProjected, int, 10, "");
+	PARAMETER(Feature2D, Star_lineThresholdBinarized, int, 8, "");
+	PARAMETER(Feature2D, Star_suppressNonmaxSize, int, 5, "");
+
+	PARAMETER(Feature2D, BRISK_thresh, int, 30, "FAST/AGAST detection threshold score.");
+	PARAMETER(Feature2D, BRISK_octaves, int, 3, "Detection octaves. Use 0 to do single scale.");
+	PARAMETER(Feature2D, BRISK_patternScale, float, 1.0f, "Apply this scale to the pattern used for sampling the neighbourhood of a keypoint.");
+
+	PARAMETER(Feature2D, FREAK_orientationNormalized, bool, true, "Enable orientation normalization.");
+	PARAMETER(Feature2D, FREAK_scaleNormalized, bool, true, "Enable scale normalization.");
+	PARAMETER(Feature2D, FREAK_patternScale, float, 22.0f, "Scaling of the description pattern.");
+	PARAMETER(Feature2D, FREAK_nOctaves, int, 4, "Number of octaves covered by the detected keypoints.");
+
+	PARAMETER(Feature2D, LUCID_kernel, int, 1, "Kernel for descriptor construction, where 1=3x3, 2=5x5, 3=7x7 and so forth.");
+	PARAMETER(Feature2D, LUCID_blur_kernel, int, 2, "Kernel for blurring image prior to descriptor construction, where 1=3x3, 2=5x5, 3=7x7 and so forth.");
+
+	PARAMETER(Feature2D, LATCH_bytes, int, 32, "Size of the descriptor - can be 64, 32, 16, 8, 4, 2 or 1.");
+	PARAMETER(Feature2D, LATCH_rotationInvariance, bool, true, "Whether or not the descriptor should compansate for orientation changes.");
+	PARAMETER(Feature2D, LATCH_half_ssd_size, int, 3, "The size of half of the mini-patches size. For example, if we would like to compare triplets of patches of size 7x7x then the half_ssd_size should be (7-1)/2 = 3.");
+
+	PARAMETER(Feature2D, DAISY_radius, float, 15, "Radius of the descriptor at the initial scale.");
+	PARAMETER(Feature2D, DAISY_q_radius, int, 3, "Amount of radial range division quantity.");
+	PARAMETER(Feature2D, DAISY_q_theta, int, 8, "Amount of angular range division quantity.");
+	PARAMETER(Feature2D, DAISY_q_hist, int, 8, "Amount of gradient orientations range division quantity.");
+	PARAMETER(Feature2D, DAISY_interpolation, bool, true, "Switch to disable interpolation for speed improvement at minor quality loss.");
+	PARAMETER(Feature2D, DAISY_use_orientation, bool, false, "Sample patterns using keypoints orientation, disabled by default.");
+
+	PARAMETER_COND(NearestNeighbor, 1Strategy, QString, FINDOBJECT_NONFREE, "1:Linear;KDTree;KMeans;Composite;Autotuned;Lsh;BruteForce;Hamming;PQ", "6:Linear;KDTree;KMeans;Composite;Autotuned;Lsh;BruteForce;Hamming;PQ", "Nearest neighbor strategy. \"Hamming\" is an exact search for binary descriptors using hardware popcount, multi-threaded and faster than \"BruteForce\" (which is used for non-binary descriptors). \"PQ\" compresses the vocabulary of float descriptors with product quantization (see NearestNeighbor/PQ_*), for vocabularies too large to fit in memory.");
+	PARAMETER_COND(NearestNeighbor, 2Distance_type, QString, FINDOBJECT_NONFREE, "0:EUCLIDEAN_L2;MANHATTAN_L1;MINKOWSKI;MAX;HIST_INTERSECT;HELLINGER;CHI_SQUARE_CS;KULLBACK_LEIBLER_KL;HAMMING", "1:EUCLIDEAN_L2;MANHATTAN_L1;MINKOWSKI;MAX;HIST_INTERSECT;HELLINGER;CHI_SQUARE_CS;KULLBACK_LEIBLER_KL;HAMMING", "Distance type.");
+	PARAMETER(NearestNeighbor, 3nndrRatioUsed, bool, true, "Nearest neighbor distance ratio approach to accept the best match.");
+	PARAMETER(NearestNeighbor, 4nndrRatio, float, 0.8f, "Nearest neighbor distance ratio.");
+	PARAMETER(NearestNeighbor, 5minDistanceUsed, bool, false, "Minimum distance with the nearest descriptor to accept a match.");
+	PARAMETER(NearestNeighbor, 6minDistance, float, 1.6f, "Minimum distance. You can look at top of this panel where minimum and maximum distances are shown to properly set this parameter depending of the descriptor used.");
+	PARAMETER(NearestNeighbor, 7ConvertBinToFloat, bool, false, "Convert binary descriptor to float before quantization, so you can use FLANN strategies with them.");
+
+
+	PARAMETER(NearestNeighbor, BruteForce_gpu, bool, false, "Brute force GPU");
+	PARAMETER(NearestNeighbor, BruteForce_gemm, bool, true, "Brute force on CPU of float descriptors with matrix products (squared norms of the words precomputed on update), multi-threaded and faster than OpenCV's brute force matcher. The distances of the nearest neighbors are exact.");
+
+	PARAMETER(NearestNeighbor, search_checks, int, 32, "The number of times the tree(s) in the index should be recursively traversed. A higher value for this parameter would give better search precision, but also take more time. If automatic configuration was used when the index was created, the number of checks required to achieve the specified precision was also computed, in which case this parameter is ignored.");
+	PARAMETER(NearestNeighbor, search_eps, float, 0, "");
+	PARAMETER(NearestNeighbor, search_sorted, bool, true, "");
+
+	PARAMETER(NearestNeighbor, KDTree_trees, int, 4, "The number of parallel kd-trees to use. Good values are in the range [1..16].");
+
+	PARAMETER(NearestNeighbor, Composite_trees, int, 4, "The number of parallel kd-trees to use. Good values are in the range [1..16].");
+	PARAMETER(NearestNeighbor, Composite_branching, int, 32, "The branching factor to use for the hierarchical k-means tree.");
+	PARAMETER(NearestNeighbor, Composite_iterations, int, 11, "The maximum number of iterations to use in the k-means clustering stage when building the k-means tree. A value of -1 used here means that the k-means clustering should be iterated until convergence.");
+	PARAMETER(NearestNeighbor, Composite_centers_init, QString, "0:RANDOM;GONZALES;KMEANSPP", "The algorithm to use for selecting the initial centers when performing a k-means clustering step. The possible values are CENTERS_RANDOM (picks the initial cluster centers randomly), CENTERS_GONZALES (picks the initial centers using Gonzales’ algorithm) and CENTERS_KMEANSPP (picks the initial centers using the algorithm suggested in arthur_kmeanspp_2007 ).");
+	PARAMETER(NearestNeighbor, Composite_cb_index, double, 0.2, "This parameter (cluster boundary index) influences the way exploration is performed in the hierarchical kmeans tree. When cb_index is zero the next kmeans domain to be explored is chosen to be the one with the closest center. A value greater then zero also takes into account the size of the domain.");
+
+	PARAMETER(NearestNeighbor, Autotuned_target_precision, double, 0.8, "Is a number between 0 and 1 specifying the percentage of the approximate nearest-neighbor searches that return the exact nearest-neighbor. Using a higher value for this parameter gives more accurate results, but the search takes longer. The optimum value usually depends on the application.");
+	PARAMETER(NearestNeighbor, Autotuned_build_weight, double, 0.01, "Specifies the importance of the index build time raported to the nearest-neighbor search time. In some applications it’s acceptable for the index build step to take a long time if the subsequent searches in the index can be performed very fast. In other applications it’s required that the index be build as fast as possible even if that leads to slightly longer search times.");
+	PARAMETER(NearestNeighbor, Autotuned_memory_weight, double, 0, "Is used to specify the tradeoff between time (index build time and search time) and memory used by the index. A value less than 1 gives more importance to the time spent and a value greater than 1 gives more importance to the memory usage.");
+	PARAMETER(NearestNeighbor, Autotuned_sample_fraction, double, 0.1, "Is a number between 0 and 1 indicating what fraction of the dataset to use in the automatic parameter configuration algorithm. Running the algorithm on the full dataset gives the most accurate results, but for very large datasets can take longer than desired. In such case using just a fraction of the data helps speeding up this algorithm while still giving good approximations of the optimum parameters.");
+
+	PARAMETER(NearestNeighbor, KMeans_branching, int, 32, "The branching factor to use for the hierarchical k-means tree.");
+	PARAMETER(NearestNeighbor, KMeans_iterations, int, 11, "The maximum number of iterations to use in the k-means clustering stage when building the k-means tree. A value of -1 used here means that the k-means clustering should be iterated until convergence.");
+	PARAMETER(NearestNeighbor, KMeans_centers_init, QString, "0:RANDOM;GONZALES;KMEANSPP", "The algorithm to use for selecting the initial centers when performing a k-means clustering step. The possible values are CENTERS_RANDOM (picks the initial cluster centers randomly), CENTERS_GONZALES (picks the initial centers using Gonzales’ algorithm) and CENTERS_KMEANSPP (picks the initial centers using the algorithm suggested in arthur_kmeanspp_2007 ).");
+	PARAMETER(NearestNeighbor, KMeans_cb_index, double, 0.2, "This parameter (cluster boundary index) influences the way exploration is performed in the hierarchical kmeans tree. When cb_index is zero the next kmeans domain to be explored is chosen to be the one with the closest center. A value greater then zero also takes into account the size of the domain.");
+
+	PARAMETER(NearestNeighbor, Lsh_table_number, int, 12, "The number of hash tables to use (between 10 and 30 usually).");
+	PARAMETER(NearestNeighbor, Lsh_key_size, int, 20, "The size of the hash key in bits (between 10 and 20 usually).");
+	PARAMETER(NearestNeighbor, Lsh_multi_probe_level, int, 2, "The number of bits to shift to check for neighboring buckets (0 is regular LSH, 2 is recommended).");
+
+	PARAMETER(NearestNeighbor, PQ_subQuantizers, int, 16, "Number of sub-vectors of a word, each one coded on one byte. The descriptor size must be a multiple of it. For 128 floats (512 bytes) descriptors, 16 gives 32x less memory, 64 gives 8x less memory with a better recall.");
+	PARAMETER(NearestNeighbor, PQ_coarseCells, int, 0, "Number of cells of the coarse quantizer, words are only compared to those in the nearest cells of the query. 0 means the square root of the number of words.");
+	PARAMETER(NearestNeighbor, PQ_probes, int, 8, "Number of nearest cells searched. A higher value gives a better recall, but the search takes longer.");
+	PARAMETER(NearestNeighbor, PQ_rerank, int, 0, "Number of best candidates re-ranked with their exact distance. The original words are then kept in memory, only the index is compressed. 0 means no re-ranking, the original words are released after being coded.");
+	PARAMETER(NearestNeighbor, quantization, int, 0, "Quantization of float descriptors (e.g., SIFT, SURF): 0=none, 1=8 bits (4x less memory, values mapped linearly between their minimum and maximum), 2=16 bits float (2x less memory). The descriptors of the objects and the vocabulary are saved quantized in the sessions. With \"BruteForce\" strategy on CPU, the vocabulary is also kept quantized in memory and searched on the codes (8 bits distances are vectorized).");
+
+	PARAMETER(General, autoStartCamera, bool, false, "Automatically start the camera when the application is opened.");
+	PARAMETER(General, autoUpdateObjects, bool, true, "Automatically update objects on every parameter changes, otherwise you would need to press \"Update objects\" on the objects panel.");
+	PARAMETER(General, nextObjID, uint, 1, "Next object ID to use.");
+	PARAMETER(General, imageFormats, QString, "*.png *.jpg *.bmp *.tiff *.ppm *.pgm", "Image formats supported.");
+	PARAMETER(General, videoFormats, QString, "*.avi *.m4v *.mp4", "Video formats supported.");
+	PARAMETER(General, mirrorView, bool, false, "Flip the camera image horizontally (like all webcam applications).");
+	PARAMETER(General, invertedSearch, bool, true, "Instead of matching descriptors from the objects to those in a vocabulary created with descriptors extracted from the scene, we create a vocabulary from all the objects' descriptors and we match scene's descriptors to this vocabulary. It is the inverted search mode.");
+	PARAMETER(General, controlsShown, bool, false, "Show play/image seek controls (useful with video file and directory of images modes).");
+	PARAMETER(General, threads, int, 1, "Number of threads of the pool used for features extraction, objects matching and homography computation. 0 means as many threads as CPU cores. On InvertedSearch mode, multi-threading has only effect on homography computation.");
+	PARAMETER(General, gpuPipeline, bool, false, "In inverted search with a GPU detector/extractor (\"Feature2D/SURF_gpu\" or \"Feature2D/ORB_gpu\", same type for both) and \"NearestNeighbor/BruteForce_gpu\", the scene descriptors stay on the GPU and are matched there with the words resident on the GPU: only the keypoints and the nearest neighbor results are downloaded. Not used with ASIFT, tiles, sub-pixel refining, RootSIFT or \"Feature2D/3MaxFeatures\", which need the descriptors on the host.");
+	PARAMETER(General, roiTracking, bool, false, "Track the objects detected between frames (e.g. a video stream): the next frames are processed only in the regions where the objects are predicted from their last positions. A full frame is processed when an object is lost and every \"General/roiTrackingFullFrameInterval\" frames (to find new objects). Not used with ASIFT.");
+	PARAMETER(General, roiTrackingMargin, float, 0.5, "Margin added on each side of the predicted region of a tracked object, in ratio of the region's size (see \"General/roiTracking\").");
+	PARAMETER(General, roiTrackingFullFrameInterval, int, 10, "A full frame is processed after X frames processed only in the tracked regions (see \"General/roiTracking\").");
+	PARAMETER(General, frameChangeThreshold, float, 0, "Frames not changed since the last frame detected are not detected again, its detection is returned (marked as reused). A frame is changed when the mean absolute difference of its downscaled grayscale image (64 pixels wide) with the one of the last frame detected is over this threshold (gray levels, e.g. 2). 0 means disabled.");
+	PARAMETER(General, frameChangeRefreshInterval, int, 30, "With \"General/frameChangeThreshold\", a frame is detected after X frames in a row not changed, even if it did not change. 0 means no forced detection.");
+	PARAMETER(General, coarseToFineScale, float, 0, "Coarse-to-fine detection: the objects are first detected on the scene downscaled by this ratio (e.g. 0.5), then the features are extracted at full resolution only in the regions of the objects found (see \"General/coarseToFineMargin\"), and the homography found on the downscaled scene rejects the matches far from it before the homography is computed again. Frames without object found on the downscaled scene are not processed at full resolution: small objects may be missed. 0 means disabled. Not used with ASIFT or when the frame is already restricted to the tracked regions (see \"General/roiTracking\").");
+	PARAMETER(General, coarseToFineMargin, float, 0.25, "Margin added on each side of the region of an object found on the downscaled scene, in ratio of the region's size (see \"General/coarseToFineScale\").");
+	PARAMETER(General, cascade, bool, false, "Feature cascade: the objects are first shortlisted with ORB features matched with \"NearestNeighbor/Hamming\" (the ORB features and the vocabulary of the objects are kept aside), then the features of \"Feature2D\" are extracted only in the regions of the objects found and matched only with these objects. The ORB parameters of \"Feature2D\" are used. Changes are applied when the vocabulary is updated.");
+	PARAMETER(General, cascadeMargin, float, 0.25, "Margin added on each side of the region of an object found by the first stage of the cascade, in ratio of the region's size (see \"General/cascade\").");
+	PARAMETER(General, multiDetection, bool, false, "Multiple detection of the same object.");
+	PARAMETER(General, multiDetectionRadius, int, 30, "Ignore detection of the same object in X pixels radius of the previous detections.");
+	PARAMETER(General, multiDetectionClustering, bool, false, "With \"General/multiDetection\", the matches of an object are first grouped by instance: each match predicts the position of the object's center in the scene (from the orientation and size of its keypoints), and the predictions are clustered by mean-shift with \"General/multiDetectionRadius\" as bandwidth. The homographies of the clusters are then computed in parallel, instead of computing them one after the other on the outliers of the previous detection.");
+	PARAMETER(General, port, int, 0, "Port on objects detected are published. If port=0, a port is chosen automatically.")
+	PARAMETER(General, portResultFormat, int, 0, "Format of the detections published on \"General/port\": 0=QDataStream of DetectionInfo with a 16 bits size (limited to 64 KB, with the file paths of the objects), 1=compact format with a 32 bits size (ID, size, homography and inliers/outliers count of each detection, see find_object::writeCompactDetectionInfo()), 2=compact format with the scene keypoints and the inliers of each detection.");
+	PARAMETER(General, autoScroll, bool, true, "Auto scroll to detected object in Objects panel.");
+	PARAMETER(General, vocabularyFixed, bool, false, "If the vocabulary is fixed, no new words will be added to it when adding new objects.");
+	PARAMETER(General, vocabularyIncremental, bool, false, "The vocabulary is created incrementally. When new objects are added, their descriptors are compared to those already in vocabulary to find if the visual word already exist or not. \"NearestNeighbor/nndrRatio\" and \"NearestNeighbor/minDistance\" are used to compare descriptors.");
+	PARAMETER(General, vocabularyUpdateMinWords, int, 2000, "When the vocabulary is incremental (see \"General/vocabularyIncremental\"), after X words added to vocabulary, the internal index is updated with new words. This parameter lets avoiding to reconstruct the whole nearest neighbor index after each time descriptors of an object are added to vocabulary. 0 means no incremental update.");
+	PARAMETER(General, vocabularyDeltaRatio, float, 0.1, "When new words are added to the vocabulary, they are indexed in a small delta index searched with the main one instead of rebuilding the whole nearest neighbor index. When the delta index becomes larger than this ratio of the main index size, all words are merged in the main index. 0 means the main index is always rebuilt. Not used with brute force nearest neighbor.");
+	PARAMETER(General, vocabularyTreePath, QString, "", "Path to a vocabulary tree trained offline with find_object-vocabulary-tree (hierarchical k-means of descriptors). Used in inverted search: the words are the leaves of the tree, object and scene descriptors are quantized by descending the tree (branching x depth comparisons) instead of searching the vocabulary, and objects are found from the inverted files of the words. Combine with \"Homography/candidatesTopK\" for large object databases. Descriptors must be of the same type and size as the tree.");
+	PARAMETER(General, featureCachePath, QString, "", "Path to a directory where the features extracted from the objects are saved, named by the hash of the image and of the \"Feature2D\" parameters. When the objects are updated (e.g. after changing other parameters) or loaded again, the features of an unchanged image with the same \"Feature2D\" parameters are read from the cache instead of being extracted. Empty means no cache.");
+	PARAMETER(General, imageCacheSize, int, 256, "When the object images are not kept in RAM, they stay encoded (file or session bytes) and are decoded on use (optical flow, display, update of the objects) in a cache shared by all objects. The least recently used images are removed from the cache above this size (MB). The cache is shared by the whole process: its size is set by the application (FindObject::setImageCacheSize()), not by the parameters of each FindObject instance.");
+	PARAMETER(General, memoryBudget, int, 0, "Objects are not added anymore when the objects, the vocabulary and its index use more than this size (MB), see the memory logged after each update of the vocabulary. Sessions are still loaded entirely. 0 means no limit.");
+	PARAMETER(General, sessionCompression, int, 0, "Compression of the descriptors and vocabulary words in the sessions saved: 0=a single zlib block per matrix (limited to 2 GB), 1 to 9=zlib level of chunks compressed in parallel on all cores, without size limit (1 is the fastest). Not used with \"General/sessionMemoryMapped\" and \"General/sessionLegacyFormat\".");
+	PARAMETER(General, sessionLegacyFormat, bool, false, "Save sessions in the format read by the versions without packed keypoints, chunked compression and saved index: keypoints field by field, descriptors and vocabulary words in a single zlib block (limited to 2 GB), the nearest neighbor index is rebuilt on load. Older versions crash on the sessions saved otherwise. \"General/sessionCompression\" and \"General/sessionMemoryMapped\" are not used, descriptors are saved unquantized (\"NearestNeighbor/quantization\").");
+	PARAMETER(General, sessionJournal, bool, false, "The objects added or removed one at a time (e.g. by TCP requests, see addObjectAndUpdate() and removeObjectAndUpdate()) after a session is loaded or saved are appended to a journal next to the session (\"<session>.journal\") instead of saving the whole session. The journal is replayed when the session is loaded, then merged in the session when it is saved again.");
+	PARAMETER(General, sessionJournalCompaction, int, 64, "When \"General/sessionJournal\" is enabled, the session is saved again in background (merging the journal) when the journal becomes larger than this size (MB). 0 means the journal is only merged on the next save of the session.");
+	PARAMETER(General, sessionMemoryMapped, bool, false, "Save sessions in an uncompressed and aligned format that is memory-mapped on load: descriptors and vocabulary words are used in place from the file instead of being uncompressed, and their memory is shared between processes loading the same session. Sessions are larger on disk.");
+	PARAMETER(General, sendNoObjDetectedEvents, bool, true, "When there are no objects detected, send an empty object detection event.");
+	PARAMETER(General, autoPauseOnDetection, bool, false, "Auto pause the camera when an object is detected.");
+	PARAMETER(General, autoScreenshotPath, QString, "", "Path to a directory to save screenshot of the current camera view when there is a detection.");
+	PARAMETER(General, guiRefreshRate, int, 30, "Maximum rate (Hz) at which the detections are shown in the GUI. Detections are done on their own thread: a detection finished before the GUI is refreshed replaces the one not shown yet (all detections are still published on \"General/port\"). 0 means the GUI is refreshed on each detection.");
+	PARAMETER(General, debug, bool, false, "Show debug logs on terminal.");
+
+	PARAMETER(Homography, homographyComputed, bool, true, "Compute homography? On ROS, this is required to publish objects detected.");
+	PARAMETER(Homography, method, QString, "1:LMEDS;RANSAC;RHO;PROSAC;USAC", "Type of the robust estimation algorithm: least-median algorithm or RANSAC algorithm. RHO and PROSAC sample the matches with the best nearest neighbor distance ratio first, which needs far fewer iterations on objects with few inliers. PROSAC and USAC (OpenCV >= 4.5.1, otherwise RHO and RANSAC) also stop early on bad models with the SPRT test.");
+	PARAMETER(Homography, ransacReprojThr, double, 3.0, "Maximum allowed reprojection error to treat a point pair as an inlier (used in the RANSAC method only). It usually makes sense to set this parameter somewhere in the range of 1 to 10.");
+#if CV_MAJOR_VERSION >= 3
+	PARAMETER(Homography, maxIterations, int, 2000, "The maximum number of RANSAC iterations, 2000 is the maximum it can be.");
+	PARAMETER(Homography, confidence, double, 0.995, "Confidence level, between 0 and 1.");
+#endif
+	PARAMETER(Homography, minimumInliers, int, 10, "Minimum inliers to accept the homography. Value must be >= 4.");
+	PARAMETER(Homography, preCheck, bool, false, "Before computing the homography of an object, the matches vote for the rotation and scale change between the object and the scene (histogram of the differences of their keypoint orientations and sizes). Objects without \"Homography/minimumInliers\" matches agreeing on a rotation and scale are rejected without RANSAC. Ignored when the keypoints have no orientation nor size.");
+	PARAMETER(Homography, candidatesTopK, int, 0, "Only the K objects with the best score are verified by homography, the others are rejected. In inverted search, objects are scored by TF-IDF weighting of the visual words matched with the scene, otherwise by their number of matches. 0 means all objects with enough matches (see \"Homography/minimumInliers\") are verified.");
+	PARAMETER(Homography, ignoreWhenAllInliers, bool, false, "Ignore homography when all features are inliers (sometimes when the homography doesn't converge, it returns the best homography with all features as inliers).");
+	PARAMETER(Homography, rectBorderWidth, int, 4, "Homography rectangle border width.");
+	PARAMETER(Homography, allCornersVisible, bool, false, "All corners of the detected object must be visible in the scene.");
+	PARAMETER(Homography, minAngle, int, 0, "(Degrees) Homography minimum angle. Set 0 to disable. When the angle is very small, this is a good indication that the homography is wrong. A good value is over 60 degrees.");
+	PARAMETER(Homography, opticalFlow, bool, false, "Activate optical flow to refine matched features before computing the homography.");
+	PARAMETER(Homography, opticalFlowWinSize, int, 16, "Size of the search window at each pyramid level.");
+	PARAMETER(Homography, opticalFlowMaxLevel, int, 3, "0-based maximal pyramid level number; if set to 0, pyramids are not used (single level), if set to 1, two levels are used, and so on; if pyramids are passed to input then algorithm will use as many levels as pyramids have but no more than maxLevel.");
+	PARAMETER(Homography, opticalFlowIterations, int, 30, "Specifying the termination criteria of the iterative search algorithm (after the specified maximum number of iterations).");
+	PARAMETER(Homography, opticalFlowEps, float, 0.01f, "Specifying the termination criteria of the iterative search algorithm (when the search window moves by less than epsilon).");
+	PARAMETER(Homography, opticalFlowTracking, bool, false, "Track the inliers of the detected objects in the next frames with pyramidal optical flow (see \"Homography/opticalFlowWinSize\" and the other optical flow parameters) and update their homography from the tracked points, instead of extracting and matching features. Features are extracted and matched again when an object has less than \"Homography/opticalFlowTrackingMinInliers\" inliers. New objects in the scene are not found while tracking. Meant for a single stream of frames.");
+	PARAMETER(Homography, opticalFlowTrackingMinInliers, int, 20, "Minimum inliers tracked to keep tracking an object with optical flow (see \"Homography/opticalFlowTracking\"), otherwise a full detection is done. Value must be >= 4.");
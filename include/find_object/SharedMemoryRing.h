@@ -0,0 +1,89 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef SHAREDMEMORYRING_H_
+#define SHAREDMEMORYRING_H_
+
+#include "find_object/FindObjectExp.h" // DLL export/import defines
+
+#include <QtCore/QSharedMemory>
+#include <QtCore/QString>
+#include <opencv2/opencv.hpp>
+
+namespace find_object {
+
+// Ring of raw frames in shared memory between a producer on the same host
+// (create()) and find-object (attach(), see Camera/sharedMemoryKey). Frames
+// are written in place by the producer (beginWrite()/endWrite()) and read in
+// place by the consumer (take()): there is no encoding. A slot taken by the
+// consumer is not overwritten until it is released, the producer uses the
+// other slots or drops the frame if they are all taken. Camera copies the
+// frame and releases the slot at once, as it cannot know when the frames
+// emitted are no longer used.
+class FINDOBJECT_EXP SharedMemoryRing
+{
+public:
+	SharedMemoryRing();
+	~SharedMemoryRing();
+
+	// Producer: slotSize is the maximum bytes of a frame (height*step)
+	bool create(const QString & key, int slotCount, int slotSize);
+	// Consumer
+	bool attach(const QString & key);
+	void detach();
+	bool isAttached() const {return memory_.isAttached();}
+
+	int slotCount() const;
+	int slotSize() const;
+
+	// Producer: the returned image is in the shared memory, empty if the
+	// frame is too large or if all slots are taken by the consumer.
+	cv::Mat beginWrite(int width, int height, int type);
+	void endWrite();
+	bool write(const cv::Mat & image); // copy of the image, beginWrite()+endWrite()
+
+	// Consumer: newest frame published since the last one taken, empty if none.
+	// The image is valid until release(slot) is called.
+	cv::Mat take(int & slot);
+	void release(int slot);
+
+private:
+	struct Header;
+	struct Slot;
+	Header * header() const;
+	Slot * slot(int index) const;
+	uchar * slotData(int index) const;
+
+private:
+	QSharedMemory memory_;
+	int writing_; // slot being written by the producer, -1 if none
+	quint64 lastTaken_; // sequence of the last frame taken by the consumer
+};
+
+} // namespace find_object
+
+#endif /* SHAREDMEMORYRING_H_ */
@@ -34,6 +34,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <opencv2/opencv.hpp>
 
 #include <QtNetwork/QTcpServer>
+#include <QtCore/QAtomicInt>
 
 namespace find_object {
 
@@ -45,9 +46,35 @@ class FINDOBJECT_EXP TcpServer : public QTcpServer
 
 public:
 	enum Service {
-		kAddObject,    // id fileName imageSize image
-		kRemoveObject, // id
-		kDetectObject  // image
+		kAddObject,      // id fileName imageSize image
+		kRemoveObject,   // id
+		kDetectObject,   // image
+		kDetectRawImage, // width height stride (qint32) pixels (8 bits grayscale, height*stride bytes)
+		kDetectFeatures, // width height count (qint32), per keypoint: x y size angle response (float) octave class_id (qint32),
+		                 // descriptors: rows cols type (qint32, CV_8UC1 or CV_32FC1) data (rows*cols*elemSize bytes)
+		kReadiness       // no payload, acknowledged "1" (kStatusOk with a request ID) when ready to
+		                 // detect, "0" (kStatusFailed) while warming up, see setReady()
+	};
+	// Set on the service type, followed by a request ID (quint32). Instead of the
+	// "1"/"0" acknowledge, the response is [size][request ID][status] (quint32)
+	// followed by the DetectionInfo (see ResultFormat) for detections, sent only
+	// to the requester when its detection is done. Many requests can be
+	// outstanding per connection.
+	static const quint32 kRequestId = 0x80000000;
+	// Set on the service type with kRequestId, followed (after the request ID) by
+	// a time budget in ms (quint32). A detection that cannot be done in time is
+	// answered with kStatusFailed without being processed, or with a degraded
+	// result (kStatusDegraded, see FindObject::detectDegraded()).
+	static const quint32 kDeadline = 0x40000000;
+	enum Status {
+		kStatusFailed,
+		kStatusOk,
+		kStatusDegraded
+	};
+	enum ResultFormat {
+		kResultQDataStream,  // [quint16 size][DetectionInfo]
+		kResultCompact,      // [quint32 size][compact DetectionInfo], see writeCompactDetectionInfo()
+		kResultCompactFull   // kResultCompact with the scene keypoints and the inliers
 	};
 
 public:
@@ -55,9 +82,27 @@ public:
 
 	QHostAddress getHostAddress() const;
 	quint16 getPort() const;
+	// Scenes received are decoded in grayscale (they are converted to grayscale
+	// for the detection anyway), when they are not displayed
+	void setGrayscaleDecoding(bool enabled) {grayscale_ = enabled;}
+	// Format of the published detections and of the results of requests
+	// with ID, set from "General/portResultFormat" on construction
+	void setResultFormat(int format) {resultFormat_ = format;}
+	int resultFormat() const {return resultFormat_;}
+	// Answer of the kReadiness service (ready by default), thread-safe
+	void setReady(bool ready) {ready_.fetchAndStoreOrdered(ready?1:0);}
+	bool isReady() const {return ready_.fetchAndAddAcquire(0) != 0;}
+	// Heavy fields of the detections (DetectionInfo::Field flags) sent with the result format
+	int usedFields() const {return resultFormat_==kResultCompactFull?DetectionInfo::kSceneKeypoints|DetectionInfo::kDetectedMatches:0;}
+
+	// Block sent to the clients by publishDetectionInfo()
+	static QByteArray serialize(const find_object::DetectionInfo & info, int format = kResultQDataStream);
 
 public Q_SLOTS:
 	void publishDetectionInfo(const find_object::DetectionInfo & info);
+	void publishData(const QByteArray & block); // block from serialize()
+	void publishResult(const find_object::DetectionInfo & info, qint64 ticket, bool degraded = false); // ticket of a request with ID
+	void rejectRequest(qint64 ticket); // the request with ID is answered with a failed status
 
 private Q_SLOTS:
 	void addClient();
@@ -69,9 +114,28 @@ Q_SIGNALS:
 	void addObject(const cv::Mat &, int, const QString &);
 	void removeObject(int);
 	void detectObject(const cv::Mat &);
+	void detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &); // keypoints, descriptors, image size
+	// Requests with ID, the result should be sent back to publishResult() with the ticket.
+	// The deadline is in ms since epoch (QDateTime::currentMSecsSinceEpoch()), 0 if none.
+	void detectObject(const cv::Mat &, qint64, qint64); // image, ticket, deadline
+	void detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64); // ..., ticket, deadline
+
+private:
+	bool readRequest(QTcpSocket * client);
+	qint64 addPendingRequest(QTcpSocket * client, quint32 requestId);
+	void sendResponse(QTcpSocket * client, quint32 requestId, Status status, const find_object::DetectionInfo * info = 0);
+	cv::Mat * recycledScene();
+	cv::Mat decodeScene(const std::vector<unsigned char> & buffer, int size);
 
 private:
 	QMap<int, quint64> blockSizes_;
+	QMap<QTcpSocket*, std::vector<unsigned char> > buffers_; // receive buffer of each client, reused between requests
+	QList<cv::Mat> scenes_; // decoded scenes, reused by imdecode() when not referenced anymore
+	bool grayscale_;
+	int resultFormat_;
+	mutable QAtomicInt ready_;
+	QMap<qint64, QPair<QTcpSocket*, quint32> > pendingRequests_; // <ticket, <client, request ID> >
+	qint64 nextTicket_;
 };
 
 } // namespace find_object
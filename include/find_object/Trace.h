@@ -0,0 +1,110 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "find_object/FindObjectExp.h" // DLL export/import defines
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+
+namespace find_object {
+
+// Spans of the detections (frame, stage, object task) recorded per thread
+// in ring buffers without lock, the oldest spans are overwritten. They are
+// dumped in the Chrome trace event format (chrome://tracing or
+// https://ui.perfetto.dev). Spans are recorded only when built with
+// WITH_TRACE (FINDOBJECT_TRACE defined), see FINDOBJECT_TRACE_SPAN().
+class FINDOBJECT_EXP Trace
+{
+public:
+	// Enabled by default when built with WITH_TRACE
+	static void setEnabled(bool enabled);
+	static bool isEnabled() {return enabled_;}
+	// Spans kept per thread, for the threads recording their first span after this call
+	static void setCapacity(int spans);
+	static bool isCompiled();
+
+	// Time since the first call in us
+	static qint64 now();
+	// name and category must be string literals (not copied), arg is
+	// shown in the span (e.g. object ID) if >= 0
+	static void record(const char * name, const char * category, qint64 start, qint64 duration, int arg = -1);
+
+	// Spans recorded (a span being recorded during the call may be missing)
+	static QByteArray toJson();
+	static bool save(const QString & path);
+	static void clear();
+
+private:
+	static bool enabled_;
+};
+
+// Records the span from its construction to end() or its destruction
+class TraceSpan
+{
+public:
+	TraceSpan(const char * name, const char * category, int arg = -1) :
+		name_(name),
+		category_(category),
+		arg_(arg),
+		start_(Trace::isEnabled()?Trace::now():-1)
+	{}
+	~TraceSpan() {end();}
+	void end()
+	{
+		if(start_ >= 0)
+		{
+			Trace::record(name_, category_, start_, Trace::now()-start_, arg_);
+			start_ = -1;
+		}
+	}
+
+private:
+	const char * name_;
+	const char * category_;
+	int arg_;
+	qint64 start_;
+};
+
+} // namespace find_object
+
+// FINDOBJECT_TRACE_SPAN(var, name, category) records a span from this line
+// to the end of the scope or FINDOBJECT_TRACE_END(var), nothing is compiled
+// without FINDOBJECT_TRACE. FINDOBJECT_TRACE_SPAN_ID() adds an ID to the span.
+#ifdef FINDOBJECT_TRACE
+#define FINDOBJECT_TRACE_SPAN(var, name, category) find_object::TraceSpan var(name, category)
+#define FINDOBJECT_TRACE_SPAN_ID(var, name, category, id) find_object::TraceSpan var(name, category, id)
+#define FINDOBJECT_TRACE_END(var) var.end()
+#else
+#define FINDOBJECT_TRACE_SPAN(var, name, category)
+#define FINDOBJECT_TRACE_SPAN_ID(var, name, category, id)
+#define FINDOBJECT_TRACE_END(var)
+#endif
+
+#endif /* TRACE_H_ */
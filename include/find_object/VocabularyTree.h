@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef VOCABULARYTREE_H_
+#define VOCABULARYTREE_H_
+
+#include "find_object/FindObjectExp.h" // DLL export/import defines
+
+#include <QtCore/QString>
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+namespace find_object {
+
+// Hierarchical k-means tree of visual words (Nister and Stewenius, 2006).
+// Float descriptors are clustered with k-means and compared with the
+// squared L2 distance, binary descriptors (CV_8U) are clustered with
+// k-majority and compared with the Hamming distance. The leaves are the
+// words: a descriptor is quantized by descending the tree, comparing it
+// only to the children of one node per level (branching x depth
+// comparisons instead of one per word).
+class FINDOBJECT_EXP VocabularyTree
+{
+public:
+	VocabularyTree();
+
+	// Cluster the descriptors in branching clusters per node, up to depth
+	// levels (at most branching^depth words). A cluster with less than
+	// branching descriptors becomes a word.
+	bool train(const cv::Mat & descriptors, int branching, int depth, int iterations = 10);
+
+	// OpenCV FileStorage format (*.yml, *.xml, add .gz to compress)
+	bool save(const QString & path) const;
+	bool load(const QString & path);
+
+	bool empty() const {return words_.empty();}
+	int branching() const {return branching_;}
+	int depth() const {return depth_;}
+	int type() const {return words_.type();}
+	int dim() const {return words_.cols;}
+	// Centers of the leaves, row i is word i
+	const cv::Mat & words() const {return words_;}
+	qint64 memoryUsage() const
+	{
+		return qint64(nodesCenters_.total()*nodesCenters_.elemSize() + words_.total()*words_.elemSize() +
+				(childrenBegin_.size() + childrenCount_.size() + children_.size())*sizeof(int));
+	}
+
+	// Like Vocabulary::search(): results (CV_32SC1) are word ids, dists
+	// (CV_32FC1) the distances to the words. With k=2, the second column
+	// is the distance to the closest sibling of the word (-1 id), for the
+	// nearest neighbor distance ratio test.
+	void quantize(const cv::Mat & descriptors, cv::Mat & results, cv::Mat & dists, int k) const;
+	int quantize(const cv::Mat & descriptor, float & distance, float & secondDistance) const;
+
+private:
+	void build(int node, const cv::Mat & descriptors, int level, int iterations);
+	float distance(const cv::Mat & a, const cv::Mat & b) const;
+
+private:
+	int branching_;
+	int depth_;
+	cv::Mat nodesCenters_; // row i is the center of node i (row 0 is the root, not used)
+	cv::Mat words_;
+	// Children of node i are children_[childrenBegin_[i]] to children_[childrenBegin_[i]+childrenCount_[i]-1],
+	// a child >= 0 is a node, a child < 0 is the word -child-1
+	std::vector<int> childrenBegin_;
+	std::vector<int> childrenCount_;
+	std::vector<int> children_;
+};
+
+} // namespace find_object
+
+#endif /* VOCABULARYTREE_H_ */
@@ -49,7 +49,7 @@
 /*
  * Convenient macros for logging...
  */
-#define ULOGGER_LOG(level, ...) ULogger::write(level, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__)
+#define ULOGGER_LOG(level, ...) (ULogger::isEnabled(level)?ULogger::write(level, __FILE__, __LINE__, __FUNCTION__, __VA_ARGS__):(void)0)
 
 #define ULOGGER_DEBUG(...)   ULOGGER_LOG(ULogger::kDebug,   __VA_ARGS__)
 #define ULOGGER_INFO(...)    ULOGGER_LOG(ULogger::kInfo,    __VA_ARGS__)
@@ -136,6 +136,12 @@
  * buffered messages will be written to file on appllciation exit (ULogger destructor) or when
  * ULogger::flush() is called.
  *
+ * With many threads logging, ULogger::setAsync() can be set to true: the
+ * messages are formatted by the threads logging, then written to the
+ * console or the file by a background thread (no lock is taken while logging).
+ * The arguments of the macros are not evaluated when the message's level is
+ * not logged.
+ *
  * If you want the application to exit on a lower severity level than kFatal,
  * you can set ULogger::setExitLevel() to any ULogger::Type you want.
  *
@@ -287,6 +293,26 @@ public:
     static void setBuffered(bool buffered);
     static bool isBuffered() {return buffered_;}
 
+    /**
+     * Set if the messages are written asynchronously, default false. When true,
+     * each thread formats its messages in its own lock-free ring buffer
+     * of "bufferSize" bytes, drained by a background thread writing them to the
+     * logger. When a ring buffer is full, the messages are dropped (the count
+     * is logged). Messages of different threads may be written out of order.
+     * Messages at the exit level are written synchronously, after those waiting.
+     * ULogger::flush() writes the messages waiting.
+     * @param async true to write messages asynchronously, otherwise set to false.
+     * @param bufferSize size of the ring buffer of each thread (rounded up to a power of 2).
+     */
+    static void setAsync(bool async, int bufferSize = 262144);
+    static bool isAsync() {return async_;}
+
+    /**
+     * If a message at this level would be logged, used by the macros to
+     * skip the formatting of the messages not logged.
+     */
+    static bool isEnabled(ULogger::Level level) {return level >= level_ && (type_ != kTypeNoLog || level >= kFatal) && !exitingState_;}
+
     /**
      * Set logger level: default kInfo. All messages over the severity set
      * are printed, other are ignored. The severity is from the lowest to
@@ -400,6 +426,7 @@ protected:
      * @see Destroyer
      */
     friend class UDestroyer<ULogger>;
+    friend class ULogWriter;
     
     /*
      * The log file name.
@@ -420,6 +447,18 @@ private:
      */
     static ULogger* createInstance();
 
+    /*
+     * Parts of the messages, see write().
+     */
+    static std::string levelString(ULogger::Level level);
+    static std::string whereString(const char * file, int line, const char * function);
+    static const char * colorString(ULogger::Level level);
+
+    /*
+     * Write messages drained from the ring buffers (async mode).
+     */
+    static void writeDrained(const std::string & msgs);
+
     /*
      * Write a message on the output with the format :
      * "A message". Inherited class
@@ -524,6 +563,12 @@ private:
 
 	static std::string bufferedMsgs_;
 
+	/*
+	 * If the messages are written by a background thread.
+	 * Default is false.
+	 */
+	static bool async_;
+
 	/*
 	 * State attribute. This state happens when an exit level
 	 * message is received.
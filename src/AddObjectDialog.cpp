@@ -69,6 +69,7 @@ AddObjectDialog::AddObjectDialog(Camera * camera, const cv::Mat & image, bool mi
 	connect(ui_->cameraView, SIGNAL(selectionChanged()), this, SLOT(updateNextButton()));
 	connect(ui_->cameraView, SIGNAL(roiChanged(const cv::Rect &)), this, SLOT(updateNextButton(const cv::Rect &)));
 	ui_->cameraView->setMirrorView(mirrorView);
+	ui_->cameraView->setBatchedFeatures(false); // keypoints are selected in the graphics view
 
 	if((camera_ && camera_->isRunning()) || image.empty())
 	{
@@ -33,15 +33,223 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <stdio.h>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <QtCore/QFile>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QMap>
+#include <limits>
 #include "utilite/UDirectory.h"
 #include "CameraTcpServer.h"
+#include "find_object/SharedMemoryRing.h"
 
 namespace find_object {
 
+// Grayscale and reduced image, see Camera/decodeGrayscale
+static cv::Mat reduceImage(const cv::Mat & image, int decodeGrayscale)
+{
+	if(decodeGrayscale <= 0 || image.empty())
+	{
+		return image;
+	}
+	cv::Mat grayscale = image;
+	if(image.channels() > 1)
+	{
+		cv::cvtColor(image, grayscale, cv::COLOR_BGR2GRAY);
+	}
+	if(decodeGrayscale > 1)
+	{
+		cv::Mat reduced;
+		cv::resize(grayscale, reduced, cv::Size(), 1.0/decodeGrayscale, 1.0/decodeGrayscale, cv::INTER_AREA);
+		return reduced;
+	}
+	return grayscale;
+}
+
+// decoded is false when the image should still be reduced with reduceImage()
+static int imreadFlags(int decodeGrayscale, bool & decoded)
+{
+	decoded = false;
+	if(decodeGrayscale <= 0)
+	{
+		return cv::IMREAD_COLOR;
+	}
+#if CV_MAJOR_VERSION > 3 || (CV_MAJOR_VERSION == 3 && CV_MINOR_VERSION >= 2)
+	// JPEG images are decoded directly at the reduced resolution
+	decoded = true;
+	if(decodeGrayscale == 2)
+	{
+		return cv::IMREAD_REDUCED_GRAYSCALE_2;
+	}
+	else if(decodeGrayscale == 4)
+	{
+		return cv::IMREAD_REDUCED_GRAYSCALE_4;
+	}
+	else if(decodeGrayscale == 8)
+	{
+		return cv::IMREAD_REDUCED_GRAYSCALE_8;
+	}
+	decoded = decodeGrayscale == 1;
+#endif
+	return cv::IMREAD_GRAYSCALE;
+}
+
+cv::Mat Camera::readImage(const std::string & path, int decodeGrayscale)
+{
+	bool decoded;
+	cv::Mat image = cv::imread(path, imreadFlags(decodeGrayscale, decoded));
+	return decoded?image:reduceImage(image, decodeGrayscale);
+}
+
+cv::Mat Camera::decodeImage(const std::vector<unsigned char> & buffer, int decodeGrayscale)
+{
+	bool decoded;
+	cv::Mat image = cv::imdecode(buffer, decodeGrayscale<=0?cv::IMREAD_UNCHANGED:imreadFlags(decodeGrayscale, decoded));
+	return decodeGrayscale<=0 || decoded?image:reduceImage(image, decodeGrayscale);
+}
+
+// Decodes the next images of a directory (multiple threads) or reads the
+// next frames of a video (one thread) ahead, images are taken in order.
+class ImagePrefetcher
+{
+public:
+	ImagePrefetcher(const QList<std::string> & images, unsigned int first, int ahead, int decodeGrayscale) :
+		images_(images),
+		capture_(0),
+		ahead_(ahead>0?ahead:1),
+		decodeGrayscale_(decodeGrayscale),
+		scheduled_(first),
+		next_(first),
+		end_(images.size()),
+		stopped_(false)
+	{
+		int threads = qMax(1, qMin(ahead_, QThread::idealThreadCount()));
+		for(int i=0; i<threads; ++i)
+		{
+			readers_.push_back(new Reader(this));
+			readers_.back()->start();
+		}
+	}
+	ImagePrefetcher(cv::VideoCapture * capture, int ahead, int decodeGrayscale) :
+		capture_(capture),
+		ahead_(ahead>0?ahead:1),
+		decodeGrayscale_(decodeGrayscale),
+		scheduled_(0),
+		next_(0),
+		end_(std::numeric_limits<unsigned int>::max()),
+		stopped_(false)
+	{
+		UASSERT(capture != 0);
+		readers_.push_back(new Reader(this));
+		readers_.back()->start();
+	}
+	~ImagePrefetcher()
+	{
+		mutex_.lock();
+		stopped_ = true;
+		slotFree_.wakeAll();
+		mutex_.unlock();
+		for(int i=0; i<readers_.size(); ++i)
+		{
+			readers_[i]->wait();
+			delete readers_[i];
+		}
+	}
+
+	// Return false if the next image is not decoded yet. An empty image is
+	// returned at the end of the directory or video.
+	bool take(cv::Mat & image)
+	{
+		QMutexLocker locker(&mutex_);
+		if(next_ >= end_)
+		{
+			image = cv::Mat();
+			return true;
+		}
+		QMap<unsigned int, cv::Mat>::iterator iter = ready_.find(next_);
+		if(iter == ready_.end())
+		{
+			return false;
+		}
+		image = iter.value();
+		ready_.erase(iter);
+		++next_;
+		slotFree_.wakeAll();
+		return true;
+	}
+
+private:
+	class Reader : public QThread
+	{
+	public:
+		Reader(ImagePrefetcher * prefetcher) : prefetcher_(prefetcher) {}
+	protected:
+		virtual void run() {prefetcher_->readLoop();}
+	private:
+		ImagePrefetcher * prefetcher_;
+	};
+
+	void readLoop()
+	{
+		while(true)
+		{
+			unsigned int index;
+			{
+				QMutexLocker locker(&mutex_);
+				while(!stopped_ && (scheduled_ >= end_ || scheduled_ - next_ >= (unsigned int)ahead_))
+				{
+					slotFree_.wait(&mutex_);
+				}
+				if(stopped_)
+				{
+					return;
+				}
+				index = scheduled_++;
+			}
+
+			cv::Mat image;
+			if(capture_)
+			{
+				cv::Mat frame;
+				capture_->read(frame);
+				image = decodeGrayscale_>0?reduceImage(frame, decodeGrayscale_):frame.clone(); // clone required with VideoCapture::read()
+			}
+			else
+			{
+				image = Camera::readImage(images_[index], decodeGrayscale_);
+			}
+
+			QMutexLocker locker(&mutex_);
+			ready_.insert(index, image);
+			if(capture_ && image.empty())
+			{
+				end_ = index; // end of the video
+			}
+		}
+	}
+
+private:
+	QList<std::string> images_;
+	cv::VideoCapture * capture_;
+	int ahead_;
+	int decodeGrayscale_;
+	QMutex mutex_;
+	QWaitCondition slotFree_;
+	unsigned int scheduled_; // next image to read
+	unsigned int next_; // next image to take
+	unsigned int end_;
+	bool stopped_;
+	QMap<unsigned int, cv::Mat> ready_;
+	QList<Reader*> readers_;
+};
+
 Camera::Camera(QObject * parent) :
 	QObject(parent),
 	currentImageIndex_(0),
-	cameraTcpServer_(0)
+	cameraTcpServer_(0),
+	prefetcher_(0),
+	sharedMemory_(0),
+	videoFrames_(0),
+	streamId_(-1)
 {
 	qRegisterMetaType<cv::Mat>("cv::Mat");
 	connect(&cameraTimer_, SIGNAL(timeout()), this, SLOT(takeImage()));
@@ -55,6 +263,8 @@ Camera::~Camera()
 void Camera::stop()
 {
 	stopTimer();
+	delete prefetcher_;
+	prefetcher_ = 0;
 	capture_.release();
 	images_.clear();
 	currentImageIndex_ = 0;
@@ -64,6 +274,35 @@ void Camera::stop()
 		delete cameraTcpServer_;
 		cameraTcpServer_ = 0;
 	}
+	if(sharedMemory_)
+	{
+		sharedMemoryFrames_.clear();
+		delete sharedMemory_;
+		sharedMemory_ = 0;
+	}
+}
+
+// A buffer not referenced anymore by the frames emitted
+cv::Mat * Camera::recycledFrame()
+{
+	for(QList<cv::Mat>::iterator iter=sharedMemoryFrames_.begin(); iter!=sharedMemoryFrames_.end(); ++iter)
+	{
+#if CV_MAJOR_VERSION < 3
+		bool shared = iter->refcount && *iter->refcount > 1;
+#else
+		bool shared = iter->u && iter->u->refcount > 1;
+#endif
+		if(!shared)
+		{
+			return &(*iter);
+		}
+	}
+	if(sharedMemoryFrames_.size() < qMax(2, sharedMemory_->slotCount()))
+	{
+		sharedMemoryFrames_.push_back(cv::Mat());
+		return &sharedMemoryFrames_.back();
+	}
+	return 0;
 }
 
 void Camera::pause()
@@ -77,6 +316,10 @@ int Camera::getTotalFrames()
 	{
 		return images_.size();
 	}
+	else if(prefetcher_)
+	{
+		return videoFrames_;
+	}
 	else if(capture_.isOpened())
 	{
 		return (int)capture_.get(CV_CAP_PROP_FRAME_COUNT);
@@ -86,7 +329,7 @@ int Camera::getTotalFrames()
 
 int Camera::getCurrentFrameIndex()
 {
-	if(images_.size())
+	if(images_.size() || prefetcher_)
 	{
 		return currentImageIndex_;
 	}
@@ -99,6 +342,9 @@ int Camera::getCurrentFrameIndex()
 
 void Camera::moveToFrame(int frame)
 {
+	bool prefetching = prefetcher_ != 0;
+	delete prefetcher_; // images decoded ahead are dropped
+	prefetcher_ = 0;
 	if(frame < images_.size())
 	{
 		currentImageIndex_ = frame;
@@ -106,6 +352,29 @@ void Camera::moveToFrame(int frame)
 	else if(capture_.isOpened() && frame < (int)capture_.get(CV_CAP_PROP_FRAME_COUNT))
 	{
 		capture_.set(CV_CAP_PROP_POS_FRAMES, frame);
+		currentImageIndex_ = frame;
+	}
+	if(prefetching)
+	{
+		startPrefetcher();
+	}
+}
+
+void Camera::startPrefetcher()
+{
+	UASSERT(prefetcher_ == 0);
+	if(Settings::getCamera_prefetch() > 0)
+	{
+		if(images_.size())
+		{
+			prefetcher_ = new ImagePrefetcher(images_, currentImageIndex_, Settings::getCamera_prefetch(), Settings::getCamera_decodeGrayscale());
+		}
+		else if(capture_.isOpened())
+		{
+			videoFrames_ = (int)capture_.get(CV_CAP_PROP_FRAME_COUNT);
+			currentImageIndex_ = (int)capture_.get(CV_CAP_PROP_POS_FRAMES);
+			prefetcher_ = new ImagePrefetcher(&capture_, Settings::getCamera_prefetch(), Settings::getCamera_decodeGrayscale());
+		}
 	}
 }
 
@@ -121,20 +390,55 @@ int Camera::getPort()
 void Camera::takeImage()
 {
 	cv::Mat img;
-	if(capture_.isOpened())
+	if(prefetcher_)
+	{
+		if(!prefetcher_->take(img))
+		{
+			// not decoded yet, don't block the timer
+			return;
+		}
+		if(!img.empty())
+		{
+			++currentImageIndex_;
+		}
+	}
+	else if(capture_.isOpened())
 	{
 		capture_.read(img);// capture a frame
+		img = reduceImage(img, Settings::getCamera_decodeGrayscale());
 	}
 	else if(!images_.empty())
 	{
 		if(currentImageIndex_ < (unsigned int)images_.size())
 		{
-			img = cv::imread(images_[currentImageIndex_++]);
+			img = readImage(images_[currentImageIndex_++], Settings::getCamera_decodeGrayscale());
+		}
+	}
+	else if(sharedMemory_)
+	{
+		int slot;
+		img = sharedMemory_->take(slot);
+		if(!img.empty())
+		{
+			// The frame may still be detected or displayed after the next ones are
+			// taken: it is copied in a buffer of the process and the slot is released
+			// right away, so that the producer never overwrites a frame in use.
+			cv::Mat * recycled = recycledFrame();
+			if(recycled)
+			{
+				img.copyTo(*recycled);
+				img = *recycled;
+			}
+			else
+			{
+				img = img.clone();
+			}
+			sharedMemory_->release(slot);
 		}
 	}
 	else if(cameraTcpServer_)
 	{
-		img = cameraTcpServer_->getImage();
+		img = cameraTcpServer_->getImage(&streamId_);
 		if(cameraTcpServer_->imagesBuffered() > 0 && Settings::getCamera_9queueSize() == 0)
 		{
 			UWARN("%d images buffered so far...", cameraTcpServer_->imagesBuffered());
@@ -150,6 +454,14 @@ void Camera::takeImage()
 				cameraTcpServer_->waitForNewConnection(100);
 			}
 		}
+		else if(sharedMemory_)
+		{
+			// no new frame yet
+			if(!sharedMemory_->isAttached())
+			{
+				sharedMemory_->attach(Settings::getCamera_sharedMemoryKey());
+			}
+		}
 		else
 		{
 			// In case of a directory of images or a video
@@ -167,24 +479,29 @@ void Camera::takeImage()
 		{
 			cv::Mat resampled;
 			cv::resize(img, resampled, cv::Size(Settings::getCamera_2imageWidth(), Settings::getCamera_3imageHeight()));
-			Q_EMIT imageReceived(resampled);
+			img = resampled;
 		}
-		else if(capture_.isOpened())
+		else if(capture_.isOpened() && !prefetcher_)
 		{
-			Q_EMIT imageReceived(img.clone()); // clone required with VideoCapture::read()
-		}
-		else
-		{
-			Q_EMIT imageReceived(img); // clone not required with cv::imread()
+			img = img.clone(); // clone required with VideoCapture::read(), not with cv::imread()
 		}
+		Q_EMIT imageReceived(img);
+		Q_EMIT imageReceived(img, streamId_);
 	}
 }
 
 bool Camera::start()
 {
-	if(!capture_.isOpened() && images_.empty() && cameraTcpServer_ == 0)
+	if(!capture_.isOpened() && images_.empty() && cameraTcpServer_ == 0 && sharedMemory_ == 0)
 	{
-		if(Settings::getCamera_6useTcpCamera())
+		if(!Settings::getCamera_sharedMemoryKey().isEmpty())
+		{
+			// the producer may be started after, attached again on the next frames
+			sharedMemory_ = new SharedMemoryRing();
+			sharedMemory_->attach(Settings::getCamera_sharedMemoryKey());
+			UINFO("Camera: Reading frames from shared memory \"%s\"...", Settings::getCamera_sharedMemoryKey().toStdString().c_str());
+		}
+		else if(Settings::getCamera_6useTcpCamera())
 		{
 			cameraTcpServer_ = new CameraTcpServer(Settings::getCamera_8port(), this);
 			if(!cameraTcpServer_->isListening())
@@ -243,6 +560,8 @@ bool Camera::start()
 					UINFO("Camera: Reading from video file \"%s\"...", path.toStdString().c_str());
 				}
 			}
+			// device frames are not read ahead, they would be late
+			startPrefetcher();
 			if(!capture_.isOpened() && images_.empty())
 			{
 				//set camera device
@@ -256,7 +575,7 @@ bool Camera::start()
 			}
 		}
 	}
-	if(!capture_.isOpened() && images_.empty() && cameraTcpServer_ == 0)
+	if(!capture_.isOpened() && images_.empty() && cameraTcpServer_ == 0 && sharedMemory_ == 0)
 	{
 		UERROR("Camera: Failed to open a capture object!");
 		return false;
@@ -25,6 +25,7 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include "find_object/Settings.h"
+#include "find_object/Camera.h"
 #include "find_object/utilite/ULogger.h"
 
 #include "CameraTcpServer.h"
@@ -36,7 +37,8 @@ namespace find_object {
 
 CameraTcpServer::CameraTcpServer(quint16 port, QObject *parent) :
 	QTcpServer(parent),
-    blockSize_(0)
+	nextStreamId_(0),
+	nextStream_(0)
 {
 	if (!this->listen(QHostAddress::Any, port))
 	{
@@ -45,31 +47,71 @@ CameraTcpServer::CameraTcpServer(quint16 port, QObject *parent) :
 	}
 }
 
-cv::Mat CameraTcpServer::getImage()
+cv::Mat CameraTcpServer::getImage(int * streamId)
 {
 	cv::Mat img;
-	if(images_.size())
+	if(streamId)
 	{
-		// if queue changed after tcp connection ended with images still in the buffer
-		int queue = Settings::getCamera_9queueSize();
-		while(queue > 0 && images_.size() > queue)
+		*streamId = -1;
+	}
+	if(streams_.size())
+	{
+		// next stream having an image, from the one after the last taken
+		QMap<int, Stream>::iterator iter = streams_.lowerBound(nextStream_);
+		for(int i=0; i<streams_.size() && img.empty(); ++i)
 		{
-			images_.pop_front();
+			if(iter == streams_.end())
+			{
+				iter = streams_.begin();
+			}
+			QVector<cv::Mat> & images = iter.value().images;
+			if(images.size())
+			{
+				// if queue changed after tcp connection ended with images still in the buffer
+				int queue = Settings::getCamera_9queueSize();
+				while(queue > 0 && images.size() > queue)
+				{
+					images.pop_front();
+				}
+
+				img = images.front();
+				images.pop_front();
+				if(streamId)
+				{
+					*streamId = iter.key();
+				}
+				nextStream_ = iter.key()+1;
+			}
+			if(images.empty() && !iter.value().connected)
+			{
+				iter = streams_.erase(iter);
+			}
+			else
+			{
+				++iter;
+			}
 		}
-
-		img = images_.front();
-		images_.pop_front();
 	}
-	if(this->findChildren<QTcpSocket*>().size() == 1)
+	if(img.empty() && streamIds_.size() == 1)
 	{
-		this->findChildren<QTcpSocket*>().first()->waitForReadyRead(100);
+		streamIds_.begin().key()->waitForReadyRead(100);
 	}
 	return img;
 }
 
+int CameraTcpServer::imagesBuffered() const
+{
+	int count = 0;
+	for(QMap<int, Stream>::const_iterator iter=streams_.constBegin(); iter!=streams_.constEnd(); ++iter)
+	{
+		count += iter.value().images.size();
+	}
+	return count;
+}
+
 bool CameraTcpServer::isConnected() const
 {
-	return this->findChildren<QTcpSocket*>().size() > 0;
+	return streamIds_.size() > 0;
 }
 
 QHostAddress CameraTcpServer::getHostAddress() const
@@ -103,55 +145,58 @@ quint16 CameraTcpServer::getPort() const
 
 void CameraTcpServer::incomingConnection(int socketDescriptor)
 {
-	QList<QTcpSocket*> clients = this->findChildren<QTcpSocket*>();
-	if(clients.size() >= 1)
-	{
-		UWARN("A client is already connected. Only one connection allowed at the same time.");
-		QTcpSocket socket;
-		socket.setSocketDescriptor(socketDescriptor);
-		socket.close(); // close without sending an acknowledge
-	}
-	else
-	{
-		QTcpSocket * socket = new QTcpSocket(this);
-		connect(socket, SIGNAL(readyRead()), this, SLOT(readReceivedData()));
-		connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(displayError(QAbstractSocket::SocketError)));
-		connect(socket, SIGNAL(disconnected()), this, SLOT(connectionLost()));
-		socket->setSocketDescriptor(socketDescriptor);
-		socket->write(QByteArray("1")); // send acknowledge
-	}
+	QTcpSocket * socket = new QTcpSocket(this);
+	connect(socket, SIGNAL(readyRead()), this, SLOT(readReceivedData()));
+	connect(socket, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(displayError(QAbstractSocket::SocketError)));
+	connect(socket, SIGNAL(disconnected()), this, SLOT(connectionLost()));
+	socket->setSocketDescriptor(socketDescriptor);
+	int id = nextStreamId_++;
+	streamIds_.insert(socket, id);
+	streams_.insert(id, Stream());
+	UINFO("CameraTcp: Stream %d connected (%d streams)", id, streamIds_.size());
+	socket->write(QByteArray("1")); // send acknowledge
 }
 
 void CameraTcpServer::readReceivedData()
 {
 	QTcpSocket * client = (QTcpSocket*)sender();
+	QMap<QTcpSocket*, int>::iterator idIter = streamIds_.find(client);
+	if(idIter == streamIds_.end())
+	{
+		return;
+	}
+	Stream & stream = streams_[idIter.value()];
 	QDataStream in(client);
 	in.setVersion(QDataStream::Qt_4_0);
 
-	if (blockSize_ == 0)
+	// many images can be received at once
+	while(true)
 	{
-		if (client->bytesAvailable() < (int)sizeof(quint64))
+		if (stream.blockSize == 0)
 		{
-			return;
-		}
+			if (client->bytesAvailable() < (int)sizeof(quint64))
+			{
+				return;
+			}
 
-		in >> blockSize_;
-	}
+			in >> stream.blockSize;
+		}
 
-	if (client->bytesAvailable() < (int)blockSize_)
-	{
-		return;
-	}
+		if (client->bytesAvailable() < (qint64)stream.blockSize)
+		{
+			return;
+		}
 
-	std::vector<unsigned char> buf(blockSize_);
-	in.readRawData((char*)buf.data(), blockSize_);
-	images_.push_back(cv::imdecode(buf, cv::IMREAD_UNCHANGED));
-	int queue = Settings::getCamera_9queueSize();
-	while(queue > 0 && images_.size() > queue)
-	{
-		images_.pop_front();
+		std::vector<unsigned char> buf(stream.blockSize);
+		in.readRawData((char*)buf.data(), stream.blockSize);
+		stream.images.push_back(Camera::decodeImage(buf, Settings::getCamera_decodeGrayscale()));
+		int queue = Settings::getCamera_9queueSize();
+		while(queue > 0 && stream.images.size() > queue)
+		{
+			stream.images.pop_front();
+		}
+		stream.blockSize = 0;
 	}
-	blockSize_ = 0;
 }
 
 void CameraTcpServer::displayError(QAbstractSocket::SocketError socketError)
@@ -179,9 +224,29 @@ void CameraTcpServer::displayError(QAbstractSocket::SocketError socketError)
 void CameraTcpServer::connectionLost()
 {
 	//printf("[WARNING] CameraTcp: Connection lost!\n");
-	((QTcpSocket*)sender())->close();
-	sender()->deleteLater();
-	blockSize_ = 0; // reset
+	QTcpSocket * client = (QTcpSocket*)sender();
+	QMap<QTcpSocket*, int>::iterator idIter = streamIds_.find(client);
+	if(idIter != streamIds_.end())
+	{
+		QMap<int, Stream>::iterator iter = streams_.find(idIter.value());
+		if(iter != streams_.end())
+		{
+			if(iter.value().images.empty())
+			{
+				streams_.erase(iter);
+			}
+			else
+			{
+				// the images received are still taken
+				iter.value().connected = false;
+				iter.value().blockSize = 0;
+			}
+		}
+		UINFO("CameraTcp: Stream %d disconnected", idIter.value());
+		streamIds_.erase(idIter);
+	}
+	client->close();
+	client->deleteLater();
 }
 
 } // namespace find_object
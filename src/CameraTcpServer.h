@@ -29,17 +29,23 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define CAMERATCPCLIENT_H_
 
 #include <QtNetwork/QTcpServer>
+#include <QtCore/QMap>
+#include <QtCore/QVector>
 #include <opencv2/opencv.hpp>
 
 namespace find_object {
 
+// Each image source connected is a stream with its own queue
+// (Camera/9queueSize). getImage() takes the streams in turn.
 class CameraTcpServer : public QTcpServer
 {
 	Q_OBJECT;
 public:
 	CameraTcpServer(quint16 port = 0, QObject * parent = 0);
-	cv::Mat getImage();
-	int imagesBuffered() const {return images_.size();}
+	// streamId is set to the stream of the image (incremented on each new
+	// connection, from 0), -1 if there is no image
+	cv::Mat getImage(int * streamId = 0);
+	int imagesBuffered() const;
 	bool isConnected() const;
 
 	QHostAddress getHostAddress() const;
@@ -54,8 +60,17 @@ private Q_SLOTS:
 	void connectionLost();
 
 private:
-	quint64 blockSize_;
-	QVector<cv::Mat> images_;
+	struct Stream
+	{
+		Stream() : blockSize(0), connected(true) {}
+		quint64 blockSize;
+		QVector<cv::Mat> images;
+		bool connected; // kept after the connection is lost until its images are taken
+	};
+	QMap<int, Stream> streams_; // <stream ID, stream>
+	QMap<QTcpSocket*, int> streamIds_;
+	int nextStreamId_;
+	int nextStream_; // round-robin, next stream ID to take an image from
 };
 
 } // namespace find_object
@@ -7,6 +7,8 @@
 
 #include <Compression.h>
 #include <zlib.h>
+#include <string.h>
+#include <algorithm>
 #include "find_object/utilite/ULogger.h"
 
 namespace find_object {
@@ -76,4 +78,185 @@ cv::Mat uncompressData(const unsigned char * bytes, unsigned long size)
 	}
 	return data;
 }
+
+// Chunked format: rows, cols, type, chunkSize, chunks (int32), rawSize
+// (int64), then the compressed size of each chunk (int64) and the chunks.
+static const int kChunkedHeaderSize = 5*sizeof(int) + sizeof(qint64);
+
+class CompressChunksBody : public cv::ParallelLoopBody
+{
+public:
+	CompressChunksBody(const unsigned char * data, qint64 rawSize, int chunkSize, int level, std::vector<std::vector<unsigned char> > & chunks) :
+		data_(data),
+		rawSize_(rawSize),
+		chunkSize_(chunkSize),
+		level_(level),
+		chunks_(chunks)
+	{}
+	virtual void operator()(const cv::Range & range) const
+	{
+		for(int i=range.start; i<range.end; ++i)
+		{
+			qint64 offset = qint64(i)*chunkSize_;
+			uLong sourceLen = uLong(std::min(qint64(chunkSize_), rawSize_-offset));
+			uLongf destLen = compressBound(sourceLen);
+			std::vector<unsigned char> & chunk = chunks_[i];
+			chunk.resize(destLen);
+			int errCode = compress2((Bytef *)chunk.data(), &destLen, (const Bytef *)(data_+offset), sourceLen, level_);
+			if(errCode != Z_OK)
+			{
+				UERROR("Compression of chunk %d failed (error=%d)", i, errCode);
+				destLen = 0;
+			}
+			chunk.resize(destLen);
+		}
+	}
+private:
+	const unsigned char * data_;
+	qint64 rawSize_;
+	int chunkSize_;
+	int level_;
+	std::vector<std::vector<unsigned char> > & chunks_;
+};
+
+std::vector<unsigned char> compressDataChunked(const cv::Mat & dataIn, int level, int chunkSize)
+{
+	UASSERT(chunkSize > 0);
+	cv::Mat data = dataIn.isContinuous()?dataIn:dataIn.clone();
+	qint64 rawSize = qint64(data.total())*qint64(data.elemSize());
+	int chunks = int((rawSize + chunkSize - 1) / chunkSize);
+
+	std::vector<std::vector<unsigned char> > compressed(chunks);
+	if(chunks)
+	{
+		cv::parallel_for_(cv::Range(0, chunks), CompressChunksBody(data.data, rawSize, chunkSize, level, compressed));
+	}
+
+	size_t total = kChunkedHeaderSize + chunks*sizeof(qint64);
+	for(int i=0; i<chunks; ++i)
+	{
+		total += compressed[i].size();
+	}
+	std::vector<unsigned char> bytes(total);
+	int header[5] = {data.rows, data.cols, data.type(), chunkSize, chunks};
+	memcpy(&bytes[0], header, sizeof(header));
+	memcpy(&bytes[sizeof(header)], &rawSize, sizeof(rawSize));
+	size_t offset = kChunkedHeaderSize + chunks*sizeof(qint64);
+	for(int i=0; i<chunks; ++i)
+	{
+		qint64 size = compressed[i].size();
+		memcpy(&bytes[kChunkedHeaderSize + i*sizeof(qint64)], &size, sizeof(size));
+		if(size)
+		{
+			memcpy(&bytes[offset], compressed[i].data(), size);
+		}
+		offset += size;
+		std::vector<unsigned char>().swap(compressed[i]);
+	}
+	return bytes;
+}
+
+class UncompressChunksBody : public cv::ParallelLoopBody
+{
+public:
+	UncompressChunksBody(const unsigned char * bytes, const std::vector<qint64> & offsets, unsigned char * data, qint64 rawSize, int chunkSize, bool & error) :
+		bytes_(bytes),
+		offsets_(offsets),
+		data_(data),
+		rawSize_(rawSize),
+		chunkSize_(chunkSize),
+		error_(error)
+	{}
+	virtual void operator()(const cv::Range & range) const
+	{
+		for(int i=range.start; i<range.end; ++i)
+		{
+			qint64 offset = qint64(i)*chunkSize_;
+			uLongf destLen = uLongf(std::min(qint64(chunkSize_), rawSize_-offset));
+			uLongf expected = destLen;
+			int errCode = uncompress((Bytef *)(data_+offset), &destLen, (const Bytef *)(bytes_+offsets_[i]), uLong(offsets_[i+1]-offsets_[i]));
+			if(errCode != Z_OK || destLen != expected)
+			{
+				UERROR("Uncompression of chunk %d failed (error=%d)", i, errCode);
+				error_ = true;
+			}
+		}
+	}
+private:
+	const unsigned char * bytes_;
+	const std::vector<qint64> & offsets_;
+	unsigned char * data_;
+	qint64 rawSize_;
+	int chunkSize_;
+	bool & error_;
+};
+
+cv::Mat uncompressDataChunked(const unsigned char * bytes, qint64 size)
+{
+	if(bytes == 0 || size < kChunkedHeaderSize)
+	{
+		return cv::Mat();
+	}
+	int header[5];
+	qint64 rawSize;
+	memcpy(header, bytes, sizeof(header));
+	memcpy(&rawSize, bytes+sizeof(header), sizeof(rawSize));
+	int chunkSize = header[3];
+	int chunks = header[4];
+	// the chunks cover exactly the raw data, each one is uncompressed in place
+	if(header[0] < 0 || header[1] < 0 || chunkSize <= 0 || rawSize < 0 ||
+	   qint64(header[0])*qint64(header[1])*qint64(CV_ELEM_SIZE(header[2])) != rawSize ||
+	   qint64(chunks) != (rawSize + chunkSize - 1) / chunkSize ||
+	   size < kChunkedHeaderSize + qint64(chunks)*qint64(sizeof(qint64)))
+	{
+		UERROR("Invalid compressed data");
+		return cv::Mat();
+	}
+
+	// offsets of the chunks
+	std::vector<qint64> offsets(chunks+1);
+	offsets[0] = kChunkedHeaderSize + qint64(chunks)*qint64(sizeof(qint64));
+	for(int i=0; i<chunks; ++i)
+	{
+		qint64 chunk;
+		memcpy(&chunk, bytes + kChunkedHeaderSize + i*sizeof(qint64), sizeof(chunk));
+		if(chunk < 0 || offsets[i] + chunk > size)
+		{
+			UERROR("Invalid compressed data");
+			return cv::Mat();
+		}
+		offsets[i+1] = offsets[i] + chunk;
+	}
+	cv::Mat data(header[0], header[1], header[2]);
+	bool error = false;
+	if(chunks)
+	{
+		cv::parallel_for_(cv::Range(0, chunks), UncompressChunksBody(bytes, offsets, data.data, rawSize, chunkSize, error));
+	}
+	return error?cv::Mat():data;
+}
+
+static const qint64 kRawBlockSize = 1<<30;
+
+void writeRawData64(QDataStream & stream, const unsigned char * data, qint64 size)
+{
+	for(qint64 offset=0; offset<size; offset+=kRawBlockSize)
+	{
+		stream.writeRawData((const char*)data+offset, int(std::min(kRawBlockSize, size-offset)));
+	}
+}
+
+bool readRawData64(QDataStream & stream, unsigned char * data, qint64 size)
+{
+	for(qint64 offset=0; offset<size; offset+=kRawBlockSize)
+	{
+		int block = int(std::min(kRawBlockSize, size-offset));
+		if(stream.readRawData((char*)data+offset, block) != block)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
 } /* namespace find_object */
@@ -9,12 +9,23 @@
 #define SRC_COMPRESSION_H_
 
 #include <opencv2/opencv.hpp>
+#include <QtCore/QtGlobal>
+#include <QtCore/QDataStream>
 
 namespace find_object {
 
 std::vector<unsigned char> compressData(const cv::Mat & data);
 cv::Mat uncompressData(const unsigned char * bytes, unsigned long size);
 
+// The data is split in chunks compressed (zlib level 1 to 9) in parallel,
+// for large matrices. The sizes are 64 bits: unlike compressData(), the
+// result can be larger than 4 GB (write it with QDataStream::writeRawData()).
+std::vector<unsigned char> compressDataChunked(const cv::Mat & data, int level, int chunkSize = 4*1024*1024);
+cv::Mat uncompressDataChunked(const unsigned char * bytes, qint64 size);
+// QDataStream::writeRawData()/readRawData() for more than 2 GB
+void writeRawData64(QDataStream & stream, const unsigned char * data, qint64 size);
+bool readRawData64(QDataStream & stream, unsigned char * data, qint64 size);
+
 }
 
 #endif /* SRC_COMPRESSION_H_ */
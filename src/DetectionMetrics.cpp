@@ -0,0 +1,314 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "find_object/DetectionMetrics.h"
+#include <QtCore/QStringList>
+#include <math.h>
+
+namespace find_object {
+
+static const float kHistogramMin = 0.0625f; // ms
+static const int kHistogramOctaves = 21; // up to ~131 s
+static const int kHistogramSubBuckets = 16;
+
+LatencyHistogram::LatencyHistogram() :
+	buckets_(1 + kHistogramOctaves*kHistogramSubBuckets, 0),
+	count_(0),
+	sum_(0.0),
+	max_(0.0f)
+{
+}
+
+int LatencyHistogram::bucketIndex(float ms)
+{
+	if(!(ms >= kHistogramMin))
+	{
+		return 0; // underflow (and NaN)
+	}
+	int exp = 0;
+	float mantissa = (float)frexp(double(ms / kHistogramMin), &exp); // [0.5, 1)
+	int octave = exp - 1;
+	if(octave >= kHistogramOctaves)
+	{
+		return 1 + kHistogramOctaves*kHistogramSubBuckets - 1; // overflow in the last bucket
+	}
+	int sub = int((mantissa*2.0f - 1.0f) * kHistogramSubBuckets);
+	if(sub >= kHistogramSubBuckets)
+	{
+		sub = kHistogramSubBuckets-1;
+	}
+	return 1 + octave*kHistogramSubBuckets + sub;
+}
+
+float LatencyHistogram::bucketUpperBound(int index)
+{
+	if(index == 0)
+	{
+		return kHistogramMin;
+	}
+	int octave = (index-1) / kHistogramSubBuckets;
+	int sub = (index-1) % kHistogramSubBuckets;
+	return kHistogramMin * (float)ldexp(1.0 + double(sub+1)/double(kHistogramSubBuckets), octave);
+}
+
+void LatencyHistogram::add(float ms)
+{
+	++buckets_[bucketIndex(ms)];
+	++count_;
+	sum_ += ms;
+	if(ms > max_)
+	{
+		max_ = ms;
+	}
+}
+
+void LatencyHistogram::merge(const LatencyHistogram & histogram)
+{
+	for(unsigned int i=0; i<buckets_.size(); ++i)
+	{
+		buckets_[i] += histogram.buckets_[i];
+	}
+	count_ += histogram.count_;
+	sum_ += histogram.sum_;
+	if(histogram.max_ > max_)
+	{
+		max_ = histogram.max_;
+	}
+}
+
+float LatencyHistogram::percentile(float p) const
+{
+	if(count_ == 0)
+	{
+		return 0.0f;
+	}
+	qint64 rank = qint64(ceil(double(p) * double(count_)));
+	if(rank < 1)
+	{
+		rank = 1;
+	}
+	qint64 cumulated = 0;
+	for(unsigned int i=0; i<buckets_.size(); ++i)
+	{
+		cumulated += buckets_[i];
+		if(cumulated >= rank)
+		{
+			float bound = bucketUpperBound(i);
+			return bound < max_?bound:max_;
+		}
+	}
+	return max_;
+}
+
+DetectionMetrics::DetectionMetrics() :
+	frames_(0),
+	framesWithDetections_(0),
+	objectsDetected_(0),
+	queueDepth_(-1),
+	queueAccepted_(0),
+	queueRejected_(0),
+	queueDropped_(0),
+	queueDegraded_(0)
+{
+}
+
+void DetectionMetrics::add(const DetectionInfo & info)
+{
+	QMutexLocker locker(&mutex_);
+	++frames_;
+	if(info.objDetected_.size())
+	{
+		++framesWithDetections_;
+		objectsDetected_ += info.objDetected_.size();
+	}
+	for(QMap<DetectionInfo::TimeStamp, float>::const_iterator iter=info.timeStamps_.constBegin(); iter!=info.timeStamps_.constEnd(); ++iter)
+	{
+		histograms_[iter.key()].add(iter.value());
+	}
+	for(QMultiMap<int, DetectionInfo::RejectedCode>::const_iterator iter=info.rejectedCodes_.constBegin(); iter!=info.rejectedCodes_.constEnd(); ++iter)
+	{
+		++rejections_[iter.value()];
+	}
+}
+
+void DetectionMetrics::setQueue(int depth, qint64 accepted, qint64 rejected, qint64 dropped, qint64 degraded)
+{
+	QMutexLocker locker(&mutex_);
+	queueDepth_ = depth;
+	queueAccepted_ = accepted;
+	queueRejected_ = rejected;
+	queueDropped_ = dropped;
+	queueDegraded_ = degraded;
+}
+
+void DetectionMetrics::reset()
+{
+	QMutexLocker locker(&mutex_);
+	histograms_.clear();
+	rejections_.clear();
+	frames_ = 0;
+	framesWithDetections_ = 0;
+	objectsDetected_ = 0;
+}
+
+LatencyHistogram DetectionMetrics::histogram(DetectionInfo::TimeStamp stamp) const
+{
+	QMutexLocker locker(&mutex_);
+	return histograms_.value(stamp);
+}
+
+qint64 DetectionMetrics::frames() const
+{
+	QMutexLocker locker(&mutex_);
+	return frames_;
+}
+
+QString DetectionMetrics::toPrometheus() const
+{
+	QMutexLocker locker(&mutex_);
+	QStringList lines;
+
+	lines.append("# HELP find_object_stage_latency_ms Latency of the detection stages in milliseconds.");
+	lines.append("# TYPE find_object_stage_latency_ms summary");
+	static const float quantiles[] = {0.5f, 0.95f, 0.99f};
+	for(QMap<int, LatencyHistogram>::const_iterator iter=histograms_.constBegin(); iter!=histograms_.constEnd(); ++iter)
+	{
+		QString stage = timeStampName((DetectionInfo::TimeStamp)iter.key());
+		for(int i=0; i<3; ++i)
+		{
+			lines.append(QString("find_object_stage_latency_ms{stage=\"%1\",quantile=\"%2\"} %3")
+					.arg(stage).arg(quantiles[i]).arg(iter.value().percentile(quantiles[i])));
+		}
+		lines.append(QString("find_object_stage_latency_ms_sum{stage=\"%1\"} %2").arg(stage).arg(iter.value().sum(), 0, 'f', 3));
+		lines.append(QString("find_object_stage_latency_ms_count{stage=\"%1\"} %2").arg(stage).arg(iter.value().count()));
+	}
+
+	lines.append("# HELP find_object_stage_latency_max_ms Maximum latency of the detection stages in milliseconds.");
+	lines.append("# TYPE find_object_stage_latency_max_ms gauge");
+	for(QMap<int, LatencyHistogram>::const_iterator iter=histograms_.constBegin(); iter!=histograms_.constEnd(); ++iter)
+	{
+		lines.append(QString("find_object_stage_latency_max_ms{stage=\"%1\"} %2")
+				.arg(timeStampName((DetectionInfo::TimeStamp)iter.key())).arg(iter.value().max()));
+	}
+
+	lines.append("# HELP find_object_frames_total Number of processed frames.");
+	lines.append("# TYPE find_object_frames_total counter");
+	lines.append(QString("find_object_frames_total %1").arg(frames_));
+	lines.append("# HELP find_object_frames_with_detections_total Number of frames with at least one object detected.");
+	lines.append("# TYPE find_object_frames_with_detections_total counter");
+	lines.append(QString("find_object_frames_with_detections_total %1").arg(framesWithDetections_));
+	lines.append("# HELP find_object_objects_detected_total Number of objects detected.");
+	lines.append("# TYPE find_object_objects_detected_total counter");
+	lines.append(QString("find_object_objects_detected_total %1").arg(objectsDetected_));
+
+	lines.append("# HELP find_object_rejections_total Number of rejected object detections by reason.");
+	lines.append("# TYPE find_object_rejections_total counter");
+	for(QMap<int, qint64>::const_iterator iter=rejections_.constBegin(); iter!=rejections_.constEnd(); ++iter)
+	{
+		lines.append(QString("find_object_rejections_total{code=\"%1\"} %2")
+				.arg(rejectedCodeName((DetectionInfo::RejectedCode)iter.key())).arg(iter.value()));
+	}
+
+	if(queueDepth_ >= 0)
+	{
+		lines.append("# HELP find_object_queue_depth Requests waiting in the detection queue.");
+		lines.append("# TYPE find_object_queue_depth gauge");
+		lines.append(QString("find_object_queue_depth %1").arg(queueDepth_));
+		lines.append("# HELP find_object_queue_accepted_total Number of requests accepted in the detection queue.");
+		lines.append("# TYPE find_object_queue_accepted_total counter");
+		lines.append(QString("find_object_queue_accepted_total %1").arg(queueAccepted_));
+		lines.append("# HELP find_object_queue_rejected_total Number of requests rejected because the detection queue was full.");
+		lines.append("# TYPE find_object_queue_rejected_total counter");
+		lines.append(QString("find_object_queue_rejected_total %1").arg(queueRejected_));
+		lines.append("# HELP find_object_queue_dropped_total Number of requests dropped because their deadline could not be met.");
+		lines.append("# TYPE find_object_queue_dropped_total counter");
+		lines.append(QString("find_object_queue_dropped_total %1").arg(queueDropped_));
+		lines.append("# HELP find_object_queue_degraded_total Number of requests processed in degraded mode to meet their deadline.");
+		lines.append("# TYPE find_object_queue_degraded_total counter");
+		lines.append(QString("find_object_queue_degraded_total %1").arg(queueDegraded_));
+	}
+
+	return lines.join("\n") + "\n";
+}
+
+QString DetectionMetrics::timeStampName(DetectionInfo::TimeStamp stamp)
+{
+	switch(stamp)
+	{
+	case DetectionInfo::kTimeKeypointDetection:
+		return "keypoint_detection";
+	case DetectionInfo::kTimeDescriptorExtraction:
+		return "descriptor_extraction";
+	case DetectionInfo::kTimeSubPixelRefining:
+		return "subpixel_refining";
+	case DetectionInfo::kTimeSkewAffine:
+		return "skew_affine";
+	case DetectionInfo::kTimeIndexing:
+		return "indexing";
+	case DetectionInfo::kTimeMatching:
+		return "matching";
+	case DetectionInfo::kTimeHomography:
+		return "homography";
+	case DetectionInfo::kTimeTotal:
+		return "total";
+	case DetectionInfo::kTimeGeometryCheck:
+		return "geometry_check";
+	}
+	return QString("stage_%1").arg((int)stamp);
+}
+
+QString DetectionMetrics::rejectedCodeName(DetectionInfo::RejectedCode code)
+{
+	switch(code)
+	{
+	case DetectionInfo::kRejectedUndef:
+		return "undef";
+	case DetectionInfo::kRejectedLowMatches:
+		return "low_matches";
+	case DetectionInfo::kRejectedLowInliers:
+		return "low_inliers";
+	case DetectionInfo::kRejectedSuperposed:
+		return "superposed";
+	case DetectionInfo::kRejectedAllInliers:
+		return "all_inliers";
+	case DetectionInfo::kRejectedNotValid:
+		return "not_valid";
+	case DetectionInfo::kRejectedCornersOutside:
+		return "corners_outside";
+	case DetectionInfo::kRejectedByAngle:
+		return "by_angle";
+	case DetectionInfo::kRejectedLowScore:
+		return "low_score";
+	case DetectionInfo::kRejectedInconsistent:
+		return "inconsistent";
+	case DetectionInfo::kRejectedCascade:
+		return "cascade";
+	}
+	return QString("code_%1").arg((int)code);
+}
+
+} // namespace find_object
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "DetectionWorker.h"
+#include "find_object/FindObject.h"
+#include "find_object/utilite/ULogger.h"
+
+#include <QtCore/QMetaObject>
+
+namespace find_object {
+
+DetectionWorker::DetectionWorker(FindObject * findObject) :
+	findObject_(findObject),
+	pendingStreamId_(-1),
+	scheduled_(false),
+	skipped_(0)
+{
+	UASSERT(findObject_ != 0);
+	qRegisterMetaType<cv::Mat>("cv::Mat");
+}
+
+void DetectionWorker::post(const cv::Mat & image, int streamId)
+{
+	cv::Mat copy = image.clone(); // outside the lock
+	QMutexLocker locker(&mutex_);
+	if(!pending_.empty())
+	{
+		++skipped_;
+	}
+	pending_ = copy;
+	pendingStreamId_ = streamId;
+	if(!scheduled_)
+	{
+		scheduled_ = true;
+		QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+	}
+}
+
+int DetectionWorker::takeSkipped()
+{
+	QMutexLocker locker(&mutex_);
+	int skipped = skipped_;
+	skipped_ = 0;
+	return skipped;
+}
+
+void DetectionWorker::process()
+{
+	while(true)
+	{
+		cv::Mat image;
+		int streamId;
+		{
+			QMutexLocker locker(&mutex_);
+			if(pending_.empty())
+			{
+				scheduled_ = false;
+				return;
+			}
+			image = pending_;
+			streamId = pendingStreamId_;
+			pending_ = cv::Mat();
+		}
+
+		DetectionInfo info;
+		bool success = findObject_->detect(image, info);
+		info.streamId_ = streamId;
+		Q_EMIT detected(image, info, success);
+	}
+}
+
+} // namespace find_object
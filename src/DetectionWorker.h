@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef DETECTIONWORKER_H_
+#define DETECTIONWORKER_H_
+
+#include "find_object/DetectionInfo.h"
+
+#include <QtCore/QObject>
+#include <QtCore/QMutex>
+#include <opencv2/opencv.hpp>
+
+namespace find_object {
+
+class FindObject;
+
+// Detects the objects on its own thread (see QObject::moveToThread()). Only
+// one image waits for detection: an image posted while the previous one is
+// still waiting replaces it, so a slow detection skips the frames received
+// meanwhile instead of queuing them.
+class DetectionWorker : public QObject
+{
+	Q_OBJECT;
+
+public:
+	DetectionWorker(FindObject * findObject);
+
+	// Thread-safe, the image is copied. streamId is set in the
+	// DetectionInfo (see Camera::streamId()), -1 if none.
+	void post(const cv::Mat & image, int streamId = -1);
+	// Images skipped since the last call
+	int takeSkipped();
+
+Q_SIGNALS:
+	// Emitted from the worker's thread with the image detected
+	void detected(const cv::Mat & image, const find_object::DetectionInfo & info, bool success);
+
+private Q_SLOTS:
+	void process();
+
+private:
+	FindObject * findObject_;
+	QMutex mutex_;
+	cv::Mat pending_;
+	int pendingStreamId_;
+	bool scheduled_; // process() is queued or running
+	int skipped_;
+};
+
+} // namespace find_object
+
+#endif /* DETECTIONWORKER_H_ */
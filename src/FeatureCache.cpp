@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "FeatureCache.h"
+#include "ObjSignature.h"
+#include "find_object/utilite/ULogger.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDataStream>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QTemporaryFile>
+
+namespace find_object {
+
+static const quint32 kFeatureCacheMagic = 0x464F4643; // "FOFC"
+static const quint32 kFeatureCacheVersion = 1;
+
+FeatureCache::FeatureCache(const QString & path, const ParametersMap & parameters)
+{
+	if(path.isEmpty())
+	{
+		return;
+	}
+
+	// all parameters used by the detector and the extractor
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	hash.addData(CV_VERSION);
+	for(ParametersMap::const_iterator iter=parameters.constBegin(); iter!=parameters.constEnd(); ++iter)
+	{
+		if(iter.key().startsWith("Feature2D/"))
+		{
+			hash.addData(QString("%1=%2\n").arg(iter.key()).arg(iter.value().toString()).toUtf8());
+		}
+	}
+	QString directory = path + QDir::separator() + hash.result().toHex();
+	if(!QDir().mkpath(directory))
+	{
+		UERROR("Cannot create the feature cache directory \"%s\", the cache is disabled.", directory.toStdString().c_str());
+		return;
+	}
+	directory_ = directory;
+}
+
+QByteArray FeatureCache::imageKey(const cv::Mat & image)
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	int header[3] = {image.cols, image.rows, image.type()};
+	hash.addData((const char*)header, sizeof(header));
+	size_t rowSize = image.cols*image.elemSize();
+	for(int i=0; i<image.rows; ++i)
+	{
+		hash.addData((const char*)image.ptr(i), (int)rowSize);
+	}
+	return hash.result().toHex();
+}
+
+QString FeatureCache::filePath(const QByteArray & imageKey) const
+{
+	return directory_ + QDir::separator() + QString(imageKey) + ".bin";
+}
+
+bool FeatureCache::load(const QByteArray & imageKey, std::vector<cv::KeyPoint> & keypoints, cv::Mat & descriptors) const
+{
+	if(!isEnabled())
+	{
+		return false;
+	}
+	QFile file(filePath(imageKey));
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		return false;
+	}
+	QDataStream in(&file);
+	quint32 magic = 0, version = 0;
+	in >> magic >> version;
+	if(magic != kFeatureCacheMagic || version != kFeatureCacheVersion)
+	{
+		UWARN("Feature cache entry \"%s\" is not valid, it is ignored.", file.fileName().toStdString().c_str());
+		return false;
+	}
+	ObjSignature signature;
+	signature.load(in, true);
+	if(in.status() != QDataStream::Ok || (int)signature.keypoints().size() != signature.descriptors().rows)
+	{
+		UWARN("Feature cache entry \"%s\" is not valid, it is ignored.", file.fileName().toStdString().c_str());
+		return false;
+	}
+	keypoints = signature.keypoints();
+	descriptors = signature.descriptors();
+	return true;
+}
+
+void FeatureCache::save(const QByteArray & imageKey, const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors) const
+{
+	if(!isEnabled())
+	{
+		return;
+	}
+	// written aside then renamed, an entry is never read partially
+	QTemporaryFile file(directory_ + QDir::separator() + "XXXXXX.tmp");
+	file.setAutoRemove(false);
+	if(!file.open())
+	{
+		UERROR("Cannot write in the feature cache \"%s\".", directory_.toStdString().c_str());
+		return;
+	}
+	ObjSignature signature(0, cv::Mat(), QString());
+	signature.setData(keypoints, descriptors);
+	QDataStream out(&file);
+	out << kFeatureCacheMagic << kFeatureCacheVersion;
+	signature.save(out);
+	QString tmpPath = file.fileName();
+	file.close();
+	if(!QFile::rename(tmpPath, filePath(imageKey)))
+	{
+		// already saved by another thread or process
+		QFile::remove(tmpPath);
+	}
+}
+
+} // namespace find_object
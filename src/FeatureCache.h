@@ -0,0 +1,66 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef FEATURECACHE_H_
+#define FEATURECACHE_H_
+
+#include "find_object/Settings.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace find_object {
+
+// Keypoints and descriptors extracted from object images, saved in the
+// directory General/featureCachePath. Entries are named by the hash of
+// the image content and are in a sub directory named by the hash of the
+// Feature2D parameters, so an image is extracted again only if its pixels
+// or the detector/extractor change. Entries have the layout of
+// ObjSignature::save(). Thread-safe, entries are written atomically.
+class FeatureCache
+{
+public:
+	FeatureCache(const QString & path, const ParametersMap & parameters);
+
+	bool isEnabled() const {return !directory_.isEmpty();}
+
+	static QByteArray imageKey(const cv::Mat & image);
+	bool load(const QByteArray & imageKey, std::vector<cv::KeyPoint> & keypoints, cv::Mat & descriptors) const;
+	void save(const QByteArray & imageKey, const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors) const;
+
+private:
+	QString filePath(const QByteArray & imageKey) const;
+
+private:
+	QString directory_; // empty if disabled
+};
+
+} // namespace find_object
+
+#endif /* FEATURECACHE_H_ */
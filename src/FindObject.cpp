@@ -31,31 +31,171 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "utilite/UConversion.h"
 
 #include "ObjSignature.h"
+#include "FeatureCache.h"
+#include "ObjectImageCache.h"
+#include "LimitKeypoints.h"
 #include "utilite/UDirectory.h"
 #include "Vocabulary.h"
+#include "ThreadPool.h"
+#include "find_object/Trace.h"
+#include "find_object/DetectionMetrics.h"
 
-#include <QtCore/QThread>
+#include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QStringList>
 #include <QtCore/QTime>
 #include <QtCore/QDir>
-#include <QGraphicsRectItem>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QHash>
+#include <QtCore/QSet>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QThread>
 #include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
 
 namespace find_object {
 
+// Detector or extractor created from the same parameters for each thread
+// using it: some OpenCV implementations keep mutable buffers in the
+// instance (or lock it), the threads of the pool don't share them and
+// each thread keeps its buffers from one image to the next. The instance
+// of a thread is deleted when the thread exits (threads of a QThreadPool
+// expire when idle), the others when the ThreadFeature2D is deleted.
+class ThreadFeature2D : public Feature2D
+{
+public:
+	ThreadFeature2D(const ParametersSnapshot & params, bool detector) :
+		params_(params),
+		detector_(detector),
+		instances_(new QThreadStorage<Instance*>()),
+		registry_(new Registry())
+	{
+		local(); // for the creating thread
+	}
+	virtual ~ThreadFeature2D()
+	{
+		// The threads exiting after don't delete their Instance (kept
+		// with the registry), a thread exiting meanwhile may: whichever
+		// removes the detector or extractor from the registry deletes it.
+		delete instances_;
+		QSet<Feature2D*> live;
+		{
+			QMutexLocker locker(&registry_->mutex);
+			live.swap(registry_->live);
+		}
+		qDeleteAll(live);
+	}
+
+	virtual void detect(const cv::Mat & image,
+			std::vector<cv::KeyPoint> & keypoints,
+			const cv::Mat & mask = cv::Mat())
+	{
+		local()->detect(image, keypoints, mask);
+	}
+	virtual void compute(const cv::Mat & image,
+			std::vector<cv::KeyPoint> & keypoints,
+			cv::Mat & descriptors)
+	{
+		local()->compute(image, keypoints, descriptors);
+	}
+	virtual void detectAndCompute(const cv::Mat & image,
+			std::vector<cv::KeyPoint> & keypoints,
+			cv::Mat & descriptors,
+			const cv::Mat & mask = cv::Mat())
+	{
+		local()->detectAndCompute(image, keypoints, descriptors, mask);
+	}
+	virtual bool detectAndComputeGpu(const cv::Mat & image,
+			std::vector<cv::KeyPoint> & keypoints,
+			GpuMat & descriptors,
+			const cv::Mat & mask = cv::Mat())
+	{
+		return local()->detectAndComputeGpu(image, keypoints, descriptors, mask);
+	}
+
+private:
+	// Detectors or extractors of the threads not exited yet, shared with
+	// the Instances so that it outlives the ThreadFeature2D
+	struct Registry
+	{
+		QMutex mutex;
+		QSet<Feature2D*> live;
+	};
+
+	// Deleted by the QThreadStorage when its thread exits
+	class Instance
+	{
+	public:
+		Instance(const QSharedPointer<Registry> & registry, Feature2D * feature) :
+			registry_(registry),
+			feature_(feature)
+		{
+			QMutexLocker locker(&registry_->mutex);
+			registry_->live.insert(feature_);
+		}
+		~Instance()
+		{
+			bool owned;
+			{
+				QMutexLocker locker(&registry_->mutex);
+				owned = registry_->live.remove(feature_);
+			}
+			if(owned)
+			{
+				delete feature_;
+			}
+		}
+		Feature2D * feature() const {return feature_;}
+	private:
+		QSharedPointer<Registry> registry_;
+		Feature2D * feature_;
+	};
+
+	Feature2D * local()
+	{
+		if(!instances_->hasLocalData())
+		{
+			Feature2D * feature = detector_?Settings::createKeypointDetector(params_):Settings::createDescriptorExtractor(params_);
+			UASSERT(feature != 0);
+			instances_->setLocalData(new Instance(registry_, feature));
+			UDEBUG("%s created for thread %p", detector_?"Detector":"Extractor", (void*)QThread::currentThread());
+		}
+		return instances_->localData()->feature();
+	}
+
+private:
+	ParametersSnapshot params_;
+	bool detector_;
+	QThreadStorage<Instance*> * instances_;
+	QSharedPointer<Registry> registry_;
+};
+
 FindObject::FindObject(bool keepImagesInRAM, QObject * parent) :
 	QObject(parent),
-	vocabulary_(new Vocabulary()),
-	detector_(Settings::createKeypointDetector()),
-	extractor_(Settings::createDescriptorExtractor()),
+	parameters_(Settings::getParameters()),
+	parametersSnapshot_(new ParametersSnapshot(parameters_)),
+	vocabulary_(new Vocabulary(*parametersSnapshot_)),
+	threadPool_(new ThreadPool(parametersSnapshot_->General_threads)),
+	cascade_(0),
+	detector_(new ThreadFeature2D(*parametersSnapshot_, true)),
+	extractor_(new ThreadFeature2D(*parametersSnapshot_, false)),
 	sessionModified_(false),
-	keepImagesInRAM_(keepImagesInRAM)
+	keepImagesInRAM_(keepImagesInRAM),
+	compactionQueued_(false),
+	framesSinceFullFrame_(0),
+	lastFrameSuccess_(false),
+	framesReused_(0),
+	objectCostsScenes_(0),
+	objectsFoundFields_(DetectionInfo::kAllFields)
 {
 	qRegisterMetaType<find_object::DetectionInfo>("find_object::DetectionInfo");
+	compactionPool_.setMaxThreadCount(1);
 	UASSERT(detector_ != 0 && extractor_ != 0);
 
-	if(Settings::getGeneral_debug())
+	if(parametersSnapshot_->General_debug)
 	{
 		ULogger::setPrintWhere(true);
 		ULogger::setLevel(ULogger::kDebug);
@@ -68,10 +208,75 @@ FindObject::FindObject(bool keepImagesInRAM, QObject * parent) :
 }
 
 FindObject::~FindObject() {
+	compactionPool_.waitForDone();
 	delete detector_;
 	delete extractor_;
+	delete cascade_;
 	delete vocabulary_;
+	delete threadPool_;
 	objectsDescriptors_.clear();
+	qDeleteAll(mappedSessions_); // unmap
+}
+
+// Memory-mapped session format
+static const char kMappedSessionMagic[8] = {'F','O','B','J','M','A','P','\0'};
+static const quint32 kMappedSessionVersion = 1;
+static const quint32 kMappedSessionByteOrder = 0x01020304; // raw blocks are in native byte order
+
+static ParametersMap sessionParameters(const ParametersMap & parameters, const ParametersMap & customParameters)
+{
+	ParametersMap merged;
+	for(QMap<QString, QVariant>::const_iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
+	{
+		QMap<QString, QVariant>::const_iterator cter = customParameters.find(iter.key());
+		if(cter != customParameters.constEnd())
+		{
+			merged.insert(cter.key(), cter.value());
+		}
+		else
+		{
+			merged.insert(iter.key(), iter.value());
+		}
+	}
+	return merged;
+}
+
+ParametersMap FindObject::parameters() const
+{
+	QMutexLocker locker(&parametersMutex_);
+	return parameters_;
+}
+
+QSharedPointer<const ParametersSnapshot> FindObject::parametersSnapshot() const
+{
+	QMutexLocker locker(&parametersMutex_);
+	return parametersSnapshot_;
+}
+
+void FindObject::setParameters(const ParametersMap & parameters)
+{
+	QMutexLocker locker(&parametersMutex_);
+	for(ParametersMap::const_iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
+	{
+		if(parameters_.contains(iter.key()))
+		{
+			parameters_[iter.key()] = iter.value();
+		}
+	}
+	// Detections in progress keep the previous snapshot
+	parametersSnapshot_ = QSharedPointer<const ParametersSnapshot>(new ParametersSnapshot(parameters_));
+}
+
+void FindObject::setImageCacheSize(int megabytes)
+{
+	ObjectImageCache::instance().setMaxBytes(qint64(megabytes)*1024*1024);
+}
+
+void FindObject::setParameter(const QString & key, const QVariant & value)
+{
+	ParametersMap parameters;
+	parameters.insert(key, value);
+	setParameters(parameters);
 }
 
 bool FindObject::loadSession(const QString & path, const ParametersMap & customParameters)
@@ -80,28 +285,24 @@ bool FindObject::loadSession(const QString & path, const ParametersMap & customP
 	{
 		QFile file(path);
 		file.open(QIODevice::ReadOnly);
+		if(file.peek(sizeof(kMappedSessionMagic)) == QByteArray(kMappedSessionMagic, sizeof(kMappedSessionMagic)))
+		{
+			file.close();
+			return loadMappedSession(path, customParameters);
+		}
 		QDataStream in(&file);
 
 		ParametersMap parameters;
 
 		// load parameters
 		in >> parameters;
-		for(QMap<QString, QVariant>::iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
-		{
-			QMap<QString, QVariant>::const_iterator cter = customParameters.find(iter.key());
-			if(cter != customParameters.constEnd())
-			{
-				Settings::setParameter(cter.key(), cter.value());
-			}
-			else
-			{
-				Settings::setParameter(iter.key(), iter.value());
-			}
-		}
+		setParameters(sessionParameters(parameters, customParameters));
+		QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
 
 		updateDetectorExtractor();
 
 		// load vocabulary
+		vocabulary_->setParameters(*params);
 		vocabulary_->load(in);
 
 		// load objects
@@ -112,6 +313,7 @@ bool FindObject::loadSession(const QString & path, const ParametersMap & customP
 			if(obj->id() >= 0)
 			{
 				objects_.insert(obj->id(), obj);
+				vocabulary_->addObjectWords(obj->id(), obj->words());
 			}
 			else
 			{
@@ -120,12 +322,21 @@ bool FindObject::loadSession(const QString & path, const ParametersMap & customP
 			}
 		}
 		file.close();
+		vocabulary_->updatePostings();
+
+		// objects added or removed since the session was saved
+		replayJournal(path);
 
-		if(!Settings::getGeneral_invertedSearch())
+		if(!params->General_invertedSearch)
 		{
-			// this will fill objectsDescriptors_ matrix
+			// this will fill objectsDescriptors_ matrix (and the cascade)
 			updateVocabulary();
 		}
+		else
+		{
+			updateCascade();
+		}
+		sessionPath_ = path;
 		sessionModified_ = false;
 		return true;
 	}
@@ -136,337 +347,996 @@ bool FindObject::loadSession(const QString & path, const ParametersMap & customP
 	return false;
 }
 
-bool FindObject::saveSession(const QString & path)
+class CompressDescriptorsBody : public cv::ParallelLoopBody
 {
-	if(!path.isEmpty() && QFileInfo(path).suffix().compare("bin") == 0)
+public:
+	CompressDescriptorsBody(const QList<ObjSignature*> & objects, int level, std::vector<std::vector<unsigned char> > & compressed, std::vector<std::vector<unsigned char> > & compressedKeypoints) :
+		objects_(objects),
+		level_(level),
+		compressed_(compressed),
+		compressedKeypoints_(compressedKeypoints)
+	{}
+	virtual void operator()(const cv::Range & range) const
 	{
-		QFile file(path);
-		file.open(QIODevice::WriteOnly);
-		QDataStream out(&file);
-
-		// save parameters
-		out << Settings::getParameters();
-
-		// save vocabulary
-		vocabulary_->save(out);
-
-		// save objects
-		for(QMultiMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+		for(int i=range.start; i<range.end; ++i)
 		{
-			iter.value()->save(out);
+			compressed_[i] = compressDataChunked(objects_[i]->descriptors(), level_);
+			compressedKeypoints_[i] = compressDataChunked(objects_[i]->packedKeypoints(), level_);
 		}
+	}
+private:
+	const QList<ObjSignature*> & objects_;
+	int level_;
+	std::vector<std::vector<unsigned char> > & compressed_;
+	std::vector<std::vector<unsigned char> > & compressedKeypoints_;
+};
 
-		file.close();
-		sessionModified_ = false;
+// rename() replaces the destination atomically on POSIX, QFile::rename() doesn't replace it
+static bool replaceFile(const QString & from, const QString & to)
+{
+	if(rename(QFile::encodeName(from).constData(), QFile::encodeName(to).constData()) == 0)
+	{
 		return true;
 	}
-	UERROR("Path \"%s\" not valid (should be *.bin)", path.toStdString().c_str());
-	return false;
+	QFile::remove(to);
+	return QFile::rename(from, to);
 }
 
-bool FindObject::saveVocabulary(const QString & filePath) const
+bool FindObject::saveSession(const QString & path)
 {
-	if(!filePath.isEmpty() && QFileInfo(filePath).suffix().compare("bin") == 0)
+	if(!path.isEmpty() && QFileInfo(path).suffix().compare("bin") == 0)
 	{
-		QFile file(filePath);
-		file.open(QIODevice::WriteOnly);
-		QDataStream out(&file);
-
-		// ignore parameters
-		out << ParametersMap();
-
-		// save vocabulary
-		vocabulary_->save(out, true);
-
-		file.close();
+		// not while the objects are updated, their journal records would be lost
+		QMutexLocker updateLocker(&updateMutex_);
+
+		// written aside then renamed: if interrupted, the previous
+		// session and its journal are still valid
+		QString tmpPath = path + ".tmp";
+		QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+		bool mapped = params->General_sessionMemoryMapped && !params->General_sessionLegacyFormat;
+		bool saved = mapped?saveMappedSession(tmpPath):writeSession(tmpPath);
+		if(!saved || !replaceFile(tmpPath, path))
+		{
+			UERROR("Failed to save session \"%s\"", path.toStdString().c_str());
+			QFile::remove(tmpPath);
+			return false;
+		}
+		sessionPath_ = path;
+		resetJournal(path);
+		sessionModified_ = false;
 		return true;
 	}
-	else
-	{
-		return vocabulary_->save(filePath);
-	}
+	UERROR("Path \"%s\" not valid (should be *.bin)", path.toStdString().c_str());
 	return false;
 }
 
-bool FindObject::loadVocabulary(const QString & filePath)
+bool FindObject::writeSession(const QString & path) const
 {
-	if(!Settings::getGeneral_vocabularyFixed() || !Settings::getGeneral_invertedSearch())
+	QFile file(path);
+	if(!file.open(QIODevice::WriteOnly))
 	{
-		UWARN("Doesn't make sense to load a vocabulary if \"General/vocabularyFixed\" and \"General/invertedSearch\" are not enabled! It will "
-			  "be cleared at the time the objects are updated.");
+		UERROR("Failed to open \"%s\"", path.toStdString().c_str());
+		return false;
 	}
+	QDataStream out(&file);
 
-	if(QFile::exists(filePath) && !filePath.isEmpty() && QFileInfo(filePath).suffix().compare("bin") == 0)
-	{
-		//binary format (from session format)
-		QFile file(filePath);
-		file.open(QIODevice::ReadOnly);
-		QDataStream in(&file);
-
-		ParametersMap parameters;
-		// ignore parameters
-		in >> parameters;
+	// save parameters
+	out << parameters();
 
-		// load vocabulary
-		vocabulary_->load(in, true);
-		file.close();
+	// save vocabulary
+	vocabulary_->save(out);
 
-		return true;
-	}
-	else
+	// save objects
+	bool legacyFormat = parametersSnapshot()->General_sessionLegacyFormat;
+	int compression = legacyFormat?0:parametersSnapshot()->General_sessionCompression;
+	int quantization = legacyFormat?0:parametersSnapshot()->NearestNeighbor_quantization;
+	if(compression > 0 && quantization <= 0)
 	{
-		//yaml/xml format
-		if(vocabulary_->load(filePath))
+		// descriptors of a batch of objects compressed in parallel, then written in order
+		QList<ObjSignature*> objects = objects_.values();
+		for(int i=0; i<objects.size();)
 		{
-			if(objects_.size())
+			QList<ObjSignature*> batch;
+			qint64 batchBytes = 0;
+			for(; i<objects.size() && (batch.empty() || batchBytes < 256*1024*1024); ++i)
 			{
-				updateVocabulary();
+				batch.push_back(objects[i]);
+				batchBytes += qint64(objects[i]->descriptors().total())*qint64(objects[i]->descriptors().elemSize());
+			}
+			std::vector<std::vector<unsigned char> > compressed(batch.size());
+			std::vector<std::vector<unsigned char> > compressedKeypoints(batch.size());
+			cv::parallel_for_(cv::Range(0, batch.size()), CompressDescriptorsBody(batch, compression, compressed, compressedKeypoints));
+			for(int j=0; j<batch.size(); ++j)
+			{
+				batch[j]->save(out, &compressed[j], 0, &compressedKeypoints[j]);
 			}
-			return true;
 		}
 	}
-	return false;
-}
-
-int FindObject::loadObjects(const QString & dirPath, bool recursive)
-{
-	QString formats = Settings::getGeneral_imageFormats().remove('*').remove('.');
-
-	QStringList paths;
-	paths.append(dirPath);
-
-	QList<int> idsLoaded;
-	while(paths.size())
+	else
 	{
-		QString currentDir = paths.front();
-		UDirectory dir(currentDir.toStdString(), formats.toStdString());
-		if(dir.isValid())
+		for(QMultiMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
 		{
-			const std::list<std::string> & names = dir.getFileNames(); // sorted in natural order
-			for(std::list<std::string>::const_iterator iter=names.begin(); iter!=names.end(); ++iter)
-			{
-				const ObjSignature * s = this->addObject((currentDir.toStdString()+dir.separator()+*iter).c_str());
-				if(s)
-				{
-					idsLoaded.push_back(s->id());
-				}
-			}
+			iter.value()->save(out, 0, quantization, 0, legacyFormat);
 		}
+	}
 
-		paths.pop_front();
+	file.close();
+	return file.error() == QFile::NoError;
+}
 
-		if(recursive)
+bool FindObject::replicate(const FindObject & other)
+{
+	// not mapped, the copy has its own memory
+	QTemporaryFile file(QDir::tempPath() + "/find_object_replica_XXXXXX.bin");
+	if(!file.open())
+	{
+		UERROR("Failed to create a temporary session to replicate the objects");
+		return false;
+	}
+	file.close();
+	{
+		QReadLocker objectsLocker(&other.objectsLock_);
+		if(!other.writeSession(file.fileName()))
 		{
-			QDir d(currentDir);
-			QStringList subDirs = d.entryList(QDir::AllDirs|QDir::NoDotAndDotDot, QDir::Name);
-			for(int i=subDirs.size()-1; i>=0; --i)
-			{
-				paths.prepend(currentDir+QDir::separator()+subDirs[i]);
-			}
+			return false;
 		}
 	}
+	ParametersMap customParameters;
+	customParameters.insert(Settings::kGeneral_sessionJournal(), false);
+	bool loaded = loadSession(file.fileName(), customParameters);
+	sessionPath_.clear();
+	return loaded;
+}
 
-	if(idsLoaded.size())
+bool FindObject::loadMappedSession(const QString & path, const ParametersMap & customParameters)
+{
+	QFile * file = new QFile(path);
+	uchar * base = 0;
+	if(!file->open(QIODevice::ReadOnly) || (base = file->map(0, file->size())) == 0)
 	{
-		this->updateObjects(idsLoaded);
-		this->updateVocabulary(idsLoaded);
+		UERROR("Failed to map session \"%s\"", path.toStdString().c_str());
+		delete file;
+		return false;
 	}
 
-	return idsLoaded.size();
-}
+	// Metadata are read from the file, descriptors and words are used
+	// in place from the mapping (kept until this object is deleted)
+	QDataStream in(file);
+	char magic[sizeof(kMappedSessionMagic)];
+	quint32 version = 0;
+	quint32 byteOrder = 0;
+	in.readRawData(magic, sizeof(kMappedSessionMagic));
+	in >> version;
+	in.readRawData((char*)&byteOrder, sizeof(byteOrder));
+	if(version != kMappedSessionVersion || byteOrder != kMappedSessionByteOrder)
+	{
+		UERROR("Session \"%s\" has an unsupported version (%d) or byte order", path.toStdString().c_str(), (int)version);
+		delete file;
+		return false;
+	}
 
-const ObjSignature * FindObject::addObject(const QString & filePath)
-{
-	if(!filePath.isNull())
+	ParametersMap parameters;
+	in >> parameters;
+	setParameters(sessionParameters(parameters, customParameters));
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+
+	updateDetectorExtractor();
+
+	vocabulary_->setParameters(*params);
+	vocabulary_->loadMapped(in, base);
+
+	int count = 0;
+	in >> count;
+	for(int i=0; i<count && in.status() == QDataStream::Ok; ++i)
 	{
-		cv::Mat img = cv::imread(filePath.toStdString().c_str(), cv::IMREAD_GRAYSCALE);
-		if(!img.empty())
+		ObjSignature * obj = new ObjSignature();
+		obj->loadMapped(in, base, !keepImagesInRAM_);
+		if(obj->id() >= 0 && in.status() == QDataStream::Ok)
 		{
-			int id = 0;
-			QFileInfo file(filePath);
-			QStringList list = file.fileName().split('.');
-			if(list.size())
-			{
-				bool ok = false;
-				id = list.front().toInt(&ok);
-				if(ok && id>0)
-				{
-					if(objects_.contains(id))
-					{
-						UWARN("Object %d already added, a new ID will be generated (new id=%d).", id, Settings::getGeneral_nextObjID());
-						id = 0;
-					}
-				}
-				else
-				{
-					id = 0;
-				}
-			}
-			else
-			{
-				UERROR("File name doesn't contain \".\" (\"%s\")", filePath.toStdString().c_str());
-			}
-
-			const ObjSignature * s = this->addObject(img, id, filePath);
-			if(s)
-			{
-				UINFO("Added object %d (%s)", s->id(), filePath.toStdString().c_str());
-				return s;
-			}
+			objects_.insert(obj->id(), obj);
+			vocabulary_->addObjectWords(obj->id(), obj->words());
 		}
 		else
 		{
-			UERROR("Could not read image \"%s\"", filePath.toStdString().c_str());
+			UERROR("Failed to load and object!");
+			delete obj;
 		}
 	}
-	else
+	vocabulary_->updatePostings();
+	mappedSessions_.push_back(file);
+
+	// objects added or removed since the session was saved
+	replayJournal(path);
+
+	if(!params->General_invertedSearch)
 	{
-		UERROR("File path is null!?");
+		// this will fill objectsDescriptors_ matrix (and the cascade)
+		updateVocabulary();
 	}
-	return 0;
-}
-
-const ObjSignature * FindObject::addObject(const cv::Mat & image, int id, const QString & filePath)
-{
-	UASSERT(id >= 0);
-	ObjSignature * s = new ObjSignature(id, image, filePath);
-	if(!this->addObject(s))
+	else
 	{
-		delete s;
-		return 0;
+		updateCascade();
 	}
-	return s;
+	sessionPath_ = path;
+	sessionModified_ = false;
+	return true;
 }
 
-bool FindObject::addObject(ObjSignature * obj)
+bool FindObject::saveMappedSession(const QString & path)
 {
-	UASSERT(obj != 0 && obj->id() >= 0);
-	if(obj->id() && objects_.contains(obj->id()))
+	QFile file(path);
+	if(!file.open(QIODevice::WriteOnly))
 	{
-		UERROR("object with id %d already added!", obj->id());
+		UERROR("Failed to open \"%s\"", path.toStdString().c_str());
 		return false;
 	}
-	else if(obj->id() == 0)
+	QDataStream out(&file);
+	out.writeRawData(kMappedSessionMagic, sizeof(kMappedSessionMagic));
+	out << kMappedSessionVersion;
+	out.writeRawData((const char*)&kMappedSessionByteOrder, sizeof(kMappedSessionByteOrder));
+
+	// save parameters
+	out << parameters();
+
+	// save vocabulary
+	vocabulary_->saveMapped(out);
+
+	// save objects
+	out << (int)objects_.size();
+	for(QMultiMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
 	{
-		obj->setId(Settings::getGeneral_nextObjID());
+		iter.value()->saveMapped(out);
 	}
 
-	Settings::setGeneral_nextObjID(obj->id()+1);
-
-	objects_.insert(obj->id(), obj);
+	file.close();
+	return file.error() == QFile::NoError;
+}
 
-	return true;
+// Session journal (see General/sessionJournal): a header identifying the
+// session it follows, then records [magic, type, size, payload, checksum]
+// appended and flushed one at a time. The records after a record
+// interrupted (e.g., crash while writing) are ignored.
+static const char kJournalMagic[8] = {'F','O','B','J','J','R','N','L'};
+static const quint32 kJournalVersion = 1;
+static const quint32 kJournalRecordMagic = 0x4A524543;
+static const int kJournalAdd = 1; // payload: ObjSignature::save()
+static const int kJournalRemove = 2; // payload: object id
+
+static QString journalPath(const QString & sessionPath)
+{
+	return sessionPath + ".journal";
 }
 
-void FindObject::removeObject(int id)
+// Journal written after the session was saved the last time
+static bool journalMatches(QFile & journal, const QString & sessionPath)
 {
-	if(objects_.contains(id))
+	QDataStream in(&journal);
+	char magic[sizeof(kJournalMagic)];
+	quint32 version = 0;
+	qint64 sessionSize = -1;
+	qint64 sessionModified = -1;
+	if(in.readRawData(magic, sizeof(kJournalMagic)) != (int)sizeof(kJournalMagic) ||
+	   memcmp(magic, kJournalMagic, sizeof(kJournalMagic)) != 0)
 	{
-		delete objects_.value(id);
-		objects_.remove(id);
-		clearVocabulary();
+		return false;
 	}
+	in >> version >> sessionSize >> sessionModified;
+	QFileInfo info(sessionPath);
+	return in.status() == QDataStream::Ok &&
+			version == kJournalVersion &&
+			sessionSize == info.size() &&
+			sessionModified == info.lastModified().toMSecsSinceEpoch();
 }
 
-void FindObject::removeAllObjects()
+class CompactJournalTask : public QRunnable
 {
-	qDeleteAll(objects_);
+public:
+	CompactJournalTask(FindObject * findObject) :
+		findObject_(findObject)
+	{}
+	virtual void run()
+	{
+		findObject_->compactJournal();
+	}
+private:
+	FindObject * findObject_;
+};
+
+void FindObject::replayJournal(const QString & sessionPath)
+{
+	QFile file(journalPath(sessionPath));
+	if(!file.exists())
+	{
+		return;
+	}
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		UERROR("Failed to open journal \"%s\"", file.fileName().toStdString().c_str());
+		return;
+	}
+	if(!journalMatches(file, sessionPath))
+	{
+		UWARN("Journal \"%s\" ignored, it doesn't follow the session (saved again since?)", file.fileName().toStdString().c_str());
+		return;
+	}
+
+	QTime time;
+	time.start();
+	QDataStream in(&file);
+	QMap<int, ObjSignature*> objectsAdded;
+	bool objectsRemoved = false;
+	int records = 0;
+	while(!in.atEnd())
+	{
+		quint32 magic = 0;
+		quint32 type = 0;
+		quint32 size = 0;
+		in >> magic >> type >> size;
+		if(in.status() != QDataStream::Ok || magic != kJournalRecordMagic || file.bytesAvailable() < qint64(size) + (qint64)sizeof(quint16))
+		{
+			UWARN("Journal \"%s\": incomplete record ignored", file.fileName().toStdString().c_str());
+			break;
+		}
+		QByteArray payload;
+		payload.resize(size);
+		quint16 checksum = 0;
+		in.readRawData(payload.data(), size);
+		in >> checksum;
+		if(checksum != qChecksum(payload.constData(), payload.size()))
+		{
+			UWARN("Journal \"%s\": corrupted record ignored", file.fileName().toStdString().c_str());
+			break;
+		}
+
+		// records are replayed again on a session merged but not
+		// renamed yet, the objects already there are kept
+		QDataStream payloadIn(payload);
+		if(type == kJournalAdd)
+		{
+			ObjSignature * obj = new ObjSignature();
+			obj->load(payloadIn, !keepImagesInRAM_);
+			if(obj->id() > 0 && payloadIn.status() == QDataStream::Ok && !objects_.contains(obj->id()) && !objectsAdded.contains(obj->id()))
+			{
+				objectsAdded.insert(obj->id(), obj);
+			}
+			else
+			{
+				UWARN("Journal: object %d already in the session or not valid, ignored", obj->id());
+				delete obj;
+			}
+		}
+		else if(type == kJournalRemove)
+		{
+			int id = 0;
+			payloadIn >> id;
+			if(objectsAdded.contains(id))
+			{
+				delete objectsAdded.take(id);
+			}
+			else if(objects_.contains(id))
+			{
+				delete objects_.take(id);
+				objectsRemoved = true;
+			}
+		}
+		++records;
+	}
+	file.close();
+
+	if(records == 0)
+	{
+		return;
+	}
+	UINFO("Journal \"%s\": %d records replayed (%d objects added%s, %d ms)",
+			file.fileName().toStdString().c_str(),
+			records,
+			objectsAdded.size(),
+			objectsRemoved?", objects removed":"",
+			time.elapsed());
+
+	// The words saved with the objects are assigned again as when they
+	// were added, the vocabulary is then the same whatever the records
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	if(!params->General_invertedSearch || objectsRemoved)
+	{
+		for(QMap<int, ObjSignature*>::iterator iter=objectsAdded.begin(); iter!=objectsAdded.end(); ++iter)
+		{
+			if(!addObject(iter.value()))
+			{
+				delete iter.value();
+			}
+		}
+		if(params->General_invertedSearch)
+		{
+			buildVocabulary(objects_.values(), true);
+		}
+		// else done with all objects after the session is loaded
+	}
+	else
+	{
+		// as addObjectAndUpdate(), without the extraction
+		for(QMap<int, ObjSignature*>::iterator iter=objectsAdded.begin(); iter!=objectsAdded.end(); ++iter)
+		{
+			QList<ObjSignature*> objectsList;
+			objectsList.push_back(iter.value());
+			buildVocabulary(objectsList, false, iter.value());
+		}
+	}
+}
+
+void FindObject::resetJournal(const QString & sessionPath)
+{
+	if(!parametersSnapshot()->General_sessionJournal)
+	{
+		if(QFile::exists(journalPath(sessionPath)))
+		{
+			QFile::remove(journalPath(sessionPath));
+		}
+		return;
+	}
+	QFile file(journalPath(sessionPath));
+	if(!file.open(QIODevice::WriteOnly))
+	{
+		UERROR("Failed to open journal \"%s\"", file.fileName().toStdString().c_str());
+		return;
+	}
+	QFileInfo info(sessionPath);
+	QDataStream out(&file);
+	out.writeRawData(kJournalMagic, sizeof(kJournalMagic));
+	out << kJournalVersion << (qint64)info.size() << (qint64)info.lastModified().toMSecsSinceEpoch();
+	file.close();
+}
+
+// Called with updateMutex_ locked
+void FindObject::appendJournal(int type, const QByteArray & payload)
+{
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	if(!params->General_sessionJournal || sessionPath_.isEmpty())
+	{
+		return;
+	}
+
+	QFile file(journalPath(sessionPath_));
+	if(!file.open(QIODevice::ReadOnly) || !journalMatches(file, sessionPath_))
+	{
+		file.close();
+		resetJournal(sessionPath_);
+	}
+	file.close();
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Append))
+	{
+		UERROR("Failed to open journal \"%s\", the session should be saved", file.fileName().toStdString().c_str());
+		return;
+	}
+
+	// the record is written at once
+	QByteArray record;
+	{
+		QDataStream out(&record, QIODevice::WriteOnly);
+		out << kJournalRecordMagic << (quint32)type << (quint32)payload.size();
+		out.writeRawData(payload.constData(), payload.size());
+		out << (quint16)qChecksum(payload.constData(), payload.size());
+	}
+	if(file.write(record) != record.size() || !file.flush())
+	{
+		UERROR("Failed to write journal \"%s\", the session should be saved", file.fileName().toStdString().c_str());
+	}
+	qint64 size = file.size();
+	file.close();
+
+	if(params->General_sessionJournalCompaction > 0 &&
+	   size >= qint64(params->General_sessionJournalCompaction)*1024*1024 &&
+	   !compactionQueued_)
+	{
+		UINFO("Journal \"%s\" is %d MB, merging it in the session in background...", file.fileName().toStdString().c_str(), int(size/(1024*1024)));
+		compactionQueued_ = true;
+		compactionPool_.start(new CompactJournalTask(this));
+	}
+}
+
+void FindObject::compactJournal()
+{
+	QString path;
+	{
+		QMutexLocker updateLocker(&updateMutex_);
+		path = sessionPath_;
+		compactionQueued_ = false;
+	}
+	QTime time;
+	time.start();
+	if(saveSession(path))
+	{
+		UINFO("Journal merged in session \"%s\" (%d ms)", path.toStdString().c_str(), time.elapsed());
+	}
+}
+
+bool FindObject::saveVocabulary(const QString & filePath) const
+{
+	if(!filePath.isEmpty() && QFileInfo(filePath).suffix().compare("bin") == 0)
+	{
+		QFile file(filePath);
+		file.open(QIODevice::WriteOnly);
+		QDataStream out(&file);
+
+		// ignore parameters
+		out << ParametersMap();
+
+		// save vocabulary
+		vocabulary_->save(out, true);
+
+		file.close();
+		return true;
+	}
+	else
+	{
+		return vocabulary_->save(filePath);
+	}
+	return false;
+}
+
+bool FindObject::loadVocabulary(const QString & filePath)
+{
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	if(!params->General_vocabularyFixed || !params->General_invertedSearch)
+	{
+		UWARN("Doesn't make sense to load a vocabulary if \"General/vocabularyFixed\" and \"General/invertedSearch\" are not enabled! It will "
+			  "be cleared at the time the objects are updated.");
+	}
+
+	if(QFile::exists(filePath) && !filePath.isEmpty() && QFileInfo(filePath).suffix().compare("bin") == 0)
+	{
+		//binary format (from session format)
+		QFile file(filePath);
+		file.open(QIODevice::ReadOnly);
+		QDataStream in(&file);
+
+		ParametersMap parameters;
+		// ignore parameters
+		in >> parameters;
+
+		// load vocabulary
+		vocabulary_->setParameters(*params);
+		vocabulary_->load(in, true);
+		file.close();
+
+		return true;
+	}
+	else
+	{
+		//yaml/xml format
+		vocabulary_->setParameters(*params);
+		if(vocabulary_->load(filePath))
+		{
+			if(objects_.size())
+			{
+				updateVocabulary();
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+// The file bytes are kept by the object, saved in sessions as is
+static cv::Mat readObjectImage(const QString & filePath, QByteArray & bytes)
+{
+	QFile file(filePath);
+	if(!file.open(QIODevice::ReadOnly))
+	{
+		return cv::Mat();
+	}
+	bytes = file.readAll();
+	if(bytes.isEmpty())
+	{
+		return cv::Mat();
+	}
+	return cv::imdecode(cv::Mat(1, bytes.size(), CV_8UC1, (void*)bytes.constData()), cv::IMREAD_GRAYSCALE);
+}
+
+// ID in the file name ("12.png" or "12.jpg.png"), 0 if none
+static int fileNameObjectId(const QString & filePath)
+{
+	QFileInfo file(filePath);
+	QStringList list = file.fileName().split('.');
+	if(list.size())
+	{
+		bool ok = false;
+		int id = list.front().toInt(&ok);
+		if(ok && id>0)
+		{
+			return id;
+		}
+	}
+	else
+	{
+		UERROR("File name doesn't contain \".\" (\"%s\")", filePath.toStdString().c_str());
+	}
+	return 0;
+}
+
+const ObjSignature * FindObject::addObject(const QString & filePath)
+{
+	if(memoryBudgetExceeded())
+	{
+		return 0;
+	}
+	if(!filePath.isNull())
+	{
+		QByteArray bytes;
+		cv::Mat img = readObjectImage(filePath, bytes);
+		if(!img.empty())
+		{
+			int id = fileNameObjectId(filePath);
+			if(id && objects_.contains(id))
+			{
+				UWARN("Object %d already added, a new ID will be generated (new id=%d).", id, parametersSnapshot()->General_nextObjID);
+				id = 0;
+			}
+
+			ObjSignature * s = new ObjSignature(id, img, filePath);
+			s->setEncodedImage(bytes);
+			if(this->addObject(s))
+			{
+				UINFO("Added object %d (%s)", s->id(), filePath.toStdString().c_str());
+				return s;
+			}
+			delete s;
+		}
+		else
+		{
+			UERROR("Could not read image \"%s\"", filePath.toStdString().c_str());
+		}
+	}
+	else
+	{
+		UERROR("File path is null!?");
+	}
+	return 0;
+}
+
+const ObjSignature * FindObject::addObject(const cv::Mat & image, int id, const QString & filePath)
+{
+	UASSERT(id >= 0);
+	if(memoryBudgetExceeded())
+	{
+		return 0;
+	}
+	ObjSignature * s = new ObjSignature(id, image, filePath);
+	if(!this->addObject(s))
+	{
+		delete s;
+		return 0;
+	}
+	return s;
+}
+
+bool FindObject::addObject(ObjSignature * obj)
+{
+	UASSERT(obj != 0 && obj->id() >= 0);
+	if(obj->id() && objects_.contains(obj->id()))
+	{
+		UERROR("object with id %d already added!", obj->id());
+		return false;
+	}
+	else if(obj->id() == 0)
+	{
+		obj->setId(parametersSnapshot()->General_nextObjID);
+	}
+
+	setParameter(Settings::kGeneral_nextObjID(), obj->id()+1);
+
+	objects_.insert(obj->id(), obj);
+
+	return true;
+}
+
+void FindObject::removeObject(int id)
+{
+	if(objects_.contains(id))
+	{
+		delete objects_.value(id);
+		objects_.remove(id);
+		clearVocabulary();
+	}
+}
+
+void FindObject::removeAllObjects()
+{
+	qDeleteAll(objects_);
 	objects_.clear();
 	clearVocabulary();
 }
 
 void FindObject::addObjectAndUpdate(const cv::Mat & image, int id, const QString & filePath)
 {
-	const ObjSignature * s = this->addObject(image, id, filePath);
-	if(s)
+	QMutexLocker updateLocker(&updateMutex_);
+	UASSERT(id >= 0);
+	if(id && objects_.contains(id))
 	{
-		QList<int> ids;
-		ids.push_back(s->id());
-		updateObjects(ids);
-		updateVocabulary(ids);
+		UERROR("object with id %d already added!", id);
+		return;
+	}
+	if(memoryBudgetExceeded())
+	{
+		return;
+	}
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	threadPool_->setMaxThreadCount(params->General_threads);
+
+	// Features and words are computed aside, the object is visible
+	// to detections only once swapped in with the updated vocabulary
+	ObjSignature * s = new ObjSignature(id?id:params->General_nextObjID, image, filePath);
+	QList<ObjSignature*> objectsList;
+	objectsList.push_back(s);
+	sessionModified_ = true;
+	extractFeatures(objectsList);
+	int objectId = s->id();
+	buildVocabulary(objectsList, false, s);
+
+	// first stage of the cascade, see General/cascade
+	if(cascade_ && objects_.contains(objectId))
+	{
+		cascade_->addObjectAndUpdate(image, objectId, filePath);
+	}
+	else if(!cascade_ && params->General_cascade)
+	{
+		updateCascade();
+	}
+
+	if(params->General_sessionJournal && objects_.contains(objectId))
+	{
+		QByteArray payload;
+		QDataStream out(&payload, QIODevice::WriteOnly);
+		objects_.value(objectId)->save(out);
+		appendJournal(kJournalAdd, payload);
 	}
 }
 
 void FindObject::removeObjectAndUpdate(int id)
 {
-	if(objects_.contains(id))
+	QMutexLocker updateLocker(&updateMutex_);
+	threadPool_->setMaxThreadCount(parametersSnapshot()->General_threads);
+
+	// The object is removed when the vocabulary rebuilt without it is swapped in
+	QList<ObjSignature*> objectsList = objects_.values();
+	bool removed = objects_.contains(id);
+	if(removed)
 	{
-		delete objects_.value(id);
-		objects_.remove(id);
+		objectsList.removeAll(objects_.value(id));
+	}
+	buildVocabulary(objectsList, true, 0, id);
+
+	if(cascade_)
+	{
+		cascade_->removeObjectAndUpdate(id);
+	}
+
+	if(removed && !objects_.contains(id))
+	{
+		QByteArray payload;
+		QDataStream out(&payload, QIODevice::WriteOnly);
+		out << id;
+		appendJournal(kJournalRemove, payload);
 	}
-	updateVocabulary();
 }
 
 void FindObject::updateDetectorExtractor()
 {
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
 	delete detector_;
 	delete extractor_;
-	detector_ = Settings::createKeypointDetector();
-	extractor_ = Settings::createDescriptorExtractor();
-	UASSERT(detector_ != 0 && extractor_ != 0);
+	detector_ = new ThreadFeature2D(*params, true);
+	extractor_ = new ThreadFeature2D(*params, false);
+	threadPool_->setMaxThreadCount(params->General_threads);
 }
 
-std::vector<cv::KeyPoint> limitKeypoints(const std::vector<cv::KeyPoint> & keypoints, int maxKeypoints)
+// Strongest response first, ties by index
+struct KeypointResponseGreater
+{
+	KeypointResponseGreater(const std::vector<cv::KeyPoint> & keypoints) : keypoints_(keypoints) {}
+	bool operator()(int a, int b) const
+	{
+		float ra = fabs(keypoints_[a].response);
+		float rb = fabs(keypoints_[b].response);
+		return ra > rb || (ra == rb && a < b);
+	}
+	const std::vector<cv::KeyPoint> & keypoints_;
+};
+
+// Indexes (in increasing order) of the maxKeypoints keypoints to keep, in O(n).
+// With gridCells>1, the bounding box of the keypoints is divided in gridCells x
+// gridCells cells sharing the budget: cells with fewer keypoints than their
+// share give the rest to the others, the strongest keypoints of each cell are kept.
+static std::vector<int> selectKeypoints(const std::vector<cv::KeyPoint> & keypoints, int maxKeypoints, int gridCells)
 {
-	std::vector<cv::KeyPoint> kptsKept;
-	if(maxKeypoints > 0 && (int)keypoints.size() > maxKeypoints)
+	std::vector<int> indexes(keypoints.size());
+	for(unsigned int i=0; i<indexes.size(); ++i)
+	{
+		indexes[i] = i;
+	}
+	if(maxKeypoints <= 0 || (int)keypoints.size() <= maxKeypoints)
+	{
+		return indexes;
+	}
+
+	KeypointResponseGreater greater(keypoints);
+	std::vector<int> kept;
+	if(gridCells > 1)
 	{
-		// Sort words by response
-		std::multimap<float, int> reponseMap; // <response,id>
-		for(unsigned int i = 0; i <keypoints.size(); ++i)
+		float minX = keypoints[0].pt.x, maxX = minX;
+		float minY = keypoints[0].pt.y, maxY = minY;
+		for(unsigned int i=1; i<keypoints.size(); ++i)
+		{
+			minX = std::min(minX, keypoints[i].pt.x);
+			maxX = std::max(maxX, keypoints[i].pt.x);
+			minY = std::min(minY, keypoints[i].pt.y);
+			maxY = std::max(maxY, keypoints[i].pt.y);
+		}
+		float cellWidth = (maxX-minX)/gridCells + 1e-3f;
+		float cellHeight = (maxY-minY)/gridCells + 1e-3f;
+		int cells = gridCells*gridCells;
+
+		// keypoints grouped by cell (counting sort)
+		std::vector<int> cellOf(keypoints.size());
+		std::vector<int> offsets(cells+1, 0);
+		for(unsigned int i=0; i<keypoints.size(); ++i)
+		{
+			int x = std::min(int((keypoints[i].pt.x-minX)/cellWidth), gridCells-1);
+			int y = std::min(int((keypoints[i].pt.y-minY)/cellHeight), gridCells-1);
+			cellOf[i] = y*gridCells + x;
+			++offsets[cellOf[i]+1];
+		}
+		for(int c=0; c<cells; ++c)
+		{
+			offsets[c+1] += offsets[c];
+		}
+		std::vector<int> next(offsets.begin(), offsets.end()-1);
+		for(unsigned int i=0; i<keypoints.size(); ++i)
+		{
+			indexes[next[cellOf[i]]++] = i;
+		}
+
+		// budget shared from the sparsest cells to the densest
+		std::vector<std::pair<int, int> > counts; // <keypoints, cell>
+		for(int c=0; c<cells; ++c)
 		{
-			//Keep track of the data, to be easier to manage the data in the next step
-			reponseMap.insert(std::pair<float, int>(fabs(keypoints[i].response), i));
+			if(offsets[c+1] > offsets[c])
+			{
+				counts.push_back(std::make_pair(offsets[c+1]-offsets[c], c));
+			}
 		}
-
-		// Remove them
-		std::multimap<float, int>::reverse_iterator iter = reponseMap.rbegin();
-		kptsKept.resize(maxKeypoints);
-		for(unsigned int k=0; k < kptsKept.size() && iter!=reponseMap.rend(); ++k, ++iter)
+		std::sort(counts.begin(), counts.end());
+		int remaining = maxKeypoints;
+		kept.reserve(maxKeypoints);
+		for(unsigned int i=0; i<counts.size(); ++i)
 		{
-			kptsKept[k] = keypoints[iter->second];
+			int cellsLeft = int(counts.size() - i);
+			int take = std::min(counts[i].first, (remaining + cellsLeft - 1)/cellsLeft);
+			std::vector<int>::iterator begin = indexes.begin() + offsets[counts[i].second];
+			std::vector<int>::iterator end = indexes.begin() + offsets[counts[i].second+1];
+			if(take < counts[i].first)
+			{
+				std::nth_element(begin, begin+take, end, greater);
+			}
+			kept.insert(kept.end(), begin, begin+take);
+			remaining -= take;
 		}
 	}
 	else
 	{
-		kptsKept = keypoints;
+		std::nth_element(indexes.begin(), indexes.begin()+maxKeypoints, indexes.end(), greater);
+		kept.assign(indexes.begin(), indexes.begin()+maxKeypoints);
+	}
+	std::sort(kept.begin(), kept.end());
+	return kept;
+}
+
+std::vector<cv::KeyPoint> limitKeypoints(const std::vector<cv::KeyPoint> & keypoints, int maxKeypoints, int gridCells)
+{
+	if(maxKeypoints <= 0 || (int)keypoints.size() <= maxKeypoints)
+	{
+		return keypoints;
+	}
+	std::vector<int> kept = selectKeypoints(keypoints, maxKeypoints, gridCells);
+	std::vector<cv::KeyPoint> kptsKept(kept.size());
+	for(unsigned int k=0; k<kept.size(); ++k)
+	{
+		kptsKept[k] = keypoints[kept[k]];
 	}
 	return kptsKept;
 }
 
-void limitKeypoints(std::vector<cv::KeyPoint> & keypoints, cv::Mat & descriptors, int maxKeypoints)
+void limitKeypoints(std::vector<cv::KeyPoint> & keypoints, cv::Mat & descriptors, int maxKeypoints, int gridCells)
 {
 	UASSERT((int)keypoints.size() == descriptors.rows);
-	std::vector<cv::KeyPoint> kptsKept;
-	cv::Mat descriptorsKept;
-	if(maxKeypoints > 0 && (int)keypoints.size() > maxKeypoints)
+	if(maxKeypoints <= 0 || (int)keypoints.size() <= maxKeypoints)
 	{
-		descriptorsKept = cv::Mat(0, descriptors.cols, descriptors.type());
+		return;
+	}
+	std::vector<int> kept = selectKeypoints(keypoints, maxKeypoints, gridCells);
+	std::vector<cv::KeyPoint> kptsKept(kept.size());
+	cv::Mat descriptorsKept((int)kept.size(), descriptors.cols, descriptors.type());
+	size_t rowSize = descriptors.cols * descriptors.elemSize();
+	for(unsigned int k=0; k<kept.size(); ++k)
+	{
+		kptsKept[k] = keypoints[kept[k]];
+		memcpy(descriptorsKept.ptr(k), descriptors.ptr(kept[k]), rowSize);
+	}
+	keypoints.swap(kptsKept);
+	descriptors = descriptorsKept;
+	UASSERT_MSG((int)keypoints.size() == descriptors.rows, uFormat("%d vs %d", (int)keypoints.size(), descriptors.rows).c_str());
+}
 
-		// Sort words by response
-		std::multimap<float, int> reponseMap; // <response,id>
-		for(unsigned int i = 0; i <keypoints.size(); ++i)
+// RootSIFT in place: each descriptor is L1 normalized in one pass over its
+// values, then the square root of a block of rows is taken at once (SIMD
+// in cv::sqrt). The result is also L2 normalized. Blocks in parallel.
+class RootSiftBody : public cv::ParallelLoopBody
+{
+public:
+	RootSiftBody(cv::Mat & descriptors) :
+		descriptors_(descriptors)
+	{
+		UASSERT(descriptors.type() == CV_32FC1);
+	}
+	virtual void operator()(const cv::Range & range) const
+	{
+		int cols = descriptors_.cols;
+		for(int i=range.start; i<range.end; ++i)
 		{
-			//Keep track of the data, to be easier to manage the data in the next step
-			reponseMap.insert(std::pair<float, int>(fabs(keypoints[i].response), i));
+			float * d = descriptors_.ptr<float>(i);
+			// independent sums so the compiler can vectorize the loop
+			float s0=0.0f, s1=0.0f, s2=0.0f, s3=0.0f;
+			int j=0;
+			for(; j+3<cols; j+=4)
+			{
+				s0 += d[j];
+				s1 += d[j+1];
+				s2 += d[j+2];
+				s3 += d[j+3];
+			}
+			for(; j<cols; ++j)
+			{
+				s0 += d[j];
+			}
+			float sum = (s0+s1)+(s2+s3);
+			if(sum > 0.0f)
+			{
+				float inv = 1.0f/sum;
+				for(j=0; j<cols; ++j)
+				{
+					d[j] *= inv;
+				}
+			}
 		}
+		cv::Mat block = descriptors_.rowRange(range.start, range.end);
+		cv::sqrt(block, block);
+	}
+private:
+	cv::Mat & descriptors_;
+};
 
-		// Remove them
-		std::multimap<float, int>::reverse_iterator iter = reponseMap.rbegin();
-		kptsKept.resize(maxKeypoints);
-		descriptorsKept.reserve(maxKeypoints);
-		for(unsigned int k=0; k < kptsKept.size() && iter!=reponseMap.rend(); ++k, ++iter)
-		{
-			kptsKept[k] = keypoints[iter->second];
-			descriptorsKept.push_back(descriptors.row(iter->second));
-		}
+static void rootSift(cv::Mat & descriptors)
+{
+	if(!descriptors.empty())
+	{
+		cv::parallel_for_(cv::Range(0, descriptors.rows), RootSiftBody(descriptors), descriptors.rows/1024.0);
 	}
-	keypoints = kptsKept;
-	descriptors = descriptorsKept;
-	UASSERT_MSG((int)keypoints.size() == descriptors.rows, uFormat("%d vs %d", (int)keypoints.size(), descriptors.rows).c_str());
+}
+
+// Descriptors can be extracted for keypoints detected before (not the case of ORB GPU on OpenCV 3)
+bool computeFromKeypoints(const ParametersSnapshot & params)
+{
+#if CV_MAJOR_VERSION >= 3
+	if(params.Feature2D_ORB_gpu && Settings::currentDescriptorType(params) == "ORB")
+	{
+		return false;
+	}
+#endif
+	return true;
 }
 
 void computeFeatures(
+		const ParametersSnapshot * params,
 		Feature2D * detector,
 		Feature2D * extractor,
 		const cv::Mat & image,
@@ -474,21 +1344,23 @@ void computeFeatures(
 		std::vector<cv::KeyPoint> & keypoints,
 		cv::Mat & descriptors,
 		int & timeDetection,
-		int & timeExtraction)
+		int & timeExtraction,
+		int maxFeatures, // 0 means no limit
+		bool limitBeforeExtraction = false) // descriptors are not extracted for the keypoints removed
 {
 	QTime timeStep;
 	timeStep.start();
 	keypoints.clear();
 	descriptors = cv::Mat();
 
-	int maxFeatures = Settings::getFeature2D_3MaxFeatures();
-	if(Settings::currentDetectorType() == Settings::currentDescriptorType())
+	if(Settings::currentDetectorType(*params) == Settings::currentDescriptorType(*params) &&
+	   !(limitBeforeExtraction && maxFeatures > 0))
 	{
 		detector->detectAndCompute(image, keypoints, descriptors, mask);
 		UASSERT_MSG((int)keypoints.size() == descriptors.rows, uFormat("%d vs %d", (int)keypoints.size(), descriptors.rows).c_str());
 		if(maxFeatures > 0 && (int)keypoints.size() > maxFeatures)
 		{
-			limitKeypoints(keypoints, descriptors, maxFeatures);
+			limitKeypoints(keypoints, descriptors, maxFeatures, params->Feature2D_3MaxFeaturesGrid);
 		}
 		timeDetection=timeStep.restart();
 		timeExtraction = 0;
@@ -498,7 +1370,7 @@ void computeFeatures(
 		detector->detect(image, keypoints, mask);
 		if(maxFeatures > 0 && (int)keypoints.size() > maxFeatures)
 		{
-			keypoints = limitKeypoints(keypoints, maxFeatures);
+			keypoints = limitKeypoints(keypoints, maxFeatures, params->Feature2D_3MaxFeaturesGrid);
 		}
 		timeDetection=timeStep.restart();
 
@@ -526,30 +1398,22 @@ void computeFeatures(
 		timeExtraction+=timeStep.restart();
 	}
 
-	if( Settings::getFeature2D_SIFT_rootSIFT() &&
-		Settings::currentDescriptorType() == "SIFT" &&
+	if( params->Feature2D_SIFT_rootSIFT &&
+		Settings::currentDescriptorType(*params) == "SIFT" &&
 		!descriptors.empty())
 	{
 		UINFO("Performing RootSIFT...");
 		// see http://www.pyimagesearch.com/2015/04/13/implementing-rootsift-in-python-and-opencv/
 		// apply the Hellinger kernel by first L1-normalizing and taking the
-		// square-root
-		for(int i=0; i<descriptors.rows; ++i)
-		{
-			descriptors.row(i) = descriptors.row(i) / cv::sum(descriptors.row(i))[0];
-			cv::sqrt(descriptors.row(i), descriptors.row(i));
-
-			// By taking the L1 norm, followed by the square-root, we have
-			// already L2 normalized the feature vector and further normalization
-			// is not needed.
-			//descs /= (np.linalg.norm(descs, axis=1, ord=2) + eps);
-		}
+		// square-root, no further L2 normalization is needed
+		rootSift(descriptors);
 	}
 }
 
 
 // taken from ASIFT example https://github.com/Itseez/opencv/blob/master/samples/python2/asift.py
 // affine - is an affine transform matrix from skew_img to img
+// skewImage and skewMask are reused if they already have the size of the view
 void FindObject::affineSkew(
 		float tilt,
 		float phi,
@@ -562,7 +1426,11 @@ void FindObject::affineSkew(
     float w = image.cols;
     cv::Mat A = cv::Mat::zeros(2,3,CV_32FC1);
     A.at<float>(0,0) = A.at<float>(1,1) = 1;
-    skewMask = cv::Mat::ones(h, w, CV_8U) * 255;
+    if(skewImage.data == image.data)
+    {
+    	skewImage = cv::Mat(); // don't write in the input image
+    }
+    cv::Mat rotated = image;
     if(phi != 0.0)
     {
         phi = phi*CV_PI/180.0f; // deg2rad
@@ -582,48 +1450,73 @@ void FindObject::affineSkew(
 				c, -s, -rect.x,
 				s, c, -rect.y);
         cv::warpAffine(image, skewImage, A, cv::Size(rect.width, rect.height), cv::INTER_LINEAR, cv::BORDER_REPLICATE);
-    }
-    else
-    {
-    	skewImage = image;
+        rotated = skewImage;
     }
     if(tilt != 1.0)
     {
         float s = 0.8*std::sqrt(tilt*tilt-1);
-        cv::Mat out, out2;
-        cv::GaussianBlur(skewImage, out, cv::Size(0, 0), s, 0.01);
-        cv::resize(out, out2, cv::Size(0, 0), 1.0/tilt, 1.0, cv::INTER_NEAREST);
-        skewImage = out2;
+        cv::Mat blurred;
+        cv::GaussianBlur(rotated, blurred, cv::Size(0, 0), s, 0.01);
+        cv::resize(blurred, skewImage, cv::Size(0, 0), 1.0/tilt, 1.0, cv::INTER_NEAREST);
         A.row(0) /= tilt;
     }
     if(phi != 0.0 || tilt != 1.0)
     {
-    	cv::Mat mask = skewMask;
-        cv::warpAffine(mask, skewMask, A, skewImage.size(), cv::INTER_NEAREST);
+    	// Pixels of the view inside the image, filled from the corners
+    	// instead of warping a full image of ones
+    	skewMask.create(skewImage.size(), CV_8U);
+    	skewMask.setTo(cv::Scalar(0));
+    	const float corners[4][2] = {{0,0}, {w,0}, {w,h}, {0,h}};
+    	cv::Point polygon[4];
+    	for(int i=0; i<4; ++i)
+    	{
+    		polygon[i].x = cvRound(A.at<float>(0,0)*corners[i][0] + A.at<float>(0,1)*corners[i][1] + A.at<float>(0,2));
+    		polygon[i].y = cvRound(A.at<float>(1,0)*corners[i][0] + A.at<float>(1,1)*corners[i][1] + A.at<float>(1,2));
+    	}
+    	cv::fillConvexPoly(skewMask, polygon, 4, cv::Scalar(255));
+    }
+    else
+    {
+    	skewImage = image;
+    	skewMask.create(image.size(), CV_8U);
+    	skewMask.setTo(cv::Scalar(255));
     }
     cv::invertAffineTransform(A, Ai);
 }
 
-class AffineExtractionThread : public QThread
+// Views and masks of the affine extraction tasks, reused by each thread of
+// the pool from one view to the next (and from one frame to the next)
+struct AffineViewBuffers
+{
+	cv::Mat skewImage;
+	cv::Mat skewMask;
+};
+static QThreadStorage<AffineViewBuffers*> affineViewBuffers;
+
+class AffineExtractionTask : public QRunnable
 {
 public:
-	AffineExtractionThread(
+	AffineExtractionTask(
+			const ParametersSnapshot * params,
 			Feature2D * detector,
 			Feature2D * extractor,
 			const cv::Mat & image,
 			float tilt,
-			float phi) :
+			float phi,
+			int maxFeatures) :
+		params_(params),
 		detector_(detector),
 		extractor_(extractor),
 		image_(image),
 		tilt_(tilt),
 		phi_(phi),
+		maxFeatures_(maxFeatures),
 		timeSkewAffine_(0),
 		timeDetection_(0),
 		timeExtraction_(0),
 		timeSubPix_(0)
 	{
-		UASSERT(detector && extractor);
+		UASSERT(params && detector && extractor);
 	}
 	const cv::Mat & image() const {return image_;}
 	const std::vector<cv::KeyPoint> & keypoints() const {return keypoints_;}
@@ -634,25 +1527,37 @@ public:
 	int timeExtraction() const {return timeExtraction_;}
 	int timeSubPix() const {return timeSubPix_;}
 
-protected:
 	virtual void run()
 	{
+		FINDOBJECT_TRACE_SPAN(traceSpan, "affine view", "features");
 		QTime timeStep;
 		timeStep.start();
-		cv::Mat skewImage, skewMask, Ai;
-		FindObject::affineSkew(tilt_, phi_, image_, skewImage, skewMask, Ai);
+		if(!affineViewBuffers.hasLocalData())
+		{
+			affineViewBuffers.setLocalData(new AffineViewBuffers());
+		}
+		AffineViewBuffers & buffers = *affineViewBuffers.localData();
+		cv::Mat Ai;
+		FindObject::affineSkew(tilt_, phi_, image_, buffers.skewImage, buffers.skewMask, Ai);
 		timeSkewAffine_=timeStep.restart();
 
-		//Detect features
+		//Detect features, only the best of the view's budget are extracted
 		computeFeatures(
+				params_,
 				detector_,
 				extractor_,
-				skewImage,
-				skewMask,
+				buffers.skewImage,
+				buffers.skewMask,
 				keypoints_,
 				descriptors_,
 				timeDetection_,
-				timeExtraction_);
+				timeExtraction_,
+				maxFeatures_,
+				computeFromKeypoints(*params_));
+		if(buffers.skewImage.data == image_.data)
+		{
+			buffers.skewImage = cv::Mat(); // not kept, it is the caller's image
+		}
 		timeStep.start();
 
 		// Transform points to original image coordinates
@@ -664,16 +1569,16 @@ protected:
 			keypoints_[i].pt.y = pa.at<float>(1,0);
 		}
 
-		if(keypoints_.size() && Settings::getFeature2D_6SubPix())
+		if(keypoints_.size() && params_->Feature2D_6SubPix)
 		{
 			// Sub pixel should be done after descriptors extraction
 			std::vector<cv::Point2f> corners;
 			cv::KeyPoint::convert(keypoints_, corners);
 			cv::cornerSubPix(image_,
 					corners,
-					cv::Size(Settings::getFeature2D_7SubPixWinSize(), Settings::getFeature2D_7SubPixWinSize()),
+					cv::Size(params_->Feature2D_7SubPixWinSize, params_->Feature2D_7SubPixWinSize),
 					cv::Size(-1,-1),
-					cv::TermCriteria( CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, Settings::getFeature2D_8SubPixIterations(), Settings::getFeature2D_9SubPixEps() ));
+					cv::TermCriteria( CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, params_->Feature2D_8SubPixIterations, params_->Feature2D_9SubPixEps ));
 			UASSERT(corners.size() == keypoints_.size());
 			for(unsigned int i=0; i<corners.size(); ++i)
 			{
@@ -683,11 +1588,13 @@ protected:
 		}
 	}
 private:
+	const ParametersSnapshot * params_;
 	Feature2D * detector_;
 	Feature2D * extractor_;
 	cv::Mat image_;
 	float tilt_;
 	float phi_;
+	int maxFeatures_;
 	std::vector<cv::KeyPoint> keypoints_;
 	cv::Mat descriptors_;
 
@@ -697,29 +1604,174 @@ private:
 	int timeSubPix_;
 };
 
-class ExtractFeaturesThread : public QThread
+// Features of a tile of the image (see Feature2D/tiles). Keypoints are detected
+// only in the tile's own area, the overlap with the neighbor tiles gives them
+// their full neighborhood for the detection and the descriptors.
+class TileExtractionTask : public QRunnable
+{
+public:
+	TileExtractionTask(
+			const ParametersSnapshot * params,
+			Feature2D * detector,
+			Feature2D * extractor,
+			const cv::Mat & image,
+			const cv::Mat & imageMask, // empty for the whole image
+			const cv::Rect & tile,
+			const cv::Rect & area,
+			int maxFeatures) :
+		params_(params),
+		detector_(detector),
+		extractor_(extractor),
+		image_(image),
+		imageMask_(imageMask),
+		tile_(tile),
+		area_(area),
+		maxFeatures_(maxFeatures),
+		timeDetection_(0),
+		timeExtraction_(0)
+	{
+		UASSERT(params && detector && extractor);
+		UASSERT((tile & area) == area);
+	}
+	const std::vector<cv::KeyPoint> & keypoints() const {return keypoints_;}
+	const cv::Mat & descriptors() const {return descriptors_;}
+
+	int timeDetection() const {return timeDetection_;}
+	int timeExtraction() const {return timeExtraction_;}
+
+	virtual void run()
+	{
+		FINDOBJECT_TRACE_SPAN(traceSpan, "tile", "features");
+		cv::Mat tileImage(image_, tile_);
+		cv::Mat mask = cv::Mat::zeros(tile_.height, tile_.width, CV_8UC1);
+		cv::Rect localArea(area_.x - tile_.x, area_.y - tile_.y, area_.width, area_.height);
+		if(imageMask_.empty())
+		{
+			mask(localArea).setTo(cv::Scalar(255));
+		}
+		else
+		{
+			cv::Mat dest = mask(localArea);
+			imageMask_(area_).copyTo(dest);
+		}
+
+		computeFeatures(
+				params_,
+				detector_,
+				extractor_,
+				tileImage,
+				mask,
+				keypoints_,
+				descriptors_,
+				timeDetection_,
+				timeExtraction_,
+				maxFeatures_,
+				computeFromKeypoints(*params_));
+
+		// Tile to image coordinates, keypoints outside the area (detectors
+		// not supporting masks) are found by the neighbor tiles
+		std::vector<cv::KeyPoint> keypoints;
+		cv::Mat descriptors;
+		keypoints.reserve(keypoints_.size());
+		std::vector<int> kept;
+		kept.reserve(keypoints_.size());
+		for(unsigned int i=0; i<keypoints_.size(); ++i)
+		{
+			keypoints_[i].pt.x += tile_.x;
+			keypoints_[i].pt.y += tile_.y;
+			if(area_.contains(cv::Point(int(keypoints_[i].pt.x), int(keypoints_[i].pt.y))))
+			{
+				kept.push_back(i);
+			}
+		}
+		if(kept.size() != keypoints_.size())
+		{
+			descriptors = cv::Mat((int)kept.size(), descriptors_.cols, descriptors_.type());
+			for(unsigned int i=0; i<kept.size(); ++i)
+			{
+				keypoints.push_back(keypoints_[kept[i]]);
+				descriptors_.row(kept[i]).copyTo(descriptors.row(i));
+			}
+			keypoints_ = keypoints;
+			descriptors_ = descriptors;
+		}
+	}
+private:
+	const ParametersSnapshot * params_;
+	Feature2D * detector_;
+	Feature2D * extractor_;
+	cv::Mat image_;
+	cv::Mat imageMask_;
+	cv::Rect tile_;
+	cv::Rect area_;
+	int maxFeatures_;
+	std::vector<cv::KeyPoint> keypoints_;
+	cv::Mat descriptors_;
+
+	int timeDetection_;
+	int timeExtraction_;
+};
+
+// Concatenate the features of the tasks, descriptors are copied once in a preallocated matrix
+template<class T>
+void mergeFeatures(const QVector<T*> & tasks, std::vector<cv::KeyPoint> & keypoints, cv::Mat & descriptors)
+{
+	int count = 0;
+	for(int k=0; k<tasks.size(); ++k)
+	{
+		count += tasks[k]->descriptors().rows;
+	}
+	keypoints.clear();
+	keypoints.reserve(count);
+	descriptors = cv::Mat();
+	for(int k=0; k<tasks.size(); ++k)
+	{
+		if(tasks[k]->descriptors().rows)
+		{
+			if(descriptors.empty())
+			{
+				descriptors = cv::Mat(count, tasks[k]->descriptors().cols, tasks[k]->descriptors().type());
+			}
+			UASSERT(descriptors.cols == tasks[k]->descriptors().cols && descriptors.type() == tasks[k]->descriptors().type());
+			cv::Mat dest = descriptors.rowRange((int)keypoints.size(), (int)keypoints.size() + tasks[k]->descriptors().rows);
+			tasks[k]->descriptors().copyTo(dest);
+			keypoints.insert(keypoints.end(), tasks[k]->keypoints().begin(), tasks[k]->keypoints().end());
+		}
+	}
+	UASSERT((int)keypoints.size() == descriptors.rows);
+}
+
+class ExtractFeaturesTask : public QRunnable
 {
 public:
-	ExtractFeaturesThread(
+	ExtractFeaturesTask(
+			const ParametersSnapshot * params,
+			ThreadPool * threadPool, // used for ASIFT
 			Feature2D * detector,
 			Feature2D * extractor,
 			int objectId,
-			const cv::Mat & image) :
+			const cv::Mat & image,
+			const cv::Mat & mask = cv::Mat(), // not used with ASIFT
+			const FeatureCache * cache = 0) : // objects only, without mask
+		params_(params),
+		threadPool_(threadPool),
 		detector_(detector),
 		extractor_(extractor),
 		objectId_(objectId),
 		image_(image),
+		mask_(mask),
+		cache_(cache),
 		timeSkewAffine_(0),
 		timeDetection_(0),
 		timeExtraction_(0),
 		timeSubPix_(0)
 	{
-		UASSERT(detector && extractor);
+		UASSERT(params && threadPool && detector && extractor);
 		UASSERT_MSG(!image.empty() && image.type() == CV_8UC1,
 				uFormat("Image of object %d is null or not type CV_8UC1!?!? (cols=%d, rows=%d, type=%d)",
 						objectId, image.cols, image.rows, image.type()).c_str());
 	}
-	virtual ~ExtractFeaturesThread() {}
+	virtual ~ExtractFeaturesTask() {}
 	int objectId() const {return objectId_;}
 	const cv::Mat & image() const {return image_;}
 	const std::vector<cv::KeyPoint> & keypoints() const {return keypoints_;}
@@ -730,8 +1782,29 @@ public:
 	int timeExtraction() const {return timeExtraction_;}
 	int timeSubPix() const {return timeSubPix_;}
 
-protected:
 	virtual void run()
+	{
+		FINDOBJECT_TRACE_SPAN_ID(traceSpan, "extract", "features", objectId_);
+		QByteArray imageKey;
+		if(cache_ && mask_.empty())
+		{
+			imageKey = FeatureCache::imageKey(image_);
+			if(cache_->load(imageKey, keypoints_, descriptors_))
+			{
+				UINFO("%d descriptors of object %d loaded from the feature cache", descriptors_.rows, objectId_);
+				return;
+			}
+		}
+
+		extract();
+
+		if(!imageKey.isEmpty())
+		{
+			cache_->save(imageKey, keypoints_, descriptors_);
+		}
+	}
+private:
+	void extract()
 	{
 		QTime time;
 		time.start();
@@ -740,32 +1813,42 @@ protected:
 		QTime timeStep;
 		timeStep.start();
 
-		if(!Settings::getFeature2D_4Affine())
-		{
-			computeFeatures(
-					detector_,
-					extractor_,
-					image_,
-					cv::Mat(),
-					keypoints_,
-					descriptors_,
-					timeDetection_,
-					timeExtraction_);
+		if(!params_->Feature2D_4Affine)
+		{
+			int tiles = params_->Feature2D_tiles;
+			if(tiles > 1 && image_.cols >= tiles && image_.rows >= tiles)
+			{
+				extractTiles(tiles);
+			}
+			else
+			{
+				computeFeatures(
+						params_,
+						detector_,
+						extractor_,
+						image_,
+						mask_,
+						keypoints_,
+						descriptors_,
+						timeDetection_,
+						timeExtraction_,
+						params_->Feature2D_3MaxFeatures);
+			}
 			timeStep.start();
 
 			if(keypoints_.size())
 			{
 				UDEBUG("Detected %d features from object %d...", (int)keypoints_.size(), objectId_);
-				if(Settings::getFeature2D_6SubPix())
+				if(params_->Feature2D_6SubPix)
 				{
 					// Sub pixel should be done after descriptors extraction
 					std::vector<cv::Point2f> corners;
 					cv::KeyPoint::convert(keypoints_, corners);
 					cv::cornerSubPix(image_,
 							corners,
-							cv::Size(Settings::getFeature2D_7SubPixWinSize(), Settings::getFeature2D_7SubPixWinSize()),
+							cv::Size(params_->Feature2D_7SubPixWinSize, params_->Feature2D_7SubPixWinSize),
 							cv::Size(-1,-1),
-							cv::TermCriteria( CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, Settings::getFeature2D_8SubPixIterations(), Settings::getFeature2D_9SubPixEps() ));
+							cv::TermCriteria( CV_TERMCRIT_EPS + CV_TERMCRIT_ITER, params_->Feature2D_8SubPixIterations, params_->Feature2D_9SubPixEps ));
 					UASSERT(corners.size() == keypoints_.size());
 					for(unsigned int i=0; i<corners.size(); ++i)
 					{
@@ -786,7 +1869,7 @@ protected:
 			std::vector<float> phis;
 			tilts.push_back(1.0f);
 			phis.push_back(0.0f);
-			int nTilt = Settings::getFeature2D_5AffineCount();
+			int nTilt = params_->Feature2D_5AffineCount;
 			for(int t=1; t<nTilt; ++t)
 			{
 				float tilt = std::pow(2.0f, 0.5f*float(t));
@@ -798,58 +1881,282 @@ protected:
 				}
 			}
 
+			// Feature2D/3MaxFeatures is shared between the views according to their
+			// area (1/tilt of the image), so that the discarded features are not extracted
+			int maxFeatures = params_->Feature2D_3MaxFeatures;
+			float areaSum = 0.0f;
+			for(unsigned int k=0; k<tilts.size(); ++k)
+			{
+				areaSum += 1.0f/tilts[k];
+			}
+
 			//multi-threaded
-			unsigned int threadCounts = Settings::getGeneral_threads();
-			if(threadCounts == 0)
+			TaskGroup group(threadPool_);
+			QVector<AffineExtractionTask*> tasks(tilts.size());
+			for(unsigned int k=0; k<tilts.size(); ++k)
 			{
-				threadCounts = (unsigned int)tilts.size();
+				int viewMaxFeatures = maxFeatures>0?(int)std::ceil(float(maxFeatures)/(tilts[k]*areaSum)):0;
+				tasks[k] = new AffineExtractionTask(params_, detector_, extractor_, image_, tilts[k], phis[k], viewMaxFeatures);
+				group.start(tasks[k]);
 			}
+			group.wait();
 
-			for(unsigned int i=0; i<tilts.size(); i+=threadCounts)
+			mergeFeatures(tasks, keypoints_, descriptors_);
+			for(int k=0; k<tasks.size(); ++k)
 			{
-				QVector<AffineExtractionThread*> threads;
+				timeSkewAffine_ += tasks[k]->timeSkewAffine();
+				timeDetection_ += tasks[k]->timeDetection();
+				timeExtraction_ += tasks[k]->timeExtraction();
+				timeSubPix_ += tasks[k]->timeSubPix();
 
-				for(unsigned int k=i; k<i+threadCounts && k<tilts.size(); ++k)
-				{
-					threads.push_back(new AffineExtractionThread(detector_, extractor_, image_, tilts[k], phis[k]));
-					threads.back()->start();
-				}
+				delete tasks[k];
+			}
+
+			// the budgets are rounded up
+			if(maxFeatures > 0 && (int)keypoints_.size() > maxFeatures)
+			{
+				limitKeypoints(keypoints_, descriptors_, maxFeatures, params_->Feature2D_3MaxFeaturesGrid);
+			}
+		}
+
+		UINFO("%d descriptors extracted from object %d (in %d ms)", descriptors_.rows, objectId_, time.elapsed());
+	}
+
+	// Feature2D/tiles x Feature2D/tiles tiles extracted in parallel on the pool
+	void extractTiles(int tiles)
+	{
+		int overlap = params_->Feature2D_tilesOverlap>0?params_->Feature2D_tilesOverlap:0;
+		int maxFeatures = params_->Feature2D_3MaxFeatures;
+		int tileMaxFeatures = maxFeatures>0?(maxFeatures + tiles*tiles - 1)/(tiles*tiles):0;
+		cv::Rect imageRect(0, 0, image_.cols, image_.rows);
+
+		TaskGroup group(threadPool_);
+		QVector<TileExtractionTask*> tasks(tiles*tiles);
+		for(int i=0; i<tiles; ++i)
+		{
+			for(int j=0; j<tiles; ++j)
+			{
+				int x = j*image_.cols/tiles;
+				int y = i*image_.rows/tiles;
+				cv::Rect area(x, y, (j+1)*image_.cols/tiles - x, (i+1)*image_.rows/tiles - y);
+				cv::Rect tile(area.x - overlap, area.y - overlap, area.width + 2*overlap, area.height + 2*overlap);
+				tile &= imageRect;
+				TileExtractionTask * task = new TileExtractionTask(params_, detector_, extractor_, image_, mask_, tile, area, tileMaxFeatures);
+				tasks[i*tiles+j] = task;
+				group.start(task);
+			}
+		}
+		group.wait();
+
+		mergeFeatures(tasks, keypoints_, descriptors_);
+		for(int k=0; k<tasks.size(); ++k)
+		{
+			timeDetection_ += tasks[k]->timeDetection();
+			timeExtraction_ += tasks[k]->timeExtraction();
+			delete tasks[k];
+		}
+
+		// the budgets are rounded up
+		if(maxFeatures > 0 && (int)keypoints_.size() > maxFeatures)
+		{
+			limitKeypoints(keypoints_, descriptors_, maxFeatures, params_->Feature2D_3MaxFeaturesGrid);
+		}
+	}
+
+private:
+	const ParametersSnapshot * params_;
+	ThreadPool * threadPool_;
+	Feature2D * detector_;
+	Feature2D * extractor_;
+	int objectId_;
+	cv::Mat image_;
+	cv::Mat mask_;
+	const FeatureCache * cache_;
+	std::vector<cv::KeyPoint> keypoints_;
+	cv::Mat descriptors_;
+
+	int timeSkewAffine_;
+	int timeDetection_;
+	int timeExtraction_;
+	int timeSubPix_;
+};
+
+// Image decoding and features extraction of an object loaded from a file,
+// so that reading the next images overlaps the extraction of the others
+class LoadObjectTask : public QRunnable
+{
+public:
+	LoadObjectTask(
+			const ParametersSnapshot * params,
+			ThreadPool * threadPool,
+			Feature2D * detector,
+			Feature2D * extractor,
+			int objectId,
+			const QString & filePath,
+			bool keepImage,
+			const FeatureCache * cache) :
+		params_(params),
+		threadPool_(threadPool),
+		detector_(detector),
+		extractor_(extractor),
+		objectId_(objectId),
+		filePath_(filePath),
+		keepImage_(keepImage),
+		cache_(cache),
+		object_(0)
+	{}
+	virtual ~LoadObjectTask() {delete object_;}
+	const QString & filePath() const {return filePath_;}
+	// 0 if the image cannot be read, the caller takes ownership
+	ObjSignature * takeObject() {ObjSignature * object = object_; object_ = 0; return object;}
+
+	virtual void run()
+	{
+		QByteArray bytes;
+		cv::Mat image = readObjectImage(filePath_, bytes);
+		if(image.empty())
+		{
+			return;
+		}
+		object_ = new ObjSignature(objectId_, image, filePath_);
+		object_->setEncodedImage(bytes);
+		ExtractFeaturesTask extraction(params_, threadPool_, detector_, extractor_, objectId_, image, cv::Mat(), cache_);
+		extraction.run();
+		object_->setData(extraction.keypoints(), extraction.descriptors());
+		if(!keepImage_)
+		{
+			object_->releaseImage();
+		}
+	}
+
+private:
+	const ParametersSnapshot * params_;
+	ThreadPool * threadPool_;
+	Feature2D * detector_;
+	Feature2D * extractor_;
+	int objectId_;
+	QString filePath_;
+	bool keepImage_;
+	const FeatureCache * cache_;
+	ObjSignature * object_;
+};
+
+int FindObject::loadObjects(const QString & dirPath, bool recursive)
+{
+	if(memoryBudgetExceeded())
+	{
+		return 0;
+	}
+	QTime time;
+	time.start();
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	QString formats = params->General_imageFormats;
+	formats.remove('*').remove('.');
+
+	QStringList paths;
+	paths.append(dirPath);
 
-				for(int k=0; k<threads.size(); ++k)
+	QList<int> idsLoaded;
+	{
+		QMutexLocker updateLocker(&updateMutex_);
+		threadPool_->setMaxThreadCount(params->General_threads);
+
+		// The files are decoded and extracted on the pool while the directories
+		// are scanned. The IDs are set in the order of the files like addObject()
+		// would do, a file that cannot be read leaves its ID unused.
+		FeatureCache cache(params->General_featureCachePath, this->parameters());
+		TaskGroup group(threadPool_);
+		QVector<LoadObjectTask*> tasks;
+		QSet<int> ids;
+		int nextId = params->General_nextObjID;
+		while(paths.size())
+		{
+			QString currentDir = paths.front();
+			UDirectory dir(currentDir.toStdString(), formats.toStdString());
+			if(dir.isValid())
+			{
+				const std::list<std::string> & names = dir.getFileNames(); // sorted in natural order
+				for(std::list<std::string>::const_iterator iter=names.begin(); iter!=names.end(); ++iter)
 				{
-					threads[k]->wait();
+					QString filePath = (currentDir.toStdString()+dir.separator()+*iter).c_str();
+					int id = fileNameObjectId(filePath);
+					if(id && (objects_.contains(id) || ids.contains(id)))
+					{
+						UWARN("Object %d already added, a new ID will be generated (new id=%d).", id, nextId);
+						id = 0;
+					}
+					if(id == 0)
+					{
+						id = nextId;
+					}
+					nextId = id+1;
+					ids.insert(id);
 
-					keypoints_.insert(keypoints_.end(), threads[k]->keypoints().begin(), threads[k]->keypoints().end());
-					descriptors_.push_back(threads[k]->descriptors());
+					tasks.push_back(new LoadObjectTask(params.data(), threadPool_, detector_, extractor_, id, filePath, keepImagesInRAM_, cache.isEnabled()?&cache:0));
+					group.start(tasks.back());
+				}
+			}
 
-					timeSkewAffine_ += threads[k]->timeSkewAffine();
-					timeDetection_ += threads[k]->timeDetection();
-					timeExtraction_ += threads[k]->timeExtraction();
-					timeSubPix_ += threads[k]->timeSubPix();
+			paths.pop_front();
 
-					delete threads[k];
+			if(recursive)
+			{
+				QDir d(currentDir);
+				QStringList subDirs = d.entryList(QDir::AllDirs|QDir::NoDotAndDotDot, QDir::Name);
+				for(int i=subDirs.size()-1; i>=0; --i)
+				{
+					paths.prepend(currentDir+QDir::separator()+subDirs[i]);
 				}
 			}
 		}
 
-		UINFO("%d descriptors extracted from object %d (in %d ms)", descriptors_.rows, objectId_, time.elapsed());
+		int done = 0;
+		int step = tasks.size()>=10?tasks.size()/10:1;
+		while(group.waitNext())
+		{
+			if(++done % step == 0 || done == tasks.size())
+			{
+				UINFO("Loading objects... %d/%d (%d ms)", done, tasks.size(), time.elapsed());
+			}
+		}
+
+		// Objects may be used by detections running in other threads
+		QWriteLocker locker(&objectsLock_);
+		for(int i=0; i<tasks.size(); ++i)
+		{
+			ObjSignature * s = tasks[i]->takeObject();
+			if(s == 0)
+			{
+				UERROR("Could not read image \"%s\"", tasks[i]->filePath().toStdString().c_str());
+			}
+			else if(this->addObject(s))
+			{
+				UINFO("Added object %d (%s)", s->id(), tasks[i]->filePath().toStdString().c_str());
+				idsLoaded.push_back(s->id());
+			}
+			else
+			{
+				delete s;
+			}
+			delete tasks[i];
+		}
+		if(idsLoaded.size())
+		{
+			sessionModified_ = true;
+		}
+	}
+
+	if(idsLoaded.size())
+	{
+		this->updateVocabulary(idsLoaded);
 	}
-private:
-	Feature2D * detector_;
-	Feature2D * extractor_;
-	int objectId_;
-	cv::Mat image_;
-	std::vector<cv::KeyPoint> keypoints_;
-	cv::Mat descriptors_;
 
-	int timeSkewAffine_;
-	int timeDetection_;
-	int timeExtraction_;
-	int timeSubPix_;
-};
+	return idsLoaded.size();
+}
 
 void FindObject::updateObjects(const QList<int> & ids)
 {
+	QMutexLocker updateLocker(&updateMutex_);
 	UINFO("Update %d objects...", ids.size());
 	QList<ObjSignature*> objectsList;
 	if(ids.size())
@@ -874,79 +2181,82 @@ void FindObject::updateObjects(const QList<int> & ids)
 	if(objectsList.size())
 	{
 		sessionModified_ = true;
-		int threadCounts = Settings::getGeneral_threads();
-		if(threadCounts == 0)
-		{
-			threadCounts = objectsList.size();
-		}
+		threadPool_->setMaxThreadCount(parametersSnapshot()->General_threads);
+		extractFeatures(objectsList);
+	}
+	else
+	{
+		UINFO("No objects to update...");
+	}
+}
 
-		QTime time;
-		time.start();
+void FindObject::extractFeatures(const QList<ObjSignature*> & objectsList)
+{
+	QTime time;
+	time.start();
 
-		if(objectsList.size())
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	UINFO("Features extraction from %d objects... (threads=%d)", objectsList.size(), threadPool_->maxThreadCount());
+	FeatureCache cache(params->General_featureCachePath, this->parameters());
+	TaskGroup group(threadPool_);
+	QVector<ExtractFeaturesTask*> tasks;
+	QVector<ObjSignature*> taskObjects;
+	QVector<ObjSignature*> emptyObjects;
+	for(int k=0; k<objectsList.size(); ++k)
+	{
+		if(!objectsList.at(k)->image().empty())
 		{
-			UINFO("Features extraction from %d objects... (threads=%d)", objectsList.size(), threadCounts);
-			for(int i=0; i<objectsList.size(); i+=threadCounts)
+			tasks.push_back(new ExtractFeaturesTask(params.data(), threadPool_, detector_, extractor_, objectsList.at(k)->id(), objectsList.at(k)->image(), cv::Mat(), cache.isEnabled()?&cache:0));
+			taskObjects.push_back(objectsList.at(k));
+			group.start(tasks.back());
+		}
+		else
+		{
+			emptyObjects.push_back(objectsList.at(k));
+			if(keepImagesInRAM_)
 			{
-				QVector<ExtractFeaturesThread*> threads;
-				for(int k=i; k<i+threadCounts && k<objectsList.size(); ++k)
-				{
-					if(!objectsList.at(k)->image().empty())
-					{
-						threads.push_back(new ExtractFeaturesThread(detector_, extractor_, objectsList.at(k)->id(), objectsList.at(k)->image()));
-						threads.back()->start();
-					}
-					else
-					{
-						objects_.value(objectsList.at(k)->id())->setData(std::vector<cv::KeyPoint>(), cv::Mat());
-						if(keepImagesInRAM_)
-						{
-							UERROR("Empty image detected for object %d!? No features can be detected.", objectsList.at(k)->id());
-
-						}
-						else
-						{
-							UWARN("Empty image detected for object %d! No features can be detected. Note that images are in not kept in RAM.", objectsList.at(k)->id());
-						}
-					}
-				}
-
-				for(int j=0; j<threads.size(); ++j)
-				{
-					threads[j]->wait();
-
-					int id = threads[j]->objectId();
+				UERROR("Empty image detected for object %d!? No features can be detected.", objectsList.at(k)->id());
 
-					objects_.value(id)->setData(threads[j]->keypoints(), threads[j]->descriptors());
-
-					if(!keepImagesInRAM_)
-					{
-						objects_.value(id)->removeImage();
-					}
-					delete threads[j];
-				}
 			}
-			UINFO("Features extraction from %d objects... done! (%d ms)", objectsList.size(), time.elapsed());
+			else
+			{
+				UWARN("Empty image detected for object %d! No features can be detected. Note that images are in not kept in RAM.", objectsList.at(k)->id());
+			}
 		}
 	}
-	else
+	group.wait();
+
+	// Objects may be used by detections running in other threads
+	QWriteLocker locker(&objectsLock_);
+	for(int j=0; j<emptyObjects.size(); ++j)
 	{
-		UINFO("No objects to update...");
+		emptyObjects[j]->setData(std::vector<cv::KeyPoint>(), cv::Mat());
 	}
+	for(int j=0; j<tasks.size(); ++j)
+	{
+		taskObjects[j]->setData(tasks[j]->keypoints(), tasks[j]->descriptors());
+
+		if(!keepImagesInRAM_)
+		{
+			taskObjects[j]->releaseImage();
+		}
+		delete tasks[j];
+	}
+	UINFO("Features extraction from %d objects... done! (%d ms)", objectsList.size(), time.elapsed());
 }
 
 void FindObject::clearVocabulary()
 {
 	objectsDescriptors_.clear();
 	dataRange_.clear();
+	vocabulary_->setParameters(*parametersSnapshot());
 	vocabulary_->clear();
 }
 
 void FindObject::updateVocabulary(const QList<int> & ids)
 {
-	int count = 0;
-	int dim = -1;
-	int type = -1;
+	QMutexLocker updateLocker(&updateMutex_);
+	threadPool_->setMaxThreadCount(parametersSnapshot()->General_threads);
 	QList<ObjSignature*> objectsList;
 	if(ids.size())
 	{
@@ -961,20 +2271,115 @@ void FindObject::updateVocabulary(const QList<int> & ids)
 				UERROR("Not found object %d!", ids[i]);
 			}
 		}
-		if(vocabulary_->size())
+	}
+	else
+	{
+		objectsList = objects_.values();
+	}
+	buildVocabulary(objectsList, ids.isEmpty());
+	updateCascade();
+}
+
+// "index:item0;item1;..." value with the item selected
+static QString selectItem(const QString & value, const QString & item)
+{
+	QStringList items = value.split(':').last().split(';');
+	int index = items.indexOf(item);
+	return index<0?value:QString("%1:%2").arg(index).arg(items.join(";"));
+}
+
+// Parameters of the first stage of the cascade (see General/cascade):
+// ORB features matched with the exact Hamming search, without tracking
+static ParametersMap cascadeParameters(const ParametersMap & parameters)
+{
+	ParametersMap cascadeParameters = parameters;
+	cascadeParameters.insert(Settings::kFeature2D_1Detector(), selectItem(parameters.value(Settings::kFeature2D_1Detector()).toString(), "ORB"));
+	cascadeParameters.insert(Settings::kFeature2D_2Descriptor(), selectItem(parameters.value(Settings::kFeature2D_2Descriptor()).toString(), "ORB"));
+	cascadeParameters.insert(Settings::kFeature2D_4Affine(), false);
+	cascadeParameters.insert(Settings::kNearestNeighbor_1Strategy(), selectItem(parameters.value(Settings::kNearestNeighbor_1Strategy()).toString(), "Hamming"));
+	cascadeParameters.insert(Settings::kNearestNeighbor_2Distance_type(), selectItem(parameters.value(Settings::kNearestNeighbor_2Distance_type()).toString(), "HAMMING"));
+	cascadeParameters.insert(Settings::kNearestNeighbor_7ConvertBinToFloat(), false);
+	cascadeParameters.insert(Settings::kGeneral_cascade(), false);
+	cascadeParameters.insert(Settings::kGeneral_coarseToFineScale(), 0.0f);
+	cascadeParameters.insert(Settings::kGeneral_roiTracking(), false);
+	// the scenes of the second stage may come from several streams or callers
+	cascadeParameters.insert(Settings::kGeneral_frameChangeThreshold(), 0.0f);
+	cascadeParameters.insert(Settings::kGeneral_frameChangeRefreshInterval(), 0);
+	cascadeParameters.insert(Settings::kGeneral_gpuPipeline(), false);
+	cascadeParameters.insert(Settings::kGeneral_vocabularyTreePath(), QString());
+	cascadeParameters.insert(Settings::kGeneral_sessionJournal(), false);
+	cascadeParameters.insert(Settings::kHomography_homographyComputed(), true);
+	cascadeParameters.insert(Settings::kHomography_opticalFlow(), false);
+	cascadeParameters.insert(Settings::kHomography_opticalFlowTracking(), false);
+	return cascadeParameters;
+}
+
+// Built again from the images of the objects, swapped in like the vocabulary
+void FindObject::updateCascade()
+{
+	FindObject * cascade = 0;
+	if(parametersSnapshot()->General_cascade && objects_.size())
+	{
+		QTime time;
+		time.start();
+		UINFO("Cascade: ORB features and vocabulary of %d objects...", objects_.size());
+		cascade = new FindObject(keepImagesInRAM_);
+		cascade->setParameters(cascadeParameters(this->parameters()));
+		cascade->updateDetectorExtractor();
+		for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
 		{
-			dim = vocabulary_->dim();
-			type = vocabulary_->type();
+			cv::Mat image = iter.value()->image();
+			if(!image.empty())
+			{
+				cascade->addObject(image, iter.key(), iter.value()->filePath());
+			}
 		}
+		cascade->updateObjects();
+		cascade->updateVocabulary();
+		UINFO("Cascade: ORB features and vocabulary of %d objects... done! (%d ms)", cascade->objects().size(), time.elapsed());
+	}
+
+	FindObject * previous = 0;
+	{
+		QWriteLocker locker(&objectsLock_);
+		previous = cascade_;
+		cascade_ = cascade;
+	}
+	delete previous;
+}
+
+void FindObject::buildVocabulary(const QList<ObjSignature*> & objectsList, bool clear, ObjSignature * addedObject, int removedObjectId)
+{
+	int count = 0;
+	int dim = -1;
+	int type = -1;
+
+	// Work on copies, detections keep using the current vocabulary until the new one is swapped in
+	QSharedPointer<const ParametersSnapshot> params = parametersSnapshot();
+	Vocabulary * vocabulary = new Vocabulary(*vocabulary_);
+	vocabulary->setParameters(*params);
+	QMap<int, cv::Mat> objectsDescriptors;
+	QMap<int, int> dataRange;
+	QMap<int, QMultiMap<int, int> > objectsWords;
+	QMap<int, cv::Mat> descriptorsViews; // <object id, its descriptors in a shared matrix>
+	if(clear)
+	{
+		vocabulary->clear();
 	}
 	else
 	{
-		clearVocabulary();
-		objectsList = objects_.values();
+		objectsDescriptors = objectsDescriptors_;
+		dataRange = dataRange_;
+		if(vocabulary->size())
+		{
+			dim = vocabulary->dim();
+			type = vocabulary->type();
+		}
 	}
 
 	// Get the total size and verify descriptors
-	for(int i=0; i<objectsList.size(); ++i)
+	bool valid = true;
+	for(int i=0; i<objectsList.size() && valid; ++i)
 	{
 		if(!objectsList.at(i)->descriptors().empty())
 		{
@@ -982,93 +2387,109 @@ void FindObject::updateVocabulary(const QList<int> & ids)
 			{
 				UERROR("Descriptors of the objects are not all the same size! Objects "
 						"opened must have all the same size (and from the same descriptor extractor).");
-				return;
+				valid = false;
 			}
-			dim = objectsList.at(i)->descriptors().cols;
-			if(type >= 0 && objectsList.at(i)->descriptors().type() != type)
+			else if(type >= 0 && objectsList.at(i)->descriptors().type() != type)
 			{
 				UERROR("Descriptors of the objects are not all the same type! Objects opened "
 						"must have been processed by the same descriptor extractor.");
-				return;
+				valid = false;
+			}
+			else
+			{
+				dim = objectsList.at(i)->descriptors().cols;
+				type = objectsList.at(i)->descriptors().type();
+				count += objectsList.at(i)->descriptors().rows;
 			}
-			type = objectsList.at(i)->descriptors().type();
-			count += objectsList.at(i)->descriptors().rows;
 		}
 	}
 
-	UINFO("Updating vocabulary with %d objects and %d descriptors...", ids.size(), count);
+	if(!valid)
+	{
+		if(!clear)
+		{
+			// the current vocabulary is left untouched
+			delete vocabulary;
+			delete addedObject;
+			return;
+		}
+		count = 0;
+	}
+
+	UINFO("Updating vocabulary with %d objects and %d descriptors...", clear?0:objectsList.size(), count);
 
 	// Copy data
 	if(count)
 	{
 		UINFO("Updating global descriptors matrix: Objects=%d, total descriptors=%d, dim=%d, type=%d",
 				(int)objects_.size(), count, dim, type);
-		if(!Settings::getGeneral_invertedSearch())
+		if(!params->General_invertedSearch)
 		{
-			if(Settings::getGeneral_threads() == 1)
+			if(params->General_threads == 1)
 			{
-				// If only one thread, put all descriptors in the same cv::Mat
+				// If only one thread, put all descriptors in the same cv::Mat,
+				// the objects then keep a view in it instead of their own copy
 				int row = 0;
-				bool vocabularyEmpty = objectsDescriptors_.size() == 0;
-				if(vocabularyEmpty)
+				cv::Mat descriptors;
+				if(objectsDescriptors.size() == 0)
 				{
-					UASSERT(objectsDescriptors_.size() == 0);
-					objectsDescriptors_.insert(0, cv::Mat(count, dim, type));
+					descriptors = cv::Mat(count, dim, type);
 				}
 				else
 				{
-					row = objectsDescriptors_.begin().value().rows;
+					// in a new matrix, detections may still use the current one
+					const cv::Mat & current = objectsDescriptors.begin().value();
+					UASSERT_MSG(current.cols == dim, uFormat("%d vs %d", current.cols, dim).c_str());
+					UASSERT(current.type() == type);
+					row = current.rows;
+					descriptors = cv::Mat(row+count, dim, type);
+					current.copyTo(descriptors.rowRange(0, row));
 				}
 				for(int i=0; i<objectsList.size(); ++i)
 				{
-					objectsList[i]->setWords(QMultiMap<int,int>());
+					objectsWords.insert(objectsList.at(i)->id(), QMultiMap<int,int>());
 					if(objectsList.at(i)->descriptors().rows)
 					{
-						if(vocabularyEmpty)
-						{
-							cv::Mat dest(objectsDescriptors_.begin().value(), cv::Range(row, row+objectsList.at(i)->descriptors().rows));
-							objectsList.at(i)->descriptors().copyTo(dest);
-						}
-						else
-						{
-							UASSERT_MSG(objectsDescriptors_.begin().value().cols == objectsList.at(i)->descriptors().cols,
-									uFormat("%d vs %d", objectsDescriptors_.begin().value().cols, objectsList.at(i)->descriptors().cols).c_str());
-							UASSERT(objectsDescriptors_.begin().value().type() == objectsList.at(i)->descriptors().type());
-							objectsDescriptors_.begin().value().push_back(objectsList.at(i)->descriptors());
-						}
+						cv::Mat dest = descriptors.rowRange(row, row+objectsList.at(i)->descriptors().rows);
+						objectsList.at(i)->descriptors().copyTo(dest);
 
 						row += objectsList.at(i)->descriptors().rows;
 						// dataRange contains the upper_bound for each
 						// object (the last descriptors position in the
 						// global object descriptors matrix)
-						if(objectsList.at(i)->descriptors().rows)
-						{
-							dataRange_.insert(row-1, objectsList.at(i)->id());
-						}
+						dataRange.insert(row-1, objectsList.at(i)->id());
 					}
 				}
+				objectsDescriptors.clear();
+				objectsDescriptors.insert(0, descriptors);
+
+				int firstRow = 0;
+				for(QMap<int, int>::iterator iter=dataRange.begin(); iter!=dataRange.end(); ++iter)
+				{
+					descriptorsViews.insert(iter.value(), descriptors.rowRange(firstRow, iter.key()+1));
+					firstRow = iter.key()+1;
+				}
 			}
 			else
 			{
 				for(int i=0; i<objectsList.size(); ++i)
 				{
-					objectsList[i]->setWords(QMultiMap<int,int>());
-					objectsDescriptors_.insert(objectsList.at(i)->id(), objectsList.at(i)->descriptors());
+					objectsWords.insert(objectsList.at(i)->id(), QMultiMap<int,int>());
+					objectsDescriptors.insert(objectsList.at(i)->id(), objectsList.at(i)->descriptors());
 				}
 			}
 		}
 		else
 		{
 			// Inverted index on (vocabulary)
-			sessionModified_ = true;
 			QTime time;
 			time.start();
-			bool incremental = Settings::getGeneral_vocabularyIncremental() && !Settings::getGeneral_vocabularyFixed();
+			bool incremental = params->General_vocabularyIncremental && !params->General_vocabularyFixed;
 			if(incremental)
 			{
 				UINFO("Creating incremental vocabulary...");
 			}
-			else if(Settings::getGeneral_vocabularyFixed())
+			else if(params->General_vocabularyFixed)
 			{
 				UINFO("Updating vocabulary correspondences only (vocabulary is fixed)...");
 			}
@@ -1078,18 +2499,18 @@ void FindObject::updateVocabulary(const QList<int> & ids)
 			}
 			QTime localTime;
 			localTime.start();
-			int updateVocabularyMinWords = Settings::getGeneral_vocabularyUpdateMinWords();
+			int updateVocabularyMinWords = params->General_vocabularyUpdateMinWords;
 			int addedWords = 0;
 			for(int i=0; i<objectsList.size(); ++i)
 			{
 				UASSERT(objectsList[i]->descriptors().rows == (int)objectsList[i]->keypoints().size());
-				QMultiMap<int, int> words = vocabulary_->addWords(objectsList[i]->descriptors(), objectsList.at(i)->id());
-				objectsList[i]->setWords(words);
+				QMultiMap<int, int> words = vocabulary->addWords(objectsList[i]->descriptors(), objectsList.at(i)->id());
+				objectsWords.insert(objectsList.at(i)->id(), words);
 				addedWords += words.uniqueKeys().size();
 				bool updated = false;
 				if(incremental && addedWords && addedWords >= updateVocabularyMinWords)
 				{
-					vocabulary_->update();
+					vocabulary->update();
 					addedWords = 0;
 					updated = true;
 				}
@@ -1097,39 +2518,118 @@ void FindObject::updateVocabulary(const QList<int> & ids)
 						objectsList[i]->id(),
 						words.uniqueKeys().size(),
 						objectsList[i]->descriptors().rows,
-						vocabulary_->size(),
+						vocabulary->size(),
 						localTime.restart(),
 						updated?"updated":"");
 			}
-			if(addedWords && !Settings::getGeneral_vocabularyFixed())
+			if(addedWords && !params->General_vocabularyFixed)
 			{
 				if(!incremental)
 				{
 					UINFO("Updating vocabulary...");
 				}
-				vocabulary_->update();
+				vocabulary->update();
+			}
+			// with a fixed vocabulary only the correspondences are updated
+			vocabulary->updatePostings();
+
+			// Objects whose descriptors are all words of the vocabulary (not incremental
+			// or all new words) keep a view in the words instead of their own copy
+			const cv::Mat & vocabularyWords = vocabulary->indexedDescriptors();
+			for(int i=0; i<objectsList.size(); ++i)
+			{
+				const cv::Mat & descriptors = objectsList.at(i)->descriptors();
+				QMap<int, QMultiMap<int, int> >::const_iterator wordsIter = objectsWords.constFind(objectsList.at(i)->id());
+				if(descriptors.rows == 0 ||
+				   wordsIter == objectsWords.constEnd() ||
+				   wordsIter.value().size() != descriptors.rows ||
+				   vocabularyWords.type() != descriptors.type() ||
+				   vocabularyWords.cols != descriptors.cols)
+				{
+					continue;
+				}
+				const QMultiMap<int, int> & words = wordsIter.value();
+				int firstWord = words.begin().key() - words.begin().value();
+				bool sameRows = firstWord >= 0 && firstWord + descriptors.rows <= vocabularyWords.rows;
+				for(QMultiMap<int, int>::const_iterator iter=words.begin(); sameRows && iter!=words.end(); ++iter)
+				{
+					sameRows = iter.key() - iter.value() == firstWord;
+				}
+				if(sameRows)
+				{
+					descriptorsViews.insert(objectsList.at(i)->id(), vocabularyWords.rowRange(firstWord, firstWord + descriptors.rows));
+				}
 			}
 
 			if(incremental)
 			{
-				UINFO("Creating incremental vocabulary... done! size=%d (%d ms)", vocabulary_->size(), time.elapsed());
+				UINFO("Creating incremental vocabulary... done! size=%d (%d ms)", vocabulary->size(), time.elapsed());
 			}
-			else if(Settings::getGeneral_vocabularyFixed())
+			else if(params->General_vocabularyFixed)
 			{
-				UINFO("Updating vocabulary correspondences only (vocabulary is fixed)... done! size=%d (%d ms)", vocabulary_->size(), time.elapsed());
+				UINFO("Updating vocabulary correspondences only (vocabulary is fixed)... done! size=%d (%d ms)", vocabulary->size(), time.elapsed());
 			}
 			else
 			{
-				UINFO("Creating vocabulary... done! size=%d (%d ms)", vocabulary_->size(), time.elapsed());
+				UINFO("Creating vocabulary... done! size=%d (%d ms)", vocabulary->size(), time.elapsed());
+			}
+		}
+	}
+
+	// Swap in the new vocabulary, only this part blocks the detections
+	Vocabulary * oldVocabulary = 0;
+	{
+		QWriteLocker locker(&objectsLock_);
+		if(removedObjectId && objects_.contains(removedObjectId))
+		{
+			delete objects_.value(removedObjectId);
+			objects_.remove(removedObjectId);
+		}
+		if(addedObject && !this->addObject(addedObject))
+		{
+			delete addedObject;
+		}
+		for(QMap<int, QMultiMap<int, int> >::iterator iter=objectsWords.begin(); iter!=objectsWords.end(); ++iter)
+		{
+			if(objects_.contains(iter.key()))
+			{
+				objects_.value(iter.key())->setWords(iter.value());
+			}
+		}
+		for(QMap<int, cv::Mat>::iterator iter=descriptorsViews.begin(); iter!=descriptorsViews.end(); ++iter)
+		{
+			if(objects_.contains(iter.key()))
+			{
+				objects_.value(iter.key())->setDescriptors(iter.value());
 			}
 		}
+		oldVocabulary = vocabulary_;
+		vocabulary_ = vocabulary;
+		lastFrameThumbnail_ = cv::Mat(); // detected again with the new objects
+		objectsDescriptors_ = objectsDescriptors;
+		dataRange_ = dataRange;
+		if(params->General_invertedSearch && count)
+		{
+			sessionModified_ = true;
+		}
 	}
+	delete oldVocabulary;
+
+	MemoryUsage memory = memoryUsage();
+	UINFO("Memory: %.1f MB (objects: images=%.1f keypoints=%.1f descriptors=%.1f words=%.1f, "
+			"descriptors matrix=%.1f, vocabulary: words=%.1f references=%.1f postings=%.1f index=%.1f, cascade=%.1f)",
+			memory.total()/1048576.0,
+			memory.objectImages/1048576.0, memory.objectKeypoints/1048576.0, memory.objectDescriptors/1048576.0, memory.objectWords/1048576.0,
+			memory.objectsDescriptors/1048576.0,
+			memory.vocabularyWords/1048576.0, memory.wordToObjects/1048576.0, memory.postings/1048576.0, memory.index/1048576.0,
+			memory.cascade/1048576.0);
 }
 
-class SearchThread: public QThread
+class SearchTask: public QRunnable
 {
 public:
-	SearchThread(Vocabulary * vocabulary, int objectId, const cv::Mat * descriptors, const QMultiMap<int, int> * sceneWords) :
+	SearchTask(const ParametersSnapshot * params, const Vocabulary * vocabulary, int objectId, const cv::Mat * descriptors, const QMultiMap<int, int> * sceneWords) :
+		params_(params),
 		vocabulary_(vocabulary),
 		objectId_(objectId),
 		descriptors_(descriptors),
@@ -1137,178 +2637,527 @@ public:
 		minMatchedDistance_(-1.0f),
 		maxMatchedDistance_(-1.0f)
 	{
-		UASSERT(descriptors);
+		UASSERT(params && descriptors);
 	}
-	virtual ~SearchThread() {}
+	virtual ~SearchTask() {}
 
 	int getObjectId() const {return objectId_;}
 	float getMinMatchedDistance() const {return minMatchedDistance_;}
 	float getMaxMatchedDistance() const {return maxMatchedDistance_;}
-	const QMultiMap<int, int> & getMatches() const {return matches_;}
+	// Matches <object descriptor index, scene descriptor index>
+	const std::vector<int> & getObjectIndexes() const {return objectIndexes_;}
+	const std::vector<int> & getSceneIndexes() const {return sceneIndexes_;}
+	// Quality of the matches, see Settings::isHomographyMethodOrdered()
+	const std::vector<float> & getQualities() const {return qualities_;}
 
-protected:
 	virtual void run()
 	{
+		FINDOBJECT_TRACE_SPAN_ID(traceSpan, "search", "matching", objectId_);
 		//QTime time;
 		//time.start();
 
-		cv::Mat results;
-		cv::Mat dists;
-
 		//match objects to scene
-		int k = Settings::getNearestNeighbor_3nndrRatioUsed()?2:1;
-		results = cv::Mat(descriptors_->rows, k, CV_32SC1); // results index
-		dists = cv::Mat(descriptors_->rows, k, CV_32FC1); // Distance results are CV_32FC1
-		vocabulary_->search(*descriptors_, results, dists, k);
+		std::vector<int> descriptorIndexes;
+		std::vector<int> wordIds;
+		std::vector<float> qualities;
+		bool ordered = Settings::isHomographyMethodOrdered(params_->Homography_method);
+		vocabulary_->searchMatches(*descriptors_, *params_, descriptorIndexes, wordIds, minMatchedDistance_, maxMatchedDistance_, ordered?&qualities:0);
 
 		// PROCESS RESULTS
 		// Get all matches for each object
-		for(int i=0; i<dists.rows; ++i)
+		objectIndexes_.reserve(descriptorIndexes.size());
+		sceneIndexes_.reserve(descriptorIndexes.size());
+		for(unsigned int i=0; i<descriptorIndexes.size(); ++i)
 		{
-			// Check if this descriptor matches with those of the objects
-			bool matched = false;
+			if(sceneWords_->count(wordIds[i]) == 1)
+			{
+				objectIndexes_.push_back(descriptorIndexes[i]);
+				sceneIndexes_.push_back(sceneWords_->value(wordIds[i]));
+				if(ordered)
+				{
+					qualities_.push_back(qualities[i]);
+				}
+			}
+		}
+
+		//UINFO("Search Object %d time=%d ms", objectIndex_, time.elapsed());
+	}
+private:
+	const ParametersSnapshot * params_;
+	const Vocabulary * vocabulary_;
+	int objectId_;
+	const cv::Mat * descriptors_;
+	const QMultiMap<int, int> * sceneWords_; // <word id, keypoint indexes>
+
+	float minMatchedDistance_;
+	float maxMatchedDistance_;
+	std::vector<int> objectIndexes_;
+	std::vector<int> sceneIndexes_;
+	std::vector<float> qualities_;
+};
+
+// The box, enlarged by margin (ratio of its size) on each side, is set in the mask
+static void addMaskRegion(cv::Mat & mask, QRectF box, float margin)
+{
+	float dx = box.width()*margin;
+	float dy = box.height()*margin;
+	box.adjust(-dx, -dy, dx, dy);
+	cv::Rect rect = cv::Rect(
+			int(std::floor(box.left())),
+			int(std::floor(box.top())),
+			int(std::ceil(box.width())),
+			int(std::ceil(box.height()))) & cv::Rect(0, 0, mask.cols, mask.rows);
+	if(rect.area())
+	{
+		mask(rect).setTo(cv::Scalar(255));
+	}
+}
+
+// Pyramid of the scene shared by the optical flow stages of a frame, built
+// on first use. The derivatives are only needed when the pyramid is kept as
+// the previous frame of the tracking (Homography/opticalFlowTracking).
+static void buildScenePyramid(const cv::Mat & image, std::vector<cv::Mat> & pyramid, const ParametersSnapshot & params)
+{
+	if(pyramid.empty())
+	{
+		cv::buildOpticalFlowPyramid(image,
+				pyramid,
+				cv::Size(params.Homography_opticalFlowWinSize, params.Homography_opticalFlowWinSize),
+				params.Homography_opticalFlowMaxLevel,
+				params.Homography_opticalFlowTracking);
+	}
+}
+
+// Hough voting of the matches for the rotation and scale change between
+// the object and the scene keypoints: bins of 30 degrees x 1 octave, each
+// match voting for the 2x2 nearest bins. Returns the votes of the best bin,
+// an upper bound of the inliers of a similarity, or -1 if the keypoints
+// have neither orientation nor size.
+static int consistentMatches(
+		const std::vector<cv::KeyPoint> & kptsA,
+		const std::vector<cv::KeyPoint> & kptsB,
+		const std::vector<int> & indexesA,
+		const std::vector<int> & indexesB)
+{
+	static const int kAngleBins = 12;
+	static const int kScaleBins = 16; // -8 to 8 octaves
+	bool useAngle = false;
+	bool useScale = false;
+	for(unsigned int j=0; j<indexesA.size() && !(useAngle && useScale); ++j)
+	{
+		const cv::KeyPoint & a = kptsA[indexesA[j]];
+		const cv::KeyPoint & b = kptsB[indexesB[j]];
+		useAngle = useAngle || (a.angle >= 0.0f && b.angle >= 0.0f);
+		useScale = useScale || (a.size > 0.0f && b.size > 0.0f);
+	}
+	if(!useAngle && !useScale)
+	{
+		return -1;
+	}
 
-			if(Settings::getNearestNeighbor_3nndrRatioUsed() &&
-			   dists.at<float>(i,0) <= Settings::getNearestNeighbor_4nndrRatio() * dists.at<float>(i,1))
+	std::vector<int> votes(kAngleBins*kScaleBins, 0);
+	int best = 0;
+	for(unsigned int j=0; j<indexesA.size(); ++j)
+	{
+		const cv::KeyPoint & a = kptsA[indexesA[j]];
+		const cv::KeyPoint & b = kptsB[indexesB[j]];
+		int angleBins[2] = {0, 0};
+		int scaleBins[2] = {0, 0};
+		int angles = 1;
+		int scales = 1;
+		if(useAngle && a.angle >= 0.0f && b.angle >= 0.0f)
+		{
+			float x = (b.angle - a.angle) / (360.0f/kAngleBins);
+			int b0 = (int)floor(x);
+			int b1 = x-b0<0.5f?b0-1:b0+1;
+			angleBins[0] = ((b0 % kAngleBins) + kAngleBins) % kAngleBins;
+			angleBins[1] = ((b1 % kAngleBins) + kAngleBins) % kAngleBins;
+			angles = 2;
+		}
+		if(useScale && a.size > 0.0f && b.size > 0.0f)
+		{
+			float x = log(b.size/a.size)/log(2.0f) + kScaleBins/2;
+			int b0 = (int)floor(x);
+			int b1 = x-b0<0.5f?b0-1:b0+1;
+			scaleBins[0] = std::max(0, std::min(kScaleBins-1, b0));
+			scaleBins[1] = std::max(0, std::min(kScaleBins-1, b1));
+			scales = scaleBins[0]!=scaleBins[1]?2:1;
+		}
+		for(int i=0; i<angles; ++i)
+		{
+			for(int k=0; k<scales; ++k)
 			{
-				matched = true;
+				int & v = votes[angleBins[i]*kScaleBins + scaleBins[k]];
+				best = std::max(best, ++v);
 			}
-			if((matched || !Settings::getNearestNeighbor_3nndrRatioUsed()) &&
-			   Settings::getNearestNeighbor_5minDistanceUsed())
+		}
+	}
+	return best;
+}
+
+struct ModeSupportGreater
+{
+	bool operator()(const std::pair<int, cv::Point2f> & a, const std::pair<int, cv::Point2f> & b) const {return a.first > b.first;}
+};
+
+// Matches of the instances of an object in the scene (see
+// General/multiDetectionClustering): each match predicts the center of the
+// object in the scene from its keypoints (translation, rotation and scale),
+// the predictions are clustered by mean-shift (flat kernel of the radius,
+// seeded on a grid of the radius). Returns the positions in indexesA/indexesB
+// of the matches of the clusters having at least minSize matches.
+static std::vector<std::vector<int> > clusterMatches(
+		const std::vector<cv::KeyPoint> & kptsA,
+		const std::vector<cv::KeyPoint> & kptsB,
+		const std::vector<int> & indexesA,
+		const std::vector<int> & indexesB,
+		const cv::Point2f & objectCenter,
+		float radius,
+		int minSize)
+{
+	UASSERT(radius > 0.0f);
+	std::vector<cv::Point2f> centers(indexesA.size());
+	std::map<std::pair<int, int>, std::vector<int> > cells; // predictions in grid cells of the radius
+	for(unsigned int j=0; j<indexesA.size(); ++j)
+	{
+		const cv::KeyPoint & a = kptsA[indexesA[j]];
+		const cv::KeyPoint & b = kptsB[indexesB[j]];
+		float scale = a.size>0.0f && b.size>0.0f?b.size/a.size:1.0f;
+		float angle = a.angle>=0.0f && b.angle>=0.0f?(b.angle-a.angle)*float(CV_PI/180.0):0.0f;
+		cv::Point2f v = objectCenter - a.pt;
+		float c = cos(angle)*scale;
+		float s = sin(angle)*scale;
+		centers[j] = b.pt + cv::Point2f(c*v.x - s*v.y, s*v.x + c*v.y);
+		cells[std::make_pair((int)floor(centers[j].x/radius), (int)floor(centers[j].y/radius))].push_back(j);
+	}
+
+	// mean-shift from the mean of each cell, neighbors are in the 3x3 cells around
+	float radius2 = radius*radius;
+	std::vector<std::pair<int, cv::Point2f> > modes; // <support, position>
+	for(std::map<std::pair<int, int>, std::vector<int> >::const_iterator iter=cells.begin(); iter!=cells.end(); ++iter)
+	{
+		cv::Point2f mode(0,0);
+		for(unsigned int i=0; i<iter->second.size(); ++i)
+		{
+			mode += centers[iter->second[i]];
+		}
+		mode *= 1.0f/iter->second.size();
+		int support = 0;
+		for(int it=0; it<20; ++it)
+		{
+			int cx = (int)floor(mode.x/radius);
+			int cy = (int)floor(mode.y/radius);
+			cv::Point2f sum(0,0);
+			support = 0;
+			for(int x=cx-1; x<=cx+1; ++x)
 			{
-				if(dists.at<float>(i,0) <= Settings::getNearestNeighbor_6minDistance())
-				{
-					matched = true;
-				}
-				else
+				for(int y=cy-1; y<=cy+1; ++y)
 				{
-					matched = false;
+					std::map<std::pair<int, int>, std::vector<int> >::const_iterator jter = cells.find(std::make_pair(x, y));
+					for(unsigned int i=0; jter!=cells.end() && i<jter->second.size(); ++i)
+					{
+						cv::Point2f d = centers[jter->second[i]] - mode;
+						if(d.dot(d) <= radius2)
+						{
+							sum += centers[jter->second[i]];
+							++support;
+						}
+					}
 				}
 			}
-			if(!matched && !Settings::getNearestNeighbor_3nndrRatioUsed() && !Settings::getNearestNeighbor_5minDistanceUsed())
+			if(support == 0)
 			{
-				matched = true; // no criterion, match to the nearest descriptor
+				break;
 			}
-			if(minMatchedDistance_ == -1 || minMatchedDistance_ > dists.at<float>(i,0))
+			cv::Point2f next = sum * (1.0f/support);
+			cv::Point2f shift = next - mode;
+			mode = next;
+			if(shift.dot(shift) < 0.25f)
 			{
-				minMatchedDistance_ = dists.at<float>(i,0);
-			}
-			if(maxMatchedDistance_ == -1 || maxMatchedDistance_ < dists.at<float>(i,0))
-			{
-				maxMatchedDistance_ = dists.at<float>(i,0);
+				break;
 			}
+		}
+		if(support >= minSize)
+		{
+			modes.push_back(std::make_pair(support, mode));
+		}
+	}
+
+	// the strongest modes are kept, the others in their radius are merged
+	std::vector<cv::Point2f> kept;
+	std::stable_sort(modes.begin(), modes.end(), ModeSupportGreater());
+	for(unsigned int i=0; i<modes.size(); ++i)
+	{
+		bool merged = false;
+		for(unsigned int k=0; k<kept.size() && !merged; ++k)
+		{
+			cv::Point2f d = modes[i].second - kept[k];
+			merged = d.dot(d) <= radius2;
+		}
+		if(!merged)
+		{
+			kept.push_back(modes[i].second);
+		}
+	}
 
-			int wordId = results.at<int>(i,0);
-			if(matched && sceneWords_->count(wordId) == 1)
+	// matches go to the nearest mode in the radius
+	std::vector<std::vector<int> > clusters(kept.size());
+	for(unsigned int j=0; j<centers.size(); ++j)
+	{
+		int nearest = -1;
+		float nearestDistance = radius2;
+		for(unsigned int k=0; k<kept.size(); ++k)
+		{
+			cv::Point2f d = centers[j] - kept[k];
+			if(d.dot(d) <= nearestDistance)
 			{
-				matches_.insert(i, sceneWords_->value(wordId));
-				matches_.insert(i, results.at<int>(i,0));
+				nearestDistance = d.dot(d);
+				nearest = k;
 			}
 		}
+		if(nearest >= 0)
+		{
+			clusters[nearest].push_back(j);
+		}
+	}
+	std::vector<std::vector<int> > result;
+	for(unsigned int k=0; k<clusters.size(); ++k)
+	{
+		if((int)clusters[k].size() >= minSize)
+		{
+			result.push_back(clusters[k]);
+		}
+	}
+	return result;
+}
 
-		//UINFO("Search Object %d time=%d ms", objectIndex_, time.elapsed());
+// Corners (top-left, top-right, bottom-right, bottom-left) of rect mapped by
+// the homography H (3x3 CV_64FC1, scene point = H * object point). Returns
+// false if the corners are not all on the same side of the line mapped to
+// infinity, the projected quadrilateral is then not valid.
+static bool mapCorners(const cv::Mat & H, const QRectF & rect, QPointF corners[4])
+{
+	UASSERT(H.cols == 3 && H.rows == 3 && H.type()==CV_64FC1 && H.isContinuous());
+	const double * h = H.ptr<double>(0);
+	const double xs[4] = {rect.left(), rect.right(), rect.right(), rect.left()};
+	const double ys[4] = {rect.top(), rect.top(), rect.bottom(), rect.bottom()};
+	double ws[4];
+	for(int i=0; i<4; ++i)
+	{
+		ws[i] = h[6]*xs[i] + h[7]*ys[i] + h[8];
+		if(ws[i] == 0.0 || (ws[i] > 0.0) != (ws[0] > 0.0))
+		{
+			return false;
+		}
 	}
-private:
-	Vocabulary * vocabulary_; // would be const but flann search() method is not const!?
-	int objectId_;
-	const cv::Mat * descriptors_;
-	const QMultiMap<int, int> * sceneWords_; // <word id, keypoint indexes>
+	for(int i=0; i<4; ++i)
+	{
+		corners[i] = QPointF((h[0]*xs[i] + h[1]*ys[i] + h[2])/ws[i], (h[3]*xs[i] + h[4]*ys[i] + h[5])/ws[i]);
+	}
+	return true;
+}
+
+// Angle in degrees [0,180] between the directions b-a and c-b
+static float cornerAngle(const QPointF & a, const QPointF & b, const QPointF & c)
+{
+	double x1 = b.x()-a.x(), y1 = b.y()-a.y();
+	double x2 = c.x()-b.x(), y2 = c.y()-b.y();
+	double norms = sqrt((x1*x1 + y1*y1) * (x2*x2 + y2*y2));
+	if(norms == 0.0)
+	{
+		return 0.0f;
+	}
+	double cosine = std::max(-1.0, std::min(1.0, (x1*x2 + y1*y2) / norms));
+	return float(acos(cosine) * 180.0 / CV_PI);
+}
 
-	float minMatchedDistance_;
-	float maxMatchedDistance_;
-	QMultiMap<int, int> matches_;
+// Matched points of the homography tasks, reused by each thread of the
+// pool from one object to the next (and from one frame to the next)
+struct HomographyBuffers
+{
+	std::vector<cv::Point2f> mpts_1;
+	std::vector<cv::Point2f> mpts_2;
+	std::vector<unsigned char> status;
+	std::vector<float> err;
 };
+static QThreadStorage<HomographyBuffers*> homographyBuffers;
 
-class HomographyThread: public QThread
+class HomographyTask: public QRunnable
 {
 public:
-	HomographyThread(
-			const QMultiMap<int, int> * matches, // <object, scene>
+	HomographyTask(
+			const ParametersSnapshot * params,
+			const std::vector<int> & indexesA, // matches <object, scene>
+			const std::vector<int> & indexesB,
 			int objectId,
 			const std::vector<cv::KeyPoint> * kptsA,
 			const std::vector<cv::KeyPoint> * kptsB,
-			const cv::Mat & imageA,   // image only required if opticalFlow is on
-			const cv::Mat & imageB) : // image only required if opticalFlow is on
-				matches_(matches),
+			const ObjSignature * objectA,              // only required if opticalFlow is on
+			const std::vector<cv::Mat> * pyramidB, // only required if opticalFlow is on, 0 without scene image
+			const std::vector<float> & qualities = std::vector<float>()) : // of the matches (lower is better), see Settings::isHomographyMethodOrdered()
+				params_(params),
 				objectId_(objectId),
 				kptsA_(kptsA),
 				kptsB_(kptsB),
-				imageA_(imageA),
-				imageB_(imageB),
-				code_(DetectionInfo::kRejectedUndef)
+				objectA_(objectA),
+				pyramidB_(pyramidB),
+				code_(DetectionInfo::kRejectedUndef),
+				timeGeometryCheck_(0.0f),
+				timeHomography_(0.0f),
+				guessMaxError_(0.0f),
+				indexesA_(indexesA),
+				indexesB_(indexesB),
+				qualities_(qualities)
 	{
-		UASSERT(matches && kptsA && kptsB);
+		UASSERT(params && kptsA && kptsB);
+		UASSERT(indexesA.size() == indexesB.size());
+		UASSERT(qualities.empty() || qualities.size() == indexesA.size());
 	}
-	virtual ~HomographyThread() {}
+	virtual ~HomographyTask() {}
 
 	int getObjectId() const {return objectId_;}
 	const std::vector<int> & getIndexesA() const {return indexesA_;}
 	const std::vector<int> & getIndexesB() const {return indexesB_;}
 	const std::vector<uchar> & getOutlierMask() const {return outlierMask_;}
-	QMultiMap<int, int> getInliers() const {return inliers_;}
-	QMultiMap<int, int> getOutliers() const {return outliers_;}
+	const std::vector<int> & getInliersA() const {return inliersA_;}
+	const std::vector<int> & getInliersB() const {return inliersB_;}
+	const std::vector<int> & getOutliersA() const {return outliersA_;}
+	const std::vector<int> & getOutliersB() const {return outliersB_;}
 	const cv::Mat & getHomography() const {return h_;}
 	DetectionInfo::RejectedCode rejectedCode() const {return code_;}
+	float timeGeometryCheck() const {return timeGeometryCheck_;} // ms
+	float timeHomography() const {return timeHomography_;} // ms, of the whole task
+
+	// Homography (3x3 CV_64FC1) found beforehand, the matches mapped farther
+	// than maxError pixels from it are outliers, see General/coarseToFineScale
+	void setGuess(const cv::Mat & H, float maxError)
+	{
+		UASSERT(H.cols == 3 && H.rows == 3 && H.type()==CV_64FC1 && H.isContinuous());
+		guess_ = H;
+		guessMaxError_ = maxError;
+	}
 
-protected:
 	virtual void run()
 	{
-		//QTime time;
-		//time.start();
+		FINDOBJECT_TRACE_SPAN_ID(traceSpan, "homography", "homography", objectId_);
+		int64 start = cv::getTickCount();
 
-		std::vector<cv::Point2f> mpts_1(matches_->size());
-		std::vector<cv::Point2f> mpts_2(matches_->size());
-		indexesA_.resize(matches_->size());
-		indexesB_.resize(matches_->size());
+		if(qualities_.size() && Settings::isHomographyMethodOrdered(params_->Homography_method))
+		{
+			// best matches first, the outliers stay in this order for the next detection
+			std::vector<std::pair<float, int> > order(qualities_.size());
+			for(unsigned int j=0; j<qualities_.size(); ++j)
+			{
+				order[j] = std::make_pair(qualities_[j], j);
+			}
+			std::sort(order.begin(), order.end());
+			std::vector<int> indexesA(indexesA_.size());
+			std::vector<int> indexesB(indexesB_.size());
+			for(unsigned int j=0; j<order.size(); ++j)
+			{
+				indexesA[j] = indexesA_[order[j].second];
+				indexesB[j] = indexesB_[order[j].second];
+			}
+			indexesA_.swap(indexesA);
+			indexesB_.swap(indexesB);
+		}
 
-		UDEBUG("Fill matches...");
-		int j=0;
-		for(QMultiMap<int, int>::const_iterator iter = matches_->begin(); iter!=matches_->end(); ++iter)
+		if(!homographyBuffers.hasLocalData())
 		{
-			UASSERT_MSG(iter.key() < (int)kptsA_->size(), uFormat("key=%d size=%d", iter.key(),(int)kptsA_->size()).c_str());
-			UASSERT_MSG(iter.value() < (int)kptsB_->size(), uFormat("key=%d size=%d", iter.value(),(int)kptsB_->size()).c_str());
-			mpts_1[j] = kptsA_->at(iter.key()).pt;
-			indexesA_[j] = iter.key();
-			mpts_2[j] = kptsB_->at(iter.value()).pt;
-			indexesB_[j] = iter.value();
-			++j;
+			homographyBuffers.setLocalData(new HomographyBuffers());
 		}
+		HomographyBuffers & buffers = *homographyBuffers.localData();
+		std::vector<cv::Point2f> & mpts_1 = buffers.mpts_1;
+		std::vector<cv::Point2f> & mpts_2 = buffers.mpts_2;
+		mpts_1.resize(indexesA_.size());
+		mpts_2.resize(indexesB_.size());
 
-		if((int)mpts_1.size() >= Settings::getHomography_minimumInliers())
+		UDEBUG("Fill matches...");
+		const double * g = guess_.empty()?0:guess_.ptr<double>();
+		double maxErrorSqr = double(guessMaxError_)*double(guessMaxError_);
+		unsigned int kept = 0;
+		for(unsigned int j=0; j<indexesA_.size(); ++j)
 		{
-			if(Settings::getHomography_opticalFlow())
+			UASSERT_MSG(indexesA_[j] < (int)kptsA_->size(), uFormat("key=%d size=%d", indexesA_[j],(int)kptsA_->size()).c_str());
+			UASSERT_MSG(indexesB_[j] < (int)kptsB_->size(), uFormat("key=%d size=%d", indexesB_[j],(int)kptsB_->size()).c_str());
+			const cv::Point2f & ptA = kptsA_->at(indexesA_[j]).pt;
+			const cv::Point2f & ptB = kptsB_->at(indexesB_[j]).pt;
+			if(g)
 			{
-				UASSERT(!imageA_.empty() && !imageB_.empty());
-
-				cv::Mat imageA = imageA_;
-				cv::Mat imageB = imageB_;
-				if(imageA_.cols < imageB_.cols && imageA_.rows < imageB_.rows)
+				// far from the guess (or mapped behind the camera), outlier
+				double w = g[6]*ptA.x + g[7]*ptA.y + g[8];
+				double dx = w>0?(g[0]*ptA.x + g[1]*ptA.y + g[2])/w - ptB.x:0.0;
+				double dy = w>0?(g[3]*ptA.x + g[4]*ptA.y + g[5])/w - ptB.y:0.0;
+				if(w <= 0 || dx*dx + dy*dy > maxErrorSqr)
 				{
-					// padding, optical flow wants images of the same size
-					imageA = cv::Mat::zeros(imageB_.size(), imageA_.type());
-					imageA_.copyTo(imageA(cv::Rect(0,0,imageA_.cols, imageA_.rows)));
+					outliersA_.push_back(indexesA_[j]);
+					outliersB_.push_back(indexesB_[j]);
+					continue;
 				}
-				if(imageA.size() == imageB.size())
+			}
+			mpts_1[kept] = ptA;
+			mpts_2[kept] = ptB;
+			indexesA_[kept] = indexesA_[j];
+			indexesB_[kept] = indexesB_[j];
+			++kept;
+		}
+		if(kept < indexesA_.size())
+		{
+			UDEBUG("Object %d: %d/%d matches close to the guess", objectId_, (int)kept, (int)indexesA_.size());
+			mpts_1.resize(kept);
+			mpts_2.resize(kept);
+			indexesA_.resize(kept);
+			indexesB_.resize(kept);
+		}
+
+		if((int)mpts_1.size() >= params_->Homography_minimumInliers && params_->Homography_preCheck)
+		{
+			int64 startCheck = cv::getTickCount();
+			int consistent = consistentMatches(*kptsA_, *kptsB_, indexesA_, indexesB_);
+			timeGeometryCheck_ = float(cv::getTickCount() - startCheck) * 1000.0f / float(cv::getTickFrequency());
+			if(consistent >= 0 && consistent < params_->Homography_minimumInliers)
+			{
+				UDEBUG("Object %d: %d/%d matches consistent, homography not computed", objectId_, consistent, (int)mpts_1.size());
+				outliersA_.insert(outliersA_.end(), indexesA_.begin(), indexesA_.end());
+				outliersB_.insert(outliersB_.end(), indexesB_.begin(), indexesB_.end());
+				code_ = DetectionInfo::kRejectedInconsistent;
+				timeHomography_ = float(cv::getTickCount() - start) * 1000.0f / float(cv::getTickFrequency());
+				return;
+			}
+		}
+
+		if((int)mpts_1.size() >= params_->Homography_minimumInliers)
+		{
+			if(params_->Homography_opticalFlow && pyramidB_)
+			{
+				UASSERT(objectA_ && pyramidB_->size());
+
+				// the object's pyramid is computed once per scene resolution
+				std::vector<cv::Mat> pyramidA = objectA_->opticalFlowPyramid(
+						pyramidB_->at(0).size(),
+						params_->Homography_opticalFlowWinSize,
+						params_->Homography_opticalFlowMaxLevel);
+				if(pyramidA.size())
 				{
 					UDEBUG("Optical flow...");
 					//refine matches
-					std::vector<unsigned char> status;
-					std::vector<float> err;
+					std::vector<unsigned char> & status = buffers.status;
+					std::vector<float> & err = buffers.err;
 					cv::calcOpticalFlowPyrLK(
-							imageA,
-							imageB_,
+							pyramidA,
+							*pyramidB_,
 							mpts_1,
 							mpts_2,
 							status,
 							err,
-							cv::Size(Settings::getHomography_opticalFlowWinSize(), Settings::getHomography_opticalFlowWinSize()),
-							Settings::getHomography_opticalFlowMaxLevel(),
-							cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, Settings::getHomography_opticalFlowIterations(), Settings::getHomography_opticalFlowEps()),
+							cv::Size(params_->Homography_opticalFlowWinSize, params_->Homography_opticalFlowWinSize),
+							params_->Homography_opticalFlowMaxLevel,
+							cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, params_->Homography_opticalFlowIterations, params_->Homography_opticalFlowEps),
 							cv::OPTFLOW_LK_GET_MIN_EIGENVALS | cv::OPTFLOW_USE_INITIAL_FLOW, 1e-4);
 				}
 				else
 				{
-					UERROR("Object's image should be less/equal size of the scene image to use Optical Flow.");
+					UERROR("Object's image should be kept in RAM and less/equal size of the scene image to use Optical Flow.");
 				}
 			}
 
@@ -1316,36 +3165,43 @@ protected:
 #if CV_MAJOR_VERSION < 3
 			h_ = findHomography(mpts_1,
 					mpts_2,
-					Settings::getHomographyMethod(),
-					Settings::getHomography_ransacReprojThr(),
+					Settings::getHomographyMethod(params_->Homography_method),
+					params_->Homography_ransacReprojThr,
 					outlierMask_);
 #else
 			h_ = findHomography(mpts_1,
 					mpts_2,
-					Settings::getHomographyMethod(),
-					Settings::getHomography_ransacReprojThr(),
+					Settings::getHomographyMethod(params_->Homography_method),
+					params_->Homography_ransacReprojThr,
 					outlierMask_,
-					Settings::getHomography_maxIterations(),
-					Settings::getHomography_confidence());
+					params_->Homography_maxIterations,
+					params_->Homography_confidence);
 #endif
 			UDEBUG("Find homography... end");
 
 			UASSERT(outlierMask_.size() == 0 || outlierMask_.size() == mpts_1.size());
+			int inliers = outlierMask_.size()?cv::countNonZero(outlierMask_):0;
+			inliersA_.reserve(inliers);
+			inliersB_.reserve(inliers);
+			outliersA_.reserve(outliersA_.size()+mpts_1.size()-inliers);
+			outliersB_.reserve(outliersB_.size()+mpts_1.size()-inliers);
 			for(unsigned int k=0; k<mpts_1.size();++k)
 			{
 				if(outlierMask_.size() && outlierMask_.at(k))
 				{
-					inliers_.insert(indexesA_[k], indexesB_[k]);
+					inliersA_.push_back(indexesA_[k]);
+					inliersB_.push_back(indexesB_[k]);
 				}
 				else
 				{
-					outliers_.insert(indexesA_[k], indexesB_[k]);
+					outliersA_.push_back(indexesA_[k]);
+					outliersB_.push_back(indexesB_[k]);
 				}
 			}
 
-			if(inliers_.size() == (int)outlierMask_.size() && !h_.empty())
+			if(inliersA_.size() == outlierMask_.size() && !h_.empty())
 			{
-				if(Settings::getHomography_ignoreWhenAllInliers() || cv::countNonZero(h_) < 1)
+				if(params_->Homography_ignoreWhenAllInliers || cv::countNonZero(h_) < 1)
 				{
 					// ignore homography when all features are inliers
 					h_ = cv::Mat();
@@ -1358,22 +3214,29 @@ protected:
 			code_ = DetectionInfo::kRejectedLowMatches;
 		}
 
-		//UINFO("Homography Object %d time=%d ms", objectIndex_, time.elapsed());
+		timeHomography_ = float(cv::getTickCount() - start) * 1000.0f / float(cv::getTickFrequency());
 	}
 private:
-	const QMultiMap<int, int> * matches_;
+	const ParametersSnapshot * params_;
 	int objectId_;
 	const std::vector<cv::KeyPoint> * kptsA_;
 	const std::vector<cv::KeyPoint> * kptsB_;
-	cv::Mat imageA_;
-	cv::Mat imageB_;
+	const ObjSignature * objectA_;
+	const std::vector<cv::Mat> * pyramidB_;
 	DetectionInfo::RejectedCode code_;
+	float timeGeometryCheck_;
+	float timeHomography_;
+	cv::Mat guess_;
+	float guessMaxError_;
 
 	std::vector<int> indexesA_;
 	std::vector<int> indexesB_;
+	std::vector<float> qualities_;
 	std::vector<uchar> outlierMask_;
-	QMultiMap<int, int> inliers_;
-	QMultiMap<int, int> outliers_;
+	std::vector<int> inliersA_;
+	std::vector<int> inliersB_;
+	std::vector<int> outliersA_;
+	std::vector<int> outliersB_;
 	cv::Mat h_;
 };
 
@@ -1398,21 +3261,358 @@ void FindObject::detect(const cv::Mat & image)
 				(int)info.objDetected_.begin().key(),
 				time.elapsed());
 	}
-	else if(Settings::getGeneral_sendNoObjDetectedEvents())
+	else if(parametersSnapshot()->General_sendNoObjDetectedEvents)
 	{
 		UINFO("(%s) No objects detected. (%d ms)",
 				QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str(),
 				time.elapsed());
 	}
 
-	if(info.objDetected_.size() > 0 || Settings::getGeneral_sendNoObjDetectedEvents())
+	if(info.objDetected_.size() > 0 || parametersSnapshot()->General_sendNoObjDetectedEvents)
 	{
+		info.release(DetectionInfo::kAllFields & ~objectsFoundFields_);
 		Q_EMIT objectsFound(info);
 	}
 }
 
 bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info) const
 {
+	// objects and vocabulary are not swapped while detecting
+	QReadLocker objectsLocker(&objectsLock_);
+
+	// parameters read in the loops below, kept even if they are changed while detecting
+	QSharedPointer<const ParametersSnapshot> snapshot = parametersSnapshot();
+	if(snapshot->General_frameChangeThreshold <= 0.0f || image.empty())
+	{
+		return detect(image, info, *snapshot, 0);
+	}
+
+	// Scene not changed since the last frame detected, its detection is reused
+	QTime time;
+	time.start();
+	cv::Mat thumbnail = frameThumbnail(image);
+	{
+		QMutexLocker locker(&lastFrameMutex_);
+		if(!lastFrameThumbnail_.empty() &&
+		   lastFrameThumbnail_.size() == thumbnail.size() &&
+		   (snapshot->General_frameChangeRefreshInterval <= 0 || framesReused_ < snapshot->General_frameChangeRefreshInterval) &&
+		   cv::norm(lastFrameThumbnail_, thumbnail, cv::NORM_L1)/double(thumbnail.total()) <= snapshot->General_frameChangeThreshold)
+		{
+			++framesReused_;
+			info = lastFrameInfo_;
+			info.reused_ = true;
+			info.timeStamps_.clear();
+			info.timeStamps_.insert(DetectionInfo::kTimeTotal, time.elapsed());
+			return lastFrameSuccess_;
+		}
+	}
+
+	bool success = detect(image, info, *snapshot, 0);
+
+	QMutexLocker locker(&lastFrameMutex_);
+	lastFrameThumbnail_ = thumbnail;
+	lastFrameInfo_ = info; // shared, not copied
+	lastFrameSuccess_ = success;
+	framesReused_ = 0;
+	return success;
+}
+
+// Grayscale image downscaled to 64 pixels wide, compared between frames
+// to know if the scene changed, see General/frameChangeThreshold
+cv::Mat FindObject::frameThumbnail(const cv::Mat & image) const
+{
+	cv::Mat grayscaleImg;
+	if(image.channels() != 1 || image.depth() != CV_8U)
+	{
+		cv::cvtColor(image, grayscaleImg, cv::COLOR_BGR2GRAY);
+	}
+	else
+	{
+		grayscaleImg = image;
+	}
+	int width = std::min(64, grayscaleImg.cols);
+	int height = std::max(1, (grayscaleImg.rows*width + grayscaleImg.cols/2)/grayscaleImg.cols);
+	cv::Mat thumbnail;
+	cv::resize(grayscaleImg, thumbnail, cv::Size(width, height), 0, 0, cv::INTER_AREA);
+	return thumbnail;
+}
+
+// Reads a byte per page, the pages of mapped files are loaded
+static unsigned char touchPages(const cv::Mat & data)
+{
+	unsigned char sum = 0;
+	if(!data.empty() && data.isContinuous())
+	{
+		size_t size = data.total()*data.elemSize();
+		for(size_t i=0; i<size; i+=4096)
+		{
+			sum ^= data.data[i];
+		}
+	}
+	return sum;
+}
+
+void FindObject::warmUp(int iterations)
+{
+	QTime time;
+	time.start();
+	std::vector<cv::Mat> scenes;
+	volatile unsigned char touched = 0; // not optimized away
+	{
+		QReadLocker objectsLocker(&objectsLock_);
+		for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+		{
+			touched ^= touchPages(iter.value()->descriptors());
+			if(scenes.size() < 4 && iter.value()->hasImage())
+			{
+				cv::Mat image = iter.value()->image();
+				if(!image.empty())
+				{
+					scenes.push_back(image);
+				}
+			}
+		}
+		for(QMap<int, cv::Mat>::const_iterator iter=objectsDescriptors_.constBegin(); iter!=objectsDescriptors_.constEnd(); ++iter)
+		{
+			touched ^= touchPages(iter.value());
+		}
+		touched ^= touchPages(vocabulary_->indexedDescriptors());
+	}
+	if(scenes.empty())
+	{
+		// features are detected on a blurred noise
+		cv::Mat texture(480, 640, CV_8UC1);
+		cv::randu(texture, cv::Scalar(0), cv::Scalar(256));
+		cv::GaussianBlur(texture, texture, cv::Size(5, 5), 1.5);
+		scenes.push_back(texture);
+	}
+
+	DetectionInfo info;
+	for(int i=0; i<iterations; ++i)
+	{
+		for(unsigned int j=0; j<scenes.size(); ++j)
+		{
+			detectUntracked(scenes[j], info);
+		}
+	}
+	resetObjectCosts();
+	UINFO("Warm-up: %d detections done in %d ms", iterations*(int)scenes.size(), time.elapsed());
+}
+
+// Matches, homographies and outcome of each object searched in a scene
+void FindObject::addObjectCosts(const DetectionInfo & info, const QMap<int, ObjectCost> & homographyCosts) const
+{
+	QMutexLocker locker(&objectCostsMutex_);
+	++objectCostsScenes_;
+	for(int g=0; g<info.matches_.groups(); ++g)
+	{
+		ObjectCost & cost = objectCosts_[info.matches_.id(g)];
+		++cost.matched;
+		cost.matches += info.matches_.groupSize(g);
+	}
+	for(QMap<int, ObjectCost>::const_iterator iter=homographyCosts.constBegin(); iter!=homographyCosts.constEnd(); ++iter)
+	{
+		ObjectCost & cost = objectCosts_[iter.key()];
+		cost.homographies += iter.value().homographies;
+		cost.homographyTime += iter.value().homographyTime;
+	}
+	int previousId = -1;
+	for(QMultiMap<int, int>::const_iterator iter=info.objDetectedInliersCount_.constBegin(); iter!=info.objDetectedInliersCount_.constEnd(); ++iter)
+	{
+		ObjectCost & cost = objectCosts_[iter.key()];
+		if(iter.key() != previousId)
+		{
+			++cost.detected; // once per scene with General/multiDetection
+			previousId = iter.key();
+		}
+		cost.inliers += iter.value();
+	}
+	for(QMultiMap<int, DetectionInfo::RejectedCode>::const_iterator iter=info.rejectedCodes_.constBegin(); iter!=info.rejectedCodes_.constEnd(); ++iter)
+	{
+		++objectCosts_[iter.key()].rejections[iter.value()];
+	}
+}
+
+QMap<int, ObjectCost> FindObject::objectCosts(qint64 * scenes) const
+{
+	QMap<int, ObjectCost> costs;
+	{
+		QMutexLocker locker(&objectCostsMutex_);
+		costs = objectCosts_;
+		if(scenes)
+		{
+			*scenes = objectCostsScenes_;
+		}
+	}
+
+	// only the objects loaded
+	QReadLocker objectsLocker(&objectsLock_);
+	QMap<int, ObjectCost> loaded;
+	for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+	{
+		ObjectCost & cost = loaded[iter.key()];
+		cost = costs.value(iter.key());
+		cost.features = (int)iter.value()->keypoints().size();
+		cost.words = iter.value()->words().uniqueKeys().size();
+	}
+	return loaded;
+}
+
+void FindObject::resetObjectCosts()
+{
+	QMutexLocker locker(&objectCostsMutex_);
+	objectCosts_.clear();
+	objectCostsScenes_ = 0;
+}
+
+QString FindObject::objectCostsReport() const
+{
+	qint64 scenes = 0;
+	QMap<int, ObjectCost> costs = objectCosts(&scenes);
+	std::vector<std::pair<double, int> > order; // <homography time, id>
+	order.reserve(costs.size());
+	for(QMap<int, ObjectCost>::const_iterator iter=costs.constBegin(); iter!=costs.constEnd(); ++iter)
+	{
+		order.push_back(std::make_pair(iter.value().homographyTime, iter.key()));
+	}
+	std::sort(order.begin(), order.end(), std::greater<std::pair<double, int> >());
+
+	QStringList lines;
+	lines.append(QString("# %1 scenes").arg(scenes));
+	lines.append("id,file,features,words,matched,matches,homographies,homography_ms,detected,detection_rate,inliers,rejections");
+	QReadLocker objectsLocker(&objectsLock_);
+	for(unsigned int i=0; i<order.size(); ++i)
+	{
+		int id = order[i].second;
+		const ObjectCost & cost = costs[id];
+		QStringList rejections;
+		for(QMap<int, qint64>::const_iterator iter=cost.rejections.constBegin(); iter!=cost.rejections.constEnd(); ++iter)
+		{
+			rejections.append(QString("%1:%2").arg(DetectionMetrics::rejectedCodeName((DetectionInfo::RejectedCode)iter.key())).arg(iter.value()));
+		}
+		lines.append(QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12")
+				.arg(id)
+				.arg(objects_.contains(id)?QFileInfo(objects_.value(id)->filePath()).fileName():QString())
+				.arg(cost.features)
+				.arg(cost.words)
+				.arg(cost.matched)
+				.arg(cost.matches)
+				.arg(cost.homographies)
+				.arg(cost.homographyTime, 0, 'f', 3)
+				.arg(cost.detected)
+				.arg(scenes?double(cost.detected)/double(scenes):0.0, 0, 'f', 4)
+				.arg(cost.inliers)
+				.arg(rejections.join(" ")));
+	}
+	return lines.join("\n") + "\n";
+}
+
+// Descriptors viewing a matrix of the map (see buildVocabulary())
+static bool isViewOf(const cv::Mat & descriptors, const QMap<int, cv::Mat> & matrices)
+{
+	for(QMap<int, cv::Mat>::const_iterator iter=matrices.constBegin(); iter!=matrices.constEnd(); ++iter)
+	{
+		if(descriptors.data >= iter.value().datastart && descriptors.data < iter.value().dataend)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+MemoryUsage FindObject::memoryUsage() const
+{
+	// QMap nodes: parent (with the color), left and right pointers, key and value
+	const qint64 kMapNodeBytes = 3*sizeof(void*) + 2*sizeof(int);
+
+	MemoryUsage usage;
+	QReadLocker objectsLocker(&objectsLock_);
+	for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+	{
+		const ObjSignature * obj = iter.value();
+		usage.objectImages += obj->imageBytes();
+		usage.objectKeypoints += obj->keypoints().size()*sizeof(cv::KeyPoint);
+		if(!isViewOf(obj->descriptors(), objectsDescriptors_))
+		{
+			usage.objectDescriptors += obj->descriptors().total()*obj->descriptors().elemSize();
+		}
+		usage.objectWords += obj->words().size()*kMapNodeBytes;
+	}
+	for(QMap<int, cv::Mat>::const_iterator iter=objectsDescriptors_.constBegin(); iter!=objectsDescriptors_.constEnd(); ++iter)
+	{
+		usage.objectsDescriptors += iter.value().total()*iter.value().elemSize();
+	}
+	usage.imageCache = ObjectImageCache::instance().bytes();
+	Vocabulary::MemoryUsage vocabularyUsage = vocabulary_->memoryUsage();
+	usage.vocabularyWords = vocabularyUsage.words;
+	usage.wordToObjects = vocabularyUsage.wordToObjects;
+	usage.postings = vocabularyUsage.postings;
+	usage.index = vocabularyUsage.index;
+	if(cascade_)
+	{
+		// the image cache is shared
+		MemoryUsage cascadeUsage = cascade_->memoryUsage();
+		usage.cascade = cascadeUsage.total() - cascadeUsage.imageCache;
+	}
+	return usage;
+}
+
+QString FindObject::memoryUsageReport() const
+{
+	MemoryUsage usage = memoryUsage();
+	QStringList lines;
+	lines.append("component,bytes");
+	lines.append(QString("object_images,%1").arg(usage.objectImages));
+	lines.append(QString("object_keypoints,%1").arg(usage.objectKeypoints));
+	lines.append(QString("object_descriptors,%1").arg(usage.objectDescriptors));
+	lines.append(QString("object_words,%1").arg(usage.objectWords));
+	lines.append(QString("objects_descriptors,%1").arg(usage.objectsDescriptors));
+	lines.append(QString("image_cache,%1").arg(usage.imageCache));
+	lines.append(QString("vocabulary_words,%1").arg(usage.vocabularyWords));
+	lines.append(QString("word_to_objects,%1").arg(usage.wordToObjects));
+	lines.append(QString("postings,%1").arg(usage.postings));
+	lines.append(QString("index,%1").arg(usage.index));
+	lines.append(QString("cascade,%1").arg(usage.cascade));
+	lines.append(QString("total,%1").arg(usage.total()));
+	return lines.join("\n") + "\n";
+}
+
+// General/memoryBudget, checked before adding objects
+bool FindObject::memoryBudgetExceeded() const
+{
+	int budget = parametersSnapshot()->General_memoryBudget;
+	if(budget > 0)
+	{
+		qint64 used = memoryUsage().total();
+		if(used >= qint64(budget)*1024*1024)
+		{
+			UERROR("Memory budget exceeded (%d MB used, General/memoryBudget=%d MB), objects are not added!",
+					int(used/(1024*1024)), budget);
+			return true;
+		}
+	}
+	return false;
+}
+
+// Matches of detect(), reused by each detecting thread from one frame to
+// the next: their capacity is kept, a frame like the previous one is
+// matched without allocating them again
+struct DetectionBuffers
+{
+	std::vector<int> descriptorIndexes;
+	std::vector<int> wordIds;
+	std::vector<float> qualities;
+	std::vector<float> sceneQualities;
+	std::vector<int> matchGroups;
+	std::vector<int> matchObjectIndexes;
+	std::vector<int> matchSceneIndexes;
+};
+static QThreadStorage<DetectionBuffers*> detectionBuffers;
+
+// With features, they are not extracted and the scene is not tracked
+bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info, const ParametersSnapshot & params, const SceneFeatures * features) const
+{
+	FINDOBJECT_TRACE_SPAN(traceFrame, "detect", "frame");
 	QTime totalTime;
 	totalTime.start();
 
@@ -1420,11 +3620,14 @@ bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info
 	info = DetectionInfo();
 
 	bool success = false;
-	if(!image.empty())
+	if(!image.empty() || features)
 	{
+		// Without image (features only), the optical flow is not used
+		cv::Size sceneSize = image.empty()?features->imageSize:cv::Size(image.cols, image.rows);
+
 		//Convert to grayscale
 		cv::Mat grayscaleImg;
-		if(image.channels() != 1 || image.depth() != CV_8U)
+		if(!image.empty() && (image.channels() != 1 || image.depth() != CV_8U))
 		{
 			cv::cvtColor(image, grayscaleImg, cv::COLOR_BGR2GRAY);
 		}
@@ -1433,33 +3636,227 @@ bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info
 			grayscaleImg =  image;
 		}
 
+		// Pyramid of the scene for the optical flow, built once for the
+		// tracking and the homography tasks (Homography/opticalFlow)
+		std::vector<cv::Mat> scenePyramid;
+
+		// Objects tracked with optical flow, no features extracted
+		if(!features &&
+		   !grayscaleImg.empty() &&
+		   params.Homography_opticalFlowTracking &&
+		   params.Homography_homographyComputed &&
+		   trackWithOpticalFlow(grayscaleImg, scenePyramid, info, params))
+		{
+			if(params.General_roiTracking)
+			{
+				updateTracks(info, false, params);
+			}
+			info.timeStamps_.insert(DetectionInfo::kTimeTotal, totalTime.elapsed());
+			return true;
+		}
+
+		// Only in the regions of the tracked objects, see General/roiTracking
+		cv::Mat sceneMask;
+		if(!features && params.General_roiTracking && !params.Feature2D_4Affine)
+		{
+			sceneMask = trackingMask(cv::Size(grayscaleImg.cols, grayscaleImg.rows), params);
+		}
+		bool fullFrame = sceneMask.empty();
+
+		// Objects found first on the downscaled scene, then only their
+		// regions are processed at full resolution, see General/coarseToFineScale
+		float coarseScale = params.General_coarseToFineScale;
+		QMap<int, cv::Mat> guesses; // <object id, homography on the downscaled scene mapped to the scene>
+		if(!features &&
+		   !grayscaleImg.empty() &&
+		   sceneMask.empty() &&
+		   !params.Feature2D_4Affine &&
+		   coarseScale > 0.0f && coarseScale < 1.0f)
+		{
+			FINDOBJECT_TRACE_SPAN(traceCoarse, "coarse", "stage");
+			ParametersSnapshot coarseParams = params;
+			coarseParams.General_coarseToFineScale = 0.0f;
+			// tracks are updated with the detections at full resolution
+			coarseParams.General_roiTracking = false;
+			coarseParams.Homography_opticalFlowTracking = false;
+			coarseParams.Homography_opticalFlow = false;
+			cv::Mat coarseImg;
+			cv::resize(grayscaleImg, coarseImg, cv::Size(), coarseScale, coarseScale, cv::INTER_AREA);
+			DetectionInfo coarseInfo;
+			bool coarseSuccess = detect(coarseImg, coarseInfo, coarseParams, 0);
+			FINDOBJECT_TRACE_END(traceCoarse);
+
+			QTransform toScene = QTransform::fromScale(1.0/coarseScale, 1.0/coarseScale);
+			if(coarseInfo.objDetected_.empty())
+			{
+				// No candidates, the full resolution pass is skipped:
+				// the scene keypoints are mapped to the scene
+				UDEBUG("No objects found on the downscaled scene (%dx%d)", coarseImg.cols, coarseImg.rows);
+				info = coarseInfo;
+				std::vector<cv::KeyPoint> & keypoints = info.sceneKeypoints_.data();
+				for(unsigned int i=0; i<keypoints.size(); ++i)
+				{
+					keypoints[i].pt *= 1.0f/coarseScale;
+					keypoints[i].size /= coarseScale;
+				}
+				if(params.General_roiTracking && coarseSuccess)
+				{
+					updateTracks(info, true, params);
+				}
+				if(params.Homography_opticalFlowTracking && params.Homography_homographyComputed)
+				{
+					updateFlowTracks(grayscaleImg, scenePyramid, info, params);
+				}
+				info.timeStamps_.insert(DetectionInfo::kTimeTotal, totalTime.elapsed());
+				return coarseSuccess;
+			}
+
+			sceneMask = cv::Mat::zeros(grayscaleImg.rows, grayscaleImg.cols, CV_8UC1);
+			for(QMultiMap<int, QTransform>::const_iterator iter=coarseInfo.objDetected_.constBegin(); iter!=coarseInfo.objDetected_.constEnd(); ++iter)
+			{
+				QTransform hTransform = iter.value() * toScene;
+				addMaskRegion(sceneMask, hTransform.mapRect(QRectF(QPointF(0,0), QSizeF(coarseInfo.objDetectedSizes_.value(iter.key())))), params.General_coarseToFineMargin);
+				// a single instance is expected per object
+				if(!params.General_multiDetection)
+				{
+					cv::Mat H = (cv::Mat_<double>(3,3) <<
+							hTransform.m11(), hTransform.m21(), hTransform.m31(),
+							hTransform.m12(), hTransform.m22(), hTransform.m32(),
+							hTransform.m13(), hTransform.m23(), hTransform.m33());
+					guesses.insert(iter.key(), H);
+				}
+			}
+			UDEBUG("%d objects found on the downscaled scene (%dx%d)", (int)coarseInfo.objDetected_.size(), coarseImg.cols, coarseImg.rows);
+		}
+
+		// Objects shortlisted with the ORB features of the first stage, then
+		// the features are extracted only in their regions and matched only
+		// with them, see General/cascade
+		bool cascaded = false;
+		QSet<int> shortlist;
+		if(cascade_ &&
+		   params.General_cascade &&
+		   !features &&
+		   !grayscaleImg.empty() &&
+		   sceneMask.empty() &&
+		   !params.Feature2D_4Affine)
+		{
+			FINDOBJECT_TRACE_SPAN(traceCascade, "cascade", "stage");
+			DetectionInfo cascadeInfo;
+			cascade_->detectUntracked(grayscaleImg, cascadeInfo); // not reused from a previous frame
+			FINDOBJECT_TRACE_END(traceCascade);
+			cascaded = true;
+
+			// objects without ORB features are always candidates, on the whole scene
+			bool wholeScene = false;
+			for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+			{
+				const ObjSignature * cascadeObject = cascade_->objects().value(iter.key(), 0);
+				if(cascadeObject == 0 || cascadeObject->keypoints().empty())
+				{
+					shortlist.insert(iter.key());
+					wholeScene = true;
+				}
+			}
+			if(cascadeInfo.objDetected_.empty() && shortlist.empty())
+			{
+				// No candidates, the second stage is skipped
+				UDEBUG("No objects found by the first stage of the cascade");
+				for(QMap<int, ObjSignature*>::const_iterator iter=objects_.constBegin(); iter!=objects_.constEnd(); ++iter)
+				{
+					info.rejectedInliers_.addGroup(iter.key());
+					info.rejectedOutliers_.addGroup(iter.key());
+					info.rejectedCodes_.insert(iter.key(), DetectionInfo::kRejectedCascade);
+				}
+				if(params.General_roiTracking)
+				{
+					updateTracks(info, true, params);
+				}
+				if(params.Homography_opticalFlowTracking && params.Homography_homographyComputed)
+				{
+					updateFlowTracks(grayscaleImg, scenePyramid, info, params);
+				}
+				info.timeStamps_.insert(DetectionInfo::kTimeTotal, totalTime.elapsed());
+				return true;
+			}
+
+			if(!wholeScene)
+			{
+				sceneMask = cv::Mat::zeros(grayscaleImg.rows, grayscaleImg.cols, CV_8UC1);
+			}
+			for(QMultiMap<int, QTransform>::const_iterator iter=cascadeInfo.objDetected_.constBegin(); iter!=cascadeInfo.objDetected_.constEnd(); ++iter)
+			{
+				shortlist.insert(iter.key());
+				if(!wholeScene)
+				{
+					addMaskRegion(sceneMask, iter.value().mapRect(QRectF(QPointF(0,0), QSizeF(cascadeInfo.objDetectedSizes_.value(iter.key())))), params.General_cascadeMargin);
+				}
+			}
+			UDEBUG("%d objects shortlisted by the first stage of the cascade", shortlist.size());
+		}
+
 		// DETECT FEATURES AND EXTRACT DESCRIPTORS
 		UDEBUG("DETECT FEATURES AND EXTRACT DESCRIPTORS FROM THE SCENE");
-		ExtractFeaturesThread extractThread(detector_, extractor_, -1, grayscaleImg);
-		extractThread.start();
-		extractThread.wait();
-		info.sceneKeypoints_ = extractThread.keypoints();
-		info.sceneDescriptors_ = extractThread.descriptors();
-		UASSERT_MSG((int)extractThread.keypoints().size() == extractThread.descriptors().rows, uFormat("%d vs %d", (int)extractThread.keypoints().size(), extractThread.descriptors().rows).c_str());
-		info.timeStamps_.insert(DetectionInfo::kTimeKeypointDetection, extractThread.timeDetection());
-		info.timeStamps_.insert(DetectionInfo::kTimeDescriptorExtraction, extractThread.timeExtraction());
-		info.timeStamps_.insert(DetectionInfo::kTimeSubPixelRefining, extractThread.timeSubPix());
-		info.timeStamps_.insert(DetectionInfo::kTimeSkewAffine, extractThread.timeSkewAffine());
-
-		bool consistentNNData = (vocabulary_->size()!=0 && vocabulary_->wordToObjects().begin().value()!=-1 && Settings::getGeneral_invertedSearch()) ||
-								((vocabulary_->size()==0 || vocabulary_->wordToObjects().begin().value()==-1) && !Settings::getGeneral_invertedSearch());
-
-		bool descriptorsValid = !Settings::getGeneral_invertedSearch() &&
+		// With General/gpuPipeline, the descriptors stay on the GPU for the matching
+		GpuMat sceneDescriptorsGpu;
+		bool gpuPipeline = !features &&
+						   params.General_gpuPipeline &&
+						   params.General_invertedSearch &&
+						   !params.Feature2D_4Affine &&
+						   params.Feature2D_tiles <= 1 &&
+						   !params.Feature2D_6SubPix &&
+						   params.Feature2D_3MaxFeatures <= 0 &&
+						   Settings::currentDetectorType(params) == Settings::currentDescriptorType(params);
+		if(gpuPipeline)
+		{
+			QTime timeStep;
+			timeStep.start();
+			gpuPipeline = detector_->detectAndComputeGpu(grayscaleImg, info.sceneKeypoints_.data(), sceneDescriptorsGpu, sceneMask);
+			if(gpuPipeline)
+			{
+				UASSERT_MSG((int)info.sceneKeypoints_.size() == sceneDescriptorsGpu.rows, uFormat("%d vs %d", (int)info.sceneKeypoints_.size(), sceneDescriptorsGpu.rows).c_str());
+				info.timeStamps_.insert(DetectionInfo::kTimeKeypointDetection, timeStep.elapsed());
+				info.timeStamps_.insert(DetectionInfo::kTimeDescriptorExtraction, 0);
+				info.timeStamps_.insert(DetectionInfo::kTimeSubPixelRefining, 0);
+				info.timeStamps_.insert(DetectionInfo::kTimeSkewAffine, 0);
+			}
+		}
+		if(features)
+		{
+			info.sceneKeypoints_ = features->keypoints;
+			info.sceneDescriptors_ = features->descriptors;
+			info.timeStamps_ = features->timeStamps;
+		}
+		else if(!gpuPipeline)
+		{
+			// Executed in the caller's thread, ASIFT views are dispatched on the pool
+			ExtractFeaturesTask extractTask(&params, threadPool_, detector_, extractor_, -1, grayscaleImg, sceneMask);
+			extractTask.run();
+			info.sceneKeypoints_ = extractTask.keypoints();
+			info.sceneDescriptors_ = extractTask.descriptors();
+			UASSERT_MSG((int)extractTask.keypoints().size() == extractTask.descriptors().rows, uFormat("%d vs %d", (int)extractTask.keypoints().size(), extractTask.descriptors().rows).c_str());
+			info.timeStamps_.insert(DetectionInfo::kTimeKeypointDetection, extractTask.timeDetection());
+			info.timeStamps_.insert(DetectionInfo::kTimeDescriptorExtraction, extractTask.timeExtraction());
+			info.timeStamps_.insert(DetectionInfo::kTimeSubPixelRefining, extractTask.timeSubPix());
+			info.timeStamps_.insert(DetectionInfo::kTimeSkewAffine, extractTask.timeSkewAffine());
+		}
+		int sceneDescriptorsDim = gpuPipeline?sceneDescriptorsGpu.cols:info.sceneDescriptors_.cols;
+		int sceneDescriptorsType = gpuPipeline?sceneDescriptorsGpu.type():info.sceneDescriptors_.type();
+
+		bool consistentNNData = (vocabulary_->size()!=0 && vocabulary_->wordToObjects().begin().value()!=-1 && params.General_invertedSearch) ||
+								((vocabulary_->size()==0 || vocabulary_->wordToObjects().begin().value()==-1) && !params.General_invertedSearch);
+
+		bool descriptorsValid = !params.General_invertedSearch &&
 								!objectsDescriptors_.empty() &&
 								objectsDescriptors_.begin().value().cols == info.sceneDescriptors_.cols &&
 								objectsDescriptors_.begin().value().type() == info.sceneDescriptors_.type();
 
-		bool vocabularyValid = Settings::getGeneral_invertedSearch() &&
+		bool vocabularyValid = params.General_invertedSearch &&
 								vocabulary_->size() &&
-								!vocabulary_->indexedDescriptors().empty() &&
-								vocabulary_->indexedDescriptors().cols == info.sceneDescriptors_.cols &&
-								(vocabulary_->indexedDescriptors().type() == info.sceneDescriptors_.type() ||
-										(Settings::getNearestNeighbor_7ConvertBinToFloat() && vocabulary_->indexedDescriptors().type() == CV_32FC1));
+								vocabulary_->indexedSize() &&
+								vocabulary_->dim() == sceneDescriptorsDim &&
+								(vocabulary_->type() == sceneDescriptorsType ||
+										(params.NearestNeighbor_7ConvertBinToFloat && vocabulary_->type() == CV_32FC1));
 
 		// COMPARE
 		UDEBUG("COMPARE");
@@ -1470,334 +3867,514 @@ bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info
 			success = true;
 			QTime time;
 			time.start();
+			FINDOBJECT_TRACE_SPAN(traceMatching, "matching", "stage");
 
 			QMultiMap<int, int> words;
 
-			if(!Settings::getGeneral_invertedSearch())
+			// Index of the scene (not inverted search). It is owned by this
+			// call so that the shared vocabulary is never modified while
+			// detecting, detect() can then be called from multiple threads.
+			Vocabulary sceneVocabulary(params);
+
+			if(!params.General_invertedSearch)
 			{
-				vocabulary_->clear();
 				// CREATE INDEX for the scene
 				UDEBUG("CREATE INDEX FOR THE SCENE");
-				words = vocabulary_->addWords(info.sceneDescriptors_, -1);
-				vocabulary_->update();
+				words = sceneVocabulary.addWords(info.sceneDescriptors_, -1);
+				sceneVocabulary.update();
 				info.timeStamps_.insert(DetectionInfo::kTimeIndexing, time.restart());
 				info.sceneWords_ = words;
 			}
 
+			// A group per object, sorted by ID
+			info.matches_.reserve(objects_.size(), 0);
+			QHash<int, int> objectGroups; // <object id, group>
 			for(QMap<int, ObjSignature*>::const_iterator iter=objects_.begin(); iter!=objects_.end(); ++iter)
 			{
-				info.matches_.insert(iter.key(), QMultiMap<int, int>());
+				objectGroups.insert(iter.key(), info.matches_.groups());
+				info.matches_.addGroup(iter.key());
+			}
+			// TF-IDF score of each object (inverted search), see Homography/candidatesTopK
+			bool scored = params.General_invertedSearch && params.Homography_homographyComputed && params.Homography_candidatesTopK > 0;
+			std::vector<float> scores(scored?info.matches_.groups():0, 0.0f);
+			// match quality for the homography methods sampling the best matches first,
+			// by scene keypoint (inverted search) or by object descriptor
+			bool ordered = params.Homography_homographyComputed && Settings::isHomographyMethodOrdered(params.Homography_method);
+			if(!detectionBuffers.hasLocalData())
+			{
+				detectionBuffers.setLocalData(new DetectionBuffers());
 			}
+			DetectionBuffers & buffers = *detectionBuffers.localData();
+			std::vector<float> & sceneQualities = buffers.sceneQualities;
+			sceneQualities.clear();
+			QMap<int, std::vector<float> > objectQualities;
 
-			if(Settings::getGeneral_invertedSearch() || Settings::getGeneral_threads() == 1)
+			if(params.General_invertedSearch || params.General_threads == 1)
 			{
-				cv::Mat results;
-				cv::Mat dists;
 				// DO NEAREST NEIGHBOR
 				UDEBUG("DO NEAREST NEIGHBOR");
-				int k = Settings::getNearestNeighbor_3nndrRatioUsed()?2:1;
-				if(!Settings::getGeneral_invertedSearch())
+				// accepted matches <descriptor index, word id>, cleared by searchMatches()
+				std::vector<int> & descriptorIndexes = buffers.descriptorIndexes;
+				std::vector<int> & wordIds = buffers.wordIds;
+				std::vector<float> & qualities = buffers.qualities;
+				descriptorIndexes.clear();
+				wordIds.clear();
+				qualities.clear();
+				if(!params.General_invertedSearch)
 				{
 					//match objects to scene
-					results = cv::Mat(objectsDescriptors_.begin().value().rows, k, CV_32SC1); // results index
-					dists = cv::Mat(objectsDescriptors_.begin().value().rows, k, CV_32FC1); // Distance results are CV_32FC1
-					vocabulary_->search(objectsDescriptors_.begin().value(), results, dists, k);
+					sceneVocabulary.searchMatches(objectsDescriptors_.begin().value(), params, descriptorIndexes, wordIds, info.minMatchedDistance_, info.maxMatchedDistance_, ordered?&qualities:0);
 				}
 				else
 				{
 					//match scene to objects
-					results = cv::Mat(info.sceneDescriptors_.rows, k, CV_32SC1); // results index
-					dists = cv::Mat(info.sceneDescriptors_.rows, k, CV_32FC1); // Distance results are CV_32FC1
-					vocabulary_->search(info.sceneDescriptors_, results, dists, k);
-				}
-
-				// PROCESS RESULTS
-				UDEBUG("PROCESS RESULTS");
-				// Get all matches for each object
-				for(int i=0; i<dists.rows; ++i)
-				{
-					// Check if this descriptor matches with those of the objects
-					bool matched = false;
-
-					if(Settings::getNearestNeighbor_3nndrRatioUsed() &&
-					   dists.at<float>(i,0) <= Settings::getNearestNeighbor_4nndrRatio() * dists.at<float>(i,1))
+					int k = Vocabulary::matchK(params);
+					cv::Mat results;
+					cv::Mat dists;
+					if(features && features->results.rows == (int)info.sceneKeypoints_.size() && features->results.cols == k)
 					{
-						matched = true;
+						// searched with the other images of the batch
+						results = features->results;
+						dists = features->dists;
 					}
-					if((matched || !Settings::getNearestNeighbor_3nndrRatioUsed()) &&
-					   Settings::getNearestNeighbor_5minDistanceUsed())
+					else if(gpuPipeline && vocabulary_->searchGpu(sceneDescriptorsGpu, results, dists, k))
 					{
-						if(dists.at<float>(i,0) <= Settings::getNearestNeighbor_6minDistance())
-						{
-							matched = true;
-						}
-						else
-						{
-							matched = false;
-						}
+						// searched on the GPU
 					}
-					if(!matched &&
-					   !Settings::getNearestNeighbor_3nndrRatioUsed() &&
-					   !Settings::getNearestNeighbor_5minDistanceUsed() &&
-					   dists.at<float>(i,0) >= 0.0f)
+					else
 					{
-						matched = true; // no criterion, match to the nearest descriptor
+						if(gpuPipeline)
+						{
+							// words not on the GPU (or converted to float), search on the host
+							sceneDescriptorsGpu.download(info.sceneDescriptors_);
+						}
+						vocabulary_->searchMatches(info.sceneDescriptors_, params, descriptorIndexes, wordIds, info.minMatchedDistance_, info.maxMatchedDistance_, ordered?&qualities:0);
 					}
-					if(info.minMatchedDistance_ == -1 || info.minMatchedDistance_ > dists.at<float>(i,0))
+					if(!results.empty())
 					{
-						info.minMatchedDistance_ = dists.at<float>(i,0);
+						Vocabulary::filterMatches(results, dists, params, descriptorIndexes, wordIds, info.minMatchedDistance_, info.maxMatchedDistance_, ordered?&qualities:0);
 					}
-					if(info.maxMatchedDistance_ == -1 || info.maxMatchedDistance_ < dists.at<float>(i,0))
+					if(ordered)
 					{
-						info.maxMatchedDistance_ = dists.at<float>(i,0);
+						sceneQualities.resize(info.sceneKeypoints_.size(), std::numeric_limits<float>::max());
+						for(unsigned int m=0; m<descriptorIndexes.size(); ++m)
+						{
+							sceneQualities[descriptorIndexes[m]] = qualities[m];
+						}
 					}
+				}
 
-					if(matched)
+				// PROCESS RESULTS
+				UDEBUG("PROCESS RESULTS");
+				// Get all matches for each object, they are grouped
+				// by object afterwards
+				std::vector<int> & matchGroups = buffers.matchGroups;
+				std::vector<int> & matchObjectIndexes = buffers.matchObjectIndexes;
+				std::vector<int> & matchSceneIndexes = buffers.matchSceneIndexes;
+				matchGroups.clear();
+				matchObjectIndexes.clear();
+				matchSceneIndexes.clear();
+				matchGroups.reserve(descriptorIndexes.size());
+				matchObjectIndexes.reserve(descriptorIndexes.size());
+				matchSceneIndexes.reserve(descriptorIndexes.size());
+				for(unsigned int m=0; m<descriptorIndexes.size(); ++m)
+				{
+					int i = descriptorIndexes[m];
+					int wordId = wordIds[m];
+					if(params.General_invertedSearch)
 					{
-						int wordId = results.at<int>(i,0);
-						if(Settings::getGeneral_invertedSearch())
+						info.sceneWords_.insertMulti(wordId, i);
+						const Vocabulary::Posting * postings = vocabulary_->postings(wordId);
+						int postingsCount = vocabulary_->postingsCount(wordId);
+						for(int j=0; j<postingsCount; ++j)
 						{
-							info.sceneWords_.insertMulti(wordId, i);
-							QList<int> objIds = vocabulary_->wordToObjects().values(wordId);
-							for(int j=0; j<objIds.size(); ++j)
+							if(cascaded && !shortlist.contains(postings[j].objectId))
 							{
-								// just add unique matches
-								if(vocabulary_->wordToObjects().count(wordId, objIds[j]) == 1)
-								{
-									info.matches_.find(objIds[j]).value().insert(objects_.value(objIds[j])->words().value(wordId), i);
-								}
+								continue;
+							}
+							if(scored)
+							{
+								scores[objectGroups.value(postings[j].objectId)] += postings[j].weight;
+							}
+							// just add unique matches
+							if(postings[j].descriptorIndex >= 0)
+							{
+								matchGroups.push_back(objectGroups.value(postings[j].objectId));
+								matchObjectIndexes.push_back(postings[j].descriptorIndex);
+								matchSceneIndexes.push_back(i);
 							}
 						}
-						else
-						{
-							QMap<int, int>::const_iterator iter = dataRange_.lowerBound(i);
-							int objectId = iter.value();
-							int fisrtObjectDescriptorIndex = (iter == dataRange_.begin())?0:(--iter).key()+1;
-							int objectDescriptorIndex = i - fisrtObjectDescriptorIndex;
+					}
+					else
+					{
+						QMap<int, int>::const_iterator iter = dataRange_.lowerBound(i);
+						int objectId = iter.value();
+						int fisrtObjectDescriptorIndex = (iter == dataRange_.begin())?0:(--iter).key()+1;
+						int objectDescriptorIndex = i - fisrtObjectDescriptorIndex;
 
-							if(words.count(wordId) == 1)
+						if(words.count(wordId) == 1 && (!cascaded || shortlist.contains(objectId)))
+						{
+							matchGroups.push_back(objectGroups.value(objectId));
+							matchObjectIndexes.push_back(objectDescriptorIndex);
+							matchSceneIndexes.push_back(words.value(wordId));
+							if(ordered)
 							{
-								info.matches_.find(objectId).value().insert(objectDescriptorIndex, words.value(wordId));
+								std::vector<float> & objectQuality = objectQualities[objectId];
+								if(objectQuality.empty())
+								{
+									objectQuality.resize(objects_.value(objectId)->keypoints().size(), std::numeric_limits<float>::max());
+								}
+								objectQuality[objectDescriptorIndex] = qualities[m];
 							}
 						}
 					}
 				}
+				info.matches_.assign(matchGroups, matchObjectIndexes, matchSceneIndexes);
 			}
 			else
 			{
-				//multi-threaded, match objects to scene
-				UDEBUG("MULTI-THREADED, MATCH OBJECTS TO SCENE");
-				int threadCounts = Settings::getGeneral_threads();
-				if(threadCounts == 0)
-				{
-					threadCounts = (int)objectsDescriptors_.size();
-				}
-
+				//multi-threaded, match objects to scene
+				UDEBUG("MULTI-THREADED, MATCH OBJECTS TO SCENE");
 				QList<int> objectsDescriptorsId = objectsDescriptors_.keys();
 				QList<cv::Mat> objectsDescriptorsMat = objectsDescriptors_.values();
-				for(int j=0; j<objectsDescriptorsMat.size(); j+=threadCounts)
+				TaskGroup group(threadPool_);
+				QVector<SearchTask*> tasks;
+				tasks.reserve(objectsDescriptorsMat.size());
+				for(int k=0; k<objectsDescriptorsMat.size(); ++k)
 				{
-					QVector<SearchThread*> threads;
-
-					for(int k=j; k<j+threadCounts && k<objectsDescriptorsMat.size(); ++k)
+					if(!cascaded || shortlist.contains(objectsDescriptorsId[k]))
 					{
-						threads.push_back(new SearchThread(vocabulary_, objectsDescriptorsId[k], &objectsDescriptorsMat[k], &words));
-						threads.back()->start();
+						tasks.push_back(new SearchTask(&params, &sceneVocabulary, objectsDescriptorsId[k], &objectsDescriptorsMat[k], &words));
+						group.start(tasks.back());
 					}
+				}
+				group.wait();
 
-					for(int k=0; k<threads.size(); ++k)
+				std::vector<int> matchGroups;
+				std::vector<int> matchObjectIndexes;
+				std::vector<int> matchSceneIndexes;
+				for(int k=0; k<tasks.size(); ++k)
+				{
+					const std::vector<int> & objectIndexes = tasks[k]->getObjectIndexes();
+					matchGroups.resize(matchGroups.size() + objectIndexes.size(), objectGroups.value(tasks[k]->getObjectId()));
+					matchObjectIndexes.insert(matchObjectIndexes.end(), objectIndexes.begin(), objectIndexes.end());
+					matchSceneIndexes.insert(matchSceneIndexes.end(), tasks[k]->getSceneIndexes().begin(), tasks[k]->getSceneIndexes().end());
+					if(ordered && tasks[k]->getQualities().size() == objectIndexes.size())
 					{
-						threads[k]->wait();
-						info.matches_[threads[k]->getObjectId()] = threads[k]->getMatches();
-
-						if(info.minMatchedDistance_ == -1 || info.minMatchedDistance_ > threads[k]->getMinMatchedDistance())
-						{
-							info.minMatchedDistance_ = threads[k]->getMinMatchedDistance();
-						}
-						if(info.maxMatchedDistance_ == -1 || info.maxMatchedDistance_ < threads[k]->getMaxMatchedDistance())
+						std::vector<float> & objectQuality = objectQualities[tasks[k]->getObjectId()];
+						objectQuality.resize(objects_.value(tasks[k]->getObjectId())->keypoints().size(), std::numeric_limits<float>::max());
+						for(unsigned int j=0; j<objectIndexes.size(); ++j)
 						{
-							info.maxMatchedDistance_ = threads[k]->getMaxMatchedDistance();
+							objectQuality[objectIndexes[j]] = tasks[k]->getQualities()[j];
 						}
-						delete threads[k];
 					}
 
+					if(info.minMatchedDistance_ == -1 || info.minMatchedDistance_ > tasks[k]->getMinMatchedDistance())
+					{
+						info.minMatchedDistance_ = tasks[k]->getMinMatchedDistance();
+					}
+					if(info.maxMatchedDistance_ == -1 || info.maxMatchedDistance_ < tasks[k]->getMaxMatchedDistance())
+					{
+						info.maxMatchedDistance_ = tasks[k]->getMaxMatchedDistance();
+					}
+					delete tasks[k];
 				}
+				info.matches_.assign(matchGroups, matchObjectIndexes, matchSceneIndexes);
 			}
 
+			FINDOBJECT_TRACE_END(traceMatching);
 			info.timeStamps_.insert(DetectionInfo::kTimeMatching, time.restart());
 
 			// Homographies
-			if(Settings::getHomography_homographyComputed())
+			QMap<int, ObjectCost> homographyCosts;
+			if(params.Homography_homographyComputed)
 			{
+				FINDOBJECT_TRACE_SPAN(traceHomography, "homographies", "stage");
 				// HOMOGRAPHY
 				UDEBUG("COMPUTE HOMOGRAPHY");
-				int threadCounts = Settings::getGeneral_threads();
-				if(threadCounts == 0)
+				// All objects are queued at once, workers pull the next object
+				// as soon as they are free and the results are processed in
+				// completion order.
+				// Only objects with enough matches are verified, and only the
+				// best scored ones if Homography/candidatesTopK is set.
+				std::vector<std::pair<float, int> > candidates; // <score, group>
+				candidates.reserve(info.matches_.groups());
+				for(int g=0; g<info.matches_.groups(); ++g)
 				{
-					threadCounts = info.matches_.size();
+					if(cascaded && !shortlist.contains(info.matches_.id(g)))
+					{
+						int id = info.matches_.id(g);
+						info.rejectedInliers_.addGroup(id);
+						info.rejectedOutliers_.addGroup(id);
+						info.rejectedCodes_.insert(id, DetectionInfo::kRejectedCascade);
+					}
+					else if(info.matches_.groupSize(g) >= params.Homography_minimumInliers)
+					{
+						candidates.push_back(std::make_pair(scored?scores[g]:(float)info.matches_.groupSize(g), g));
+					}
+					else
+					{
+						int id = info.matches_.id(g);
+						info.rejectedInliers_.addGroup(id);
+						info.rejectedOutliers_.addGroup(id);
+						info.rejectedCodes_.insert(id, DetectionInfo::kRejectedLowMatches);
+					}
 				}
-				QList<int> matchesId = info.matches_.keys();
-				QList<QMultiMap<int, int> > matchesList = info.matches_.values();
-				for(int i=0; i<matchesList.size(); i+=threadCounts)
+				int topK = params.Homography_candidatesTopK;
+				if(topK > 0 && (int)candidates.size() > topK)
 				{
-					UDEBUG("Processing matches %d/%d", i+1, matchesList.size());
+					std::nth_element(candidates.begin(), candidates.begin()+topK, candidates.end(), std::greater<std::pair<float, int> >());
+					for(unsigned int k=topK; k<candidates.size(); ++k)
+					{
+						int id = info.matches_.id(candidates[k].second);
+						info.rejectedInliers_.addGroup(id);
+						info.rejectedOutliers_.addGroup(id);
+						info.rejectedCodes_.insert(id, DetectionInfo::kRejectedLowScore);
+					}
+					candidates.resize(topK);
+				}
 
-					QVector<HomographyThread*> threads;
+				if(params.Homography_opticalFlow && !grayscaleImg.empty() && candidates.size())
+				{
+					buildScenePyramid(grayscaleImg, scenePyramid, params);
+				}
 
-					UDEBUG("Creating/Starting homography threads (%d)...", threadCounts);
-					for(int k=i; k<i+threadCounts && k<matchesList.size(); ++k)
+				TaskGroup group(threadPool_);
+				bool clustered = params.General_multiDetection && params.General_multiDetectionClustering && params.General_multiDetectionRadius > 0;
+				UDEBUG("Starting homography tasks (%d/%d)...", (int)candidates.size(), info.matches_.groups());
+				for(unsigned int k=0; k<candidates.size(); ++k)
+				{
+					int g = candidates[k].second;
+					int objectId = info.matches_.id(g);
+					UASSERT(objects_.contains(objectId));
+					std::vector<int> objectIndexes = info.matches_.objectIndexes(g);
+					std::vector<int> sceneIndexes = info.matches_.sceneIndexes(g);
+					std::vector<float> qualities;
+					const std::vector<float> & source = params.General_invertedSearch?sceneQualities:objectQualities[objectId];
+					const std::vector<int> & sourceIndexes = params.General_invertedSearch?sceneIndexes:objectIndexes;
+					if(ordered && source.size())
 					{
-						int objectId = matchesId[k];
-						UASSERT(objects_.contains(objectId));
-						threads.push_back(new HomographyThread(
-								&matchesList[k],
-								objectId,
-								&objects_.value(objectId)->keypoints(),
-								&info.sceneKeypoints_,
-								objects_.value(objectId)->image(),
-								grayscaleImg));
-						threads.back()->start();
+						qualities.resize(sourceIndexes.size());
+						for(unsigned int j=0; j<sourceIndexes.size(); ++j)
+						{
+							qualities[j] = source[sourceIndexes[j]];
+						}
 					}
-					UDEBUG("Started homography threads");
-
-					for(int j=0; j<threads.size(); ++j)
+					if(clustered)
 					{
-						threads[j]->wait();
-						UDEBUG("Processing results of homography thread %d", j);
-
-						int id = threads[j]->getObjectId();
-						QTransform hTransform;
-						DetectionInfo::RejectedCode code = DetectionInfo::kRejectedUndef;
-						if(threads[j]->getHomography().empty())
+						QPointF center = objects_.value(objectId)->rect().center();
+						std::vector<std::vector<int> > clusters = clusterMatches(
+								objects_.value(objectId)->keypoints(),
+								info.sceneKeypoints_,
+								objectIndexes,
+								sceneIndexes,
+								cv::Point2f(center.x(), center.y()),
+								(float)params.General_multiDetectionRadius,
+								params.Homography_minimumInliers);
+						if(clusters.size())
 						{
-							code = threads[j]->rejectedCode();
+							UDEBUG("Object %d: %d clusters", objectId, (int)clusters.size());
+							// a homography per instance, in parallel
+							for(unsigned int c=0; c<clusters.size(); ++c)
+							{
+								std::vector<int> clusterObjectIndexes(clusters[c].size());
+								std::vector<int> clusterSceneIndexes(clusters[c].size());
+								std::vector<float> clusterQualities(qualities.size()?clusters[c].size():0);
+								for(unsigned int j=0; j<clusters[c].size(); ++j)
+								{
+									clusterObjectIndexes[j] = objectIndexes[clusters[c][j]];
+									clusterSceneIndexes[j] = sceneIndexes[clusters[c][j]];
+									if(qualities.size())
+									{
+										clusterQualities[j] = qualities[clusters[c][j]];
+									}
+								}
+								group.start(new HomographyTask(
+										&params,
+										clusterObjectIndexes,
+										clusterSceneIndexes,
+										objectId,
+										&objects_.value(objectId)->keypoints(),
+										&info.sceneKeypoints_.vector(),
+										objects_.value(objectId),
+										scenePyramid.empty()?0:&scenePyramid,
+										clusterQualities));
+							}
+							continue;
 						}
-						if(code == DetectionInfo::kRejectedUndef &&
-						   threads[j]->getInliers().size() < Settings::getHomography_minimumInliers()	)
+						// no cluster large enough, all the matches are verified
+					}
+					HomographyTask * homographyTask = new HomographyTask(
+							&params,
+							objectIndexes,
+							sceneIndexes,
+							objectId,
+							&objects_.value(objectId)->keypoints(),
+							&info.sceneKeypoints_.vector(),
+							objects_.value(objectId),
+							scenePyramid.empty()?0:&scenePyramid,
+							qualities);
+					if(guesses.contains(objectId))
+					{
+						// the error of the guess grows with the downscaling
+						homographyTask->setGuess(guesses.value(objectId), 4.0f*float(params.Homography_ransacReprojThr)/coarseScale);
+					}
+					group.start(homographyTask);
+				}
+
+				HomographyTask * task = 0;
+				float timeGeometryCheck = 0.0f; // summed over the tasks
+				while((task = static_cast<HomographyTask*>(group.waitNext())) != 0)
+				{
+					int id = task->getObjectId();
+					timeGeometryCheck += task->timeGeometryCheck();
+					ObjectCost & cost = homographyCosts[id];
+					++cost.homographies;
+					cost.homographyTime += task->timeHomography();
+					QTransform hTransform;
+					DetectionInfo::RejectedCode code = DetectionInfo::kRejectedUndef;
+					if(task->getHomography().empty())
+					{
+						code = task->rejectedCode();
+					}
+					if(code == DetectionInfo::kRejectedUndef &&
+					   (int)task->getInliersA().size() < params.Homography_minimumInliers	)
+					{
+						code = DetectionInfo::kRejectedLowInliers;
+					}
+					if(code == DetectionInfo::kRejectedUndef)
+					{
+						const cv::Mat & H = task->getHomography();
+						UASSERT(H.cols == 3 && H.rows == 3 && H.type()==CV_64FC1);
+						hTransform = QTransform(
+							H.at<double>(0,0), H.at<double>(1,0), H.at<double>(2,0),
+							H.at<double>(0,1), H.at<double>(1,1), H.at<double>(2,1),
+							H.at<double>(0,2), H.at<double>(1,2), H.at<double>(2,2));
+
+						// is homography valid? The corners are projected on the
+						// 3x3 matrix, a corner mapped behind the camera is invalid
+						UASSERT(objects_.contains(id));
+						QRectF objectRect = objects_.value(id)->rect();
+						QPointF rectH[4];
+						if(!mapCorners(H, objectRect, rectH))
 						{
-							code = DetectionInfo::kRejectedLowInliers;
+							code = DetectionInfo::kRejectedNotValid;
 						}
-						if(code == DetectionInfo::kRejectedUndef)
+
+						// If a point is outside of 2x times the surface of the scene, homography is invalid.
+						for(int p=0; p<4 && code == DetectionInfo::kRejectedUndef; ++p)
 						{
-							const cv::Mat & H = threads[j]->getHomography();
-							UASSERT(H.cols == 3 && H.rows == 3 && H.type()==CV_64FC1);
-							hTransform = QTransform(
-								H.at<double>(0,0), H.at<double>(1,0), H.at<double>(2,0),
-								H.at<double>(0,1), H.at<double>(1,1), H.at<double>(2,1),
-								H.at<double>(0,2), H.at<double>(1,2), H.at<double>(2,2));
-
-							// is homography valid?
-							// Here we use mapToScene() from QGraphicsItem instead
-							// of QTransform::map() because if the homography is not valid,
-							// huge errors are set by the QGraphicsItem and not by QTransform::map();
-							UASSERT(objects_.contains(id));
-							QRectF objectRect = objects_.value(id)->rect();
-							QGraphicsRectItem item(objectRect);
-							item.setTransform(hTransform);
-							QPolygonF rectH = item.mapToScene(item.rect());
-
-							// If a point is outside of 2x times the surface of the scene, homography is invalid.
-							for(int p=0; p<rectH.size(); ++p)
+							if((rectH[p].x() < -sceneSize.width && rectH[p].x() < -objectRect.width()) ||
+							   (rectH[p].x() > sceneSize.width*2  && rectH[p].x() > objectRect.width()*2) ||
+							   (rectH[p].y() < -sceneSize.height  && rectH[p].y() < -objectRect.height()) ||
+							   (rectH[p].y() > sceneSize.height*2  && rectH[p].y() > objectRect.height()*2))
 							{
-								if((rectH.at(p).x() < -image.cols && rectH.at(p).x() < -objectRect.width()) ||
-								   (rectH.at(p).x() > image.cols*2  && rectH.at(p).x() > objectRect.width()*2) ||
-								   (rectH.at(p).y() < -image.rows  && rectH.at(p).x() < -objectRect.height()) ||
-								   (rectH.at(p).y() > image.rows*2  && rectH.at(p).x() > objectRect.height()*2))
-								{
-									code= DetectionInfo::kRejectedNotValid;
-									break;
-								}
+								code= DetectionInfo::kRejectedNotValid;
 							}
+						}
 
-							// angle
-							if(code == DetectionInfo::kRejectedUndef &&
-							   Settings::getHomography_minAngle() > 0)
+						// angle
+						if(code == DetectionInfo::kRejectedUndef &&
+						   params.Homography_minAngle > 0)
+						{
+							for(int a=0; a<4; ++a)
 							{
-								for(int a=0; a<rectH.size(); ++a)
+								//  Find the smaller angle
+								float angle = cornerAngle(rectH[a], rectH[(a+1)%4], rectH[(a+2)%4]);
+								float minAngle = (float)params.Homography_minAngle;
+								if(angle < minAngle ||
+								   angle > 180.0-minAngle)
 								{
-									//  Find the smaller angle
-									QLineF ab(rectH.at(a).x(), rectH.at(a).y(), rectH.at((a+1)%4).x(), rectH.at((a+1)%4).y());
-									QLineF cb(rectH.at((a+1)%4).x(), rectH.at((a+1)%4).y(), rectH.at((a+2)%4).x(), rectH.at((a+2)%4).y());
-									float angle =  ab.angle(cb);
-									float minAngle = (float)Settings::getHomography_minAngle();
-									if(angle < minAngle ||
-									   angle > 180.0-minAngle)
-									{
-										code = DetectionInfo::kRejectedByAngle;
-										break;
-									}
+									code = DetectionInfo::kRejectedByAngle;
+									break;
 								}
 							}
+						}
 
-							// multi detection
-							if(code == DetectionInfo::kRejectedUndef &&
-							   Settings::getGeneral_multiDetection())
+						// multi detection
+						if(code == DetectionInfo::kRejectedUndef &&
+						   params.General_multiDetection)
+						{
+							int distance = params.General_multiDetectionRadius; // in pixels
+							if(!clustered)
 							{
-								int distance = Settings::getGeneral_multiDetectionRadius(); // in pixels
 								// Get the outliers and recompute homography with them
-								matchesList.push_back(threads[j]->getOutliers());
-								matchesId.push_back(id);
+								HomographyTask * outliersTask = new HomographyTask(
+										&params,
+										task->getOutliersA(),
+										task->getOutliersB(),
+										id,
+										&objects_.value(id)->keypoints(),
+										&info.sceneKeypoints_.vector(),
+										objects_.value(id),
+										scenePyramid.empty()?0:&scenePyramid);
+								group.start(outliersTask);
+							}
 
-								// compute distance from previous added same objects...
-								QMultiMap<int, QTransform>::iterator objIter = info.objDetected_.find(id);
-								for(;objIter!=info.objDetected_.end() && objIter.key() == id; ++objIter)
+							// compute distance from previous added same objects...
+							QMultiMap<int, QTransform>::iterator objIter = info.objDetected_.find(id);
+							for(;objIter!=info.objDetected_.end() && objIter.key() == id; ++objIter)
+							{
+								qreal dx = objIter.value().m31() - hTransform.m31();
+								qreal dy = objIter.value().m32() - hTransform.m32();
+								int d = (int)sqrt(dx*dx + dy*dy);
+								if(d < distance)
 								{
-									qreal dx = objIter.value().m31() - hTransform.m31();
-									qreal dy = objIter.value().m32() - hTransform.m32();
-									int d = (int)sqrt(dx*dx + dy*dy);
-									if(d < distance)
-									{
-										distance = d;
-									}
+									distance = d;
 								}
+							}
 
-								if(distance < Settings::getGeneral_multiDetectionRadius())
-								{
-									code = DetectionInfo::kRejectedSuperposed;
-								}
+							if(distance < params.General_multiDetectionRadius)
+							{
+								code = DetectionInfo::kRejectedSuperposed;
 							}
+						}
 
-							// Corners visible
-							if(code == DetectionInfo::kRejectedUndef &&
-							   Settings::getHomography_allCornersVisible())
+						// Corners visible
+						if(code == DetectionInfo::kRejectedUndef &&
+						   params.Homography_allCornersVisible)
+						{
+							// Now verify if all corners are in the scene
+							QRectF sceneRect(0,0,sceneSize.width, sceneSize.height);
+							for(int p=0; p<4; ++p)
 							{
-								// Now verify if all corners are in the scene
-								QRectF sceneRect(0,0,image.cols, image.rows);
-								for(int p=0; p<rectH.size(); ++p)
+								if(!sceneRect.contains(rectH[p]))
 								{
-									if(!sceneRect.contains(QPointF(rectH.at(p).x(), rectH.at(p).y())))
-									{
-										code = DetectionInfo::kRejectedCornersOutside;
-										break;
-									}
+									code = DetectionInfo::kRejectedCornersOutside;
+									break;
 								}
 							}
 						}
+					}
 
-						if(code == DetectionInfo::kRejectedUndef)
-						{
-							// Accepted!
-							info.objDetected_.insert(id, hTransform);
-							info.objDetectedSizes_.insert(id, objects_.value(id)->rect().size());
-							info.objDetectedInliers_.insert(id, threads[j]->getInliers());
-							info.objDetectedOutliers_.insert(id, threads[j]->getOutliers());
-							info.objDetectedInliersCount_.insert(id, threads[j]->getInliers().size());
-							info.objDetectedOutliersCount_.insert(id, threads[j]->getOutliers().size());
-							info.objDetectedFilePaths_.insert(id, objects_.value(id)->filePath());
-						}
-						else
-						{
-							//Rejected!
-							info.rejectedInliers_.insert(id, threads[j]->getInliers());
-							info.rejectedOutliers_.insert(id, threads[j]->getOutliers());
-							info.rejectedCodes_.insert(id, code);
-						}
-						delete threads[j];
+					if(code == DetectionInfo::kRejectedUndef)
+					{
+						// Accepted!
+						info.objDetected_.insert(id, hTransform);
+						info.objDetectedSizes_.insert(id, objects_.value(id)->rect().size());
+						info.objDetectedInliers_.addGroup(id, task->getInliersA(), task->getInliersB());
+						info.objDetectedOutliers_.addGroup(id, task->getOutliersA(), task->getOutliersB());
+						info.objDetectedInliersCount_.insert(id, (int)task->getInliersA().size());
+						info.objDetectedOutliersCount_.insert(id, (int)task->getOutliersA().size());
+						info.objDetectedFilePaths_.insert(id, objects_.value(id)->filePath());
 					}
-					UDEBUG("Processed matches %d", i+1);
+					else
+					{
+						//Rejected!
+						info.rejectedInliers_.addGroup(id, task->getInliersA(), task->getInliersB());
+						info.rejectedOutliers_.addGroup(id, task->getOutliersA(), task->getOutliersB());
+						info.rejectedCodes_.insert(id, code);
+					}
+					delete task;
+				}
+				UDEBUG("Homography tasks done");
+				if(params.Homography_preCheck)
+				{
+					info.timeStamps_.insert(DetectionInfo::kTimeGeometryCheck, timeGeometryCheck);
 				}
 				info.timeStamps_.insert(DetectionInfo::kTimeHomography, time.restart());
 			}
+			addObjectCosts(info, homographyCosts);
 		}
 		else if((descriptorsValid || vocabularyValid) && info.sceneKeypoints_.size())
 		{
@@ -1809,6 +4386,15 @@ bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info
 			UWARN("No features detected in the scene!?!");
 			success = true;
 		}
+
+		if(!features && params.General_roiTracking && success)
+		{
+			updateTracks(info, fullFrame, params);
+		}
+		if(!features && !grayscaleImg.empty() && params.Homography_opticalFlowTracking && params.Homography_homographyComputed)
+		{
+			updateFlowTracks(grayscaleImg, scenePyramid, info, params);
+		}
 	}
 
 	info.timeStamps_.insert(DetectionInfo::kTimeTotal, totalTime.elapsed());
@@ -1816,4 +4402,482 @@ bool FindObject::detect(const cv::Mat & image, find_object::DetectionInfo & info
 	return success;
 }
 
+class DetectBatchTask : public QRunnable
+{
+public:
+	DetectBatchTask(
+			const FindObject * findObject,
+			const ParametersSnapshot * params,
+			const cv::Mat & image,
+			const FindObject::SceneFeatures * features,
+			DetectionInfo * info) :
+		findObject_(findObject),
+		params_(params),
+		image_(image),
+		features_(features),
+		info_(info),
+		success_(false)
+	{
+		UASSERT(findObject && params && features && info);
+	}
+	virtual ~DetectBatchTask() {}
+	bool success() const {return success_;}
+
+	virtual void run()
+	{
+		success_ = findObject_->detect(image_, *info_, *params_, features_);
+	}
+private:
+	const FindObject * findObject_;
+	const ParametersSnapshot * params_;
+	cv::Mat image_;
+	const FindObject::SceneFeatures * features_;
+	DetectionInfo * info_;
+	bool success_;
+};
+
+bool FindObject::detect(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, find_object::DetectionInfo & info) const
+{
+	UASSERT_MSG((int)keypoints.size() == descriptors.rows, uFormat("%d vs %d", (int)keypoints.size(), descriptors.rows).c_str());
+
+	// objects and vocabulary are not swapped while detecting
+	QReadLocker objectsLocker(&objectsLock_);
+	QSharedPointer<const ParametersSnapshot> snapshot = parametersSnapshot();
+
+	SceneFeatures features;
+	features.keypoints = keypoints;
+	features.descriptors = descriptors;
+	features.imageSize = imageSize;
+	return detect(cv::Mat(), info, *snapshot, &features);
+}
+
+static ParametersSnapshot degradedParameters(const ParametersSnapshot & params, int maxFeatures, bool homographyComputed)
+{
+	ParametersSnapshot degraded = params;
+	if(maxFeatures > 0 && (degraded.Feature2D_3MaxFeatures <= 0 || degraded.Feature2D_3MaxFeatures > maxFeatures))
+	{
+		degraded.Feature2D_3MaxFeatures = maxFeatures;
+	}
+	degraded.Homography_homographyComputed = params.Homography_homographyComputed && homographyComputed;
+	// tracks are kept for the full detections
+	degraded.General_roiTracking = false;
+	degraded.Homography_opticalFlowTracking = false;
+	return degraded;
+}
+
+bool FindObject::detectDegraded(const cv::Mat & image, find_object::DetectionInfo & info, int maxFeatures, bool homographyComputed) const
+{
+	QReadLocker objectsLocker(&objectsLock_);
+	QSharedPointer<const ParametersSnapshot> snapshot = parametersSnapshot();
+	return detect(image, info, degradedParameters(*snapshot, maxFeatures, homographyComputed), 0);
+}
+
+bool FindObject::detectDegraded(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, find_object::DetectionInfo & info, bool homographyComputed) const
+{
+	UASSERT_MSG((int)keypoints.size() == descriptors.rows, uFormat("%d vs %d", (int)keypoints.size(), descriptors.rows).c_str());
+
+	QReadLocker objectsLocker(&objectsLock_);
+	QSharedPointer<const ParametersSnapshot> snapshot = parametersSnapshot();
+
+	SceneFeatures features;
+	features.keypoints = keypoints;
+	features.descriptors = descriptors;
+	features.imageSize = imageSize;
+	return detect(cv::Mat(), info, degradedParameters(*snapshot, 0, homographyComputed), &features);
+}
+
+int FindObject::detectBatch(const std::vector<cv::Mat> & images, std::vector<find_object::DetectionInfo> & infos) const
+{
+	// objects and vocabulary are not swapped while detecting
+	QReadLocker objectsLocker(&objectsLock_);
+
+	// same parameters for all images
+	QSharedPointer<const ParametersSnapshot> snapshot = parametersSnapshot();
+	const ParametersSnapshot & params = *snapshot;
+
+	infos = std::vector<DetectionInfo>(images.size());
+
+	// DETECT FEATURES AND EXTRACT DESCRIPTORS of all images
+	QTime time;
+	time.start();
+	std::vector<cv::Mat> grayscaleImages(images.size());
+	std::vector<ExtractFeaturesTask*> extractTasks(images.size(), (ExtractFeaturesTask*)0);
+	{
+		TaskGroup group(threadPool_);
+		for(unsigned int i=0; i<images.size(); ++i)
+		{
+			if(images[i].empty())
+			{
+				continue;
+			}
+			if(images[i].channels() != 1 || images[i].depth() != CV_8U)
+			{
+				cv::cvtColor(images[i], grayscaleImages[i], cv::COLOR_BGR2GRAY);
+			}
+			else
+			{
+				grayscaleImages[i] = images[i];
+			}
+			extractTasks[i] = new ExtractFeaturesTask(&params, threadPool_, detector_, extractor_, -1, grayscaleImages[i]);
+			group.start(extractTasks[i]);
+		}
+		group.wait();
+	}
+	std::vector<SceneFeatures> features(images.size());
+	int descriptors = 0;
+	int dim = -1;
+	int type = -1;
+	bool stackable = true;
+	for(unsigned int i=0; i<extractTasks.size(); ++i)
+	{
+		if(extractTasks[i])
+		{
+			UASSERT_MSG((int)extractTasks[i]->keypoints().size() == extractTasks[i]->descriptors().rows, uFormat("%d vs %d", (int)extractTasks[i]->keypoints().size(), extractTasks[i]->descriptors().rows).c_str());
+			features[i].keypoints = extractTasks[i]->keypoints();
+			features[i].imageSize = cv::Size(grayscaleImages[i].cols, grayscaleImages[i].rows);
+			features[i].descriptors = extractTasks[i]->descriptors();
+			features[i].timeStamps.insert(DetectionInfo::kTimeKeypointDetection, extractTasks[i]->timeDetection());
+			features[i].timeStamps.insert(DetectionInfo::kTimeDescriptorExtraction, extractTasks[i]->timeExtraction());
+			features[i].timeStamps.insert(DetectionInfo::kTimeSubPixelRefining, extractTasks[i]->timeSubPix());
+			features[i].timeStamps.insert(DetectionInfo::kTimeSkewAffine, extractTasks[i]->timeSkewAffine());
+			if(features[i].descriptors.rows)
+			{
+				stackable = stackable &&
+						(dim == -1 || (dim == features[i].descriptors.cols && type == features[i].descriptors.type()));
+				dim = features[i].descriptors.cols;
+				type = features[i].descriptors.type();
+				descriptors += features[i].descriptors.rows;
+			}
+			delete extractTasks[i];
+		}
+	}
+	UDEBUG("Features of %d images extracted (%d ms)", (int)images.size(), time.restart());
+
+	// SEARCH the descriptors of all images at once (inverted search)
+	if(params.General_invertedSearch &&
+	   stackable &&
+	   descriptors &&
+	   vocabulary_->size() &&
+	   vocabulary_->indexedSize() &&
+	   vocabulary_->wordToObjects().begin().value()!=-1 &&
+	   vocabulary_->dim() == dim &&
+	   (vocabulary_->type() == type || (params.NearestNeighbor_7ConvertBinToFloat && vocabulary_->type() == CV_32FC1)))
+	{
+		cv::Mat sceneDescriptors(descriptors, dim, type);
+		int row = 0;
+		for(unsigned int i=0; i<features.size(); ++i)
+		{
+			if(features[i].descriptors.rows)
+			{
+				features[i].descriptors.copyTo(sceneDescriptors.rowRange(row, row+features[i].descriptors.rows));
+				row += features[i].descriptors.rows;
+			}
+		}
+		int k = Vocabulary::matchK(params);
+		cv::Mat results(descriptors, k, CV_32SC1);
+		cv::Mat dists(descriptors, k, CV_32FC1);
+		vocabulary_->search(sceneDescriptors, results, dists, k);
+		row = 0;
+		for(unsigned int i=0; i<features.size(); ++i)
+		{
+			if(features[i].descriptors.rows)
+			{
+				features[i].results = results.rowRange(row, row+features[i].descriptors.rows);
+				features[i].dists = dists.rowRange(row, row+features[i].descriptors.rows);
+				row += features[i].descriptors.rows;
+			}
+		}
+		UDEBUG("%d descriptors of %d images searched (%d ms)", descriptors, (int)images.size(), time.restart());
+	}
+
+	// MATCHING AND HOMOGRAPHIES, images done in parallel with their own tasks
+	int successes = 0;
+	{
+		TaskGroup group(threadPool_);
+		std::vector<DetectBatchTask*> tasks;
+		for(unsigned int i=0; i<images.size(); ++i)
+		{
+			if(!grayscaleImages[i].empty())
+			{
+				tasks.push_back(new DetectBatchTask(this, &params, grayscaleImages[i], &features[i], &infos[i]));
+				group.start(tasks.back());
+			}
+		}
+		group.wait();
+		for(unsigned int i=0; i<tasks.size(); ++i)
+		{
+			successes += tasks[i]->success()?1:0;
+			delete tasks[i];
+		}
+	}
+	UDEBUG("%d/%d images detected (%d ms)", successes, (int)images.size(), time.elapsed());
+	return successes;
+}
+
+// Mask of the predicted regions of the tracked objects, empty when the
+// full frame should be processed. Tracks are shared by the detections of
+// this instance, they are meant for a single stream of frames.
+cv::Mat FindObject::trackingMask(const cv::Size & imageSize, const ParametersSnapshot & params) const
+{
+	QMutexLocker locker(&tracksMutex_);
+	if(tracks_.empty() || framesSinceFullFrame_ >= params.General_roiTrackingFullFrameInterval)
+	{
+		return cv::Mat();
+	}
+	++framesSinceFullFrame_;
+
+	cv::Mat mask = cv::Mat::zeros(imageSize, CV_8UC1);
+	cv::Rect imageRect(0, 0, imageSize.width, imageSize.height);
+	float margin = params.General_roiTrackingMargin;
+	for(int i=0; i<tracks_.size(); ++i)
+	{
+		QRectF box = tracks_[i].box.translated(tracks_[i].velocity);
+		float dx = box.width()*margin;
+		float dy = box.height()*margin;
+		box.adjust(-dx, -dy, dx, dy);
+		cv::Rect rect = cv::Rect(
+				int(std::floor(box.left())),
+				int(std::floor(box.top())),
+				int(std::ceil(box.width())),
+				int(std::ceil(box.height()))) & imageRect;
+		if(rect.area())
+		{
+			mask(rect).setTo(cv::Scalar(255));
+		}
+	}
+	return mask;
+}
+
+// Propagate the inliers of the tracked objects to this frame with
+// pyramidal optical flow and estimate their homography from them. Returns
+// false (and stops tracking) if an object has not enough inliers, then
+// the features should be extracted and matched.
+bool FindObject::trackWithOpticalFlow(const cv::Mat & image, std::vector<cv::Mat> & pyramid, DetectionInfo & info, const ParametersSnapshot & params) const
+{
+	QMutexLocker locker(&tracksMutex_);
+	if(flowTracks_.empty() || flowPyramid_.empty())
+	{
+		return false;
+	}
+
+	QTime time;
+	time.start();
+	cv::Size winSize(params.Homography_opticalFlowWinSize, params.Homography_opticalFlowWinSize);
+	buildScenePyramid(image, pyramid, params);
+
+	std::vector<cv::Point2f> previousPoints;
+	for(int i=0; i<flowTracks_.size(); ++i)
+	{
+		previousPoints.insert(previousPoints.end(), flowTracks_[i].scenePoints.begin(), flowTracks_[i].scenePoints.end());
+	}
+	std::vector<cv::Point2f> points;
+	std::vector<unsigned char> status;
+	std::vector<float> err;
+	cv::calcOpticalFlowPyrLK(
+			flowPyramid_,
+			pyramid,
+			previousPoints,
+			points,
+			status,
+			err,
+			winSize,
+			params.Homography_opticalFlowMaxLevel,
+			cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, params.Homography_opticalFlowIterations, params.Homography_opticalFlowEps));
+
+	int minInliers = params.Homography_opticalFlowTrackingMinInliers>4?params.Homography_opticalFlowTrackingMinInliers:4;
+	QList<FlowTrack> tracks;
+	std::vector<cv::Mat> homographies;
+	int offset = 0;
+	bool lost = false;
+	for(int i=0; i<flowTracks_.size() && !lost; ++i)
+	{
+		const FlowTrack & previous = flowTracks_[i];
+		FlowTrack tracked;
+		tracked.objectId = previous.objectId;
+		for(unsigned int j=0; j<previous.scenePoints.size(); ++j)
+		{
+			if(status[offset+j])
+			{
+				tracked.objectIndexes.push_back(previous.objectIndexes[j]);
+				tracked.objectPoints.push_back(previous.objectPoints[j]);
+				tracked.scenePoints.push_back(points[offset+j]);
+			}
+		}
+		offset += (int)previous.scenePoints.size();
+
+		cv::Mat H;
+		if((int)tracked.objectPoints.size() >= minInliers && objects_.contains(tracked.objectId))
+		{
+			std::vector<unsigned char> inliersMask;
+			H = cv::findHomography(tracked.objectPoints,
+					tracked.scenePoints,
+					Settings::getHomographyMethod(params.Homography_method),
+					params.Homography_ransacReprojThr,
+					inliersMask);
+			if(!H.empty() && inliersMask.size() == tracked.objectPoints.size())
+			{
+				// only the inliers are tracked in the next frames
+				unsigned int k = 0;
+				for(unsigned int j=0; j<inliersMask.size(); ++j)
+				{
+					if(inliersMask[j])
+					{
+						tracked.objectIndexes[k] = tracked.objectIndexes[j];
+						tracked.objectPoints[k] = tracked.objectPoints[j];
+						tracked.scenePoints[k] = tracked.scenePoints[j];
+						++k;
+					}
+				}
+				tracked.objectIndexes.resize(k);
+				tracked.objectPoints.resize(k);
+				tracked.scenePoints.resize(k);
+			}
+		}
+		if(H.empty() || (int)tracked.objectPoints.size() < minInliers)
+		{
+			UDEBUG("Object %d lost by optical flow tracking (%d inliers)", tracked.objectId, (int)tracked.objectPoints.size());
+			lost = true;
+		}
+		else
+		{
+			tracks.push_back(tracked);
+			homographies.push_back(H);
+		}
+	}
+	if(lost)
+	{
+		flowTracks_.clear();
+		flowPyramid_.clear();
+		return false;
+	}
+
+	for(int i=0; i<tracks.size(); ++i)
+	{
+		const FlowTrack & track = tracks[i];
+		const ObjSignature * object = objects_.value(track.objectId);
+		const cv::Mat & H = homographies[i];
+		std::vector<int> sceneIndexes(track.scenePoints.size());
+		for(unsigned int j=0; j<track.scenePoints.size(); ++j)
+		{
+			sceneIndexes[j] = (int)info.sceneKeypoints_.size();
+			float size = track.objectIndexes[j] < (int)object->keypoints().size()?object->keypoints()[track.objectIndexes[j]].size:1.0f;
+			info.sceneKeypoints_.push_back(cv::KeyPoint(track.scenePoints[j], size));
+		}
+		info.objDetected_.insert(track.objectId, QTransform(
+				H.at<double>(0,0), H.at<double>(1,0), H.at<double>(2,0),
+				H.at<double>(0,1), H.at<double>(1,1), H.at<double>(2,1),
+				H.at<double>(0,2), H.at<double>(1,2), H.at<double>(2,2)));
+		info.objDetectedSizes_.insert(track.objectId, object->rect().size());
+		info.objDetectedInliers_.addGroup(track.objectId, track.objectIndexes, sceneIndexes);
+		info.objDetectedOutliers_.addGroup(track.objectId);
+		info.objDetectedInliersCount_.insert(track.objectId, (int)track.objectIndexes.size());
+		info.objDetectedOutliersCount_.insert(track.objectId, 0);
+		info.objDetectedFilePaths_.insert(track.objectId, object->filePath());
+	}
+	flowTracks_ = tracks;
+	flowPyramid_ = pyramid;
+	info.timeStamps_.insert(DetectionInfo::kTimeKeypointDetection, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeDescriptorExtraction, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeSubPixelRefining, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeSkewAffine, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeIndexing, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeMatching, 0);
+	info.timeStamps_.insert(DetectionInfo::kTimeHomography, time.elapsed());
+	UDEBUG("Optical flow tracking: %d objects, %d points (%d ms)", tracks.size(), (int)previousPoints.size(), time.elapsed());
+	return true;
+}
+
+// Start tracking with optical flow the inliers of the objects detected
+void FindObject::updateFlowTracks(const cv::Mat & image, std::vector<cv::Mat> & pyramid, const DetectionInfo & info, const ParametersSnapshot & params) const
+{
+	QList<FlowTrack> tracks;
+	for(int g=0; g<info.objDetectedInliers_.groups(); ++g)
+	{
+		int id = info.objDetectedInliers_.id(g);
+		if(!objects_.contains(id) || info.objDetectedInliers_.groupSize(g) < params.Homography_opticalFlowTrackingMinInliers)
+		{
+			continue;
+		}
+		const std::vector<cv::KeyPoint> & objectKeypoints = objects_.value(id)->keypoints();
+		FlowTrack track;
+		track.objectId = id;
+		for(int i=info.objDetectedInliers_.groupBegin(g); i<info.objDetectedInliers_.groupBegin(g+1); ++i)
+		{
+			int objectIndex = info.objDetectedInliers_.objectIndex(i);
+			int sceneIndex = info.objDetectedInliers_.sceneIndex(i);
+			UASSERT(objectIndex < (int)objectKeypoints.size() && sceneIndex < (int)info.sceneKeypoints_.size());
+			track.objectIndexes.push_back(objectIndex);
+			track.objectPoints.push_back(objectKeypoints[objectIndex].pt);
+			track.scenePoints.push_back(info.sceneKeypoints_[sceneIndex].pt);
+		}
+		tracks.push_back(track);
+	}
+
+	if(tracks.size())
+	{
+		buildScenePyramid(image, pyramid, params);
+	}
+	QMutexLocker locker(&tracksMutex_);
+	flowTracks_ = tracks;
+	flowPyramid_ = tracks.size()?pyramid:std::vector<cv::Mat>();
+}
+
+// Tracks are replaced by the objects detected. If a tracked object is not
+// found again, the next frame is processed in full.
+void FindObject::updateTracks(const DetectionInfo & info, bool fullFrame, const ParametersSnapshot & params) const
+{
+	QList<Track> tracks;
+	QMultiMap<int, QSize>::const_iterator iterSizes = info.objDetectedSizes_.constBegin();
+	for(QMultiMap<int, QTransform>::const_iterator iter=info.objDetected_.constBegin(); iter!=info.objDetected_.constEnd(); ++iter, ++iterSizes)
+	{
+		Track track;
+		track.objectId = iter.key();
+		track.box = iter.value().mapRect(QRectF(QPointF(0,0), QSizeF(iterSizes.value())));
+		tracks.push_back(track);
+	}
+
+	QMutexLocker locker(&tracksMutex_);
+	bool lost = false;
+	QVector<bool> matched(tracks.size(), false);
+	for(int i=0; i<tracks_.size(); ++i)
+	{
+		// nearest detection of the same object
+		int best = -1;
+		float bestDistance = 0.0f;
+		QPointF predicted = tracks_[i].box.center() + tracks_[i].velocity;
+		for(int j=0; j<tracks.size(); ++j)
+		{
+			if(!matched[j] && tracks[j].objectId == tracks_[i].objectId)
+			{
+				QPointF d = tracks[j].box.center() - predicted;
+				float distance = d.x()*d.x() + d.y()*d.y();
+				if(best < 0 || distance < bestDistance)
+				{
+					best = j;
+					bestDistance = distance;
+				}
+			}
+		}
+		if(best >= 0)
+		{
+			matched[best] = true;
+			tracks[best].velocity = tracks[best].box.center() - tracks_[i].box.center();
+		}
+		else
+		{
+			lost = true;
+		}
+	}
+	tracks_ = tracks;
+	if(fullFrame)
+	{
+		framesSinceFullFrame_ = 0;
+	}
+	else if(lost)
+	{
+		UDEBUG("Tracked object lost, processing the full next frame");
+		framesSinceFullFrame_ = params.General_roiTrackingFullFrameInterval;
+	}
+}
+
 } // namespace find_object
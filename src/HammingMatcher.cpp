@@ -0,0 +1,154 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "HammingMatcher.h"
+#include "find_object/utilite/ULogger.h"
+#include <string.h>
+#include <limits>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace find_object {
+
+// Compiled to POPCNT on x86 (when enabled) and to CNT on ARM
+static inline int popcount64(unsigned long long v)
+{
+#if defined(_MSC_VER) && defined(_M_X64)
+	return (int)__popcnt64(v);
+#elif defined(__GNUC__)
+	return __builtin_popcountll(v);
+#else
+	v = v - ((v >> 1) & 0x5555555555555555ULL);
+	v = (v & 0x3333333333333333ULL) + ((v >> 2) & 0x3333333333333333ULL);
+	v = (v + (v >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (int)((v * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+static inline int hammingDistance(const uchar * a, const uchar * b, int words, int tail)
+{
+	int dist = 0;
+	for(int i=0; i<words; ++i)
+	{
+		// memcpy: descriptors are not necessarily 8 bytes aligned, it is a single load on x86/ARM
+		unsigned long long va, vb;
+		memcpy(&va, a+i*8, 8);
+		memcpy(&vb, b+i*8, 8);
+		dist += popcount64(va ^ vb);
+	}
+	for(int i=words*8; i<words*8+tail; ++i)
+	{
+		dist += popcount64(a[i] ^ b[i]);
+	}
+	return dist;
+}
+
+class HammingKnnBody : public cv::ParallelLoopBody
+{
+public:
+	HammingKnnBody(const cv::Mat & queries, const cv::Mat & train, cv::Mat & results, cv::Mat & dists, int k) :
+		queries_(queries),
+		train_(train),
+		results_(results),
+		dists_(dists),
+		k_(k)
+	{}
+
+	virtual void operator()(const cv::Range & range) const
+	{
+		static const int kTrainBlock = 1024; // e.g. 32 KB of ORB descriptors
+		const int words = train_.cols / 8;
+		const int tail = train_.cols % 8;
+
+		std::vector<int> bestDists((range.end - range.start) * k_, std::numeric_limits<int>::max());
+		std::vector<int> bestIds((range.end - range.start) * k_, -1);
+
+		for(int t=0; t<train_.rows; t+=kTrainBlock)
+		{
+			int tEnd = t+kTrainBlock < train_.rows?t+kTrainBlock:train_.rows;
+			for(int q=range.start; q<range.end; ++q)
+			{
+				const uchar * query = queries_.ptr<uchar>(q);
+				int * qDists = &bestDists[(q-range.start)*k_];
+				int * qIds = &bestIds[(q-range.start)*k_];
+				for(int j=t; j<tEnd; ++j)
+				{
+					int dist = hammingDistance(query, train_.ptr<uchar>(j), words, tail);
+					if(dist < qDists[k_-1])
+					{
+						// insert sorted
+						int m = k_-1;
+						while(m > 0 && qDists[m-1] > dist)
+						{
+							qDists[m] = qDists[m-1];
+							qIds[m] = qIds[m-1];
+							--m;
+						}
+						qDists[m] = dist;
+						qIds[m] = j;
+					}
+				}
+			}
+		}
+
+		for(int q=range.start; q<range.end; ++q)
+		{
+			for(int m=0; m<k_; ++m)
+			{
+				int id = bestIds[(q-range.start)*k_ + m];
+				results_.at<int>(q, m) = id;
+				dists_.at<float>(q, m) = id>=0?(float)bestDists[(q-range.start)*k_ + m]:std::numeric_limits<float>::max();
+			}
+		}
+	}
+
+private:
+	const cv::Mat & queries_;
+	const cv::Mat & train_;
+	cv::Mat & results_;
+	cv::Mat & dists_;
+	int k_;
+};
+
+void hammingKnnSearch(const cv::Mat & queries, const cv::Mat & train, cv::Mat & results, cv::Mat & dists, int k)
+{
+	UASSERT(queries.type() == CV_8UC1 && train.type() == CV_8UC1);
+	UASSERT(queries.cols == train.cols);
+	UASSERT(k >= 1);
+
+	// reused if already allocated with the same size
+	results.create(queries.rows, k, CV_32SC1);
+	dists.create(queries.rows, k, CV_32FC1);
+	if(queries.rows)
+	{
+		// ~64 queries per stripe
+		cv::parallel_for_(cv::Range(0, queries.rows), HammingKnnBody(queries, train, results, dists, k), (queries.rows+63)/64);
+	}
+}
+
+} // namespace find_object
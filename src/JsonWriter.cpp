@@ -42,6 +42,15 @@ void JsonWriter::write(const DetectionInfo & info, const QString & path)
 	{
 		Json::Value root;
 
+		if(info.streamId_ >= 0)
+		{
+			root["stream"] = info.streamId_;
+		}
+		if(info.reused_)
+		{
+			root["reused"] = true;
+		}
+
 		if(info.objDetected_.size())
 		{
 			Json::Value detections;
@@ -93,16 +102,14 @@ void JsonWriter::write(const DetectionInfo & info, const QString & path)
 			root["objects"] = detections;
 		}
 
-		if(info.matches_.size())
+		if(!info.matches_.empty())
 		{
 			Json::Value matchesValues;
-			const QMap<int, QMultiMap<int, int> > & matches = info.matches_;
-			for(QMap<int, QMultiMap<int, int> >::const_iterator iter = matches.constBegin();
-				iter != matches.end();
-				++iter)
+			const DetectionMatches & matches = info.matches_;
+			for(int g = 0; g < matches.groups(); ++g)
 			{
-				QString name = QString("matches_%1").arg(iter.key());
-				root[name.toStdString()] = iter.value().size();
+				QString name = QString("matches_%1").arg(matches.id(g));
+				root[name.toStdString()] = matches.groupSize(g);
 				matchesValues.append(name.toStdString());
 			}
 			root["matches"] = matchesValues;
@@ -119,4 +126,64 @@ void JsonWriter::write(const DetectionInfo & info, const QString & path)
 	}
 }
 
+QByteArray JsonWriter::line(const DetectionInfo & info, qint64 time)
+{
+	// formatted directly, without Json::Value tree
+	QByteArray line;
+	line.reserve(128 + info.objDetected_.size()*192);
+	line += "{\"time\":";
+	line += QByteArray::number(time);
+	if(info.streamId_ >= 0)
+	{
+		line += ",\"stream\":";
+		line += QByteArray::number(info.streamId_);
+	}
+	if(info.reused_)
+	{
+		line += ",\"reused\":true";
+	}
+	if(info.timeStamps_.contains(DetectionInfo::kTimeTotal))
+	{
+		line += ",\"detection_ms\":";
+		line += QByteArray::number(info.timeStamps_.value(DetectionInfo::kTimeTotal), 'g', 6);
+	}
+	line += ",\"objects\":[";
+	QMultiMap<int, int>::const_iterator iterInliers = info.objDetectedInliersCount_.constBegin();
+	QMultiMap<int, int>::const_iterator iterOutliers = info.objDetectedOutliersCount_.constBegin();
+	QMultiMap<int, QSize>::const_iterator iterSizes = info.objDetectedSizes_.constBegin();
+	for(QMultiMap<int, QTransform>::const_iterator iter = info.objDetected_.constBegin();
+		iter!= info.objDetected_.constEnd();
+		++iter, ++iterInliers, ++iterOutliers, ++iterSizes)
+	{
+		if(iter != info.objDetected_.constBegin())
+		{
+			line += ',';
+		}
+		const QTransform & h = iter.value();
+		double m[9] = {h.m11(), h.m12(), h.m13(), h.m21(), h.m22(), h.m23(), h.m31(), h.m32(), h.m33()};
+		line += "{\"id\":";
+		line += QByteArray::number(iter.key());
+		line += ",\"width\":";
+		line += QByteArray::number(iterSizes.value().width());
+		line += ",\"height\":";
+		line += QByteArray::number(iterSizes.value().height());
+		line += ",\"homography\":[";
+		for(int i=0; i<9; ++i)
+		{
+			if(i)
+			{
+				line += ',';
+			}
+			line += QByteArray::number(m[i], 'g', 9);
+		}
+		line += "],\"inliers\":";
+		line += QByteArray::number(iterInliers.value());
+		line += ",\"outliers\":";
+		line += QByteArray::number(iterOutliers.value());
+		line += '}';
+	}
+	line += "]}\n";
+	return line;
+}
+
 } // namespace find_object
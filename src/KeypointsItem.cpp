@@ -0,0 +1,128 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "KeypointsItem.h"
+
+#include <QtGui/QPainter>
+#include <QStyleOptionGraphicsItem>
+
+namespace find_object {
+
+KeypointsItem::KeypointsItem(const QVector<QRectF> * rects, const QVector<QColor> * colors, QGraphicsItem * parent) :
+	QGraphicsItem(parent),
+	rects_(rects),
+	colors_(colors),
+	alpha_(-1)
+{
+	// exposedRect is set in paint()
+	this->setFlag(QGraphicsItem::ItemUsesExtendedStyleOption, true);
+	this->updateGeometry();
+}
+
+KeypointsItem::~KeypointsItem()
+{
+}
+
+void KeypointsItem::setAlpha(int alpha)
+{
+	alpha_ = alpha;
+	this->update();
+}
+
+void KeypointsItem::updateGeometry()
+{
+	this->prepareGeometryChange();
+	boundingRect_ = QRectF();
+	for(int i=0; i<rects_->size(); ++i)
+	{
+		boundingRect_ |= rects_->at(i);
+	}
+}
+
+void KeypointsItem::updateKeypoint(int index)
+{
+	if(index>=0 && index < rects_->size())
+	{
+		this->update(rects_->at(index));
+	}
+}
+
+void KeypointsItem::paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget *)
+{
+	paintKeypoints(painter, *rects_, *colors_, alpha_, option->exposedRect);
+}
+
+void KeypointsItem::paintKeypoints(QPainter * painter, const QVector<QRectF> & rects, const QVector<QColor> & colors, int alpha, const QRectF & exposed)
+{
+	qreal lod = QStyleOptionGraphicsItem::levelOfDetailFromTransform(painter->worldTransform());
+	int size = qMin(rects.size(), colors.size());
+	QVector<QPointF> points; // small keypoints of the current color
+	QRgb currentColor = 0;
+	bool colorSet = false;
+
+	painter->save();
+	for(int i=0; i<size; ++i)
+	{
+		const QRectF & rect = rects.at(i);
+		if(!exposed.isNull() && !exposed.intersects(rect))
+		{
+			continue;
+		}
+		QColor color = colors.at(i);
+		if(alpha >= 0)
+		{
+			color.setAlpha(alpha);
+		}
+		if(!colorSet || color.rgba() != currentColor)
+		{
+			if(points.size())
+			{
+				painter->drawPoints(points.constData(), points.size());
+				points.clear();
+			}
+			painter->setPen(color);
+			painter->setBrush(color);
+			currentColor = color.rgba();
+			colorSet = true;
+		}
+		if(rect.width()*lod < 2.0)
+		{
+			points.push_back(rect.center());
+		}
+		else
+		{
+			painter->drawEllipse(rect);
+		}
+	}
+	if(points.size())
+	{
+		painter->drawPoints(points.constData(), points.size());
+	}
+	painter->restore();
+}
+
+} // namespace find_object
@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef KEYPOINTSITEM_H_
+#define KEYPOINTSITEM_H_
+
+#include <QGraphicsItem>
+#include <QtCore/QVector>
+#include <QtCore/QRectF>
+#include <QtGui/QColor>
+
+namespace find_object {
+
+// All the keypoints of a view in a single item, painted from the arrays
+// of their rectangles and colors instead of an item per keypoint in the
+// scene. Keypoints are neither selectable nor hoverable (see KeypointItem).
+class KeypointsItem : public QGraphicsItem
+{
+public:
+	enum {Type = UserType + 1};
+
+public:
+	// rects and colors are not copied, they must outlive the item
+	KeypointsItem(const QVector<QRectF> * rects, const QVector<QColor> * colors, QGraphicsItem * parent = 0);
+	virtual ~KeypointsItem();
+
+	void setAlpha(int alpha);
+	// Call after the rectangles changed
+	void updateGeometry();
+	// Repaints only this keypoint, call after its color changed
+	void updateKeypoint(int index);
+
+	virtual int type() const {return Type;}
+	virtual QRectF boundingRect() const {return boundingRect_;}
+	virtual void paint(QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget = 0);
+
+	// Paint the keypoints intersecting exposed (all if null), the pen and
+	// brush are changed only between keypoints of different colors. Keypoints
+	// smaller than 2 pixels on the device are painted as points. alpha<0
+	// keeps the alpha of the colors.
+	static void paintKeypoints(QPainter * painter, const QVector<QRectF> & rects, const QVector<QColor> & colors, int alpha = -1, const QRectF & exposed = QRectF());
+
+private:
+	const QVector<QRectF> * rects_;
+	const QVector<QColor> * colors_;
+	int alpha_;
+	QRectF boundingRect_;
+};
+
+} // namespace find_object
+
+#endif /* KEYPOINTSITEM_H_ */
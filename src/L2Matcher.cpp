@@ -0,0 +1,179 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "L2Matcher.h"
+#include "find_object/utilite/ULogger.h"
+#include <algorithm>
+#include <limits>
+#include <cmath>
+
+namespace find_object {
+
+void l2SquaredNorms(const cv::Mat & descriptors, cv::Mat & norms)
+{
+	UASSERT(descriptors.empty() || descriptors.type() == CV_32FC1);
+	norms = cv::Mat(descriptors.rows, 1, CV_32FC1);
+	for(int i=0; i<descriptors.rows; ++i)
+	{
+		const float * d = descriptors.ptr<float>(i);
+		float norm = 0.0f;
+		for(int j=0; j<descriptors.cols; ++j)
+		{
+			norm += d[j]*d[j];
+		}
+		norms.at<float>(i) = norm;
+	}
+}
+
+static inline float l2Distance(const float * a, const float * b, int dim)
+{
+	float dist = 0.0f;
+	for(int i=0; i<dim; ++i)
+	{
+		float diff = a[i] - b[i];
+		dist += diff*diff;
+	}
+	return std::sqrt(dist);
+}
+
+class L2KnnBody : public cv::ParallelLoopBody
+{
+public:
+	L2KnnBody(const cv::Mat & queries, const cv::Mat & train, const cv::Mat & trainNorms, cv::Mat & results, cv::Mat & dists, int k) :
+		queries_(queries),
+		train_(train),
+		trainNorms_(trainNorms),
+		results_(results),
+		dists_(dists),
+		k_(k)
+	{}
+
+	virtual void operator()(const cv::Range & range) const
+	{
+		static const int kQueryBlock = 64;
+		static const int kTrainBlock = 1024; // e.g. 512 KB of SIFT descriptors, 256 KB of products
+
+		cv::Mat queryNorms;
+		l2SquaredNorms(queries_.rowRange(range.start, range.end), queryNorms);
+
+		std::vector<float> bestDists((range.end - range.start) * k_, std::numeric_limits<float>::max());
+		std::vector<int> bestIds((range.end - range.start) * k_, -1);
+
+		cv::Mat products;
+		for(int q=range.start; q<range.end; q+=kQueryBlock)
+		{
+			int qEnd = q+kQueryBlock < range.end?q+kQueryBlock:range.end;
+			cv::Mat queries = queries_.rowRange(q, qEnd);
+			for(int t=0; t<train_.rows; t+=kTrainBlock)
+			{
+				int tEnd = t+kTrainBlock < train_.rows?t+kTrainBlock:train_.rows;
+				// -2 q.t of the block
+				cv::gemm(queries, train_.rowRange(t, tEnd), -2.0, cv::Mat(), 0.0, products, cv::GEMM_2_T);
+				const float * tNorms = trainNorms_.ptr<float>(t);
+				for(int i=q; i<qEnd; ++i)
+				{
+					const float * row = products.ptr<float>(i-q);
+					float qNorm = queryNorms.at<float>(i-range.start);
+					float * qDists = &bestDists[(i-range.start)*k_];
+					int * qIds = &bestIds[(i-range.start)*k_];
+					for(int j=0; j<tEnd-t; ++j)
+					{
+						float dist = qNorm + tNorms[j] + row[j];
+						if(dist < qDists[k_-1])
+						{
+							// insert sorted
+							int m = k_-1;
+							while(m > 0 && qDists[m-1] > dist)
+							{
+								qDists[m] = qDists[m-1];
+								qIds[m] = qIds[m-1];
+								--m;
+							}
+							qDists[m] = dist;
+							qIds[m] = t+j;
+						}
+					}
+				}
+			}
+		}
+
+		for(int q=range.start; q<range.end; ++q)
+		{
+			const float * query = queries_.ptr<float>(q);
+			for(int m=0; m<k_; ++m)
+			{
+				int id = bestIds[(q-range.start)*k_ + m];
+				results_.at<int>(q, m) = id;
+				// exact distance, the expanded form loses precision on near descriptors
+				dists_.at<float>(q, m) = id>=0?l2Distance(query, train_.ptr<float>(id), train_.cols):std::numeric_limits<float>::max();
+			}
+			// the exact distances may swap near neighbors
+			for(int m=1; m<k_; ++m)
+			{
+				int n = m;
+				while(n > 0 && results_.at<int>(q, n) >= 0 && dists_.at<float>(q, n-1) > dists_.at<float>(q, n))
+				{
+					std::swap(dists_.at<float>(q, n-1), dists_.at<float>(q, n));
+					std::swap(results_.at<int>(q, n-1), results_.at<int>(q, n));
+					--n;
+				}
+			}
+		}
+	}
+
+private:
+	const cv::Mat & queries_;
+	const cv::Mat & train_;
+	const cv::Mat & trainNorms_;
+	cv::Mat & results_;
+	cv::Mat & dists_;
+	int k_;
+};
+
+void l2KnnSearch(const cv::Mat & queries, const cv::Mat & train, const cv::Mat & trainNorms, cv::Mat & results, cv::Mat & dists, int k)
+{
+	UASSERT(queries.type() == CV_32FC1 && train.type() == CV_32FC1);
+	UASSERT(queries.cols == train.cols);
+	UASSERT(k >= 1);
+
+	cv::Mat norms = trainNorms;
+	if(norms.rows != train.rows)
+	{
+		l2SquaredNorms(train, norms);
+	}
+
+	// reused if already allocated with the same size
+	results.create(queries.rows, k, CV_32SC1);
+	dists.create(queries.rows, k, CV_32FC1);
+	if(queries.rows)
+	{
+		// ~64 queries per stripe
+		cv::parallel_for_(cv::Range(0, queries.rows), L2KnnBody(queries, train, norms, results, dists, k), (queries.rows+63)/64);
+	}
+}
+
+} // namespace find_object
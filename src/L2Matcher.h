@@ -0,0 +1,52 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef L2MATCHER_H_
+#define L2MATCHER_H_
+
+#include <opencv2/opencv.hpp>
+
+namespace find_object {
+
+// Squared L2 norms (CV_32FC1, rows x 1) of the float descriptors (CV_32FC1)
+void l2SquaredNorms(const cv::Mat & descriptors, cv::Mat & norms);
+
+// Exhaustive k nearest neighbors search of float descriptors (CV_32FC1)
+// with the L2 distance. The squared distances of blocks of queries to
+// blocks of train descriptors are computed with a matrix product
+// (|q|^2 + |t|^2 - 2 q.t) and the k nearest are selected as soon as a
+// block is computed, query blocks are split between threads. The
+// distances of the k nearest are then computed again directly, so they
+// are exact (same as cv::BFMatcher with NORM_L2, not squared).
+// trainNorms are the l2SquaredNorms() of train, computed here if empty.
+// results (CV_32SC1) and dists (CV_32FC1) are queries.rows x k, missing
+// neighbors (k > train.rows) are set to -1.
+void l2KnnSearch(const cv::Mat & queries, const cv::Mat & train, const cv::Mat & trainNorms, cv::Mat & results, cv::Mat & dists, int k);
+
+} // namespace find_object
+
+#endif /* L2MATCHER_H_ */
@@ -33,6 +33,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "find_object/utilite/ULogger.h"
 #include "find_object/ObjWidget.h"
 #include "find_object/QtOpenCV.h"
+#include "find_object/Trace.h"
 
 #include "AddObjectDialog.h"
 #include "ui_mainWindow.h"
@@ -40,6 +41,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "RectItem.h"
 #include "ParametersToolBox.h"
 #include "AboutDialog.h"
+#include "DetectionWorker.h"
 #include "rtabmap/PdfPlot.h"
 #include "Vocabulary.h"
 #include "ObjSignature.h"
@@ -87,10 +89,25 @@ MainWindow::MainWindow(FindObject * findObject, Camera * camera, QWidget * paren
 	inliersCurve_(0),
 	lowestRefreshRate_(99),
 	objectsModified_(false),
-	tcpServer_(0)
+	tcpServer_(0),
+	detectionThread_(0),
+	detectionWorker_(0),
+	pendingDetected_(false),
+	detectionPending_(false)
 {
 	UASSERT(findObject_ != 0);
 
+	// Detections are done on their own thread, the GUI only shows the latest one
+	detectionWorker_ = new DetectionWorker(findObject_);
+	detectionThread_ = new QThread(this);
+	detectionWorker_->moveToThread(detectionThread_);
+	connect(detectionThread_, SIGNAL(finished()), detectionWorker_, SLOT(deleteLater()));
+	connect(detectionWorker_, SIGNAL(detected(const cv::Mat &, const find_object::DetectionInfo &, bool)), this, SLOT(detectionDone(const cv::Mat &, const find_object::DetectionInfo &, bool)));
+	refreshTimer_.setSingleShot(true);
+	connect(&refreshTimer_, SIGNAL(timeout()), this, SLOT(showPendingDetection()));
+	lastRefreshTime_.start();
+	detectionThread_->start();
+
 	ui_ = new Ui_mainWindow();
 	ui_->setupUi(this);
 	aboutDialog_ = new AboutDialog(this);
@@ -107,6 +124,7 @@ MainWindow::MainWindow(FindObject * findObject, Camera * camera, QWidget * paren
 	ui_->dockWidget_statistics->setVisible(false);
 	ui_->dockWidget_parameters->setVisible(false);
 	ui_->dockWidget_plot->setVisible(false);
+	ui_->dockWidget_objectCosts->setVisible(false);
 	ui_->widget_controls->setVisible(false);
 
 	QByteArray geometry;
@@ -166,6 +184,16 @@ MainWindow::MainWindow(FindObject * findObject, Camera * camera, QWidget * paren
 	ui_->menuView->addAction(ui_->dockWidget_parameters->toggleViewAction());
 	ui_->menuView->addAction(ui_->dockWidget_objects->toggleViewAction());
 	ui_->menuView->addAction(ui_->dockWidget_plot->toggleViewAction());
+	ui_->menuView->addAction(ui_->dockWidget_objectCosts->toggleViewAction());
+	ui_->tableWidget_objectCosts->setColumnCount(11);
+	ui_->tableWidget_objectCosts->setHorizontalHeaderLabels(QStringList()
+			<< tr("ID") << tr("File") << tr("Features") << tr("Words") << tr("Matched") << tr("Matches")
+			<< tr("Homographies") << tr("Homography (ms)") << tr("Detected") << tr("Detection rate") << tr("Rejections"));
+	ui_->tableWidget_objectCosts->setToolTip(tr("Costs of the objects in the scenes searched since the last reset: "
+			"scenes where the object has matches, matches, homographies computed and their time, scenes where "
+			"the object is detected and why it was rejected."));
+	connect(ui_->dockWidget_objectCosts, SIGNAL(visibilityChanged(bool)), this, SLOT(updateObjectCosts()));
+	connect(ui_->pushButton_resetObjectCosts, SIGNAL(clicked()), this, SLOT(resetObjectCosts()));
 	connect(ui_->toolBox, SIGNAL(parametersChanged(const QStringList &)), this, SLOT(notifyParametersChanged(const QStringList &)));
 
 	ui_->imageView_source->setTextLabel(tr("Press \"space\" to start the camera or drop an image here..."));
@@ -210,6 +238,8 @@ MainWindow::MainWindow(FindObject * findObject, Camera * camera, QWidget * paren
 	connect(ui_->actionSave_settings, SIGNAL(triggered()), this, SLOT(saveSettings()));
 	connect(ui_->actionLoad_settings, SIGNAL(triggered()), this, SLOT(loadSettings()));
 	connect(ui_->actionSave_session, SIGNAL(triggered()), this, SLOT(saveSession()));
+	connect(ui_->actionSave_trace, SIGNAL(triggered()), this, SLOT(saveTrace()));
+	ui_->actionSave_trace->setVisible(Trace::isCompiled()); // see WITH_TRACE
 	connect(ui_->actionLoad_session, SIGNAL(triggered()), this, SLOT(loadSession()));
 	connect(ui_->actionSave_vocabulary, SIGNAL(triggered()), this, SLOT(saveVocabulary()));
 	connect(ui_->actionLoad_vocabulary, SIGNAL(triggered()), this, SLOT(loadVocabulary()));
@@ -289,6 +319,9 @@ MainWindow::~MainWindow()
 	disconnect(camera_, SIGNAL(imageReceived(const cv::Mat &)), this, SLOT(update(const cv::Mat &)));
 	disconnect(camera_, SIGNAL(finished()), this, SLOT(stopProcessing()));
 	camera_->stop();
+	// wait for the detection in progress
+	detectionThread_->quit();
+	detectionThread_->wait();
 	qDeleteAll(objWidgets_);
 	objWidgets_.clear();
 	delete ui_;
@@ -389,10 +422,11 @@ void MainWindow::loadSession()
 
 		if(findObject_->loadSession(path))
 		{
-			//update parameters tool box
-			const ParametersMap & parameters = Settings::getParameters();
+			//update parameters tool box with the parameters of the session
+			const ParametersMap parameters = findObject_->parameters();
 			for(ParametersMap::const_iterator iter = parameters.begin(); iter!= parameters.constEnd(); ++iter)
 			{
+				Settings::setParameter(iter.key(), iter.value());
 				ui_->toolBox->updateParameter(iter.key());
 			}
 
@@ -440,6 +474,27 @@ void MainWindow::saveSession()
 	}
 }
 
+void MainWindow::saveTrace()
+{
+	QString path = QFileDialog::getSaveFileName(this, tr("Save trace..."), Settings::workingDirectory(), "*.json");
+	if(!path.isEmpty())
+	{
+		if(QFileInfo(path).suffix().compare("json") != 0)
+		{
+			path.append(".json");
+		}
+
+		if(Trace::save(path))
+		{
+			QMessageBox::information(this, tr("Trace saved!"), tr("Trace \"%1\" successfully saved, open it in chrome://tracing or https://ui.perfetto.dev.").arg(path));
+		}
+		else
+		{
+			QMessageBox::warning(this, tr("Save trace..."), tr("Cannot write trace \"%1\".").arg(path));
+		}
+	}
+}
+
 void MainWindow::loadSettings()
 {
 	QString path = QFileDialog::getOpenFileName(this, tr("Load settings..."), Settings::workingDirectory(), "*.ini");
@@ -472,6 +527,7 @@ bool MainWindow::loadSettings(const QString & path)
 		QByteArray geometry;
 		QByteArray state;
 		Settings::loadSettings(path);
+		findObject_->setParameters(Settings::getParameters());
 		Settings::loadWindowSettings(geometry, state, path);
 		this->restoreGeometry(geometry);
 		this->restoreState(state);
@@ -630,6 +686,7 @@ void MainWindow::loadVocabulary()
 		{
 			Settings::setGeneral_vocabularyFixed(true);
 			Settings::setGeneral_invertedSearch(true);
+			findObject_->setParameters(Settings::getParameters());
 		}
 	}
 	if(Settings::getGeneral_vocabularyFixed() &&
@@ -1032,6 +1089,7 @@ void MainWindow::showObject(ObjWidget * obj)
 		obj->setMirrorView(ui_->imageView_source->isMirrorView());
 		QList<ObjWidget*> objs = ui_->objects_area->findChildren<ObjWidget*>();
 		QVBoxLayout * vLayout = new QVBoxLayout();
+		Settings::setGeneral_nextObjID(findObject_->parameters().value(Settings::kGeneral_nextObjID()).toUInt());
 		ui_->toolBox->updateParameter(Settings::kGeneral_nextObjID());
 
 		QLabel * title = new QLabel(QString("%1 (%2)").arg(obj->id()).arg(obj->keypoints().size()), this);
@@ -1290,7 +1348,86 @@ void MainWindow::update(const cv::Mat & image)
 		UWARN("The image received is empty...");
 		return;
 	}
-	sceneImage_ = image.clone();
+	detectionWorker_->post(image, camera_ && camera_->isRunning()?camera_->streamId():-1);
+}
+
+void MainWindow::detectionDone(const cv::Mat & image, const DetectionInfo & info, bool detected)
+{
+	// Published for every detection, even those replaced before being shown
+	if(detected)
+	{
+		if(info.objDetected_.size() > 1)
+		{
+			UINFO("(%s) %d objects detected!",
+					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str(),
+					(int)info.objDetected_.size());
+		}
+		else if(info.objDetected_.size() == 1)
+		{
+			UINFO("(%s) Object %d detected!",
+					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str(),
+					(int)info.objDetected_.begin().key());
+		}
+		else if(Settings::getGeneral_sendNoObjDetectedEvents())
+		{
+			UINFO("(%s) No objects detected.",
+					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str());
+		}
+
+		if(info.objDetected_.size() > 0 || Settings::getGeneral_sendNoObjDetectedEvents())
+		{
+			Q_EMIT objectsFound(info);
+		}
+
+		if(info.objDetected_.size() && camera_->isRunning() && Settings::getGeneral_autoPauseOnDetection())
+		{
+			this->pauseProcessing();
+		}
+	}
+
+	if(detectionPending_)
+	{
+		UDEBUG("Detection not shown, replaced by a newer one");
+	}
+	pendingImage_ = image;
+	pendingInfo_ = info;
+	pendingDetected_ = detected;
+	detectionPending_ = true;
+
+	// Shown right away if the last refresh is old enough, or for a screenshot of the detection
+	int rate = Settings::getGeneral_guiRefreshRate();
+	int wait = rate>0?1000/rate - lastRefreshTime_.elapsed():0;
+	if(wait <= 0 || (detected && info.objDetected_.size() && !Settings::getGeneral_autoScreenshotPath().isEmpty()))
+	{
+		refreshTimer_.stop();
+		showPendingDetection();
+	}
+	else if(!refreshTimer_.isActive())
+	{
+		refreshTimer_.start(wait);
+	}
+}
+
+void MainWindow::showPendingDetection()
+{
+	if(detectionPending_)
+	{
+		detectionPending_ = false;
+		lastRefreshTime_.start();
+		int skipped = detectionWorker_->takeSkipped();
+		if(skipped)
+		{
+			UDEBUG("%d images skipped while detecting", skipped);
+		}
+		showDetection(pendingImage_, pendingInfo_, pendingDetected_);
+		pendingImage_ = cv::Mat();
+		pendingInfo_ = DetectionInfo();
+	}
+}
+
+void MainWindow::showDetection(const cv::Mat & image, DetectionInfo & info, bool detected)
+{
+	sceneImage_ = image;
 
 	// reset objects color
 	for(QMap<int, ObjWidget*>::iterator iter=objWidgets_.begin(); iter!=objWidgets_.end(); ++iter)
@@ -1304,8 +1441,7 @@ void MainWindow::update(const cv::Mat & image)
 
 	QTime guiRefreshTime;
 
-	DetectionInfo info;
-	if(findObject_->detect(sceneImage_, info))
+	if(detected)
 	{
 		guiRefreshTime.start();
 		ui_->label_timeDetection->setNum(info.timeStamps_.value(DetectionInfo::kTimeKeypointDetection, 0));
@@ -1321,10 +1457,11 @@ void MainWindow::update(const cv::Mat & image)
 		ui_->label_timeMatching->setNum(info.timeStamps_.value(DetectionInfo::kTimeMatching, 0));
 		ui_->label_timeHomographies->setNum(info.timeStamps_.value(DetectionInfo::kTimeHomography, 0));
 
-		ui_->label_vocabularySize->setNum(findObject_->vocabulary()->size());
+		// In not inverted search, the vocabulary is created from the scene
+		ui_->label_vocabularySize->setNum(Settings::getGeneral_invertedSearch()?findObject_->vocabulary()->size():info.sceneWords_.uniqueKeys().size());
 
 		// Colorize features matched
-		const QMap<int, QMultiMap<int, int> > & matches = info.matches_;
+		const QMap<int, QMultiMap<int, int> > matches = info.matches_.toMap();
 		QMap<int, int> scores;
 		int maxScoreId = -1;
 		int maxScore = 0;
@@ -1339,13 +1476,16 @@ void MainWindow::update(const cv::Mat & image)
 
 			int id = jter.key();
 			QLabel * label = ui_->dockWidget_objects->findChild<QLabel*>(QString("%1detection").arg(id));
+			ObjWidget * obj = objWidgets_.value(id);
+			if(obj == 0 || label == 0)
+			{
+				// removed while the scene was detected
+				continue;
+			}
 			if(!Settings::getHomography_homographyComputed())
 			{
 				label->setText(QString("%1 matches").arg(jter.value().size()));
 
-				ObjWidget * obj = objWidgets_.value(id);
-				UASSERT(obj != 0);
-
 				for(QMultiMap<int, int>::const_iterator iter = jter.value().constBegin(); iter!= jter.value().constEnd(); ++iter)
 				{
 					obj->setKptColor(iter.key(), obj->color());
@@ -1387,19 +1527,28 @@ void MainWindow::update(const cv::Mat & image)
 				{
 					label->setText(QString("Angle too small (%1 in %2 out)").arg(rejectedInliers.size()).arg(rejectedOutliers.size()));
 				}
+				else if(rejectedCode == DetectionInfo::kRejectedLowScore)
+				{
+					label->setText(QString("Not in best candidates (%1 matches)").arg(jter.value().size()));
+				}
+				else if(rejectedCode == DetectionInfo::kRejectedInconsistent)
+				{
+					label->setText(QString("Inconsistent matches (%1 matches)").arg(jter.value().size()));
+				}
+				else if(rejectedCode == DetectionInfo::kRejectedCascade)
+				{
+					label->setText(QString("Not found by the cascade"));
+				}
 			}
 		}
 
-		if(info.objDetected_.size() && camera_->isRunning() && Settings::getGeneral_autoPauseOnDetection())
-		{
-			this->pauseProcessing();
-		}
-
 		// Add homography rectangles when homographies are computed
 		int maxHomographyScoreId = -1;
 		int maxHomographyScore = 0;
-		QMultiMap<int, QMultiMap<int,int> >::const_iterator inliersIter = info.objDetectedInliers_.constBegin();
-		QMultiMap<int, QMultiMap<int,int> >::const_iterator outliersIter = info.objDetectedOutliers_.constBegin();
+		const QMultiMap<int, QMultiMap<int,int> > objDetectedInliers = info.objDetectedInliers_.toMultiMap();
+		const QMultiMap<int, QMultiMap<int,int> > objDetectedOutliers = info.objDetectedOutliers_.toMultiMap();
+		QMultiMap<int, QMultiMap<int,int> >::const_iterator inliersIter = objDetectedInliers.constBegin();
+		QMultiMap<int, QMultiMap<int,int> >::const_iterator outliersIter = objDetectedOutliers.constBegin();
 		for(QMultiMap<int,QTransform>::iterator iter = info.objDetected_.begin();
 				iter!=info.objDetected_.end();
 				++iter, ++inliersIter, ++outliersIter)
@@ -1413,7 +1562,11 @@ void MainWindow::update(const cv::Mat & image)
 			}
 
 			ObjWidget * obj = objWidgets_.value(id);
-			UASSERT(obj != 0);
+			if(obj == 0)
+			{
+				// removed while the scene was detected
+				continue;
+			}
 
 			// COLORIZE (should be done in the GUI thread)
 			QTransform hTransform = iter.value();
@@ -1528,29 +1681,6 @@ void MainWindow::update(const cv::Mat & image)
 			}
 		}
 
-		// Emit homographies
-		if(info.objDetected_.size() > 1)
-		{
-			UINFO("(%s) %d objects detected!",
-					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str(),
-					(int)info.objDetected_.size());
-		}
-		else if(info.objDetected_.size() == 1)
-		{
-			UINFO("(%s) Object %d detected!",
-					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str(),
-					(int)info.objDetected_.begin().key());
-		}
-		else if(Settings::getGeneral_sendNoObjDetectedEvents())
-		{
-			UINFO("(%s) No objects detected.",
-					QTime::currentTime().toString("HH:mm:ss.zzz").toStdString().c_str());
-		}
-
-		if(info.objDetected_.size() > 0 || Settings::getGeneral_sendNoObjDetectedEvents())
-		{
-			Q_EMIT objectsFound(info);
-		}
 		ui_->label_objectsDetected->setNum(info.objDetected_.size());
 	}
 	else
@@ -1611,11 +1741,72 @@ void MainWindow::update(const cv::Mat & image)
 		refreshStartTime_.start();
 	}
 
+	// the costs are refreshed at most each second
+	if(ui_->dockWidget_objectCosts->isVisible() && (objectCostsTime_.isNull() || objectCostsTime_.elapsed() > 1000))
+	{
+		updateObjectCosts();
+	}
+
 	ui_->label_timeRefreshGUI->setNum(guiRefreshTime.elapsed());
 }
 
+static QTableWidgetItem * costItem(const QVariant & value)
+{
+	// numbers are sorted as numbers
+	QTableWidgetItem * item = new QTableWidgetItem();
+	item->setData(Qt::DisplayRole, value);
+	return item;
+}
+
+void MainWindow::updateObjectCosts()
+{
+	if(!ui_->dockWidget_objectCosts->isVisible())
+	{
+		return;
+	}
+	qint64 scenes = 0;
+	QMap<int, ObjectCost> costs = findObject_->objectCosts(&scenes);
+	QTableWidget * table = ui_->tableWidget_objectCosts;
+	table->setSortingEnabled(false); // rows are sorted once filled
+	table->setRowCount(costs.size());
+	int row = 0;
+	for(QMap<int, ObjectCost>::const_iterator iter=costs.constBegin(); iter!=costs.constEnd(); ++iter, ++row)
+	{
+		const ObjectCost & cost = iter.value();
+		QStringList rejections;
+		for(QMap<int, qint64>::const_iterator jter=cost.rejections.constBegin(); jter!=cost.rejections.constEnd(); ++jter)
+		{
+			rejections.append(QString("%1:%2").arg(DetectionMetrics::rejectedCodeName((DetectionInfo::RejectedCode)jter.key())).arg(jter.value()));
+		}
+		const ObjSignature * obj = findObject_->objects().value(iter.key(), 0);
+		table->setItem(row, 0, costItem(iter.key()));
+		table->setItem(row, 1, new QTableWidgetItem(obj?QFileInfo(obj->filePath()).fileName():QString()));
+		table->setItem(row, 2, costItem(cost.features));
+		table->setItem(row, 3, costItem(cost.words));
+		table->setItem(row, 4, costItem(cost.matched));
+		table->setItem(row, 5, costItem(cost.matches));
+		table->setItem(row, 6, costItem(cost.homographies));
+		table->setItem(row, 7, costItem(qRound(cost.homographyTime*10.0)/10.0));
+		table->setItem(row, 8, costItem(cost.detected));
+		table->setItem(row, 9, costItem(scenes?qRound(double(cost.detected)/double(scenes)*1000.0)/1000.0:0.0));
+		table->setItem(row, 10, new QTableWidgetItem(rejections.join(" ")));
+	}
+	table->setSortingEnabled(true);
+	ui_->label_objectCostsScenes->setText(tr("%1 scenes").arg(scenes));
+	objectCostsTime_.start();
+}
+
+void MainWindow::resetObjectCosts()
+{
+	findObject_->resetObjectCosts();
+	updateObjectCosts();
+}
+
 void MainWindow::notifyParametersChanged(const QStringList & paramChanged)
 {
+	findObject_->setParameters(Settings::getParameters());
+	FindObject::setImageCacheSize(Settings::getGeneral_imageCacheSize());
+
 	//Selective update (to not update all objects for a simple camera's parameter modification)
 	bool detectorDescriptorParamsChanged = false;
 	bool nearestNeighborParamsChanged = false;
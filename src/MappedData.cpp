@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "MappedData.h"
+#include "find_object/utilite/ULogger.h"
+#include <QtCore/QIODevice>
+
+namespace find_object {
+
+static const qint64 kMappedBlockAlignment = 64; // cache line
+
+void writeMappedBlock(QDataStream & stream, const void * data, qint64 size)
+{
+	UASSERT(stream.device() != 0);
+	stream << size;
+	qint64 pos = stream.device()->pos();
+	qint64 padding = (kMappedBlockAlignment - pos % kMappedBlockAlignment) % kMappedBlockAlignment;
+	static const char zeros[kMappedBlockAlignment] = {0};
+	stream.writeRawData(zeros, (int)padding);
+	const char * ptr = (const char *)data;
+	while(size > 0)
+	{
+		// writeRawData() takes an int
+		int chunk = size > (1<<30)?(1<<30):(int)size;
+		stream.writeRawData(ptr, chunk);
+		ptr += chunk;
+		size -= chunk;
+	}
+}
+
+const uchar * readMappedBlock(QDataStream & stream, const uchar * base, qint64 & size)
+{
+	UASSERT(stream.device() != 0);
+	stream >> size;
+	qint64 pos = stream.device()->pos();
+	pos += (kMappedBlockAlignment - pos % kMappedBlockAlignment) % kMappedBlockAlignment;
+	if(size < 0 || pos + size > stream.device()->size())
+	{
+		UERROR("Invalid block (size=%lld at %lld, file size=%lld)", size, pos, stream.device()->size());
+		stream.setStatus(QDataStream::ReadCorruptData);
+		size = 0;
+		return 0;
+	}
+	stream.device()->seek(pos + size);
+	return base + pos;
+}
+
+void writeMappedMat(QDataStream & stream, const cv::Mat & data)
+{
+	cv::Mat mat = data.isContinuous()?data:data.clone();
+	stream << mat.rows << mat.cols << mat.type();
+	writeMappedBlock(stream, mat.data, qint64(mat.total())*qint64(mat.elemSize()));
+}
+
+cv::Mat readMappedMat(QDataStream & stream, const uchar * base)
+{
+	int rows, cols, type;
+	stream >> rows >> cols >> type;
+	qint64 size = 0;
+	const uchar * data = readMappedBlock(stream, base, size);
+	if(data && rows > 0 && cols > 0)
+	{
+		cv::Mat mat(rows, cols, type, (void*)data);
+		if(qint64(mat.total())*qint64(mat.elemSize()) == size)
+		{
+			return mat;
+		}
+		UERROR("Invalid matrix block (%dx%d type=%d, size=%lld)", rows, cols, type, size);
+	}
+	return cv::Mat();
+}
+
+} // namespace find_object
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef OBJSIGNATURE_H_
 #define OBJSIGNATURE_H_
 
+#include "find_object/utilite/ULogger.h"
 #include <opencv2/opencv.hpp>
 #include <QtCore/QString>
 #include <QtCore/QMultiMap>
@@ -35,22 +36,31 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QtCore/QDataStream>
 #include <QtCore/QByteArray>
 #include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QtEndian>
 #include <Compression.h>
+#include <ScalarQuantizer.h>
+#include <ObjectImageCache.h>
+#include <MappedData.h>
 
 namespace find_object {
 
 class ObjSignature {
 public:
 	ObjSignature() :
-		id_(-1)
+		id_(-1),
+		pyramidWinSize_(0),
+		pyramidMaxLevel_(0)
 	{}
 	ObjSignature(int id, const cv::Mat & image, const QString & filePath) :
 		id_(id),
 		image_(image),
 		rect_(0,0,image.cols, image.rows),
-		filePath_(filePath)
+		filePath_(filePath),
+		pyramidWinSize_(0),
+		pyramidMaxLevel_(0)
 	{}
-	virtual ~ObjSignature() {}
+	virtual ~ObjSignature() {ObjectImageCache::instance().remove(this);}
 
 	void setData(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors)
 	{
@@ -58,38 +68,257 @@ public:
 		descriptors_ = descriptors;
 	}
 	void setWords(const QMultiMap<int, int> & words) {words_ = words;}
+	// Same descriptors, viewed in a matrix shared with other objects or the vocabulary
+	void setDescriptors(const cv::Mat & descriptors)
+	{
+		UASSERT(descriptors.rows == descriptors_.rows && descriptors.cols == descriptors_.cols && descriptors.type() == descriptors_.type());
+		descriptors_ = descriptors;
+	}
 	void setId(int id) {id_ = id;}
-	void removeImage() {image_ = cv::Mat();}
+	// Bytes of the image file, saved in sessions instead of encoding the image again
+	void setEncodedImage(const QByteArray & bytes) {encodedImage_ = bytes;}
+	void removeImage()
+	{
+		image_ = cv::Mat();
+		encodedImage_.clear();
+		ObjectImageCache::instance().remove(this);
+		clearPyramid();
+	}
+	// Only the encoded image is kept, it is decoded again when needed
+	// (see image()). Same as removeImage() without encoded image.
+	void releaseImage()
+	{
+		image_ = cv::Mat();
+		clearPyramid();
+	}
+	bool hasImage() const {return !image_.empty() || !encodedImage_.isEmpty();}
 
 	const QRect & rect() const {return rect_;}
 
 	int id() const {return id_;}
 	const QString & filePath() const {return filePath_;}
-	const cv::Mat & image() const {return image_;}
+	// Decoded in the ObjectImageCache if the image is released
+	cv::Mat image() const
+	{
+		if(!image_.empty() || encodedImage_.isEmpty())
+		{
+			return image_;
+		}
+		cv::Mat image = ObjectImageCache::instance().get(this);
+		if(image.empty())
+		{
+			image = cv::imdecode(cv::Mat(1, encodedImage_.size(), CV_8UC1, (void*)encodedImage_.constData()), cv::IMREAD_UNCHANGED);
+			if(!image.empty())
+			{
+				ObjectImageCache::instance().insert(this, image);
+			}
+		}
+		return image;
+	}
 	const std::vector<cv::KeyPoint> & keypoints() const {return keypoints_;}
 	const cv::Mat & descriptors() const {return descriptors_;}
 	const QMultiMap<int, int> & words() const {return words_;}
+	// Bytes of the decoded and encoded images and of the pyramid (not the cache)
+	qint64 imageBytes() const
+	{
+		qint64 bytes = qint64(image_.total()*image_.elemSize()) + encodedImage_.size();
+		QMutexLocker locker(&pyramidMutex_);
+		for(unsigned int i=0; i<pyramid_.size(); ++i)
+		{
+			// levels are views of padded matrices
+			if(pyramid_[i].datastart)
+			{
+				bytes += qint64(pyramid_[i].dataend - pyramid_[i].datastart);
+			}
+		}
+		return bytes;
+	}
+
+	// Pyramid of the image for the optical flow (see Homography/opticalFlow),
+	// zero padded to the scene size. Computed on first use, then kept until
+	// the scene size or the pyramid parameters change. Empty if the image
+	// is not kept in RAM or is larger than the scene.
+	std::vector<cv::Mat> opticalFlowPyramid(const cv::Size & sceneSize, int winSize, int maxLevel) const
+	{
+		QMutexLocker locker(&pyramidMutex_);
+		if(pyramidSceneSize_ != sceneSize || pyramidWinSize_ != winSize || pyramidMaxLevel_ != maxLevel)
+		{
+			pyramid_.clear();
+			pyramidSceneSize_ = sceneSize;
+			pyramidWinSize_ = winSize;
+			pyramidMaxLevel_ = maxLevel;
+			cv::Mat image = this->image();
+			if(!image.empty() && (image.channels() != 1 || image.depth() != CV_8U))
+			{
+				// objects added in color, the scene pyramid is grayscale
+				cv::Mat grayscaleImg;
+				cv::cvtColor(image, grayscaleImg, cv::COLOR_BGR2GRAY);
+				image = grayscaleImg;
+			}
+			if(!image.empty() && image.cols <= sceneSize.width && image.rows <= sceneSize.height)
+			{
+				// levels and derivatives of the object only
+				std::vector<cv::Mat> pyramid;
+				int levels = cv::buildOpticalFlowPyramid(image, pyramid, cv::Size(winSize, winSize), maxLevel);
+				if(image.size() == sceneSize)
+				{
+					pyramid_ = pyramid;
+				}
+				else
+				{
+					// padding, optical flow wants images of the same size: each
+					// level is copied in a zero level of the scene size instead
+					// of building the pyramid of a padded image
+					pyramid_.resize(pyramid.size());
+					cv::Size size = sceneSize;
+					for(int level=0; level<=levels; ++level)
+					{
+						if(level > 0)
+						{
+							size = cv::Size((size.width+1)/2, (size.height+1)/2);
+						}
+						for(int k=0; k<2 && level*2+k<(int)pyramid.size(); ++k)
+						{
+							// with the top and left borders, the right and bottom ones are zeros
+							cv::Mat src = pyramid[level*2+k];
+							src.adjustROI(winSize, 0, winSize, 0);
+							cv::Mat & dst = pyramid_[level*2+k];
+							dst = cv::Mat::zeros(size.height + winSize*2, size.width + winSize*2, src.type());
+							src.copyTo(dst(cv::Rect(0, 0, src.cols, src.rows)));
+							dst.adjustROI(-winSize, -winSize, -winSize, -winSize);
+						}
+					}
+				}
+			}
+		}
+		if(image_.empty())
+		{
+			// released image: the pyramid is not kept either
+			std::vector<cv::Mat> pyramid;
+			pyramid.swap(pyramid_);
+			pyramidSceneSize_ = cv::Size();
+			return pyramid;
+		}
+		return pyramid_;
+	}
 
-	void save(QDataStream & streamPtr) const
+	// Keypoints packed in a single block, little-endian: x, y, size, angle,
+	// response (float) and octave, class_id (int) per keypoint
+	static const int kPackedKeypointSize = 28;
+	cv::Mat packedKeypoints() const
 	{
+		cv::Mat packed;
+		if(keypoints_.empty())
+		{
+			return packed;
+		}
+		packed = cv::Mat(1, (int)keypoints_.size()*kPackedKeypointSize, CV_8UC1);
+		unsigned char * p = packed.data;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+		if(sizeof(cv::KeyPoint) == kPackedKeypointSize)
+		{
+			// same layout
+			memcpy(p, &keypoints_[0], packed.cols);
+			return packed;
+		}
+#endif
+		for(unsigned int j=0; j<keypoints_.size(); ++j)
+		{
+			const cv::KeyPoint & kpt = keypoints_[j];
+			float f[5] = {kpt.pt.x, kpt.pt.y, kpt.size, kpt.angle, kpt.response};
+			for(int k=0; k<5; ++k)
+			{
+				quint32 v;
+				memcpy(&v, &f[k], 4);
+				qToLittleEndian(v, p);
+				p+=4;
+			}
+			qToLittleEndian((qint32)kpt.octave, p);
+			qToLittleEndian((qint32)kpt.class_id, p+4);
+			p+=8;
+		}
+		return packed;
+	}
+
+	// With chunkedDescriptors (see compressDataChunked()), the descriptors
+	// compressed aside are saved instead, without limit of size, same for
+	// the packedKeypoints() with chunkedKeypoints. With quantization (see
+	// ScalarQuantizer::Type), float descriptors are saved quantized, they
+	// are loaded back as float. With legacyFormat (see General/sessionLegacyFormat),
+	// the keypoints are saved field by field and the descriptors in a single
+	// zlib block, as read by older versions.
+	void save(QDataStream & streamPtr, const std::vector<unsigned char> * chunkedDescriptors = 0, int quantization = 0, const std::vector<unsigned char> * chunkedKeypoints = 0, bool legacyFormat = false) const
+	{
+		UASSERT(!legacyFormat || (chunkedDescriptors == 0 && quantization <= 0 && chunkedKeypoints == 0));
 		streamPtr << id_;
 		streamPtr << filePath_;
-		streamPtr << (int)keypoints_.size();
-		for(unsigned int j=0; j<keypoints_.size(); ++j)
+		if(legacyFormat)
+		{
+			// old: keypoints count then the fields of each keypoint
+			streamPtr << (int)keypoints_.size();
+			for(unsigned int j=0; j<keypoints_.size(); ++j)
+			{
+					streamPtr << keypoints_.at(j).angle <<
+									keypoints_.at(j).class_id <<
+									keypoints_.at(j).octave <<
+									keypoints_.at(j).pt.x <<
+									keypoints_.at(j).pt.y <<
+									keypoints_.at(j).response <<
+									keypoints_.at(j).size;
+			}
+		}
+		else
+		{
+			// kPackedKeypoints instead of the count: older versions cannot read it
+			streamPtr << kPackedKeypoints << (int)keypoints_.size();
+			if(chunkedKeypoints)
+			{
+				int compressed = 1;
+				qint64 size = chunkedKeypoints->size();
+				streamPtr << compressed << size;
+				writeRawData64(streamPtr, chunkedKeypoints->data(), size);
+			}
+			else
+			{
+				int compressed = 0;
+				cv::Mat packed = packedKeypoints();
+				qint64 size = packed.cols;
+				streamPtr << compressed << size;
+				writeRawData64(streamPtr, packed.data, size);
+			}
+		}
+
+		int old = 0;
+		ScalarQuantizer quantizer;
+		if(quantization > 0 &&
+		   !descriptors_.empty() &&
+		   descriptors_.type() == CV_32FC1 &&
+		   quantizer.train(descriptors_, quantization))
 		{
-				streamPtr << keypoints_.at(j).angle <<
-								keypoints_.at(j).class_id <<
-								keypoints_.at(j).octave <<
-								keypoints_.at(j).pt.x <<
-								keypoints_.at(j).pt.y <<
-								keypoints_.at(j).response <<
-								keypoints_.at(j).size;
+			// old: rows, cols, type (type=3: quantized descriptors)
+			int quantized = 3;
+			std::vector<unsigned char> bytes = compressData(quantizer.encode(descriptors_));
+			qint64 dataSize = bytes.size();
+			streamPtr << old << old << quantized << dataSize;
+			streamPtr << quantizer.type() << quantizer.offset() << quantizer.scale();
+			writeRawData64(streamPtr, bytes.data(), dataSize);
+			saveWordsAndImage(streamPtr);
+			return;
+		}
+		if(chunkedDescriptors)
+		{
+			// old: rows, cols, type (type=2: chunked compression)
+			int chunked = 2;
+			qint64 chunkedSize = chunkedDescriptors->size();
+			streamPtr << old << old << chunked << chunkedSize;
+			writeRawData64(streamPtr, chunkedDescriptors->data(), chunkedSize);
+			saveWordsAndImage(streamPtr);
+			return;
 		}
 
 		std::vector<unsigned char> bytes  = compressData(descriptors_);
 
 		qint64 dataSize = bytes.size();
-		int old = 0;
 		if(dataSize <= std::numeric_limits<int>::max())
 		{
 			// old: rows, cols, type
@@ -99,15 +328,25 @@ public:
 		else
 		{
 			UERROR("Descriptors (compressed) are too large (%d MB) to be saved! Limit is 2 GB (based on max QByteArray size).",
-					dataSize/(1024*1024));
+					int(dataSize/(1024*1024)));
 			// old: rows, cols, type, dataSize
 			streamPtr << old << old << old << old;
 			streamPtr << QByteArray(); // empty
 		}
 
+		saveWordsAndImage(streamPtr);
+	}
+
+private:
+	void saveWordsAndImage(QDataStream & streamPtr) const
+	{
 		streamPtr << words_;
 
-		if(!image_.empty())
+		if(!encodedImage_.isEmpty())
+		{
+			streamPtr << encodedImage_;
+		}
+		else if(!image_.empty())
 		{
 			std::vector<unsigned char> bytes;
 			QString ext = QFileInfo(filePath_).suffix();
@@ -130,27 +369,88 @@ public:
 		streamPtr << rect_;
 	}
 
+public:
 	void load(QDataStream & streamPtr, bool ignoreImage)
 	{
 		int nKpts;
 		streamPtr >> id_ >> filePath_ >> nKpts;
-		keypoints_.resize(nKpts);
-		for(int i=0;i<nKpts;++i)
+		if(nKpts == kPackedKeypoints)
 		{
-				streamPtr >>
-				keypoints_[i].angle >>
-				keypoints_[i].class_id >>
-				keypoints_[i].octave >>
-				keypoints_[i].pt.x >>
-				keypoints_[i].pt.y >>
-				keypoints_[i].response >>
-				keypoints_[i].size;
+			int compressed;
+			qint64 size;
+			streamPtr >> nKpts >> compressed >> size;
+			std::vector<unsigned char> data(size>0?size:0);
+			if(size > 0 && readRawData64(streamPtr, data.data(), size))
+			{
+				if(compressed)
+				{
+					cv::Mat packed = uncompressDataChunked(data.data(), size);
+					unpackKeypoints(packed.data, packed.total()*packed.elemSize(), nKpts);
+				}
+				else
+				{
+					unpackKeypoints(data.data(), size, nKpts);
+				}
+			}
+			else
+			{
+				if(size)
+				{
+					UERROR("Error reading keypoints for object=%d", id_);
+				}
+				keypoints_.clear();
+			}
+		}
+		else
+		{
+			// old format
+			keypoints_.resize(nKpts);
+			for(int i=0;i<nKpts;++i)
+			{
+					streamPtr >>
+					keypoints_[i].angle >>
+					keypoints_[i].class_id >>
+					keypoints_[i].octave >>
+					keypoints_[i].pt.x >>
+					keypoints_[i].pt.y >>
+					keypoints_[i].response >>
+					keypoints_[i].size;
+			}
 		}
 
 		int rows,cols,type;
 		qint64 dataSize;
 		streamPtr >> rows >> cols >> type >> dataSize;
-		if(rows == 0 && cols == 0 && type == 0)
+		if(rows == 0 && cols == 0 && type == 2)
+		{
+			// chunked compression, 64 bits size
+			std::vector<unsigned char> data(dataSize>0?dataSize:0);
+			if(dataSize > 0 && readRawData64(streamPtr, data.data(), dataSize))
+			{
+				descriptors_ = uncompressDataChunked(data.data(), dataSize);
+			}
+			else if(dataSize)
+			{
+				UERROR("Error reading descriptor data for object=%d", id_);
+			}
+		}
+		else if(rows == 0 && cols == 0 && type == 3)
+		{
+			// quantized descriptors
+			int quantization;
+			float offset, scale;
+			streamPtr >> quantization >> offset >> scale;
+			std::vector<unsigned char> data(dataSize>0?dataSize:0);
+			if(dataSize > 0 && readRawData64(streamPtr, data.data(), dataSize))
+			{
+				descriptors_ = ScalarQuantizer(quantization, offset, scale, uncompressData(data.data(), dataSize)).reconstruct();
+			}
+			else if(dataSize)
+			{
+				UERROR("Error reading descriptor data for object=%d", id_);
+			}
+		}
+		else if(rows == 0 && cols == 0 && type == 0)
 		{
 			// compressed descriptors
 			UASSERT(dataSize <= std::numeric_limits<int>::max());
@@ -175,26 +475,159 @@ public:
 
 		streamPtr >> words_;
 
-		QByteArray image;
-		streamPtr >> image;
-		if(!ignoreImage && image.size())
+		// kept encoded, decoded on use when ignoreImage (see image())
+		streamPtr >> encodedImage_;
+		ObjectImageCache::instance().remove(this);
+		image_ = cv::Mat();
+		if(!ignoreImage && encodedImage_.size())
 		{
-			std::vector<unsigned char> bytes(image.size());
-			memcpy(bytes.data(), image.data(), image.size());
-			image_ = cv::imdecode(bytes, cv::IMREAD_UNCHANGED);
+			image_ = cv::imdecode(cv::Mat(1, encodedImage_.size(), CV_8UC1, (void*)encodedImage_.constData()), cv::IMREAD_UNCHANGED);
 		}
 
 		streamPtr >> rect_;
+		clearPyramid();
+	}
+
+	// Memory-mapped session format, descriptors are used in place from the mapped file
+	void saveMapped(QDataStream & streamPtr) const
+	{
+		streamPtr << id_ << filePath_ << rect_ << words_;
+
+		// keypoints: x, y, size, angle, response (float) and octave, class_id (int)
+		cv::Mat kptsFloat((int)keypoints_.size(), 5, CV_32FC1);
+		cv::Mat kptsInt((int)keypoints_.size(), 2, CV_32SC1);
+		for(unsigned int j=0; j<keypoints_.size(); ++j)
+		{
+			float * f = kptsFloat.ptr<float>(j);
+			f[0] = keypoints_[j].pt.x;
+			f[1] = keypoints_[j].pt.y;
+			f[2] = keypoints_[j].size;
+			f[3] = keypoints_[j].angle;
+			f[4] = keypoints_[j].response;
+			int * i = kptsInt.ptr<int>(j);
+			i[0] = keypoints_[j].octave;
+			i[1] = keypoints_[j].class_id;
+		}
+		writeMappedMat(streamPtr, kptsFloat);
+		writeMappedMat(streamPtr, kptsInt);
+		writeMappedMat(streamPtr, descriptors_);
+
+		if(!encodedImage_.isEmpty())
+		{
+			writeMappedBlock(streamPtr, (const unsigned char*)encodedImage_.constData(), (qint64)encodedImage_.size());
+		}
+		else
+		{
+			std::vector<unsigned char> bytes;
+			if(!image_.empty())
+			{
+				QString ext = QFileInfo(filePath_).suffix();
+				cv::imencode(ext.isEmpty()?std::string(".png"):std::string(".")+ext.toStdString(), image_, bytes);
+			}
+			writeMappedBlock(streamPtr, bytes.data(), (qint64)bytes.size());
+		}
+	}
+
+	void loadMapped(QDataStream & streamPtr, const uchar * base, bool ignoreImage)
+	{
+		streamPtr >> id_ >> filePath_ >> rect_ >> words_;
+
+		cv::Mat kptsFloat = readMappedMat(streamPtr, base);
+		cv::Mat kptsInt = readMappedMat(streamPtr, base);
+		keypoints_.resize(kptsFloat.rows);
+		if(kptsFloat.rows && (kptsFloat.cols != 5 || kptsInt.rows != kptsFloat.rows || kptsInt.cols != 2))
+		{
+			UERROR("Invalid keypoints for object=%d", id_);
+			keypoints_.clear();
+		}
+		for(unsigned int j=0; j<keypoints_.size(); ++j)
+		{
+			const float * f = kptsFloat.ptr<float>(j);
+			const int * i = kptsInt.ptr<int>(j);
+			keypoints_[j] = cv::KeyPoint(f[0], f[1], f[2], f[3], f[4], i[0], i[1]);
+		}
+
+		descriptors_ = readMappedMat(streamPtr, base); // view on the mapped file
+
+		qint64 size = 0;
+		const uchar * image = readMappedBlock(streamPtr, base, size);
+		ObjectImageCache::instance().remove(this);
+		image_ = cv::Mat();
+		encodedImage_.clear();
+		if(image && size)
+		{
+			// copied, the objects may outlive the mapping
+			encodedImage_ = QByteArray((const char*)image, (int)size);
+			if(!ignoreImage)
+			{
+				image_ = cv::imdecode(cv::Mat(1, (int)size, CV_8UC1, (void*)image), cv::IMREAD_UNCHANGED);
+			}
+		}
+		clearPyramid();
+	}
+
+private:
+	// written instead of the keypoints count, followed by the packed keypoints
+	static const int kPackedKeypoints = -1;
+
+	void unpackKeypoints(const unsigned char * p, qint64 size, int count)
+	{
+		if(count < 0 || size != qint64(count)*kPackedKeypointSize)
+		{
+			UERROR("Invalid keypoints for object=%d (%d keypoints, %lld bytes)", id_, count, size);
+			keypoints_.clear();
+			return;
+		}
+		keypoints_.resize(count);
+		if(count == 0)
+		{
+			return;
+		}
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+		if(sizeof(cv::KeyPoint) == kPackedKeypointSize)
+		{
+			memcpy(&keypoints_[0], p, size);
+			return;
+		}
+#endif
+		for(int j=0; j<count; ++j)
+		{
+			float f[5];
+			for(int k=0; k<5; ++k)
+			{
+				quint32 v = qFromLittleEndian<quint32>(p);
+				memcpy(&f[k], &v, 4);
+				p+=4;
+			}
+			int octave = qFromLittleEndian<qint32>(p);
+			int classId = qFromLittleEndian<qint32>(p+4);
+			p+=8;
+			keypoints_[j] = cv::KeyPoint(f[0], f[1], f[2], f[3], f[4], octave, classId);
+		}
+	}
+
+	void clearPyramid()
+	{
+		QMutexLocker locker(&pyramidMutex_);
+		pyramid_.clear();
+		pyramidSceneSize_ = cv::Size();
 	}
 
 private:
 	int id_;
 	cv::Mat image_;
+	QByteArray encodedImage_; // image file or session bytes, empty if none
 	QRect rect_;
 	QString filePath_;
 	std::vector<cv::KeyPoint> keypoints_;
 	cv::Mat descriptors_;
 	QMultiMap<int, int> words_; // <word id, keypoint indexes>
+
+	mutable QMutex pyramidMutex_;
+	mutable std::vector<cv::Mat> pyramid_;
+	mutable cv::Size pyramidSceneSize_;
+	mutable int pyramidWinSize_;
+	mutable int pyramidMaxLevel_;
 };
 
 } // namespace find_object
@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "find_object/QtOpenCV.h"
 
 #include "KeypointItem.h"
+#include "KeypointsItem.h"
 
 #include <opencv2/highgui/highgui.hpp>
 
@@ -54,9 +55,21 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace find_object {
 
+static QRectF keypointRect(const cv::KeyPoint & kpt, bool sized)
+{
+	float size = 14;
+	if(sized && kpt.size>14.0f)
+	{
+		size = kpt.size;
+	}
+	float radius = size*1.2f/9.0f*2.0f;
+	return QRectF(kpt.pt.x-radius, kpt.pt.y-radius, radius*2, radius*2);
+}
+
 ObjWidget::ObjWidget(QWidget * parent) :
 	QWidget(parent),
 	id_(0),
+	keypointsItem_(0),
 	graphicsView_(0),
 	graphicsViewInitialized_(false),
 	alpha_(100),
@@ -67,6 +80,7 @@ ObjWidget::ObjWidget(QWidget * parent) :
 ObjWidget::ObjWidget(int id, const std::vector<cv::KeyPoint> & keypoints, const QMultiMap<int,int> & words, const QImage & image, QWidget * parent) :
 	QWidget(parent),
 	id_(id),
+	keypointsItem_(0),
 	graphicsView_(0),
 	graphicsViewInitialized_(false),
 	alpha_(100),
@@ -116,6 +130,10 @@ void ObjWidget::setupUi()
 	sizedFeatures_ = menu_->addAction(tr("Sized features"));
 	sizedFeatures_->setCheckable(true);
 	sizedFeatures_->setChecked(false);
+	batchedFeatures_ = menu_->addAction(tr("Batched features"));
+	batchedFeatures_->setCheckable(true);
+	batchedFeatures_->setChecked(true);
+	batchedFeatures_->setEnabled(false);
 	menu_->addSeparator();
 	setColor_ = menu_->addAction(tr("Set color..."));
 	setAlpha_ = menu_->addAction(tr("Set alpha..."));
@@ -148,6 +166,7 @@ void ObjWidget::setGraphicsViewMode(bool on)
 	graphicsViewMode_->setChecked(on);
 	graphicsView_->setVisible(on && graphicsView_->scene()->items().size());
 	autoScale_->setEnabled(on);
+	batchedFeatures_->setEnabled(on);
 	//update items' color
 	if(on)
 	{
@@ -157,12 +176,7 @@ void ObjWidget::setGraphicsViewMode(bool on)
 		}
 		else
 		{
-			for(int i=0; i<keypointItems_.size(); ++i)
-			{
-				QColor color = kptColors_.at(i);
-				color.setAlpha(alpha_);
-				keypointItems_[i]->setColor(color);
-			}
+			this->updateItemsColor();
 		}
 	}
 	if(autoScale_->isChecked())
@@ -196,17 +210,16 @@ void ObjWidget::setAutoScale(bool autoScale)
 void ObjWidget::setSizedFeatures(bool on)
 {
 	sizedFeatures_->setChecked(on);
+	this->updateKptRects();
 	if(graphicsViewInitialized_)
 	{
-		for(unsigned int i=0; i<(unsigned int)keypointItems_.size() && i<keypoints_.size(); ++i)
+		for(int i=0; i<keypointItems_.size() && i<kptRects_.size(); ++i)
 		{
-			float size = 14;
-			if(on && keypoints_[i].size>14.0f)
-			{
-				size = keypoints_[i].size;
-			}
-			float radius = size*1.2f/9.0f*2.0f;
-			keypointItems_.at(i)->setRect(keypoints_[i].pt.x-radius, keypoints_[i].pt.y-radius, radius*2, radius*2);
+			keypointItems_.at(i)->setRect(kptRects_.at(i));
+		}
+		if(keypointsItem_)
+		{
+			keypointsItem_->updateGeometry();
 		}
 	}
 	if(!graphicsViewMode_->isChecked())
@@ -215,6 +228,26 @@ void ObjWidget::setSizedFeatures(bool on)
 	}
 }
 
+void ObjWidget::setBatchedFeatures(bool on)
+{
+	if(batchedFeatures_->isChecked() != on)
+	{
+		batchedFeatures_->setChecked(on);
+		if(graphicsViewInitialized_)
+		{
+			// recreate the keypoint items
+			keypointItems_.clear();
+			keypointsItem_ = 0;
+			graphicsView_->scene()->clear();
+			graphicsViewInitialized_ = false;
+			if(graphicsViewMode_->isChecked())
+			{
+				this->setupGraphicsView();
+			}
+		}
+	}
+}
+
 void ObjWidget::setMirrorView(bool on)
 {
 	mirrorView_->setChecked(on);
@@ -236,12 +269,7 @@ void ObjWidget::setAlpha(int alpha)
 		alpha_ = alpha;
 		if(graphicsViewInitialized_)
 		{
-			for(int i=0; i<keypointItems_.size() && i<kptColors_.size(); ++i)
-			{
-				QColor color = kptColors_.at(i);
-				color.setAlpha(alpha_);
-				keypointItems_.at(i)->setColor(color);
-			}
+			this->updateItemsColor();
 		}
 		for(int i=0; i<rectItems_.size(); ++i)
 		{
@@ -279,7 +307,11 @@ void ObjWidget::updateData(const std::vector<cv::KeyPoint> & keypoints, const QM
 {
 	keypoints_ = keypoints;
 	kptColors_ = QVector<QColor>((int)keypoints.size(), defaultColor(0));
+	this->updateKptRects();
+	changedKpts_.clear();
+	kptChanged_ = QVector<bool>((int)keypoints.size(), false);
 	keypointItems_.clear();
+	keypointsItem_ = 0;
 	rectItems_.clear();
 	this->updateWords(words);
 	graphicsView_->scene()->clear();
@@ -314,12 +346,19 @@ void ObjWidget::updateWords(const QMultiMap<int,int> & words)
 			keypointItems_[i]->setColor(defaultColor(words_.size()?keypointItems_[i]->wordID():0));
 		}
 	}
+	if(keypointsItem_)
+	{
+		keypointsItem_->update();
+	}
 }
 
 void ObjWidget::resetKptsColor()
 {
-	for(int i=0; i<kptColors_.size(); ++i)
+	// only the keypoints colored since the last reset
+	for(int j=0; j<changedKpts_.size(); ++j)
 	{
+		int i = changedKpts_.at(j);
+		kptChanged_[i] = false;
 		if(keypointItems_.size() == kptColors_.size())
 		{
 			kptColors_[i] = defaultColor(keypointItems_[i]->wordID());
@@ -328,14 +367,24 @@ void ObjWidget::resetKptsColor()
 		else
 		{
 			kptColors_[i] = defaultColor(words_.value(i,-1));
+			if(keypointsItem_)
+			{
+				keypointsItem_->updateKeypoint(i);
+			}
 		}
 	}
+	changedKpts_.clear();
 	qDeleteAll(rectItems_.begin(), rectItems_.end());
 	rectItems_.clear();
 }
 
 void ObjWidget::resetKptsWordID()
 {
+	// their color is reset on the next resetKptsColor()
+	for(QMap<int,int>::const_iterator iter=words_.constBegin(); iter!=words_.constEnd(); ++iter)
+	{
+		this->setKptChanged(iter.key());
+	}
 	words_.clear();
 	for(int i=0; i<keypointItems_.size(); ++i)
 	{
@@ -348,6 +397,7 @@ void ObjWidget::setKptColor(int index, const QColor & color)
 	if(index < kptColors_.size())
 	{
 		kptColors_[index] = color;
+		this->setKptChanged(index);
 	}
 	else
 	{
@@ -362,6 +412,10 @@ void ObjWidget::setKptColor(int index, const QColor & color)
 			c.setAlpha(alpha_);
 			keypointItems_.at(index)->setColor(c);
 		}
+		else if(keypointsItem_)
+		{
+			keypointsItem_->updateKeypoint(index);
+		}
 	}
 }
 
@@ -374,6 +428,38 @@ void ObjWidget::setKptWordID(int index, int wordID)
 	}
 }
 
+void ObjWidget::setKptChanged(int index)
+{
+	if(index>=0 && index < kptChanged_.size() && !kptChanged_[index])
+	{
+		kptChanged_[index] = true;
+		changedKpts_.push_back(index);
+	}
+}
+
+void ObjWidget::updateKptRects()
+{
+	kptRects_.resize((int)keypoints_.size());
+	for(unsigned int i=0; i<keypoints_.size(); ++i)
+	{
+		kptRects_[i] = keypointRect(keypoints_[i], sizedFeatures_->isChecked());
+	}
+}
+
+void ObjWidget::updateItemsColor()
+{
+	for(int i=0; i<keypointItems_.size() && i<kptColors_.size(); ++i)
+	{
+		QColor color = kptColors_.at(i);
+		color.setAlpha(alpha_);
+		keypointItems_.at(i)->setColor(color);
+	}
+	if(keypointsItem_)
+	{
+		keypointsItem_->setAlpha(alpha_);
+	}
+}
+
 void ObjWidget::addRect(QGraphicsRectItem * rect)
 {
 	if(graphicsViewInitialized_)
@@ -409,6 +495,11 @@ bool ObjWidget::isSizedFeatures() const
 	return sizedFeatures_->isChecked();
 }
 
+bool ObjWidget::isBatchedFeatures() const
+{
+	return batchedFeatures_->isChecked();
+}
+
 bool ObjWidget::isMirrorView() const
 {
 	return mirrorView_->isChecked();
@@ -661,6 +752,12 @@ void ObjWidget::contextMenuEvent(QContextMenuEvent * event)
 	{
 		this->setSizedFeatures(sizedFeatures_->isChecked());
 	}
+	else if(action == batchedFeatures_)
+	{
+		// already toggled by the menu
+		batchedFeatures_->setChecked(!batchedFeatures_->isChecked());
+		this->setBatchedFeatures(!batchedFeatures_->isChecked());
+	}
 	else if(action == setColor_)
 	{
 		QColor color = QColorDialog::getColor(color_, this);
@@ -671,12 +768,16 @@ void ObjWidget::contextMenuEvent(QContextMenuEvent * event)
 				if(kptColors_[i] == color_)
 				{
 					kptColors_[i] = color;
-					if(graphicsViewMode_->isChecked())
+					if(graphicsViewMode_->isChecked() && i < keypointItems_.size())
 					{
 						keypointItems_[i]->setColor(color);
 					}
 				}
 			}
+			if(keypointsItem_)
+			{
+				keypointsItem_->update();
+			}
 			for(int i=0; i<rectItems_.size(); ++i)
 			{
 				if(rectItems_[i]->pen().color() == color_)
@@ -721,7 +822,7 @@ void ObjWidget::updateItemsShown()
 	QList<QGraphicsItem*> items = graphicsView_->scene()->items();
 	for(int i=0; i<items.size(); ++i)
 	{
-		if(qgraphicsitem_cast<KeypointItem*>(items.at(i)))
+		if(qgraphicsitem_cast<KeypointItem*>(items.at(i)) || qgraphicsitem_cast<KeypointsItem*>(items.at(i)))
 		{
 			items.at(i)->setVisible(showFeatures_->isChecked());
 		}
@@ -734,40 +835,37 @@ void ObjWidget::updateItemsShown()
 
 void ObjWidget::drawKeypoints(QPainter * painter)
 {
-	QList<KeypointItem *> items;
-	KeypointItem * item = 0;
+	KeypointsItem::paintKeypoints(painter, kptRects_, kptColors_, alpha_);
+}
 
-	int i = 0;
-	for(std::vector<cv::KeyPoint>::const_iterator iter = keypoints_.begin(); iter != keypoints_.end(); ++iter, ++i )
+void ObjWidget::createKeypointItems()
+{
+	if(batchedFeatures_->isChecked())
 	{
-		const cv::KeyPoint & r = *iter;
-		float size = 14;
-		if(r.size>14.0f && sizedFeatures_->isChecked())
-		{
-			size = r.size;
-		}
-		float radius = size*1.2f/9.0f*2.0f;
-		QColor color(kptColors_.at(i).red(), kptColors_.at(i).green(), kptColors_.at(i).blue(), alpha_);
-		if(graphicsViewMode_->isChecked())
+		for(int i=0; i<kptColors_.size(); ++i)
 		{
-			// YELLOW = NEW and multiple times
-			item = new KeypointItem(i, r.pt.x-radius, r.pt.y-radius, radius*2, r, words_.value(i, -1), color);
-			item->setVisible(this->isFeaturesShown());
-			item->setZValue(2);
-			graphicsView_->scene()->addItem(item);
-			item->setColor(defaultColor(item->wordID()));
-			kptColors_[i] = defaultColor(item->wordID());
-			keypointItems_.append(item);
+			kptColors_[i] = defaultColor(words_.value(i, -1));
 		}
+		keypointsItem_ = new KeypointsItem(&kptRects_, &kptColors_);
+		keypointsItem_->setAlpha(alpha_);
+		keypointsItem_->setVisible(this->isFeaturesShown());
+		keypointsItem_->setZValue(2);
+		graphicsView_->scene()->addItem(keypointsItem_);
+		return;
+	}
 
-		if(painter)
-		{
-			painter->save();
-			painter->setPen(color);
-			painter->setBrush(color);
-			painter->drawEllipse(r.pt.x-radius, r.pt.y-radius, radius*2, radius*2);
-			painter->restore();
-		}
+	for(unsigned int i=0; i<keypoints_.size() && i<(unsigned int)kptRects_.size(); ++i)
+	{
+		const QRectF & rect = kptRects_.at(i);
+		QColor color(kptColors_.at(i).red(), kptColors_.at(i).green(), kptColors_.at(i).blue(), alpha_);
+		// YELLOW = NEW and multiple times
+		KeypointItem * item = new KeypointItem(i, rect.x(), rect.y(), rect.width(), keypoints_[i], words_.value(i, -1), color);
+		item->setVisible(this->isFeaturesShown());
+		item->setZValue(2);
+		graphicsView_->scene()->addItem(item);
+		item->setColor(defaultColor(item->wordID()));
+		kptColors_[i] = defaultColor(item->wordID());
+		keypointItems_.append(item);
 	}
 }
 
@@ -807,7 +905,7 @@ void ObjWidget::setupGraphicsView()
 
 		QGraphicsPixmapItem * pixmapItem = graphicsView_->scene()->addPixmap(pixmap_);
 		pixmapItem->setVisible(this->isImageShown());
-		this->drawKeypoints();
+		this->createKeypointItems();
 
 		for(int i=0; i<rectItems_.size(); ++i)
 		{
@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "ObjectImageCache.h"
+
+namespace find_object {
+
+ObjectImageCache & ObjectImageCache::instance()
+{
+	static ObjectImageCache cache;
+	return cache;
+}
+
+ObjectImageCache::ObjectImageCache() :
+	bytes_(0),
+	maxBytes_(256LL*1024*1024)
+{
+}
+
+void ObjectImageCache::setMaxBytes(qint64 maxBytes)
+{
+	QMutexLocker locker(&mutex_);
+	maxBytes_ = maxBytes;
+	trim();
+}
+
+cv::Mat ObjectImageCache::get(const void * owner)
+{
+	QMutexLocker locker(&mutex_);
+	QHash<const void*, Entry>::iterator iter = images_.find(owner);
+	if(iter == images_.end())
+	{
+		return cv::Mat();
+	}
+	lru_.splice(lru_.begin(), lru_, iter->position);
+	return iter->image;
+}
+
+void ObjectImageCache::insert(const void * owner, const cv::Mat & image)
+{
+	QMutexLocker locker(&mutex_);
+	QHash<const void*, Entry>::iterator iter = images_.find(owner);
+	if(iter != images_.end())
+	{
+		// decoded by two threads at the same time
+		return;
+	}
+	lru_.push_front(owner);
+	Entry entry;
+	entry.image = image;
+	entry.position = lru_.begin();
+	images_.insert(owner, entry);
+	bytes_ += image.total()*image.elemSize();
+	trim();
+}
+
+void ObjectImageCache::remove(const void * owner)
+{
+	QMutexLocker locker(&mutex_);
+	QHash<const void*, Entry>::iterator iter = images_.find(owner);
+	if(iter != images_.end())
+	{
+		bytes_ -= iter->image.total()*iter->image.elemSize();
+		lru_.erase(iter->position);
+		images_.erase(iter);
+	}
+}
+
+qint64 ObjectImageCache::bytes()
+{
+	QMutexLocker locker(&mutex_);
+	return bytes_;
+}
+
+void ObjectImageCache::trim()
+{
+	// the image just inserted is kept, even if larger than the cache
+	while(bytes_ > maxBytes_ && lru_.size() > 1)
+	{
+		QHash<const void*, Entry>::iterator iter = images_.find(lru_.back());
+		bytes_ -= iter->image.total()*iter->image.elemSize();
+		images_.erase(iter);
+		lru_.pop_back();
+	}
+}
+
+} // namespace find_object
@@ -0,0 +1,75 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef OBJECTIMAGECACHE_H_
+#define OBJECTIMAGECACHE_H_
+
+#include <opencv2/opencv.hpp>
+#include <QtCore/QMutex>
+#include <QtCore/QHash>
+#include <list>
+
+namespace find_object {
+
+// Decoded images of the objects whose images are not kept in RAM (see
+// ObjSignature::releaseImage()), shared by all objects of the process.
+// The least recently used images are removed when the decoded images
+// take more than General/imageCacheSize MB (see FindObject::setImageCacheSize()).
+// Thread-safe.
+class ObjectImageCache
+{
+public:
+	static ObjectImageCache & instance();
+
+	void setMaxBytes(qint64 maxBytes);
+
+	// Empty if not cached
+	cv::Mat get(const void * owner);
+	void insert(const void * owner, const cv::Mat & image);
+	void remove(const void * owner);
+	qint64 bytes();
+
+private:
+	ObjectImageCache();
+	void trim();
+
+private:
+	QMutex mutex_;
+	std::list<const void*> lru_; // most recently used first
+	struct Entry
+	{
+		cv::Mat image;
+		std::list<const void*>::iterator position;
+	};
+	QHash<const void*, Entry> images_;
+	qint64 bytes_;
+	qint64 maxBytes_;
+};
+
+} // namespace find_object
+
+#endif /* OBJECTIMAGECACHE_H_ */
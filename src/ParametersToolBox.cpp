@@ -397,8 +397,9 @@ void ParametersToolBox::addParameter(QVBoxLayout * layout,
 		if(key.compare(Settings::kHomography_method()) == 0)
 		{
 #if CV_MAJOR_VERSION < 3
-			// disable RHO approach
+			// disable RHO and PROSAC approaches
 			widget->setItemData(2, 0, Qt::UserRole - 1);
+			widget->setItemData(3, 0, Qt::UserRole - 1);
 #endif
 		}
 
@@ -663,7 +664,7 @@ void ParametersToolBox::changeParameter(QObject * sender, int value)
 									  descriptorBox->currentText().compare("LATCH") == 0 ||
 									  descriptorBox->currentText().compare("LUCID") == 0;
 			bool binToFloat = binToFloatCheckbox->isChecked();
-			if(isBinaryDescriptor && !binToFloat && nnBox->currentText().compare("Lsh") != 0 && nnBox->currentText().compare("BruteForce") != 0)
+			if(isBinaryDescriptor && !binToFloat && nnBox->currentText().compare("Lsh") != 0 && nnBox->currentText().compare("BruteForce") != 0 && nnBox->currentText().compare("Hamming") != 0)
 			{
 				QMessageBox::warning(this,
 						tr("Warning"),
@@ -764,7 +765,7 @@ void ParametersToolBox::changeParameter(QObject * sender, int value)
 		{
 			QComboBox * nnBox = (QComboBox*)this->getParameterWidget(Settings::kNearestNeighbor_1Strategy());
 			QComboBox * distBox = (QComboBox*)this->getParameterWidget(Settings::kNearestNeighbor_2Distance_type());
-			if(nnBox->currentText().compare("BruteForce") != 0 && nnBox->currentText().compare("Lsh") != 0 && distBox->currentIndex() > 1)
+			if(nnBox->currentText().compare("BruteForce") != 0 && nnBox->currentText().compare("Lsh") != 0 && nnBox->currentText().compare("Hamming") != 0 && distBox->currentIndex() > 1)
 			{
 				QMessageBox::warning(this,
 									tr("Warning"),
@@ -0,0 +1,364 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ProductQuantizer.h"
+#include "find_object/utilite/ULogger.h"
+#include <algorithm>
+#include <limits>
+#include <math.h>
+
+namespace find_object {
+
+static const int kCoarseSamplesPerCell = 32;
+static const int kCodebookSamples = 65536;
+static const int kIterations = 15;
+
+static cv::Mat sampleRows(const cv::Mat & data, int maxRows)
+{
+	if(data.rows <= maxRows)
+	{
+		return data;
+	}
+	cv::Mat indexes(data.rows, 1, CV_32SC1);
+	for(int i=0; i<data.rows; ++i)
+	{
+		indexes.at<int>(i) = i;
+	}
+	cv::RNG rng(0x12345);
+	cv::randShuffle(indexes, 1.0, &rng);
+	cv::Mat sample(maxRows, data.cols, data.type());
+	for(int i=0; i<maxRows; ++i)
+	{
+		data.row(indexes.at<int>(i)).copyTo(sample.row(i));
+	}
+	return sample;
+}
+
+ProductQuantizer::ProductQuantizer() :
+	subQuantizers_(0),
+	subDim_(0),
+	centroids_(0)
+{
+}
+
+bool ProductQuantizer::train(const cv::Mat & words, int subQuantizers, int coarseCells)
+{
+	*this = ProductQuantizer();
+	if(words.empty() || words.type() != CV_32FC1 || subQuantizers <= 0 || words.cols % subQuantizers != 0)
+	{
+		UERROR("Product quantization requires float descriptors (type=%d) with a size (%d) multiple of the number of sub-quantizers (%d)",
+				words.type(), words.cols, subQuantizers);
+		return false;
+	}
+	subQuantizers_ = subQuantizers;
+	subDim_ = words.cols / subQuantizers;
+
+	int cells = coarseCells>0?coarseCells:(int)sqrt((double)words.rows);
+	cells = cells<1?1:cells>words.rows?words.rows:cells;
+	cv::TermCriteria criteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, kIterations, 0.01);
+
+	// coarse quantizer
+	cv::Mat coarseSample = sampleRows(words, cells*kCoarseSamplesPerCell);
+	cv::Mat labels;
+	cv::kmeans(coarseSample, cells, labels, criteria, 1, cv::KMEANS_PP_CENTERS, coarseCenters_);
+	if(cells < 64)
+	{
+		coarseIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index(coarseCenters_, cv::flann::LinearIndexParams(), cvflann::FLANN_DIST_L2));
+	}
+	else
+	{
+		coarseIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index(coarseCenters_, cv::flann::KDTreeIndexParams(4), cvflann::FLANN_DIST_L2));
+	}
+
+	// a codebook per sub-vector of the residuals
+	cv::Mat sample = sampleRows(words, kCodebookSamples);
+	cv::Mat cellIds, cellDists;
+	coarseIndex_->knnSearch(sample, cellIds, cellDists, 1, cv::flann::SearchParams(64));
+	cv::Mat residuals(sample.rows, sample.cols, CV_32FC1);
+	for(int r=0; r<sample.rows; ++r)
+	{
+		cv::Mat residual = residuals.row(r);
+		cv::subtract(sample.row(r), coarseCenters_.row(cellIds.at<int>(r,0)), residual);
+	}
+	centroids_ = sample.rows<256?sample.rows:256;
+	codebooks_ = cv::Mat(subQuantizers_*centroids_, subDim_, CV_32FC1);
+	for(int s=0; s<subQuantizers_; ++s)
+	{
+		cv::Mat sub = residuals.colRange(s*subDim_, (s+1)*subDim_).clone();
+		cv::Mat subLabels, subCenters;
+		cv::kmeans(sub, centroids_, subLabels, criteria, 1, cv::KMEANS_PP_CENTERS, subCenters);
+		subCenters.copyTo(codebooks_.rowRange(s*centroids_, (s+1)*centroids_));
+	}
+
+	add(words);
+	UINFO("Product quantization: %d words in %d cells, %d bytes per word instead of %d",
+			size(), cells, subQuantizers_, words.cols*(int)sizeof(float));
+	return true;
+}
+
+void ProductQuantizer::add(const cv::Mat & words)
+{
+	if(words.empty())
+	{
+		return;
+	}
+	UASSERT(!coarseCenters_.empty());
+	UASSERT(words.type() == CV_32FC1 && words.cols == dim());
+
+	cv::Mat cellIds, cellDists;
+	coarseIndex_->knnSearch(words, cellIds, cellDists, 1, cv::flann::SearchParams(64));
+	cv::Mat residuals(words.rows, words.cols, CV_32FC1);
+	for(int r=0; r<words.rows; ++r)
+	{
+		cv::Mat residual = residuals.row(r);
+		cv::subtract(words.row(r), coarseCenters_.row(cellIds.at<int>(r,0)), residual);
+	}
+
+	cv::Mat codes(words.rows, subQuantizers_, CV_8UC1);
+	cv::BFMatcher matcher(cv::NORM_L2);
+	for(int s=0; s<subQuantizers_; ++s)
+	{
+		std::vector<cv::DMatch> matches;
+		matcher.match(residuals.colRange(s*subDim_, (s+1)*subDim_).clone(), codebooks_.rowRange(s*centroids_, (s+1)*centroids_), matches);
+		UASSERT((int)matches.size() == words.rows);
+		for(int r=0; r<words.rows; ++r)
+		{
+			codes.at<unsigned char>(matches[r].queryIdx, s) = (unsigned char)matches[r].trainIdx;
+		}
+	}
+
+	// new matrices, copies keep the old ones
+	if(codes_.empty())
+	{
+		codes_ = codes;
+	}
+	else
+	{
+		cv::Mat allCodes;
+		cv::vconcat(codes_, codes, allCodes);
+		codes_ = allCodes;
+	}
+	for(int r=0; r<words.rows; ++r)
+	{
+		cells_.push_back(cellIds.at<int>(r,0));
+	}
+
+	std::vector<int> offsets(coarseCenters_.rows+1, 0);
+	for(unsigned int i=0; i<cells_.size(); ++i)
+	{
+		++offsets[cells_[i]+1];
+	}
+	for(int c=0; c<coarseCenters_.rows; ++c)
+	{
+		offsets[c+1] += offsets[c];
+	}
+	std::vector<int> next(offsets.begin(), offsets.end()-1);
+	cellWords_.resize(cells_.size());
+	for(unsigned int i=0; i<cells_.size(); ++i)
+	{
+		cellWords_[next[cells_[i]]++] = i;
+	}
+	cellOffsets_ = offsets;
+}
+
+class ProductQuantizerSearchBody : public cv::ParallelLoopBody
+{
+public:
+	ProductQuantizerSearchBody(
+			const ProductQuantizer & pq,
+			const cv::Mat & queries,
+			const cv::Mat & cellIds,
+			const cv::Mat & exactWords,
+			int rerank,
+			cv::Mat & results,
+			cv::Mat & dists) :
+		pq_(pq),
+		queries_(queries),
+		cellIds_(cellIds),
+		exactWords_(exactWords),
+		rerank_(rerank),
+		results_(results),
+		dists_(dists)
+	{}
+
+	virtual void operator()(const cv::Range & range) const
+	{
+		const int k = results_.cols;
+		const int m = pq_.subQuantizers_;
+		const int ksub = pq_.centroids_;
+		const int subDim = pq_.subDim_;
+		const int dim = queries_.cols;
+		unsigned int candidates = rerank_>k?rerank_:k;
+		std::vector<float> table(m*ksub);
+		std::vector<float> residual(dim);
+		std::vector<std::pair<float, int> > heap; // max-heap of the best candidates
+		heap.reserve(candidates+1);
+
+		for(int q=range.start; q<range.end; ++q)
+		{
+			heap.clear();
+			const float * query = queries_.ptr<float>(q);
+			for(int p=0; p<cellIds_.cols; ++p)
+			{
+				int c = cellIds_.at<int>(q, p);
+				if(c < 0 || c >= pq_.coarseCenters_.rows)
+				{
+					continue;
+				}
+				const float * center = pq_.coarseCenters_.ptr<float>(c);
+				for(int d=0; d<dim; ++d)
+				{
+					residual[d] = query[d] - center[d];
+				}
+				for(int s=0; s<m; ++s)
+				{
+					const float * r = &residual[s*subDim];
+					for(int j=0; j<ksub; ++j)
+					{
+						const float * centroid = pq_.codebooks_.ptr<float>(s*ksub+j);
+						float dist = 0.0f;
+						for(int t=0; t<subDim; ++t)
+						{
+							float diff = r[t] - centroid[t];
+							dist += diff*diff;
+						}
+						table[s*ksub+j] = dist;
+					}
+				}
+				for(int i=pq_.cellOffsets_[c]; i<pq_.cellOffsets_[c+1]; ++i)
+				{
+					int word = pq_.cellWords_[i];
+					const unsigned char * code = pq_.codes_.ptr<unsigned char>(word);
+					float dist = 0.0f;
+					for(int s=0; s<m; ++s)
+					{
+						dist += table[s*ksub + code[s]];
+					}
+					if(heap.size() < candidates)
+					{
+						heap.push_back(std::make_pair(dist, word));
+						std::push_heap(heap.begin(), heap.end());
+					}
+					else if(dist < heap.front().first)
+					{
+						std::pop_heap(heap.begin(), heap.end());
+						heap.back() = std::make_pair(dist, word);
+						std::push_heap(heap.begin(), heap.end());
+					}
+				}
+			}
+
+			if(rerank_ > 0 && !exactWords_.empty())
+			{
+				for(unsigned int i=0; i<heap.size(); ++i)
+				{
+					const float * word = exactWords_.ptr<float>(heap[i].second);
+					float dist = 0.0f;
+					for(int d=0; d<dim; ++d)
+					{
+						float diff = query[d] - word[d];
+						dist += diff*diff;
+					}
+					heap[i].first = dist;
+				}
+				std::sort(heap.begin(), heap.end());
+			}
+			else
+			{
+				std::sort_heap(heap.begin(), heap.end());
+			}
+
+			for(int j=0; j<k; ++j)
+			{
+				if(j < (int)heap.size())
+				{
+					results_.at<int>(q, j) = heap[j].second;
+					dists_.at<float>(q, j) = heap[j].first;
+				}
+				else
+				{
+					results_.at<int>(q, j) = -1;
+					dists_.at<float>(q, j) = std::numeric_limits<float>::max();
+				}
+			}
+		}
+	}
+
+private:
+	const ProductQuantizer & pq_;
+	const cv::Mat & queries_;
+	const cv::Mat & cellIds_;
+	const cv::Mat & exactWords_;
+	int rerank_;
+	cv::Mat & results_;
+	cv::Mat & dists_;
+};
+
+void ProductQuantizer::search(const cv::Mat & queries, cv::Mat & results, cv::Mat & dists, int k, int probes,
+		const cv::Mat & exactWords, int rerank) const
+{
+	UASSERT(k >= 1);
+	results = cv::Mat(queries.rows, k, CV_32SC1, cv::Scalar(-1));
+	dists = cv::Mat(queries.rows, k, CV_32FC1, cv::Scalar(std::numeric_limits<float>::max()));
+	if(queries.rows == 0 || empty())
+	{
+		return;
+	}
+	UASSERT(queries.type() == CV_32FC1 && queries.cols == dim());
+	UASSERT(exactWords.empty() || (exactWords.rows == size() && exactWords.cols == dim() && exactWords.type() == CV_32FC1));
+
+	probes = probes<1?1:probes>coarseCenters_.rows?coarseCenters_.rows:probes;
+	cv::Mat cellIds, cellDists;
+	coarseIndex_->knnSearch(queries, cellIds, cellDists, probes, cv::flann::SearchParams(64));
+
+	// ~64 queries per stripe
+	cv::parallel_for_(cv::Range(0, queries.rows),
+			ProductQuantizerSearchBody(*this, queries, cellIds, exactWords, rerank, results, dists),
+			(queries.rows+63)/64);
+}
+
+cv::Mat ProductQuantizer::reconstruct() const
+{
+	cv::Mat words(size(), dim(), CV_32FC1);
+	for(int r=0; r<words.rows; ++r)
+	{
+		float * word = words.ptr<float>(r);
+		const float * center = coarseCenters_.ptr<float>(cells_[r]);
+		const unsigned char * code = codes_.ptr<unsigned char>(r);
+		for(int s=0; s<subQuantizers_; ++s)
+		{
+			const float * centroid = codebooks_.ptr<float>(s*centroids_ + code[s]);
+			for(int t=0; t<subDim_; ++t)
+			{
+				word[s*subDim_+t] = center[s*subDim_+t] + centroid[t];
+			}
+		}
+	}
+	return words;
+}
+
+} // namespace find_object
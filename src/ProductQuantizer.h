@@ -0,0 +1,91 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef PRODUCTQUANTIZER_H_
+#define PRODUCTQUANTIZER_H_
+
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace find_object {
+
+// Inverted file with product quantization codes (IVFADC, Jegou et al.,
+// "Product quantization for nearest neighbor search", 2011). A coarse
+// k-means quantizer splits the words in cells, the residual of each word
+// to its cell center is cut in sub-vectors coded on one byte each. Queries
+// are compared to the words of the nearest cells with asymmetric distances
+// (query not quantized) read from per sub-vector lookup tables, then the
+// best candidates can be re-ranked with the exact words. Distances are
+// squared L2, like FLANN. Copies share the coarse quantizer and codebooks.
+class ProductQuantizer
+{
+public:
+	ProductQuantizer();
+
+	// Train the quantizers with the words (CV_32FC1) and add them.
+	// words.cols should be a multiple of subQuantizers, coarseCells=0 means sqrt(words).
+	bool train(const cv::Mat & words, int subQuantizers, int coarseCells);
+	// Words added after the ones already added (ids follow)
+	void add(const cv::Mat & words);
+
+	// Like Vocabulary::search(), missing neighbors are set to -1. When
+	// rerank > k and exactWords is not empty, the rerank best candidates
+	// are sorted with their exact distance.
+	void search(const cv::Mat & queries, cv::Mat & results, cv::Mat & dists, int k, int probes,
+			const cv::Mat & exactWords = cv::Mat(), int rerank = 0) const;
+
+	// Approximation of the words (coarse center + decoded residual)
+	cv::Mat reconstruct() const;
+
+	int size() const {return (int)cells_.size();}
+	bool empty() const {return cells_.empty();}
+	int dim() const {return coarseCenters_.cols;}
+	int codeSize() const {return subQuantizers_;}
+	qint64 memoryUsage() const
+	{
+		return qint64(coarseCenters_.total()*coarseCenters_.elemSize() + codebooks_.total()*codebooks_.elemSize() + codes_.total()*codes_.elemSize() +
+				(cells_.size() + cellOffsets_.size() + cellWords_.size())*sizeof(int));
+	}
+
+private:
+	friend class ProductQuantizerSearchBody;
+	int subQuantizers_;
+	int subDim_;
+	int centroids_; // per sub-quantizer, <= 256
+	cv::Mat coarseCenters_; // cells x dim
+	cv::Ptr<cv::flann::Index> coarseIndex_;
+	cv::Mat codebooks_; // (subQuantizers x centroids) x subDim
+	std::vector<int> cells_; // cell of each word
+	cv::Mat codes_; // words x subQuantizers (CV_8UC1)
+	// Words of cell i are cellWords_[cellOffsets_[i]] to cellWords_[cellOffsets_[i+1]-1]
+	std::vector<int> cellOffsets_;
+	std::vector<int> cellWords_;
+};
+
+} // namespace find_object
+
+#endif /* PRODUCTQUANTIZER_H_ */
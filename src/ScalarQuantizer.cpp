@@ -0,0 +1,284 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "ScalarQuantizer.h"
+#include "find_object/utilite/ULogger.h"
+#include <string.h>
+#include <limits>
+#include <math.h>
+
+namespace find_object {
+
+// IEEE 754 half precision, rounded to nearest
+static inline unsigned short floatToHalf(float value)
+{
+	unsigned int f;
+	memcpy(&f, &value, sizeof(f));
+	unsigned int sign = (f >> 16) & 0x8000;
+	int exponent = int((f >> 23) & 0xFF) - 127 + 15;
+	unsigned int mantissa = f & 0x7FFFFF;
+	if(((f >> 23) & 0xFF) == 0xFF)
+	{
+		return sign | 0x7C00 | (mantissa?0x200:0); // inf or nan
+	}
+	if(exponent >= 31)
+	{
+		return sign | 0x7C00; // overflow
+	}
+	if(exponent <= 0)
+	{
+		if(exponent < -10)
+		{
+			return sign;
+		}
+		// subnormal
+		mantissa |= 0x800000;
+		int shift = 14 - exponent;
+		unsigned int half = mantissa >> shift;
+		if((mantissa >> (shift-1)) & 1)
+		{
+			++half;
+		}
+		return sign | half;
+	}
+	unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+	if(mantissa & 0x1000)
+	{
+		++half; // a carry in the exponent is still the right value
+	}
+	return half;
+}
+
+static inline float halfToFloat(unsigned short half)
+{
+	unsigned int sign = (half & 0x8000) << 16;
+	unsigned int exponent = (half >> 10) & 0x1F;
+	unsigned int mantissa = half & 0x3FF;
+	unsigned int f;
+	if(exponent == 0)
+	{
+		float value = (float)mantissa * (1.0f/16777216.0f); // subnormal, 2^-24
+		return sign?-value:value;
+	}
+	else if(exponent == 31)
+	{
+		f = sign | 0x7F800000 | (mantissa << 13);
+	}
+	else
+	{
+		f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+	}
+	float value;
+	memcpy(&value, &f, sizeof(value));
+	return value;
+}
+
+ScalarQuantizer::ScalarQuantizer() :
+	type_(kNone),
+	dim_(0),
+	offset_(0.0f),
+	scale_(1.0f)
+{
+}
+
+ScalarQuantizer::ScalarQuantizer(int type, float offset, float scale, const cv::Mat & codes) :
+	type_(type),
+	dim_(codes.cols),
+	offset_(offset),
+	scale_(scale),
+	codes_(codes)
+{
+	UASSERT((type == kUint8 && codes.type() == CV_8UC1) || (type == kFloat16 && codes.type() == CV_16UC1));
+	UASSERT(scale > 0.0f);
+}
+
+bool ScalarQuantizer::train(const cv::Mat & words, int type)
+{
+	if(words.empty() || words.type() != CV_32FC1 || (type != kUint8 && type != kFloat16))
+	{
+		return false;
+	}
+	type_ = type;
+	dim_ = words.cols;
+	codes_ = cv::Mat();
+	offset_ = 0.0f;
+	scale_ = 1.0f;
+	if(type_ == kUint8)
+	{
+		double minValue, maxValue;
+		cv::minMaxLoc(words, &minValue, &maxValue);
+		offset_ = (float)minValue;
+		scale_ = maxValue>minValue?float((maxValue-minValue)/255.0):1.0f;
+	}
+	return true;
+}
+
+void ScalarQuantizer::add(const cv::Mat & words)
+{
+	UASSERT(type_ != kNone && words.type() == CV_32FC1 && words.cols == dim_);
+	if(codes_.empty())
+	{
+		codes_ = encode(words);
+	}
+	else
+	{
+		// copies of this quantizer may still use the old codes
+		cv::Mat codes;
+		cv::vconcat(codes_, encode(words), codes);
+		codes_ = codes;
+	}
+}
+
+cv::Mat ScalarQuantizer::encode(const cv::Mat & descriptors) const
+{
+	UASSERT(descriptors.type() == CV_32FC1 && descriptors.cols == dim_);
+	cv::Mat codes;
+	if(type_ == kUint8)
+	{
+		// rounded and saturated
+		descriptors.convertTo(codes, CV_8U, 1.0/scale_, -offset_/scale_);
+	}
+	else
+	{
+		codes = cv::Mat(descriptors.rows, descriptors.cols, CV_16UC1);
+		for(int i=0; i<descriptors.rows; ++i)
+		{
+			const float * src = descriptors.ptr<float>(i);
+			unsigned short * dst = codes.ptr<unsigned short>(i);
+			for(int j=0; j<descriptors.cols; ++j)
+			{
+				dst[j] = floatToHalf(src[j]);
+			}
+		}
+	}
+	return codes;
+}
+
+cv::Mat ScalarQuantizer::decode(const cv::Mat & codes) const
+{
+	cv::Mat descriptors;
+	if(type_ == kUint8)
+	{
+		codes.convertTo(descriptors, CV_32F, scale_, offset_);
+	}
+	else if(type_ == kFloat16)
+	{
+		descriptors = cv::Mat(codes.rows, codes.cols, CV_32FC1);
+		for(int i=0; i<codes.rows; ++i)
+		{
+			const unsigned short * src = codes.ptr<unsigned short>(i);
+			float * dst = descriptors.ptr<float>(i);
+			for(int j=0; j<codes.cols; ++j)
+			{
+				dst[j] = halfToFloat(src[j]);
+			}
+		}
+	}
+	return descriptors;
+}
+
+void ScalarQuantizer::search(const cv::Mat & queries, cv::Mat & results, cv::Mat & dists, int k) const
+{
+	UASSERT(queries.type() == CV_32FC1 && queries.cols == dim_);
+	UASSERT(k >= 1);
+	results = cv::Mat(queries.rows, k, CV_32SC1, cv::Scalar(-1));
+	dists = cv::Mat(queries.rows, k, CV_32FC1, cv::Scalar(std::numeric_limits<float>::max()));
+	if(queries.empty() || codes_.empty())
+	{
+		return;
+	}
+
+	if(type_ == kUint8)
+	{
+		// The queries are coded too: the L2 distance between codes is
+		// the distance between the (quantized) descriptors / scale
+		cv::Mat queryCodes = encode(queries);
+		cv::Mat codeDists;
+		cv::Mat codeResults;
+		int kk = k<codes_.rows?k:codes_.rows;
+		cv::batchDistance(queryCodes, codes_, codeDists, CV_32S, codeResults, cv::NORM_L2SQR, kk, cv::Mat(), 0, false);
+		for(int i=0; i<queries.rows; ++i)
+		{
+			for(int j=0; j<kk; ++j)
+			{
+				int id = codeResults.at<int>(i,j);
+				if(id >= 0)
+				{
+					results.at<int>(i,j) = id;
+					dists.at<float>(i,j) = sqrtf((float)codeDists.at<int>(i,j)) * scale_;
+				}
+			}
+		}
+		return;
+	}
+
+	// Float16: blocks of words are decoded, then compared to all queries
+	static const int kBlock = 4096; // 2 MB of 128 floats descriptors
+	for(int b=0; b<codes_.rows; b+=kBlock)
+	{
+		int end = b+kBlock<codes_.rows?b+kBlock:codes_.rows;
+		cv::Mat words = decode(codes_.rowRange(b, end));
+		int kk = k<end-b?k:end-b;
+		cv::Mat blockDists;
+		cv::Mat blockResults;
+		cv::batchDistance(queries, words, blockDists, CV_32F, blockResults, cv::NORM_L2SQR, kk, cv::Mat(), 0, false);
+		for(int i=0; i<queries.rows; ++i)
+		{
+			int * ids = results.ptr<int>(i);
+			float * best = dists.ptr<float>(i);
+			for(int j=0; j<kk; ++j)
+			{
+				int id = blockResults.at<int>(i,j);
+				float dist = blockDists.at<float>(i,j);
+				if(id < 0 || dist >= best[k-1])
+				{
+					break; // sorted
+				}
+				// insert sorted
+				int m = k-1;
+				while(m > 0 && best[m-1] > dist)
+				{
+					best[m] = best[m-1];
+					ids[m] = ids[m-1];
+					--m;
+				}
+				best[m] = dist;
+				ids[m] = b + id;
+			}
+		}
+	}
+	for(int i=0; i<queries.rows; ++i)
+	{
+		for(int j=0; j<k && results.at<int>(i,j) >= 0; ++j)
+		{
+			dists.at<float>(i,j) = sqrtf(dists.at<float>(i,j));
+		}
+	}
+}
+
+} // namespace find_object
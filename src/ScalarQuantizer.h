@@ -0,0 +1,87 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SCALARQUANTIZER_H_
+#define SCALARQUANTIZER_H_
+
+#include <opencv2/opencv.hpp>
+
+namespace find_object {
+
+// Scalar quantization of float descriptors (e.g., SIFT, SURF, KAZE), see
+// NearestNeighbor/quantization. Each value is coded on 8 bits (linear
+// mapping between the minimum and maximum values of the training words,
+// values outside are saturated) or as a 16 bits float, 4x or 2x less
+// memory than CV_32FC1. The exhaustive search reads the codes: L2 between
+// 8 bits codes (vectorized in cv::batchDistance) or float16 words decoded
+// in blocks staying in cache. Distances are L2, like cv::BFMatcher.
+// Copies share the codes until new words are added.
+class ScalarQuantizer
+{
+public:
+	enum Type {kNone, kUint8, kFloat16};
+
+public:
+	ScalarQuantizer();
+	// Codes already computed (e.g., loaded from a session)
+	ScalarQuantizer(int type, float offset, float scale, const cv::Mat & codes);
+
+	// Mapping from the range of the words (CV_32FC1), no word added
+	bool train(const cv::Mat & words, int type);
+	// Words coded after the ones already added (ids follow)
+	void add(const cv::Mat & words);
+
+	cv::Mat encode(const cv::Mat & descriptors) const;
+	cv::Mat decode(const cv::Mat & codes) const;
+	// Approximation of the words
+	cv::Mat reconstruct() const {return decode(codes_);}
+
+	// Like Vocabulary::search(), missing neighbors are set to -1
+	void search(const cv::Mat & queries, cv::Mat & results, cv::Mat & dists, int k) const;
+
+	int size() const {return codes_.rows;}
+	bool empty() const {return codes_.empty();}
+	int dim() const {return dim_;}
+	int type() const {return type_;}
+	int codeSize() const {return dim_ * (type_==kUint8?1:2);}
+	float offset() const {return offset_;}
+	float scale() const {return scale_;}
+	const cv::Mat & codes() const {return codes_;} // CV_8UC1 (kUint8) or CV_16UC1 (kFloat16 bits)
+	qint64 memoryUsage() const {return qint64(codes_.total()*codes_.elemSize());}
+
+private:
+	int type_;
+	int dim_;
+	float offset_; // kUint8: value = offset_ + code * scale_
+	float scale_;
+	cv::Mat codes_;
+};
+
+} // namespace find_object
+
+#endif /* SCALARQUANTIZER_H_ */
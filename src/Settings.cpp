@@ -194,6 +194,7 @@ ParametersMap Settings::loadSettings(const QString & fileName)
 		Settings::setFeature2D_Fast_gpu(false);
 		Settings::setFeature2D_ORB_gpu(false);
 		Settings::setNearestNeighbor_BruteForce_gpu(false);
+		Settings::setGeneral_gpuPipeline(false);
 	}
 	return loadedParameters;
 }
@@ -381,6 +382,31 @@ public:
 		}
 	}
 
+	virtual bool detectAndComputeGpu(const cv::Mat & image,
+				std::vector<cv::KeyPoint> & keypoints,
+				GpuMat & descriptors,
+				const cv::Mat & mask = cv::Mat())
+	{
+		CVCUDA::GpuMat imgGpu(image);
+		CVCUDA::GpuMat maskGpu(mask);
+		try
+		{
+			surf_(imgGpu, maskGpu, keypoints, descriptors, false);
+		}
+		catch(cv::Exception &e)
+		{
+			UERROR("GPUSURF error: %s \n(If something about layer_rows, parameter nOctaves=%d of SURF "
+					"is too high for the size of the image (%d,%d).)",
+					e.msg.c_str(),
+					surf_.nOctaves,
+					image.cols,
+					image.rows);
+			keypoints.clear();
+			descriptors = GpuMat();
+		}
+		return true;
+	}
+
 private:
 #if CV_MAJOR_VERSION < 3
     CVCUDA::SURF_GPU surf_;
@@ -607,6 +633,39 @@ public:
 		}
 	}
 
+	virtual bool detectAndComputeGpu(const cv::Mat & image,
+				std::vector<cv::KeyPoint> & keypoints,
+				GpuMat & descriptors,
+				const cv::Mat & mask = cv::Mat())
+	{
+		CVCUDA::GpuMat imgGpu(image);
+		CVCUDA::GpuMat maskGpu(mask);
+		try
+		{
+#if CV_MAJOR_VERSION < 3
+			orb_(imgGpu, maskGpu, keypoints, descriptors);
+#else
+#ifdef HAVE_OPENCV_CUDAFEATURES2D
+			CVCUDA::GpuMat keypointsGpu;
+			orb_->detectAndComputeAsync(imgGpu, maskGpu, keypointsGpu, descriptors, false);
+			orb_->convert(keypointsGpu, keypoints);
+#else
+			return false;
+#endif
+#endif
+		}
+		catch(cv::Exception &e)
+		{
+			UERROR("GPUORB error: %s \n(If something about matrix size, the image/object may be too small (%d,%d).)",
+					e.msg.c_str(),
+					image.cols,
+					image.rows);
+			keypoints.clear();
+			descriptors = GpuMat();
+		}
+		return true;
+	}
+
 private:
 #if CV_MAJOR_VERSION < 3
     CVCUDA::ORB_GPU orb_;
@@ -618,9 +677,14 @@ private:
 };
 
 Feature2D * Settings::createKeypointDetector()
+{
+	return createKeypointDetector(ParametersSnapshot());
+}
+
+Feature2D * Settings::createKeypointDetector(const ParametersSnapshot & parameters)
 {
 	Feature2D * feature2D = 0;
-	QString str = getFeature2D_1Detector();
+	QString str = parameters.Feature2D_1Detector;
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
@@ -682,13 +746,13 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::FeatureDetector>(new cv::DenseFeatureDetector(
-								getFeature2D_Dense_initFeatureScale(),
-								getFeature2D_Dense_featureScaleLevels(),
-								getFeature2D_Dense_featureScaleMul(),
-								getFeature2D_Dense_initXyStep(),
-								getFeature2D_Dense_initImgBound(),
-								getFeature2D_Dense_varyXyStepWithScale(),
-								getFeature2D_Dense_varyImgBoundWithScale())));
+								parameters.Feature2D_Dense_initFeatureScale,
+								parameters.Feature2D_Dense_featureScaleLevels,
+								parameters.Feature2D_Dense_featureScaleMul,
+								parameters.Feature2D_Dense_initXyStep,
+								parameters.Feature2D_Dense_initImgBound,
+								parameters.Feature2D_Dense_varyXyStepWithScale,
+								parameters.Feature2D_Dense_varyImgBoundWithScale)));
 #else
 					UWARN("Find-Object is not built with OpenCV 2 so Dense cannot be used!");
 #endif
@@ -696,23 +760,23 @@ Feature2D * Settings::createKeypointDetector()
 				}
 				else if(strategies.at(index).compare("Fast") == 0)
 				{
-					if(getFeature2D_Fast_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+					if(parameters.Feature2D_Fast_gpu && CVCUDA::getCudaEnabledDeviceCount())
 					{
 						feature2D = new GPUFAST(
-								getFeature2D_Fast_threshold(),
-								getFeature2D_Fast_nonmaxSuppression());
+								parameters.Feature2D_Fast_threshold,
+								parameters.Feature2D_Fast_nonmaxSuppression);
 						UDEBUG("type=%s GPU", strategies.at(index).toStdString().c_str());
 					}
 					else
 					{
 #if CV_MAJOR_VERSION < 3
 						feature2D = new Feature2D(cv::Ptr<cv::FeatureDetector>(new cv::FastFeatureDetector(
-								getFeature2D_Fast_threshold(),
-								getFeature2D_Fast_nonmaxSuppression())));
+								parameters.Feature2D_Fast_threshold,
+								parameters.Feature2D_Fast_nonmaxSuppression)));
 #else
 						feature2D = new Feature2D(cv::FastFeatureDetector::create(
-								getFeature2D_Fast_threshold(),
-								getFeature2D_Fast_nonmaxSuppression()));
+								parameters.Feature2D_Fast_threshold,
+								parameters.Feature2D_Fast_nonmaxSuppression));
 #endif
 						UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 					}
@@ -723,8 +787,8 @@ Feature2D * Settings::createKeypointDetector()
 					UWARN("Find-Object is not built with OpenCV 3 so AGAST cannot be used!");
 #else
 					feature2D = new Feature2D(cv::AgastFeatureDetector::create(
-							getFeature2D_AGAST_threshold(),
-							getFeature2D_AGAST_nonmaxSuppression()));
+							parameters.Feature2D_AGAST_threshold,
+							parameters.Feature2D_AGAST_nonmaxSuppression));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
@@ -732,20 +796,20 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::FeatureDetector>(new cv::GFTTDetector(
-							getFeature2D_GFTT_maxCorners(),
-							getFeature2D_GFTT_qualityLevel(),
-							getFeature2D_GFTT_minDistance(),
-							getFeature2D_GFTT_blockSize(),
-							getFeature2D_GFTT_useHarrisDetector(),
-							getFeature2D_GFTT_k())));
+							parameters.Feature2D_GFTT_maxCorners,
+							parameters.Feature2D_GFTT_qualityLevel,
+							parameters.Feature2D_GFTT_minDistance,
+							parameters.Feature2D_GFTT_blockSize,
+							parameters.Feature2D_GFTT_useHarrisDetector,
+							parameters.Feature2D_GFTT_k)));
 #else
 					feature2D = new Feature2D(cv::GFTTDetector::create(
-							getFeature2D_GFTT_maxCorners(),
-							getFeature2D_GFTT_qualityLevel(),
-							getFeature2D_GFTT_minDistance(),
-							getFeature2D_GFTT_blockSize(),
-							getFeature2D_GFTT_useHarrisDetector(),
-							getFeature2D_GFTT_k()));
+							parameters.Feature2D_GFTT_maxCorners,
+							parameters.Feature2D_GFTT_qualityLevel,
+							parameters.Feature2D_GFTT_minDistance,
+							parameters.Feature2D_GFTT_blockSize,
+							parameters.Feature2D_GFTT_useHarrisDetector,
+							parameters.Feature2D_GFTT_k));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
@@ -753,47 +817,47 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::FeatureDetector>(new cv::MSER(
-							getFeature2D_MSER_delta(),
-							getFeature2D_MSER_minArea(),
-							getFeature2D_MSER_maxArea(),
-							getFeature2D_MSER_maxVariation(),
-							getFeature2D_MSER_minDiversity(),
-							getFeature2D_MSER_maxEvolution(),
-							getFeature2D_MSER_areaThreshold(),
-							getFeature2D_MSER_minMargin(),
-							getFeature2D_MSER_edgeBlurSize())));
+							parameters.Feature2D_MSER_delta,
+							parameters.Feature2D_MSER_minArea,
+							parameters.Feature2D_MSER_maxArea,
+							parameters.Feature2D_MSER_maxVariation,
+							parameters.Feature2D_MSER_minDiversity,
+							parameters.Feature2D_MSER_maxEvolution,
+							parameters.Feature2D_MSER_areaThreshold,
+							parameters.Feature2D_MSER_minMargin,
+							parameters.Feature2D_MSER_edgeBlurSize)));
 #else
 					feature2D = new Feature2D(cv::MSER::create(
-							getFeature2D_MSER_delta(),
-							getFeature2D_MSER_minArea(),
-							getFeature2D_MSER_maxArea(),
-							getFeature2D_MSER_maxVariation(),
-							getFeature2D_MSER_minDiversity(),
-							getFeature2D_MSER_maxEvolution(),
-							getFeature2D_MSER_areaThreshold(),
-							getFeature2D_MSER_minMargin(),
-							getFeature2D_MSER_edgeBlurSize()));
+							parameters.Feature2D_MSER_delta,
+							parameters.Feature2D_MSER_minArea,
+							parameters.Feature2D_MSER_maxArea,
+							parameters.Feature2D_MSER_maxVariation,
+							parameters.Feature2D_MSER_minDiversity,
+							parameters.Feature2D_MSER_maxEvolution,
+							parameters.Feature2D_MSER_areaThreshold,
+							parameters.Feature2D_MSER_minMargin,
+							parameters.Feature2D_MSER_edgeBlurSize));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
 				else if(strategies.at(index).compare("ORB") == 0)
 				{
-					if(getFeature2D_ORB_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+					if(parameters.Feature2D_ORB_gpu && CVCUDA::getCudaEnabledDeviceCount())
 					{
 						feature2D = new GPUORB(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize(),
-								getFeature2D_Fast_threshold(),
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize,
+								parameters.Feature2D_Fast_threshold,
 #if CV_MAJOR_VERSION < 3
-								getFeature2D_Fast_nonmaxSuppression());
+								parameters.Feature2D_Fast_nonmaxSuppression);
 #else
-								getFeature2D_ORB_blurForDescriptor());
+								parameters.Feature2D_ORB_blurForDescriptor);
 #endif
 						UDEBUG("type=%s (GPU)", strategies.at(index).toStdString().c_str());
 					}
@@ -801,25 +865,25 @@ Feature2D * Settings::createKeypointDetector()
 					{
 #if CV_MAJOR_VERSION < 3
 						feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::ORB(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize())));
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize)));
 #else
 						feature2D = new Feature2D(cv::ORB::create(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize(),
-								getFeature2D_Fast_threshold()));
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize,
+								parameters.Feature2D_Fast_threshold));
 #endif
 						UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 					}
@@ -828,19 +892,19 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::FeatureDetector>(new cv::StarFeatureDetector(
-								getFeature2D_Star_maxSize(),
-								getFeature2D_Star_responseThreshold(),
-								getFeature2D_Star_lineThresholdProjected(),
-								getFeature2D_Star_lineThresholdBinarized(),
-								getFeature2D_Star_suppressNonmaxSize())));
+								parameters.Feature2D_Star_maxSize,
+								parameters.Feature2D_Star_responseThreshold,
+								parameters.Feature2D_Star_lineThresholdProjected,
+								parameters.Feature2D_Star_lineThresholdBinarized,
+								parameters.Feature2D_Star_suppressNonmaxSize)));
 #else
 #ifdef HAVE_OPENCV_XFEATURES2D
 					feature2D = new Feature2D(cv::xfeatures2d::StarDetector::create(
-								getFeature2D_Star_maxSize(),
-								getFeature2D_Star_responseThreshold(),
-								getFeature2D_Star_lineThresholdProjected(),
-								getFeature2D_Star_lineThresholdBinarized(),
-								getFeature2D_Star_suppressNonmaxSize()));
+								parameters.Feature2D_Star_maxSize,
+								parameters.Feature2D_Star_responseThreshold,
+								parameters.Feature2D_Star_lineThresholdProjected,
+								parameters.Feature2D_Star_lineThresholdBinarized,
+								parameters.Feature2D_Star_suppressNonmaxSize));
 #else
 					UWARN("Find-Object is not built with OpenCV xfeatures2d module so Star cannot be used!");
 #endif
@@ -851,14 +915,14 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::BRISK(
-							getFeature2D_BRISK_thresh(),
-							getFeature2D_BRISK_octaves(),
-							getFeature2D_BRISK_patternScale())));
+							parameters.Feature2D_BRISK_thresh,
+							parameters.Feature2D_BRISK_octaves,
+							parameters.Feature2D_BRISK_patternScale)));
 #else
 					feature2D = new Feature2D(cv::BRISK::create(
-							getFeature2D_BRISK_thresh(),
-							getFeature2D_BRISK_octaves(),
-							getFeature2D_BRISK_patternScale()));
+							parameters.Feature2D_BRISK_thresh,
+							parameters.Feature2D_BRISK_octaves,
+							parameters.Feature2D_BRISK_patternScale));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
@@ -868,11 +932,11 @@ Feature2D * Settings::createKeypointDetector()
 					UWARN("Find-Object is not built with OpenCV 3 so KAZE cannot be used!");
 #else
 					feature2D = new Feature2D(cv::KAZE::create(
-							getFeature2D_KAZE_extended(),
-							getFeature2D_KAZE_upright(),
-							getFeature2D_KAZE_threshold(),
-							getFeature2D_KAZE_nOctaves(),
-							getFeature2D_KAZE_nOctaveLayers(),
+							parameters.Feature2D_KAZE_extended,
+							parameters.Feature2D_KAZE_upright,
+							parameters.Feature2D_KAZE_threshold,
+							parameters.Feature2D_KAZE_nOctaves,
+							parameters.Feature2D_KAZE_nOctaveLayers,
 							cv::KAZE::DIFF_PM_G2)); // FIXME: make a parameter
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
@@ -884,11 +948,11 @@ Feature2D * Settings::createKeypointDetector()
 #else
 					feature2D = new Feature2D(cv::AKAZE::create(
 							cv::AKAZE::DESCRIPTOR_MLDB, // FIXME: make a parameter
-							getFeature2D_AKAZE_descriptorSize(),
-							getFeature2D_AKAZE_descriptorChannels(),
-							getFeature2D_AKAZE_threshold(),
-							getFeature2D_AKAZE_nOctaves(),
-							getFeature2D_AKAZE_nOctaveLayers(),
+							parameters.Feature2D_AKAZE_descriptorSize,
+							parameters.Feature2D_AKAZE_descriptorChannels,
+							parameters.Feature2D_AKAZE_threshold,
+							parameters.Feature2D_AKAZE_nOctaves,
+							parameters.Feature2D_AKAZE_nOctaveLayers,
 							cv::KAZE::DIFF_PM_G2)); // FIXME: make a parameter
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
@@ -898,50 +962,50 @@ Feature2D * Settings::createKeypointDetector()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::SIFT(
-							getFeature2D_SIFT_nfeatures(),
-							getFeature2D_SIFT_nOctaveLayers(),
-							getFeature2D_SIFT_contrastThreshold(),
-							getFeature2D_SIFT_edgeThreshold(),
-							getFeature2D_SIFT_sigma())));
+							parameters.Feature2D_SIFT_nfeatures,
+							parameters.Feature2D_SIFT_nOctaveLayers,
+							parameters.Feature2D_SIFT_contrastThreshold,
+							parameters.Feature2D_SIFT_edgeThreshold,
+							parameters.Feature2D_SIFT_sigma)));
 #else
 					feature2D = new Feature2D(cv::xfeatures2d::SIFT::create(
-							getFeature2D_SIFT_nfeatures(),
-							getFeature2D_SIFT_nOctaveLayers(),
-							getFeature2D_SIFT_contrastThreshold(),
-							getFeature2D_SIFT_edgeThreshold(),
-							getFeature2D_SIFT_sigma()));
+							parameters.Feature2D_SIFT_nfeatures,
+							parameters.Feature2D_SIFT_nOctaveLayers,
+							parameters.Feature2D_SIFT_contrastThreshold,
+							parameters.Feature2D_SIFT_edgeThreshold,
+							parameters.Feature2D_SIFT_sigma));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
 				else if(strategies.at(index).compare("SURF") == 0)
 				{
-					if(getFeature2D_SURF_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+					if(parameters.Feature2D_SURF_gpu && CVCUDA::getCudaEnabledDeviceCount())
 					{
 						feature2D = new GPUSURF(
-								getFeature2D_SURF_hessianThreshold(),
-								getFeature2D_SURF_nOctaves(),
-								getFeature2D_SURF_nOctaveLayers(),
-								getFeature2D_SURF_extended(),
-								getFeature2D_SURF_keypointsRatio(),
-								getFeature2D_SURF_upright());
+								parameters.Feature2D_SURF_hessianThreshold,
+								parameters.Feature2D_SURF_nOctaves,
+								parameters.Feature2D_SURF_nOctaveLayers,
+								parameters.Feature2D_SURF_extended,
+								parameters.Feature2D_SURF_keypointsRatio,
+								parameters.Feature2D_SURF_upright);
 						UDEBUG("type=%s (GPU)", strategies.at(index).toStdString().c_str());
 					}
 					else
 					{
 #if CV_MAJOR_VERSION < 3
 						feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::SURF(
-							getFeature2D_SURF_hessianThreshold(),
-							getFeature2D_SURF_nOctaves(),
-							getFeature2D_SURF_nOctaveLayers(),
-							getFeature2D_SURF_extended(),
-							getFeature2D_SURF_upright())));
+							parameters.Feature2D_SURF_hessianThreshold,
+							parameters.Feature2D_SURF_nOctaves,
+							parameters.Feature2D_SURF_nOctaveLayers,
+							parameters.Feature2D_SURF_extended,
+							parameters.Feature2D_SURF_upright)));
 #else
 						feature2D = new Feature2D(cv::xfeatures2d::SURF::create(
-							getFeature2D_SURF_hessianThreshold(),
-							getFeature2D_SURF_nOctaves(),
-							getFeature2D_SURF_nOctaveLayers(),
-							getFeature2D_SURF_extended(),
-							getFeature2D_SURF_upright()));
+							parameters.Feature2D_SURF_hessianThreshold,
+							parameters.Feature2D_SURF_nOctaves,
+							parameters.Feature2D_SURF_nOctaveLayers,
+							parameters.Feature2D_SURF_extended,
+							parameters.Feature2D_SURF_upright));
 #endif
 						UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 					}
@@ -955,9 +1019,14 @@ Feature2D * Settings::createKeypointDetector()
 }
 
 Feature2D * Settings::createDescriptorExtractor()
+{
+	return createDescriptorExtractor(ParametersSnapshot());
+}
+
+Feature2D * Settings::createDescriptorExtractor(const ParametersSnapshot & parameters)
 {
 	Feature2D * feature2D = 0;
-	QString str = getFeature2D_2Descriptor();
+	QString str = parameters.Feature2D_2Descriptor;
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
@@ -1013,11 +1082,11 @@ Feature2D * Settings::createDescriptorExtractor()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::DescriptorExtractor>(new cv::BriefDescriptorExtractor(
-								getFeature2D_Brief_bytes())));
+								parameters.Feature2D_Brief_bytes)));
 #else
 #ifdef HAVE_OPENCV_XFEATURES2D
 					feature2D = new Feature2D(cv::xfeatures2d::BriefDescriptorExtractor::create(
-								getFeature2D_Brief_bytes()));
+								parameters.Feature2D_Brief_bytes));
 #else
 					UWARN("Find-Object is not built with OpenCV xfeatures2d module so Brief cannot be used!");
 #endif
@@ -1026,44 +1095,44 @@ Feature2D * Settings::createDescriptorExtractor()
 				}
 				else if(strategies.at(index).compare("ORB") == 0)
 				{
-					if(getFeature2D_ORB_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+					if(parameters.Feature2D_ORB_gpu && CVCUDA::getCudaEnabledDeviceCount())
 					{
 						feature2D = new GPUORB(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize(),
-								getFeature2D_Fast_threshold(),
-								getFeature2D_Fast_nonmaxSuppression());
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize,
+								parameters.Feature2D_Fast_threshold,
+								parameters.Feature2D_Fast_nonmaxSuppression);
 						UDEBUG("type=%s (GPU)", strategies.at(index).toStdString().c_str());
 					}
 					else
 					{
 #if CV_MAJOR_VERSION < 3
 						feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::ORB(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize())));
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize)));
 #else
 						feature2D = new Feature2D(cv::ORB::create(
-								getFeature2D_ORB_nFeatures(),
-								getFeature2D_ORB_scaleFactor(),
-								getFeature2D_ORB_nLevels(),
-								getFeature2D_ORB_edgeThreshold(),
-								getFeature2D_ORB_firstLevel(),
-								getFeature2D_ORB_WTA_K(),
-								getFeature2D_ORB_scoreType(),
-								getFeature2D_ORB_patchSize(),
-								getFeature2D_Fast_threshold()));
+								parameters.Feature2D_ORB_nFeatures,
+								parameters.Feature2D_ORB_scaleFactor,
+								parameters.Feature2D_ORB_nLevels,
+								parameters.Feature2D_ORB_edgeThreshold,
+								parameters.Feature2D_ORB_firstLevel,
+								parameters.Feature2D_ORB_WTA_K,
+								parameters.Feature2D_ORB_scoreType,
+								parameters.Feature2D_ORB_patchSize,
+								parameters.Feature2D_Fast_threshold));
 #endif
 						UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 					}
@@ -1072,14 +1141,14 @@ Feature2D * Settings::createDescriptorExtractor()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::BRISK(
-							getFeature2D_BRISK_thresh(),
-							getFeature2D_BRISK_octaves(),
-							getFeature2D_BRISK_patternScale())));
+							parameters.Feature2D_BRISK_thresh,
+							parameters.Feature2D_BRISK_octaves,
+							parameters.Feature2D_BRISK_patternScale)));
 #else
 					feature2D = new Feature2D(cv::BRISK::create(
-							getFeature2D_BRISK_thresh(),
-							getFeature2D_BRISK_octaves(),
-							getFeature2D_BRISK_patternScale()));
+							parameters.Feature2D_BRISK_thresh,
+							parameters.Feature2D_BRISK_octaves,
+							parameters.Feature2D_BRISK_patternScale));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
@@ -1089,11 +1158,11 @@ Feature2D * Settings::createDescriptorExtractor()
 					UWARN("Find-Object is not built with OpenCV 3 so KAZE cannot be used!");
 #else
 					feature2D = new Feature2D(cv::KAZE::create(
-							getFeature2D_KAZE_extended(),
-							getFeature2D_KAZE_upright(),
-							getFeature2D_KAZE_threshold(),
-							getFeature2D_KAZE_nOctaves(),
-							getFeature2D_KAZE_nOctaveLayers(),
+							parameters.Feature2D_KAZE_extended,
+							parameters.Feature2D_KAZE_upright,
+							parameters.Feature2D_KAZE_threshold,
+							parameters.Feature2D_KAZE_nOctaves,
+							parameters.Feature2D_KAZE_nOctaveLayers,
 							cv::KAZE::DIFF_PM_G2)); // FIXME: make a parameter
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
@@ -1105,11 +1174,11 @@ Feature2D * Settings::createDescriptorExtractor()
 #else
 					feature2D = new Feature2D(cv::AKAZE::create(
 							cv::AKAZE::DESCRIPTOR_MLDB, // FIXME: make a parameter
-							getFeature2D_AKAZE_descriptorSize(),
-							getFeature2D_AKAZE_descriptorChannels(),
-							getFeature2D_AKAZE_threshold(),
-							getFeature2D_AKAZE_nOctaves(),
-							getFeature2D_AKAZE_nOctaveLayers(),
+							parameters.Feature2D_AKAZE_descriptorSize,
+							parameters.Feature2D_AKAZE_descriptorChannels,
+							parameters.Feature2D_AKAZE_threshold,
+							parameters.Feature2D_AKAZE_nOctaves,
+							parameters.Feature2D_AKAZE_nOctaveLayers,
 							cv::KAZE::DIFF_PM_G2)); // FIXME: make a parameter
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
@@ -1118,17 +1187,17 @@ Feature2D * Settings::createDescriptorExtractor()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::DescriptorExtractor>(new cv::FREAK(
-							getFeature2D_FREAK_orientationNormalized(),
-							getFeature2D_FREAK_scaleNormalized(),
-							getFeature2D_FREAK_patternScale(),
-							getFeature2D_FREAK_nOctaves())));
+							parameters.Feature2D_FREAK_orientationNormalized,
+							parameters.Feature2D_FREAK_scaleNormalized,
+							parameters.Feature2D_FREAK_patternScale,
+							parameters.Feature2D_FREAK_nOctaves)));
 #else
 #ifdef HAVE_OPENCV_XFEATURES2D
 					feature2D = new Feature2D(cv::xfeatures2d::FREAK::create(
-							getFeature2D_FREAK_orientationNormalized(),
-							getFeature2D_FREAK_scaleNormalized(),
-							getFeature2D_FREAK_patternScale(),
-							getFeature2D_FREAK_nOctaves()));
+							parameters.Feature2D_FREAK_orientationNormalized,
+							parameters.Feature2D_FREAK_scaleNormalized,
+							parameters.Feature2D_FREAK_patternScale,
+							parameters.Feature2D_FREAK_nOctaves));
 #else
 					UWARN("Find-Object is not built with OpenCV xfeatures2d module so Freak cannot be used!");
 #endif
@@ -1140,31 +1209,31 @@ Feature2D * Settings::createDescriptorExtractor()
 				else if(strategies.at(index).compare("LUCID") == 0)
 				{
 					feature2D = new Feature2D(cv::xfeatures2d::LUCID::create(
-							getFeature2D_LUCID_kernel(),
-							getFeature2D_LUCID_blur_kernel()));
+							parameters.Feature2D_LUCID_kernel,
+							parameters.Feature2D_LUCID_blur_kernel));
 
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
 				else if(strategies.at(index).compare("LATCH") == 0)
 				{
 					feature2D = new Feature2D(cv::xfeatures2d::LATCH::create(
-							getFeature2D_LATCH_bytes(),
-							getFeature2D_LATCH_rotationInvariance(),
-							getFeature2D_LATCH_half_ssd_size()));
+							parameters.Feature2D_LATCH_bytes,
+							parameters.Feature2D_LATCH_rotationInvariance,
+							parameters.Feature2D_LATCH_half_ssd_size));
 
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
 				else if(strategies.at(index).compare("DAISY") == 0)
 				{
 					feature2D = new Feature2D(cv::xfeatures2d::DAISY::create(
-							getFeature2D_DAISY_radius(),
-							getFeature2D_DAISY_q_radius(),
-							getFeature2D_DAISY_q_theta(),
-							getFeature2D_DAISY_q_hist(),
+							parameters.Feature2D_DAISY_radius,
+							parameters.Feature2D_DAISY_q_radius,
+							parameters.Feature2D_DAISY_q_theta,
+							parameters.Feature2D_DAISY_q_hist,
 							cv::xfeatures2d::DAISY::NRM_NONE,
 							cv::noArray(),
-							getFeature2D_DAISY_interpolation(),
-							getFeature2D_DAISY_use_orientation()));
+							parameters.Feature2D_DAISY_interpolation,
+							parameters.Feature2D_DAISY_use_orientation));
 
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
@@ -1174,50 +1243,50 @@ Feature2D * Settings::createDescriptorExtractor()
 				{
 #if CV_MAJOR_VERSION < 3
 					feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::SIFT(
-							getFeature2D_SIFT_nfeatures(),
-							getFeature2D_SIFT_nOctaveLayers(),
-							getFeature2D_SIFT_contrastThreshold(),
-							getFeature2D_SIFT_edgeThreshold(),
-							getFeature2D_SIFT_sigma())));
+							parameters.Feature2D_SIFT_nfeatures,
+							parameters.Feature2D_SIFT_nOctaveLayers,
+							parameters.Feature2D_SIFT_contrastThreshold,
+							parameters.Feature2D_SIFT_edgeThreshold,
+							parameters.Feature2D_SIFT_sigma)));
 #else
 					feature2D = new Feature2D(cv::xfeatures2d::SIFT::create(
-							getFeature2D_SIFT_nfeatures(),
-							getFeature2D_SIFT_nOctaveLayers(),
-							getFeature2D_SIFT_contrastThreshold(),
-							getFeature2D_SIFT_edgeThreshold(),
-							getFeature2D_SIFT_sigma()));
+							parameters.Feature2D_SIFT_nfeatures,
+							parameters.Feature2D_SIFT_nOctaveLayers,
+							parameters.Feature2D_SIFT_contrastThreshold,
+							parameters.Feature2D_SIFT_edgeThreshold,
+							parameters.Feature2D_SIFT_sigma));
 #endif
 					UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 				}
 				else if(strategies.at(index).compare("SURF") == 0)
 				{
-					if(getFeature2D_SURF_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+					if(parameters.Feature2D_SURF_gpu && CVCUDA::getCudaEnabledDeviceCount())
 					{
 						feature2D = new GPUSURF(
-								getFeature2D_SURF_hessianThreshold(),
-								getFeature2D_SURF_nOctaves(),
-								getFeature2D_SURF_nOctaveLayers(),
-								getFeature2D_SURF_extended(),
-								getFeature2D_SURF_keypointsRatio(),
-								getFeature2D_SURF_upright());
+								parameters.Feature2D_SURF_hessianThreshold,
+								parameters.Feature2D_SURF_nOctaves,
+								parameters.Feature2D_SURF_nOctaveLayers,
+								parameters.Feature2D_SURF_extended,
+								parameters.Feature2D_SURF_keypointsRatio,
+								parameters.Feature2D_SURF_upright);
 						UDEBUG("type=%s (GPU)", strategies.at(index).toStdString().c_str());
 					}
 					else
 					{
 #if CV_MAJOR_VERSION < 3
 						feature2D = new Feature2D(cv::Ptr<cv::Feature2D>(new cv::SURF(
-								getFeature2D_SURF_hessianThreshold(),
-								getFeature2D_SURF_nOctaves(),
-								getFeature2D_SURF_nOctaveLayers(),
-								getFeature2D_SURF_extended(),
-								getFeature2D_SURF_upright())));
+								parameters.Feature2D_SURF_hessianThreshold,
+								parameters.Feature2D_SURF_nOctaves,
+								parameters.Feature2D_SURF_nOctaveLayers,
+								parameters.Feature2D_SURF_extended,
+								parameters.Feature2D_SURF_upright)));
 #else
 						feature2D = new Feature2D(cv::xfeatures2d::SURF::create(
-								getFeature2D_SURF_hessianThreshold(),
-								getFeature2D_SURF_nOctaves(),
-								getFeature2D_SURF_nOctaveLayers(),
-								getFeature2D_SURF_extended(),
-								getFeature2D_SURF_upright()));
+								parameters.Feature2D_SURF_hessianThreshold,
+								parameters.Feature2D_SURF_nOctaves,
+								parameters.Feature2D_SURF_nOctaveLayers,
+								parameters.Feature2D_SURF_extended,
+								parameters.Feature2D_SURF_upright));
 #endif
 						UDEBUG("type=%s", strategies.at(index).toStdString().c_str());
 					}
@@ -1232,26 +1301,46 @@ Feature2D * Settings::createDescriptorExtractor()
 
 QString Settings::currentDetectorType()
 {
-	int index = getFeature2D_1Detector().split(':').first().toInt();
-	return getFeature2D_1Detector().split(':').last().split(';').at(index);
+	return currentDetectorType(ParametersSnapshot());
+}
+
+QString Settings::currentDetectorType(const ParametersSnapshot & parameters)
+{
+	int index = parameters.Feature2D_1Detector.split(':').first().toInt();
+	return parameters.Feature2D_1Detector.split(':').last().split(';').at(index);
 }
 
 QString Settings::currentDescriptorType()
 {
-	int index = getFeature2D_2Descriptor().split(':').first().toInt();
-	return getFeature2D_2Descriptor().split(':').last().split(';').at(index);
+	return currentDescriptorType(ParametersSnapshot());
+}
+
+QString Settings::currentDescriptorType(const ParametersSnapshot & parameters)
+{
+	int index = parameters.Feature2D_2Descriptor.split(':').first().toInt();
+	return parameters.Feature2D_2Descriptor.split(':').last().split(';').at(index);
 }
 
 QString Settings::currentNearestNeighborType()
 {
-	int index = getNearestNeighbor_1Strategy().split(':').first().toInt();
-	return getNearestNeighbor_1Strategy().split(':').last().split(';').at(index);
+	return currentNearestNeighborType(ParametersSnapshot());
+}
+
+QString Settings::currentNearestNeighborType(const ParametersSnapshot & parameters)
+{
+	int index = parameters.NearestNeighbor_1Strategy.split(':').first().toInt();
+	return parameters.NearestNeighbor_1Strategy.split(':').last().split(';').at(index);
 }
 
 bool Settings::isBruteForceNearestNeighbor()
+{
+	return isBruteForceNearestNeighbor(ParametersSnapshot());
+}
+
+bool Settings::isBruteForceNearestNeighbor(const ParametersSnapshot & parameters)
 {
 	bool bruteForce = false;
-	QString str = getNearestNeighbor_1Strategy();
+	QString str = parameters.NearestNeighbor_1Strategy;
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
@@ -1260,7 +1349,8 @@ bool Settings::isBruteForceNearestNeighbor()
 		if(ok)
 		{
 			QStringList strategies = split.last().split(';');
-			if(strategies.size() >= 7 && index == 6)
+			if((strategies.size() >= 7 && index == 6) ||
+			   (strategies.size() >= 8 && index == 7))
 			{
 				bruteForce = true;
 			}
@@ -1269,10 +1359,67 @@ bool Settings::isBruteForceNearestNeighbor()
 	return bruteForce;
 }
 
+bool Settings::isHammingNearestNeighbor()
+{
+	return isHammingNearestNeighbor(ParametersSnapshot());
+}
+
+bool Settings::isHammingNearestNeighbor(const ParametersSnapshot & parameters)
+{
+	bool hamming = false;
+	QString str = parameters.NearestNeighbor_1Strategy;
+	QStringList split = str.split(':');
+	if(split.size()==2)
+	{
+		bool ok = false;
+		int index = split.first().toInt(&ok);
+		if(ok)
+		{
+			QStringList strategies = split.last().split(';');
+			if(strategies.size() >= 8 && index == 7)
+			{
+				hamming = true;
+			}
+		}
+	}
+	return hamming;
+}
+
+bool Settings::isProductQuantizationNearestNeighbor()
+{
+	return isProductQuantizationNearestNeighbor(ParametersSnapshot());
+}
+
+bool Settings::isProductQuantizationNearestNeighbor(const ParametersSnapshot & parameters)
+{
+	bool pq = false;
+	QString str = parameters.NearestNeighbor_1Strategy;
+	QStringList split = str.split(':');
+	if(split.size()==2)
+	{
+		bool ok = false;
+		int index = split.first().toInt(&ok);
+		if(ok)
+		{
+			QStringList strategies = split.last().split(';');
+			if(strategies.size() >= 9 && index == 8)
+			{
+				pq = true;
+			}
+		}
+	}
+	return pq;
+}
+
 cv::flann::IndexParams * Settings::createFlannIndexParams()
+{
+	return createFlannIndexParams(ParametersSnapshot());
+}
+
+cv::flann::IndexParams * Settings::createFlannIndexParams(const ParametersSnapshot & parameters)
 {
 	cv::flann::IndexParams * params = 0;
-	QString str = getNearestNeighbor_1Strategy();
+	QString str = parameters.NearestNeighbor_1Strategy;
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
@@ -1297,14 +1444,14 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 					{
 						UDEBUG("type=%s", "KDTree");
 						params = new cv::flann::KDTreeIndexParams(
-								getNearestNeighbor_KDTree_trees());
+								parameters.NearestNeighbor_KDTree_trees);
 					}
 					break;
 				case 2:
 					if(strategies.at(index).compare("KMeans") == 0)
 					{
 						cvflann::flann_centers_init_t centers_init = cvflann::FLANN_CENTERS_RANDOM;
-						QString str = getNearestNeighbor_KMeans_centers_init();
+						QString str = parameters.NearestNeighbor_KMeans_centers_init;
 						QStringList split = str.split(':');
 						if(split.size()==2)
 						{
@@ -1317,17 +1464,17 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 						}
 						UDEBUG("type=%s", "KMeans");
 						params = new cv::flann::KMeansIndexParams(
-								getNearestNeighbor_KMeans_branching(),
-								getNearestNeighbor_KMeans_iterations(),
+								parameters.NearestNeighbor_KMeans_branching,
+								parameters.NearestNeighbor_KMeans_iterations,
 								centers_init,
-								getNearestNeighbor_KMeans_cb_index());
+								parameters.NearestNeighbor_KMeans_cb_index);
 					}
 					break;
 				case 3:
 					if(strategies.at(index).compare("Composite") == 0)
 					{
 						cvflann::flann_centers_init_t centers_init = cvflann::FLANN_CENTERS_RANDOM;
-						QString str = getNearestNeighbor_Composite_centers_init();
+						QString str = parameters.NearestNeighbor_Composite_centers_init;
 						QStringList split = str.split(':');
 						if(split.size()==2)
 						{
@@ -1340,11 +1487,11 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 						}
 						UDEBUG("type=%s", "Composite");
 						params = new cv::flann::CompositeIndexParams(
-								getNearestNeighbor_Composite_trees(),
-								getNearestNeighbor_Composite_branching(),
-								getNearestNeighbor_Composite_iterations(),
+								parameters.NearestNeighbor_Composite_trees,
+								parameters.NearestNeighbor_Composite_branching,
+								parameters.NearestNeighbor_Composite_iterations,
 								centers_init,
-								getNearestNeighbor_Composite_cb_index());
+								parameters.NearestNeighbor_Composite_cb_index);
 					}
 					break;
 				case 4:
@@ -1352,10 +1499,10 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 					{
 						UDEBUG("type=%s", "Autotuned");
 						params = new cv::flann::AutotunedIndexParams(
-								getNearestNeighbor_Autotuned_target_precision(),
-								getNearestNeighbor_Autotuned_build_weight(),
-								getNearestNeighbor_Autotuned_memory_weight(),
-								getNearestNeighbor_Autotuned_sample_fraction());
+								parameters.NearestNeighbor_Autotuned_target_precision,
+								parameters.NearestNeighbor_Autotuned_build_weight,
+								parameters.NearestNeighbor_Autotuned_memory_weight,
+								parameters.NearestNeighbor_Autotuned_sample_fraction);
 					}
 					break;
 				case 5:
@@ -1363,9 +1510,9 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 					{
 						UDEBUG("type=%s", "Lsh");
 						params = new cv::flann::LshIndexParams(
-								getNearestNeighbor_Lsh_table_number(),
-								getNearestNeighbor_Lsh_key_size(),
-								getNearestNeighbor_Lsh_multi_probe_level());
+								parameters.NearestNeighbor_Lsh_table_number,
+								parameters.NearestNeighbor_Lsh_key_size,
+								parameters.NearestNeighbor_Lsh_multi_probe_level);
 
 					}
 					break;
@@ -1384,9 +1531,14 @@ cv::flann::IndexParams * Settings::createFlannIndexParams()
 }
 
 cvflann::flann_distance_t Settings::getFlannDistanceType()
+{
+	return getFlannDistanceType(ParametersSnapshot());
+}
+
+cvflann::flann_distance_t Settings::getFlannDistanceType(const ParametersSnapshot & parameters)
 {
 	cvflann::flann_distance_t distance = cvflann::FLANN_DIST_L2;
-	QString str = getNearestNeighbor_2Distance_type();
+	QString str = parameters.NearestNeighbor_2Distance_type;
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
@@ -1406,39 +1558,106 @@ cvflann::flann_distance_t Settings::getFlannDistanceType()
 
 int Settings::getHomographyMethod()
 {
-	int method = cv::RANSAC;
-	QString str = getHomography_method();
+	return getHomographyMethod(getHomography_method());
+}
+
+// cv::USAC_* since OpenCV 4.5.1
+#if CV_MAJOR_VERSION > 4 || (CV_MAJOR_VERSION == 4 && (CV_MINOR_VERSION > 5 || (CV_MINOR_VERSION == 5 && CV_SUBMINOR_VERSION >= 1)))
+#define FINDOBJECT_USAC
+#endif
+
+static int homographyMethodIndex(const QString & str)
+{
 	QStringList split = str.split(':');
 	if(split.size()==2)
 	{
 		bool ok = false;
 		int index = split.first().toInt(&ok);
-		if(ok)
+		if(ok && index>=0 && index<split.last().split(';').size())
 		{
-			QStringList strategies = split.last().split(';');
-			if(strategies.size() == 2 && index>=0 && index<2)
-			{
-				switch(method)
-				{
+			return index;
+		}
+	}
+	return 1; // RANSAC
+}
+
+int Settings::getHomographyMethod(const QString & str)
+{
+	int method = cv::RANSAC;
+	switch(homographyMethodIndex(str))
+	{
+	case 0:
+		method = cv::LMEDS;
+		break;
 #if CV_MAJOR_VERSION >= 3
-				case 2:
-					method = cv::RHO;
-					break;
+	case 2:
+		method = cv::RHO;
+		break;
+	case 3:
+#ifdef FINDOBJECT_USAC
+		method = cv::USAC_PROSAC;
+#else
+		method = cv::RHO; // PROSAC-based too
 #endif
-				case 0:
-					method = cv::LMEDS;
-					break;
-				default:
-					method = cv::RANSAC;
-					break;
-				}
-			}
-		}
+		break;
+#endif
+	case 4:
+#ifdef FINDOBJECT_USAC
+		method = cv::USAC_DEFAULT;
+#else
+		method = cv::RANSAC;
+#endif
+		break;
+	default:
+		method = cv::RANSAC;
+		break;
 	}
 	UDEBUG("method=%d", method);
 	return method;
 }
 
+bool Settings::isHomographyMethodOrdered(const QString & str)
+{
+	int index = homographyMethodIndex(str);
+	return index == 2 || index == 3;
+}
+
+// same conversions as the Settings getters
+static void fromVariant(const QVariant & value, bool & out) {out = value.toBool();}
+static void fromVariant(const QVariant & value, int & out) {out = value.toInt();}
+static void fromVariant(const QVariant & value, uint & out) {out = value.toUInt();}
+static void fromVariant(const QVariant & value, float & out) {out = value.toFloat();}
+static void fromVariant(const QVariant & value, double & out) {out = value.toDouble();}
+static void fromVariant(const QVariant & value, QString & out) {out = value.toString();}
+
+#define PARAMETER(PREFIX, NAME, TYPE, DEFAULT_VALUE, DESCRIPTION) \
+	fromVariant(parameters.value(#PREFIX "/" #NAME, QVariant(Settings::default##PREFIX##_##NAME())), PREFIX##_##NAME);
+#define PARAMETER_COND(PREFIX, NAME, TYPE, COND, DEFAULT_VALUE1, DEFAULT_VALUE2, DESCRIPTION) \
+	fromVariant(parameters.value(#PREFIX "/" #NAME, QVariant(Settings::default##PREFIX##_##NAME())), PREFIX##_##NAME);
+
+ParametersSnapshot::ParametersSnapshot(const ParametersMap & parameters)
+{
+#include "find_object/SettingsParameters.h"
+}
+
+#undef PARAMETER
+#undef PARAMETER_COND
+
+#define PARAMETER(PREFIX, NAME, TYPE, DEFAULT_VALUE, DESCRIPTION) \
+	parameters.insert(#PREFIX "/" #NAME, QVariant(PREFIX##_##NAME));
+#define PARAMETER_COND(PREFIX, NAME, TYPE, COND, DEFAULT_VALUE1, DEFAULT_VALUE2, DESCRIPTION) \
+	parameters.insert(#PREFIX "/" #NAME, QVariant(PREFIX##_##NAME));
+
+ParametersMap ParametersSnapshot::toMap() const
+{
+	ParametersMap parameters;
+#include "find_object/SettingsParameters.h"
+	return parameters;
+}
+
+#undef PARAMETER
+#undef PARAMETER_COND
+
 #if CV_MAJOR_VERSION < 3
 Feature2D::Feature2D(cv::Ptr<cv::FeatureDetector> featureDetector) :
 	featureDetector_(featureDetector)
@@ -0,0 +1,282 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "find_object/SharedMemoryRing.h"
+#include "find_object/utilite/ULogger.h"
+
+namespace find_object {
+
+static const quint32 kRingMagic = 0x464F534D; // "FOSM"
+static const quint32 kRingVersion = 1;
+static const int kRingAlignment = 64;
+
+// Layout: Header, Slot x slotCount, then the frames aligned on 64 bytes
+struct SharedMemoryRing::Header
+{
+	quint32 magic;
+	quint32 version;
+	qint32 slotCount;
+	qint32 slotSize; // aligned
+	quint64 sequence; // of the last frame published
+	quint64 reserved[5];
+};
+
+struct SharedMemoryRing::Slot
+{
+	enum State {kFree, kWriting, kReady, kTaken};
+	quint64 sequence;
+	qint32 state;
+	qint32 width;
+	qint32 height;
+	qint32 type;
+	qint32 step;
+	qint32 reserved[9];
+};
+
+SharedMemoryRing::SharedMemoryRing() :
+	writing_(-1),
+	lastTaken_(0)
+{
+}
+
+SharedMemoryRing::~SharedMemoryRing()
+{
+	detach();
+}
+
+bool SharedMemoryRing::create(const QString & key, int slotCount, int slotSize)
+{
+	UASSERT(slotCount >= 2 && slotSize > 0);
+	detach();
+	memory_.setKey(key);
+	// segment left by a producer that crashed (Unix)
+	if(memory_.attach())
+	{
+		memory_.detach();
+	}
+	int alignedSlotSize = (slotSize + kRingAlignment - 1) / kRingAlignment * kRingAlignment;
+	int size = (int)sizeof(Header) + slotCount*((int)sizeof(Slot) + alignedSlotSize);
+	if(!memory_.create(size))
+	{
+		UERROR("SharedMemoryRing: Cannot create \"%s\" (%d bytes): %s", key.toStdString().c_str(), size, memory_.errorString().toStdString().c_str());
+		return false;
+	}
+	memory_.lock();
+	memset(memory_.data(), 0, size);
+	Header * h = header();
+	h->magic = kRingMagic;
+	h->version = kRingVersion;
+	h->slotCount = slotCount;
+	h->slotSize = alignedSlotSize;
+	h->sequence = 0;
+	memory_.unlock();
+	UINFO("SharedMemoryRing: \"%s\" created (%d slots of %d bytes)", key.toStdString().c_str(), slotCount, alignedSlotSize);
+	return true;
+}
+
+bool SharedMemoryRing::attach(const QString & key)
+{
+	detach();
+	memory_.setKey(key);
+	if(!memory_.attach())
+	{
+		UWARN("SharedMemoryRing: Cannot attach to \"%s\": %s", key.toStdString().c_str(), memory_.errorString().toStdString().c_str());
+		return false;
+	}
+	if(memory_.size() < (int)sizeof(Header) ||
+	   header()->magic != kRingMagic ||
+	   header()->version != kRingVersion ||
+	   memory_.size() < (int)sizeof(Header) + header()->slotCount*((int)sizeof(Slot) + header()->slotSize))
+	{
+		UERROR("SharedMemoryRing: \"%s\" is not a ring of frames (version %d)", key.toStdString().c_str(), (int)kRingVersion);
+		memory_.detach();
+		return false;
+	}
+	memory_.lock();
+	// slots taken by a previous consumer
+	for(int i=0; i<header()->slotCount; ++i)
+	{
+		if(slot(i)->state == Slot::kTaken)
+		{
+			slot(i)->state = Slot::kFree;
+		}
+	}
+	lastTaken_ = header()->sequence; // only the frames published from now
+	memory_.unlock();
+	UINFO("SharedMemoryRing: attached to \"%s\" (%d slots of %d bytes)", key.toStdString().c_str(), header()->slotCount, header()->slotSize);
+	return true;
+}
+
+void SharedMemoryRing::detach()
+{
+	if(memory_.isAttached())
+	{
+		memory_.detach();
+	}
+	writing_ = -1;
+	lastTaken_ = 0;
+}
+
+int SharedMemoryRing::slotCount() const
+{
+	return memory_.isAttached()?header()->slotCount:0;
+}
+
+int SharedMemoryRing::slotSize() const
+{
+	return memory_.isAttached()?header()->slotSize:0;
+}
+
+SharedMemoryRing::Header * SharedMemoryRing::header() const
+{
+	return (Header*)memory_.constData();
+}
+
+SharedMemoryRing::Slot * SharedMemoryRing::slot(int index) const
+{
+	return (Slot*)((const uchar*)memory_.constData() + sizeof(Header)) + index;
+}
+
+uchar * SharedMemoryRing::slotData(int index) const
+{
+	return (uchar*)memory_.constData() + sizeof(Header) + header()->slotCount*sizeof(Slot) + (size_t)index*header()->slotSize;
+}
+
+cv::Mat SharedMemoryRing::beginWrite(int width, int height, int type)
+{
+	UASSERT(memory_.isAttached());
+	UASSERT_MSG(writing_ < 0, "endWrite() not called");
+	int step = width*(int)CV_ELEM_SIZE(type);
+	if((qint64)step*height > header()->slotSize)
+	{
+		UERROR("SharedMemoryRing: Frame %dx%d (%d bytes) is larger than the slots (%d bytes)", width, height, step*height, header()->slotSize);
+		return cv::Mat();
+	}
+
+	memory_.lock();
+	// a free slot, or the oldest frame not taken
+	int index = -1;
+	for(int i=0; i<header()->slotCount; ++i)
+	{
+		Slot * s = slot(i);
+		if(s->state == Slot::kFree)
+		{
+			index = i;
+			break;
+		}
+		if(s->state == Slot::kReady && (index < 0 || s->sequence < slot(index)->sequence))
+		{
+			index = i;
+		}
+	}
+	if(index >= 0)
+	{
+		Slot * s = slot(index);
+		s->state = Slot::kWriting;
+		s->width = width;
+		s->height = height;
+		s->type = type;
+		s->step = step;
+	}
+	memory_.unlock();
+
+	if(index < 0)
+	{
+		UDEBUG("SharedMemoryRing: All slots are taken by the consumer, frame dropped");
+		return cv::Mat();
+	}
+	writing_ = index;
+	return cv::Mat(height, width, type, slotData(index), step);
+}
+
+void SharedMemoryRing::endWrite()
+{
+	if(writing_ >= 0)
+	{
+		memory_.lock();
+		Slot * s = slot(writing_);
+		s->sequence = ++header()->sequence;
+		s->state = Slot::kReady;
+		memory_.unlock();
+		writing_ = -1;
+	}
+}
+
+bool SharedMemoryRing::write(const cv::Mat & image)
+{
+	cv::Mat frame = beginWrite(image.cols, image.rows, image.type());
+	if(frame.empty())
+	{
+		return false;
+	}
+	image.copyTo(frame);
+	endWrite();
+	return true;
+}
+
+cv::Mat SharedMemoryRing::take(int & index)
+{
+	index = -1;
+	if(!memory_.isAttached())
+	{
+		return cv::Mat();
+	}
+	cv::Mat image;
+	memory_.lock();
+	for(int i=0; i<header()->slotCount; ++i)
+	{
+		Slot * s = slot(i);
+		if(s->state == Slot::kReady && s->sequence > lastTaken_ && (index < 0 || s->sequence > slot(index)->sequence))
+		{
+			index = i;
+		}
+	}
+	if(index >= 0)
+	{
+		Slot * s = slot(index);
+		s->state = Slot::kTaken;
+		lastTaken_ = s->sequence;
+		image = cv::Mat(s->height, s->width, s->type, slotData(index), s->step);
+	}
+	memory_.unlock();
+	return image;
+}
+
+void SharedMemoryRing::release(int index)
+{
+	if(memory_.isAttached() && index >= 0 && index < header()->slotCount)
+	{
+		memory_.lock();
+		if(slot(index)->state == Slot::kTaken)
+		{
+			slot(index)->state = Slot::kFree;
+		}
+		memory_.unlock();
+	}
+}
+
+} // namespace find_object
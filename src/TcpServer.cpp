@@ -25,18 +25,29 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 #include "find_object/TcpServer.h"
+#include "find_object/Settings.h"
 #include "find_object/utilite/ULogger.h"
 
 #include <QtNetwork/QNetworkInterface>
 #include <QtNetwork/QTcpSocket>
+#include <QtCore/QDateTime>
 #include <QtGui/QTransform>
 #include <opencv2/highgui/highgui.hpp>
+#include <limits>
 
 namespace find_object {
 
 TcpServer::TcpServer(quint16 port, QObject * parent) :
-	QTcpServer(parent)
+	QTcpServer(parent),
+	grayscale_(false),
+	resultFormat_(Settings::getGeneral_portResultFormat()),
+	ready_(1),
+	nextTicket_(0)
 {
+	qRegisterMetaType<cv::Mat>("cv::Mat");
+	qRegisterMetaType<cv::Size>("cv::Size");
+	qRegisterMetaType<std::vector<cv::KeyPoint> >("std::vector<cv::KeyPoint>");
+
 	if (!this->listen(QHostAddress::Any, port))
 	{
 		UERROR("Unable to start the TCP server: %s", this->errorString().toStdString().c_str());
@@ -75,22 +86,50 @@ quint16 TcpServer::getPort() const
 	return this->serverPort();
 }
 
-void TcpServer::publishDetectionInfo(const DetectionInfo & info)
+QByteArray TcpServer::serialize(const DetectionInfo & info, int format)
 {
-	QList<QTcpSocket*> clients = this->findChildren<QTcpSocket*>();
-	if(clients.size())
+	QByteArray block;
+	QDataStream out(&block, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	if(format == kResultQDataStream)
 	{
-		UINFO("TCP server: Publish detected objects");
-		QByteArray block;
-		QDataStream out(&block, QIODevice::WriteOnly);
-		out.setVersion(QDataStream::Qt_4_0);
 		out << (quint16)0;
 
 		out << info;
 
+		if(block.size() - (int)sizeof(quint16) > 0xFFFF)
+		{
+			UWARN("Detection (%d bytes) is too large for the QDataStream format (64 KB), use the compact format (General/portResultFormat).", block.size());
+		}
 		out.device()->seek(0);
 		out << (quint16)(block.size() - sizeof(quint16));
+	}
+	else
+	{
+		out << (quint32)0;
+
+		writeCompactDetectionInfo(out, info, format==kResultCompactFull?kCompactKeypoints|kCompactMatches:0);
+
+		out.device()->seek(0);
+		out << (quint32)(block.size() - sizeof(quint32));
+	}
+	return block;
+}
 
+void TcpServer::publishDetectionInfo(const DetectionInfo & info)
+{
+	if(this->findChildren<QTcpSocket*>().size())
+	{
+		publishData(serialize(info, resultFormat_));
+	}
+}
+
+void TcpServer::publishData(const QByteArray & block)
+{
+	QList<QTcpSocket*> clients = this->findChildren<QTcpSocket*>();
+	if(clients.size())
+	{
+		UINFO("TCP server: Publish detected objects");
 		for(QList<QTcpSocket*>::iterator iter = clients.begin(); iter!=clients.end(); ++iter)
 		{
 			(*iter)->write(block);
@@ -112,6 +151,15 @@ void TcpServer::addClient()
 void TcpServer::readReceivedData()
 {
 	QTcpSocket * client = (QTcpSocket*)sender();
+	// pipelined requests can be received at once
+	while(readRequest(client))
+	{
+	}
+}
+
+// Returns false if the request is not completely received
+bool TcpServer::readRequest(QTcpSocket * client)
+{
 	QDataStream in(client);
 	in.setVersion(QDataStream::Qt_4_0);
 
@@ -119,20 +167,52 @@ void TcpServer::readReceivedData()
 	{
 		if (client->bytesAvailable() < (int)sizeof(quint64))
 		{
-			return;
+			return false;
 		}
 
 		in >> blockSizes_[client->socketDescriptor()];
 	}
 
-	if (client->bytesAvailable() < (int)blockSizes_[client->socketDescriptor()])
+	quint64 blockSize = blockSizes_[client->socketDescriptor()];
+	if (client->bytesAvailable() < (qint64)blockSize)
 	{
-		return;
+		return false;
 	}
+	qint64 available = client->bytesAvailable();
 
 	quint32 serviceType;
 	in >> serviceType;
 
+	// With a request ID, the response is sent only to this client when the request is done
+	quint32 requestId = 0;
+	bool withId = (serviceType & kRequestId) != 0;
+	qint64 headerSize = sizeof(quint32);
+	if(withId)
+	{
+		serviceType &= ~kRequestId;
+		in >> requestId;
+		headerSize += sizeof(quint32);
+	}
+	// Time budget of the request, it is dropped or degraded by the workers when it cannot be met
+	qint64 deadline = 0;
+	if(serviceType & kDeadline)
+	{
+		serviceType &= ~kDeadline;
+		quint32 budget;
+		in >> budget;
+		headerSize += sizeof(quint32);
+		if(withId)
+		{
+			deadline = QDateTime::currentMSecsSinceEpoch() + budget;
+		}
+		else
+		{
+			UWARN("TCP service: A deadline is only used with a request ID (kRequestId), ignored.");
+		}
+	}
+	qint64 ticket = -1;
+	bool pending = false; // response sent with the result
+
 	bool ok = true;
 	if(serviceType == kAddObject)
 	{
@@ -142,12 +222,28 @@ void TcpServer::readReceivedData()
 		in >> fileName;
 		quint64 imageSize;
 		in >> imageSize;
-		std::vector<unsigned char> buf(imageSize);
-		in.readRawData((char*)buf.data(), imageSize);
-		cv::Mat image = cv::imdecode(buf, cv::IMREAD_UNCHANGED);
+		qint64 maxImageSize = (qint64)blockSize-headerSize; // also holds the ID and the file name
+		if(imageSize > 0 && maxImageSize > 0 &&
+		   imageSize <= (quint64)maxImageSize &&
+		   imageSize <= (quint64)std::numeric_limits<int>::max())
+		{
+			std::vector<unsigned char> & buf = buffers_[client];
+			if(buf.size() < imageSize)
+			{
+				buf.resize(imageSize);
+			}
+			in.readRawData((char*)buf.data(), (int)imageSize);
+			// kept in color in the sessions, not recycled
+			cv::Mat image = cv::imdecode(cv::Mat(1, (int)imageSize, CV_8UC1, buf.data()), cv::IMREAD_UNCHANGED);
 
-		UINFO("TCP service: Add %d \"%s\"", id, fileName.toStdString().c_str());
-		Q_EMIT addObject(image, id, fileName);
+			UINFO("TCP service: Add %d \"%s\"", id, fileName.toStdString().c_str());
+			Q_EMIT addObject(image, id, fileName);
+		}
+		else
+		{
+			UERROR("Invalid object image (%llu bytes)", imageSize);
+			ok = false;
+		}
 	}
 	else if(serviceType == kRemoveObject)
 	{
@@ -159,12 +255,139 @@ void TcpServer::readReceivedData()
 	}
 	else if(serviceType == kDetectObject)
 	{
-		std::vector<unsigned char> buf(blockSizes_[client->socketDescriptor()]);
-		in.readRawData((char*)buf.data(), blockSizes_[client->socketDescriptor()]-sizeof(quint32));
-		cv::Mat image = cv::imdecode(buf, cv::IMREAD_UNCHANGED);
+		qint64 imageSize = (qint64)blockSize-headerSize;
+		if(imageSize > 0 && imageSize <= std::numeric_limits<int>::max())
+		{
+			std::vector<unsigned char> & buf = buffers_[client];
+			if((qint64)buf.size() < imageSize)
+			{
+				buf.resize(imageSize);
+			}
+			in.readRawData((char*)buf.data(), (int)imageSize);
+			cv::Mat image = decodeScene(buf, (int)imageSize);
 
-		UINFO("TCP service: Detect object");
-		Q_EMIT detectObject(image);
+			UINFO("TCP service: Detect object");
+			if(withId)
+			{
+				ticket = addPendingRequest(client, requestId);
+				pending = true;
+				Q_EMIT detectObject(image, ticket, deadline);
+			}
+			else
+			{
+				Q_EMIT detectObject(image);
+			}
+		}
+		else
+		{
+			UERROR("Invalid image (%lld bytes)", imageSize);
+			ok = false;
+		}
+	}
+	else if(serviceType == kDetectRawImage)
+	{
+		qint32 width, height, stride;
+		in >> width >> height >> stride;
+		qint64 imageSize = (qint64)blockSize-headerSize-3*(qint64)sizeof(qint32);
+		if(imageSize > 0 && imageSize <= std::numeric_limits<int>::max() &&
+		   width > 0 && height > 0 && stride >= width && (qint64)stride*height <= imageSize)
+		{
+			std::vector<unsigned char> & buf = buffers_[client];
+			if((qint64)buf.size() < imageSize)
+			{
+				buf.resize(imageSize);
+			}
+			in.readRawData((char*)buf.data(), (int)imageSize);
+			cv::Mat raw(height, width, CV_8UC1, buf.data(), stride);
+			cv::Mat * recycled = recycledScene();
+			cv::Mat image;
+			if(recycled)
+			{
+				raw.copyTo(*recycled);
+				image = *recycled;
+			}
+			else
+			{
+				image = raw.clone();
+			}
+
+			UINFO("TCP service: Detect object (raw %dx%d)", width, height);
+			if(withId)
+			{
+				ticket = addPendingRequest(client, requestId);
+				pending = true;
+				Q_EMIT detectObject(image, ticket, deadline);
+			}
+			else
+			{
+				Q_EMIT detectObject(image);
+			}
+		}
+		else
+		{
+			UERROR("Invalid raw image (%dx%d, stride=%d, %lld bytes)", width, height, stride, imageSize);
+			ok = false;
+		}
+	}
+	else if(serviceType == kDetectFeatures)
+	{
+		qint32 width, height, count;
+		in >> width >> height >> count;
+		// 5 floats and 2 integers per keypoint, in the block after the image
+		// size, the keypoints count and the descriptors size
+		qint64 maxCount = ((qint64)blockSize - headerSize - 6*(qint64)sizeof(qint32)) / (qint64)(5*sizeof(float)+2*sizeof(qint32));
+		if(count < 0 || count > maxCount)
+		{
+			UERROR("Invalid features (%d keypoints, %lld bytes)", count, (qint64)blockSize);
+			count = 0;
+			ok = false;
+		}
+		std::vector<cv::KeyPoint> keypoints(count);
+		for(unsigned int i=0; i<keypoints.size(); ++i)
+		{
+			qint32 octave, classId;
+			in >> keypoints[i].pt.x >>
+				  keypoints[i].pt.y >>
+				  keypoints[i].size >>
+				  keypoints[i].angle >>
+				  keypoints[i].response >>
+				  octave >>
+				  classId;
+			keypoints[i].octave = octave;
+			keypoints[i].class_id = classId;
+		}
+		qint32 rows, cols, type;
+		in >> rows >> cols >> type;
+		qint64 dataSize = (qint64)blockSize - headerSize - 3*sizeof(qint32) - (qint64)keypoints.size()*(5*sizeof(float)+2*sizeof(qint32)) - 3*sizeof(qint32);
+		if(ok && rows == (int)keypoints.size() && cols > 0 &&
+		   (type == CV_8UC1 || type == CV_32FC1) &&
+		   dataSize == (qint64)rows*cols*CV_ELEM_SIZE(type))
+		{
+			cv::Mat descriptors(rows, cols, type);
+			in.readRawData((char*)descriptors.data, (int)dataSize);
+
+			UINFO("TCP service: Detect object (%d features)", rows);
+			if(withId)
+			{
+				ticket = addPendingRequest(client, requestId);
+				pending = true;
+				Q_EMIT detectFeatures(keypoints, descriptors, cv::Size(width, height), ticket, deadline);
+			}
+			else
+			{
+				Q_EMIT detectFeatures(keypoints, descriptors, cv::Size(width, height));
+			}
+		}
+		else if(ok)
+		{
+			UERROR("Invalid features (%d keypoints, descriptors %dx%d type=%d, %d bytes)", (int)keypoints.size(), rows, cols, type, (int)dataSize);
+			ok = false;
+		}
+	}
+	else if(serviceType == kReadiness)
+	{
+		ok = isReady();
+		UDEBUG("TCP service: Readiness (%s)", ok?"ready":"warming up");
 	}
 	else
 	{
@@ -172,8 +395,79 @@ void TcpServer::readReceivedData()
 		ok = false;
 	}
 
+	// skip what was not read (unknown service or invalid request)
+	qint64 read = available - client->bytesAvailable();
+	if(read < (qint64)blockSize)
+	{
+		in.skipRawData((int)(blockSize - read));
+	}
+
 	blockSizes_.remove(client->socketDescriptor());
-	client->write(QByteArray(ok?"1":"0")); // send acknowledge
+	if(withId)
+	{
+		if(!pending)
+		{
+			sendResponse(client, requestId, ok?kStatusOk:kStatusFailed);
+		}
+	}
+	else
+	{
+		client->write(QByteArray(ok?"1":"0")); // send acknowledge
+	}
+	return true;
+}
+
+qint64 TcpServer::addPendingRequest(QTcpSocket * client, quint32 requestId)
+{
+	qint64 ticket = nextTicket_++;
+	pendingRequests_.insert(ticket, QPair<QTcpSocket*, quint32>(client, requestId));
+	return ticket;
+}
+
+// [quint32 size][quint32 request ID][quint32 status][DetectionInfo, only for detections done]
+void TcpServer::sendResponse(QTcpSocket * client, quint32 requestId, Status status, const DetectionInfo * info)
+{
+	QByteArray block;
+	QDataStream out(&block, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << (quint32)0;
+	out << requestId;
+	out << (quint32)status;
+	if(info)
+	{
+		if(resultFormat_ == kResultQDataStream)
+		{
+			out << *info;
+		}
+		else
+		{
+			writeCompactDetectionInfo(out, *info, resultFormat_==kResultCompactFull?kCompactKeypoints|kCompactMatches:0);
+		}
+	}
+	out.device()->seek(0);
+	out << (quint32)(block.size() - sizeof(quint32));
+	client->write(block);
+}
+
+void TcpServer::publishResult(const DetectionInfo & info, qint64 ticket, bool degraded)
+{
+	QMap<qint64, QPair<QTcpSocket*, quint32> >::iterator iter = pendingRequests_.find(ticket);
+	if(iter != pendingRequests_.end())
+	{
+		// only sent to the requester, if it is still connected
+		sendResponse(iter.value().first, iter.value().second, degraded?kStatusDegraded:kStatusOk, &info);
+		pendingRequests_.erase(iter);
+	}
+}
+
+void TcpServer::rejectRequest(qint64 ticket)
+{
+	QMap<qint64, QPair<QTcpSocket*, quint32> >::iterator iter = pendingRequests_.find(ticket);
+	if(iter != pendingRequests_.end())
+	{
+		sendResponse(iter.value().first, iter.value().second, kStatusFailed);
+		pendingRequests_.erase(iter);
+	}
 }
 
 void TcpServer::displayError(QAbstractSocket::SocketError socketError)
@@ -198,9 +492,53 @@ void TcpServer::displayError(QAbstractSocket::SocketError socketError)
 	}
 }
 
+// A scene decoded before and not referenced anymore by the receivers, its
+// buffer is reused when the resolution repeats. 0 if they are all in use.
+cv::Mat * TcpServer::recycledScene()
+{
+	for(QList<cv::Mat>::iterator iter=scenes_.begin(); iter!=scenes_.end(); ++iter)
+	{
+#if CV_MAJOR_VERSION < 3
+		bool shared = iter->refcount && *iter->refcount > 1;
+#else
+		bool shared = iter->u && iter->u->refcount > 1;
+#endif
+		if(!shared)
+		{
+			return &(*iter);
+		}
+	}
+	if(scenes_.size() < 4)
+	{
+		scenes_.push_back(cv::Mat());
+		return &scenes_.back();
+	}
+	return 0;
+}
+
+cv::Mat TcpServer::decodeScene(const std::vector<unsigned char> & buffer, int size)
+{
+	cv::Mat encoded(1, size, CV_8UC1, (void*)buffer.data());
+	int flags = grayscale_?cv::IMREAD_GRAYSCALE:cv::IMREAD_UNCHANGED;
+	cv::Mat * recycled = recycledScene();
+	return recycled?cv::imdecode(encoded, flags, recycled):cv::imdecode(encoded, flags);
+}
+
 void TcpServer::connectionLost()
 {
 	//printf("[WARNING] CameraTcp: Connection lost!\n");
+	buffers_.remove((QTcpSocket*)sender());
+	for(QMap<qint64, QPair<QTcpSocket*, quint32> >::iterator iter = pendingRequests_.begin(); iter!=pendingRequests_.end();)
+	{
+		if(iter.value().first == sender())
+		{
+			iter = pendingRequests_.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
 	blockSizes_.remove(((QTcpSocket*)sender())->socketDescriptor());
 	((QTcpSocket*)sender())->close();
 	sender()->deleteLater();
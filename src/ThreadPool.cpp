@@ -0,0 +1,250 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "ThreadPool.h"
+#include "find_object/utilite/ULogger.h"
+#include "utilite/UConversion.h"
+
+namespace find_object {
+
+class ThreadPool::Worker : public QThread
+{
+public:
+	Worker(ThreadPool * pool, int index) :
+		pool_(pool),
+		index_(index),
+		active_(false)
+	{}
+	int index() const {return index_;}
+	bool isActive() const {return active_;}
+	void setActive(bool active) {active_ = active;}
+
+protected:
+	virtual void run()
+	{
+		pool_->workerLoop(this);
+	}
+
+private:
+	ThreadPool * pool_;
+	int index_;
+	bool active_; // protected by pool's mutex
+};
+
+ThreadPool::ThreadPool(int maxThreadCount) :
+	maxThreadCount_(0),
+	stopped_(false)
+{
+	setMaxThreadCount(maxThreadCount);
+}
+
+ThreadPool::~ThreadPool()
+{
+	mutex_.lock();
+	stopped_ = true;
+	taskAdded_.wakeAll();
+	mutex_.unlock();
+	for(int i=0; i<workers_.size(); ++i)
+	{
+		workers_[i]->wait();
+		delete workers_[i];
+	}
+	UASSERT_MSG(queue_.empty(), uFormat("%d tasks were still queued!", queue_.size()).c_str());
+}
+
+void ThreadPool::setMaxThreadCount(int maxThreadCount)
+{
+	if(maxThreadCount <= 0)
+	{
+		maxThreadCount = QThread::idealThreadCount()>0?QThread::idealThreadCount():1;
+	}
+
+	QMutexLocker lock(&mutex_);
+	if(maxThreadCount == maxThreadCount_)
+	{
+		return;
+	}
+	UDEBUG("Thread pool: %d -> %d threads", maxThreadCount_, maxThreadCount);
+	maxThreadCount_ = maxThreadCount;
+
+	// With only one thread, tasks are executed in the caller's thread (see TaskGroup::start())
+	int workers = maxThreadCount_>1?maxThreadCount_:0;
+	for(int i=0; i<workers; ++i)
+	{
+		if(i >= workers_.size())
+		{
+			workers_.push_back(new Worker(this, i));
+		}
+		if(!workers_[i]->isActive())
+		{
+			// the worker may still be exiting
+			workers_[i]->wait();
+			workers_[i]->setActive(true);
+			workers_[i]->start();
+		}
+	}
+	// wake up extra workers so that they can exit
+	taskAdded_.wakeAll();
+}
+
+int ThreadPool::maxThreadCount() const
+{
+	QMutexLocker lock(&mutex_);
+	return maxThreadCount_;
+}
+
+void ThreadPool::enqueue(QRunnable * task, TaskGroup * group)
+{
+	mutex_.lock();
+	bool inlined = maxThreadCount_ <= 1;
+	++group->pending_;
+	if(!inlined)
+	{
+		queue_.push_back(qMakePair(task, group));
+		taskAdded_.wakeOne();
+	}
+	mutex_.unlock();
+
+	if(inlined)
+	{
+		runTask(task, group);
+	}
+}
+
+void ThreadPool::runTask(QRunnable * task, TaskGroup * group)
+{
+	task->run();
+
+	QMutexLocker lock(&mutex_);
+	--group->pending_;
+	group->finished_.push_back(task);
+	taskDone_.wakeAll();
+}
+
+QRunnable * ThreadPool::takeQueuedTask(TaskGroup * group)
+{
+	for(int i=0; i<queue_.size(); ++i)
+	{
+		if(queue_.at(i).second == group)
+		{
+			return queue_.takeAt(i).first;
+		}
+	}
+	return 0;
+}
+
+void ThreadPool::wait(TaskGroup * group)
+{
+	QMutexLocker lock(&mutex_);
+	while(group->pending_ > 0)
+	{
+		// Help executing the tasks of this group that are not started yet
+		QRunnable * task = takeQueuedTask(group);
+		if(task)
+		{
+			lock.unlock();
+			runTask(task, group);
+			lock.relock();
+		}
+		else
+		{
+			taskDone_.wait(&mutex_);
+		}
+	}
+}
+
+QRunnable * ThreadPool::waitNext(TaskGroup * group)
+{
+	QMutexLocker lock(&mutex_);
+	while(group->finished_.empty() && group->pending_ > 0)
+	{
+		QRunnable * task = takeQueuedTask(group);
+		if(task)
+		{
+			lock.unlock();
+			runTask(task, group);
+			lock.relock();
+		}
+		else
+		{
+			taskDone_.wait(&mutex_);
+		}
+	}
+	if(group->finished_.size())
+	{
+		return group->finished_.takeFirst();
+	}
+	return 0;
+}
+
+void ThreadPool::workerLoop(Worker * worker)
+{
+	QMutexLocker lock(&mutex_);
+	while(!stopped_ && worker->index() < maxThreadCount_ && maxThreadCount_ > 1)
+	{
+		if(queue_.empty())
+		{
+			taskAdded_.wait(&mutex_);
+			continue;
+		}
+		QPair<QRunnable*, TaskGroup*> item = queue_.takeFirst();
+		lock.unlock();
+		runTask(item.first, item.second);
+		lock.relock();
+	}
+	worker->setActive(false);
+}
+
+TaskGroup::TaskGroup(ThreadPool * pool) :
+	pool_(pool),
+	pending_(0)
+{
+	UASSERT(pool != 0);
+}
+
+TaskGroup::~TaskGroup()
+{
+	wait();
+}
+
+void TaskGroup::start(QRunnable * task)
+{
+	UASSERT(task != 0);
+	pool_->enqueue(task, this);
+}
+
+void TaskGroup::wait()
+{
+	pool_->wait(this);
+}
+
+QRunnable * TaskGroup::waitNext()
+{
+	return pool_->waitNext(this);
+}
+
+} // namespace find_object
@@ -0,0 +1,112 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef THREADPOOL_H_
+#define THREADPOOL_H_
+
+#include <QtCore/QRunnable>
+#include <QtCore/QThread>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+#include <QtCore/QList>
+#include <QtCore/QPair>
+#include <QtCore/QVector>
+
+namespace find_object {
+
+class TaskGroup;
+
+/**
+ * Long-lived pool of worker threads executing QRunnable tasks. Tasks are
+ * always started through a TaskGroup, which is used to wait for a set of
+ * tasks. A thread waiting on a group executes the queued tasks of that group
+ * itself instead of sleeping, so tasks can safely start and wait on other
+ * tasks (e.g., ASIFT extraction inside object extraction) without
+ * exhausting the workers.
+ */
+class ThreadPool
+{
+public:
+	ThreadPool(int maxThreadCount = 1);
+	virtual ~ThreadPool();
+
+	// Can be called at any time, extra workers exit when they are idle.
+	void setMaxThreadCount(int maxThreadCount);
+	int maxThreadCount() const;
+
+private:
+	class Worker;
+	friend class TaskGroup;
+	friend class Worker;
+
+	void enqueue(QRunnable * task, TaskGroup * group);
+	void wait(TaskGroup * group);
+	QRunnable * waitNext(TaskGroup * group);
+	QRunnable * takeQueuedTask(TaskGroup * group);
+	void runTask(QRunnable * task, TaskGroup * group);
+	void workerLoop(Worker * worker);
+
+private:
+	mutable QMutex mutex_;
+	QWaitCondition taskAdded_;
+	QWaitCondition taskDone_;
+	QList<QPair<QRunnable*, TaskGroup*> > queue_;
+	QVector<Worker*> workers_;
+	int maxThreadCount_;
+	bool stopped_;
+};
+
+/**
+ * Set of tasks started on a ThreadPool. Tasks are not deleted by
+ * the group, even if QRunnable::autoDelete() is true. The destructor waits
+ * for all tasks started.
+ */
+class TaskGroup
+{
+public:
+	TaskGroup(ThreadPool * pool);
+	virtual ~TaskGroup();
+
+	// If the pool has only one thread, the task is executed immediately in the calling thread.
+	void start(QRunnable * task);
+	void wait();
+
+	// Return the next finished task (in completion order), or 0 when all
+	// started tasks have been returned. Tasks can be started while
+	// iterating over the results.
+	QRunnable * waitNext();
+
+private:
+	friend class ThreadPool;
+	ThreadPool * pool_;
+	int pending_; // protected by pool's mutex
+	QList<QRunnable*> finished_; // protected by pool's mutex
+};
+
+} // namespace find_object
+
+#endif /* THREADPOOL_H_ */
@@ -0,0 +1,320 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "find_object/Trace.h"
+#include "find_object/utilite/ULogger.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <vector>
+
+namespace find_object {
+
+#ifdef FINDOBJECT_TRACE
+bool Trace::enabled_ = true;
+#else
+bool Trace::enabled_ = false;
+#endif
+
+struct TraceEvent
+{
+	const char * name;
+	const char * category;
+	qint64 start;
+	qint64 duration;
+	int arg;
+};
+
+// Spans of a thread, written only by this thread. count_ is published after
+// the span is written: a reader copying the spans ignores those overwritten
+// while it was copying (seqlock on the whole ring).
+class TraceBuffer
+{
+public:
+	TraceBuffer(int capacity, int tid, const QString & threadName) :
+		events_(capacity),
+		count_(0),
+		tid_(tid),
+		threadName_(threadName),
+		orphaned_(0)
+	{}
+
+	void record(const TraceEvent & event)
+	{
+		unsigned int count = (unsigned int)count_.fetchAndAddRelaxed(0);
+		events_[count % events_.size()] = event;
+		count_.fetchAndStoreRelease(int(count+1));
+	}
+
+	void copy(std::vector<TraceEvent> & events) const
+	{
+		unsigned int end = (unsigned int)count_.fetchAndAddAcquire(0);
+		unsigned int capacity = (unsigned int)events_.size();
+		unsigned int begin = end > capacity?end-capacity:0;
+		std::vector<TraceEvent> copied;
+		copied.reserve(end-begin);
+		for(unsigned int i=begin; i<end; ++i)
+		{
+			copied.push_back(events_[i % capacity]);
+		}
+		// spans overwritten during the copy
+		unsigned int after = (unsigned int)count_.fetchAndAddAcquire(0);
+		unsigned int valid = after > capacity?after-capacity:0;
+		for(unsigned int i=begin; i<end; ++i)
+		{
+			if(i >= valid)
+			{
+				events.push_back(copied[i-begin]);
+			}
+		}
+	}
+
+	void clear() {count_.fetchAndStoreRelease(0);}
+	int tid() const {return tid_;}
+	const QString & threadName() const {return threadName_;}
+	void setOrphaned() {orphaned_.fetchAndStoreRelease(1);}
+	bool isOrphaned() const {return orphaned_.fetchAndAddAcquire(0) != 0;}
+
+private:
+	std::vector<TraceEvent> events_;
+	mutable QAtomicInt count_;
+	int tid_;
+	QString threadName_;
+	mutable QAtomicInt orphaned_;
+};
+
+// Deleted with its thread, the buffer is kept for the dump
+class TraceBufferHolder
+{
+public:
+	TraceBufferHolder(TraceBuffer * buffer) : buffer_(buffer) {}
+	~TraceBufferHolder() {buffer_->setOrphaned();}
+	TraceBuffer * buffer() const {return buffer_;}
+private:
+	TraceBuffer * buffer_;
+};
+
+// Never deleted, the buffers stay valid for the threads recording
+class TraceRegistry
+{
+public:
+	static TraceRegistry * instance()
+	{
+		static TraceRegistry registry;
+		return &registry;
+	}
+
+	TraceBuffer * localBuffer()
+	{
+		TraceBufferHolder * holder = localBuffer_.localData();
+		if(!holder)
+		{
+			QMutexLocker locker(&mutex_);
+			QString name = QThread::currentThread()?QThread::currentThread()->objectName():QString();
+			int tid = ++lastTid_;
+			if(name.isEmpty())
+			{
+				name = QString("thread %1").arg(tid);
+			}
+			// The buffers of the finished threads are kept for their spans,
+			// until too many threads have finished (e.g. expired pool threads)
+			int orphaned = 0;
+			for(int i=0; i<buffers_.size(); ++i)
+			{
+				orphaned += buffers_[i]->isOrphaned()?1:0;
+			}
+			if(orphaned > 64)
+			{
+				for(int i=0; i<buffers_.size(); ++i)
+				{
+					if(buffers_[i]->isOrphaned())
+					{
+						delete buffers_[i];
+						buffers_.removeAt(i);
+						break;
+					}
+				}
+			}
+			holder = new TraceBufferHolder(new TraceBuffer(capacity_, tid, name));
+			buffers_.push_back(holder->buffer());
+			localBuffer_.setLocalData(holder);
+		}
+		return holder->buffer();
+	}
+
+	qint64 now()
+	{
+		return timer_.nsecsElapsed()/1000;
+	}
+
+	void setCapacity(int capacity)
+	{
+		QMutexLocker locker(&mutex_);
+		capacity_ = capacity;
+	}
+
+	QByteArray toJson()
+	{
+		QMutexLocker locker(&mutex_);
+		QByteArray json;
+		json.append("{\"traceEvents\":[\n");
+		bool first = true;
+		for(int i=0; i<buffers_.size(); ++i)
+		{
+			std::vector<TraceEvent> events;
+			buffers_[i]->copy(events);
+			if(events.empty())
+			{
+				continue;
+			}
+			QString name = buffers_[i]->threadName();
+			name.replace('\\', "\\\\").replace('"', "\\\"");
+			json.append(QString("%1{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%2,\"args\":{\"name\":\"%3\"}}")
+					.arg(first?"":",\n").arg(buffers_[i]->tid()).arg(name).toUtf8());
+			first = false;
+			for(unsigned int j=0; j<events.size(); ++j)
+			{
+				const TraceEvent & e = events[j];
+				json.append(",\n{\"name\":\"");
+				json.append(e.name);
+				json.append("\",\"cat\":\"");
+				json.append(e.category);
+				json.append("\",\"ph\":\"X\",\"pid\":1,\"tid\":");
+				json.append(QByteArray::number(buffers_[i]->tid()));
+				json.append(",\"ts\":");
+				json.append(QByteArray::number(e.start));
+				json.append(",\"dur\":");
+				json.append(QByteArray::number(e.duration));
+				if(e.arg >= 0)
+				{
+					json.append(",\"args\":{\"id\":");
+					json.append(QByteArray::number(e.arg));
+					json.append("}");
+				}
+				json.append("}");
+			}
+		}
+		json.append("\n],\"displayTimeUnit\":\"ms\"}\n");
+		return json;
+	}
+
+	void clear()
+	{
+		QMutexLocker locker(&mutex_);
+		for(int i=0; i<buffers_.size(); ++i)
+		{
+			buffers_[i]->clear();
+		}
+	}
+
+private:
+	TraceRegistry() :
+		capacity_(16384),
+		lastTid_(0)
+	{
+		timer_.start();
+	}
+
+private:
+	QElapsedTimer timer_;
+	QThreadStorage<TraceBufferHolder*> localBuffer_;
+	QMutex mutex_;
+	QList<TraceBuffer*> buffers_;
+	int capacity_;
+	int lastTid_;
+};
+
+void Trace::setEnabled(bool enabled)
+{
+	if(enabled && !isCompiled())
+	{
+		UWARN("Trace spans are not recorded, the library is not built with WITH_TRACE.");
+	}
+	enabled_ = enabled;
+}
+
+void Trace::setCapacity(int spans)
+{
+	UASSERT(spans > 0);
+	TraceRegistry::instance()->setCapacity(spans);
+}
+
+bool Trace::isCompiled()
+{
+#ifdef FINDOBJECT_TRACE
+	return true;
+#else
+	return false;
+#endif
+}
+
+qint64 Trace::now()
+{
+	return TraceRegistry::instance()->now();
+}
+
+void Trace::record(const char * name, const char * category, qint64 start, qint64 duration, int arg)
+{
+	TraceEvent event;
+	event.name = name;
+	event.category = category;
+	event.start = start;
+	event.duration = duration;
+	event.arg = arg;
+	TraceRegistry::instance()->localBuffer()->record(event);
+}
+
+QByteArray Trace::toJson()
+{
+	return TraceRegistry::instance()->toJson();
+}
+
+bool Trace::save(const QString & path)
+{
+	QFile file(path);
+	if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+	{
+		UERROR("Cannot write trace to \"%s\"", path.toStdString().c_str());
+		return false;
+	}
+	file.write(toJson());
+	file.close();
+	UINFO("Trace written to \"%s\"", path.toStdString().c_str());
+	return true;
+}
+
+void Trace::clear()
+{
+	TraceRegistry::instance()->clear();
+}
+
+} // namespace find_object
@@ -29,11 +29,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "find_object/utilite/ULogger.h"
 #include "Compression.h"
+#include "MappedData.h"
+#include "HammingMatcher.h"
+#include "L2Matcher.h"
 #include "Vocabulary.h"
 #include <QtCore/QVector>
+#include <QtCore/QHash>
 #include <QDataStream>
 #include <QTime>
+#include <QtCore/QTemporaryFile>
+#include <QtCore/QThreadStorage>
 #include <stdio.h>
+#include <algorithm>
+#include <cmath>
 #if CV_MAJOR_VERSION < 3
 #include <opencv2/gpu/gpu.hpp>
 #define CVCUDA cv::gpu
@@ -47,21 +55,186 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace find_object {
 
-Vocabulary::Vocabulary()
+// Words uploaded once to the GPU for NearestNeighbor/BruteForce_gpu, the
+// matcher is reused. Each search uploads its descriptors and matches them
+// in its own stream, so concurrent searches (e.g. detections from
+// different threads) overlap instead of being serialized on the default stream.
+class VocabularyGpuWords
 {
+public:
+	VocabularyGpuWords(const cv::Mat & words) :
+		data_(words.data),
+		rows_(words.rows)
+#if CV_MAJOR_VERSION < 3
+		,matcher_(words.type()==CV_8U?cv::NORM_HAMMING:cv::NORM_L2)
+#endif
+	{
+		words_.upload(words);
+#if CV_MAJOR_VERSION >= 3 && defined(HAVE_OPENCV_CUDAFEATURES2D)
+		matcher_ = cv::cuda::DescriptorMatcher::createBFMatcher(words.type()==CV_8U?cv::NORM_HAMMING:cv::NORM_L2);
+#endif
+	}
+
+	// Still the words of the vocabulary (they are not modified in place)
+	bool isUploaded(const cv::Mat & words) const {return words.data == data_ && words.rows == rows_;}
+	int type() const {return words_.type();}
+	int dim() const {return words_.cols;}
+
+	void knnMatch(const cv::Mat & descriptors, std::vector<std::vector<cv::DMatch> > & matches, int k) const
+	{
+		CVCUDA::Stream stream;
+		CVCUDA::GpuMat descriptorsGpu;
+#if CV_MAJOR_VERSION < 3
+		stream.enqueueUpload(descriptors, descriptorsGpu);
+#else
+		descriptorsGpu.upload(descriptors, stream);
+#endif
+		knnMatch(descriptorsGpu, stream, matches, k);
+	}
+
+	// Descriptors already on the GPU (see General/gpuPipeline)
+	void knnMatch(const CVCUDA::GpuMat & descriptorsGpu, std::vector<std::vector<cv::DMatch> > & matches, int k) const
+	{
+		CVCUDA::Stream stream;
+		knnMatch(descriptorsGpu, stream, matches, k);
+	}
+
+private:
+	void knnMatch(const CVCUDA::GpuMat & descriptorsGpu, CVCUDA::Stream & stream, std::vector<std::vector<cv::DMatch> > & matches, int k) const
+	{
+#if CV_MAJOR_VERSION < 3
+		CVCUDA::GpuMat trainIdx, distance, allDist;
+		matcher_.knnMatchSingle(descriptorsGpu, words_, trainIdx, distance, allDist, k, CVCUDA::GpuMat(), stream);
+		stream.waitForCompletion();
+		CVCUDA::BFMatcher_GPU::knnMatchDownload(trainIdx, distance, matches);
+#else
+#ifdef HAVE_OPENCV_CUDAFEATURES2D
+		CVCUDA::GpuMat matchesGpu;
+		matcher_->knnMatchAsync(descriptorsGpu, words_, matchesGpu, k, cv::noArray(), stream);
+		stream.waitForCompletion();
+		matcher_->knnMatchConvert(matchesGpu, matches);
+#else
+		UERROR("OpenCV3 is not built with CUDAFEATURES2D module, cannot do brute force matching on GPU!");
+#endif
+#endif
+	}
+
+private:
+	const uchar * data_;
+	int rows_;
+	CVCUDA::GpuMat words_;
+#if CV_MAJOR_VERSION < 3
+	mutable CVCUDA::BFMatcher_GPU matcher_;
+#elif defined(HAVE_OPENCV_CUDAFEATURES2D)
+	cv::Ptr<cv::cuda::DescriptorMatcher> matcher_;
+#endif
+};
+
+Vocabulary::Vocabulary(const ParametersSnapshot & parameters) :
+	params_(parameters),
+	flannIndex_(new cv::flann::Index()),
+	deltaIndex_(new cv::flann::Index())
+{
+	updateTree();
 }
 
 Vocabulary::~Vocabulary()
 {
 }
 
+void Vocabulary::setParameters(const ParametersSnapshot & parameters)
+{
+	params_ = parameters;
+	updateTree();
+	if(gpuWordsUsed() == gpuWords_.isNull())
+	{
+		updateGpuWords();
+	}
+	if(wordNormsUsed() == wordNorms_.empty())
+	{
+		updateWordNorms();
+	}
+}
+
+// The words are searched with brute force on the GPU
+bool Vocabulary::gpuWordsUsed() const
+{
+	return params_.NearestNeighbor_BruteForce_gpu &&
+		   !usesTree() &&
+		   (Settings::isBruteForceNearestNeighbor(params_) || (usesProductQuantization() && !hasCodes())) &&
+		   !(Settings::isHammingNearestNeighbor(params_) && this->type() == CV_8U) && // searched on CPU
+		   !indexedDescriptors_.empty() &&
+		   CVCUDA::getCudaEnabledDeviceCount();
+}
+
+void Vocabulary::updateGpuWords()
+{
+	gpuWords_.clear();
+	if(gpuWordsUsed())
+	{
+		QTime time;
+		time.start();
+		cv::Mat words = allIndexedDescriptors(); // the delta is normally empty in brute force mode
+		gpuWords_ = QSharedPointer<const VocabularyGpuWords>(new VocabularyGpuWords(words));
+		UDEBUG("Uploaded %d words to GPU (%d ms)", words.rows, time.elapsed());
+	}
+}
+
+// The float words are searched with brute force on CPU with matrix products
+bool Vocabulary::wordNormsUsed() const
+{
+	return params_.NearestNeighbor_BruteForce_gemm &&
+		   !usesTree() &&
+		   (Settings::isBruteForceNearestNeighbor(params_) || (usesProductQuantization() && !hasCodes())) &&
+		   !hasScalarCodes() &&
+		   !gpuWordsUsed() &&
+		   !indexedDescriptors_.empty() &&
+		   indexedDescriptors_.type() == CV_32FC1;
+}
+
+void Vocabulary::updateWordNorms()
+{
+	// a new matrix, copies of this vocabulary may still use the old norms
+	wordNorms_ = cv::Mat();
+	if(wordNormsUsed())
+	{
+		l2SquaredNorms(allIndexedDescriptors(), wordNorms_);
+	}
+}
+
+void Vocabulary::updateTree()
+{
+	if(params_.General_vocabularyTreePath == treePath_)
+	{
+		return;
+	}
+	treePath_ = params_.General_vocabularyTreePath;
+	tree_.clear();
+	if(!treePath_.isEmpty())
+	{
+		QSharedPointer<VocabularyTree> tree(new VocabularyTree());
+		if(tree->load(treePath_))
+		{
+			tree_ = tree;
+		}
+	}
+}
+
 void Vocabulary::clear()
 {
 	wordToObjects_.clear();
+	clearPostings();
 	notIndexedDescriptors_ = cv::Mat();
 	notIndexedWordIds_.clear();
 
-	if(Settings::getGeneral_vocabularyFixed() && Settings::getGeneral_invertedSearch())
+	if(usesTree())
+	{
+		// the words are the leaves of the tree
+		this->update();
+		return;
+	}
+
+	if(params_.General_vocabularyFixed && params_.General_invertedSearch)
 	{
 		this->update(); // if vocabulary structure has changed
 
@@ -70,6 +243,32 @@ void Vocabulary::clear()
 	}
 
 	indexedDescriptors_ = cv::Mat();
+	deltaDescriptors_ = cv::Mat();
+	deltaIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+	pq_ = cv::Ptr<ProductQuantizer>();
+	sq_ = cv::Ptr<ScalarQuantizer>();
+	gpuWords_.clear();
+	wordNorms_ = cv::Mat();
+}
+
+cv::Mat Vocabulary::allIndexedDescriptors() const
+{
+	if(indexedDescriptors_.empty() && hasCodes())
+	{
+		// words not kept, approximated from their codes
+		return pq_->reconstruct();
+	}
+	if(indexedDescriptors_.empty() && hasScalarCodes())
+	{
+		return sq_->reconstruct();
+	}
+	if(deltaDescriptors_.empty())
+	{
+		return indexedDescriptors_;
+	}
+	cv::Mat descriptors;
+	cv::vconcat(indexedDescriptors_, deltaDescriptors_, descriptors);
+	return descriptors;
 }
 
 void Vocabulary::save(QDataStream & streamSessionPtr, bool saveVocabularyOnly) const
@@ -86,23 +285,89 @@ void Vocabulary::save(QDataStream & streamSessionPtr, bool saveVocabularyOnly) c
 		streamSessionPtr << wordToObjects_;
 	}
 
-	// save words
-	qint64 rawDataSize = indexedDescriptors_.rows * indexedDescriptors_.cols * indexedDescriptors_.elemSize();
-	UINFO("Compressing words... (%dx%d, %d MB)", indexedDescriptors_.rows, indexedDescriptors_.cols, rawDataSize/(1024*1024));
-	std::vector<unsigned char> bytes  = compressData(indexedDescriptors_);
+	// save words, in the legacy format only compressed in a single block (the index is rebuilt on load)
+	bool legacyFormat = params_.General_sessionLegacyFormat;
+	if(!legacyFormat && params_.NearestNeighbor_quantization > 0 && this->type() == CV_32FC1 && indexedRows() > 0)
+	{
+		// codes of the words, the current ones if they are of the same type
+		ScalarQuantizer quantizer;
+		if(hasScalarCodes() && sq_->type() == params_.NearestNeighbor_quantization && deltaDescriptors_.empty())
+		{
+			quantizer = *sq_;
+		}
+		else
+		{
+			cv::Mat words = allIndexedDescriptors();
+			if(quantizer.train(words, params_.NearestNeighbor_quantization))
+			{
+				quantizer.add(words);
+			}
+		}
+		if(!quantizer.empty())
+		{
+			int chunked = params_.General_sessionCompression > 0?1:0;
+			std::vector<unsigned char> bytes = chunked?
+					compressDataChunked(quantizer.codes(), params_.General_sessionCompression):
+					compressData(quantizer.codes());
+			qint64 dataSize = bytes.size();
+			UINFO("Saving quantized words... (%dx%d, %d MB)", quantizer.size(), quantizer.dim(), int(dataSize/(1024*1024)));
+			// old: rows, cols, type (type=3: quantized words, see ScalarQuantizer, the index follows the words)
+			int old = 0;
+			int quantized = 3;
+			streamSessionPtr << old << old << quantized << dataSize;
+			streamSessionPtr << quantizer.type() << quantizer.offset() << quantizer.scale() << chunked;
+			writeRawData64(streamSessionPtr, bytes.data(), dataSize);
+
+			QString signature;
+			QByteArray indexData = saveIndex(signature);
+			streamSessionPtr << signature << indexData;
+			return;
+		}
+	}
+	cv::Mat indexedDescriptors = allIndexedDescriptors();
+	qint64 rawDataSize = qint64(indexedDescriptors.rows) * qint64(indexedDescriptors.cols) * qint64(indexedDescriptors.elemSize());
+	UINFO("Compressing words... (%dx%d, %d MB)", indexedDescriptors.rows, indexedDescriptors.cols, int(rawDataSize/(1024*1024)));
+	if(!legacyFormat && params_.General_sessionCompression > 0)
+	{
+		std::vector<unsigned char> bytes = compressDataChunked(indexedDescriptors, params_.General_sessionCompression);
+		qint64 dataSize = bytes.size();
+		UINFO("Compressed = %d MB (chunked)", int(dataSize/(1024*1024)));
+		// old: rows, cols, type (type=2: chunked compression, the index follows the words)
+		int old = 0;
+		int chunked = 2;
+		streamSessionPtr << old << old << chunked << dataSize;
+		writeRawData64(streamSessionPtr, bytes.data(), dataSize);
+
+		QString signature;
+		QByteArray indexData = saveIndex(signature);
+		UINFO("Saving index... (%d MB)", indexData.size()/(1024*1024));
+		streamSessionPtr << signature << indexData;
+		return;
+	}
+	std::vector<unsigned char> bytes  = compressData(indexedDescriptors);
 	qint64 dataSize = bytes.size();
-	UINFO("Compressed = %d MB", dataSize/(1024*1024));
+	UINFO("Compressed = %d MB", int(dataSize/(1024*1024)));
 	int old = 0;
+	int withIndex = legacyFormat?0:1;
 	if(dataSize <= std::numeric_limits<int>::max())
 	{
-		// old: rows, cols, type
-		streamSessionPtr << old << old << old << dataSize;
+		// old: rows, cols, type (type=1: the index follows the words)
+		streamSessionPtr << old << old << withIndex << dataSize;
 		streamSessionPtr << QByteArray::fromRawData((const char*)bytes.data(), dataSize);
+
+		if(withIndex)
+		{
+			// save index, it is rebuilt on load if the parameters are not the same
+			QString signature;
+			QByteArray indexData = saveIndex(signature);
+			UINFO("Saving index... (%d MB)", indexData.size()/(1024*1024));
+			streamSessionPtr << signature << indexData;
+		}
 	}
 	else
 	{
 		UERROR("Vocabulary (compressed) is too large (%d MB) to be saved! Limit is 2 GB (based on max QByteArray size).",
-				dataSize/(1024*1024));
+				int(dataSize/(1024*1024)));
 		// old: rows, cols, type, dataSize
 		streamSessionPtr << old << old << old << old;
 		streamSessionPtr << QByteArray(); // empty
@@ -125,27 +390,112 @@ void Vocabulary::load(QDataStream & streamSessionPtr, bool loadVocabularyOnly)
 		streamSessionPtr >> wordToObjects_;
 		UINFO("Loaded %d object references...", wordToObjects_.size());
 	}
+	clearPostings(); // see addObjectWords()
 
 	// load words
+	deltaDescriptors_ = cv::Mat();
+	pq_ = cv::Ptr<ProductQuantizer>(); // coded again from the loaded words
+	sq_ = cv::Ptr<ScalarQuantizer>();
 	int rows,cols,type;
 	qint64 dataSize;
 	streamSessionPtr >> rows >> cols >> type >> dataSize;
-	if(rows == 0 && cols == 0 && type == 0)
+	if(rows == 0 && cols == 0 && type == 2)
+	{
+		// chunked compression, 64 bits size
+		UINFO("Loading words... (chunked format: %d MB)", int(dataSize/(1024*1024)));
+		std::vector<unsigned char> data(dataSize>0?dataSize:0);
+		if(dataSize > 0 && readRawData64(streamSessionPtr, data.data(), dataSize))
+		{
+			indexedDescriptors_ = uncompressDataChunked(data.data(), dataSize);
+		}
+		else
+		{
+			indexedDescriptors_ = cv::Mat();
+			if(dataSize)
+			{
+				UERROR("Error reading the words");
+			}
+		}
+		std::vector<unsigned char>().swap(data);
+		UINFO("Words: %dx%d (%d MB)", indexedDescriptors_.rows, indexedDescriptors_.cols,
+				int((qint64(indexedDescriptors_.rows) * qint64(indexedDescriptors_.cols) * qint64(indexedDescriptors_.elemSize())) / (1024*1024)));
+
+		QString signature;
+		QByteArray indexData;
+		streamSessionPtr >> signature >> indexData;
+		if(!usesTree() && loadIndex(signature, indexData.constData(), indexData.size()))
+		{
+			return;
+		}
+	}
+	else if(rows == 0 && cols == 0 && type == 3)
+	{
+		// quantized words
+		int quantization, chunked;
+		float offset, scale;
+		streamSessionPtr >> quantization >> offset >> scale >> chunked;
+		UINFO("Loading words... (quantized format: %d MB)", int(dataSize/(1024*1024)));
+		std::vector<unsigned char> data(dataSize>0?dataSize:0);
+		cv::Mat codes;
+		if(dataSize > 0 && readRawData64(streamSessionPtr, data.data(), dataSize))
+		{
+			codes = chunked?uncompressDataChunked(data.data(), dataSize):uncompressData(data.data(), dataSize);
+		}
+		else if(dataSize)
+		{
+			UERROR("Error reading the words");
+		}
+		std::vector<unsigned char>().swap(data);
+		indexedDescriptors_ = cv::Mat();
+		if(!codes.empty())
+		{
+			cv::Ptr<ScalarQuantizer> sq(new ScalarQuantizer(quantization, offset, scale, codes));
+			if(usesScalarQuantization() && quantization == params_.NearestNeighbor_quantization)
+			{
+				sq_ = sq; // kept quantized
+			}
+			else
+			{
+				indexedDescriptors_ = sq->reconstruct();
+			}
+			UINFO("Words: %dx%d (%d MB)", sq->size(), sq->dim(), (sq->size() * sq->codeSize()) / (1024*1024));
+		}
+
+		QString signature;
+		QByteArray indexData;
+		streamSessionPtr >> signature >> indexData;
+		if(!usesTree() && loadIndex(signature, indexData.constData(), indexData.size()))
+		{
+			return;
+		}
+	}
+	else if(rows == 0 && cols == 0 && (type == 0 || type == 1))
 	{
 		// compressed vocabulary
-		UINFO("Loading words... (compressed format: %d MB)", dataSize/(1024*1024));
+		UINFO("Loading words... (compressed format: %d MB)", int(dataSize/(1024*1024)));
 		UASSERT(dataSize <= std::numeric_limits<int>::max());
 		QByteArray data;
 		streamSessionPtr >> data;
 		UINFO("Uncompress vocabulary...");
 		indexedDescriptors_ = uncompressData((unsigned const char*)data.data(), dataSize);
 		UINFO("Words: %dx%d (%d MB)", indexedDescriptors_.rows, indexedDescriptors_.cols,
-				(indexedDescriptors_.rows * indexedDescriptors_.cols * indexedDescriptors_.elemSize()) / (1024*1024));
+				int((qint64(indexedDescriptors_.rows) * qint64(indexedDescriptors_.cols) * qint64(indexedDescriptors_.elemSize())) / (1024*1024)));
+
+		if(type == 1)
+		{
+			QString signature;
+			QByteArray indexData;
+			streamSessionPtr >> signature >> indexData;
+			if(!usesTree() && loadIndex(signature, indexData.constData(), indexData.size()))
+			{
+				return;
+			}
+		}
 	}
 	else
 	{
 		// old raw format
-		UINFO("Loading words... (old format: %dx%d (%d MB))", rows, cols, dataSize/(1024*1024));
+		UINFO("Loading words... (old format: %dx%d (%d MB))", rows, cols, int(dataSize/(1024*1024)));
 		QByteArray data;
 		streamSessionPtr >> data;
 		UINFO("Allocate memory...");
@@ -163,13 +513,121 @@ void Vocabulary::load(QDataStream & streamSessionPtr, bool loadVocabularyOnly)
 	update();
 }
 
+void Vocabulary::saveMapped(QDataStream & streamSessionPtr, bool saveVocabularyOnly) const
+{
+	if(saveVocabularyOnly)
+	{
+		streamSessionPtr << QMultiMap<int, int>();
+	}
+	else
+	{
+		streamSessionPtr << wordToObjects_;
+	}
+	writeMappedMat(streamSessionPtr, allIndexedDescriptors());
+
+	QString signature;
+	QByteArray indexData = saveIndex(signature);
+	streamSessionPtr << signature;
+	writeMappedBlock(streamSessionPtr, indexData.constData(), indexData.size());
+}
+
+void Vocabulary::loadMapped(QDataStream & streamSessionPtr, const uchar * base, bool loadVocabularyOnly)
+{
+	streamSessionPtr >> wordToObjects_;
+	if(loadVocabularyOnly)
+	{
+		wordToObjects_.clear();
+	}
+	clearPostings(); // see addObjectWords()
+	indexedDescriptors_ = readMappedMat(streamSessionPtr, base); // view on the mapped file
+	deltaDescriptors_ = cv::Mat();
+	pq_ = cv::Ptr<ProductQuantizer>(); // coded again from the mapped words
+	sq_ = cv::Ptr<ScalarQuantizer>();
+	notIndexedDescriptors_ = cv::Mat();
+	notIndexedWordIds_.clear();
+	UINFO("Words: %dx%d (mapped)", indexedDescriptors_.rows, indexedDescriptors_.cols);
+
+	QString signature;
+	streamSessionPtr >> signature;
+	qint64 indexSize = 0;
+	const uchar * indexData = readMappedBlock(streamSessionPtr, base, indexSize);
+	if(usesTree() || !loadIndex(signature, (const char *)indexData, indexSize))
+	{
+		UINFO("Update vocabulary index...");
+		update();
+	}
+}
+
+QByteArray Vocabulary::saveIndex(QString & signature) const
+{
+	QByteArray indexData;
+	if(deltaDescriptors_.empty() && !indexedDescriptors_.empty() && !Settings::isBruteForceNearestNeighbor(params_) && !usesTree() && !usesProductQuantization())
+	{
+		QTemporaryFile tmpFile;
+		if(tmpFile.open())
+		{
+			tmpFile.close();
+			try
+			{
+				flannIndex_->save(tmpFile.fileName().toStdString());
+				if(tmpFile.open())
+				{
+					indexData = tmpFile.readAll();
+					signature = indexSignature(indexedDescriptors_);
+				}
+			}
+			catch(cv::Exception & e)
+			{
+				UWARN("Index cannot be saved, it will be rebuilt on load (%s)", e.what());
+			}
+		}
+	}
+	return indexData;
+}
+
+bool Vocabulary::loadIndex(const QString & signature, const char * data, qint64 size)
+{
+	if(size &&
+	   !Settings::isBruteForceNearestNeighbor(params_) &&
+	   signature.compare(indexSignature(indexedDescriptors_)) == 0)
+	{
+		UINFO("Loading index... (%d MB)", int(size/(1024*1024)));
+		QTemporaryFile tmpFile;
+		if(tmpFile.open() && tmpFile.write(data, size) == size)
+		{
+			tmpFile.close();
+			cv::Ptr<cv::flann::Index> index(new cv::flann::Index());
+			try
+			{
+				if(index->load(indexedDescriptors_, tmpFile.fileName().toStdString()))
+				{
+					flannIndex_ = index;
+					notIndexedDescriptors_ = cv::Mat();
+					notIndexedWordIds_.clear();
+					return true;
+				}
+			}
+			catch(cv::Exception & e)
+			{
+				UWARN("Failed to load the index (%s)", e.what());
+			}
+		}
+		UWARN("Failed to load the index, it will be rebuilt.");
+	}
+	else if(size)
+	{
+		UINFO("Index saved with different parameters, it will be rebuilt.");
+	}
+	return false;
+}
+
 bool Vocabulary::save(const QString & filename) const
 {
 	// save descriptors
 	cv::FileStorage fs(filename.toStdString(), cv::FileStorage::WRITE);
 	if(fs.isOpened())
 	{
-		fs << "Descriptors" << indexedDescriptors_;
+		fs << "Descriptors" << allIndexedDescriptors();
 		return true;
 	}
 	else
@@ -193,6 +651,7 @@ bool Vocabulary::load(const QString & filename)
 			// clear index
 			wordToObjects_.clear();
 			indexedDescriptors_ = tmp;
+			deltaDescriptors_ = cv::Mat();
 			update();
 			return true;
 		}
@@ -208,6 +667,59 @@ bool Vocabulary::load(const QString & filename)
 	return false;
 }
 
+// The 2 nearest words of a descriptor
+struct NearestWords
+{
+	NearestWords() : count(0) {}
+	void add(float distance, int word)
+	{
+		if(count == 0 || distance < distances[0])
+		{
+			distances[1] = distances[0];
+			words[1] = words[0];
+			distances[0] = distance;
+			words[0] = word;
+		}
+		else if(count == 1 || distance < distances[1])
+		{
+			distances[1] = distance;
+			words[1] = word;
+		}
+		count = count<2?count+1:2;
+	}
+	int count;
+	float distances[2];
+	int words[2];
+};
+
+// Linear k nearest neighbors search of the words not indexed yet, all
+// queries at once. Same distances as the index: Hamming for binary
+// descriptors, squared L2 (like FLANN) for float descriptors.
+static void searchNotIndexed(const cv::Mat & queries, const cv::Mat & words, int normType, int k, cv::Mat & results, cv::Mat & dists)
+{
+	if(queries.type() == CV_8U && normType == cv::NORM_HAMMING)
+	{
+		hammingKnnSearch(queries, words, results, dists, k);
+		return;
+	}
+	cv::batchDistance(queries,
+			words,
+			dists,
+			queries.type()==CV_8U?CV_32S:CV_32F,
+			results,
+			queries.type()==CV_8U?normType:cv::NORM_L2SQR,
+			k,
+			cv::Mat(),
+			0,
+			false);
+	if(dists.type() == CV_32S)
+	{
+		cv::Mat temp;
+		dists.convertTo(temp, CV_32F);
+		dists = temp;
+	}
+}
+
 QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int objectId)
 {
 	QMultiMap<int, int> words;
@@ -217,7 +729,7 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 	}
 
 	cv::Mat descriptors;
-	if(descriptorsIn.type() == CV_8U && Settings::getNearestNeighbor_7ConvertBinToFloat())
+	if(descriptorsIn.type() == CV_8U && params_.NearestNeighbor_7ConvertBinToFloat)
 	{
 		descriptorsIn.convertTo(descriptors, CV_32F);
 	}
@@ -226,27 +738,48 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 		descriptors = descriptorsIn;
 	}
 
-	if(Settings::getGeneral_vocabularyIncremental() || Settings::getGeneral_vocabularyFixed())
+	if(usesTree())
+	{
+		if(tree_->type() != descriptors.type() || tree_->dim() != descriptors.cols)
+		{
+			UERROR("Descriptors (type=%d size=%d) are not the same type/size as those of the vocabulary tree (type=%d size=%d)! Empty words returned.",
+					descriptors.type(), descriptors.cols, tree_->type(), tree_->dim());
+			return words;
+		}
+		for(int i = 0; i < descriptors.rows; ++i)
+		{
+			float distance, secondDistance;
+			int wordId = tree_->quantize(descriptors.row(i), distance, secondDistance);
+			words.insert(wordId, i);
+			wordToObjects_.insert(wordId, objectId);
+			pendingWords_.push_back(wordId);
+			Posting posting = {objectId, i, 0.0f};
+			pendingPostings_.push_back(posting);
+		}
+		return words;
+	}
+
+	if(params_.General_vocabularyIncremental || params_.General_vocabularyFixed)
 	{
 		int k = 2;
 		cv::Mat results;
 		cv::Mat	dists;
 
 		bool globalSearch = false;
-		if(!indexedDescriptors_.empty() && indexedDescriptors_.rows >= (int)k)
+		if(indexedRows() > 0 && indexedSize() >= (int)k)
 		{
-			if(indexedDescriptors_.type() != descriptors.type() || indexedDescriptors_.cols != descriptors.cols)
+			if(this->type() != descriptors.type() || this->dim() != descriptors.cols)
 			{
-				if(Settings::getGeneral_vocabularyFixed())
+				if(params_.General_vocabularyFixed)
 				{
 					UERROR("Descriptors (type=%d size=%d) to search in vocabulary are not the same type/size as those in the vocabulary (type=%d size=%d)! Empty words returned.",
-							descriptors.type(), descriptors.cols, indexedDescriptors_.type(), indexedDescriptors_.cols);
+							descriptors.type(), descriptors.cols, this->type(), this->dim());
 					return words;
 				}
 				else
 				{
 					UFATAL("Descriptors (type=%d size=%d) to search in vocabulary are not the same type/size as those in the vocabulary (type=%d size=%d)!",
-							descriptors.type(), descriptors.cols, indexedDescriptors_.type(), indexedDescriptors_.cols);
+							descriptors.type(), descriptors.cols, this->type(), this->dim());
 				}
 			}
 
@@ -262,71 +795,59 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 			globalSearch = true;
 		}
 
-		if(!Settings::getGeneral_vocabularyFixed())
+		if(!params_.General_vocabularyFixed)
 		{
 			notIndexedWordIds_.reserve(notIndexedWordIds_.size() + descriptors.rows);
 			notIndexedDescriptors_.reserve(notIndexedDescriptors_.rows + descriptors.rows);
 		}
+		//normType – One of NORM_L1, NORM_L2, NORM_HAMMING, NORM_HAMMING2. L1 and L2 norms are
+		//			 preferable choices for SIFT and SURF descriptors, NORM_HAMMING should be
+		// 			 used with ORB, BRISK and BRIEF, NORM_HAMMING2 should be used with ORB
+		// 			 when WTA_K==3 or 4 (see ORB::ORB constructor description).
+		int normType = cv::NORM_HAMMING;
+		if(descriptors.type()==CV_8U &&
+			Settings::currentDescriptorType(params_).compare("ORB") &&
+			(params_.Feature2D_ORB_WTA_K==3 || params_.Feature2D_ORB_WTA_K==4))
+		{
+			normType = cv::NORM_HAMMING2;
+		}
+		// Words not indexed yet: those existing before this call are searched
+		// at once for all descriptors, only the words added by the previous
+		// descriptors of this call are then searched one descriptor at a time.
+		int pendingRows = notIndexedDescriptors_.rows;
+		cv::Mat pendingResults;
+		cv::Mat pendingDists;
+		if(pendingRows)
+		{
+			UASSERT(notIndexedDescriptors_.type() == descriptors.type() && notIndexedDescriptors_.cols == descriptors.cols);
+			searchNotIndexed(descriptors, notIndexedDescriptors_, normType, pendingRows>=k?k:1, pendingResults, pendingDists);
+		}
+
 		int matches = 0;
 		for(int i = 0; i < descriptors.rows; ++i)
 		{
-			QMultiMap<float, int> fullResults; // nearest descriptors sorted by distance
-			if(notIndexedDescriptors_.rows)
+			NearestWords nearest; // the 2 nearest words sorted by distance
+			if(pendingRows)
 			{
-				UASSERT(notIndexedDescriptors_.type() == descriptors.type() && notIndexedDescriptors_.cols == descriptors.cols);
-
-				// Check if this descriptor matches with a word not already added to the vocabulary
-				// Do linear search only
-				cv::Mat tmpResults;
-				cv::Mat	tmpDists;
-				if(descriptors.type()==CV_8U)
+				for(int j = 0; j < pendingResults.cols; ++j)
 				{
-					//normType – One of NORM_L1, NORM_L2, NORM_HAMMING, NORM_HAMMING2. L1 and L2 norms are
-					//			 preferable choices for SIFT and SURF descriptors, NORM_HAMMING should be
-					// 			 used with ORB, BRISK and BRIEF, NORM_HAMMING2 should be used with ORB
-					// 			 when WTA_K==3 or 4 (see ORB::ORB constructor description).
-					int normType = cv::NORM_HAMMING;
-					if(Settings::currentDescriptorType().compare("ORB") &&
-						(Settings::getFeature2D_ORB_WTA_K()==3 || Settings::getFeature2D_ORB_WTA_K()==4))
+					if(pendingResults.at<int>(i,j) >= 0)
 					{
-						normType = cv::NORM_HAMMING2;
+						nearest.add(pendingDists.at<float>(i,j), notIndexedWordIds_.at(pendingResults.at<int>(i,j)));
 					}
-
-					cv::batchDistance( descriptors.row(i),
-									notIndexedDescriptors_,
-									tmpDists,
-									CV_32S,
-									tmpResults,
-									normType,
-									notIndexedDescriptors_.rows>=k?k:1,
-									cv::Mat(),
-									0,
-									false);
-				}
-				else
-				{
-					cv::flann::Index tmpIndex;
-#if CV_MAJOR_VERSION == 2 and CV_MINOR_VERSION == 4 and CV_SUBMINOR_VERSION >= 12
-					tmpIndex.build(notIndexedDescriptors_, cv::Mat(), cv::flann::LinearIndexParams(), cvflann::FLANN_DIST_L2);
-#else
-					tmpIndex.build(notIndexedDescriptors_, cv::flann::LinearIndexParams(), cvflann::FLANN_DIST_L2);
-#endif
-					tmpIndex.knnSearch(descriptors.row(i), tmpResults, tmpDists, notIndexedDescriptors_.rows>1?k:1, cvflann::FLANN_DIST_L2);
-				}
-
-				if( tmpDists.type() == CV_32S )
-				{
-					cv::Mat temp;
-					tmpDists.convertTo(temp, CV_32F);
-					tmpDists = temp;
 				}
-
+			}
+			if(notIndexedDescriptors_.rows > pendingRows)
+			{
+				cv::Mat tmpResults;
+				cv::Mat	tmpDists;
+				int added = notIndexedDescriptors_.rows - pendingRows;
+				searchNotIndexed(descriptors.row(i), notIndexedDescriptors_.rowRange(pendingRows, notIndexedDescriptors_.rows), normType, added>=k?k:1, tmpResults, tmpDists);
 				for(int j = 0; j < tmpResults.cols; ++j)
 				{
 					if(tmpResults.at<int>(0,j) >= 0)
 					{
-						//printf("local i=%d, j=%d, tmpDist=%f tmpResult=%d\n", i ,j, tmpDists.at<float>(0,j), tmpResults.at<int>(0,j));
-						fullResults.insert(tmpDists.at<float>(0,j), notIndexedWordIds_.at(tmpResults.at<int>(0,j)));
+						nearest.add(tmpDists.at<float>(0,j), notIndexedWordIds_.at(pendingRows + tmpResults.at<int>(0,j)));
 					}
 				}
 			}
@@ -337,23 +858,22 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 				{
 					if(results.at<int>(i,j) >= 0)
 					{
-						//printf("global i=%d, j=%d, dist=%f\n", i ,j, dists.at<float>(i,j));
-						fullResults.insert(dists.at<float>(i,j), results.at<int>(i,j));
+						nearest.add(dists.at<float>(i,j), results.at<int>(i,j));
 					}
 				}
 			}
 
 			bool matched = false;
-			if(Settings::getNearestNeighbor_3nndrRatioUsed() &&
-			   fullResults.size() >= 2 &&
-			   fullResults.begin().key() <= Settings::getNearestNeighbor_4nndrRatio() * (++fullResults.begin()).key())
+			if(params_.NearestNeighbor_3nndrRatioUsed &&
+			   nearest.count >= 2 &&
+			   nearest.distances[0] <= params_.NearestNeighbor_4nndrRatio * nearest.distances[1])
 			{
 				matched = true;
 			}
-			if((matched || !Settings::getNearestNeighbor_3nndrRatioUsed()) &&
-			   Settings::getNearestNeighbor_5minDistanceUsed())
+			if((matched || !params_.NearestNeighbor_3nndrRatioUsed) &&
+			   params_.NearestNeighbor_5minDistanceUsed)
 			{
-				if(fullResults.begin().key() <= Settings::getNearestNeighbor_6minDistance())
+				if(nearest.count && nearest.distances[0] <= params_.NearestNeighbor_6minDistance)
 				{
 					matched = true;
 				}
@@ -362,24 +882,30 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 					matched = false;
 				}
 			}
-			if(!matched && !Settings::getNearestNeighbor_3nndrRatioUsed() && !Settings::getNearestNeighbor_5minDistanceUsed())
+			if(!matched && nearest.count && !params_.NearestNeighbor_3nndrRatioUsed && !params_.NearestNeighbor_5minDistanceUsed)
 			{
 				matched = true; // no criterion, match to the nearest descriptor
 			}
 
 			if(matched)
 			{
-				words.insert(fullResults.begin().value(), i);
-				wordToObjects_.insert(fullResults.begin().value(), objectId);
+				words.insert(nearest.words[0], i);
+				wordToObjects_.insert(nearest.words[0], objectId);
+				pendingWords_.push_back(nearest.words[0]);
+				Posting posting = {objectId, i, 0.0f};
+				pendingPostings_.push_back(posting);
 				++matches;
 			}
-			else if(!Settings::getGeneral_invertedSearch() || !Settings::getGeneral_vocabularyFixed())
+			else if(!params_.General_invertedSearch || !params_.General_vocabularyFixed)
 			{
 				//concatenate new words
-				notIndexedWordIds_.push_back(indexedDescriptors_.rows + notIndexedDescriptors_.rows);
+				notIndexedWordIds_.push_back(indexedSize() + notIndexedDescriptors_.rows);
 				notIndexedDescriptors_.push_back(descriptors.row(i));
 				words.insert(notIndexedWordIds_.back(), i);
 				wordToObjects_.insert(notIndexedWordIds_.back(), objectId);
+				pendingWords_.push_back(notIndexedWordIds_.back());
+				Posting posting = {objectId, i, 0.0f};
+				pendingPostings_.push_back(posting);
 			}
 			else
 			{
@@ -391,9 +917,12 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 	{
 		for(int i = 0; i < descriptors.rows; ++i)
 		{
-			wordToObjects_.insert(indexedDescriptors_.rows + notIndexedDescriptors_.rows+i, objectId);
-			words.insert(indexedDescriptors_.rows + notIndexedDescriptors_.rows+i, i);
-			notIndexedWordIds_.push_back(indexedDescriptors_.rows + notIndexedDescriptors_.rows+i);
+			wordToObjects_.insert(indexedSize() + notIndexedDescriptors_.rows+i, objectId);
+			words.insert(indexedSize() + notIndexedDescriptors_.rows+i, i);
+			notIndexedWordIds_.push_back(indexedSize() + notIndexedDescriptors_.rows+i);
+			pendingWords_.push_back(notIndexedWordIds_.back());
+			Posting posting = {objectId, i, 0.0f};
+			pendingPostings_.push_back(posting);
 		}
 
 		//just concatenate descriptors
@@ -404,6 +933,302 @@ QMultiMap<int, int> Vocabulary::addWords(const cv::Mat & descriptorsIn, int obje
 
 void Vocabulary::update()
 {
+	updateIndex();
+	updateGpuWords();
+	updateWordNorms();
+	updatePostings();
+}
+
+void Vocabulary::addObjectWords(int objectId, const QMultiMap<int, int> & words)
+{
+	for(QMultiMap<int, int>::const_iterator iter=words.constBegin(); iter!=words.constEnd(); ++iter)
+	{
+		if(iter.key() >= 0)
+		{
+			pendingWords_.push_back(iter.key());
+			Posting posting = {objectId, iter.value(), 0.0f};
+			pendingPostings_.push_back(posting);
+		}
+	}
+}
+
+void Vocabulary::clearPostings()
+{
+	postingOffsets_.clear();
+	postings_.clear();
+	pendingWords_.clear();
+	pendingPostings_.clear();
+}
+
+static bool postingLessThan(const Vocabulary::Posting & a, const Vocabulary::Posting & b)
+{
+	return a.objectId < b.objectId || (a.objectId == b.objectId && a.descriptorIndex < b.descriptorIndex);
+}
+
+void Vocabulary::updatePostings()
+{
+	if(pendingWords_.empty())
+	{
+		return;
+	}
+
+	int words = (int)postingOffsets_.size()-1;
+	for(unsigned int i=0; i<pendingWords_.size(); ++i)
+	{
+		if(words < pendingWords_[i]+1)
+		{
+			words = pendingWords_[i]+1;
+		}
+	}
+
+	// count postings per word, then place old and new postings
+	QVector<int> offsets(words+1, 0);
+	for(int w=0; w+1<(int)postingOffsets_.size(); ++w)
+	{
+		offsets[w+1] = postingOffsets_[w+1] - postingOffsets_[w];
+	}
+	for(unsigned int i=0; i<pendingWords_.size(); ++i)
+	{
+		++offsets[pendingWords_[i]+1];
+	}
+	for(int w=0; w<words; ++w)
+	{
+		offsets[w+1] += offsets[w];
+	}
+	QVector<Posting> postings(offsets[words]);
+	QVector<int> next = offsets;
+	for(int w=0; w+1<(int)postingOffsets_.size(); ++w)
+	{
+		for(int j=postingOffsets_[w]; j<postingOffsets_[w+1]; ++j)
+		{
+			postings[next[w]++] = postings_[j];
+		}
+	}
+	for(unsigned int i=0; i<pendingWords_.size(); ++i)
+	{
+		postings[next[pendingWords_[i]]++] = pendingPostings_[i];
+	}
+
+	// objects having a word more than once are not unique matches
+	QHash<int, double> objectsNorm; // <object id, sum of squared weights>
+	QVector<int> objectsPerWord(words, 0);
+	for(int w=0; w<words; ++w)
+	{
+		if(offsets[w+1] - offsets[w] > 1)
+		{
+			std::sort(postings.begin()+offsets[w], postings.begin()+offsets[w+1], postingLessThan);
+			for(int j=offsets[w]; j+1<offsets[w+1]; ++j)
+			{
+				if(postings[j].objectId == postings[j+1].objectId)
+				{
+					postings[j].descriptorIndex = -1;
+					postings[j+1].descriptorIndex = -1;
+				}
+			}
+		}
+		for(int j=offsets[w]; j<offsets[w+1]; ++j)
+		{
+			if(j == offsets[w] || postings[j].objectId != postings[j-1].objectId)
+			{
+				++objectsPerWord[w];
+				objectsNorm.insert(postings[j].objectId, 0.0);
+			}
+		}
+	}
+
+	// TF-IDF: idf of a word is log(objects / objects having the word), its
+	// weight in an object is its occurrences in the object times its idf
+	double objects = objectsNorm.size();
+	QVector<float> idf(words, 0.0f);
+	for(int w=0; w<words; ++w)
+	{
+		if(objectsPerWord[w])
+		{
+			idf[w] = (float)log(objects / double(objectsPerWord[w]));
+		}
+		for(int j=offsets[w]; j<offsets[w+1];)
+		{
+			int k = j;
+			while(k<offsets[w+1] && postings[k].objectId == postings[j].objectId)
+			{
+				++k;
+			}
+			double weight = double(k-j) * idf[w];
+			objectsNorm[postings[j].objectId] += weight*weight;
+			j = k;
+		}
+	}
+
+	// the score of an object is the sum over the scene words of
+	// idf(w)*objectWeight(w)/objectNorm, which is the sum of the
+	// weights below as each occurrence of a word has its own posting
+	for(int w=0; w<words; ++w)
+	{
+		for(int j=offsets[w]; j<offsets[w+1]; ++j)
+		{
+			double norm = sqrt(objectsNorm.value(postings[j].objectId));
+			postings[j].weight = norm>0.0?float(double(idf[w])*double(idf[w])/norm):0.0f;
+		}
+	}
+
+	// copies of this vocabulary keep the old postings
+	postingOffsets_ = offsets;
+	postings_ = postings;
+	pendingWords_.clear();
+	pendingPostings_.clear();
+}
+
+void Vocabulary::updateIndex()
+{
+	if(usesTree())
+	{
+		if(!indexedDescriptors_.empty() &&
+		   indexedDescriptors_.data != tree_->words().data &&
+		   (indexedDescriptors_.rows != tree_->words().rows || indexedDescriptors_.cols != tree_->words().cols))
+		{
+			UWARN("The vocabulary (%d words) is replaced by the words of the vocabulary tree (%d words), "
+				  "words of the objects are not valid if they were not created with this tree.",
+				  indexedDescriptors_.rows, tree_->words().rows);
+		}
+		indexedDescriptors_ = tree_->words();
+		pq_ = cv::Ptr<ProductQuantizer>();
+		sq_ = cv::Ptr<ScalarQuantizer>();
+		deltaDescriptors_ = cv::Mat();
+		deltaIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		notIndexedDescriptors_ = cv::Mat();
+		notIndexedWordIds_.clear();
+		flannIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		return;
+	}
+
+	if(hasScalarCodes() && (usesProductQuantization() || !usesScalarQuantization() || sq_->type() != params_.NearestNeighbor_quantization))
+	{
+		// quantization changed, back to float words
+		indexedDescriptors_ = allIndexedDescriptors();
+		sq_ = cv::Ptr<ScalarQuantizer>();
+	}
+
+	if(usesProductQuantization())
+	{
+		bool keepWords = params_.NearestNeighbor_PQ_rerank > 0;
+		if(!hasCodes() || pq_->codeSize() != params_.NearestNeighbor_PQ_subQuantizers)
+		{
+			// (re)train with all the words
+			cv::Mat words = allIndexedDescriptors();
+			if(!notIndexedDescriptors_.empty())
+			{
+				if(words.empty())
+				{
+					words = notIndexedDescriptors_;
+				}
+				else
+				{
+					cv::Mat tmp;
+					cv::vconcat(words, notIndexedDescriptors_, tmp);
+					words = tmp;
+				}
+			}
+			cv::Ptr<ProductQuantizer> pq(new ProductQuantizer());
+			if(!words.empty() && words.type() == CV_32FC1 &&
+			   pq->train(words, params_.NearestNeighbor_PQ_subQuantizers, params_.NearestNeighbor_PQ_coarseCells))
+			{
+				pq_ = pq;
+				indexedDescriptors_ = keepWords?words:cv::Mat();
+				UINFO("Vocabulary coded with product quantization (%d words, %d bytes per word instead of %d)",
+						pq_->size(), pq_->codeSize(), (int)(words.cols * words.elemSize()));
+			}
+			else
+			{
+				if(!words.empty())
+				{
+					UWARN("Product quantization cannot be trained on these words (%dx%d type=%d), "
+						  "brute force search is used. Binary descriptors should be converted to float (%s).",
+						  words.rows, words.cols, words.type(), Settings::kNearestNeighbor_7ConvertBinToFloat().toStdString().c_str());
+				}
+				pq_ = cv::Ptr<ProductQuantizer>();
+				indexedDescriptors_ = words;
+			}
+		}
+		else if(!notIndexedDescriptors_.empty())
+		{
+			// copies of this vocabulary may still use the old codes
+			cv::Ptr<ProductQuantizer> pq(new ProductQuantizer(*pq_));
+			pq->add(notIndexedDescriptors_);
+			if(keepWords && indexedDescriptors_.rows + notIndexedDescriptors_.rows == pq->size())
+			{
+				cv::Mat descriptors;
+				cv::vconcat(indexedDescriptors_, notIndexedDescriptors_, descriptors);
+				indexedDescriptors_ = descriptors;
+			}
+			else
+			{
+				indexedDescriptors_ = cv::Mat();
+			}
+			pq_ = pq;
+		}
+		else if(!keepWords)
+		{
+			indexedDescriptors_ = cv::Mat();
+		}
+		notIndexedDescriptors_ = cv::Mat();
+		notIndexedWordIds_.clear();
+		deltaDescriptors_ = cv::Mat();
+		deltaIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		flannIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		return;
+	}
+
+	if(hasCodes())
+	{
+		// strategy changed, index the words back (approximated if they were not kept)
+		indexedDescriptors_ = allIndexedDescriptors();
+		pq_ = cv::Ptr<ProductQuantizer>();
+	}
+
+	if(usesScalarQuantization() &&
+	   (hasScalarCodes() || (this->type() == CV_32FC1 && (!indexedDescriptors_.empty() || !notIndexedDescriptors_.empty()))))
+	{
+		if(!hasScalarCodes())
+		{
+			// train on all the words
+			cv::Mat words = allIndexedDescriptors();
+			if(!notIndexedDescriptors_.empty())
+			{
+				if(words.empty())
+				{
+					words = notIndexedDescriptors_;
+				}
+				else
+				{
+					cv::Mat tmp;
+					cv::vconcat(words, notIndexedDescriptors_, tmp);
+					words = tmp;
+				}
+			}
+			cv::Ptr<ScalarQuantizer> sq(new ScalarQuantizer());
+			sq->train(words, params_.NearestNeighbor_quantization);
+			sq->add(words);
+			sq_ = sq;
+			UINFO("Vocabulary quantized (%d words, %d bytes per word instead of %d)",
+					sq_->size(), sq_->codeSize(), (int)(words.cols * words.elemSize()));
+		}
+		else if(!notIndexedDescriptors_.empty())
+		{
+			// copies of this vocabulary may still use the old codes
+			cv::Ptr<ScalarQuantizer> sq(new ScalarQuantizer(*sq_));
+			sq->add(notIndexedDescriptors_);
+			sq_ = sq;
+		}
+		indexedDescriptors_ = cv::Mat();
+		notIndexedDescriptors_ = cv::Mat();
+		notIndexedWordIds_.clear();
+		deltaDescriptors_ = cv::Mat();
+		deltaIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		flannIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+		return;
+	}
+
+	bool bruteForce = Settings::isBruteForceNearestNeighbor(params_);
 	if(!notIndexedDescriptors_.empty())
 	{
 		if(!indexedDescriptors_.empty())
@@ -411,32 +1236,209 @@ void Vocabulary::update()
 			UASSERT(indexedDescriptors_.cols == notIndexedDescriptors_.cols &&
 				 	indexedDescriptors_.type() == notIndexedDescriptors_.type() );
 		}
-		
-		//concatenate descriptors
-		indexedDescriptors_.push_back(notIndexedDescriptors_);
+
+		float deltaRatio = params_.General_vocabularyDeltaRatio;
+		if(!bruteForce &&
+		   !indexedDescriptors_.empty() &&
+		   deltaRatio > 0.0f &&
+		   deltaDescriptors_.rows + notIndexedDescriptors_.rows <= deltaRatio * indexedDescriptors_.rows)
+		{
+			// Only the small delta index is rebuilt, the main index is kept
+			if(deltaDescriptors_.empty())
+			{
+				deltaDescriptors_ = notIndexedDescriptors_;
+			}
+			else
+			{
+				cv::Mat descriptors;
+				cv::vconcat(deltaDescriptors_, notIndexedDescriptors_, descriptors);
+				deltaDescriptors_ = descriptors;
+			}
+			notIndexedDescriptors_ = cv::Mat();
+			notIndexedWordIds_.clear();
+
+			deltaIndex_ = buildIndex(deltaDescriptors_);
+			UDEBUG("Delta index updated (%d words, main index=%d words)", deltaDescriptors_.rows, indexedDescriptors_.rows);
+			return;
+		}
+
+		//concatenate descriptors in a new matrix (copies of this vocabulary may still use the old one)
+		if(indexedDescriptors_.empty())
+		{
+			indexedDescriptors_ = notIndexedDescriptors_;
+		}
+		else
+		{
+			cv::Mat descriptors;
+			if(deltaDescriptors_.empty())
+			{
+				cv::vconcat(indexedDescriptors_, notIndexedDescriptors_, descriptors);
+			}
+			else
+			{
+				cv::Mat tmp;
+				cv::vconcat(indexedDescriptors_, deltaDescriptors_, tmp);
+				cv::vconcat(tmp, notIndexedDescriptors_, descriptors);
+			}
+			indexedDescriptors_ = descriptors;
+		}
 
 		notIndexedDescriptors_ = cv::Mat();
 		notIndexedWordIds_.clear();
 	}
+	else if(!deltaDescriptors_.empty())
+	{
+		// full update requested, merge the delta words
+		indexedDescriptors_ = allIndexedDescriptors();
+	}
+	deltaDescriptors_ = cv::Mat();
+	deltaIndex_ = cv::Ptr<cv::flann::Index>(new cv::flann::Index());
+
+	if(!indexedDescriptors_.empty() && !bruteForce)
+	{
+		flannIndex_ = buildIndex(indexedDescriptors_);
+	}
+}
 
-	if(!indexedDescriptors_.empty() && !Settings::isBruteForceNearestNeighbor())
+QString Vocabulary::indexSignature(const cv::Mat & descriptors) const
+{
+	// Identify the data and the parameters used to build the index (search parameters are ignored)
+	QString signature = QString("%1 %2x%3 type=%4").arg(CV_VERSION).arg(descriptors.rows).arg(descriptors.cols).arg(descriptors.type());
+	const ParametersMap parameters = params_.toMap();
+	for(ParametersMap::const_iterator iter=parameters.begin(); iter!=parameters.end(); ++iter)
 	{
-		cv::flann::IndexParams * params = Settings::createFlannIndexParams();
+		if(iter.key().startsWith("NearestNeighbor/") &&
+		   iter.key().compare(Settings::kNearestNeighbor_3nndrRatioUsed()) != 0 &&
+		   iter.key().compare(Settings::kNearestNeighbor_4nndrRatio()) != 0 &&
+		   iter.key().compare(Settings::kNearestNeighbor_5minDistanceUsed()) != 0 &&
+		   iter.key().compare(Settings::kNearestNeighbor_6minDistance()) != 0 &&
+		   iter.key().compare(Settings::kNearestNeighbor_BruteForce_gpu()) != 0 &&
+		   !iter.key().startsWith("NearestNeighbor/search_"))
+		{
+			signature += QString(";%1=%2").arg(iter.key()).arg(iter.value().toString());
+		}
+	}
+	return signature;
+}
+
+cv::Ptr<cv::flann::Index> Vocabulary::buildIndex(const cv::Mat & descriptors) const
+{
+	cv::flann::IndexParams * params = Settings::createFlannIndexParams(params_);
+	cv::Ptr<cv::flann::Index> index(new cv::flann::Index());
 #if CV_MAJOR_VERSION == 2 and CV_MINOR_VERSION == 4 and CV_SUBMINOR_VERSION >= 12
-		flannIndex_.build(indexedDescriptors_, cv::Mat(), *params, Settings::getFlannDistanceType());
+	index->build(descriptors, cv::Mat(), *params, Settings::getFlannDistanceType(params_));
 #else
-		flannIndex_.build(indexedDescriptors_, *params, Settings::getFlannDistanceType());
+	index->build(descriptors, *params, Settings::getFlannDistanceType(params_));
 #endif
-		delete params;
+	delete params;
+	return index;
+}
+
+static qint64 matBytes(const cv::Mat & m)
+{
+	return qint64(m.total()*m.elemSize());
+}
+
+// Nodes of QMap: parent (with the color), left and right pointers, key and value
+static const qint64 kMapNodeBytes = 3*sizeof(void*) + 2*sizeof(int);
+
+// FLANN doesn't report its memory, estimated from the structures of its
+// algorithms: indices of the points per tree/table and nodes of the trees
+static qint64 flannIndexBytes(const cv::Ptr<cv::flann::Index> & index, int rows, int dim, const ParametersSnapshot & params)
+{
+	if(index.empty() || rows == 0)
+	{
+		return 0;
+	}
+	const qint64 kdTreeBytes = qint64(rows)*(sizeof(int) + 2*(2*sizeof(void*) + sizeof(int) + sizeof(float)));
+	const int branching = params.NearestNeighbor_KMeans_branching>1?params.NearestNeighbor_KMeans_branching:2;
+	const qint64 kMeansBytes = qint64(rows)*sizeof(int) + qint64(rows/(branching-1)+1)*(dim*sizeof(float) + 8*sizeof(void*));
+	switch(index->getAlgorithm())
+	{
+	case cvflann::FLANN_INDEX_LINEAR:
+		return 0;
+	case cvflann::FLANN_INDEX_KDTREE:
+		return params.NearestNeighbor_KDTree_trees * kdTreeBytes;
+	case cvflann::FLANN_INDEX_KMEANS:
+		return kMeansBytes;
+	case cvflann::FLANN_INDEX_COMPOSITE:
+		return params.NearestNeighbor_Composite_trees * kdTreeBytes + kMeansBytes;
+	case cvflann::FLANN_INDEX_LSH:
+		return params.NearestNeighbor_Lsh_table_number * qint64(rows)*sizeof(unsigned int);
+	default:
+		return params.NearestNeighbor_KDTree_trees * kdTreeBytes;
 	}
 }
 
-void Vocabulary::search(const cv::Mat & descriptorsIn, cv::Mat & results, cv::Mat & dists, int k)
+Vocabulary::MemoryUsage Vocabulary::memoryUsage() const
 {
-	if(!indexedDescriptors_.empty())
+	MemoryUsage usage;
+	usage.words = matBytes(indexedDescriptors_) + matBytes(deltaDescriptors_) + matBytes(notIndexedDescriptors_) +
+			matBytes(wordNorms_) + notIndexedWordIds_.size()*sizeof(int);
+	if(hasCodes())
+	{
+		usage.words += pq_->memoryUsage();
+	}
+	if(hasScalarCodes())
+	{
+		usage.words += sq_->memoryUsage();
+	}
+	usage.wordToObjects = wordToObjects_.size()*kMapNodeBytes;
+	usage.postings = (postingOffsets_.size() + pendingWords_.size())*sizeof(int) +
+			(postings_.size() + pendingPostings_.size())*sizeof(Posting);
+	usage.index = flannIndexBytes(flannIndex_, indexedDescriptors_.rows, indexedDescriptors_.cols, params_) +
+			flannIndexBytes(deltaIndex_, deltaDescriptors_.rows, deltaDescriptors_.cols, params_);
+	if(!tree_.isNull())
+	{
+		usage.index += tree_->memoryUsage();
+	}
+	return usage;
+}
+
+// Convert back to matrix style, missing neighbors are set to -1
+static void convertMatches(const std::vector<std::vector<cv::DMatch> > & matches, int k, cv::Mat & results, cv::Mat & dists)
+{
+	results = cv::Mat((int)matches.size(), k, CV_32SC1);
+	dists = cv::Mat((int)matches.size(), k, CV_32FC1);
+	for(unsigned int i=0; i<matches.size(); ++i)
+	{
+		for(int j=0; j<k; ++j)
+		{
+			if(j < (int)matches[i].size())
+			{
+				results.at<int>(i, j) = matches[i][j].trainIdx;
+				dists.at<float>(i, j) = matches[i][j].distance;
+			}
+			else
+			{
+				results.at<int>(i, j) = -1;
+				dists.at<float>(i, j) = std::numeric_limits<float>::max();
+			}
+		}
+	}
+}
+
+bool Vocabulary::searchGpu(const GpuMat & descriptors, cv::Mat & results, cv::Mat & dists, int k) const
+{
+	if(gpuWords_.isNull() ||
+	   !gpuWords_->isUploaded(allIndexedDescriptors()) ||
+	   descriptors.type() != gpuWords_->type() ||
+	   descriptors.cols != gpuWords_->dim())
+	{
+		return false;
+	}
+	std::vector<std::vector<cv::DMatch> > matches;
+	gpuWords_->knnMatch(descriptors, matches, k);
+	convertMatches(matches, k, results, dists);
+	return true;
+}
+
+void Vocabulary::search(const cv::Mat & descriptorsIn, cv::Mat & results, cv::Mat & dists, int k) const
+{
+	if(indexedRows() > 0)
 	{
 		cv::Mat descriptors;
-		if(descriptorsIn.type() == CV_8U && Settings::getNearestNeighbor_7ConvertBinToFloat())
+		if(descriptorsIn.type() == CV_8U && params_.NearestNeighbor_7ConvertBinToFloat)
 		{
 			descriptorsIn.convertTo(descriptors, CV_32F);
 		}
@@ -445,70 +1447,121 @@ void Vocabulary::search(const cv::Mat & descriptorsIn, cv::Mat & results, cv::Ma
 			descriptors = descriptorsIn;
 		}
 
-		UASSERT(descriptors.type() == indexedDescriptors_.type() && descriptors.cols == indexedDescriptors_.cols);
+		UASSERT(descriptors.type() == this->type() && descriptors.cols == this->dim());
 
-		if(Settings::isBruteForceNearestNeighbor())
+		if(usesTree())
+		{
+			tree_->quantize(descriptors, results, dists, k);
+		}
+		else if(usesProductQuantization() && hasCodes())
 		{
-			std::vector<std::vector<cv::DMatch> > matches;
-			if(Settings::getNearestNeighbor_BruteForce_gpu() && CVCUDA::getCudaEnabledDeviceCount())
+			int rerank = indexedDescriptors_.rows == pq_->size()?params_.NearestNeighbor_PQ_rerank:0;
+			pq_->search(descriptors, results, dists, k, params_.NearestNeighbor_PQ_probes, indexedDescriptors_, rerank);
+		}
+		else if(hasScalarCodes())
+		{
+			sq_->search(descriptors, results, dists, k);
+		}
+		else if(Settings::isBruteForceNearestNeighbor(params_) || usesProductQuantization())
+		{
+			cv::Mat words = allIndexedDescriptors(); // the delta is normally empty in brute force mode
+			if(Settings::isHammingNearestNeighbor(params_) && descriptors.type()==CV_8U && words.type()==CV_8U)
 			{
-				CVCUDA::GpuMat newDescriptorsGpu(descriptors);
-				CVCUDA::GpuMat lastDescriptorsGpu(indexedDescriptors_);
-#if CV_MAJOR_VERSION < 3
-				if(indexedDescriptors_.type()==CV_8U)
+				hammingKnnSearch(descriptors, words, results, dists, k);
+			}
+			else if(params_.NearestNeighbor_BruteForce_gemm &&
+					!(params_.NearestNeighbor_BruteForce_gpu && CVCUDA::getCudaEnabledDeviceCount()) &&
+					descriptors.type()==CV_32FC1 && words.type()==CV_32FC1)
+			{
+				// norms computed here if not updated yet
+				l2KnnSearch(descriptors, words, wordNorms_, results, dists, k);
+			}
+			else
+			{
+				std::vector<std::vector<cv::DMatch> > matches;
+				if(params_.NearestNeighbor_BruteForce_gpu && CVCUDA::getCudaEnabledDeviceCount())
 				{
-					CVCUDA::BruteForceMatcher_GPU<cv::Hamming> gpuMatcher;
-					gpuMatcher.knnMatch(newDescriptorsGpu, lastDescriptorsGpu, matches, k);
+					if(!gpuWords_.isNull() && gpuWords_->isUploaded(words))
+					{
+						gpuWords_->knnMatch(descriptors, matches, k);
+					}
+					else
+					{
+						// not uploaded yet (updated on next update()), upload for this search only
+						VocabularyGpuWords(words).knnMatch(descriptors, matches, k);
+					}
 				}
 				else
 				{
-					CVCUDA::BruteForceMatcher_GPU<cv::L2<float> > gpuMatcher;
-					gpuMatcher.knnMatch(newDescriptorsGpu, lastDescriptorsGpu, matches, k);
+					cv::BFMatcher matcher(words.type()==CV_8U?cv::NORM_HAMMING:cv::NORM_L2);
+					matcher.knnMatch(descriptors, words, matches, k);
 				}
-#else
-#ifdef HAVE_OPENCV_CUDAFEATURES2D
-				cv::Ptr<cv::cuda::DescriptorMatcher> gpuMatcher;
-				if(indexedDescriptors_.type()==CV_8U)
+
+				convertMatches(matches, k, results, dists);
+			}
+		}
+		else
+		{
+			cv::flann::SearchParams searchParams(
+					params_.NearestNeighbor_search_checks,
+					params_.NearestNeighbor_search_eps,
+					params_.NearestNeighbor_search_sorted);
+			flannIndex_->knnSearch(descriptors, results, dists, k, searchParams);
+
+			if(!deltaDescriptors_.empty())
+			{
+				// Search the delta index too and keep the k nearest of both
+				cv::Mat deltaResults;
+				cv::Mat deltaDists;
+				int deltaK = deltaDescriptors_.rows<k?deltaDescriptors_.rows:k;
+				deltaIndex_->knnSearch(descriptors, deltaResults, deltaDists, deltaK, searchParams);
+				if( dists.type() == CV_32S )
 				{
-					gpuMatcher = cv::cuda::DescriptorMatcher::createBFMatcher(cv::NORM_HAMMING);
-					gpuMatcher->knnMatch(newDescriptorsGpu, lastDescriptorsGpu, matches, k);
+					cv::Mat temp;
+					dists.convertTo(temp, CV_32F);
+					dists = temp;
 				}
-				else
+				if( deltaDists.type() == CV_32S )
 				{
-					gpuMatcher = cv::cuda::DescriptorMatcher::createBFMatcher(cv::NORM_L2);
-					gpuMatcher->knnMatch(newDescriptorsGpu, lastDescriptorsGpu, matches, k);
+					cv::Mat temp;
+					deltaDists.convertTo(temp, CV_32F);
+					deltaDists = temp;
 				}
-#else
-				UERROR("OpenCV3 is not built with CUDAFEATURES2D module, cannot do brute force matching on GPU!");
-#endif
-#endif
-			}
-			else
-			{
-				cv::BFMatcher matcher(indexedDescriptors_.type()==CV_8U?cv::NORM_HAMMING:cv::NORM_L2);
-				matcher.knnMatch(descriptors, indexedDescriptors_, matches, k);
-			}
 
-			//convert back to matrix style
-			results = cv::Mat((int)matches.size(), k, CV_32SC1);
-			dists = cv::Mat((int)matches.size(), k, CV_32FC1);
-			for(unsigned int i=0; i<matches.size(); ++i)
-			{
-				for(int j=0; j<k; ++j)
+				cv::Mat mergedResults(results.rows, k, CV_32SC1);
+				cv::Mat mergedDists(results.rows, k, CV_32FC1);
+				for(int i=0; i<results.rows; ++i)
 				{
-					results.at<int>(i, j) = matches[i].at(j).trainIdx;
-					dists.at<float>(i, j) = matches[i].at(j).distance;
+					int m = 0; // main index
+					int d = 0; // delta index
+					for(int j=0; j<k; ++j)
+					{
+						bool mainValid = m<k && results.at<int>(i,m) >= 0;
+						bool deltaValid = d<deltaK && deltaResults.at<int>(i,d) >= 0;
+						if(mainValid && (!deltaValid || dists.at<float>(i,m) <= deltaDists.at<float>(i,d)))
+						{
+							mergedResults.at<int>(i,j) = results.at<int>(i,m);
+							mergedDists.at<float>(i,j) = dists.at<float>(i,m);
+							++m;
+						}
+						else if(deltaValid)
+						{
+							// words of the delta follow those of the main index
+							mergedResults.at<int>(i,j) = indexedDescriptors_.rows + deltaResults.at<int>(i,d);
+							mergedDists.at<float>(i,j) = deltaDists.at<float>(i,d);
+							++d;
+						}
+						else
+						{
+							mergedResults.at<int>(i,j) = -1;
+							mergedDists.at<float>(i,j) = std::numeric_limits<float>::max();
+						}
+					}
 				}
+				results = mergedResults;
+				dists = mergedDists;
 			}
 		}
-		else
-		{
-			flannIndex_.knnSearch(descriptors, results, dists, k,
-					cv::flann::SearchParams(
-						Settings::getNearestNeighbor_search_checks(),
-						Settings::getNearestNeighbor_search_eps(),
-						Settings::getNearestNeighbor_search_sorted()));
-		}
 
 		if( dists.type() == CV_32S )
 		{
@@ -519,4 +1572,97 @@ void Vocabulary::search(const cv::Mat & descriptorsIn, cv::Mat & results, cv::Ma
 	}
 }
 
+// Neighbors of the blocks searched by searchMatches(), reused by each thread
+// from one block to the next (and from one frame to the next)
+struct SearchBuffers
+{
+	cv::Mat results;
+	cv::Mat dists;
+};
+static QThreadStorage<SearchBuffers*> searchBuffers;
+
+void Vocabulary::searchMatches(
+		const cv::Mat & descriptors,
+		const ParametersSnapshot & parameters,
+		std::vector<int> & descriptorIndexes,
+		std::vector<int> & wordIds,
+		float & minDistance,
+		float & maxDistance,
+		std::vector<float> * qualities) const
+{
+	descriptorIndexes.clear();
+	wordIds.clear();
+	if(qualities)
+	{
+		qualities->clear();
+	}
+	if(indexedRows() == 0 || descriptors.empty())
+	{
+		return;
+	}
+	descriptorIndexes.reserve(descriptors.rows);
+	wordIds.reserve(descriptors.rows);
+	int k = matchK(parameters);
+	static const int kBlock = 4096; // neighbors of a block stay in cache until filtered
+	if(!searchBuffers.hasLocalData())
+	{
+		searchBuffers.setLocalData(new SearchBuffers());
+	}
+	cv::Mat & results = searchBuffers.localData()->results;
+	cv::Mat & dists = searchBuffers.localData()->dists;
+	for(int i=0; i<descriptors.rows; i+=kBlock)
+	{
+		int end = i+kBlock<descriptors.rows?i+kBlock:descriptors.rows;
+		search(descriptors.rowRange(i, end), results, dists, k);
+		filterMatches(results, dists, parameters, descriptorIndexes, wordIds, minDistance, maxDistance, qualities, i);
+	}
+}
+
+void Vocabulary::filterMatches(
+		const cv::Mat & results,
+		const cv::Mat & dists,
+		const ParametersSnapshot & parameters,
+		std::vector<int> & descriptorIndexes,
+		std::vector<int> & wordIds,
+		float & minDistance,
+		float & maxDistance,
+		std::vector<float> * qualities,
+		int firstIndex)
+{
+	UASSERT(results.type() == CV_32SC1 && dists.type() == CV_32FC1 && results.rows == dists.rows);
+	bool ratioUsed = parameters.NearestNeighbor_3nndrRatioUsed;
+	bool minDistanceUsed = parameters.NearestNeighbor_5minDistanceUsed;
+	float ratio = parameters.NearestNeighbor_4nndrRatio;
+	float minDistanceAccepted = parameters.NearestNeighbor_6minDistance;
+	UASSERT(!ratioUsed || dists.cols >= 2);
+	for(int i=0; i<dists.rows; ++i)
+	{
+		const float * d = dists.ptr<float>(i);
+		int wordId = results.ptr<int>(i)[0];
+		if(wordId < 0 || d[0] < 0.0f)
+		{
+			continue; // no neighbor
+		}
+		if(minDistance == -1 || minDistance > d[0])
+		{
+			minDistance = d[0];
+		}
+		if(maxDistance == -1 || maxDistance < d[0])
+		{
+			maxDistance = d[0];
+		}
+		// no criterion: match to the nearest descriptor
+		if((!ratioUsed || d[0] <= ratio * d[1]) &&
+		   (!minDistanceUsed || d[0] <= minDistanceAccepted))
+		{
+			descriptorIndexes.push_back(firstIndex + i);
+			wordIds.push_back(wordId);
+			if(qualities)
+			{
+				qualities->push_back(ratioUsed?(d[1]>0.0f?d[0]/d[1]:0.0f):d[0]);
+			}
+		}
+	}
+}
+
 } // namespace find_object
@@ -28,38 +28,156 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef VOCABULARY_H_
 #define VOCABULARY_H_
 
+#include "find_object/Settings.h"
+#include "find_object/VocabularyTree.h"
+#include "ProductQuantizer.h"
+#include "ScalarQuantizer.h"
+
 #include <QtCore/QMultiMap>
 #include <QtCore/QVector>
+#include <QtCore/QSharedPointer>
 #include <opencv2/opencv.hpp>
 
 namespace find_object {
 
+class VocabularyGpuWords;
+
+// Copies are cheap: words, references and the index are shared
+// with the original and are never modified in place afterwards,
+// so a copy can be updated while the original is still searched.
 class Vocabulary {
 public:
-	Vocabulary();
+	// An object having a word, descriptorIndex is the object's descriptor
+	// of this word or -1 if the object has this word more than once.
+	// weight is the TF-IDF weight of the word in the object divided by the
+	// norm of the object's weights: the sum of the weights of the postings
+	// matched by the scene words ranks the objects like a normalized
+	// bag-of-words score.
+	struct Posting
+	{
+		int objectId;
+		int descriptorIndex;
+		float weight;
+	};
+
+public:
+	Vocabulary(const ParametersSnapshot & parameters = ParametersSnapshot());
 	virtual ~Vocabulary();
 
+	// Applied on the next addWords()/update()/search(). The vocabulary
+	// tree (General/vocabularyTreePath) is loaded here when it changes.
+	void setParameters(const ParametersSnapshot & parameters);
+	const ParametersSnapshot & parameters() const {return params_;}
+	// Words are the leaves of the vocabulary tree (inverted search only)
+	bool usesTree() const {return params_.General_invertedSearch && !tree_.isNull() && !tree_->empty();}
+	// Words are coded with product quantization (NearestNeighbor/1Strategy "PQ")
+	bool usesProductQuantization() const {return Settings::isProductQuantizationNearestNeighbor(params_) && !usesTree();}
+	// Float words are kept quantized in memory (NearestNeighbor/quantization with brute force on CPU)
+	bool usesScalarQuantization() const {return (params_.NearestNeighbor_quantization == ScalarQuantizer::kUint8 || params_.NearestNeighbor_quantization == ScalarQuantizer::kFloat16) && Settings::isBruteForceNearestNeighbor(params_) && !params_.NearestNeighbor_BruteForce_gpu && !usesTree();}
+
 	void clear();
 	QMultiMap<int, int> addWords(const cv::Mat & descriptors, int objectId);
 	void update();
-	void search(const cv::Mat & descriptors, cv::Mat & results, cv::Mat & dists, int k);
-	int size() const {return indexedDescriptors_.rows + notIndexedDescriptors_.rows;}
-	int dim() const {return !indexedDescriptors_.empty()?indexedDescriptors_.cols:notIndexedDescriptors_.cols;}
-	int type() const {return !indexedDescriptors_.empty()?indexedDescriptors_.type():notIndexedDescriptors_.type();}
+	// Postings of the words added since the last update, called by update()
+	void updatePostings();
+	// Add postings of an object loaded from a session, its references
+	// are already in wordToObjects(). Call updatePostings() after.
+	void addObjectWords(int objectId, const QMultiMap<int, int> & words);
+	void search(const cv::Mat & descriptors, cv::Mat & results, cv::Mat & dists, int k) const;
+	// Nearest word of each descriptor accepted by the NearestNeighbor/3nndrRatioUsed
+	// and NearestNeighbor/5minDistanceUsed criteria of parameters: descriptor
+	// descriptorIndexes[i] matches word wordIds[i]. The descriptors are searched
+	// by blocks filtered as soon as they are searched, the neighbors of all
+	// descriptors are not kept. minDistance and maxDistance (-1 if not set)
+	// are updated with the nearest distances of all descriptors. qualities
+	// (lower is better) are the distance ratios of the matches with the
+	// ratio test, their distances otherwise.
+	void searchMatches(const cv::Mat & descriptors, const ParametersSnapshot & parameters,
+			std::vector<int> & descriptorIndexes, std::vector<int> & wordIds,
+			float & minDistance, float & maxDistance,
+			std::vector<float> * qualities = 0) const;
+	// Same on the results of search() with matchK() neighbors, descriptor
+	// indexes start at firstIndex
+	static void filterMatches(const cv::Mat & results, const cv::Mat & dists, const ParametersSnapshot & parameters,
+			std::vector<int> & descriptorIndexes, std::vector<int> & wordIds,
+			float & minDistance, float & maxDistance,
+			std::vector<float> * qualities = 0, int firstIndex = 0);
+	static int matchK(const ParametersSnapshot & parameters) {return parameters.NearestNeighbor_3nndrRatioUsed?2:1;}
+	// Descriptors already on the GPU, returns false if the words are not
+	// resident on the GPU or not the same type (see General/gpuPipeline)
+	bool searchGpu(const GpuMat & descriptors, cv::Mat & results, cv::Mat & dists, int k) const;
+	int size() const {return indexedSize() + notIndexedDescriptors_.rows;}
+	int dim() const {return !indexedDescriptors_.empty()?indexedDescriptors_.cols:hasCodes()?pq_->dim():hasScalarCodes()?sq_->dim():notIndexedDescriptors_.cols;}
+	int type() const {return !indexedDescriptors_.empty()?indexedDescriptors_.type():hasCodes()||hasScalarCodes()?CV_32FC1:notIndexedDescriptors_.type();}
+	int indexedSize() const {return indexedRows() + deltaDescriptors_.rows;}
 	const QMultiMap<int, int> & wordToObjects() const {return wordToObjects_;}
+	// Objects having this word, without allocation
+	int postingsCount(int wordId) const {return wordId>=0 && wordId+1<(int)postingOffsets_.size()?postingOffsets_[wordId+1]-postingOffsets_[wordId]:0;}
+	const Posting * postings(int wordId) const {return postingsCount(wordId)?postings_.constData()+postingOffsets_[wordId]:0;}
+	// Empty with product quantization when the words are not kept (NearestNeighbor/PQ_rerank=0)
+	// and with scalar quantization (see usesScalarQuantization())
 	const cv::Mat & indexedDescriptors() const {return indexedDescriptors_;}
 
+	// Bytes of the words (descriptors or codes), the references <word, object>, the
+	// postings and the index. FLANN doesn't report its memory: the index is estimated
+	// from its algorithm. The words of the tree are counted in the index.
+	struct MemoryUsage
+	{
+		qint64 words;
+		qint64 wordToObjects;
+		qint64 postings;
+		qint64 index;
+	};
+	MemoryUsage memoryUsage() const;
+
 	void save(QDataStream & streamSessionPtr, bool saveVocabularyOnly = false) const;
 	void load(QDataStream & streamSessionPtr, bool loadVocabularyOnly = false);
 	bool save(const QString & filename) const;
 	bool load(const QString & filename);
 
+	// Memory-mapped session format, words are used in place from the mapped file
+	void saveMapped(QDataStream & streamSessionPtr, bool saveVocabularyOnly = false) const;
+	void loadMapped(QDataStream & streamSessionPtr, const uchar * base, bool loadVocabularyOnly = false);
+
 private:
-	cv::flann::Index flannIndex_;
+	bool hasCodes() const {return !pq_.empty() && !pq_->empty();}
+	bool hasScalarCodes() const {return !sq_.empty() && !sq_->empty();}
+	int indexedRows() const {return hasCodes()?pq_->size():hasScalarCodes()?sq_->size():indexedDescriptors_.rows;}
+	cv::Mat allIndexedDescriptors() const;
+	void updateIndex();
+	void clearPostings();
+	void updateTree();
+	bool gpuWordsUsed() const;
+	void updateGpuWords();
+	bool wordNormsUsed() const;
+	void updateWordNorms();
+	cv::Ptr<cv::flann::Index> buildIndex(const cv::Mat & descriptors) const;
+	QString indexSignature(const cv::Mat & descriptors) const;
+	QByteArray saveIndex(QString & signature) const;
+	bool loadIndex(const QString & signature, const char * data, qint64 size);
+
+private:
+	ParametersSnapshot params_;
+	QSharedPointer<const VocabularyTree> tree_; // shared by copies
+	QString treePath_;
+	cv::Ptr<cv::flann::Index> flannIndex_; // rebuilt in a new instance on update(), shared by copies
 	cv::Mat indexedDescriptors_;
+	cv::Mat deltaDescriptors_; // words indexed after indexedDescriptors_, see General/vocabularyDeltaRatio
+	cv::Ptr<cv::flann::Index> deltaIndex_;
+	QSharedPointer<const VocabularyGpuWords> gpuWords_; // words on the GPU, uploaded again on update(), shared by copies
+	cv::Mat wordNorms_; // squared norms of the indexed words for brute force with matrix products, see NearestNeighbor/BruteForce_gemm
+	cv::Ptr<ProductQuantizer> pq_; // codes of the indexed words, rebuilt in a new instance on update(), shared by copies
+	cv::Ptr<ScalarQuantizer> sq_; // same for scalar quantization
 	cv::Mat notIndexedDescriptors_;
 	QMultiMap<int, int> wordToObjects_; // <wordId, ObjectId>
 	QVector<int> notIndexedWordIds_;
+
+	// Inverted index <wordId, postings> in compressed sparse rows: postings of
+	// word i are postings_[postingOffsets_[i]] to postings_[postingOffsets_[i+1]-1]
+	QVector<int> postingOffsets_;
+	QVector<Posting> postings_;
+	QVector<int> pendingWords_; // added since the last updatePostings()
+	QVector<Posting> pendingPostings_;
 };
 
 } // namespace find_object
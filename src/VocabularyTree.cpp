@@ -0,0 +1,343 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "find_object/VocabularyTree.h"
+#include "find_object/utilite/ULogger.h"
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+#include <limits>
+
+namespace find_object {
+
+// Binary descriptors: like k-means with the Hamming distance, the center
+// of a cluster is the majority of the bits of its descriptors.
+static void kMajority(const cv::Mat & data, int k, int iterations, cv::Mat & labels, cv::Mat & centers)
+{
+	cv::RNG rng(0x12345);
+	cv::Mat seeds(data.rows, 1, CV_32SC1);
+	for(int r=0; r<data.rows; ++r)
+	{
+		seeds.at<int>(r) = r;
+	}
+	cv::randShuffle(seeds, 1.0, &rng);
+	centers = cv::Mat(k, data.cols, CV_8UC1);
+	for(int c=0; c<k; ++c)
+	{
+		data.row(seeds.at<int>(c)).copyTo(centers.row(c));
+	}
+
+	labels = cv::Mat(data.rows, 1, CV_32SC1, cv::Scalar(-1));
+	std::vector<int> counts(k*data.cols*8);
+	std::vector<int> sizes(k);
+	for(int it=0; it<iterations; ++it)
+	{
+		bool changed = false;
+		for(int r=0; r<data.rows; ++r)
+		{
+			int best = 0;
+			double bestDistance = cv::norm(data.row(r), centers.row(0), cv::NORM_HAMMING);
+			for(int c=1; c<k; ++c)
+			{
+				double d = cv::norm(data.row(r), centers.row(c), cv::NORM_HAMMING);
+				if(d < bestDistance)
+				{
+					bestDistance = d;
+					best = c;
+				}
+			}
+			if(labels.at<int>(r) != best)
+			{
+				labels.at<int>(r) = best;
+				changed = true;
+			}
+		}
+		if(!changed)
+		{
+			break;
+		}
+
+		std::fill(counts.begin(), counts.end(), 0);
+		std::fill(sizes.begin(), sizes.end(), 0);
+		for(int r=0; r<data.rows; ++r)
+		{
+			int c = labels.at<int>(r);
+			++sizes[c];
+			const unsigned char * bytes = data.ptr<unsigned char>(r);
+			int * count = &counts[c*data.cols*8];
+			for(int b=0; b<data.cols; ++b)
+			{
+				for(int bit=0; bit<8; ++bit)
+				{
+					if(bytes[b] & (1<<bit))
+					{
+						++count[b*8+bit];
+					}
+				}
+			}
+		}
+		for(int c=0; c<k; ++c)
+		{
+			if(sizes[c] == 0)
+			{
+				continue; // keep the previous center
+			}
+			const int * count = &counts[c*data.cols*8];
+			unsigned char * center = centers.ptr<unsigned char>(c);
+			for(int b=0; b<data.cols; ++b)
+			{
+				unsigned char value = 0;
+				for(int bit=0; bit<8; ++bit)
+				{
+					if(count[b*8+bit]*2 > sizes[c])
+					{
+						value |= (unsigned char)(1<<bit);
+					}
+				}
+				center[b] = value;
+			}
+		}
+	}
+}
+
+VocabularyTree::VocabularyTree() :
+	branching_(0),
+	depth_(0)
+{
+}
+
+bool VocabularyTree::train(const cv::Mat & descriptors, int branching, int depth, int iterations)
+{
+	*this = VocabularyTree();
+	if(descriptors.empty() || branching < 2 || depth < 1)
+	{
+		UERROR("Cannot train a vocabulary tree with %d descriptors, branching=%d and depth=%d (branching should be >= 2 and depth >= 1)",
+				descriptors.rows, branching, depth);
+		return false;
+	}
+	if(descriptors.type() != CV_32FC1 && descriptors.type() != CV_8UC1)
+	{
+		UERROR("Descriptors should be float (CV_32F) or binary (CV_8U), type=%d", descriptors.type());
+		return false;
+	}
+
+	branching_ = branching;
+	depth_ = depth;
+	nodesCenters_ = cv::Mat::zeros(1, descriptors.cols, descriptors.type()); // root
+	childrenBegin_.push_back(0);
+	childrenCount_.push_back(0);
+	build(0, descriptors.isContinuous()?descriptors:descriptors.clone(), 0, iterations);
+	UINFO("Vocabulary tree trained: %d words, %d nodes (%d descriptors, branching=%d, depth=%d)",
+			words_.rows, nodesCenters_.rows, descriptors.rows, branching_, depth_);
+	return true;
+}
+
+void VocabularyTree::build(int node, const cv::Mat & descriptors, int level, int iterations)
+{
+	int k = branching_ < descriptors.rows?branching_:descriptors.rows;
+	cv::Mat labels;
+	cv::Mat centers;
+	if(k == descriptors.rows)
+	{
+		centers = descriptors.clone();
+		labels = cv::Mat(descriptors.rows, 1, CV_32SC1);
+		for(int r=0; r<descriptors.rows; ++r)
+		{
+			labels.at<int>(r) = r;
+		}
+	}
+	else if(descriptors.type() == CV_8UC1)
+	{
+		kMajority(descriptors, k, iterations, labels, centers);
+	}
+	else
+	{
+		cv::kmeans(descriptors, k, labels,
+				cv::TermCriteria(cv::TermCriteria::COUNT+cv::TermCriteria::EPS, iterations, 0.01),
+				1, cv::KMEANS_PP_CENTERS, centers);
+	}
+
+	std::vector<std::vector<int> > clusters(k);
+	for(int r=0; r<descriptors.rows; ++r)
+	{
+		clusters[labels.at<int>(r)].push_back(r);
+	}
+
+	int begin = (int)children_.size();
+	childrenBegin_[node] = begin;
+	childrenCount_[node] = k;
+	children_.resize(begin + k);
+	for(int c=0; c<k; ++c)
+	{
+		if(level+1 >= depth_ || (int)clusters[c].size() <= branching_)
+		{
+			words_.push_back(centers.row(c));
+			children_[begin+c] = -words_.rows;
+		}
+		else
+		{
+			cv::Mat cluster((int)clusters[c].size(), descriptors.cols, descriptors.type());
+			for(unsigned int r=0; r<clusters[c].size(); ++r)
+			{
+				descriptors.row(clusters[c][r]).copyTo(cluster.row(r));
+			}
+			int child = nodesCenters_.rows;
+			nodesCenters_.push_back(centers.row(c));
+			childrenBegin_.push_back(0);
+			childrenCount_.push_back(0);
+			children_[begin+c] = child;
+			build(child, cluster, level+1, iterations);
+		}
+	}
+}
+
+bool VocabularyTree::save(const QString & path) const
+{
+	cv::FileStorage fs(path.toStdString(), cv::FileStorage::WRITE);
+	if(!fs.isOpened())
+	{
+		UERROR("Failed to open vocabulary tree file \"%s\"", path.toStdString().c_str());
+		return false;
+	}
+	fs << "branching" << branching_;
+	fs << "depth" << depth_;
+	fs << "nodesCenters" << nodesCenters_;
+	fs << "words" << words_;
+	fs << "childrenBegin" << childrenBegin_;
+	fs << "childrenCount" << childrenCount_;
+	fs << "children" << children_;
+	return true;
+}
+
+bool VocabularyTree::load(const QString & path)
+{
+	*this = VocabularyTree();
+	cv::FileStorage fs(path.toStdString(), cv::FileStorage::READ);
+	if(!fs.isOpened())
+	{
+		UERROR("Failed to open vocabulary tree file \"%s\"", path.toStdString().c_str());
+		return false;
+	}
+	fs["branching"] >> branching_;
+	fs["depth"] >> depth_;
+	fs["nodesCenters"] >> nodesCenters_;
+	fs["words"] >> words_;
+	fs["childrenBegin"] >> childrenBegin_;
+	fs["childrenCount"] >> childrenCount_;
+	fs["children"] >> children_;
+
+	if(words_.empty() ||
+	   nodesCenters_.rows != (int)childrenBegin_.size() ||
+	   childrenBegin_.size() != childrenCount_.size() ||
+	   nodesCenters_.type() != words_.type() ||
+	   nodesCenters_.cols != words_.cols)
+	{
+		UERROR("Vocabulary tree file \"%s\" is not valid", path.toStdString().c_str());
+		*this = VocabularyTree();
+		return false;
+	}
+	for(unsigned int i=0; i<children_.size(); ++i)
+	{
+		if(children_[i] >= nodesCenters_.rows || -children_[i]-1 >= words_.rows)
+		{
+			UERROR("Vocabulary tree file \"%s\" is not valid", path.toStdString().c_str());
+			*this = VocabularyTree();
+			return false;
+		}
+	}
+	UINFO("Vocabulary tree loaded: %d words, %d nodes (branching=%d, depth=%d)", words_.rows, nodesCenters_.rows, branching_, depth_);
+	return true;
+}
+
+float VocabularyTree::distance(const cv::Mat & a, const cv::Mat & b) const
+{
+	return (float)cv::norm(a, b, words_.type()==CV_8UC1?cv::NORM_HAMMING:cv::NORM_L2SQR);
+}
+
+int VocabularyTree::quantize(const cv::Mat & descriptor, float & distance, float & secondDistance) const
+{
+	distance = -1.0f;
+	secondDistance = -1.0f;
+	if(words_.empty())
+	{
+		return -1;
+	}
+	UASSERT(descriptor.type() == words_.type() && descriptor.cols == words_.cols);
+
+	int node = 0;
+	while(1)
+	{
+		int best = -1;
+		float bestDistance = 0.0f;
+		float bestSecondDistance = std::numeric_limits<float>::max();
+		for(int j=childrenBegin_[node]; j<childrenBegin_[node]+childrenCount_[node]; ++j)
+		{
+			int child = children_[j];
+			float d = this->distance(descriptor, child>=0?nodesCenters_.row(child):words_.row(-child-1));
+			if(best == -1 || d < bestDistance)
+			{
+				if(best != -1)
+				{
+					bestSecondDistance = bestDistance;
+				}
+				bestDistance = d;
+				best = j;
+			}
+			else if(d < bestSecondDistance)
+			{
+				bestSecondDistance = d;
+			}
+		}
+		UASSERT(best >= 0);
+		if(children_[best] < 0)
+		{
+			distance = bestDistance;
+			secondDistance = bestSecondDistance;
+			return -children_[best]-1;
+		}
+		node = children_[best];
+	}
+	return -1;
+}
+
+void VocabularyTree::quantize(const cv::Mat & descriptors, cv::Mat & results, cv::Mat & dists, int k) const
+{
+	UASSERT(k >= 1);
+	results = cv::Mat(descriptors.rows, k, CV_32SC1, cv::Scalar(-1));
+	dists = cv::Mat(descriptors.rows, k, CV_32FC1, cv::Scalar(std::numeric_limits<float>::max()));
+	for(int i=0; i<descriptors.rows; ++i)
+	{
+		float distance, secondDistance;
+		results.at<int>(i,0) = quantize(descriptors.row(i), distance, secondDistance);
+		dists.at<float>(i,0) = distance;
+		if(k > 1)
+		{
+			dists.at<float>(i,1) = secondDistance;
+		}
+	}
+}
+
+} // namespace find_object
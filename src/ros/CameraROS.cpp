@@ -35,11 +35,33 @@ using namespace find_object;
 
 CameraROS::CameraROS(bool subscribeDepth, QObject * parent) :
 	Camera(parent),
-	subscribeDepth_(subscribeDepth)
+	subscribeDepth_(subscribeDepth),
+	shareImages_(false),
+	sync_(0)
 {
 	ros::NodeHandle nh; // public
 	ros::NodeHandle pnh("~"); // private
+	setup(nh, pnh);
+}
+
+CameraROS::CameraROS(
+		bool subscribeDepth,
+		const ros::NodeHandle & nh,
+		const ros::NodeHandle & pnh,
+		bool shareImages,
+		QObject * parent) :
+	Camera(parent),
+	subscribeDepth_(subscribeDepth),
+	shareImages_(shareImages),
+	sync_(0)
+{
+	ros::NodeHandle publicNh = nh;
+	ros::NodeHandle privateNh = pnh;
+	setup(publicNh, privateNh);
+}
 
+void CameraROS::setup(ros::NodeHandle & nh, ros::NodeHandle & pnh)
+{
 	qRegisterMetaType<ros::Time>("ros::Time");
 	qRegisterMetaType<cv::Mat>("cv::Mat");
 
@@ -111,7 +133,8 @@ void CameraROS::imgReceivedCallback(const sensor_msgs::ImageConstPtr & msg)
 		cv_bridge::CvImageConstPtr ptr = cv_bridge::toCvShare(msg);
 		if(msg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0)
 		{
-			cv::Mat cpy = ptr->image.clone();
+			// the shared image is valid only while the message is
+			cv::Mat cpy = shareImages_?ptr->image:ptr->image.clone();
 			Q_EMIT rosDataReceived(msg->header.frame_id, msg->header.stamp, cv::Mat(), 0.0f);
 			Q_EMIT imageReceived(cpy);
 		}
@@ -136,8 +159,8 @@ void CameraROS::imgDepthReceivedCallback(
 {
 	if(!(rgbMsg->encoding.compare(sensor_msgs::image_encodings::MONO8) ==0 ||
 		 rgbMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0 ||
-		 rgbMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0) &&
-		(depthMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1)!=0 ||
+		 rgbMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0) ||
+		(depthMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_16UC1)!=0 &&
 		 depthMsg->encoding.compare(sensor_msgs::image_encodings::TYPE_32FC1)!=0))
 	{
 			ROS_ERROR("find_object_ros: Input type must be rgb=mono8,rgb8,bgr8 and depth=32FC1,16UC1");
@@ -148,18 +171,20 @@ void CameraROS::imgDepthReceivedCallback(
 	{
 		cv_bridge::CvImageConstPtr ptr = cv_bridge::toCvShare(rgbMsg);
 		cv_bridge::CvImageConstPtr ptrDepth = cv_bridge::toCvShare(depthMsg);
+		// the depth is kept until the next frame, shared only when the detection is done in this callback
+		cv::Mat depth = shareImages_?ptrDepth->image:ptrDepth->image.clone();
 		float depthConstant = 1.0f/cameraInfoMsg->K[4];
 		if(rgbMsg->encoding.compare(sensor_msgs::image_encodings::BGR8) == 0)
 		{
-			cv::Mat cpy = ptr->image.clone();
-			Q_EMIT rosDataReceived(rgbMsg->header.frame_id, rgbMsg->header.stamp, ptrDepth->image, depthConstant);
+			cv::Mat cpy = shareImages_?ptr->image:ptr->image.clone();
+			Q_EMIT rosDataReceived(rgbMsg->header.frame_id, rgbMsg->header.stamp, depth, depthConstant);
 			Q_EMIT imageReceived(cpy);
 		}
 		else if(rgbMsg->encoding.compare(sensor_msgs::image_encodings::RGB8) == 0)
 		{
 			cv::Mat bgr;
 			cv::cvtColor(ptr->image, bgr, cv::COLOR_RGB2BGR);
-			Q_EMIT rosDataReceived(rgbMsg->header.frame_id, rgbMsg->header.stamp, ptrDepth->image, depthConstant);
+			Q_EMIT rosDataReceived(rgbMsg->header.frame_id, rgbMsg->header.stamp, depth, depthConstant);
 			Q_EMIT imageReceived(bgr);
 		}
 	}
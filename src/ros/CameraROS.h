@@ -49,6 +49,14 @@ class CameraROS : public find_object::Camera {
 	Q_OBJECT
 public:
 	CameraROS(bool subscribeDepth, QObject * parent = 0);
+	// With shareImages, the emitted images point in the received messages
+	// (no copy): they are valid only until the signal returns, so the
+	// receivers should be connected with Qt::DirectConnection (nodelet).
+	CameraROS(bool subscribeDepth,
+			const ros::NodeHandle & nh,
+			const ros::NodeHandle & pnh,
+			bool shareImages,
+			QObject * parent = 0);
 	virtual ~CameraROS() {}
 
 	virtual bool start();
@@ -66,6 +74,7 @@ private Q_SLOTS:
 	virtual void takeImage();
 
 private:
+	void setup(ros::NodeHandle & nh, ros::NodeHandle & pnh);
 	void imgReceivedCallback(const sensor_msgs::ImageConstPtr & msg);
 	void imgDepthReceivedCallback(
 			const sensor_msgs::ImageConstPtr& rgbMsg,
@@ -74,6 +83,7 @@ private:
 
 private:
 	bool subscribeDepth_;
+	bool shareImages_;
 	image_transport::Subscriber imageSub_;
 
 	image_transport::SubscriberFilter rgbSub_;
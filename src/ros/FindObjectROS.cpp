@@ -31,23 +31,42 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "find_object_2d/ObjectsStamped.h"
 
 #include <cmath>
+#include <algorithm>
 
 using namespace find_object;
 
 FindObjectROS::FindObjectROS(QObject * parent) :
 	FindObject(true, parent),
+	depthConstant_(0.0f),
 	objFramePrefix_("object")
 {
-	ros::NodeHandle pnh("~"); // public
+	ros::NodeHandle pnh("~"); // private
+	ros::NodeHandle nh; // public
+	setup(nh, pnh, Qt::AutoConnection);
+}
+
+FindObjectROS::FindObjectROS(const ros::NodeHandle & nh, const ros::NodeHandle & pnh, QObject * parent) :
+	FindObject(true, parent),
+	depthConstant_(0.0f),
+	objFramePrefix_("object")
+{
+	ros::NodeHandle publicNh = nh;
+	ros::NodeHandle privateNh = pnh;
+	// no Qt event loop in a nodelet
+	setup(publicNh, privateNh, Qt::DirectConnection);
+}
+
+void FindObjectROS::setup(ros::NodeHandle & nh, ros::NodeHandle & pnh, Qt::ConnectionType publishConnection)
+{
 	pnh.param("object_prefix", objFramePrefix_, objFramePrefix_);
 	ROS_INFO("object_prefix = %s", objFramePrefix_.c_str());
 
-	ros::NodeHandle nh; // public
-
 	pub_ = nh.advertise<std_msgs::Float32MultiArray>("objects", 1);
 	pubStamped_ = nh.advertise<find_object_2d::ObjectsStamped>("objectsStamped", 1);
 
-	this->connect(this, SIGNAL(objectsFound(find_object::DetectionInfo)), this, SLOT(publish(find_object::DetectionInfo)));
+	// only the inliers and their scene keypoints are used by publish()
+	setObjectsFoundFields(find_object::DetectionInfo::kSceneKeypoints | find_object::DetectionInfo::kDetectedMatches);
+	this->connect(this, SIGNAL(objectsFound(find_object::DetectionInfo)), this, SLOT(publish(find_object::DetectionInfo)), publishConnection);
 }
 
 void FindObjectROS::publish(const find_object::DetectionInfo & info)
@@ -58,6 +77,16 @@ void FindObjectROS::publish(const find_object::DetectionInfo & info)
 		std::vector<tf::StampedTransform> transforms;
 		char multiSubId = 'b';
 		int previousId = -1;
+		float cx = float(depth_.cols/2)-0.5f;
+		float cy = float(depth_.rows/2)-0.5f;
+		float f = 1.0f/depthConstant_;
+		// Inlier groups of the detected objects, in the same order as objDetected_
+		QMultiMap<int, int> inlierGroups;
+		for(int g=0; g<info.objDetectedInliers_.groups(); ++g)
+		{
+			inlierGroups.insert(info.objDetectedInliers_.id(g), g);
+		}
+		QMultiMap<int, int>::const_iterator iterInliers = inlierGroups.constBegin();
 		QMultiMap<int, QSize>::const_iterator iterSizes=info.objDetectedSizes_.constBegin();
 		for(QMultiMap<int, QTransform>::const_iterator iter=info.objDetected_.constBegin();
 			iter!=info.objDetected_.constEnd();
@@ -84,20 +113,31 @@ void FindObjectROS::publish(const find_object::DetectionInfo & info)
 			QPointF xAxis = iter->map(QPointF(3*objectWidth/4, objectHeight/2));
 			QPointF yAxis = iter->map(QPointF(objectWidth/2, 3*objectHeight/4));
 
-			cv::Vec3f center3D = this->getDepth(depth_,
-					center.x()+0.5f, center.y()+0.5f,
-					float(depth_.cols/2)-0.5f, float(depth_.rows/2)-0.5f,
-					1.0f/depthConstant_, 1.0f/depthConstant_);
-
-			cv::Vec3f axisEndX = this->getDepth(depth_,
-					xAxis.x()+0.5f, xAxis.y()+0.5f,
-					float(depth_.cols/2)-0.5f, float(depth_.rows/2)-0.5f,
-					1.0f/depthConstant_, 1.0f/depthConstant_);
+			std::vector<cv::Point2f> points;
+			if(iterInliers != inlierGroups.constEnd())
+			{
+				int g = iterInliers.value();
+				int end = info.objDetectedInliers_.groupBegin(g+1);
+				points.reserve(info.objDetectedInliers_.groupSize(g));
+				for(int j=info.objDetectedInliers_.groupBegin(g); j<end; ++j)
+				{
+					int sceneIndex = info.objDetectedInliers_.sceneIndex(j);
+					if(sceneIndex >=0 && sceneIndex < (int)info.sceneKeypoints_.size())
+					{
+						points.push_back(info.sceneKeypoints_[sceneIndex].pt);
+					}
+				}
+				++iterInliers;
+			}
 
-			cv::Vec3f axisEndY = this->getDepth(depth_,
-					yAxis.x()+0.5f, yAxis.y()+0.5f,
-					float(depth_.cols/2)-0.5f, float(depth_.rows/2)-0.5f,
-					1.0f/depthConstant_, 1.0f/depthConstant_);
+			cv::Vec3f center3D, axisEndX, axisEndY;
+			if(!this->getPlaneDepth(depth_, points, center, xAxis, yAxis, cx, cy, f, f, center3D, axisEndX, axisEndY))
+			{
+				// not enough valid depth on the inliers, sample the axes directly
+				center3D = this->getDepth(depth_, center.x()+0.5f, center.y()+0.5f, cx, cy, f, f);
+				axisEndX = this->getDepth(depth_, xAxis.x()+0.5f, xAxis.y()+0.5f, cx, cy, f, f);
+				axisEndY = this->getDepth(depth_, yAxis.x()+0.5f, yAxis.y()+0.5f, cx, cy, f, f);
+			}
 
 			if(std::isfinite(center3D.val[0]) && std::isfinite(center3D.val[1]) && std::isfinite(center3D.val[2]) &&
 				std::isfinite(axisEndX.val[0]) && std::isfinite(axisEndX.val[1]) && std::isfinite(axisEndX.val[2]) &&
@@ -194,6 +234,107 @@ void FindObjectROS::setDepthData(const std::string & frameId,
 	depthConstant_ = depthConstant;
 }
 
+// The object is assumed planar: a plane is fitted on the 3D points of the
+// inliers having a depth close to their median depth (the background seen
+// through or around the object is rejected), then the center and the axis
+// ends are the intersections of their rays with this plane. With less than
+// three inliers left, the plane faces the camera at the median depth.
+bool FindObjectROS::getPlaneDepth(const cv::Mat & depthImage,
+		const std::vector<cv::Point2f> & points,
+		const QPointF & center, const QPointF & xAxis, const QPointF & yAxis,
+		float cx, float cy,
+		float fx, float fy,
+		cv::Vec3f & center3D, cv::Vec3f & axisEndX, cv::Vec3f & axisEndY)
+{
+	bool isInMM = depthImage.type() == CV_16UC1;
+	float unitScaling = isInMM?0.001f:1.0f;
+
+	std::vector<cv::Vec3f> xyz;
+	std::vector<float> depths;
+	xyz.reserve(points.size());
+	depths.reserve(points.size());
+	for(unsigned int i=0; i<points.size(); ++i)
+	{
+		int x = int(points[i].x+0.5f);
+		int y = int(points[i].y+0.5f);
+		if(x >=0 && x<depthImage.cols && y >=0 && y<depthImage.rows)
+		{
+			float depth = isInMM?float(depthImage.at<unsigned short>(y,x))*unitScaling:depthImage.at<float>(y,x);
+			if(depth > 0.0f && std::isfinite(depth))
+			{
+				xyz.push_back(cv::Vec3f((float(x) - cx) * depth / fx, (float(y) - cy) * depth / fy, depth));
+				depths.push_back(depth);
+			}
+		}
+	}
+	if(depths.empty())
+	{
+		return false;
+	}
+
+	std::vector<float> sorted = depths;
+	std::nth_element(sorted.begin(), sorted.begin()+sorted.size()/2, sorted.end());
+	float median = sorted[sorted.size()/2];
+	for(unsigned int i=0; i<sorted.size(); ++i)
+	{
+		sorted[i] = std::fabs(depths[i] - median);
+	}
+	std::nth_element(sorted.begin(), sorted.begin()+sorted.size()/2, sorted.end());
+	// 3 sigmas (1.4826*MAD), at least 1 cm for flat objects
+	float maxDeviation = std::max(3.0f*1.4826f*sorted[sorted.size()/2], 0.01f);
+
+	cv::Vec3f centroid(0,0,0);
+	int count = 0;
+	for(unsigned int i=0; i<xyz.size(); ++i)
+	{
+		if(std::fabs(depths[i] - median) <= maxDeviation)
+		{
+			xyz[count++] = xyz[i];
+			centroid += xyz[i];
+		}
+	}
+	xyz.resize(count);
+	centroid *= 1.0f/float(count);
+
+	cv::Vec3f normal(0, 0, -1);
+	if(count >= 3)
+	{
+		cv::Matx33f covariance = cv::Matx33f::zeros();
+		for(int i=0; i<count; ++i)
+		{
+			cv::Matx31f d = xyz[i] - centroid;
+			covariance += d * d.t();
+		}
+		cv::Mat eigenValues, eigenVectors;
+		cv::eigen(cv::Mat(covariance), eigenValues, eigenVectors);
+		// smallest eigen value, the second is 0 if the points are on a line
+		if(eigenValues.at<float>(1) > 0.0f)
+		{
+			normal = cv::Vec3f(eigenVectors.at<float>(2,0), eigenVectors.at<float>(2,1), eigenVectors.at<float>(2,2));
+		}
+	}
+	else
+	{
+		centroid = cv::Vec3f(0, 0, median);
+	}
+
+	// intersections of the rays with the plane
+	QPointF pixels[3] = {center, xAxis, yAxis};
+	cv::Vec3f * results[3] = {&center3D, &axisEndX, &axisEndY};
+	float planeDistance = normal.dot(centroid);
+	for(int i=0; i<3; ++i)
+	{
+		cv::Vec3f ray((float(pixels[i].x()) - cx) / fx, (float(pixels[i].y()) - cy) / fy, 1.0f);
+		float d = normal.dot(ray);
+		if(std::fabs(d) < 1e-6f || planeDistance / d <= 0.0f)
+		{
+			return false;
+		}
+		*results[i] = ray * (planeDistance / d);
+	}
+	return true;
+}
+
 cv::Vec3f FindObjectROS::getDepth(const cv::Mat & depthImage,
 				   int x, int y,
 				   float cx, float cy,
@@ -45,6 +45,8 @@ class FindObjectROS : public find_object::FindObject
 
 public:
 	FindObjectROS(QObject * parent = 0);
+	// Results are published from the thread calling detect() (nodelet)
+	FindObjectROS(const ros::NodeHandle & nh, const ros::NodeHandle & pnh, QObject * parent = 0);
 	virtual ~FindObjectROS() {}
 
 public Q_SLOTS:
@@ -56,7 +58,14 @@ public Q_SLOTS:
 			float depthConstant);
 
 private:
-	cv::Vec3f getDepth(const cv::Mat & depthImage,
+	void setup(ros::NodeHandle & nh, ros::NodeHandle & pnh, Qt::ConnectionType publishConnection);
+	bool getPlaneDepth(const cv::Mat & depthImage,
+			const std::vector<cv::Point2f> & points,
+			const QPointF & center, const QPointF & xAxis, const QPointF & yAxis,
+			float cx, float cy,
+			float fx, float fy,
+			cv::Vec3f & center3D, cv::Vec3f & axisEndX, cv::Vec3f & axisEndY);
+		cv::Vec3f getDepth(const cv::Mat & depthImage,
 					   int x, int y,
 					   float cx, float cy,
 					   float fx, float fy);
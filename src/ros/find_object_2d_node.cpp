@@ -122,6 +122,15 @@ int main(int argc, char** argv)
 		{
 			ROS_ERROR("Failed to load session \"%s\"", sessionPath.c_str());
 		}
+		else
+		{
+			// the camera and the GUI use the parameters of the session
+			const ParametersMap sessionParameters = findObjectROS->parameters();
+			for(ParametersMap::const_iterator iter=sessionParameters.begin(); iter!=sessionParameters.end(); ++iter)
+			{
+				Settings::setParameter(iter.key(), iter.value());
+			}
+		}
 	}
 	else if(!objectsPath.empty())
 	{
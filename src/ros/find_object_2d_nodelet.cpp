@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "CameraROS.h"
+#include "FindObjectROS.h"
+#include "find_object/Settings.h"
+
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <QDir>
+
+using namespace find_object;
+
+namespace find_object_2d {
+
+// find_object_2d without GUI, loaded in a nodelet manager with the camera
+// driver: images are received by shared pointer (no serialization) and are
+// detected in place in the callback (no copy for bgr8 images). As there is
+// no Qt event loop, all connections are direct. The settings are global to
+// the process, nodelets loaded in the same manager share them.
+class FindObject2DNodelet : public nodelet::Nodelet
+{
+public:
+	FindObject2DNodelet() :
+		findObjectROS_(0),
+		camera_(0)
+	{}
+
+	virtual ~FindObject2DNodelet()
+	{
+		delete camera_;
+		delete findObjectROS_;
+	}
+
+private:
+	virtual void onInit()
+	{
+		ros::NodeHandle & nh = getNodeHandle();
+		ros::NodeHandle & pnh = getPrivateNodeHandle();
+
+		std::string objectsPath;
+		std::string sessionPath;
+		std::string settingsPath = QDir::homePath().append("/.ros/find_object_2d.ini").toStdString();
+		bool subscribeDepth = false;
+
+		pnh.param("objects_path", objectsPath, objectsPath);
+		pnh.param("session_path", sessionPath, sessionPath);
+		pnh.param("settings_path", settingsPath, settingsPath);
+		pnh.param("subscribe_depth", subscribeDepth, subscribeDepth);
+
+		NODELET_INFO("objects_path=%s", objectsPath.c_str());
+		NODELET_INFO("session_path=%s", sessionPath.c_str());
+		NODELET_INFO("settings_path=%s", settingsPath.c_str());
+		NODELET_INFO("subscribe_depth = %s", subscribeDepth?"true":"false");
+
+		if(settingsPath.empty())
+		{
+			settingsPath = QDir::homePath().append("/.ros/find_object_2d.ini").toStdString();
+		}
+		else
+		{
+			QString path = settingsPath.c_str();
+			if(path.contains('~'))
+			{
+				path.replace('~', QDir::homePath());
+				settingsPath = path.toStdString();
+			}
+		}
+
+		// Load settings, should be loaded before creating other objects
+		Settings::init(settingsPath.c_str());
+
+		findObjectROS_ = new FindObjectROS(nh, pnh);
+		if(!sessionPath.empty())
+		{
+			if(!findObjectROS_->loadSession(sessionPath.c_str()))
+			{
+				NODELET_ERROR("Failed to load session \"%s\"", sessionPath.c_str());
+			}
+		}
+		else if(!objectsPath.empty())
+		{
+			QString path = objectsPath.c_str();
+			if(path.contains('~'))
+			{
+				path.replace('~', QDir::homePath());
+			}
+			if(!findObjectROS_->loadObjects(path))
+			{
+				NODELET_ERROR("No objects loaded from path \"%s\"", path.toStdString().c_str());
+			}
+		}
+
+		// The callbacks are called by the manager, the camera is not started
+		camera_ = new CameraROS(subscribeDepth, nh, pnh, true);
+		QObject::connect(
+				camera_,
+				SIGNAL(rosDataReceived(const std::string &, const ros::Time &, const cv::Mat &, float)),
+				findObjectROS_,
+				SLOT(setDepthData(const std::string &, const ros::Time &, const cv::Mat &, float)),
+				Qt::DirectConnection);
+		QObject::connect(
+				camera_,
+				SIGNAL(imageReceived(const cv::Mat &)),
+				findObjectROS_,
+				SLOT(detect(const cv::Mat &)),
+				Qt::DirectConnection);
+
+		QStringList topics = camera_->subscribedTopics();
+		for(int i=0; i<topics.size(); ++i)
+		{
+			NODELET_INFO("Subscribed to %s", topics.at(i).toStdString().c_str());
+		}
+	}
+
+private:
+	FindObjectROS * findObjectROS_;
+	CameraROS * camera_;
+};
+
+} // namespace find_object_2d
+
+PLUGINLIB_EXPORT_CLASS(find_object_2d::FindObject2DNodelet, nodelet::Nodelet);
@@ -26,6 +26,13 @@
 #include <string>
 #include <string.h>
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadStorage>
+#include <QtCore/QWaitCondition>
+
 #ifndef WIN32
 #include <sys/time.h>
 #endif
@@ -52,6 +59,7 @@ bool ULogger::printWhere_ = true;
 bool ULogger::printWhereFullPath_ = false;
 bool ULogger::limitWhereLength_ = false;
 bool ULogger::buffered_ = false;
+bool ULogger::async_ = false;
 bool ULogger::exitingState_ = false;
 ULogger::Level ULogger::level_ = kWarning;
 ULogger::Level ULogger::exitLevel_ = kFatal;
@@ -172,6 +180,238 @@ private:
     std::string bufferedMsgs_;
 };
 
+/**
+ * Messages of a thread waiting to be written in async mode: single producer
+ * (the thread logging) and single consumer (ULogWriter) ring of records,
+ * a 32 bits size followed by the text. Positions are byte counters, their
+ * wrap around is fine as the capacity is a power of 2.
+ */
+class ULogRing
+{
+public:
+	ULogRing(int capacity) :
+		buffer_(capacity),
+		mask_(capacity-1),
+		head_(0),
+		tail_(0),
+		orphaned_(0),
+		dropped_(0)
+	{}
+
+	// Producer, false if the ring is full
+	bool push(const std::string & text)
+	{
+		unsigned int size = (unsigned int)text.size();
+		if(size > buffer_.size()/2)
+		{
+			size = (unsigned int)buffer_.size()/2; // truncated
+		}
+		unsigned int head = (unsigned int)head_.fetchAndAddRelaxed(0);
+		unsigned int tail = (unsigned int)tail_.fetchAndAddAcquire(0);
+		if(sizeof(size) + size > buffer_.size() - (head - tail))
+		{
+			dropped_.fetchAndAddRelaxed(1);
+			return false;
+		}
+		copyIn(head, (const char *)&size, sizeof(size));
+		copyIn(head+sizeof(size), text.data(), size);
+		head_.fetchAndStoreRelease(int(head + sizeof(size) + size));
+		return true;
+	}
+
+	// Consumer, appends the messages waiting to msgs
+	void pop(std::string & msgs)
+	{
+		unsigned int tail = (unsigned int)tail_.fetchAndAddRelaxed(0);
+		unsigned int head = (unsigned int)head_.fetchAndAddAcquire(0);
+		while(tail != head)
+		{
+			unsigned int size;
+			copyOut(tail, (char *)&size, sizeof(size));
+			tail += sizeof(size);
+			unsigned int i = tail & mask_;
+			unsigned int first = size < buffer_.size() - i ? size : (unsigned int)buffer_.size() - i;
+			msgs.append(&buffer_[i], first);
+			msgs.append(&buffer_[0], size - first);
+			tail += size;
+		}
+		tail_.fetchAndStoreRelease(int(tail));
+	}
+
+	bool empty() const {return head_.fetchAndAddAcquire(0) == tail_.fetchAndAddAcquire(0);}
+	int takeDropped() {return dropped_.fetchAndStoreRelaxed(0);}
+	// Set when the thread logging is finished, the ring is then deleted by ULogWriter
+	void setOrphaned() {orphaned_.fetchAndStoreRelease(1);}
+	bool isOrphaned() const {return orphaned_.fetchAndAddAcquire(0) != 0;}
+
+private:
+	void copyIn(unsigned int position, const char * data, unsigned int size)
+	{
+		unsigned int i = position & mask_;
+		unsigned int first = size < buffer_.size() - i ? size : (unsigned int)buffer_.size() - i;
+		memcpy(&buffer_[i], data, first);
+		memcpy(&buffer_[0], data + first, size - first);
+	}
+	void copyOut(unsigned int position, char * data, unsigned int size) const
+	{
+		unsigned int i = position & mask_;
+		unsigned int first = size < buffer_.size() - i ? size : (unsigned int)buffer_.size() - i;
+		memcpy(data, &buffer_[i], first);
+		memcpy(data + first, &buffer_[0], size - first);
+	}
+
+private:
+	std::vector<char> buffer_;
+	unsigned int mask_;
+	mutable QAtomicInt head_; // bytes written
+	mutable QAtomicInt tail_; // bytes read
+	mutable QAtomicInt orphaned_;
+	QAtomicInt dropped_;
+};
+
+// Deleted with its thread, the ring is kept until ULogWriter drained it
+class ULogRingHolder
+{
+public:
+	ULogRingHolder(ULogRing * ring) : ring_(ring) {}
+	~ULogRingHolder() {ring_->setOrphaned();}
+	ULogRing * ring() const {return ring_;}
+private:
+	ULogRing * ring_;
+};
+
+/**
+ * Background thread of the async mode (see ULogger::setAsync()), never
+ * deleted: the rings of the threads logging stay valid while it is stopped.
+ */
+class ULogWriter : public QThread
+{
+public:
+	static ULogWriter * instance()
+	{
+		static ULogWriter writer;
+		return &writer;
+	}
+
+	void setRingSize(int size)
+	{
+		int capacity = 1024;
+		while(capacity < size)
+		{
+			capacity *= 2;
+		}
+		ringSize_ = capacity; // for the threads logging for the first time
+	}
+
+	// Called by the threads logging, thread-safe without lock after the
+	// first message of the thread
+	bool push(const std::string & text)
+	{
+		ULogRingHolder * holder = localRing_.localData();
+		if(!holder)
+		{
+			holder = new ULogRingHolder(new ULogRing(ringSize_));
+			QMutexLocker locker(&ringsMutex_);
+			rings_.push_back(holder->ring());
+			localRing_.setLocalData(holder);
+		}
+		return holder->ring()->push(text);
+	}
+
+	// Write the messages waiting, called by the writer thread and ULogger::flush()
+	void drain()
+	{
+		QMutexLocker drainLocker(&drainMutex_);
+		std::string msgs;
+		int dropped = 0;
+		{
+			QMutexLocker locker(&ringsMutex_);
+			for(int i=0; i<rings_.size();)
+			{
+				bool orphaned = rings_[i]->isOrphaned(); // before the last messages are read
+				rings_[i]->pop(msgs);
+				dropped += rings_[i]->takeDropped();
+				if(orphaned)
+				{
+					delete rings_[i];
+					rings_.removeAt(i);
+				}
+				else
+				{
+					++i;
+				}
+			}
+		}
+		if(dropped)
+		{
+			msgs.append(uFormat("[ WARN] %d log messages dropped (async log buffers full)\r\n", dropped));
+		}
+		if(!msgs.empty())
+		{
+			ULogger::writeDrained(msgs);
+		}
+	}
+
+	void startWriting()
+	{
+		QMutexLocker locker(&waitMutex_);
+		stopping_ = false;
+		if(!this->isRunning())
+		{
+			this->start();
+		}
+	}
+
+	void stopWriting()
+	{
+		if(this->isRunning())
+		{
+			waitMutex_.lock();
+			stopping_ = true;
+			wakeUp_.wakeAll();
+			waitMutex_.unlock();
+			this->wait();
+		}
+		drain();
+	}
+
+protected:
+	virtual void run()
+	{
+		while(true)
+		{
+			drain();
+			QMutexLocker locker(&waitMutex_);
+			if(stopping_)
+			{
+				break;
+			}
+			// the threads logging don't notify, they would need a lock
+			wakeUp_.wait(&waitMutex_, 20);
+		}
+	}
+
+private:
+	ULogWriter() :
+		ringSize_(262144),
+		stopping_(false)
+	{}
+	virtual ~ULogWriter()
+	{
+		stopWriting();
+	}
+
+private:
+	int ringSize_;
+	QThreadStorage<ULogRingHolder*> localRing_;
+	QMutex ringsMutex_;
+	QList<ULogRing*> rings_;
+	QMutex drainMutex_;
+	QMutex waitMutex_;
+	QWaitCondition wakeUp_;
+	bool stopping_;
+};
+
 void ULogger::setType(Type type, const std::string &fileName, bool append)
 {
 	ULogger::flush();
@@ -225,8 +465,45 @@ void ULogger::setBuffered(bool buffered)
 }
 
 
+void ULogger::setAsync(bool async, int bufferSize)
+{
+	ULogWriter * writer = ULogWriter::instance();
+	if(async)
+	{
+		writer->setRingSize(bufferSize);
+		writer->startWriting();
+		async_ = true;
+	}
+	else if(async_)
+	{
+		async_ = false;
+		writer->stopWriting();
+	}
+}
+
+void ULogger::writeDrained(const std::string & msgs)
+{
+	loggerMutex_.lock();
+	if(instance_)
+	{
+		if(buffered_)
+		{
+			bufferedMsgs_.append(msgs);
+		}
+		else
+		{
+			instance_->_writeStr(msgs.c_str());
+		}
+	}
+	loggerMutex_.unlock();
+}
+
 void ULogger::flush()
 {
+	if(async_)
+	{
+		ULogWriter::instance()->drain();
+	}
 	loggerMutex_.lock();
 	if(!instance_ || bufferedMsgs_.size()==0)
 	{
@@ -316,6 +593,45 @@ void ULogger::write(ULogger::Level level,
 		// Ignore messages after a fatal exit...
 		return;
 	}
+	if(async_ && level < exitLevel_)
+	{
+		if(type_ == kTypeNoLog || level < level_ || (strlen(msg) == 0 && !printWhere_))
+		{
+			return;
+		}
+		std::string text;
+		if(type_ == ULogger::kTypeConsole && printColored_)
+		{
+			text.append(colorString(level));
+		}
+		text.append(levelString(level));
+		if(printTime_)
+		{
+			text.append("(");
+			getTime(text);
+			text.append(") ");
+		}
+		text.append(whereString(file, line, function));
+		va_list args;
+		va_start(args, msg);
+		text.append(uFormatv(msg, args));
+		va_end(args);
+		if(type_ == ULogger::kTypeConsole && printColored_)
+		{
+			text.append(colorString(kInfo));
+		}
+		if(printEndline_)
+		{
+			text.append("\r\n");
+		}
+		ULogWriter::instance()->push(text);
+		return;
+	}
+	if(async_)
+	{
+		// messages waiting are written before
+		ULogWriter::instance()->drain();
+	}
 	loggerMutex_.lock();
 	if(type_ == kTypeNoLog && level < kFatal)
 	{
@@ -368,59 +684,8 @@ void ULogger::write(ULogger::Level level,
 			time.append(") ");
 		}
 
-		std::string levelStr = "";
-		if(printLevel_)
-		{
-			const int bufSize = 30;
-			char buf[bufSize] = {0};
-
-#ifdef _MSC_VER
-			sprintf_s(buf, bufSize, "[%s]", levelName_[level]);
-#else
-			snprintf(buf, bufSize, "[%s]", levelName_[level]);
-#endif
-			levelStr = buf;
-			levelStr.append(" ");
-		}
-
-		std::string whereStr = "";
-		if(printWhere_)
-		{
-			whereStr.append("");
-			//File
-			if(printWhereFullPath_)
-			{
-				whereStr.append(file);
-			}
-			else
-			{
-				std::string fileName = UFile::getName(file);
-				if(limitWhereLength_ && fileName.size() > 8)
-				{
-					fileName.erase(8);
-					fileName.append("~");
-				}
-				whereStr.append(fileName);
-			}
-
-			//Line
-			whereStr.append(":");
-			std::string lineStr = uNumber2Str(line);
-			whereStr.append(lineStr);
-
-			//Function
-			whereStr.append("::");
-			std::string funcStr = function;
-			if(!printWhereFullPath_ && limitWhereLength_ && funcStr.size() > 8)
-			{
-				funcStr.erase(8);
-				funcStr.append("~");
-			}
-			funcStr.append("()");
-			whereStr.append(funcStr);
-
-			whereStr.append(" ");
-		}
+		std::string levelStr = levelString(level);
+		std::string whereStr = whereString(file, line, function);
 
 		va_list args;
 
@@ -509,6 +774,89 @@ void ULogger::write(ULogger::Level level,
     loggerMutex_.unlock();
 }
 
+std::string ULogger::levelString(ULogger::Level level)
+{
+	std::string levelStr = "";
+	if(printLevel_)
+	{
+		const int bufSize = 30;
+		char buf[bufSize] = {0};
+
+#ifdef _MSC_VER
+		sprintf_s(buf, bufSize, "[%s]", levelName_[level]);
+#else
+		snprintf(buf, bufSize, "[%s]", levelName_[level]);
+#endif
+		levelStr = buf;
+		levelStr.append(" ");
+	}
+	return levelStr;
+}
+
+std::string ULogger::whereString(const char * file, int line, const char * function)
+{
+	std::string whereStr = "";
+	if(printWhere_)
+	{
+		whereStr.append("");
+		//File
+		if(printWhereFullPath_)
+		{
+			whereStr.append(file);
+		}
+		else
+		{
+			std::string fileName = UFile::getName(file);
+			if(limitWhereLength_ && fileName.size() > 8)
+			{
+				fileName.erase(8);
+				fileName.append("~");
+			}
+			whereStr.append(fileName);
+		}
+
+		//Line
+		whereStr.append(":");
+		std::string lineStr = uNumber2Str(line);
+		whereStr.append(lineStr);
+
+		//Function
+		whereStr.append("::");
+		std::string funcStr = function;
+		if(!printWhereFullPath_ && limitWhereLength_ && funcStr.size() > 8)
+		{
+			funcStr.erase(8);
+			funcStr.append("~");
+		}
+		funcStr.append("()");
+		whereStr.append(funcStr);
+
+		whereStr.append(" ");
+	}
+	return whereStr;
+}
+
+const char * ULogger::colorString(ULogger::Level level)
+{
+#ifdef WIN32
+	// set with SetConsoleTextAttribute(), not in the text
+	return "";
+#else
+	switch(level)
+	{
+	case kDebug:
+		return COLOR_GREEN;
+	case kWarning:
+		return COLOR_YELLOW;
+	case kError:
+	case kFatal:
+		return COLOR_RED;
+	default:
+		return COLOR_NORMAL;
+	}
+#endif
+}
+
 int ULogger::getTime(std::string &timeStr)
 {
     if(!printTime_) {
@@ -0,0 +1,450 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QTime>
+#include <opencv2/opencv.hpp>
+#include <find_object/FindObject.h>
+#include <find_object/Settings.h>
+#include <find_object/DetectionMetrics.h>
+#include <find_object/utilite/ULogger.h>
+
+void showUsage()
+{
+	printf("\nfind_object-bench [options] --scenes path (--session path | --objects path)\n"
+			"  Run detections on scenes for each combination of the strategies and\n"
+			"  thread counts set, then report throughput and latencies of each stage\n"
+			"  (mean, p50, p95, max in ms) as CSV (default) or JSON.\n"
+			"  Options:\n"
+			"    --session \"path\"        Session to load (objects and parameters).\n"
+			"    --objects \"path\"        Directory of objects to load.\n"
+			"    --config \"path\"         Parameters file (*.ini) loaded before the session or objects.\n"
+			"    --scenes \"path\"         Directory of images or video file.\n"
+			"    --max_scenes #          Maximum scenes read from a video (default 100).\n"
+			"    --iterations #          Passes over all scenes per combination (default 10).\n"
+			"    --warmup #              Passes not measured before each combination (default 1).\n"
+			"    --detectors \"a,b\"       Feature2D/1Detector values to test (e.g. \"ORB,GFTT\").\n"
+			"    --descriptors \"a,b\"     Feature2D/2Descriptor values to test (e.g. \"ORB,BRISK\"),\n"
+			"                              combined with those of --detectors.\n"
+			"    --strategies \"a,b\"      NearestNeighbor/1Strategy values to test (e.g. \"KDTree,BruteForce\").\n"
+			"    --threads \"1,2,4\"       General/threads values to test.\n"
+			"    --json                  Output JSON instead of CSV.\n"
+			"    --output \"path\"         Write results to a file instead of stdout.\n"
+			"    --debug                 Show debug log.\n"
+			"    --help                  Show this help.\n"
+			"  Example:\n"
+			"    $ find_object-bench --objects ./objects --scenes ./scenes --detectors ORB,FAST --descriptors ORB \\\n"
+			"             --strategies Lsh,BruteForce,Hamming --threads 1,4 --output bench.csv\n");
+	exit(-1);
+}
+
+// Select a value by name of a list parameter ("index:a;b;c")
+bool setListParameter(const QString & key, const QString & name)
+{
+	QStringList split = find_object::Settings::getParameter(key).toString().split(':');
+	if(split.size() != 2)
+	{
+		return false;
+	}
+	QStringList values = split.last().split(';');
+	int index = values.indexOf(name);
+	if(index < 0)
+	{
+		printf("\"%s\" is not a value of %s (%s)\n", name.toStdString().c_str(), key.toStdString().c_str(), split.last().toStdString().c_str());
+		return false;
+	}
+	find_object::Settings::setParameter(key, QString("%1:%2").arg(index).arg(split.last()));
+	return true;
+}
+
+QString currentListValue(const QString & key)
+{
+	QStringList split = find_object::Settings::getParameter(key).toString().split(':');
+	if(split.size() == 2)
+	{
+		QStringList values = split.last().split(';');
+		int index = split.first().toInt();
+		if(index >= 0 && index < values.size())
+		{
+			return values.at(index);
+		}
+	}
+	return QString();
+}
+
+void loadScenes(const QString & path, int maxScenes, std::vector<cv::Mat> & scenes)
+{
+	QFileInfo info(path);
+	if(info.isDir())
+	{
+		QStringList filters = find_object::Settings::getGeneral_imageFormats().split(' ');
+		QStringList names = QDir(path).entryList(filters, QDir::Files, QDir::Name);
+		for(int i=0; i<names.size(); ++i)
+		{
+			cv::Mat image = cv::imread((path+QDir::separator()+names[i]).toStdString());
+			if(!image.empty())
+			{
+				scenes.push_back(image);
+			}
+		}
+	}
+	else
+	{
+		cv::Mat image = cv::imread(path.toStdString());
+		if(!image.empty())
+		{
+			scenes.push_back(image);
+		}
+		else
+		{
+			cv::VideoCapture capture(path.toStdString());
+			while(capture.isOpened() && (int)scenes.size() < maxScenes)
+			{
+				cv::Mat frame;
+				if(!capture.read(frame) || frame.empty())
+				{
+					break;
+				}
+				scenes.push_back(frame.clone());
+			}
+		}
+	}
+}
+
+class Result
+{
+public:
+	QString detector;
+	QString descriptor;
+	QString strategy;
+	int threads;
+	int frames;
+	double seconds;
+	int objectsDetected;
+	std::vector<find_object::LatencyHistogram> stages; // indexed by DetectionInfo::TimeStamp
+};
+
+static const int kStages = find_object::DetectionInfo::kTimeGeometryCheck + 1;
+
+QString toCsv(const QList<Result> & results)
+{
+	QStringList lines;
+	QStringList header;
+	header << "detector" << "descriptor" << "strategy" << "threads" << "frames" << "seconds" << "fps" << "objects_per_frame";
+	for(int s=0; s<kStages; ++s)
+	{
+		QString name = find_object::DetectionMetrics::timeStampName((find_object::DetectionInfo::TimeStamp)s);
+		header << name+"_mean_ms" << name+"_p50_ms" << name+"_p95_ms" << name+"_max_ms";
+	}
+	lines.append(header.join(","));
+	for(int i=0; i<results.size(); ++i)
+	{
+		const Result & r = results[i];
+		QStringList row;
+		row << r.detector << r.descriptor << r.strategy << QString::number(r.threads) << QString::number(r.frames)
+			<< QString::number(r.seconds, 'f', 3)
+			<< QString::number(r.seconds>0?double(r.frames)/r.seconds:0.0, 'f', 2)
+			<< QString::number(r.frames?double(r.objectsDetected)/r.frames:0.0, 'f', 2);
+		for(int s=0; s<kStages; ++s)
+		{
+			const find_object::LatencyHistogram & h = r.stages[s];
+			row << QString::number(h.count()?h.sum()/h.count():0.0, 'f', 3)
+				<< QString::number(h.percentile(0.5f), 'f', 3)
+				<< QString::number(h.percentile(0.95f), 'f', 3)
+				<< QString::number(h.max(), 'f', 3);
+		}
+		lines.append(row.join(","));
+	}
+	return lines.join("\n") + "\n";
+}
+
+QString toJson(const QList<Result> & results)
+{
+	QStringList entries;
+	for(int i=0; i<results.size(); ++i)
+	{
+		const Result & r = results[i];
+		QStringList stages;
+		for(int s=0; s<kStages; ++s)
+		{
+			const find_object::LatencyHistogram & h = r.stages[s];
+			stages.append(QString("      \"%1\": {\"mean\": %2, \"p50\": %3, \"p95\": %4, \"max\": %5}")
+					.arg(find_object::DetectionMetrics::timeStampName((find_object::DetectionInfo::TimeStamp)s))
+					.arg(h.count()?h.sum()/h.count():0.0, 0, 'f', 3)
+					.arg(h.percentile(0.5f), 0, 'f', 3)
+					.arg(h.percentile(0.95f), 0, 'f', 3)
+					.arg(h.max(), 0, 'f', 3));
+		}
+		entries.append(QString("  {\n"
+				"    \"detector\": \"%1\",\n"
+				"    \"descriptor\": \"%2\",\n"
+				"    \"strategy\": \"%3\",\n"
+				"    \"threads\": %4,\n"
+				"    \"frames\": %5,\n"
+				"    \"seconds\": %6,\n"
+				"    \"fps\": %7,\n"
+				"    \"objects_per_frame\": %8,\n"
+				"    \"latencies_ms\": {\n%9\n    }\n"
+				"  }")
+				.arg(r.detector).arg(r.descriptor).arg(r.strategy)
+				.arg(r.threads).arg(r.frames)
+				.arg(r.seconds, 0, 'f', 3)
+				.arg(r.seconds>0?double(r.frames)/r.seconds:0.0, 0, 'f', 2)
+				.arg(r.frames?double(r.objectsDetected)/r.frames:0.0, 0, 'f', 2)
+				.arg(stages.join(",\n")));
+	}
+	return "[\n" + entries.join(",\n") + "\n]\n";
+}
+
+QStringList splitValues(const char * arg)
+{
+	return QString(arg).split(',', QString::SkipEmptyParts);
+}
+
+int main(int argc, char * argv[])
+{
+	QString sessionPath;
+	QString objectsPath;
+	QString configPath;
+	QString scenesPath;
+	QString outputPath;
+	int maxScenes = 100;
+	int iterations = 10;
+	int warmup = 1;
+	bool json = false;
+	QStringList detectors;
+	QStringList descriptors;
+	QStringList strategies;
+	QStringList threads;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kWarning);
+
+	for(int i=1; i<argc; ++i)
+	{
+		QString arg = argv[i];
+		if(arg == "--help" || arg == "-help")
+		{
+			showUsage();
+		}
+		if(arg == "--json" || arg == "-json")
+		{
+			json = true;
+			continue;
+		}
+		if(arg == "--debug" || arg == "-debug")
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(i+1 >= argc)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		++i;
+		if(arg == "--session" || arg == "-session") sessionPath = argv[i];
+		else if(arg == "--objects" || arg == "-objects") objectsPath = argv[i];
+		else if(arg == "--config" || arg == "-config") configPath = argv[i];
+		else if(arg == "--scenes" || arg == "-scenes") scenesPath = argv[i];
+		else if(arg == "--output" || arg == "-output") outputPath = argv[i];
+		else if(arg == "--max_scenes" || arg == "-max_scenes") maxScenes = atoi(argv[i]);
+		else if(arg == "--iterations" || arg == "-iterations") iterations = atoi(argv[i]);
+		else if(arg == "--warmup" || arg == "-warmup") warmup = atoi(argv[i]);
+		else if(arg == "--detectors" || arg == "-detectors") detectors = splitValues(argv[i]);
+		else if(arg == "--descriptors" || arg == "-descriptors") descriptors = splitValues(argv[i]);
+		else if(arg == "--strategies" || arg == "-strategies") strategies = splitValues(argv[i]);
+		else if(arg == "--threads" || arg == "-threads") threads = splitValues(argv[i]);
+		else
+		{
+			printf("Unrecognized option: %s\n", argv[i-1]);
+			showUsage();
+		}
+	}
+
+	if(scenesPath.isEmpty() || (sessionPath.isEmpty() && objectsPath.isEmpty()) || iterations <= 0)
+	{
+		printf("Scenes and a session or objects should be set!\n");
+		showUsage();
+	}
+
+	QCoreApplication app(argc, argv);
+
+	if(!configPath.isEmpty())
+	{
+		find_object::Settings::init(configPath);
+	}
+
+	std::vector<cv::Mat> scenes;
+	loadScenes(scenesPath, maxScenes, scenes);
+	if(scenes.empty())
+	{
+		printf("No scenes loaded from \"%s\"\n", scenesPath.toStdString().c_str());
+		return -1;
+	}
+
+	find_object::FindObject findObject(true); // images kept to re-extract features
+	if(!sessionPath.isEmpty())
+	{
+		if(!findObject.loadSession(sessionPath))
+		{
+			printf("Could not load session \"%s\"\n", sessionPath.toStdString().c_str());
+			return -1;
+		}
+	}
+	else if(!findObject.loadObjects(objectsPath))
+	{
+		printf("No objects loaded from \"%s\"\n", objectsPath.toStdString().c_str());
+		return -1;
+	}
+	fprintf(stderr, "Loaded %d objects and %d scenes\n", findObject.objects().size(), (int)scenes.size());
+
+	// Combinations are set from the parameters of the session
+	const find_object::ParametersMap loadedParameters = findObject.parameters();
+	for(find_object::ParametersMap::const_iterator iter=loadedParameters.begin(); iter!=loadedParameters.end(); ++iter)
+	{
+		find_object::Settings::setParameter(iter.key(), iter.value());
+	}
+
+	// An empty axis keeps the current value (from the session or the config)
+	if(detectors.isEmpty()) detectors.append(currentListValue(find_object::Settings::kFeature2D_1Detector()));
+	if(descriptors.isEmpty()) descriptors.append(currentListValue(find_object::Settings::kFeature2D_2Descriptor()));
+	if(strategies.isEmpty()) strategies.append(currentListValue(find_object::Settings::kNearestNeighbor_1Strategy()));
+	if(threads.isEmpty()) threads.append(QString::number(find_object::Settings::getGeneral_threads()));
+
+	QString indexedDetector = currentListValue(find_object::Settings::kFeature2D_1Detector());
+	QString indexedDescriptor = currentListValue(find_object::Settings::kFeature2D_2Descriptor());
+	QString indexedStrategy = currentListValue(find_object::Settings::kNearestNeighbor_1Strategy());
+
+	QList<Result> results;
+	for(int d=0; d<detectors.size(); ++d)
+	{
+		for(int e=0; e<descriptors.size(); ++e)
+		{
+			for(int s=0; s<strategies.size(); ++s)
+			{
+				for(int t=0; t<threads.size(); ++t)
+				{
+					if(!setListParameter(find_object::Settings::kFeature2D_1Detector(), detectors[d]) ||
+					   !setListParameter(find_object::Settings::kFeature2D_2Descriptor(), descriptors[e]) ||
+					   !setListParameter(find_object::Settings::kNearestNeighbor_1Strategy(), strategies[s]))
+					{
+						return -1;
+					}
+					find_object::Settings::setGeneral_threads(threads[t].toInt());
+					findObject.setParameters(find_object::Settings::getParameters());
+
+					// Only rebuild what the combination changes
+					findObject.updateDetectorExtractor();
+					if(detectors[d] != indexedDetector || descriptors[e] != indexedDescriptor)
+					{
+						findObject.updateObjects();
+						findObject.updateVocabulary();
+					}
+					else if(strategies[s] != indexedStrategy)
+					{
+						findObject.updateVocabulary();
+					}
+					indexedDetector = detectors[d];
+					indexedDescriptor = descriptors[e];
+					indexedStrategy = strategies[s];
+
+					fprintf(stderr, "Benchmarking detector=%s descriptor=%s strategy=%s threads=%d...\n",
+							detectors[d].toStdString().c_str(),
+							descriptors[e].toStdString().c_str(),
+							strategies[s].toStdString().c_str(),
+							threads[t].toInt());
+
+					find_object::DetectionInfo info;
+					for(int w=0; w<warmup; ++w)
+					{
+						for(unsigned int i=0; i<scenes.size(); ++i)
+						{
+							findObject.detect(scenes[i], info);
+						}
+					}
+
+					Result result;
+					result.detector = detectors[d];
+					result.descriptor = descriptors[e];
+					result.strategy = strategies[s];
+					result.threads = threads[t].toInt();
+					result.frames = 0;
+					result.objectsDetected = 0;
+					result.stages.resize(kStages);
+					QTime time;
+					time.start();
+					for(int n=0; n<iterations; ++n)
+					{
+						for(unsigned int i=0; i<scenes.size(); ++i)
+						{
+							info = find_object::DetectionInfo();
+							findObject.detect(scenes[i], info);
+							++result.frames;
+							result.objectsDetected += info.objDetected_.size();
+							for(QMap<find_object::DetectionInfo::TimeStamp, float>::const_iterator iter=info.timeStamps_.constBegin(); iter!=info.timeStamps_.constEnd(); ++iter)
+							{
+								if((int)iter.key() < kStages)
+								{
+									result.stages[iter.key()].add(iter.value());
+								}
+							}
+						}
+					}
+					result.seconds = double(time.elapsed())/1000.0;
+					results.append(result);
+				}
+			}
+		}
+	}
+
+	QString output = json?toJson(results):toCsv(results);
+	if(!outputPath.isEmpty())
+	{
+		QFile file(outputPath);
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+		{
+			printf("Cannot write results to \"%s\"\n", outputPath.toStdString().c_str());
+			return -1;
+		}
+		QTextStream out(&file);
+		out << output;
+		file.close();
+		fprintf(stderr, "Results saved to \"%s\"\n", outputPath.toStdString().c_str());
+	}
+	else
+	{
+		printf("%s", output.toStdString().c_str());
+	}
+
+	return 0;
+}
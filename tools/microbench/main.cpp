@@ -0,0 +1,721 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QRegExp>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <opencv2/opencv.hpp>
+#include <find_object/FindObject.h>
+#include <find_object/Settings.h>
+#include <find_object/utilite/ULogger.h>
+#include "Vocabulary.h"
+#include "ObjSignature.h"
+#include "Compression.h"
+#include "LimitKeypoints.h"
+
+void showUsage()
+{
+	printf("\nfind_object-microbench [options]\n"
+			"  Time the building blocks of the detection in isolation: Vocabulary::addWords()\n"
+			"  (default, incremental and fixed vocabulary), Vocabulary::update() and\n"
+			"  Vocabulary::search() per nearest neighbor strategy, limitKeypoints(),\n"
+			"  compressData()/uncompressData() and ObjSignature save/load. Each benchmark\n"
+			"  is repeated until it runs for --min_time, then its time per iteration and\n"
+			"  its throughput (descriptors, keypoints or bytes per second) are reported\n"
+			"  as CSV. Synthetic descriptors are random (queries are noisy copies of\n"
+			"  words), real ones are those of the objects of a session or a directory.\n"
+			"  Options:\n"
+			"    --types \"a,b\"           Synthetic descriptors: orb (32 bytes), brisk (64 bytes),\n"
+			"                              surf (64 floats), sift (128 floats). Default \"orb,sift\".\n"
+			"    --words \"n,m\"           Vocabulary sizes of the synthetic descriptors (default \"10000,100000\").\n"
+			"    --session \"path\"        Also benchmark the descriptors of the objects of this session.\n"
+			"    --objects \"path\"        Same with a directory of objects.\n"
+			"    --config \"path\"         Parameters file (*.ini) used to extract the objects.\n"
+			"    --queries #             Descriptors searched per iteration (default 1000).\n"
+			"    --k \"1,2\"               Neighbors searched (default \"1,2\").\n"
+			"    --strategies \"a,b\"      NearestNeighbor/1Strategy values, default \"Linear,Lsh,BruteForce,Hamming\"\n"
+			"                              for binary descriptors and \"Linear,KDTree,KMeans,BruteForce\" otherwise.\n"
+			"    --filter \"regexp\"       Only the benchmarks whose name matches (e.g. \"search.*sift\").\n"
+			"    --min_time #            Minimum time (s) per benchmark (default 0.5).\n"
+			"    --output \"path\"         Write results to a file instead of stdout.\n"
+			"    --list                  List the benchmarks without running them.\n"
+			"    --debug                 Show debug log.\n"
+			"    --help                  Show this help.\n"
+			"  Example:\n"
+			"    $ find_object-microbench --types orb --words 100000 --filter \"Vocabulary/\" --output vocabulary.csv\n");
+	exit(-1);
+}
+
+QStringList splitValues(const QString & values)
+{
+	return values.split(',', QString::SkipEmptyParts);
+}
+
+static double secondsSince(int64 start)
+{
+	return double(cv::getTickCount()-start)/cv::getTickFrequency();
+}
+
+// "index:item0;item1;..." value with the item selected
+static bool selectItem(find_object::ParametersMap & parameters, const QString & key, const QString & item)
+{
+	QStringList items = parameters.value(key).toString().split(':').last().split(';');
+	int index = items.indexOf(item);
+	if(index < 0)
+	{
+		printf("\"%s\" is not a value of %s (%s)\n", item.toStdString().c_str(), key.toStdString().c_str(), items.join(";").toStdString().c_str());
+		return false;
+	}
+	parameters.insert(key, QString("%1:%2").arg(index).arg(items.join(";")));
+	return true;
+}
+
+// Descriptors to index and to search, keypoints of a scene
+class Dataset
+{
+public:
+	QString name;
+	cv::Mat words;
+	cv::Mat queries;
+	std::vector<cv::KeyPoint> keypoints;
+	cv::Mat keypointsDescriptors;
+
+	bool binary() const {return words.type() == CV_8UC1;}
+};
+
+// Queries near the words: bits flipped or gaussian noise added
+static cv::Mat noisyCopies(const cv::Mat & words, int count, cv::RNG & rng)
+{
+	cv::Mat queries(count, words.cols, words.type());
+	for(int i=0; i<count; ++i)
+	{
+		words.row(rng.uniform(0, words.rows)).copyTo(queries.row(i));
+		if(words.type() == CV_8UC1)
+		{
+			for(int b=0; b<words.cols*8/16; ++b)
+			{
+				queries.at<unsigned char>(i, rng.uniform(0, words.cols)) ^= (unsigned char)(1 << rng.uniform(0, 8));
+			}
+		}
+		else
+		{
+			cv::Mat noise(1, words.cols, CV_32FC1);
+			rng.fill(noise, cv::RNG::NORMAL, 0.0, 0.02);
+			queries.row(i) += noise;
+		}
+	}
+	return queries;
+}
+
+// Keypoints spread on a VGA image with random responses
+static void syntheticKeypoints(int count, const cv::Mat & descriptors, cv::RNG & rng, Dataset & dataset)
+{
+	dataset.keypoints.resize(count);
+	for(int i=0; i<count; ++i)
+	{
+		dataset.keypoints[i] = cv::KeyPoint(rng.uniform(0.0f, 640.0f), rng.uniform(0.0f, 480.0f), 31.0f, rng.uniform(0.0f, 360.0f), rng.uniform(0.0f, 1.0f));
+	}
+	dataset.keypointsDescriptors = cv::Mat(count, descriptors.cols, descriptors.type());
+	for(int i=0; i<count; ++i)
+	{
+		descriptors.row(i % descriptors.rows).copyTo(dataset.keypointsDescriptors.row(i));
+	}
+}
+
+static bool syntheticDataset(const QString & type, int words, int queries, Dataset & dataset)
+{
+	int cols;
+	int cvType;
+	if(type == "orb") {cols = 32; cvType = CV_8UC1;}
+	else if(type == "brisk") {cols = 64; cvType = CV_8UC1;}
+	else if(type == "surf") {cols = 64; cvType = CV_32FC1;}
+	else if(type == "sift") {cols = 128; cvType = CV_32FC1;}
+	else
+	{
+		printf("Unknown descriptor type \"%s\"\n", type.toStdString().c_str());
+		return false;
+	}
+	cv::RNG rng(words);
+	dataset.name = QString("%1-%2").arg(type).arg(words);
+	dataset.words = cv::Mat(words, cols, cvType);
+	if(cvType == CV_8UC1)
+	{
+		rng.fill(dataset.words, cv::RNG::UNIFORM, 0, 256);
+	}
+	else
+	{
+		rng.fill(dataset.words, cv::RNG::UNIFORM, 0.0, 1.0);
+		for(int i=0; i<words; ++i)
+		{
+			cv::normalize(dataset.words.row(i), dataset.words.row(i));
+		}
+	}
+	dataset.queries = noisyCopies(dataset.words, queries, rng);
+	syntheticKeypoints(20000, dataset.words, rng, dataset);
+	return true;
+}
+
+// Descriptors of all objects, keypoints of the object having the most
+static bool objectsDataset(const find_object::FindObject & findObject, int queries, Dataset & dataset)
+{
+	std::vector<cv::Mat> descriptors;
+	const find_object::ObjSignature * largest = 0;
+	for(QMap<int, find_object::ObjSignature*>::const_iterator iter=findObject.objects().constBegin(); iter!=findObject.objects().constEnd(); ++iter)
+	{
+		if(!iter.value()->descriptors().empty())
+		{
+			descriptors.push_back(iter.value()->descriptors());
+			if(largest == 0 || iter.value()->keypoints().size() > largest->keypoints().size())
+			{
+				largest = iter.value();
+			}
+		}
+	}
+	if(largest == 0)
+	{
+		return false;
+	}
+	cv::RNG rng;
+	cv::vconcat(descriptors, dataset.words);
+	dataset.name = QString("objects-%1").arg(dataset.words.rows);
+	dataset.queries = noisyCopies(dataset.words, queries, rng);
+	dataset.keypoints = largest->keypoints();
+	dataset.keypointsDescriptors = largest->descriptors().clone();
+	return true;
+}
+
+// Iterations of an operation, timed by run() without its setup. items()
+// are processed per iteration (descriptors, keypoints or bytes).
+class Benchmark
+{
+public:
+	Benchmark(const QString & name, qint64 items) :
+		name_(name),
+		items_(items)
+	{}
+	virtual ~Benchmark() {}
+	const QString & name() const {return name_;}
+	qint64 items() const {return items_;}
+
+	// Called once before run() if the benchmark is selected
+	virtual bool setUp() {return true;}
+	// Seconds taken by the iterations
+	virtual double run(int iterations) = 0;
+
+private:
+	QString name_;
+	qint64 items_;
+};
+
+// Objects of objectSize descriptors added one at a time, as FindObject
+// does: each descriptor is a word, or with an incremental vocabulary only
+// descriptors not matching a word are added (the index is updated every
+// General/vocabularyUpdateMinWords words), or all are matched to the
+// words of a fixed vocabulary.
+class AddWordsBenchmark : public Benchmark
+{
+public:
+	enum Mode {kDefault, kIncremental, kFixed};
+	AddWordsBenchmark(const QString & name, const Dataset & dataset, const find_object::ParametersMap & parameters, Mode mode, int objectSize = 500) :
+		Benchmark(name, dataset.words.rows),
+		dataset_(dataset),
+		parameters_(parameters),
+		mode_(mode),
+		objectSize_(objectSize)
+	{
+		parameters_.insert(find_object::Settings::kGeneral_vocabularyIncremental(), mode == kIncremental);
+	}
+	virtual bool setUp()
+	{
+		if(mode_ == kFixed)
+		{
+			fixedVocabulary_ = find_object::Vocabulary(find_object::ParametersSnapshot(parameters_));
+			fixedVocabulary_.addWords(dataset_.words, 1);
+			fixedVocabulary_.update();
+			parameters_.insert(find_object::Settings::kGeneral_vocabularyFixed(), true);
+		}
+		return true;
+	}
+	virtual double run(int iterations)
+	{
+		find_object::ParametersSnapshot params(parameters_);
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			find_object::Vocabulary vocabulary(params);
+			if(mode_ == kFixed)
+			{
+				vocabulary = fixedVocabulary_;
+				vocabulary.setParameters(params);
+			}
+			int notIndexed = 0;
+			for(int row=0, id=1; row<dataset_.words.rows; row+=objectSize_, ++id)
+			{
+				cv::Mat object = dataset_.words.rowRange(row, std::min(row+objectSize_, dataset_.words.rows));
+				vocabulary.addWords(object, id);
+				if(mode_ == kIncremental)
+				{
+					notIndexed = vocabulary.size() - vocabulary.indexedSize();
+					if(params.General_vocabularyUpdateMinWords > 0 && notIndexed >= params.General_vocabularyUpdateMinWords)
+					{
+						vocabulary.update();
+					}
+				}
+			}
+		}
+		return secondsSince(start);
+	}
+private:
+	const Dataset & dataset_;
+	find_object::ParametersMap parameters_;
+	Mode mode_;
+	int objectSize_;
+	find_object::Vocabulary fixedVocabulary_;
+};
+
+// Index of the words built from scratch (copies share the words added)
+class UpdateBenchmark : public Benchmark
+{
+public:
+	UpdateBenchmark(const QString & name, const Dataset & dataset, const find_object::ParametersMap & parameters) :
+		Benchmark(name, dataset.words.rows),
+		dataset_(dataset),
+		vocabulary_(find_object::ParametersSnapshot(parameters))
+	{}
+	virtual bool setUp()
+	{
+		vocabulary_.addWords(dataset_.words, 1);
+		return true;
+	}
+	virtual double run(int iterations)
+	{
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			find_object::Vocabulary vocabulary = vocabulary_;
+			vocabulary.update();
+		}
+		return secondsSince(start);
+	}
+private:
+	const Dataset & dataset_;
+	find_object::Vocabulary vocabulary_;
+};
+
+class SearchBenchmark : public Benchmark
+{
+public:
+	SearchBenchmark(const QString & name, const Dataset & dataset, const find_object::ParametersMap & parameters, int k) :
+		Benchmark(name, dataset.queries.rows),
+		dataset_(dataset),
+		vocabulary_(find_object::ParametersSnapshot(parameters)),
+		k_(k)
+	{}
+	virtual bool setUp()
+	{
+		vocabulary_.addWords(dataset_.words, 1);
+		vocabulary_.update();
+		return vocabulary_.size() == dataset_.words.rows;
+	}
+	virtual double run(int iterations)
+	{
+		cv::Mat results;
+		cv::Mat dists;
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			vocabulary_.search(dataset_.queries, results, dists, k_);
+		}
+		return secondsSince(start);
+	}
+private:
+	const Dataset & dataset_;
+	find_object::Vocabulary vocabulary_;
+	int k_;
+};
+
+// Keypoints of a scene and their descriptors limited to Feature2D/3MaxFeatures
+// (the copy of the keypoints, done by the caller in FindObject, is timed too)
+class LimitKeypointsBenchmark : public Benchmark
+{
+public:
+	LimitKeypointsBenchmark(const QString & name, const Dataset & dataset, int maxKeypoints, int gridCells) :
+		Benchmark(name, dataset.keypoints.size()),
+		dataset_(dataset),
+		maxKeypoints_(maxKeypoints),
+		gridCells_(gridCells)
+	{}
+	virtual double run(int iterations)
+	{
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			std::vector<cv::KeyPoint> keypoints = dataset_.keypoints;
+			cv::Mat descriptors = dataset_.keypointsDescriptors;
+			find_object::limitKeypoints(keypoints, descriptors, maxKeypoints_, gridCells_);
+		}
+		return secondsSince(start);
+	}
+private:
+	const Dataset & dataset_;
+	int maxKeypoints_;
+	int gridCells_;
+};
+
+// level 0 is compressData() (single zlib block), otherwise compressDataChunked()
+class CompressBenchmark : public Benchmark
+{
+public:
+	CompressBenchmark(const QString & name, const cv::Mat & data, int level, bool uncompress) :
+		Benchmark(name, data.total()*data.elemSize()),
+		data_(data),
+		level_(level),
+		uncompress_(uncompress)
+	{}
+	virtual bool setUp()
+	{
+		compressed_ = level_>0?find_object::compressDataChunked(data_, level_):find_object::compressData(data_);
+		return !compressed_.empty();
+	}
+	virtual double run(int iterations)
+	{
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			if(uncompress_)
+			{
+				cv::Mat data = level_>0?
+						find_object::uncompressDataChunked(&compressed_[0], (qint64)compressed_.size()):
+						find_object::uncompressData(&compressed_[0], (unsigned long)compressed_.size());
+			}
+			else
+			{
+				std::vector<unsigned char> bytes = level_>0?find_object::compressDataChunked(data_, level_):find_object::compressData(data_);
+			}
+		}
+		return secondsSince(start);
+	}
+private:
+	cv::Mat data_;
+	int level_;
+	bool uncompress_;
+	std::vector<unsigned char> compressed_;
+};
+
+// An object with the keypoints of the dataset and an encoded VGA image, as in sessions
+class ObjSignatureBenchmark : public Benchmark
+{
+public:
+	ObjSignatureBenchmark(const QString & name, const Dataset & dataset, bool load) :
+		Benchmark(name, dataset.keypoints.size()),
+		object_(1, cv::Mat(), "object.png"),
+		load_(load)
+	{
+		object_.setData(dataset.keypoints, dataset.keypointsDescriptors);
+	}
+	virtual bool setUp()
+	{
+		cv::Mat image(480, 640, CV_8UC1);
+		cv::randu(image, cv::Scalar(0), cv::Scalar(256));
+		std::vector<unsigned char> bytes;
+		cv::imencode(".png", image, bytes);
+		object_.setEncodedImage(QByteArray((const char*)&bytes[0], (int)bytes.size()));
+		QDataStream out(&saved_, QIODevice::WriteOnly);
+		object_.save(out);
+		return true;
+	}
+	virtual double run(int iterations)
+	{
+		int64 start = cv::getTickCount();
+		for(int i=0; i<iterations; ++i)
+		{
+			if(load_)
+			{
+				QDataStream in(saved_);
+				find_object::ObjSignature object;
+				object.load(in, true); // image kept encoded, like without General/keepImagesInRAM
+			}
+			else
+			{
+				QByteArray saved;
+				QDataStream out(&saved, QIODevice::WriteOnly);
+				object_.save(out);
+			}
+		}
+		return secondsSince(start);
+	}
+private:
+	find_object::ObjSignature object_;
+	bool load_;
+	QByteArray saved_;
+};
+
+static void addBenchmarks(const Dataset & dataset, const QStringList & strategiesSet, const QList<int> & ks, QList<Benchmark*> & benchmarks)
+{
+	find_object::ParametersMap parameters = find_object::Settings::getDefaultParameters();
+	parameters.insert(find_object::Settings::kNearestNeighbor_7ConvertBinToFloat(), false);
+	if(!selectItem(parameters, find_object::Settings::kNearestNeighbor_2Distance_type(), dataset.binary()?"HAMMING":"EUCLIDEAN_L2"))
+	{
+		return;
+	}
+	QStringList strategies = strategiesSet;
+	if(strategies.isEmpty())
+	{
+		strategies = dataset.binary()?
+				QString("Linear,Lsh,BruteForce,Hamming").split(','):
+				QString("Linear,KDTree,KMeans,BruteForce").split(',');
+	}
+	// addWords() searches the words with the fastest exact strategy
+	find_object::ParametersMap addParameters = parameters;
+	selectItem(addParameters, find_object::Settings::kNearestNeighbor_1Strategy(), dataset.binary()?"Hamming":"KDTree");
+	benchmarks.push_back(new AddWordsBenchmark("Vocabulary/addWords/default/"+dataset.name, dataset, addParameters, AddWordsBenchmark::kDefault));
+	benchmarks.push_back(new AddWordsBenchmark("Vocabulary/addWords/incremental/"+dataset.name, dataset, addParameters, AddWordsBenchmark::kIncremental));
+	benchmarks.push_back(new AddWordsBenchmark("Vocabulary/addWords/fixed/"+dataset.name, dataset, addParameters, AddWordsBenchmark::kFixed));
+
+	for(int s=0; s<strategies.size(); ++s)
+	{
+		find_object::ParametersMap strategyParameters = parameters;
+		if(!selectItem(strategyParameters, find_object::Settings::kNearestNeighbor_1Strategy(), strategies[s]))
+		{
+			continue;
+		}
+		benchmarks.push_back(new UpdateBenchmark(QString("Vocabulary/update/%1/%2").arg(strategies[s]).arg(dataset.name), dataset, strategyParameters));
+		for(int k=0; k<ks.size(); ++k)
+		{
+			benchmarks.push_back(new SearchBenchmark(QString("Vocabulary/search/%1/k%2/%3").arg(strategies[s]).arg(ks[k]).arg(dataset.name), dataset, strategyParameters, ks[k]));
+		}
+	}
+
+	benchmarks.push_back(new LimitKeypointsBenchmark(QString("limitKeypoints/1000/%1").arg(dataset.name), dataset, 1000, 0));
+	benchmarks.push_back(new LimitKeypointsBenchmark(QString("limitKeypoints/1000/grid4/%1").arg(dataset.name), dataset, 1000, 4));
+
+	benchmarks.push_back(new CompressBenchmark("compressData/"+dataset.name, dataset.words, 0, false));
+	benchmarks.push_back(new CompressBenchmark("uncompressData/"+dataset.name, dataset.words, 0, true));
+	benchmarks.push_back(new CompressBenchmark("compressDataChunked/level1/"+dataset.name, dataset.words, 1, false));
+	benchmarks.push_back(new CompressBenchmark("uncompressDataChunked/level1/"+dataset.name, dataset.words, 1, true));
+
+	benchmarks.push_back(new ObjSignatureBenchmark("ObjSignature/save/"+dataset.name, dataset, false));
+	benchmarks.push_back(new ObjSignatureBenchmark("ObjSignature/load/"+dataset.name, dataset, true));
+}
+
+// Iterations grow until the benchmark runs for minTime
+static QString measure(Benchmark * benchmark, double minTime)
+{
+	int iterations = 1;
+	double seconds = benchmark->run(iterations);
+	while(seconds < minTime && iterations < 1000000000)
+	{
+		double factor = seconds>0.0?minTime*1.4/seconds:10.0;
+		iterations = int(iterations * std::max(2.0, std::min(10.0, factor)));
+		seconds = benchmark->run(iterations);
+	}
+	double perIteration = seconds/double(iterations);
+	fprintf(stderr, "%-60s %12.3f us %14.0f items/s\n",
+			benchmark->name().toStdString().c_str(),
+			perIteration*1000000.0,
+			perIteration>0.0?double(benchmark->items())/perIteration:0.0);
+	return QString("%1,%2,%3,%4,%5")
+			.arg(benchmark->name())
+			.arg(iterations)
+			.arg(perIteration*1000000.0, 0, 'f', 3)
+			.arg(benchmark->items())
+			.arg(perIteration>0.0?double(benchmark->items())/perIteration:0.0, 0, 'f', 0);
+}
+
+int main(int argc, char * argv[])
+{
+	QStringList types = QString("orb,sift").split(',');
+	QStringList words = QString("10000,100000").split(',');
+	QString sessionPath;
+	QString objectsPath;
+	QString configPath;
+	QString outputPath;
+	QStringList strategies;
+	QList<int> ks;
+	ks << 1 << 2;
+	int queries = 1000;
+	QRegExp filter;
+	double minTime = 0.5;
+	bool list = false;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kWarning);
+
+	for(int i=1; i<argc; ++i)
+	{
+		QString arg = argv[i];
+		if(arg == "--help" || arg == "-help")
+		{
+			showUsage();
+		}
+		if(arg == "--list" || arg == "-list")
+		{
+			list = true;
+			continue;
+		}
+		if(arg == "--debug" || arg == "-debug")
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(i+1 >= argc)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		++i;
+		if(arg == "--types" || arg == "-types") types = splitValues(argv[i]);
+		else if(arg == "--words" || arg == "-words") words = splitValues(argv[i]);
+		else if(arg == "--session" || arg == "-session") sessionPath = argv[i];
+		else if(arg == "--objects" || arg == "-objects") objectsPath = argv[i];
+		else if(arg == "--config" || arg == "-config") configPath = argv[i];
+		else if(arg == "--output" || arg == "-output") outputPath = argv[i];
+		else if(arg == "--queries" || arg == "-queries") queries = atoi(argv[i]);
+		else if(arg == "--strategies" || arg == "-strategies") strategies = splitValues(argv[i]);
+		else if(arg == "--filter" || arg == "-filter") filter = QRegExp(argv[i]);
+		else if(arg == "--min_time" || arg == "-min_time") minTime = atof(argv[i]);
+		else if(arg == "--k" || arg == "-k")
+		{
+			ks.clear();
+			QStringList values = splitValues(argv[i]);
+			for(int j=0; j<values.size(); ++j)
+			{
+				ks.push_back(values[j].toInt());
+			}
+		}
+		else
+		{
+			printf("Unrecognized option: %s\n", argv[i-1]);
+			showUsage();
+		}
+	}
+
+	if(queries <= 0 || minTime <= 0.0 || ks.isEmpty())
+	{
+		printf("Queries, minimum time and k should be set!\n");
+		showUsage();
+	}
+
+	QCoreApplication app(argc, argv);
+
+	if(!configPath.isEmpty())
+	{
+		find_object::Settings::init(configPath);
+	}
+
+	QList<Dataset> datasets;
+	for(int t=0; t<types.size(); ++t)
+	{
+		for(int w=0; w<words.size(); ++w)
+		{
+			Dataset dataset;
+			if(!syntheticDataset(types[t], words[w].toInt(), queries, dataset))
+			{
+				return -1;
+			}
+			datasets.push_back(dataset);
+		}
+	}
+	if(!sessionPath.isEmpty() || !objectsPath.isEmpty())
+	{
+		find_object::FindObject findObject(false);
+		if(!sessionPath.isEmpty() && !findObject.loadSession(sessionPath))
+		{
+			printf("Could not load session \"%s\"\n", sessionPath.toStdString().c_str());
+			return -1;
+		}
+		else if(sessionPath.isEmpty() && !findObject.loadObjects(objectsPath))
+		{
+			printf("No objects loaded from \"%s\"\n", objectsPath.toStdString().c_str());
+			return -1;
+		}
+		Dataset dataset;
+		if(!objectsDataset(findObject, queries, dataset))
+		{
+			printf("The objects have no descriptors\n");
+			return -1;
+		}
+		datasets.push_back(dataset);
+	}
+
+	// the datasets are not copied anymore, the benchmarks refer to them
+	QList<Benchmark*> benchmarks;
+	for(int d=0; d<datasets.size(); ++d)
+	{
+		addBenchmarks(datasets[d], strategies, ks, benchmarks);
+	}
+
+	QStringList lines;
+	lines.append("benchmark,iterations,us_per_iteration,items_per_iteration,items_per_second");
+	for(int i=0; i<benchmarks.size(); ++i)
+	{
+		if(filter.isEmpty() || filter.indexIn(benchmarks[i]->name()) >= 0)
+		{
+			if(list)
+			{
+				printf("%s\n", benchmarks[i]->name().toStdString().c_str());
+			}
+			else if(benchmarks[i]->setUp())
+			{
+				lines.append(measure(benchmarks[i], minTime));
+			}
+			else
+			{
+				fprintf(stderr, "%s: setup failed, skipped\n", benchmarks[i]->name().toStdString().c_str());
+			}
+		}
+		delete benchmarks[i];
+	}
+	if(list)
+	{
+		return 0;
+	}
+
+	QString output = lines.join("\n") + "\n";
+	if(!outputPath.isEmpty())
+	{
+		QFile file(outputPath);
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+		{
+			printf("Cannot write results to \"%s\"\n", outputPath.toStdString().c_str());
+			return -1;
+		}
+		QTextStream out(&file);
+		out << output;
+		file.close();
+		fprintf(stderr, "Results saved to \"%s\"\n", outputPath.toStdString().c_str());
+	}
+	else
+	{
+		printf("%s", output.toStdString().c_str());
+	}
+
+	return 0;
+}
@@ -27,6 +27,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <algorithm>
 
 // OpenCV stuff
 #include <opencv2/core/core.hpp>
@@ -53,17 +58,427 @@ void showUsage()
 	"Return similarity between two images (the number of similar features between the images).\n"
 	"Usage :\n"
 	"  ./find_object-similarity [option] object.png scene.png\n"
+	"  ./find_object-similarity -batch [option] images...\n"
 	"Options: \n"
 	"   -inliers            return inliers percentage : inliers / (inliers + outliers)\n"
-	"   -quiet              don't show messages\n");
+	"   -quiet              don't show messages\n"
+	"Batch mode (similarity of all pairs of images):\n"
+	"   images              image files, directories of images or *.txt files listing\n"
+	"                         an image path per line\n"
+	"   -o \"path\"           CSV output file (default: standard output)\n"
+	"   -min #              minimum similarity written (default 1), the matrix is sparse\n"
+	"   -k #                nearest neighbors searched per feature in the index of all the\n"
+	"                         images (default 10). A higher value finds more matches between\n"
+	"                         images sharing similar features with many others.\n"
+	"   The features of each image are extracted once, a single index of all the features\n"
+	"   is searched, in parallel. A line \"object,scene,similarity\" is written per pair.\n");
 
 	exit(-1);
 }
 
 enum {mTotal, mInliers};
 
+static cv::Mat extractSift(const cv::Mat & image, std::vector<cv::KeyPoint> & keypoints)
+{
+	cv::Mat descriptors;
+#if CV_MAJOR_VERSION < 3
+	cv::SIFT sift;
+	sift.detect(image, keypoints);
+	sift.compute(image, keypoints, descriptors);
+#else
+	cv::Ptr<cv::xfeatures2d::SIFT> sift = cv::xfeatures2d::SIFT::create();
+	sift->detect(image, keypoints);
+	sift->compute(image, keypoints, descriptors);
+#endif
+	return descriptors;
+}
+
+// Similarity of matches from the object to the scene, as returned in the two images mode
+static int similarity(
+		int method,
+		const std::vector<cv::Point2f> & mpts_1,
+		const std::vector<cv::Point2f> & mpts_2,
+		bool quiet)
+{
+	if(method == mInliers)
+	{
+		// FIND HOMOGRAPHY
+		unsigned int minInliers = 8;
+		if(mpts_1.size() >= minInliers)
+		{
+			std::vector<uchar> outlier_mask;
+			cv::Mat H = findHomography(mpts_1,
+					mpts_2,
+					cv::RANSAC,
+					1.0,
+					outlier_mask);
+			int inliers=0, outliers=0;
+			for(unsigned int k=0; k<mpts_1.size();++k)
+			{
+				if(outlier_mask.at(k))
+				{
+					++inliers;
+				}
+				else
+				{
+					++outliers;
+				}
+			}
+			if(!quiet)
+				printf("Total=%d Inliers=%d Outliers=%d\n", (int)mpts_1.size(), inliers, outliers);
+			return (inliers*100) / (inliers+outliers);
+		}
+		return 0;
+	}
+	return (int)mpts_1.size();
+}
+
+//////////////////////////
+// Batch mode
+//////////////////////////
+
+static bool isImageFile(const std::string & path)
+{
+	static const char * extensions[] = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".ppm", ".pgm", 0};
+	std::string lower = path;
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	for(int i=0; extensions[i]; ++i)
+	{
+		std::string ext = extensions[i];
+		if(lower.size() > ext.size() && lower.compare(lower.size()-ext.size(), ext.size(), ext) == 0)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+// Images of a directory, of a list (*.txt) or the image itself
+static void addImagePaths(const std::string & path, std::vector<std::string> & paths)
+{
+	std::string lower = path;
+	std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+	if(lower.size() > 4 && lower.compare(lower.size()-4, 4, ".txt") == 0)
+	{
+		std::ifstream file(path.c_str());
+		std::string line;
+		while(std::getline(file, line))
+		{
+			line.erase(line.find_last_not_of(" \t\r\n")+1);
+			if(!line.empty())
+			{
+				paths.push_back(line);
+			}
+		}
+	}
+	else if(isImageFile(path))
+	{
+		paths.push_back(path);
+	}
+	else
+	{
+		std::vector<cv::String> files;
+		try
+		{
+			cv::glob(path, files, false);
+		}
+		catch(const cv::Exception &)
+		{
+			printf("\"%s\" is not an image, a directory or a list of images!\n", path.c_str());
+		}
+		for(unsigned int i=0; i<files.size(); ++i)
+		{
+			if(isImageFile(files[i]))
+			{
+				paths.push_back(files[i]);
+			}
+		}
+	}
+}
+
+class ExtractBody : public cv::ParallelLoopBody
+{
+public:
+	ExtractBody(const std::vector<std::string> & paths,
+			std::vector<std::vector<cv::KeyPoint> > & keypoints,
+			std::vector<cv::Mat> & descriptors) :
+		paths_(paths),
+		keypoints_(keypoints),
+		descriptors_(descriptors)
+	{}
+	virtual void operator()(const cv::Range & range) const
+	{
+		for(int i=range.start; i<range.end; ++i)
+		{
+			cv::Mat image = cv::imread(paths_[i], cv::IMREAD_GRAYSCALE);
+			if(!image.empty())
+			{
+				descriptors_[i] = extractSift(image, keypoints_[i]);
+			}
+			else
+			{
+				printf("Image \"%s\" is not valid!\n", paths_[i].c_str());
+			}
+		}
+	}
+private:
+	const std::vector<std::string> & paths_;
+	std::vector<std::vector<cv::KeyPoint> > & keypoints_;
+	std::vector<cv::Mat> & descriptors_;
+};
+
+// Each image (object) is searched in the index of the features of all the
+// images. For each other image (scene), the NNDR is applied between the
+// two nearest neighbors found in that scene. When only one is found in the k
+// nearest neighbors, the second one is at least as far as the k-th.
+class MatchBody : public cv::ParallelLoopBody
+{
+public:
+	MatchBody(const cv::flann::Index & index,
+			int k,
+			int method,
+			int minSimilarity,
+			const std::vector<std::vector<cv::KeyPoint> > & keypoints,
+			const std::vector<cv::Mat> & descriptors,
+			const std::vector<int> & rowImages,
+			const std::vector<int> & rowFeatures,
+			std::vector<std::vector<std::pair<int, int> > > & similarities) :
+		index_(index),
+		k_(k),
+		method_(method),
+		minSimilarity_(minSimilarity),
+		keypoints_(keypoints),
+		descriptors_(descriptors),
+		rowImages_(rowImages),
+		rowFeatures_(rowFeatures),
+		similarities_(similarities)
+	{}
+	virtual void operator()(const cv::Range & range) const
+	{
+		float nndrRatio = 0.6f;
+		for(int i=range.start; i<range.end; ++i)
+		{
+			if(descriptors_[i].empty())
+			{
+				continue;
+			}
+			cv::Mat results(descriptors_[i].rows, k_, CV_32SC1);
+			cv::Mat dists(descriptors_[i].rows, k_, CV_32FC1);
+			const_cast<cv::flann::Index&>(index_).knnSearch(descriptors_[i], results, dists, k_, cv::flann::SearchParams());
+
+			// matches per scene
+			std::map<int, std::pair<std::vector<cv::Point2f>, std::vector<cv::Point2f> > > matches;
+			for(int r=0; r<results.rows; ++r)
+			{
+				const int * result = results.ptr<int>(r);
+				const float * dist = dists.ptr<float>(r);
+				// <scene, <index of the first, distance of the second (-1 if not found)>>
+				std::map<int, std::pair<int, float> > nearest;
+				int found = 0;
+				for(; found<k_ && result[found] >= 0; ++found)
+				{
+					int scene = rowImages_[result[found]];
+					if(scene == i)
+					{
+						continue;
+					}
+					std::map<int, std::pair<int, float> >::iterator iter = nearest.find(scene);
+					if(iter == nearest.end())
+					{
+						nearest.insert(std::make_pair(scene, std::make_pair(found, -1.0f)));
+					}
+					else if(iter->second.second < 0.0f)
+					{
+						iter->second.second = dist[found];
+					}
+				}
+				for(std::map<int, std::pair<int, float> >::iterator iter=nearest.begin(); iter!=nearest.end(); ++iter)
+				{
+					int j = iter->second.first;
+					float second = iter->second.second<0.0f?dist[found-1]:iter->second.second;
+					if(dist[j] <= nndrRatio * second)
+					{
+						std::pair<std::vector<cv::Point2f>, std::vector<cv::Point2f> > & sceneMatches = matches[iter->first];
+						sceneMatches.first.push_back(keypoints_[i][r].pt);
+						sceneMatches.second.push_back(keypoints_[iter->first][rowFeatures_[result[j]]].pt);
+					}
+				}
+			}
+
+			for(std::map<int, std::pair<std::vector<cv::Point2f>, std::vector<cv::Point2f> > >::iterator iter=matches.begin(); iter!=matches.end(); ++iter)
+			{
+				int value = similarity(method_, iter->second.first, iter->second.second, true);
+				if(value >= minSimilarity_)
+				{
+					similarities_[i].push_back(std::make_pair(iter->first, value));
+				}
+			}
+		}
+	}
+private:
+	const cv::flann::Index & index_;
+	int k_;
+	int method_;
+	int minSimilarity_;
+	const std::vector<std::vector<cv::KeyPoint> > & keypoints_;
+	const std::vector<cv::Mat> & descriptors_;
+	const std::vector<int> & rowImages_;
+	const std::vector<int> & rowFeatures_;
+	std::vector<std::vector<std::pair<int, int> > > & similarities_;
+};
+
+static int batch(int argc, char * argv[])
+{
+	bool quiet = false;
+	int method = mTotal;
+	int k = 10;
+	int minSimilarity = 1;
+	std::string outputPath;
+	std::vector<std::string> paths;
+	for(int i=1; i<argc; ++i)
+	{
+		std::string arg = argv[i];
+		if(arg.compare("-batch") == 0)
+		{
+			continue;
+		}
+		else if(arg.compare("-inliers") == 0)
+		{
+			method = mInliers;
+		}
+		else if(arg.compare("-quiet") == 0)
+		{
+			quiet = true;
+		}
+		else if((arg.compare("-o") == 0 || arg.compare("-k") == 0 || arg.compare("-min") == 0) && i+1<argc)
+		{
+			++i;
+			if(arg.compare("-o") == 0)
+			{
+				outputPath = argv[i];
+			}
+			else if(arg.compare("-k") == 0)
+			{
+				k = std::max(2, atoi(argv[i]));
+			}
+			else
+			{
+				minSimilarity = atoi(argv[i]);
+			}
+		}
+		else if(arg.size() && arg[0] == '-')
+		{
+			printf("Option %s not recognized!", argv[i]);
+			showUsage();
+		}
+		else
+		{
+			addImagePaths(arg, paths);
+		}
+	}
+	if(paths.size() < 2)
+	{
+		printf("At least two images required!\n");
+		showUsage();
+	}
+
+	////////////////////////////
+	// EXTRACT FEATURES, ONCE PER IMAGE
+	////////////////////////////
+	int64 time = cv::getTickCount();
+	std::vector<std::vector<cv::KeyPoint> > keypoints(paths.size());
+	std::vector<cv::Mat> descriptors(paths.size());
+	cv::parallel_for_(cv::Range(0, (int)paths.size()), ExtractBody(paths, keypoints, descriptors));
+
+	// All the descriptors in one matrix, image and feature of each row
+	int rows = 0;
+	for(unsigned int i=0; i<descriptors.size(); ++i)
+	{
+		rows += descriptors[i].rows;
+	}
+	if(rows == 0)
+	{
+		printf("No features extracted!\n");
+		return -1;
+	}
+	int dim = 0;
+	for(unsigned int i=0; i<descriptors.size() && dim == 0; ++i)
+	{
+		dim = descriptors[i].cols;
+	}
+	cv::Mat allDescriptors(rows, dim, CV_32FC1);
+	std::vector<int> rowImages(rows);
+	std::vector<int> rowFeatures(rows);
+	int row = 0;
+	for(unsigned int i=0; i<descriptors.size(); ++i)
+	{
+		if(descriptors[i].rows)
+		{
+			descriptors[i].copyTo(allDescriptors.rowRange(row, row+descriptors[i].rows));
+			for(int j=0; j<descriptors[i].rows; ++j, ++row)
+			{
+				rowImages[row] = i;
+				rowFeatures[row] = j;
+			}
+		}
+	}
+	if(!quiet)
+		printf("%d images, %d features extracted (%.0f ms)\n", (int)paths.size(), rows, double(cv::getTickCount()-time)*1000.0/cv::getTickFrequency());
+
+	////////////////////////////
+	// ONE INDEX, SEARCHED BY ALL THE IMAGES IN PARALLEL
+	////////////////////////////
+	time = cv::getTickCount();
+	cv::flann::Index flannIndex(allDescriptors, cv::flann::KDTreeIndexParams(), cvflann::FLANN_DIST_EUCLIDEAN);
+	k = std::min(k, rows);
+	std::vector<std::vector<std::pair<int, int> > > similarities(paths.size()); // <scene, similarity> per object
+	cv::parallel_for_(cv::Range(0, (int)paths.size()), MatchBody(flannIndex, k, method, minSimilarity, keypoints, descriptors, rowImages, rowFeatures, similarities));
+	if(!quiet)
+		printf("Similarities computed (%.0f ms)\n", double(cv::getTickCount()-time)*1000.0/cv::getTickFrequency());
+
+	////////////////////////////
+	// SPARSE CSV
+	////////////////////////////
+	FILE * out = stdout;
+	if(!outputPath.empty())
+	{
+		out = fopen(outputPath.c_str(), "w");
+		if(out == 0)
+		{
+			printf("Cannot open \"%s\"!\n", outputPath.c_str());
+			return -1;
+		}
+	}
+	fprintf(out, "object,scene,similarity\n");
+	int pairs = 0;
+	for(unsigned int i=0; i<similarities.size(); ++i)
+	{
+		std::sort(similarities[i].begin(), similarities[i].end());
+		for(unsigned int j=0; j<similarities[i].size(); ++j)
+		{
+			fprintf(out, "%s,%s,%d\n", paths[i].c_str(), paths[similarities[i][j].first].c_str(), similarities[i][j].second);
+			++pairs;
+		}
+	}
+	if(out != stdout)
+	{
+		fclose(out);
+		if(!quiet)
+			printf("%d pairs written to \"%s\"\n", pairs, outputPath.c_str());
+	}
+	return 0;
+}
+
 int main(int argc, char * argv[])
 {
+	for(int i=1; i<argc; ++i)
+	{
+		if(std::string(argv[i]).compare("-batch") == 0)
+		{
+			return batch(argc, argv);
+		}
+	}
+
 	bool quiet = false;
 	int method = mTotal; //total matches
 	if(argc<3)
@@ -104,33 +519,12 @@ int main(int argc, char * argv[])
 		cv::Mat objectDescriptors;
 		cv::Mat sceneDescriptors;
 
-#if CV_MAJOR_VERSION < 3
 		////////////////////////////
-		// EXTRACT KEYPOINTS
+		// EXTRACT KEYPOINTS AND DESCRIPTORS
 		////////////////////////////
-		cv::SIFT sift;
-		sift.detect(objectImg, objectKeypoints);
-		sift.detect(sceneImg, sceneKeypoints);
+		objectDescriptors = extractSift(objectImg, objectKeypoints);
+		sceneDescriptors = extractSift(sceneImg, sceneKeypoints);
 
-		////////////////////////////
-		// EXTRACT DESCRIPTORS
-		////////////////////////////
-		sift.compute(objectImg, objectKeypoints, objectDescriptors);
-		sift.compute(sceneImg, sceneKeypoints, sceneDescriptors);
-#else
-		////////////////////////////
-		// EXTRACT KEYPOINTS
-		////////////////////////////
-		cv::Ptr<cv::xfeatures2d::SIFT> sift = cv::xfeatures2d::SIFT::create();
-		sift->detect(objectImg, objectKeypoints);
-		sift->detect(sceneImg, sceneKeypoints);
-
-		////////////////////////////
-		// EXTRACT DESCRIPTORS
-		////////////////////////////
-		sift->compute(objectImg, objectKeypoints, objectDescriptors);
-		sift->compute(sceneImg, sceneKeypoints, sceneDescriptors);
-#endif
 		////////////////////////////
 		// NEAREST NEIGHBOR MATCHING USING FLANN LIBRARY (included in OpenCV)
 		////////////////////////////
@@ -155,7 +549,6 @@ int main(int argc, char * argv[])
 		float nndrRatio = 0.6f;
 		std::vector<cv::Point2f> mpts_1, mpts_2; // Used for homography
 		std::vector<int> indexes_1, indexes_2; // Used for homography
-		std::vector<uchar> outlier_mask;  // Used for homography
 		// Check if this descriptor matches with those of the objects
 
 		for(int i=0; i<objectDescriptors.rows; ++i)
@@ -171,38 +564,7 @@ int main(int argc, char * argv[])
 			}
 		}
 
-		if(method == mInliers)
-		{
-			// FIND HOMOGRAPHY
-			unsigned int minInliers = 8;
-			if(mpts_1.size() >= minInliers)
-			{
-				cv::Mat H = findHomography(mpts_1,
-						mpts_2,
-						cv::RANSAC,
-						1.0,
-						outlier_mask);
-				int inliers=0, outliers=0;
-				for(unsigned int k=0; k<mpts_1.size();++k)
-				{
-					if(outlier_mask.at(k))
-					{
-						++inliers;
-					}
-					else
-					{
-						++outliers;
-					}
-				}
-				if(!quiet)
-					printf("Total=%d Inliers=%d Outliers=%d\n", (int)mpts_1.size(), inliers, outliers);
-				value = (inliers*100) / (inliers+outliers);
-			}
-		}
-		else
-		{
-			value = (int)mpts_1.size();
-		}
+		value = similarity(method, mpts_1, mpts_2, quiet);
 	}
 	else
 	{
@@ -32,8 +32,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <QtCore/QPointF>
 #include <QtCore/QTime>
 
-TcpClient::TcpClient(QObject *parent) :
+TcpClient::TcpClient(bool compact, QObject *parent) :
 	QTcpSocket(parent),
+	compact_(compact),
     blockSize_(0)
 {
 	connect(this, SIGNAL(readyRead()), this, SLOT(readReceivedData()));
@@ -48,15 +49,24 @@ void TcpClient::readReceivedData()
 
 	if (blockSize_ == 0)
 	{
-		if (this->bytesAvailable() < (int)sizeof(quint16))
+		if (this->bytesAvailable() < (compact_?(int)sizeof(quint32):(int)sizeof(quint16)))
 		{
 			return;
 		}
 
-		in >> blockSize_;
+		if(compact_)
+		{
+			in >> blockSize_;
+		}
+		else
+		{
+			quint16 blockSize;
+			in >> blockSize;
+			blockSize_ = blockSize;
+		}
 	}
 
-	if (this->bytesAvailable() < blockSize_)
+	if (this->bytesAvailable() < (qint64)blockSize_)
 	{
 		return;
 	}
@@ -64,7 +74,18 @@ void TcpClient::readReceivedData()
 	blockSize_ = 0;
 
 	find_object::DetectionInfo info;
-	in >> info;
+	if(compact_)
+	{
+		if(!find_object::readCompactDetectionInfo(in, info))
+		{
+			printf("Unsupported compact result format!\n");
+			return;
+		}
+	}
+	else
+	{
+		in >> info;
+	}
 
 	printf("---\n");
 	if(info.objDetected_.size() == 0)
@@ -34,7 +34,7 @@ class TcpClient : public QTcpSocket
 {
 	Q_OBJECT;
 public:
-	TcpClient(QObject * parent = 0);
+	TcpClient(bool compact = false, QObject * parent = 0);
 
 private Q_SLOTS:
 	void readReceivedData();
@@ -42,7 +42,8 @@ private Q_SLOTS:
 	void connectionLost();
 
 private:
-	quint16 blockSize_;
+	bool compact_; // [quint32 size][compact DetectionInfo] instead of [quint16 size][DetectionInfo]
+	quint32 blockSize_;
 };
 
 #endif /* TCPCLIENT_H_ */
@@ -31,12 +31,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 void showUsage()
 {
-	printf("\ntcpObjectsClient [hostname] port\n");
+	printf("\ntcpObjectsClient [hostname] port [--compact]\n"
+			"  --compact    Detections are published in the compact format (General/portResultFormat > 0).\n");
 	exit(-1);
 }
 
 int main(int argc, char * argv[])
 {
+	bool compact = false;
+	if(argc > 1 && strcmp(argv[argc-1], "--compact") == 0)
+	{
+		compact = true;
+		--argc;
+	}
 	if(argc < 2 || argc > 3)
 	{
 		showUsage();
@@ -64,7 +71,7 @@ int main(int argc, char * argv[])
 
 	printf("Connecting to \"%s:%d\"...\n", ipAddress.toStdString().c_str(), port);
 
-	TcpClient client;
+	TcpClient client(compact);
 
 	client.connectToHost(ipAddress, port);
 
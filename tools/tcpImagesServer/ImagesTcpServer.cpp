@@ -68,6 +68,11 @@ QHostAddress ImagesTcpServer::getHostAddress()
 	return hostAddress;
 }
 
+bool ImagesTcpServer::createSharedMemory(const QString & key, int slotCount, int slotSize)
+{
+	return sharedMemory_.create(key, slotCount, slotSize);
+}
+
 void ImagesTcpServer::publishImage(const cv::Mat & image)
 {
 	if(image.empty())
@@ -76,6 +81,14 @@ void ImagesTcpServer::publishImage(const cv::Mat & image)
 		camera_.pause();
 		Q_EMIT connectionLost();
 	}
+	else if(sharedMemory_.isAttached())
+	{
+		// raw frame, no encoding
+		if(!sharedMemory_.write(image))
+		{
+			printf("Frame dropped (%dx%d)...\n", image.cols, image.rows);
+		}
+	}
 	else
 	{
 		if(this->waitForConnected())
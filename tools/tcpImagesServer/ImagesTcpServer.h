@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define IMAGESTCPSERVER_H_
 
 #include "find_object/Camera.h"
+#include "find_object/SharedMemoryRing.h"
 #include <QtNetwork/QTcpSocket>
 
 class ImagesTcpServer : public QTcpSocket
@@ -40,9 +41,13 @@ public:
 
 public:
 	ImagesTcpServer(float hz = 10.0f, const QString & path = "", QObject * parent = 0);
+	// Images are written in a shared memory ring instead of being sent by TCP
+	bool createSharedMemory(const QString & key, int slotCount, int slotSize);
 
-private Q_SLOTS:
+public Q_SLOTS:
 	void startCamera();
+
+private Q_SLOTS:
 	void publishImage(const cv::Mat & image);
 
 Q_SIGNALS:
@@ -50,6 +55,7 @@ Q_SIGNALS:
 
 private:
 	find_object::Camera camera_;
+	find_object::SharedMemoryRing sharedMemory_;
 };
 
 #endif /* TCPCLIENT_H_ */
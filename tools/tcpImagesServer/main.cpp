@@ -35,7 +35,12 @@ void showUsage()
 			"  Options:\n"
 			"    --hz #.#          Image rate (default 10 Hz).\n"
 			"    --host #.#.#.#    Set host address.\n"
-			"    --path \"\"       Set a path of a directory of images or a video file.\n");
+			"    --path \"\"       Set a path of a directory of images or a video file.\n"
+			"    --shm \"key\"     Write raw frames in a shared memory ring instead of sending\n"
+			"                      them by TCP (find-object with --Camera/sharedMemoryKey \"key\").\n"
+			"                      The port is ignored.\n"
+			"    --shm_slots #     Frames in the ring (default 8).\n"
+			"    --shm_size #      Maximum bytes of a frame (default 1920*1080*3).\n");
 	exit(-1);
 }
 
@@ -44,6 +49,9 @@ int main(int argc, char * argv[])
 	QString ipAddress;
 	float hz = 10.0f;
 	QString path;
+	QString shmKey;
+	int shmSlots = 8;
+	int shmSize = 1920*1080*3;
 
 	if(argc < 2)
 	{
@@ -97,6 +105,56 @@ int main(int argc, char * argv[])
 			continue;
 		}
 
+		if(strcmp(argv[i], "-shm") == 0 || strcmp(argv[i], "--shm") == 0)
+		{
+			++i;
+			if(i < argc-1)
+			{
+				shmKey = argv[i];
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-shm_slots") == 0 || strcmp(argv[i], "--shm_slots") == 0)
+		{
+			++i;
+			if(i < argc-1)
+			{
+				shmSlots = std::atoi(argv[i]);
+				if(shmSlots < 2)
+				{
+					printf("[ERROR] shm_slots should be >= 2 : %s\n", argv[i]);
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-shm_size") == 0 || strcmp(argv[i], "--shm_size") == 0)
+		{
+			++i;
+			if(i < argc-1)
+			{
+				shmSize = std::atoi(argv[i]);
+				if(shmSize <= 0)
+				{
+					printf("[ERROR] shm_size not valid : %s\n", argv[i]);
+					showUsage();
+				}
+			}
+			else
+			{
+				showUsage();
+			}
+			continue;
+		}
+
 		printf("Unrecognized option: %s\n", argv[i]);
 		showUsage();
 	}
@@ -113,6 +171,18 @@ int main(int argc, char * argv[])
 
 	QObject::connect(&server, SIGNAL(connectionLost()), &app, SLOT(quit()));
 
+	if(!shmKey.isEmpty())
+	{
+		if(!server.createSharedMemory(shmKey, shmSlots, shmSize))
+		{
+			printf("ERROR: Unable to create the shared memory \"%s\"\n", shmKey.toStdString().c_str());
+			return -1;
+		}
+		printf("Writing frames in shared memory \"%s\"\n", shmKey.toStdString().c_str());
+		server.startCamera();
+		return app.exec();
+	}
+
 	if(ipAddress.isEmpty())
 	{
 		ipAddress = server.getHostAddress().toString();
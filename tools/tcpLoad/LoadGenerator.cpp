@@ -0,0 +1,565 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "LoadGenerator.h"
+
+#include <find_object/TcpServer.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QTextStream>
+#include <algorithm>
+#include <cmath>
+
+using find_object::TcpServer;
+
+LoadClient::LoadClient(const QString & host, quint16 port, QObject * parent) :
+	QTcpSocket(parent),
+	host_(host),
+	port_(port),
+	blockSize_(0),
+	nextRequestId_(1)
+{
+	connect(this, SIGNAL(readyRead()), this, SLOT(readReceivedData()));
+	connect(this, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(displayError(QAbstractSocket::SocketError)));
+	connect(this, SIGNAL(disconnected()), this, SLOT(connectionLost()));
+}
+
+// [quint64 size][quint32 service type | kRequestId (| kDeadline)][quint32 request ID]([quint32 budget])[payload]
+bool LoadClient::send(quint32 serviceType, const QByteArray & payload, quint32 budgetMs, qint64 sentTime)
+{
+	if(!isReady())
+	{
+		return false;
+	}
+	quint32 requestId = nextRequestId_++;
+	if(nextRequestId_ == 0)
+	{
+		nextRequestId_ = 1;
+	}
+	QByteArray header;
+	QDataStream out(&header, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << (quint64)0;
+	if(budgetMs > 0)
+	{
+		out << (quint32)(serviceType | TcpServer::kRequestId | TcpServer::kDeadline) << requestId << budgetMs;
+	}
+	else
+	{
+		out << (quint32)(serviceType | TcpServer::kRequestId) << requestId;
+	}
+	out.device()->seek(0);
+	out << (quint64)(header.size() - sizeof(quint64) + payload.size());
+	write(header);
+	write(payload);
+	sent_.insert(requestId, sentTime);
+	return true;
+}
+
+int LoadClient::expire(qint64 sentTime)
+{
+	int count = 0;
+	for(QMap<quint32, qint64>::iterator iter=sent_.begin(); iter!=sent_.end();)
+	{
+		if(iter.value() < sentTime)
+		{
+			iter = sent_.erase(iter);
+			++count;
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	return count;
+}
+
+void LoadClient::reconnect()
+{
+	if(state() == QAbstractSocket::UnconnectedState)
+	{
+		blockSize_ = 0;
+		connectToHost(host_, port_);
+	}
+}
+
+// [quint32 size][quint32 request ID][quint32 status][DetectionInfo, ignored]
+void LoadClient::readReceivedData()
+{
+	QDataStream in(this);
+	in.setVersion(QDataStream::Qt_4_0);
+	while(true)
+	{
+		if(blockSize_ == 0)
+		{
+			if(bytesAvailable() < (int)sizeof(quint32))
+			{
+				return;
+			}
+			in >> blockSize_;
+		}
+		if(bytesAvailable() < blockSize_)
+		{
+			return;
+		}
+		QByteArray block = read(blockSize_);
+		blockSize_ = 0;
+
+		QDataStream blockIn(block);
+		blockIn.setVersion(QDataStream::Qt_4_0);
+		quint32 requestId, status;
+		blockIn >> requestId >> status;
+
+		QMap<quint32, qint64>::iterator iter = sent_.find(requestId);
+		if(iter != sent_.end())
+		{
+			qint64 sentTime = iter.value();
+			sent_.erase(iter);
+			Q_EMIT responseReceived(status, sentTime);
+		}
+		else
+		{
+			Q_EMIT responseReceived(status, -1);
+		}
+	}
+}
+
+void LoadClient::displayError(QAbstractSocket::SocketError socketError)
+{
+	if(socketError == QAbstractSocket::RemoteHostClosedError)
+	{
+		UWARN("%s:%d: connection lost", host_.toStdString().c_str(), port_);
+	}
+	else
+	{
+		UWARN("%s:%d: %s", host_.toStdString().c_str(), port_, errorString().toStdString().c_str());
+	}
+	// try again until the server is back
+	QTimer::singleShot(1000, this, SLOT(reconnect()));
+}
+
+void LoadClient::connectionLost()
+{
+	int count = sent_.size();
+	sent_.clear();
+	blockSize_ = 0;
+	if(count)
+	{
+		Q_EMIT requestsLost(count);
+	}
+}
+
+LoadGenerator::LoadGenerator(
+		const QList<QByteArray> & payloads,
+		quint32 serviceType,
+		const QString & host,
+		quint16 port,
+		int connections,
+		double rate,
+		int concurrency,
+		int count,
+		int durationMs,
+		int timeoutMs,
+		int deadlineMs,
+		const QString & csvPath,
+		QObject * parent) :
+	QObject(parent),
+	payloads_(payloads),
+	serviceType_(serviceType),
+	rate_(rate),
+	concurrency_(concurrency),
+	count_(count),
+	durationMs_(durationMs),
+	timeoutMs_(timeoutMs),
+	deadlineMs_(deadlineMs),
+	started_(false),
+	finished_(false),
+	sending_(false),
+	connected_(0),
+	nextClient_(0),
+	sentCount_(0),
+	saturatedCount_(0),
+	okCount_(0),
+	degradedCount_(0),
+	failedCount_(0),
+	timeoutCount_(0),
+	lateCount_(0),
+	lostCount_(0),
+	lastResponse_(0),
+	intervalSent_(0),
+	intervalDone_(0)
+{
+	UASSERT(payloads.size() > 0);
+	UASSERT(connections > 0);
+	UASSERT(rate > 0 || concurrency > 0);
+	UASSERT(count > 0 || durationMs > 0);
+	UASSERT(timeoutMs > 0);
+
+	for(int i=0; i<connections; ++i)
+	{
+		LoadClient * client = new LoadClient(host, port, this);
+		connect(client, SIGNAL(connected()), this, SLOT(clientConnected()));
+		connect(client, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(connectionFailed()));
+		connect(client, SIGNAL(responseReceived(quint32, qint64)), this, SLOT(receiveResponse(quint32, qint64)));
+		connect(client, SIGNAL(requestsLost(int)), this, SLOT(loseRequests(int)));
+		clients_.push_back(client);
+	}
+
+	if(!csvPath.isEmpty())
+	{
+		csv_.setFileName(csvPath);
+		if(csv_.open(QIODevice::WriteOnly | QIODevice::Text))
+		{
+			csv_.write("sent_ms,latency_ms,status\n");
+		}
+		else
+		{
+			UERROR("Cannot open \"%s\"", csvPath.toStdString().c_str());
+		}
+	}
+
+	connect(&sendTimer_, SIGNAL(timeout()), this, SLOT(sendRequests()));
+	connect(&timeoutTimer_, SIGNAL(timeout()), this, SLOT(checkTimeouts()));
+	connect(&progressTimer_, SIGNAL(timeout()), this, SLOT(printProgress()));
+	sendTimer_.setInterval(1);
+	timeoutTimer_.setInterval(qMax(10, qMin(100, timeoutMs_/4)));
+	progressTimer_.setInterval(1000);
+}
+
+LoadGenerator::~LoadGenerator()
+{
+}
+
+void LoadGenerator::start()
+{
+	UINFO("Connecting %d clients...", clients_.size());
+	for(int i=0; i<clients_.size(); ++i)
+	{
+		clients_[i]->reconnect();
+	}
+}
+
+void LoadGenerator::clientConnected()
+{
+	LoadClient * client = (LoadClient*)sender();
+	// small requests are not delayed, the latency is measured
+	client->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+	if(started_)
+	{
+		// connection lost then back
+		if(rate_ <= 0)
+		{
+			while(client->outstanding() < concurrency_ && sendNext(client)) {}
+		}
+		return;
+	}
+	if(++connected_ < clients_.size())
+	{
+		return;
+	}
+
+	if(rate_ > 0)
+	{
+		UINFO("Sending %.1f requests/s over %d connections%s", rate_, clients_.size(),
+				concurrency_>0?QString(" (max %1 outstanding each)").arg(concurrency_).toStdString().c_str():"");
+	}
+	else
+	{
+		UINFO("Sending with %d requests outstanding on each of the %d connections", concurrency_, clients_.size());
+	}
+	started_ = true;
+	sending_ = true;
+	time_.start();
+	timeoutTimer_.start();
+	progressTimer_.start();
+	if(rate_ > 0)
+	{
+		sendTimer_.start();
+		sendRequests();
+	}
+	else
+	{
+		for(int i=0; i<clients_.size(); ++i)
+		{
+			while(clients_[i]->outstanding() < concurrency_ && sendNext(clients_[i])) {}
+		}
+	}
+}
+
+void LoadGenerator::connectionFailed()
+{
+	if(!started_ && !finished_)
+	{
+		// the load is measured on all connections, not on the first ones
+		UERROR("Cannot connect all clients, is the server started?");
+		finished_ = true;
+		QCoreApplication::exit(-1);
+	}
+}
+
+bool LoadGenerator::keepSending()
+{
+	if(sending_ &&
+	   ((count_ > 0 && sentCount_ + saturatedCount_ >= count_) ||
+	    (durationMs_ > 0 && time_.elapsed() >= durationMs_)))
+	{
+		UINFO("All requests sent, waiting for the last responses...");
+		sending_ = false;
+		sendTimer_.stop();
+	}
+	return sending_;
+}
+
+bool LoadGenerator::sendNext(LoadClient * client)
+{
+	if(!keepSending())
+	{
+		return false;
+	}
+	const QByteArray & payload = payloads_[int(sentCount_ % payloads_.size())];
+	if(client->send(serviceType_, payload, deadlineMs_, time_.nsecsElapsed()))
+	{
+		++sentCount_;
+		++intervalSent_;
+		return true;
+	}
+	return false;
+}
+
+bool LoadGenerator::done() const
+{
+	if(!started_ || sending_)
+	{
+		return false;
+	}
+	for(int i=0; i<clients_.size(); ++i)
+	{
+		if(clients_[i]->outstanding())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// open loop: the requests due since the start are sent, to the
+// connections in turn, late timer ticks are caught up
+void LoadGenerator::sendRequests()
+{
+	qint64 due = qint64(double(time_.nsecsElapsed()) * 1e-9 * rate_) + 1;
+	while(sentCount_ + saturatedCount_ < due && keepSending())
+	{
+		bool sent = false;
+		for(int i=0; i<clients_.size() && !sent; ++i)
+		{
+			LoadClient * client = clients_[nextClient_];
+			nextClient_ = (nextClient_+1) % clients_.size();
+			if(client->isReady() && (concurrency_ <= 0 || client->outstanding() < concurrency_))
+			{
+				sent = sendNext(client);
+			}
+		}
+		if(!sent && sending_)
+		{
+			++saturatedCount_;
+		}
+	}
+	if(done())
+	{
+		finish();
+	}
+}
+
+void LoadGenerator::receiveResponse(quint32 status, qint64 sentTime)
+{
+	if(finished_)
+	{
+		return;
+	}
+	if(sentTime < 0)
+	{
+		// already counted as timeout
+		++lateCount_;
+		return;
+	}
+	qint64 now = time_.nsecsElapsed();
+	float latency = float(double(now - sentTime) * 1e-6);
+	lastResponse_ = now;
+	++intervalDone_;
+	if(status == TcpServer::kStatusOk || status == TcpServer::kStatusDegraded)
+	{
+		if(status == TcpServer::kStatusOk)
+		{
+			++okCount_;
+		}
+		else
+		{
+			++degradedCount_;
+		}
+		latencies_.push_back(latency);
+		intervalLatencies_.push_back(latency);
+	}
+	else
+	{
+		// rejected by the server (queue full, deadline)
+		++failedCount_;
+	}
+	if(csv_.isOpen())
+	{
+		QTextStream(&csv_) << QString::number(double(sentTime)*1e-6, 'f', 3) << ","
+				<< QString::number(latency, 'f', 3) << ","
+				<< status << "\n";
+	}
+
+	if(rate_ <= 0)
+	{
+		sendNext((LoadClient*)sender());
+	}
+	if(done())
+	{
+		finish();
+	}
+}
+
+void LoadGenerator::loseRequests(int count)
+{
+	if(finished_)
+	{
+		return;
+	}
+	lostCount_ += count;
+	if(done())
+	{
+		finish();
+	}
+}
+
+void LoadGenerator::checkTimeouts()
+{
+	keepSending();
+	qint64 limit = time_.nsecsElapsed() - qint64(timeoutMs_)*1000000;
+	for(int i=0; i<clients_.size(); ++i)
+	{
+		int expired = clients_[i]->expire(limit);
+		timeoutCount_ += expired;
+		for(int j=0; rate_ <= 0 && j<expired && sendNext(clients_[i]); ++j) {}
+	}
+	if(done())
+	{
+		finish();
+	}
+}
+
+// nearest rank
+static float percentile(const std::vector<float> & sorted, double p)
+{
+	if(sorted.empty())
+	{
+		return 0.0f;
+	}
+	int i = int(std::ceil(p * sorted.size())) - 1;
+	return sorted[qBound(0, i, int(sorted.size())-1)];
+}
+
+void LoadGenerator::printProgress()
+{
+	int outstanding = 0;
+	for(int i=0; i<clients_.size(); ++i)
+	{
+		outstanding += clients_[i]->outstanding();
+	}
+	std::sort(intervalLatencies_.begin(), intervalLatencies_.end());
+	printf("%6.1f s: %lld sent, %lld answered, p50=%.1f ms p99=%.1f ms, %d outstanding\n",
+			double(time_.elapsed())/1000.0,
+			intervalSent_,
+			intervalDone_,
+			percentile(intervalLatencies_, 0.5),
+			percentile(intervalLatencies_, 0.99),
+			outstanding);
+	fflush(stdout);
+	intervalLatencies_.clear();
+	intervalSent_ = 0;
+	intervalDone_ = 0;
+}
+
+void LoadGenerator::finish()
+{
+	if(finished_)
+	{
+		return;
+	}
+	finished_ = true;
+	sendTimer_.stop();
+	timeoutTimer_.stop();
+	progressTimer_.stop();
+	printSummary();
+	if(csv_.isOpen())
+	{
+		csv_.close();
+	}
+	QCoreApplication::quit();
+}
+
+void LoadGenerator::printSummary()
+{
+	double elapsed = double(lastResponse_>0?lastResponse_:time_.nsecsElapsed()) * 1e-9;
+	std::sort(latencies_.begin(), latencies_.end());
+	double sum = 0.0;
+	for(unsigned int i=0; i<latencies_.size(); ++i)
+	{
+		sum += latencies_[i];
+	}
+
+	printf("\nRequests: %lld sent on %d connections", sentCount_, clients_.size());
+	if(rate_ > 0)
+	{
+		printf(" (%.1f/s asked, %lld not sent: no connection available)", rate_, saturatedCount_);
+	}
+	printf("\n  ok:        %lld\n"
+			"  degraded:  %lld\n"
+			"  failed:    %lld (rejected by the server)\n"
+			"  timeouts:  %lld (%lld answered later)\n"
+			"  lost:      %lld (connection closed)\n",
+			okCount_,
+			degradedCount_,
+			failedCount_,
+			timeoutCount_, lateCount_,
+			lostCount_);
+	printf("Throughput: %.2f detections/s (%.2f s)\n",
+			elapsed>0.0?double(okCount_+degradedCount_)/elapsed:0.0,
+			elapsed);
+	printf("Latency (ms) of the detections:\n"
+			"  min=%.2f mean=%.2f p50=%.2f p90=%.2f p99=%.2f p99.9=%.2f max=%.2f\n",
+			latencies_.empty()?0.0f:latencies_.front(),
+			latencies_.empty()?0.0:sum/double(latencies_.size()),
+			percentile(latencies_, 0.5),
+			percentile(latencies_, 0.9),
+			percentile(latencies_, 0.99),
+			percentile(latencies_, 0.999),
+			latencies_.empty()?0.0f:latencies_.back());
+	fflush(stdout);
+}
@@ -0,0 +1,153 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef LOADGENERATOR_H_
+#define LOADGENERATOR_H_
+
+#include <QtNetwork/QTcpSocket>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTimer>
+#include <QtCore/QFile>
+#include <QtCore/QMap>
+#include <vector>
+
+// Connection to a find_object server, all requests are sent with a
+// request ID (TcpServer::kRequestId) so that many can be outstanding
+class LoadClient : public QTcpSocket
+{
+	Q_OBJECT;
+public:
+	LoadClient(const QString & host, quint16 port, QObject * parent = 0);
+	bool isReady() const {return state() == QAbstractSocket::ConnectedState;}
+	int outstanding() const {return sent_.size();}
+	// payload starts after the request ID, sentTime in ns, returns false if not connected
+	bool send(quint32 serviceType, const QByteArray & payload, quint32 budgetMs, qint64 sentTime);
+	// requests sent before "sentTime" are forgotten, returns how many
+	int expire(qint64 sentTime);
+
+public Q_SLOTS:
+	void reconnect();
+
+private Q_SLOTS:
+	void readReceivedData();
+	void displayError(QAbstractSocket::SocketError socketError);
+	void connectionLost();
+
+Q_SIGNALS:
+	// sentTime is -1 for a response received after its timeout
+	void responseReceived(quint32 status, qint64 sentTime);
+	void requestsLost(int count);
+
+private:
+	QString host_;
+	quint16 port_;
+	quint32 blockSize_;
+	quint32 nextRequestId_;
+	QMap<quint32, qint64> sent_; // <request ID, sent time>
+};
+
+// Replays scenes to a find_object server (or a TcpServerPool, or tcpShards)
+// over many connections and measures the end-to-end latency of the
+// detections. Open loop (rate > 0): the requests are sent at a fixed rate
+// whatever the responses, "concurrency" caps the requests outstanding per
+// connection (0 = no cap). Closed loop (rate = 0): each connection keeps
+// "concurrency" requests outstanding.
+class LoadGenerator : public QObject
+{
+	Q_OBJECT;
+public:
+	LoadGenerator(const QList<QByteArray> & payloads, // requests without header, see TcpServer::Service
+			quint32 serviceType,
+			const QString & host,
+			quint16 port,
+			int connections,
+			double rate,
+			int concurrency,
+			int count,      // requests to send, 0 for "duration"
+			int durationMs,
+			int timeoutMs,
+			int deadlineMs, // time budget sent with the requests (TcpServer::kDeadline), 0 for none
+			const QString & csvPath,
+			QObject * parent = 0);
+	virtual ~LoadGenerator();
+
+	void start();
+	bool succeeded() const {return okCount_ + degradedCount_ > 0;}
+
+private Q_SLOTS:
+	void clientConnected();
+	void connectionFailed();
+	void sendRequests();
+	void receiveResponse(quint32 status, qint64 sentTime);
+	void loseRequests(int count);
+	void checkTimeouts();
+	void printProgress();
+
+private:
+	bool keepSending();
+	bool sendNext(LoadClient * client);
+	bool done() const;
+	void finish();
+	void printSummary();
+
+private:
+	QList<QByteArray> payloads_;
+	quint32 serviceType_;
+	QList<LoadClient*> clients_;
+	double rate_;
+	int concurrency_;
+	int count_;
+	int durationMs_;
+	int timeoutMs_;
+	int deadlineMs_;
+	QFile csv_;
+
+	QElapsedTimer time_;
+	QTimer sendTimer_;
+	QTimer timeoutTimer_;
+	QTimer progressTimer_;
+	bool started_;
+	bool finished_;
+	bool sending_;
+	int connected_;
+	int nextClient_;
+	qint64 sentCount_;
+	qint64 saturatedCount_; // not sent, all connections at the concurrency cap
+	qint64 okCount_;
+	qint64 degradedCount_;
+	qint64 failedCount_;
+	qint64 timeoutCount_;
+	qint64 lateCount_;
+	qint64 lostCount_;
+	qint64 lastResponse_; // ns
+	std::vector<float> latencies_; // ms of the detections done
+	std::vector<float> intervalLatencies_;
+	qint64 intervalSent_;
+	qint64 intervalDone_;
+};
+
+#endif /* LOADGENERATOR_H_ */
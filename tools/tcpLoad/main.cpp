@@ -0,0 +1,285 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <opencv2/opencv.hpp>
+#include <find_object/Settings.h>
+#include <find_object/TcpServer.h>
+#include <find_object/utilite/ULogger.h>
+#include "LoadGenerator.h"
+
+void showUsage()
+{
+	printf("\ntcpLoad [options] scenes port\n"
+			"  Load generator for a find_object server (find_object --console with General/port,\n"
+			"  tcpShards...): the images of the directory \"scenes\" (or a single image) are sent in\n"
+			"  turn with a request ID (see find_object::TcpServer::kRequestId), then the throughput\n"
+			"  and the latency of the detections are reported.\n"
+			"  Options:\n"
+			"    --host #.#.#.#          Server address (default 127.0.0.1).\n"
+			"    --connections #         Connections to the server (default 1).\n"
+			"    --rate #                Requests/s sent whatever the responses (open loop), to the\n"
+			"                             connections in turn. Default 0: each connection sends its\n"
+			"                             next request when a response is received (closed loop).\n"
+			"    --concurrency #         Requests outstanding per connection (default 1), with --rate\n"
+			"                             the maximum (default 0: no maximum).\n"
+			"    --count #               Requests to send.\n"
+			"    --duration #            Time (s) sending requests (default 10 without --count).\n"
+			"    --timeout #             Time (ms) before a request without response is counted as\n"
+			"                             timeout (default 5000).\n"
+			"    --deadline #            Time budget (ms) sent with the requests (TcpServer::kDeadline):\n"
+			"                             the server answers failed or degraded when it cannot be met.\n"
+			"    --raw                   Send the raw grayscale pixels instead of the image files.\n"
+			"    --csv \"path\"            Write the latency of each request (sent_ms,latency_ms,status).\n"
+			"    --debug                 Show debug log.\n"
+			"  Example:\n"
+			"     $ tcpLoad --connections 8 --rate 50 --duration 30 ~/scenes 5000\n");
+	exit(-1);
+}
+
+int main(int argc, char * argv[])
+{
+	QString host = "127.0.0.1";
+	int connections = 1;
+	double rate = 0.0;
+	int concurrency = -1;
+	int count = 0;
+	int duration = 0;
+	int timeout = 5000;
+	int deadline = 0;
+	bool raw = false;
+	QString csvPath;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kInfo);
+
+	if(argc < 3)
+	{
+		showUsage();
+	}
+
+	for(int i=1; i<argc-2; ++i)
+	{
+		if(strcmp(argv[i], "-debug") == 0 || strcmp(argv[i], "--debug") == 0)
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(strcmp(argv[i], "-raw") == 0 || strcmp(argv[i], "--raw") == 0)
+		{
+			raw = true;
+			continue;
+		}
+		if(i+1 >= argc-2)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		if(strcmp(argv[i], "-host") == 0 || strcmp(argv[i], "--host") == 0)
+		{
+			host = argv[++i];
+			continue;
+		}
+		if(strcmp(argv[i], "-connections") == 0 || strcmp(argv[i], "--connections") == 0)
+		{
+			connections = std::atoi(argv[++i]);
+			if(connections <= 0)
+			{
+				printf("[ERROR] connections should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-rate") == 0 || strcmp(argv[i], "--rate") == 0)
+		{
+			rate = std::atof(argv[++i]);
+			if(rate < 0.0)
+			{
+				printf("[ERROR] rate should be >= 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-concurrency") == 0 || strcmp(argv[i], "--concurrency") == 0)
+		{
+			concurrency = std::atoi(argv[++i]);
+			if(concurrency < 0)
+			{
+				printf("[ERROR] concurrency should be >= 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-count") == 0 || strcmp(argv[i], "--count") == 0)
+		{
+			count = std::atoi(argv[++i]);
+			if(count <= 0)
+			{
+				printf("[ERROR] count should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-duration") == 0 || strcmp(argv[i], "--duration") == 0)
+		{
+			duration = std::atoi(argv[++i]);
+			if(duration <= 0)
+			{
+				printf("[ERROR] duration should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-timeout") == 0 || strcmp(argv[i], "--timeout") == 0)
+		{
+			timeout = std::atoi(argv[++i]);
+			if(timeout <= 0)
+			{
+				printf("[ERROR] timeout should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-deadline") == 0 || strcmp(argv[i], "--deadline") == 0)
+		{
+			deadline = std::atoi(argv[++i]);
+			if(deadline < 0)
+			{
+				printf("[ERROR] deadline should be >= 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-csv") == 0 || strcmp(argv[i], "--csv") == 0)
+		{
+			csvPath = argv[++i];
+			continue;
+		}
+
+		printf("Unrecognized option: %s\n", argv[i]);
+		showUsage();
+	}
+
+	QString scenesPath = argv[argc-2];
+	quint16 port = std::atoi(argv[argc-1]);
+	if(port == 0)
+	{
+		printf("[ERROR] Port not valid : %s\n", argv[argc-1]);
+		showUsage();
+	}
+	if(concurrency < 0)
+	{
+		concurrency = rate > 0.0?0:1;
+	}
+	else if(concurrency == 0 && rate <= 0.0)
+	{
+		printf("[ERROR] concurrency should be > 0 without --rate\n");
+		showUsage();
+	}
+	if(count == 0 && duration == 0)
+	{
+		duration = 10;
+	}
+
+	QStringList paths;
+	if(QFileInfo(scenesPath).isDir())
+	{
+		QDir dir(scenesPath);
+		QStringList names = dir.entryList(find_object::Settings::getGeneral_imageFormats().split(' '), QDir::Files, QDir::Name);
+		for(int i=0; i<names.size(); ++i)
+		{
+			paths.push_back(dir.absoluteFilePath(names[i]));
+		}
+	}
+	else
+	{
+		paths.push_back(scenesPath);
+	}
+
+	// the requests are prepared before, only the sending is measured
+	QList<QByteArray> payloads;
+	qint64 bytes = 0;
+	for(int i=0; i<paths.size(); ++i)
+	{
+		QByteArray payload;
+		if(raw)
+		{
+			cv::Mat image = cv::imread(paths[i].toStdString(), cv::IMREAD_GRAYSCALE);
+			if(!image.empty())
+			{
+				QDataStream out(&payload, QIODevice::WriteOnly);
+				out.setVersion(QDataStream::Qt_4_0);
+				out << (qint32)image.cols << (qint32)image.rows << (qint32)image.step;
+				out.writeRawData((const char*)image.data, (int)(image.step*image.rows));
+			}
+		}
+		else
+		{
+			// the file is sent as is, decoded by the server
+			QFile file(paths[i]);
+			if(file.open(QIODevice::ReadOnly))
+			{
+				payload = file.readAll();
+			}
+		}
+		if(payload.isEmpty())
+		{
+			printf("[WARNING] Cannot read image \"%s\", ignored\n", paths[i].toStdString().c_str());
+			continue;
+		}
+		bytes += payload.size();
+		payloads.push_back(payload);
+	}
+	if(payloads.empty())
+	{
+		printf("[ERROR] No scene found in \"%s\"\n", scenesPath.toStdString().c_str());
+		return -1;
+	}
+	printf("%d scenes loaded (%.1f KB on average)\n", payloads.size(), double(bytes)/double(payloads.size())/1024.0);
+
+	QCoreApplication app(argc, argv);
+
+	LoadGenerator generator(
+			payloads,
+			raw?find_object::TcpServer::kDetectRawImage:find_object::TcpServer::kDetectObject,
+			host,
+			port,
+			connections,
+			rate,
+			concurrency,
+			count,
+			duration*1000,
+			timeout,
+			deadline,
+			csvPath);
+	generator.start();
+	int code = app.exec();
+	return code!=0?code:generator.succeeded()?0:1;
+}
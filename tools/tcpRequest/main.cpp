@@ -44,6 +44,7 @@ void showUsage()
 			"  Options:\n"
 			"    --host #.#.#.#       Set host address.\n"
 			"    --json \"path\"        Path to an output JSON file.\n"
+			"    --raw                Send the raw grayscale pixels instead of a PNG image (only with --port).\n"
 			"    --help               Show this help.\n");
 	exit(-1);
 }
@@ -56,6 +57,7 @@ int main(int argc, char * argv[])
 	quint16 portOut = 0;
 	quint16 portIn = 0;
 	quint16 bidrectionalPort = 0;
+	bool raw = false;
 
 	for(int i=1; i<argc; ++i)
 	{
@@ -145,6 +147,12 @@ int main(int argc, char * argv[])
 			continue;
 		}
 
+		if(strcmp(argv[i], "--raw") == 0 || strcmp(argv[i], "-raw") == 0)
+		{
+			raw = true;
+			continue;
+		}
+
 		if(strcmp(argv[i], "-help") == 0 ||
 		   strcmp(argv[i], "--help") == 0)
 		{
@@ -175,13 +183,18 @@ int main(int argc, char * argv[])
 		printf("Argument --scene should be set.\n");
 		showUsage();
 	}
+	else if(raw && bidrectionalPort == 0)
+	{
+		printf("Argument --raw requires --port.\n");
+		showUsage();
+	}
 
 	if(ipAddress.isEmpty())
 	{
 		ipAddress = QHostAddress(QHostAddress::LocalHost).toString();
 	}
 
-	cv::Mat image = cv::imread(scenePath.toStdString());
+	cv::Mat image = cv::imread(scenePath.toStdString(), raw?cv::IMREAD_GRAYSCALE:cv::IMREAD_COLOR);
 	if(image.empty())
 	{
 		printf("Cannot read image from \"%s\".\n", scenePath.toStdString().c_str());
@@ -226,18 +239,27 @@ int main(int argc, char * argv[])
 	}
 
 	// publish image
-	std::vector<unsigned char> buf;
-	cv::imencode(".png", image, buf);
-
 	QByteArray block;
 	QDataStream out(&block, QIODevice::WriteOnly);
 	out.setVersion(QDataStream::Qt_4_0);
 	out << (quint64)0;
-	if(bidrectionalPort)
+	if(raw)
 	{
-		out << (quint32)find_object::TcpServer::kDetectObject;
+		// no codec
+		out << (quint32)find_object::TcpServer::kDetectRawImage;
+		out << (qint32)image.cols << (qint32)image.rows << (qint32)image.step;
+		out.writeRawData((const char*)image.data, (int)(image.step*image.rows));
+	}
+	else
+	{
+		std::vector<unsigned char> buf;
+		cv::imencode(".png", image, buf);
+		if(bidrectionalPort)
+		{
+			out << (quint32)find_object::TcpServer::kDetectObject;
+		}
+		out.writeRawData((char*)buf.data(), (int)buf.size());
 	}
-	out.writeRawData((char*)buf.data(), (int)buf.size());
 	out.device()->seek(0);
 	out << (quint64)(block.size() - sizeof(quint64));
 
@@ -0,0 +1,513 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "ShardCoordinator.h"
+
+#include <find_object/Settings.h>
+#include <find_object/utilite/ULogger.h>
+#include <QtCore/QDateTime>
+
+using find_object::TcpServer;
+using find_object::DetectionInfo;
+
+ShardClient::ShardClient(const QString & host, quint16 port, int resultFormat, QObject * parent) :
+	QTcpSocket(parent),
+	host_(host),
+	port_(port),
+	resultFormat_(resultFormat),
+	blockSize_(0),
+	nextRequestId_(1)
+{
+	connect(this, SIGNAL(readyRead()), this, SLOT(readReceivedData()));
+	connect(this, SIGNAL(error(QAbstractSocket::SocketError)), this, SLOT(displayError(QAbstractSocket::SocketError)));
+}
+
+// [quint64 size][quint32 service type | kRequestId (| kDeadline)][quint32 request ID]([quint32 budget])[payload]
+quint32 ShardClient::send(quint32 serviceType, const QByteArray & payload, qint64 deadline)
+{
+	if(!isReady())
+	{
+		return 0;
+	}
+	quint32 requestId = nextRequestId_++;
+	if(nextRequestId_ == 0)
+	{
+		nextRequestId_ = 1;
+	}
+	QByteArray header;
+	QDataStream out(&header, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << (quint64)0;
+	if(deadline > 0)
+	{
+		qint64 budget = deadline - QDateTime::currentMSecsSinceEpoch();
+		out << (quint32)(serviceType | TcpServer::kRequestId | TcpServer::kDeadline) << requestId << (quint32)(budget>0?budget:0);
+	}
+	else
+	{
+		out << (quint32)(serviceType | TcpServer::kRequestId) << requestId;
+	}
+	out.device()->seek(0);
+	out << (quint64)(header.size() - sizeof(quint64) + payload.size());
+	write(header);
+	write(payload);
+	return requestId;
+}
+
+void ShardClient::reconnect()
+{
+	if(state() == QAbstractSocket::UnconnectedState)
+	{
+		blockSize_ = 0;
+		connectToHost(host_, port_);
+	}
+}
+
+// [quint32 size][quint32 request ID][quint32 status][DetectionInfo, only for detections done]
+void ShardClient::readReceivedData()
+{
+	QDataStream in(this);
+	in.setVersion(QDataStream::Qt_4_0);
+	while(true)
+	{
+		if(blockSize_ == 0)
+		{
+			if(bytesAvailable() < (int)sizeof(quint32))
+			{
+				return;
+			}
+			in >> blockSize_;
+		}
+		if(bytesAvailable() < blockSize_)
+		{
+			return;
+		}
+		QByteArray block = read(blockSize_);
+		blockSize_ = 0;
+
+		QDataStream blockIn(block);
+		blockIn.setVersion(QDataStream::Qt_4_0);
+		quint32 requestId, status;
+		blockIn >> requestId >> status;
+		DetectionInfo info;
+		if(!blockIn.atEnd())
+		{
+			if(resultFormat_ == TcpServer::kResultQDataStream)
+			{
+				blockIn >> info;
+			}
+			else if(!find_object::readCompactDetectionInfo(blockIn, info))
+			{
+				UERROR("Shard %s: detection not valid, check the result format", name().toStdString().c_str());
+				status = TcpServer::kStatusFailed;
+			}
+		}
+		Q_EMIT responseReceived(requestId, status, info);
+	}
+}
+
+void ShardClient::displayError(QAbstractSocket::SocketError socketError)
+{
+	if(socketError == QAbstractSocket::RemoteHostClosedError)
+	{
+		UWARN("Shard %s: connection lost", name().toStdString().c_str());
+	}
+	else
+	{
+		UWARN("Shard %s: %s", name().toStdString().c_str(), errorString().toStdString().c_str());
+	}
+	// try again until the shard is back
+	QTimer::singleShot(1000, this, SLOT(reconnect()));
+}
+
+ShardCoordinator::ShardCoordinator(const QList<QStringList> & shards, quint16 port, int shardsResultFormat, int timeoutMs, int firstObjectId, QObject * parent) :
+	QObject(parent),
+	findObject_(false),
+	server_(0),
+	timeoutMs_(timeoutMs),
+	nextObjectId_(firstObjectId),
+	nextQueryId_(0)
+{
+	UASSERT(shards.size() > 0);
+	UASSERT(timeoutMs > 0);
+
+	// the descriptors are sent to the shards
+	findObject_.setParameter(find_object::Settings::kGeneral_gpuPipeline(), false);
+
+	for(int i=0; i<shards.size(); ++i)
+	{
+		QList<ShardClient*> replicas;
+		for(int j=0; j<shards[i].size(); ++j)
+		{
+			QStringList hostPort = shards[i][j].split(':');
+			if(hostPort.size() != 2 || hostPort[1].toInt() <= 0)
+			{
+				UERROR("Shard %d: replica \"%s\" not valid (should be host:port)", i, shards[i][j].toStdString().c_str());
+				continue;
+			}
+			ShardClient * replica = new ShardClient(hostPort[0], hostPort[1].toInt(), shardsResultFormat, this);
+			connect(replica, SIGNAL(responseReceived(quint32, quint32, const find_object::DetectionInfo &)), this, SLOT(receiveResponse(quint32, quint32, const find_object::DetectionInfo &)));
+			connect(replica, SIGNAL(disconnected()), this, SLOT(replicaLost()));
+			replica->reconnect();
+			replicas.push_back(replica);
+		}
+		UASSERT(replicas.size() > 0);
+		shards_.push_back(replicas);
+	}
+
+	server_ = new TcpServer(port, this);
+	UINFO("Coordinator of %d shards on port: %d (IP=%s)",
+			shards_.size(),
+			server_->getPort(),
+			server_->getHostAddress().toString().toStdString().c_str());
+
+	connect(server_, SIGNAL(detectObject(const cv::Mat &)), this, SLOT(detect(const cv::Mat &)));
+	connect(server_, SIGNAL(detectObject(const cv::Mat &, qint64, qint64)), this, SLOT(detect(const cv::Mat &, qint64, qint64)));
+	connect(server_, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)), this, SLOT(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &)));
+	connect(server_, SIGNAL(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)), this, SLOT(detectFeatures(const std::vector<cv::KeyPoint> &, const cv::Mat &, const cv::Size &, qint64, qint64)));
+	connect(server_, SIGNAL(addObject(const cv::Mat &, int, const QString &)), this, SLOT(addObject(const cv::Mat &, int, const QString &)));
+	connect(server_, SIGNAL(removeObject(int)), this, SLOT(removeObject(int)));
+
+	connect(&timeoutTimer_, SIGNAL(timeout()), this, SLOT(checkTimeouts()));
+	timeoutTimer_.start(qMax(10, qMin(100, timeoutMs_/4)));
+}
+
+ShardCoordinator::~ShardCoordinator()
+{
+}
+
+void ShardCoordinator::detect(const cv::Mat & image)
+{
+	detect(image, -1, 0);
+}
+
+void ShardCoordinator::detect(const cv::Mat & image, qint64 ticket, qint64 deadline)
+{
+	// without objects, only the features of the scene are extracted
+	DetectionInfo info;
+	findObject_.detectUntracked(image, info);
+	scatter(info.sceneKeypoints_, info.sceneDescriptors_, cv::Size(image.cols, image.rows), ticket, deadline, info);
+}
+
+void ShardCoordinator::detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize)
+{
+	detectFeatures(keypoints, descriptors, imageSize, -1, 0);
+}
+
+void ShardCoordinator::detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline)
+{
+	DetectionInfo info;
+	info.sceneKeypoints_ = keypoints;
+	info.sceneDescriptors_ = descriptors;
+	scatter(keypoints, descriptors, imageSize, ticket, deadline, info);
+}
+
+void ShardCoordinator::scatter(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline, DetectionInfo & info)
+{
+	qint64 queryId = nextQueryId_++;
+	Query & query = queries_[queryId];
+	query.ticket = ticket;
+	query.deadline = deadline;
+	query.replicas.fill(int(queryId % 0x10000) - 1, shards_.size()); // replicas used in turn
+	query.tries.fill(0, shards_.size());
+	query.done.fill(false, shards_.size());
+	query.sent.resize(shards_.size());
+	query.remaining = shards_.size();
+	query.answered = 0;
+	query.degraded = false;
+	query.time.start();
+	query.info.sceneKeypoints_ = info.sceneKeypoints_;
+	query.info.timeStamps_ = info.timeStamps_;
+
+	if(descriptors.empty() || (int)keypoints.size() != descriptors.rows ||
+	   (descriptors.type() != CV_8UC1 && descriptors.type() != CV_32FC1))
+	{
+		// nothing to match, answered without the shards
+		UDEBUG("No features in the scene");
+		query.answered = shards_.size();
+		query.remaining = 1;
+		shardDone(queryId, 0);
+		return;
+	}
+
+	// kDetectFeatures request, same for all shards
+	QDataStream out(&query.payload, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << (qint32)imageSize.width << (qint32)imageSize.height << (qint32)keypoints.size();
+	for(unsigned int i=0; i<keypoints.size(); ++i)
+	{
+		out << keypoints[i].pt.x <<
+			   keypoints[i].pt.y <<
+			   keypoints[i].size <<
+			   keypoints[i].angle <<
+			   keypoints[i].response <<
+			   (qint32)keypoints[i].octave <<
+			   (qint32)keypoints[i].class_id;
+	}
+	cv::Mat data = descriptors.isContinuous()?descriptors:descriptors.clone();
+	out << (qint32)data.rows << (qint32)data.cols << (qint32)data.type();
+	out.writeRawData((const char*)data.data, int(data.total()*data.elemSize()));
+
+	for(int shard=0; shard<shards_.size() && queries_.contains(queryId); ++shard)
+	{
+		sendToShard(queryId, shard);
+	}
+}
+
+void ShardCoordinator::sendToShard(qint64 queryId, int shard)
+{
+	Query & query = queries_[queryId];
+	const QList<ShardClient*> & replicas = shards_[shard];
+	bool late = query.deadline > 0 && QDateTime::currentMSecsSinceEpoch() >= query.deadline;
+	while(!late && query.tries[shard] < replicas.size())
+	{
+		int replica = (query.replicas[shard] + 1) % replicas.size();
+		query.replicas[shard] = replica;
+		++query.tries[shard];
+		quint32 requestId = replicas[replica]->send(TcpServer::kDetectFeatures, query.payload, query.deadline);
+		if(requestId)
+		{
+			Request request = {queryId, shard};
+			requests_.insert(QPair<ShardClient*, quint32>(replicas[replica], requestId), request);
+			query.sent[shard].start();
+			return;
+		}
+	}
+	UWARN("Shard %d: no replica answered%s, the detection is partial", shard, late?" before the deadline":"");
+	shardDone(queryId, shard);
+}
+
+void ShardCoordinator::shardDone(qint64 queryId, int shard)
+{
+	QMap<qint64, Query>::iterator iter = queries_.find(queryId);
+	if(iter == queries_.end() || iter.value().done[shard])
+	{
+		return;
+	}
+	Query & query = iter.value();
+	query.done[shard] = true;
+	if(--query.remaining > 0)
+	{
+		return;
+	}
+
+	query.info.timeStamps_.insert(DetectionInfo::kTimeTotal, query.time.elapsed());
+	UINFO("Detection: %d objects found by %d/%d shards (%d ms)",
+			query.info.objDetected_.size(),
+			query.answered,
+			shards_.size(),
+			query.time.elapsed());
+	if(query.ticket >= 0)
+	{
+		if(query.answered)
+		{
+			server_->publishResult(query.info, query.ticket, query.degraded);
+		}
+		else
+		{
+			server_->rejectRequest(query.ticket);
+		}
+	}
+	else if(query.answered)
+	{
+		server_->publishDetectionInfo(query.info);
+	}
+	queries_.erase(iter);
+}
+
+// The objects of the shards are disjoint, their detections are put together.
+// The inliers refer to the same scene keypoints (sent by the coordinator).
+static void mergeDetections(DetectionInfo & merged, const DetectionInfo & info)
+{
+	QMultiMap<int, QSize>::const_iterator iterSizes = info.objDetectedSizes_.constBegin();
+	QMultiMap<int, QString>::const_iterator iterFilePaths = info.objDetectedFilePaths_.constBegin();
+	QMultiMap<int, int>::const_iterator iterInliers = info.objDetectedInliersCount_.constBegin();
+	QMultiMap<int, int>::const_iterator iterOutliers = info.objDetectedOutliersCount_.constBegin();
+	for(QMultiMap<int, QTransform>::const_iterator iter=info.objDetected_.constBegin();
+		iter!=info.objDetected_.constEnd();
+		++iter, ++iterSizes, ++iterFilePaths, ++iterInliers, ++iterOutliers)
+	{
+		merged.objDetected_.insert(iter.key(), iter.value());
+		merged.objDetectedSizes_.insert(iter.key(), iterSizes.value());
+		merged.objDetectedFilePaths_.insert(iter.key(), iterFilePaths.value());
+		merged.objDetectedInliersCount_.insert(iter.key(), iterInliers.value());
+		merged.objDetectedOutliersCount_.insert(iter.key(), iterOutliers.value());
+	}
+	const find_object::DetectionMatches & inliers = info.objDetectedInliers_;
+	for(int g=0; g<inliers.groups(); ++g)
+	{
+		merged.objDetectedInliers_.addGroup(inliers.id(g));
+		for(int i=inliers.groupBegin(g); i<inliers.groupBegin(g)+inliers.groupSize(g); ++i)
+		{
+			merged.objDetectedInliers_.append(inliers.objectIndex(i), inliers.sceneIndex(i));
+		}
+	}
+}
+
+void ShardCoordinator::receiveResponse(quint32 requestId, quint32 status, const DetectionInfo & info)
+{
+	ShardClient * replica = (ShardClient*)sender();
+	QMap<QPair<ShardClient*, quint32>, Request>::iterator iter = requests_.find(QPair<ShardClient*, quint32>(replica, requestId));
+	if(iter == requests_.end())
+	{
+		// object added/removed, or detection answered after the timeout
+		if(status == TcpServer::kStatusFailed)
+		{
+			UWARN("Shard %s: request %u failed", replica->name().toStdString().c_str(), requestId);
+		}
+		return;
+	}
+	Request request = iter.value();
+	requests_.erase(iter);
+	if(!queries_.contains(request.query))
+	{
+		return;
+	}
+
+	if(status == TcpServer::kStatusFailed)
+	{
+		// rejected (queue full, deadline), asked to the next replica
+		UDEBUG("Shard %s: detection rejected", replica->name().toStdString().c_str());
+		sendToShard(request.query, request.shard);
+		return;
+	}
+	Query & query = queries_[request.query];
+	mergeDetections(query.info, info);
+	++query.answered;
+	query.degraded = query.degraded || status == TcpServer::kStatusDegraded;
+	shardDone(request.query, request.shard);
+}
+
+void ShardCoordinator::replicaLost()
+{
+	ShardClient * replica = (ShardClient*)sender();
+	QList<Request> lost;
+	for(QMap<QPair<ShardClient*, quint32>, Request>::iterator iter=requests_.begin(); iter!=requests_.end();)
+	{
+		if(iter.key().first == replica)
+		{
+			lost.push_back(iter.value());
+			iter = requests_.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	for(int i=0; i<lost.size(); ++i)
+	{
+		if(queries_.contains(lost[i].query))
+		{
+			sendToShard(lost[i].query, lost[i].shard);
+		}
+	}
+}
+
+void ShardCoordinator::checkTimeouts()
+{
+	QList<Request> late;
+	for(QMap<QPair<ShardClient*, quint32>, Request>::iterator iter=requests_.begin(); iter!=requests_.end();)
+	{
+		QMap<qint64, Query>::iterator query = queries_.find(iter.value().query);
+		if(query == queries_.end())
+		{
+			iter = requests_.erase(iter);
+		}
+		else if(query.value().sent[iter.value().shard].elapsed() > timeoutMs_ ||
+				(query.value().deadline > 0 && QDateTime::currentMSecsSinceEpoch() >= query.value().deadline))
+		{
+			UDEBUG("Shard %s: no answer after %d ms", iter.key().first->name().toStdString().c_str(), query.value().sent[iter.value().shard].elapsed());
+			late.push_back(iter.value());
+			iter = requests_.erase(iter);
+		}
+		else
+		{
+			++iter;
+		}
+	}
+	for(int i=0; i<late.size(); ++i)
+	{
+		if(queries_.contains(late[i].query))
+		{
+			sendToShard(late[i].query, late[i].shard);
+		}
+	}
+}
+
+void ShardCoordinator::addObject(const cv::Mat & image, int id, const QString & filePath)
+{
+	if(id <= 0)
+	{
+		id = nextObjectId_;
+	}
+	nextObjectId_ = qMax(nextObjectId_, id+1);
+
+	std::vector<unsigned char> bytes;
+	cv::imencode(".png", image, bytes);
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << id << filePath << (quint64)bytes.size();
+	out.writeRawData((const char*)bytes.data(), (int)bytes.size());
+
+	// on all replicas of the shard
+	int shard = id % shards_.size();
+	int added = 0;
+	for(int i=0; i<shards_[shard].size(); ++i)
+	{
+		if(shards_[shard][i]->send(TcpServer::kAddObject, payload))
+		{
+			++added;
+		}
+		else
+		{
+			UWARN("Shard %d: replica %s not connected, object %d is not added to it", shard, shards_[shard][i]->name().toStdString().c_str(), id);
+		}
+	}
+	UINFO("Object %d added to shard %d (%d/%d replicas)", id, shard, added, shards_[shard].size());
+}
+
+void ShardCoordinator::removeObject(int id)
+{
+	// shards may have been loaded with other objects than "id % shards"
+	QByteArray payload;
+	QDataStream out(&payload, QIODevice::WriteOnly);
+	out.setVersion(QDataStream::Qt_4_0);
+	out << id;
+	for(int i=0; i<shards_.size(); ++i)
+	{
+		for(int j=0; j<shards_[i].size(); ++j)
+		{
+			if(!shards_[i][j]->send(TcpServer::kRemoveObject, payload))
+			{
+				UWARN("Shard %d: replica %s not connected, object %d is not removed from it", i, shards_[i][j]->name().toStdString().c_str(), id);
+			}
+		}
+	}
+	UINFO("Object %d removed", id);
+}
@@ -0,0 +1,142 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef SHARDCOORDINATOR_H_
+#define SHARDCOORDINATOR_H_
+
+#include <find_object/FindObject.h>
+#include <find_object/TcpServer.h>
+#include <find_object/DetectionInfo.h>
+
+#include <QtNetwork/QTcpSocket>
+#include <QtCore/QTimer>
+#include <QtCore/QTime>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+// Connection to a shard server (find_object --console with General/port),
+// all requests are sent with a request ID (TcpServer::kRequestId)
+class ShardClient : public QTcpSocket
+{
+	Q_OBJECT;
+public:
+	ShardClient(const QString & host, quint16 port, int resultFormat, QObject * parent = 0);
+	QString name() const {return QString("%1:%2").arg(host_).arg(port_);}
+	bool isReady() const {return state() == QAbstractSocket::ConnectedState;}
+	// [quint32 service type][quint32 request ID][payload], returns the request ID or 0 if not connected
+	quint32 send(quint32 serviceType, const QByteArray & payload, qint64 deadline = 0);
+
+public Q_SLOTS:
+	void reconnect();
+
+private Q_SLOTS:
+	void readReceivedData();
+	void displayError(QAbstractSocket::SocketError socketError);
+
+Q_SIGNALS:
+	void responseReceived(quint32 requestId, quint32 status, const find_object::DetectionInfo & info);
+
+private:
+	QString host_;
+	quint16 port_;
+	int resultFormat_; // General/portResultFormat of the shard
+	quint32 blockSize_;
+	quint32 nextRequestId_;
+};
+
+// Scatter-gather over shard servers each having a subset of the objects:
+// features of the scenes are extracted once here, sent to a replica of
+// each shard (TcpServer::kDetectFeatures), then the detections of all
+// shards are merged and sent back to the clients. The clients connect to
+// this coordinator with the same protocol as a find_object server.
+// Objects added are routed to the shard "id % shards", to all its replicas.
+// A shard not answering (disconnected, failed status or timeout) is asked
+// again on its next replica, the result is partial when none answers.
+class ShardCoordinator : public QObject
+{
+	Q_OBJECT;
+public:
+	// shards: "host:port" of the replicas of each shard
+	ShardCoordinator(const QList<QStringList> & shards, quint16 port, int shardsResultFormat, int timeoutMs, int firstObjectId = 1, QObject * parent = 0);
+	virtual ~ShardCoordinator();
+
+	const find_object::TcpServer * server() const {return server_;}
+
+private Q_SLOTS:
+	void detect(const cv::Mat & image);
+	void detect(const cv::Mat & image, qint64 ticket, qint64 deadline);
+	void detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize);
+	void detectFeatures(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline);
+	void addObject(const cv::Mat & image, int id, const QString & filePath);
+	void removeObject(int id);
+	void receiveResponse(quint32 requestId, quint32 status, const find_object::DetectionInfo & info);
+	void replicaLost();
+	void checkTimeouts();
+
+private:
+	// A detection waiting for the shards
+	struct Query
+	{
+		qint64 ticket; // of the client, -1 if the result is published to all clients
+		qint64 deadline;
+		QByteArray payload; // kDetectFeatures request
+		find_object::DetectionInfo info; // scene features, then the merged detections
+		QVector<int> replicas; // replica asked last for each shard
+		QVector<int> tries; // replicas asked for each shard
+		QVector<bool> done; // shard answered or unavailable
+		QVector<QTime> sent;
+		int remaining;
+		int answered;
+		bool degraded;
+		QTime time;
+	};
+	struct Request
+	{
+		qint64 query;
+		int shard;
+	};
+
+private:
+	void scatter(const std::vector<cv::KeyPoint> & keypoints, const cv::Mat & descriptors, const cv::Size & imageSize, qint64 ticket, qint64 deadline, find_object::DetectionInfo & info);
+	void sendToShard(qint64 queryId, int shard);
+	void shardFailed(qint64 queryId, int shard);
+	void shardDone(qint64 queryId, int shard);
+
+private:
+	find_object::FindObject findObject_; // features extraction only, no objects
+	find_object::TcpServer * server_;
+	QList<QList<ShardClient*> > shards_;
+	int timeoutMs_;
+	int nextObjectId_;
+	qint64 nextQueryId_;
+	QMap<qint64, Query> queries_;
+	QMap<QPair<ShardClient*, quint32>, Request> requests_; // sent, waiting for the response
+	QTimer timeoutTimer_;
+};
+
+#endif /* SHARDCOORDINATOR_H_ */
@@ -0,0 +1,184 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QStringList>
+#include <find_object/Settings.h>
+#include <find_object/utilite/ULogger.h>
+#include "ShardCoordinator.h"
+
+void showUsage()
+{
+	printf("\ntcpShards [options] port\n"
+			"  Coordinator of find_object servers each having a part of the objects (shards):\n"
+			"  the features of the scenes received on \"port\" are extracted once, sent to all\n"
+			"  shards, and their detections are merged. Clients use the same protocol as with a\n"
+			"  single server (see find_object::TcpServer). Start each shard with the same\n"
+			"  \"Feature2D\" parameters, e.g.:\n"
+			"     $ find_object --console --session shard0.bin --tcp_single_port --tcp_threads 4 --General/port 5000\n"
+			"  Options:\n"
+			"    --shard \"host:port,...\" A shard, with the address of each of its replicas (the\n"
+			"                             same objects, e.g. the same session). Repeat for each shard.\n"
+			"                             A detection is sent to one replica of each shard in turn,\n"
+			"                             objects added are sent to all replicas of the shard\n"
+			"                             \"id %% shards\", objects removed to all shards.\n"
+			"    --shards_format #       \"General/portResultFormat\" of the shards (default 0). Use 2\n"
+			"                             to get the inliers of the detections.\n"
+			"    --timeout #             Time (ms) for a shard to answer before the next replica is\n"
+			"                             asked (default 1000). Without answer, the result is partial.\n"
+			"    --first_id #            ID of the first object added without ID (default 1).\n"
+			"    --config \"path\"         Configuration file (\"Feature2D\" parameters of the shards).\n"
+			"    --My/Parameter \"value\"  Set a parameter (e.g. --Feature2D/3MaxFeatures 1000).\n"
+			"    --debug                 Show debug log.\n"
+			"  Example:\n"
+			"     $ tcpShards --shard host1:5000,host2:5000 --shard host3:5000,host4:5000 4000\n");
+	exit(-1);
+}
+
+int main(int argc, char * argv[])
+{
+	QList<QStringList> shards;
+	int shardsFormat = 0;
+	int timeout = 1000;
+	int firstId = 1;
+	QString configPath;
+	find_object::ParametersMap customParameters;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kInfo);
+
+	if(argc < 2)
+	{
+		showUsage();
+	}
+
+	for(int i=1; i<argc-1; ++i)
+	{
+		if(strcmp(argv[i], "-debug") == 0 || strcmp(argv[i], "--debug") == 0)
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(i+1 >= argc-1)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		if(strcmp(argv[i], "-shard") == 0 || strcmp(argv[i], "--shard") == 0)
+		{
+			shards.push_back(QString(argv[++i]).split(',', QString::SkipEmptyParts));
+			for(int j=0; j<shards.back().size(); ++j)
+			{
+				QStringList hostPort = shards.back()[j].split(':');
+				if(hostPort.size() != 2 || hostPort[1].toInt() <= 0)
+				{
+					printf("[ERROR] Replica not valid (should be host:port) : %s\n", shards.back()[j].toStdString().c_str());
+					showUsage();
+				}
+			}
+			if(shards.back().empty())
+			{
+				printf("[ERROR] Shard without replica : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-shards_format") == 0 || strcmp(argv[i], "--shards_format") == 0)
+		{
+			shardsFormat = std::atoi(argv[++i]);
+			if(shardsFormat < 0 || shardsFormat > 2)
+			{
+				printf("[ERROR] shards_format should be 0, 1 or 2 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-timeout") == 0 || strcmp(argv[i], "--timeout") == 0)
+		{
+			timeout = std::atoi(argv[++i]);
+			if(timeout <= 0)
+			{
+				printf("[ERROR] timeout should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-first_id") == 0 || strcmp(argv[i], "--first_id") == 0)
+		{
+			firstId = std::atoi(argv[++i]);
+			if(firstId <= 0)
+			{
+				printf("[ERROR] first_id should be > 0 : %s\n", argv[i]);
+				showUsage();
+			}
+			continue;
+		}
+		if(strcmp(argv[i], "-config") == 0 || strcmp(argv[i], "--config") == 0)
+		{
+			configPath = argv[++i];
+			continue;
+		}
+
+		// parameters
+		QString name = argv[i];
+		if(name.startsWith("--") && find_object::Settings::getDefaultParameters().contains(name.mid(2)))
+		{
+			customParameters.insert(name.mid(2), argv[++i]);
+			continue;
+		}
+
+		printf("Unrecognized option: %s\n", argv[i]);
+		showUsage();
+	}
+
+	quint16 port = std::atoi(argv[argc-1]);
+	if(shards.empty())
+	{
+		printf("[ERROR] At least one --shard should be set!\n");
+		showUsage();
+	}
+
+	QCoreApplication app(argc, argv);
+
+	if(!configPath.isEmpty())
+	{
+		find_object::Settings::init(configPath);
+	}
+	for(find_object::ParametersMap::iterator iter=customParameters.begin(); iter!=customParameters.end(); ++iter)
+	{
+		find_object::Settings::setParameter(iter.key(), iter.value());
+	}
+
+	ShardCoordinator coordinator(shards, port, shardsFormat, timeout, firstId);
+	if(!coordinator.server()->isListening())
+	{
+		printf("ERROR: Unable to listen on port %d\n", port);
+		return -1;
+	}
+	return app.exec();
+}
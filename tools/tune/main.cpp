@@ -0,0 +1,516 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <opencv2/opencv.hpp>
+#include <find_object/FindObject.h>
+#include <find_object/Settings.h>
+#include <find_object/DetectionMetrics.h>
+#include <find_object/utilite/ULogger.h>
+#include <algorithm>
+
+void showUsage()
+{
+	printf("\nfind_object-tune [options] --labels path (--session path | --objects path)\n"
+			"  Detect the labeled scenes for each combination of the parameter values swept,\n"
+			"  then report the latency (mean and p95 of the detections in ms), the recall and\n"
+			"  the precision of each combination as CSV. The combinations on the Pareto front\n"
+			"  of latency vs recall are marked, the fastest of them reaching --min_recall is\n"
+			"  chosen (or the one with the best recall) and its parameters can be saved.\n"
+			"  Options:\n"
+			"    --labels \"path\"         Labeled scenes, a line per scene: \"image,id id ...\" with the\n"
+			"                              IDs of the objects in the image (none if empty). Paths are\n"
+			"                              relative to the labels file, lines starting with # ignored.\n"
+			"    --session \"path\"        Session to load (objects and parameters).\n"
+			"    --objects \"path\"        Directory of objects to load.\n"
+			"    --config \"path\"         Parameters file (*.ini) loaded before the session or objects.\n"
+			"    --sweep \"Key=a,b,c\"     Values of a parameter to sweep, repeat for each parameter (all\n"
+			"                              combinations are tested). Values of list parameters are set\n"
+			"                              by name (e.g. \"NearestNeighbor/1Strategy=KDTree,Lsh\"). Default:\n"
+			"                              NearestNeighbor/search_checks=16,32,64,128 and\n"
+			"                              Feature2D/3MaxFeatures=250,500,1000.\n"
+			"    --max_combinations #    Maximum combinations tested (default 200).\n"
+			"    --iterations #          Passes over all scenes per combination (default 1).\n"
+			"    --warmup #              Passes not measured before each combination (default 1).\n"
+			"    --min_recall #          Recall [0,1] to reach with the chosen combination (default 0.9).\n"
+			"    --ini \"path\"            Save the parameters with the chosen combination to this file.\n"
+			"    --output \"path\"         Write results to a file instead of stdout.\n"
+			"    --debug                 Show debug log.\n"
+			"    --help                  Show this help.\n"
+			"  The scenes are detected independently: General/roiTracking, Homography/opticalFlowTracking\n"
+			"  and General/frameChangeThreshold are not used while tuning.\n"
+			"  Example:\n"
+			"    $ find_object-tune --session objects.bin --labels scenes/labels.csv \\\n"
+			"             --sweep NearestNeighbor/search_checks=8,16,32,64 --sweep Feature2D/3MaxFeatures=300,600,1200 \\\n"
+			"             --min_recall 0.95 --ini tuned.ini --output tune.csv\n");
+	exit(-1);
+}
+
+// "index:a;b;c" parameters are set by name
+bool isListParameter(const QString & key)
+{
+	QStringList split = find_object::Settings::getDefaultParameters().value(key).toString().split(':');
+	return find_object::Settings::getParametersType().value(key).compare("QString") == 0 &&
+			split.size() == 2 && split.last().contains(';');
+}
+
+bool setParameter(const QString & key, const QString & value)
+{
+	if(!isListParameter(key))
+	{
+		find_object::Settings::setParameter(key, value);
+		return true;
+	}
+	QStringList split = find_object::Settings::getParameter(key).toString().split(':');
+	QStringList values = split.last().split(';');
+	int index = values.indexOf(value);
+	if(index < 0)
+	{
+		printf("\"%s\" is not a value of %s (%s)\n", value.toStdString().c_str(), key.toStdString().c_str(), split.last().toStdString().c_str());
+		return false;
+	}
+	find_object::Settings::setParameter(key, QString("%1:%2").arg(index).arg(split.last()));
+	return true;
+}
+
+class Scene
+{
+public:
+	QString path;
+	cv::Mat image;
+	QSet<int> ids; // objects in the image
+};
+
+bool loadLabels(const QString & path, QList<Scene> & scenes)
+{
+	QFile file(path);
+	if(!file.open(QIODevice::ReadOnly | QIODevice::Text))
+	{
+		printf("Cannot open labels \"%s\"\n", path.toStdString().c_str());
+		return false;
+	}
+	QDir dir = QFileInfo(path).absoluteDir();
+	QTextStream in(&file);
+	int lineNumber = 0;
+	while(!in.atEnd())
+	{
+		QString line = in.readLine().trimmed();
+		++lineNumber;
+		if(line.isEmpty() || line.startsWith('#'))
+		{
+			continue;
+		}
+		int comma = line.lastIndexOf(',');
+		Scene scene;
+		scene.path = dir.absoluteFilePath(comma<0?line:line.left(comma).trimmed());
+		QStringList ids = comma<0?QStringList():line.mid(comma+1).split(' ', QString::SkipEmptyParts);
+		for(int i=0; i<ids.size(); ++i)
+		{
+			bool ok = false;
+			int id = ids[i].toInt(&ok);
+			if(!ok)
+			{
+				printf("%s:%d: object ID \"%s\" not valid\n", path.toStdString().c_str(), lineNumber, ids[i].toStdString().c_str());
+				return false;
+			}
+			scene.ids.insert(id);
+		}
+		scene.image = cv::imread(scene.path.toStdString());
+		if(scene.image.empty())
+		{
+			printf("%s:%d: cannot read image \"%s\"\n", path.toStdString().c_str(), lineNumber, scene.path.toStdString().c_str());
+			return false;
+		}
+		scenes.push_back(scene);
+	}
+	return true;
+}
+
+class Axis
+{
+public:
+	QString key;
+	QStringList values;
+};
+
+class Result
+{
+public:
+	Result() : truePositives(0), falsePositives(0), labeled(0), pareto(false), chosen(false) {}
+	QStringList values; // of the axes
+	find_object::LatencyHistogram latency; // of the detections
+	int truePositives;
+	int falsePositives;
+	int labeled;
+	bool pareto;
+	bool chosen;
+
+	double meanLatency() const {return latency.count()?latency.sum()/double(latency.count()):0.0;}
+	double recall() const {return labeled?double(truePositives)/double(labeled):1.0;}
+	double precision() const {return truePositives+falsePositives?double(truePositives)/double(truePositives+falsePositives):1.0;}
+};
+
+int main(int argc, char * argv[])
+{
+	QString labelsPath;
+	QString sessionPath;
+	QString objectsPath;
+	QString configPath;
+	QString iniPath;
+	QString outputPath;
+	QList<Axis> axes;
+	int maxCombinations = 200;
+	int iterations = 1;
+	int warmup = 1;
+	double minRecall = 0.9;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kWarning);
+
+	for(int i=1; i<argc; ++i)
+	{
+		QString arg = argv[i];
+		if(arg == "--help" || arg == "-help")
+		{
+			showUsage();
+		}
+		if(arg == "--debug" || arg == "-debug")
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(i+1 >= argc)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		++i;
+		if(arg == "--labels" || arg == "-labels") labelsPath = argv[i];
+		else if(arg == "--session" || arg == "-session") sessionPath = argv[i];
+		else if(arg == "--objects" || arg == "-objects") objectsPath = argv[i];
+		else if(arg == "--config" || arg == "-config") configPath = argv[i];
+		else if(arg == "--ini" || arg == "-ini") iniPath = argv[i];
+		else if(arg == "--output" || arg == "-output") outputPath = argv[i];
+		else if(arg == "--max_combinations" || arg == "-max_combinations") maxCombinations = atoi(argv[i]);
+		else if(arg == "--iterations" || arg == "-iterations") iterations = atoi(argv[i]);
+		else if(arg == "--warmup" || arg == "-warmup") warmup = atoi(argv[i]);
+		else if(arg == "--min_recall" || arg == "-min_recall") minRecall = atof(argv[i]);
+		else if(arg == "--sweep" || arg == "-sweep")
+		{
+			QString sweep = argv[i];
+			int equal = sweep.indexOf('=');
+			Axis axis;
+			axis.key = sweep.left(equal);
+			axis.values = sweep.mid(equal+1).split(',', QString::SkipEmptyParts);
+			if(equal <= 0 || axis.values.isEmpty() || !find_object::Settings::getDefaultParameters().contains(axis.key))
+			{
+				printf("Sweep not valid (should be \"Group/Parameter=a,b,c\"): %s\n", argv[i]);
+				showUsage();
+			}
+			axes.push_back(axis);
+		}
+		else
+		{
+			printf("Unrecognized option: %s\n", argv[i-1]);
+			showUsage();
+		}
+	}
+
+	if(labelsPath.isEmpty() || (sessionPath.isEmpty() && objectsPath.isEmpty()) || iterations <= 0 || warmup < 0)
+	{
+		printf("Labels and a session or objects should be set!\n");
+		showUsage();
+	}
+
+	if(axes.isEmpty())
+	{
+		Axis checks;
+		checks.key = find_object::Settings::kNearestNeighbor_search_checks();
+		checks.values << "16" << "32" << "64" << "128";
+		Axis features;
+		features.key = find_object::Settings::kFeature2D_3MaxFeatures();
+		features.values << "250" << "500" << "1000";
+		axes << checks << features;
+	}
+	int combinations = 1;
+	for(int a=0; a<axes.size(); ++a)
+	{
+		combinations *= axes[a].values.size();
+	}
+	if(combinations > maxCombinations)
+	{
+		printf("%d combinations to test, more than --max_combinations (%d)\n", combinations, maxCombinations);
+		return -1;
+	}
+
+	QCoreApplication app(argc, argv);
+
+	if(!configPath.isEmpty())
+	{
+		find_object::Settings::init(configPath);
+	}
+
+	QList<Scene> scenes;
+	if(!loadLabels(labelsPath, scenes))
+	{
+		return -1;
+	}
+	if(scenes.empty())
+	{
+		printf("No scenes in \"%s\"\n", labelsPath.toStdString().c_str());
+		return -1;
+	}
+
+	find_object::FindObject findObject(true); // images kept to re-extract features
+	if(!sessionPath.isEmpty())
+	{
+		if(!findObject.loadSession(sessionPath))
+		{
+			printf("Could not load session \"%s\"\n", sessionPath.toStdString().c_str());
+			return -1;
+		}
+	}
+	else if(!findObject.loadObjects(objectsPath))
+	{
+		printf("No objects loaded from \"%s\"\n", objectsPath.toStdString().c_str());
+		return -1;
+	}
+	fprintf(stderr, "Loaded %d objects and %d scenes, %d combinations to test\n", findObject.objects().size(), scenes.size(), combinations);
+
+	// Combinations are set from the parameters of the session
+	const find_object::ParametersMap loadedParameters = findObject.parameters();
+	for(find_object::ParametersMap::const_iterator iter=loadedParameters.begin(); iter!=loadedParameters.end(); ++iter)
+	{
+		find_object::Settings::setParameter(iter.key(), iter.value());
+	}
+	find_object::ParametersMap indexedParameters = find_object::Settings::getParameters();
+
+	QList<Result> results;
+	std::vector<int> odometer(axes.size(), 0);
+	for(int c=0; c<combinations; ++c)
+	{
+		Result result;
+		for(int a=0; a<axes.size(); ++a)
+		{
+			result.values.append(axes[a].values[odometer[a]]);
+			if(!setParameter(axes[a].key, result.values.back()))
+			{
+				return -1;
+			}
+		}
+		// next combination, the last axis changes first
+		for(int a=axes.size()-1; a>=0 && ++odometer[a] == axes[a].values.size(); --a)
+		{
+			odometer[a] = 0;
+		}
+
+		// the scenes are not consecutive frames
+		findObject.setParameters(find_object::Settings::getParameters());
+		findObject.setParameter(find_object::Settings::kGeneral_roiTracking(), false);
+		findObject.setParameter(find_object::Settings::kHomography_opticalFlowTracking(), false);
+		findObject.setParameter(find_object::Settings::kGeneral_frameChangeThreshold(), 0.0f);
+
+		// Only rebuild what the combination changes, as in MainWindow::notifyParametersChanged()
+		bool featuresChanged = false;
+		bool vocabularyChanged = false;
+		bool invertedSearch = find_object::Settings::getGeneral_invertedSearch();
+		for(int a=0; a<axes.size(); ++a)
+		{
+			const QString & key = axes[a].key;
+			if(indexedParameters.value(key) == find_object::Settings::getParameter(key))
+			{
+				continue;
+			}
+			if(key.startsWith("Feature2D/"))
+			{
+				featuresChanged = true;
+			}
+			else if((key.startsWith("NearestNeighbor/") && invertedSearch) ||
+					key.compare(find_object::Settings::kGeneral_invertedSearch()) == 0 ||
+					(key.compare(find_object::Settings::kGeneral_vocabularyIncremental()) == 0 && invertedSearch) ||
+					(key.compare(find_object::Settings::kGeneral_vocabularyFixed()) == 0 && invertedSearch) ||
+					(key.compare(find_object::Settings::kGeneral_threads()) == 0 && !invertedSearch))
+			{
+				vocabularyChanged = true;
+			}
+		}
+		if(featuresChanged)
+		{
+			findObject.updateDetectorExtractor();
+			findObject.updateObjects();
+			findObject.updateVocabulary();
+		}
+		else if(vocabularyChanged)
+		{
+			findObject.updateVocabulary();
+		}
+		indexedParameters = find_object::Settings::getParameters();
+
+		QStringList description;
+		for(int a=0; a<axes.size(); ++a)
+		{
+			description.append(QString("%1=%2").arg(axes[a].key).arg(result.values[a]));
+		}
+		fprintf(stderr, "[%d/%d] %s...", c+1, combinations, description.join(" ").toStdString().c_str());
+
+		find_object::DetectionInfo info;
+		for(int w=0; w<warmup; ++w)
+		{
+			for(int i=0; i<scenes.size(); ++i)
+			{
+				findObject.detect(scenes[i].image, info);
+			}
+		}
+		for(int n=0; n<iterations; ++n)
+		{
+			for(int i=0; i<scenes.size(); ++i)
+			{
+				findObject.detect(scenes[i].image, info);
+				result.latency.add(info.timeStamps_.value(find_object::DetectionInfo::kTimeTotal, 0.0f));
+				if(n == 0)
+				{
+					// the same objects are detected on each pass
+					QList<int> detected = info.objDetected_.uniqueKeys();
+					for(int j=0; j<detected.size(); ++j)
+					{
+						if(scenes[i].ids.contains(detected[j]))
+						{
+							++result.truePositives;
+						}
+						else
+						{
+							++result.falsePositives;
+						}
+					}
+					result.labeled += scenes[i].ids.size();
+				}
+			}
+		}
+		fprintf(stderr, " %.1f ms, recall=%.3f precision=%.3f\n", result.meanLatency(), result.recall(), result.precision());
+		results.push_back(result);
+	}
+
+	// Pareto front: no other combination is faster with the same or a better recall
+	std::vector<std::pair<double, int> > order(results.size()); // <latency, result>
+	for(int i=0; i<results.size(); ++i)
+	{
+		order[i] = std::make_pair(results[i].meanLatency(), i);
+	}
+	std::sort(order.begin(), order.end());
+	double bestRecall = -1.0;
+	int chosen = -1;
+	for(unsigned int i=0; i<order.size(); ++i)
+	{
+		Result & result = results[order[i].second];
+		if(result.recall() > bestRecall)
+		{
+			result.pareto = true;
+			bestRecall = result.recall();
+			if(chosen < 0 && result.recall() >= minRecall)
+			{
+				chosen = order[i].second;
+			}
+		}
+	}
+	if(chosen < 0)
+	{
+		// the best recall, the last of the front
+		for(unsigned int i=0; i<order.size(); ++i)
+		{
+			if(results[order[i].second].pareto)
+			{
+				chosen = order[i].second;
+			}
+		}
+		fprintf(stderr, "No combination reaches a recall of %.3f, the best recall is chosen\n", minRecall);
+	}
+	results[chosen].chosen = true;
+
+	QStringList lines;
+	QStringList header;
+	for(int a=0; a<axes.size(); ++a)
+	{
+		header << axes[a].key;
+	}
+	header << "mean_ms" << "p95_ms" << "recall" << "precision" << "pareto" << "chosen";
+	lines.append(header.join(","));
+	fprintf(stderr, "\nPareto front (latency vs recall):\n");
+	for(unsigned int i=0; i<order.size(); ++i)
+	{
+		const Result & r = results[order[i].second];
+		QStringList row = r.values;
+		row << QString::number(r.meanLatency(), 'f', 3)
+			<< QString::number(r.latency.percentile(0.95f), 'f', 3)
+			<< QString::number(r.recall(), 'f', 4)
+			<< QString::number(r.precision(), 'f', 4)
+			<< QString::number(r.pareto?1:0)
+			<< QString::number(r.chosen?1:0);
+		lines.append(row.join(","));
+		if(r.pareto)
+		{
+			fprintf(stderr, "  %s%8.2f ms  recall=%.3f precision=%.3f  %s\n",
+					r.chosen?"* ":"  ",
+					r.meanLatency(), r.recall(), r.precision(),
+					r.values.join(" ").toStdString().c_str());
+		}
+	}
+	QString csv = lines.join("\n") + "\n";
+
+	if(outputPath.isEmpty())
+	{
+		printf("%s", csv.toStdString().c_str());
+	}
+	else
+	{
+		QFile file(outputPath);
+		if(!file.open(QIODevice::WriteOnly | QIODevice::Text))
+		{
+			printf("Cannot write \"%s\"\n", outputPath.toStdString().c_str());
+			return -1;
+		}
+		file.write(csv.toUtf8());
+		fprintf(stderr, "Results written to \"%s\"\n", outputPath.toStdString().c_str());
+	}
+
+	if(!iniPath.isEmpty())
+	{
+		for(int a=0; a<axes.size(); ++a)
+		{
+			setParameter(axes[a].key, results[chosen].values[a]);
+		}
+		find_object::Settings::saveSettings(iniPath);
+		fprintf(stderr, "Parameters of the chosen combination saved to \"%s\"\n", iniPath.toStdString().c_str());
+	}
+
+	return 0;
+}
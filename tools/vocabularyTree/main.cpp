@@ -0,0 +1,222 @@
+/*
+Copyright (c) 2011-2014, Mathieu Labbe - IntRoLab - Universite de Sherbrooke
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the Universite de Sherbrooke nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QStringList>
+#include <QtCore/QTime>
+#include <opencv2/opencv.hpp>
+#include <find_object/Settings.h>
+#include <find_object/VocabularyTree.h>
+#include <find_object/utilite/ULogger.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+void showUsage()
+{
+	printf("\nfind_object-vocabulary-tree [options] --images path --output path\n"
+			"  Extract features of the images with the current parameters and train\n"
+			"  a vocabulary tree (hierarchical k-means) with them. Set the tree file\n"
+			"  in General/vocabularyTreePath to use it.\n"
+			"  Options:\n"
+			"    --images \"path\"         Directory of training images (recursive).\n"
+			"    --output \"path\"         Vocabulary tree file (*.yml, *.xml, *.yml.gz).\n"
+			"    --config \"path\"         Parameters file (*.ini) with the features to extract.\n"
+			"    --branching #           Clusters per node (default 10).\n"
+			"    --depth #               Levels of the tree (default 6), at most branching^depth words.\n"
+			"    --iterations #          k-means iterations per node (default 10).\n"
+			"    --max_descriptors #     Maximum descriptors used for training, randomly\n"
+			"                              sampled (default 0, all descriptors).\n"
+			"    --debug                 Show debug log.\n"
+			"    --help                  Show this help.\n"
+			"  Example:\n"
+			"    $ find_object-vocabulary-tree --images ./catalogue --config config.ini --branching 10 --depth 5 --output tree.yml.gz\n");
+	exit(-1);
+}
+
+void listImages(const QString & path, const QStringList & filters, QStringList & images)
+{
+	QDir dir(path);
+	QStringList names = dir.entryList(filters, QDir::Files, QDir::Name);
+	for(int i=0; i<names.size(); ++i)
+	{
+		images.append(dir.absoluteFilePath(names[i]));
+	}
+	QStringList subDirs = dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+	for(int i=0; i<subDirs.size(); ++i)
+	{
+		listImages(dir.absoluteFilePath(subDirs[i]), filters, images);
+	}
+}
+
+int main(int argc, char * argv[])
+{
+	QString imagesPath;
+	QString outputPath;
+	QString configPath;
+	int branching = 10;
+	int depth = 6;
+	int iterations = 10;
+	int maxDescriptors = 0;
+
+	ULogger::setType(ULogger::kTypeConsole);
+	ULogger::setLevel(ULogger::kInfo);
+
+	for(int i=1; i<argc; ++i)
+	{
+		QString arg = argv[i];
+		if(arg == "--help" || arg == "-help")
+		{
+			showUsage();
+		}
+		if(arg == "--debug" || arg == "-debug")
+		{
+			ULogger::setLevel(ULogger::kDebug);
+			continue;
+		}
+		if(i+1 >= argc)
+		{
+			printf("Unrecognized option or missing value: %s\n", argv[i]);
+			showUsage();
+		}
+		++i;
+		if(arg == "--images" || arg == "-images") imagesPath = argv[i];
+		else if(arg == "--output" || arg == "-output") outputPath = argv[i];
+		else if(arg == "--config" || arg == "-config") configPath = argv[i];
+		else if(arg == "--branching" || arg == "-branching") branching = atoi(argv[i]);
+		else if(arg == "--depth" || arg == "-depth") depth = atoi(argv[i]);
+		else if(arg == "--iterations" || arg == "-iterations") iterations = atoi(argv[i]);
+		else if(arg == "--max_descriptors" || arg == "-max_descriptors") maxDescriptors = atoi(argv[i]);
+		else
+		{
+			printf("Unrecognized option: %s\n", argv[i-1]);
+			showUsage();
+		}
+	}
+
+	if(imagesPath.isEmpty() || outputPath.isEmpty() || branching < 2 || depth < 1 || iterations < 1)
+	{
+		printf("Images and output should be set, with branching >= 2, depth >= 1 and iterations >= 1!\n");
+		showUsage();
+	}
+
+	QCoreApplication app(argc, argv);
+
+	if(!configPath.isEmpty())
+	{
+		find_object::Settings::init(configPath);
+	}
+
+	QStringList images;
+	listImages(imagesPath, find_object::Settings::getGeneral_imageFormats().split(' '), images);
+	if(images.isEmpty())
+	{
+		printf("No images found in \"%s\"\n", imagesPath.toStdString().c_str());
+		return -1;
+	}
+
+	find_object::Feature2D * detector = find_object::Settings::createKeypointDetector();
+	find_object::Feature2D * extractor = find_object::Settings::createDescriptorExtractor();
+	QTime time;
+	time.start();
+	cv::Mat descriptors;
+	for(int i=0; i<images.size(); ++i)
+	{
+		cv::Mat image = cv::imread(images[i].toStdString(), cv::IMREAD_GRAYSCALE);
+		if(image.empty())
+		{
+			UWARN("Cannot read \"%s\"", images[i].toStdString().c_str());
+			continue;
+		}
+		std::vector<cv::KeyPoint> keypoints;
+		cv::Mat imageDescriptors;
+		detector->detect(image, keypoints);
+		if(keypoints.size())
+		{
+			extractor->compute(image, keypoints, imageDescriptors);
+		}
+		if(!imageDescriptors.empty())
+		{
+			if(!descriptors.empty() &&
+			   (descriptors.type() != imageDescriptors.type() || descriptors.cols != imageDescriptors.cols))
+			{
+				UERROR("Descriptors of \"%s\" are not the same type/size as the previous ones!", images[i].toStdString().c_str());
+				return -1;
+			}
+			descriptors.push_back(imageDescriptors);
+		}
+		UDEBUG("%s: %d descriptors", images[i].toStdString().c_str(), imageDescriptors.rows);
+	}
+	delete detector;
+	delete extractor;
+	UINFO("Extracted %d descriptors from %d images (%d ms)", descriptors.rows, images.size(), time.restart());
+	if(descriptors.empty())
+	{
+		printf("No descriptors extracted!\n");
+		return -1;
+	}
+
+	// The vocabulary compares converted descriptors
+	if(descriptors.type() == CV_8U && find_object::Settings::getNearestNeighbor_7ConvertBinToFloat())
+	{
+		cv::Mat tmp;
+		descriptors.convertTo(tmp, CV_32F);
+		descriptors = tmp;
+	}
+
+	if(maxDescriptors > 0 && descriptors.rows > maxDescriptors)
+	{
+		cv::Mat indexes(descriptors.rows, 1, CV_32SC1);
+		for(int i=0; i<descriptors.rows; ++i)
+		{
+			indexes.at<int>(i) = i;
+		}
+		cv::RNG rng(0x12345);
+		cv::randShuffle(indexes, 1.0, &rng);
+		cv::Mat sampled(maxDescriptors, descriptors.cols, descriptors.type());
+		for(int i=0; i<maxDescriptors; ++i)
+		{
+			descriptors.row(indexes.at<int>(i)).copyTo(sampled.row(i));
+		}
+		descriptors = sampled;
+		UINFO("Sampled %d descriptors", descriptors.rows);
+	}
+
+	find_object::VocabularyTree tree;
+	if(!tree.train(descriptors, branching, depth, iterations))
+	{
+		return -1;
+	}
+	UINFO("Training time %d ms", time.restart());
+	if(!tree.save(outputPath))
+	{
+		return -1;
+	}
+	printf("Vocabulary tree saved to \"%s\" (%d words)\n", outputPath.toStdString().c_str(), tree.words().rows);
+	return 0;
+}